@@ -0,0 +1,103 @@
+#ifndef ADJ_CACHE_H_
+#define ADJ_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// The adjacency arrays of a DataGraph read out of core: they stay in the
+// .graph file and are paged in BLOCK-byte blocks of it, cut at absolute file
+// offsets, into a cache of a fixed size with CLOCK eviction. The cache is
+// split into shards by block, each under its own lock, so the threads of a
+// run share it. A miss is read with pread (O_DIRECT where the file system
+// allows it, so the blocks are not cached twice); Prefetch instead submits
+// the read to an io_uring of the calling thread and returns, and the next
+// access of the block waits for it only if it has not landed yet. Without
+// io_uring (old kernels, seccomp) Prefetch asks the kernel for readahead.
+class AdjCache {
+public:
+  static const size_t BLOCK = 1 << 16;
+
+  AdjCache();
+  ~AdjCache();
+
+  // opens path with a cache of about capacity bytes; false, reported on
+  // stderr, if it cannot be read
+  bool Open(const char* path, size_t capacity);
+  // the adjacency array of direction dir (out: true) holds count entries
+  // from byte offset of the file on
+  void SetArray(bool dir, uint64_t offset, uint64_t count) {
+    array_[dir ? 0 : 1] = offset;
+    count_[dir ? 0 : 1] = count;
+  }
+  // the bytes [ArrayBegin, ArrayEnd) of the file the array of dir takes
+  uint64_t ArrayBegin(bool dir) const { return array_[dir ? 0 : 1]; }
+  uint64_t ArrayEnd(bool dir) const { return Offset(dir, count_[dir ? 0 : 1]); }
+
+  // entry pos of the array of dir
+  int Get(bool dir, int64_t pos);
+  // copies entries [begin, end) to out
+  void Read(bool dir, int64_t begin, int64_t end, int* out);
+  // whether the sorted entries [begin, end) contain target
+  bool Contains(bool dir, int64_t begin, int64_t end, int target);
+  // starts reading the blocks of entries [begin, end) without waiting
+  void Prefetch(bool dir, int64_t begin, int64_t end);
+
+  // blocks served from the cache, read on demand and read ahead
+  uint64_t Hits() const { return hits_; }
+  uint64_t Misses() const { return misses_; }
+  uint64_t Prefetched() const { return prefetched_; }
+
+private:
+  struct Ring;
+  struct Slot {
+    int64_t block = -1;
+    enum { FREE, LOADING, READY } state = FREE;
+    bool referenced = false;
+    int pins = 0;         // readers copying out, or an asynchronous read
+    Ring* owner = nullptr; // the ring reading it, while LOADING
+    char* data = nullptr;
+  };
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<int64_t, int> index; // block -> slot
+    std::vector<Slot> slots;
+    size_t hand = 0;
+  };
+
+  // the block's data, pinned (Unpin it after use); if no slot can be had,
+  // the block is read into buf and buf returned
+  const char* Pin(int64_t block, char* buf, Shard** shard, Slot** slot);
+  void Unpin(Shard* shard, Slot* slot);
+  // a slot of shard to load a new block into, or nullptr; under its lock
+  Slot* Victim(Shard& shard);
+  // reads block of the file into out, exiting on an error
+  void ReadBlock(int64_t block, char* out);
+  // handles completions of the calling thread's ring: all there are, or,
+  // with wait, until slot is loaded
+  void Reap(Ring* ring, Slot* wait);
+  Ring* ThreadRing();
+  Shard& ShardOf(int64_t block) {
+    return shards_[(uint64_t)block * 0x9e3779b97f4a7c15ull >> 58 & (NUM_SHARDS - 1)];
+  }
+  uint64_t Offset(bool dir, int64_t pos) const {
+    return array_[dir ? 0 : 1] + (uint64_t)pos * sizeof(int);
+  }
+
+  static const int NUM_SHARDS = 64;
+  int fd_ = -1;
+  bool direct_ = false;
+  uint64_t file_size_ = 0;
+  uint64_t array_[2] = {0, 0}, count_[2] = {0, 0};
+  uint64_t id_ = 0; // tells this cache's rings from those of a former one
+  char* arena_ = nullptr;
+  std::unique_ptr<Shard[]> shards_;
+  std::mutex rings_lock_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+  std::atomic<uint64_t> hits_{0}, misses_{0}, prefetched_{0};
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef AUTO_SELECT_H_
+#define AUTO_SELECT_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "data_graph.h"
+#include "query_graph.h"
+
+namespace graph {
+
+// The method "auto" picks, per query, one of several estimators and the
+// sampling ratio it runs at so that an iteration is predicted to take no
+// longer than a latency budget. The prediction is by a cost model over cheap
+// features of the query; the model learns from the seconds the runs
+// actually took (see LinearCostModel).
+
+// What the cost of a query depends on: its size, its independent cycles, its
+// bound vertices, how many data edges carry its rarest edge label, and the
+// ratio it is sampled at (0 for methods that do not sample).
+struct QueryFeatures {
+  enum { BIAS, VERTICES, EDGES, CYCLES, BOUND, LOG_EDGES, LOG_RATIO, NUM };
+  double x[NUM];
+
+  QueryFeatures(QueryGraph& q, DataGraph& g);
+  bool Cyclic() const { return x[CYCLES] > 0; }
+};
+
+class CostModel {
+public:
+  virtual ~CostModel() {}
+  // the predicted log seconds per iteration of method on the query of x
+  virtual double LogSeconds(const std::string& method,
+                            const double* x) const = 0;
+  // learns that an iteration of method on the query of x took seconds
+  virtual void Observe(const std::string& method, const double* x,
+                       double seconds) = 0;
+};
+
+// Log seconds linear in the features, per method. The weights start from
+// rough built-in ones (zero for a method it has none for) and are refitted
+// by ridge regression towards them with every observation, so a few runs
+// adjust them and many replace them. Observations persist as "METHOD
+// VERTICES EDGES CYCLES BOUND LOG_EDGES LOG_RATIO SECONDS" lines.
+class LinearCostModel : public CostModel {
+public:
+  LinearCostModel();
+
+  double LogSeconds(const std::string& method, const double* x) const;
+  void Observe(const std::string& method, const double* x, double seconds);
+
+  // observes every line of the file at path, if there is one
+  void ReadLog(const char* path);
+  // appends the observation to the file at path
+  static void AppendLog(const char* path, const std::string& method,
+                        const double* x, double seconds);
+
+private:
+  static const int NUM = QueryFeatures::NUM;
+  struct Weights {
+    double prior[NUM] = {};
+    double w[NUM] = {};
+    // sums of the observations' x x^T and x log(seconds)
+    double xtx[NUM][NUM] = {};
+    double xty[NUM] = {};
+  };
+  std::map<std::string, Weights> weights_;
+};
+
+// An estimator "auto" may pick: whether it samples (runs at a ratio), and
+// whether it suits cyclic queries; one that does not is only picked for
+// them if nothing else fits the budget.
+struct AutoCandidate {
+  std::string method;
+  bool samples;
+  bool cyclic;
+};
+
+struct AutoChoice {
+  int candidate; // index into the candidates
+  double ratio;
+  double log_seconds; // as predicted
+};
+
+// the smallest ratio tried below the given one
+const int AUTO_MAX_RATIO_CUT = 64;
+
+// The first of candidates, in order of preference, predicted to run an
+// iteration within budget seconds, sampling at the largest of ratio,
+// ratio / 2, ... down to ratio / AUTO_MAX_RATIO_CUT that does; the one
+// predicted fastest if none fits. f's LOG_RATIO is set to the choice.
+AutoChoice ChooseEstimator(const CostModel& model,
+                           const std::vector<AutoCandidate>& candidates,
+                           QueryFeatures& f, double budget, double ratio);
+
+}  // namespace graph
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "sketch.h"
 
+namespace relational {
+
 struct BoundFormula {
 	int index;
 	vector<Sketch*> uncList;
@@ -10,16 +12,241 @@ struct BoundFormula {
 	vector<int> activeL; //global attribute ids
 	vector<int> hash_sizes; //global attribute id to hash sizes
 
+	//compiled form: the partitioned attributes (hash size > 1) in global id
+	//order, the last one innermost, and per sketch the offset a step along
+	//each of them moves its counts by, so a bucket combination maps to one
+	//offset per sketch without building index vectors or calling access()
+	vector<int> dims; //hash sizes, outermost first
+	vector<const int*> counts; //per sketch: uncList, then conList
+	vector<long> strides; //[dim][sketch]
+	long rows; //combinations of all dims but the innermost
+	int inner; //size of the innermost dim, 1 if there is none
+	//narrowest accumulator the largest possible sum (the product of the
+	//sketch maxima times the number of buckets) cannot overflow; long
+	//vectorises best, doubles only round beyond 2^127
+	enum SumWidth { SUM_LONG, SUM_INT128, SUM_DOUBLE } width;
+	//sparse form, when a sketch is sparse (see OfflineSketch::write): a
+	//join of the sketches' non-zero buckets instead of the loop over every
+	//combination. The sketches in join order, the one with the fewest
+	//non-zero buckets (the driver) first, then each with the fewest dims
+	//not bound by those before it; per sketch the dim of each local dim, -1
+	//if unpartitioned. rows is the driver's nnz and inner 1, so sum() takes
+	//ranges of its non-zero buckets.
+	bool sparse;
+	vector<Sketch*> join;
+	vector<int> join_dims; //[sketch][2]
+	long free_dims; //combinations of the dims no sketch partitions
+
 	BoundFormula(int _index, vector<Sketch*>& _uncList, vector<Sketch*>& _conList, vector<int>& _activeL, vector<int>& _hash_sizes) :
-		index(_index), uncList(_uncList), conList(_conList), activeL(_activeL), hash_sizes(_hash_sizes) {}
+		index(_index), uncList(_uncList), conList(_conList), activeL(_activeL), hash_sizes(_hash_sizes) {
+		compile();
+	}
 
-	long execute(vector<int> indices) {
-		long prod = 1;
+	void compile() {
+		vector<int> dim_of(hash_sizes.size(), -1);
+		dims.clear();
+		for (int i = 0; i < hash_sizes.size(); i++) {
+			if (hash_sizes[i] > 1) {
+				dim_of[i] = dims.size();
+				dims.push_back(hash_sizes[i]);
+			}
+		}
+		counts.clear();
 		for (Sketch* s : uncList)
-			prod *= s->access(index, -1, indices);
-		for (int i = 0; i < conList.size(); i++)
-			prod *= conList[i]->access(index, activeL[i], indices);
-		return prod;
+			counts.push_back(s->data);
+		for (Sketch* s : conList)
+			counts.push_back(s->data);
+
+		int num = counts.size();
+		vector<Sketch*> sketches(uncList);
+		sketches.insert(sketches.end(), conList.begin(), conList.end());
+		strides.assign(dims.size() * num, 0);
+		for (int k = 0; k < num; k++) {
+			Sketch* s = sketches[k];
+			//local dim l of a sketch is row-major over its hash sizes
+			for (auto& p : s->l2gIndex[index]) {
+				long stride = 1;
+				for (int j = p.first + 1; j < s->hash_sizes.size(); j++)
+					stride *= s->hash_sizes[j];
+				int d = dim_of[p.second];
+				if (d >= 0)
+					strides[d * num + k] += stride;
+			}
+		}
+		rows = 1;
+		for (int d = 0; d + 1 < dims.size(); d++)
+			rows *= dims[d];
+		inner = dims.empty() ? 1 : dims.back();
+
+		double log_bound = log2((double) rows * inner);
+		for (Sketch* s : sketches) {
+			int mx = 0;
+			s->scan(0, s->size(), [&](int, int c) { mx = std::max(mx, c); });
+			log_bound += log2((double) std::max(mx, 1));
+		}
+		width = log_bound < 62 ? SUM_LONG : log_bound < 126 ? SUM_INT128 : SUM_DOUBLE;
+
+		sparse = false;
+		for (Sketch* s : sketches)
+			sparse = sparse || s->nnz >= 0;
+		if (sparse)
+			compileJoin(sketches, dim_of);
+	}
+
+	void compileJoin(const vector<Sketch*>& sketches, const vector<int>& dim_of) {
+		int num = sketches.size();
+		auto entries = [](Sketch* s) { return s->nnz >= 0 ? (long) s->nnz : (long) s->size(); };
+		vector<vector<int>> local(num);
+		for (int k = 0; k < num; k++) {
+			Sketch* s = sketches[k];
+			local[k].assign(2, -1);
+			for (auto& p : s->l2gIndex[index])
+				local[k][p.first] = dim_of[p.second];
+		}
+		vector<bool> bound(dims.size(), false), used(num, false);
+		join.clear();
+		join_dims.clear();
+		for (int step = 0; step < num; step++) {
+			int best = -1, best_new = 0;
+			for (int k = 0; k < num; k++) {
+				if (used[k] || (step == 0 && sketches[k]->nnz < 0))
+					continue;
+				int fresh = 0;
+				for (int d : local[k])
+					fresh += d >= 0 && !bound[d];
+				bool fewer = best >= 0 && entries(sketches[k]) < entries(sketches[best]);
+				if (best < 0 || (step == 0 ? fewer : fresh < best_new || (fresh == best_new && fewer))) {
+					best = k;
+					best_new = fresh;
+				}
+			}
+			used[best] = true;
+			join.push_back(sketches[best]);
+			for (int d : local[best]) {
+				join_dims.push_back(d);
+				if (d >= 0)
+					bound[d] = true;
+			}
+		}
+		free_dims = 1;
+		for (int d = 0; d < dims.size(); d++)
+			if (!bound[d])
+				free_dims *= dims[d];
+		rows = join[0]->nnz;
+		inner = 1;
+	}
+
+	//sum over the bucket combinations in rows [begin, end) of the product of
+	//the sketch counts, exact while it fits the type chosen by compile()
+	double sum(long begin, long end) const {
+		switch (width) {
+		case SUM_LONG:
+			return (double) sumAs<long>(begin, end);
+		case SUM_INT128:
+			return (double) sumAs<__int128>(begin, end);
+		default:
+			return sumAs<double>(begin, end);
+		}
+	}
+
+	template <typename T>
+	T sumAs(long begin, long end) const {
+		if (sparse) {
+			vector<int> at(dims.size(), -1);
+			T res = 0;
+			for (long i = begin; i < end; i++)
+				visit<T>(0, join[0]->nz_ids[i], join[0]->nz_counts[i], at, 1, res);
+			return res * (T) free_dims;
+		}
+		int num = counts.size();
+		int outer = (int) dims.size() - 1;
+		vector<int> idx(std::max(outer, 0));
+		vector<long> off(num, 0);
+		vector<T> prod(inner);
+		long r = begin;
+		for (int d = outer - 1; d >= 0; d--) {
+			idx[d] = r % dims[d];
+			r /= dims[d];
+		}
+		for (int d = 0; d < outer; d++)
+			for (int k = 0; k < num; k++)
+				off[k] += idx[d] * strides[d * num + k];
+
+		T res = 0;
+		for (long row = begin; row < end; row++) {
+			for (int i = 0; i < inner; i++)
+				prod[i] = 1;
+			for (int k = 0; k < num; k++) {
+				const int* c = counts[k] + off[k];
+				long step = outer >= 0 ? strides[outer * num + k] : 0;
+				for (int i = 0; i < inner; i++)
+					prod[i] *= c[i * step];
+			}
+			for (int i = 0; i < inner; i++)
+				res += prod[i];
+
+			for (int d = outer - 1; d >= 0; d--) {
+				for (int k = 0; k < num; k++)
+					off[k] += strides[d * num + k];
+				if (++idx[d] < dims[d])
+					break;
+				for (int k = 0; k < num; k++)
+					off[k] -= strides[d * num + k] * dims[d];
+				idx[d] = 0;
+			}
+		}
+		return res;
+	}
+
+	//binds the dims of bucket b of join[k], whose count is c, unless they
+	//contradict those bound already, and goes on with the next sketch
+	template <typename T>
+	void visit(size_t k, int b, int c, vector<int>& at, T prod, T& res) const {
+		Sketch* s = join[k];
+		int hs1 = s->hash_sizes.size() == 2 ? s->hash_sizes[1] : 1;
+		int coord[2] = {b / hs1, b % hs1};
+		int fresh[2], num_fresh = 0;
+		bool ok = true;
+		for (int l = 0; l < 2 && ok; l++) {
+			int d = join_dims[2 * k + l];
+			if (d < 0)
+				ok = coord[l] == 0;
+			else if (at[d] >= 0)
+				ok = at[d] == coord[l];
+			else {
+				at[d] = coord[l];
+				fresh[num_fresh++] = d;
+			}
+		}
+		if (ok)
+			joinFrom<T>(k + 1, at, prod * (T) c, res);
+		for (int i = 0; i < num_fresh; i++)
+			at[fresh[i]] = -1;
+	}
+
+	//the non-zero buckets of join[k] that agree with the dims bound so far:
+	//one lookup if they bind all its dims, the run of its first dim's value
+	//if they bind that one, all of them otherwise
+	template <typename T>
+	void joinFrom(size_t k, vector<int>& at, T prod, T& res) const {
+		if (k == join.size()) {
+			res += prod;
+			return;
+		}
+		Sketch* s = join[k];
+		int hs1 = s->hash_sizes.size() == 2 ? s->hash_sizes[1] : 1;
+		int d0 = join_dims[2 * k], d1 = join_dims[2 * k + 1];
+		bool known0 = d0 < 0 || at[d0] >= 0, known1 = d1 < 0 || at[d1] >= 0;
+		int c0 = d0 < 0 ? 0 : at[d0], c1 = d1 < 0 ? 0 : at[d1];
+		int lo = 0, hi = s->size();
+		if (known0 && known1) {
+			lo = c0 * hs1 + c1;
+			hi = lo + 1;
+		} else if (known0) {
+			lo = c0 * hs1;
+			hi = lo + hs1;
+		}
+		s->scan(lo, hi, [&](int b, int c) { visit<T>(k, b, c, at, prod, res); });
 	}
 
 	void print() {
@@ -57,53 +284,6 @@ struct BoundFormula {
 	}
 };
 
-struct CrossProductIterator {
-	vector<int> hashSizes;
-	vector<int> indices;
-	int totalBuckets;
-	int count;
-	vector<int> notOne;
-
-	CrossProductIterator(vector<int>& _hashSizes) : 
-		hashSizes(_hashSizes), indices(_hashSizes.size()) 
-	{
-		totalBuckets = 1;
-		for (int h : hashSizes)
-			totalBuckets *= h;
-		count = 0;
-
-		int numNotOnes = 0;
-		for (int h : hashSizes)
-			if (h != 1)
-				numNotOnes++;
-		notOne.resize(numNotOnes);
-		int currPos = 0;
-		for (int i = hashSizes.size() - 1; i > -1; i--) {
-			if (hashSizes[i] > 1) {
-				notOne[currPos] = i;
-				currPos++;
-			}
-		}
-		if (notOne.size() > 0)
-			indices[notOne[0]] = -1;
-	}
-
-	bool hasNext() {
-		return count < totalBuckets;
-	}
-
-	vector<int> next() {
-		for (int i : notOne) {
-			if (indices[i] < hashSizes[i]-1) {
-				indices[i]++;
-				count++;
-				break;
-			}
-			else
-				indices[i] = 0;
-		}
-		return indices;
-	}
-};
+}  // namespace relational
 
 #endif
@@ -3,6 +3,9 @@
 
 #include "../include/estimator.h"
 #include "../include/bound_formula.h"
+#include "../include/mmap_file.h"
+
+namespace relational {
 
 class BoundSketch : public Estimator {
 public:
@@ -26,10 +29,38 @@ private:
 	void getJoinAttributeCovers();
 	void getJoinAttributeCovers(int);
 	void getBoundFormulae();
+	double minBoundFormula();
+	void evictSketches();
+	void buildSketches(const vector<OfflineSketch*>&);
+	void saveSketches(FILE*, int);
+	int loadSketches(FILE*);
+
+	//build mode: tables built between checkpoints, at least
+	static const size_t CHECKPOINT_ROWS = 1 << 24;
+	//checkpoint: CHECKPOINT_MAGIC, CHECKPOINT_VERSION, buckets, #tables,
+	//#built, then the rows of every table as uint64s and the counts of the
+	//built ones (see OfflineSketch::save)
+	static const int CHECKPOINT_MAGIC = 0x4b434253; //"SBCK"
+	static const int CHECKPOINT_VERSION = 1;
 
-	unordered_map<string, Sketch*> sketch_map_;
+	SketchMap sketch_map_;
+	//ONLINE: the sketches built online stay in sketch_map_ across the
+	//queries of a server run in-process (--no-fork), at most
+	//GCARE_BSK_CACHE of them (default 4096) left between queries, evicting
+	//the least recently used
+	unordered_map<SketchKey, long, SketchKeyHash> last_use_;
+	long num_queries_;
+	size_t cache_capacity_;
 	vector<OfflineSketch*> offline_skethces_; 
+	char* summary_; //mapped sketch archive the query mode sketches point into
+	size_t summary_size_;
+	LoadMode summary_mode_;
+	//table -> its entries in the archive not yet in sketch_map_: a table's
+	//sketches are made, and with GCARE_SUMMARY_LAZY=1 read in, when a
+	//query first looks one up
+	vector<vector<int>> archive_entries_;
 	int buckets_;
+	int built_buckets_; //the budget the read summary was built for, 0 if unknown
 	int bf_index_;
 	vector<vector<int>> covers_; //query's join attribute -> vector of covering relations
 	vector<int> join_attribute_cnt_; //relation -> # covering join attributes in query
@@ -39,7 +70,11 @@ private:
 	vector<unordered_map<int, vector<int>>> rel_to_covered_attributes_; //vector of relation -> covering join attributes mappings
 	vector<BoundFormula> bound_formulae_;
 	double sketch_build_time_;
+	bool prune_; //GCARE_BSK_PRUNE=0 evaluates every formula as a substructure
+	double pruned_card_; //minimum over the formulae in pruned mode, else -1
 };
 
+}  // namespace relational
+
 #endif
 
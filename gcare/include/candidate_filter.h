@@ -0,0 +1,42 @@
+#ifndef CANDIDATE_FILTER_H_
+#define CANDIDATE_FILTER_H_
+
+#include <cstdint>
+#include <vector>
+#include "data_graph.h"
+#include "query_graph.h"
+#include "rng.h"
+
+namespace graph {
+
+// Per query vertex, the data vertices that can take part in a match: they
+// carry its vertex label and binding, have an edge of every label and
+// direction incident to it, and (after one refinement round) a candidate
+// neighbour along each of its query edges. Sound for homomorphisms and
+// embeddings alike, so walks that only step onto candidates reach every
+// match and stay unbiased once their probabilities count candidates only.
+class CandidateFilter {
+public:
+	void Build(DataGraph&, QueryGraph&);
+	bool Empty() const { return bits_.empty(); }
+
+	inline bool Pass(int u, int v) const {
+		return bits_[u][v >> 6] >> (v & 63) & 1;
+	}
+	//the candidate tuples of an edge label (src of u, dst of w) or, for
+	//w < 0, of a vertex label (as (v, v)), flattened into out
+	void Tuples(int label, int u, int w, vector<int>& out);
+	//a uniform candidate of w among the (v, el, dir) neighbours into *other;
+	//returns their number (0: none drawn)
+	int PickAdj(int v, int el, bool dir, int w, Rng&, int* other);
+	//number of candidates of w among the (v, el, dir) neighbours
+	int CountAdj(int v, int el, bool dir, int w);
+
+private:
+	DataGraph* g_;
+	vector<vector<uint64_t>> bits_; //query vertex -> bitset over data vertices
+};
+
+}  // namespace graph
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef CHUNKED_FILE_H_
+#define CHUNKED_FILE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// A data file (a .graph binary, a summary) stored compressed in fixed-size
+// blocks, so that LoadFile can read and inflate the blocks on all threads
+// at once, straight into the buffer the file is loaded to:
+//   ChunkedHeader; uint64 offsets[blocks + 1] (of the blocks in the file);
+//   the blocks, each a deflate stream of block_size bytes of the file (the
+//   last one of the rest)
+// LoadFile tells such a file by its magic, so either form of a file loads
+// the same; CompressFile turns a file into this form (gcare -b --compress).
+struct ChunkedHeader {
+	char magic[8];
+	uint32_t codec;
+	uint32_t block_size;
+	uint64_t size; //of the file inflated
+	uint64_t blocks;
+};
+
+const char CHUNKED_MAGIC[8] = {'G', 'C', 'A', 'R', 'E', 'C', 'Z', '1'};
+const uint32_t CHUNKED_DEFLATE = 1;
+const uint32_t CHUNKED_BLOCK_SIZE = 4 << 20;
+
+inline bool ReadChunkedHeader(int fd, ChunkedHeader& h) {
+	return pread(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h)
+		&& memcmp(h.magic, CHUNKED_MAGIC, sizeof(CHUNKED_MAGIC)) == 0;
+}
+
+inline bool IsChunkedFile(const char* fn) {
+	int fd = open(fn, O_RDONLY);
+	if (fd == -1)
+		return false;
+	ChunkedHeader h;
+	bool chunked = ReadChunkedHeader(fd, h);
+	close(fd);
+	return chunked;
+}
+
+inline bool ValidChunkedHeader(const char* fn, const ChunkedHeader& h) {
+	uint64_t block = h.block_size;
+	if (h.codec == CHUNKED_DEFLATE && block > 0 && h.blocks == (h.size + block - 1) / block)
+		return true;
+	fprintf(stderr, "%s: unknown chunked format\n", fn);
+	return false;
+}
+
+// Inflates the chunked file fd, of header h, into dst (of h.size bytes),
+// the blocks read and inflated in parallel
+inline bool ReadChunked(int fd, const char* fn, const ChunkedHeader& h, char* dst) {
+	uint64_t block = h.block_size;
+	std::vector<uint64_t> offsets(h.blocks + 1);
+	ssize_t index_size = sizeof(uint64_t) * offsets.size();
+	if (pread(fd, offsets.data(), index_size, sizeof(h)) != index_size) {
+		perror(fn);
+		return false;
+	}
+	int failed = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(| : failed)
+	for (uint64_t b = 0; b < h.blocks; b++) {
+		if (offsets[b + 1] < offsets[b]) {
+			failed = 1;
+			continue;
+		}
+		size_t in_size = offsets[b + 1] - offsets[b];
+		std::vector<Bytef> in(in_size);
+		size_t done = 0;
+		while (done < in_size) {
+			ssize_t n = pread(fd, in.data() + done, in_size - done, offsets[b] + done);
+			if (n <= 0)
+				break;
+			done += n;
+		}
+		uLongf out_size = std::min<uint64_t>(block, h.size - b * block);
+		uLongf expected = out_size;
+		failed |= done != in_size
+			|| uncompress((Bytef*) dst + b * block, &out_size, in.data(), in_size) != Z_OK
+			|| out_size != expected;
+	}
+	if (failed)
+		fprintf(stderr, "%s: corrupt chunked file\n", fn);
+	return !failed;
+}
+
+// Rewrites the file fn in the chunked form, the blocks deflated in
+// parallel at level (zlib's, 1 to 9); false, leaving fn as it was, on
+// failure. A file already chunked is left alone
+inline bool CompressFile(const char* fn, int level = Z_DEFAULT_COMPRESSION) {
+	if (IsChunkedFile(fn))
+		return true;
+	FILE* fp = fopen(fn, "rb");
+	if (fp == nullptr) {
+		perror(fn);
+		return false;
+	}
+	std::vector<char> data;
+	char buf[1 << 16];
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0;)
+		data.insert(data.end(), buf, buf + n);
+	fclose(fp);
+
+	ChunkedHeader h;
+	memcpy(h.magic, CHUNKED_MAGIC, sizeof(CHUNKED_MAGIC));
+	h.codec = CHUNKED_DEFLATE;
+	h.block_size = CHUNKED_BLOCK_SIZE;
+	h.size = data.size();
+	h.blocks = (h.size + h.block_size - 1) / h.block_size;
+	std::vector<std::vector<Bytef>> blocks(h.blocks);
+	int failed = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(| : failed)
+	for (uint64_t b = 0; b < h.blocks; b++) {
+		uLong in_size = std::min<uint64_t>(h.block_size, h.size - b * h.block_size);
+		uLongf out_size = compressBound(in_size);
+		blocks[b].resize(out_size);
+		failed |= compress2(blocks[b].data(), &out_size,
+			(const Bytef*) data.data() + b * h.block_size, in_size, level) != Z_OK;
+		blocks[b].resize(out_size);
+	}
+	if (failed) {
+		fprintf(stderr, "%s: cannot compress\n", fn);
+		return false;
+	}
+	std::vector<uint64_t> offsets(1, sizeof(h) + sizeof(uint64_t) * (h.blocks + 1));
+	for (auto& block : blocks)
+		offsets.push_back(offsets.back() + block.size());
+	std::string tmp = std::string(fn) + ".chunked";
+	fp = fopen(tmp.c_str(), "wb");
+	bool ok = fp != nullptr && fwrite(&h, sizeof(h), 1, fp) == 1
+		&& fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), fp) == offsets.size();
+	for (size_t b = 0; ok && b < blocks.size(); b++)
+		ok = fwrite(blocks[b].data(), 1, blocks[b].size(), fp) == blocks[b].size();
+	if (fp != nullptr)
+		ok = fclose(fp) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), fn) != 0) {
+		perror(tmp.c_str());
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+#endif
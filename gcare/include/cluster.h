@@ -0,0 +1,59 @@
+#ifndef CLUSTER_H_
+#define CLUSTER_H_
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "registry.h"
+
+// Distributed sampling over plain TCP. Workers (gcare -q --listen PORT) keep
+// the data and the summaries loaded, each from its own copy, and a driver
+// (gcare -q --workers host:port,...) sends every query to all of them.
+// Worker w of n samples at ratio / n with seeds of its own, seed + w *
+// iterations onwards, and the driver merges the workers' estimates of an
+// iteration into their mean weighted by the substructures each sampled.
+// For estimators that average their samples (wj, jsub, impr) that is the
+// mean over all the samples, so the estimator maths stay untouched.
+//
+// A request is the line "query METHOD RATIO SEED ITERATIONS TIMEOUT
+// PARTIAL", the query's "v ..."/"e ..." lines and "end"; the reply is "ok
+// N" and per iteration "EST SAMPLES TIME PARTIAL", or "error MESSAGE".
+class Cluster {
+public:
+  ~Cluster();
+
+  // whether method samples at ratio and may be split between workers (wj,
+  // jsub, impr, cs); for the others -p is no sampling ratio, e.g. bsk's
+  // bucket budget, or they do the same full work on every worker
+  static bool Splits(const std::string& method);
+
+  // connects to every host:port; false, reported on stderr, if any fails
+  bool Connect(const std::vector<std::string>& workers);
+
+  // runs the iterations of query_params on the query in text over all
+  // workers and averages the merged iterations into est; time is the
+  // wall-clock time per iteration. False on an error or timeout of any
+  // worker, reported on stderr.
+  bool Query(const std::string& method, const std::vector<std::string>& text,
+             const QueryParams& query_params, double& est, double& time,
+             bool& partial);
+
+private:
+  struct Connection {
+    std::string address;
+    FILE* in = nullptr;
+    FILE* out = nullptr;
+  };
+  std::vector<Connection> workers_;
+};
+
+// The worker side: serves the connections to port one after another, each
+// until it closes, running requests with the runner of their method.
+// query_params gives how iterations run (fork, threads); false if port
+// cannot be listened on.
+bool ServeWorker(int port, std::map<std::string, Runner*>& runners,
+                 const QueryParams& query_params);
+
+#endif
@@ -8,13 +8,24 @@
 #include <vector>
 #include <random>
 
+namespace relational {
 
+// Without a summary every attribute a gets hash functions h_a of its own
+// and a sample scans the tables. The summary (-b -m cs) holds one base hash
+// H of every value and, per table and column, the row ids ordered by H of
+// the value; a query then hashes with h_a(x) = (H(x) + shift_a) mod 2^32
+// for random shifts, so
+// the rows of a sample on a form one or two runs of that order. The shifts
+// are independent and uniform, so the estimate stays unbiased, and the
+// summary does not depend on the ratio or seed.
 class CorrelatedSampling: public Estimator {
 public:
-    void PrepareSummaryStructure(DataGraph&, double) {}
-    void WriteSummary(const char*) {}
+    void PrepareSummaryStructure(DataGraph&, double);
+    void WriteSummary(const char*);
+    bool FixedSummary() { return true; }
 
-    void ReadSummary(const char*) {}
+    void ReadSummary(const char*);
+    bool ShareSummary(const Estimator&);
 
     void Init();
     int DecomposeQuery() { num_subqueries_ = 1; status_ = true; return 1; }
@@ -24,7 +35,24 @@ public:
 	return card_vec_[0];
     }
     double GetSelectivity() { return 1; }
+    bool Nests() { return true; }
+protected:
+    double AggCardAt(int, double);
 private:
+    void JoinProbs(double, std::vector<bool>&, std::vector<double>&);
+    uint32_t BaseHash(int) const;
+    uint32_t AttrHash(int, int) const;
+    bool SummaryRows(int, int, int, uint64_t, size_t, std::vector<int>&) const;
+    // built summary: value -> base hash, table * 2 + column -> row ids
+    std::vector<uint32_t> hash_column_;
+    std::vector<std::vector<int>> orders_;
+    bool scan_only_ = false; // build mode: the summary did not fit the byte budget
+    std::shared_ptr<LoadedFile> summary_; // mapped summary, shared by the instances
+    const uint32_t* hashes_ = nullptr; // value -> base hash
+    uint32_t num_values_ = 0;
+    std::vector<std::pair<const int*, size_t>> columns_; // table * 2 + column -> row ids
+    std::pair<uint64_t, uint64_t> base_seed_;
+    std::vector<uint32_t> shifts_;
     std::vector<Relation<int>> samples_;
     std::vector<std::pair<uint64_t,uint64_t>> seeds_;
     bool status_;
@@ -32,9 +60,8 @@ private:
     std::vector<double> pmins_;
     int m3_;
     uint64_t EstCard_(DataGraph&, QueryGraph&);
-    double Hash(std::pair<uint64_t, uint64_t> &, int);
 };
 
-
+}  // namespace relational
 
 #endif
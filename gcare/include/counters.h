@@ -0,0 +1,95 @@
+#ifndef COUNTERS_H_
+#define COUNTERS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Hot-path counters and timers, compiled in with -DGCARE_COUNTERS (cmake
+// -DGCARE_COUNTERS=ON) and no-ops otherwise. Each thread counts into its own
+// Counters, which the backend clears before and collects after every
+// iteration into its QueryResult, so forked children report theirs too.
+struct Counters {
+  uint64_t get_adj = 0;         // DataGraph::GetAdj
+  uint64_t has_edge = 0;        // DataGraph::HasEdge
+  uint64_t edge_filter_misses = 0; // HasEdge calls its edge filter answered
+  uint64_t label_search = 0;    // GetELabelIndex, HasVLabel
+  uint64_t substructures = 0;   // GetSubstructure() calls that found one
+  uint64_t walk_steps = 0;      // tuples drawn by random walks
+  uint64_t rejected_walks = 0;  // samples with an estimate of 0
+  uint64_t memo_hits = 0;       // MemoTable::Find
+  uint64_t memo_misses = 0;
+  uint64_t join_rows = 0;       // matches and join results enumerated
+  uint64_t get_substructure_ns = 0;
+  uint64_t est_card_ns = 0;
+
+  void Clear() { *this = Counters(); }
+
+  void Add(const Counters& o) {
+    get_adj += o.get_adj;
+    has_edge += o.has_edge;
+    edge_filter_misses += o.edge_filter_misses;
+    label_search += o.label_search;
+    substructures += o.substructures;
+    walk_steps += o.walk_steps;
+    rejected_walks += o.rejected_walks;
+    memo_hits += o.memo_hits;
+    memo_misses += o.memo_misses;
+    join_rows += o.join_rows;
+    get_substructure_ns += o.get_substructure_ns;
+    est_card_ns += o.est_card_ns;
+  }
+
+  std::string ToJson() const {
+    std::string s = "{";
+    auto field = [&s](const char* name, uint64_t v) {
+      if (s.size() > 1) s += ",";
+      s += std::string("\"") + name + "\":" + std::to_string(v);
+    };
+    field("get_adj", get_adj);
+    field("has_edge", has_edge);
+    field("edge_filter_misses", edge_filter_misses);
+    field("label_search", label_search);
+    field("substructures", substructures);
+    field("walk_steps", walk_steps);
+    field("rejected_walks", rejected_walks);
+    field("memo_hits", memo_hits);
+    field("memo_misses", memo_misses);
+    field("join_rows", join_rows);
+    field("get_substructure_ns", get_substructure_ns);
+    field("est_card_ns", est_card_ns);
+    return s + "}";
+  }
+};
+
+inline Counters& ThreadCounters() {
+  static thread_local Counters counters;
+  return counters;
+}
+
+// adds the nanoseconds of its lifetime to a field of ThreadCounters()
+class CounterTimer {
+public:
+  explicit CounterTimer(uint64_t Counters::*field)
+      : field_(field), start_(std::chrono::steady_clock::now()) {}
+  ~CounterTimer() {
+    ThreadCounters().*field_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+  }
+
+private:
+  uint64_t Counters::*field_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#ifdef GCARE_COUNTERS
+#define GCARE_COUNT(name) (++ThreadCounters().name)
+#define GCARE_COUNT_N(name, n) (ThreadCounters().name += (n))
+#define GCARE_TIMER(name) CounterTimer name##_timer(&Counters::name)
+#else
+#define GCARE_COUNT(name) ((void)0)
+#define GCARE_COUNT_N(name, n) ((void)0)
+#define GCARE_TIMER(name) ((void)0)
+#endif
+
+#endif
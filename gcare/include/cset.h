@@ -4,12 +4,19 @@
 #include <algorithm>
 #include <vector>
 #include "estimator.h" 
+#include "mmap_file.h"
+
+namespace graph {
 
 class CharacteristicSets : public Estimator {
 public:
 	//build mode
 	void PrepareSummaryStructure(DataGraph&, double); 
 	void WriteSummary(const char*); 
+	//unless GCARE_CSET_SAMPLE builds it from a sample of ratio of the vertices
+	bool FixedSummary();
+	unsigned DataSections() { return SECTION_OUT | SECTION_IN | SECTION_VLABELS; }
+	bool UpdateSummary(DataGraph&, const char*, const char*);
 	
 	//query mode
 	void Init();
@@ -19,6 +26,7 @@ public:
 	double EstCard(int);
 	double AggCard();
 	double GetSelectivity();
+	string SubqueryKey(int);
 	
 	struct CSet {
 		int vid_;
@@ -28,7 +36,78 @@ public:
 		CSet() : count_(0) { freq_.clear(); }
 	};
 
+	//query mode: the sets as laid out in the (mapped) summary
+	struct FlatCSets {
+		int size = 0;
+		const int* count;
+		const int* vid;
+		const int* freq_offset; //size + 1 entries into freq
+		const int* freq;
+
+		int Freq(int i, int j) const { return freq[freq_offset[i] + j]; }
+	};
+
+	//query mode: inverted index from a label to the ascending ids of the
+	//sets whose vertices have it, so that superset matching for a star only
+	//touches the sets having all of its labels; next to each id, the slot
+	//of the label's frequency in the set's freq, so that estimating a star
+	//needs no lookup of the label in the data graph
+	struct Postings {
+		int num_keys = 0;
+		const int* offset; //key -> begin in ids, key + 1 -> end
+		const int* ids;
+		const int* slots; //parallel to ids
+
+		range Get(int key) const {
+			range r;
+			if (key < 0 || key >= num_keys) {
+				r.begin = r.end = nullptr;
+			} else {
+				r.begin = ids + offset[key];
+				r.end   = ids + offset[key + 1];
+			}
+			return r;
+		}
+		//the slots of the ids Get(key) gives
+		const int* Slots(int key) const { return slots + offset[key]; }
+	};
+
+	//query mode: vertex -> id of its set, packed into bits bits each
+	struct VertexMap {
+		int n = 0; //vertices, 0 if the summary has no map
+		int bits = 0;
+		const uint64_t* words;
+
+		int Get(int v) const {
+			if (bits == 0) return 0;
+			uint64_t at = (uint64_t)v * bits;
+			uint64_t w = words[at / 64] >> (at % 64);
+			if (at % 64 + bits > 64) w |= words[at / 64 + 1] << (64 - at % 64);
+			return (int)(w & ((1ull << bits) - 1));
+		}
+	};
+
+	CharacteristicSets() : write_vertex_map_(false), summary_(nullptr), summary_size_(0), postings_built_(false) {}
+
+	//query mode: binary summaries of version 3 on are shared as they are
+	bool ShareSummary(const Estimator&);
+
 private:
+	static const int CSET_MAGIC = 0x53534343; //"CCSS"
+	static const int CSET_VERSION = 5;
+	//histogram rows start on this many ints (64 bytes) in the summary file
+	static const int HIST_ALIGN = 16;
+
+	void sampleStars(DataGraph&, double, vector<double>&);
+	void readTextSummary(const char*);
+	void loadForUpdate(DataGraph&, const char*);
+	void findCandidates(vector<int>&, const Postings&, int);
+	void estimateStars(int);
+	void fetchSections();
+	const int* HistRow(int label, int c) const {
+		return hist_data_ + ((size_t)label * 2 + c) * hist_stride_;
+	}
+	int Hist(int label, int c, int b) const { return HistRow(label, c)[b]; }
 	double getNodeSelectivity(int);
 	double getPairwiseSelectivity(int, int);
 
@@ -52,13 +131,47 @@ private:
 	vector<vector<Triple>> rdf_q_adj_lists_, rdf_q_rev_adj_lists_;  
 	vector<vector<bool>> join_q_adj_mat_;
 	
+	//build mode
 	//csets_[i]: i'th forward characteristic set, rev_csets_[i]: i'th backward
 	vector<CSet> csets_, rev_csets_; 
-	int pos_; //index to csets_ or rev_csets_
+	//vertex -> index to csets_ ([0]) or rev_csets_ ([1]), written next to the
+	//summary (see WriteSummary) for UpdateSummary
+	vector<int> vertex_sets_[2];
+	//whether the summary carries vertex_sets_ packed, for bound stars
+	//(GCARE_CSET_VERTEX_MAP=1)
+	bool write_vertex_map_;
+
+	//query mode, pointing into summary_ (or text_summary_ for old summaries),
+	//the data of summary_file_, which the instances sharing it hold
+	std::shared_ptr<LoadedFile> summary_file_;
+	char* summary_;
+	size_t summary_size_;
+	vector<int> text_summary_;
+	FlatCSets csets_view_, rev_csets_view_;
+	const int* hist_data_; //[label][src/dst][bucket], rows hist_stride_ apart
+	size_t hist_stride_;
+	const int64_t* hist_totals_; //[label][src/dst]: sum over the buckets
+	int num_hist_; //labels of hist_data_
+	vector<int64_t> text_totals_; //hist_totals_ of summaries without them
+	int pos_; //index to csets_view_ or rev_csets_view_
+	//keys: vertex label vl, or offset_ + el for an out-edge label el
+	Postings postings_;
+	Postings rev_postings_; //keys: in-edge label el
+	bool postings_built_;
+	//forward and backward index blocks, when not in the summary
+	vector<int> postings_data_[2];
+	vector<int> cand_, cand_tmp_, cand_keys_; //candidate sets of the current star
+	size_t cand_pos_;
+	//per candidate of the current star: its count, the frequency of one
+	//predicate, the products m and o of EstCard, and the estimate
+	vector<double> star_count_, star_freq_, star_m_, star_o_, star_est_;
+	VertexMap vertex_map_[2]; //forward and backward, when in the summary
 
 	int num_buckets_;
 	int bucket_size_;
 	vector<vector<vector<int>>> hist_; //vertex/edge label, src/dst, bucket 
 };
 
+}  // namespace graph
+
 #endif
@@ -2,14 +2,78 @@
 #define GRAPH_H_
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
 #include <vector>
 #include <map>
+#include <memory>
 #include <iostream>
 #include <unordered_map>
 #include "util.h"
+#include "rng.h"
+#include "mmap_file.h"
+#include "packed_adj.h"
+#include "adj_cache.h"
+#include "edge_filter.h"
+#include "label_stats.h"
+#include "gpu_walk.h"
 
 using namespace std;
 
+namespace graph {
+
+// Optional relabelling of the data vertices at build time, so that the
+// neighbours of a vertex get nearby ids.
+//  REORDER_DEGREE: by decreasing total degree (hubs first).
+//  REORDER_BFS: breadth-first from the highest-degree vertex of each
+//               component.
+//  REORDER_RCM: reverse Cuthill-McKee (BFS taking low degrees first).
+// The old -> new id map is written next to the binary as .graph.perm.
+enum Reorder { REORDER_NONE, REORDER_DEGREE, REORDER_BFS, REORDER_RCM };
+
+// The sections of a .graph body, in file order. Binaries list where each
+// starts in their .meta (the section directory); an estimator names those it
+// reads (Estimator::DataSections), and ReadBinary then reads just them in and
+// leaves the others mapped, paged in only if touched after all.
+enum DataSection {
+	SECTION_OUT = 1,       //offset_, label_, adj_offset_, adj_
+	SECTION_IN = 2,        //the same of the in-lists
+	SECTION_VLABELS = 4,   //vl_offset_, vl_
+	SECTION_EDGES = 8,     //el_rel_, or the lean layout's list index
+	SECTION_VERTICES = 16, //vl_rel_
+	SECTION_ALL = 31
+};
+const int NUM_SECTIONS = 5;
+
+// An offset array of the binary: int, or int64_t in the wide layout that
+// graphs with more than INT_MAX adjacency entries need. Wide entries follow
+// int arrays in the file, so they are read unaligned.
+class Offsets {
+public:
+	int64_t operator[](size_t i) const {
+		if (narrow_) return narrow_[i];
+		int64_t x;
+		memcpy(&x, wide_ + sizeof(int64_t) * i, sizeof(int64_t));
+		return x;
+	}
+	const void* Address(size_t i) const {
+		return narrow_ ? (const void*)(narrow_ + i) : (const void*)(wide_ + sizeof(int64_t) * i);
+	}
+	//n entries at p; returns their end
+	const char* Attach(const char* p, size_t n, bool wide) {
+		narrow_ = wide ? nullptr : (const int*)p;
+		wide_ = wide ? p : nullptr;
+		return p + n * (wide ? sizeof(int64_t) : sizeof(int));
+	}
+
+private:
+	const int* narrow_ = nullptr;
+	const char* wide_ = nullptr;
+};
+
 //use for making binary
 struct RawDataGraph {
 	int max_vl_, max_el_;
@@ -34,49 +98,243 @@ struct RawDataGraph {
 
 	vector<vector<int>> vl_rel_;
 	vector<vector<pair<int, int>>> el_rel_;
+
+	//old -> new vertex id, if MakeBinary reordered
+	vector<int> perm_;
+
+	//adj_ and in_adj_ compressed, when the binary is written packed
+	PackedAdj packed_adj_;
+	PackedAdj packed_in_adj_;
 };
 
 class DataGraph {
 private:
-	int vnum_, enum_, vl_num_, el_num_; 
+	int vnum_, vl_num_, el_num_; 
+	int64_t enum_;
 
-	vector<int> vl_cnt_, el_cnt_;
+	vector<int> vl_cnt_;
+	vector<int64_t> el_cnt_;
+	//the distinct sources of the edges of each label, then their distinct
+	//targets (see GetNumDistinct); empty if the binary has none
+	vector<int64_t> el_distinct_;
 	
 	size_t encode_size_;
+	char* buffer_;        //backing storage of the arrays below
+	LoadMode load_mode_;
 
-	const int* offset_; //data vertex id -> offset 
+	Offsets offset_; //data vertex id -> offset 
 	//const pair<int, int>* label_;
 	const int* label_;
-	const int* adj_offset_;
+	Offsets adj_offset_;
 	const int* adj_;
 
-	const int* in_offset_; //data vertex id -> offset 
+	Offsets in_offset_; //data vertex id -> offset 
 	//const pair<int, int>* in_label_;
 	const int* in_label_;
-	const int* in_adj_offset_;
+	Offsets in_adj_offset_;
 	const int* in_adj_;
 
+	//packed layout (GCARE_PACKED_ADJ at build time): adj_ and in_adj_ are
+	//null and the lists are read from these instead
+	bool packed_;
+	PackedAdj packed_adj_;
+	PackedAdj packed_in_adj_;
+
+	//out-of-core mode (SetOutOfCore): adj_ and in_adj_ are null too, and the
+	//lists are read from the .graph file through ooc_
+	size_t ooc_cache_;
+	std::unique_ptr<AdjCache> ooc_;
+
+	//wide layout: offset arrays and their sizes are int64_t (BuildBinary
+	//picks it when the adjacency outgrows int, or GCARE_WIDE_OFFSETS=1)
+	bool wide_;
+
+	//relabelling applied by MakeBinary/BuildBinary, and the old -> new id
+	//map of a loaded graph (empty if it wasn't reordered)
+	Reorder reorder_;
+	vector<int> vertex_map_;
+
+	//the label projection BuildBinary applies, or that the loaded graph was
+	//built on, and its input -> label maps
+	vector<int> project_vl_, project_el_;
+	LabelMap vl_map_, el_map_;
+
+	//vertex-label bitmaps (.graph.vlbits, GCARE_VLABEL_BITMAP at build
+	//time): label -> first word of its vnum-bit bitmap, or -1 for labels
+	//too rare to get one, which HasVLabel searches for as before
+	bool vl_bitmap_;
+	char* vl_bitmap_buffer_;
+	size_t vl_bitmap_size_;
+	const int64_t* vl_bitmap_offset_;
+	const uint64_t* vl_bitmap_words_;
+
+	//edge filters (.graph.edgefilter, GCARE_EDGE_FILTER at build time): per
+	//edge label, the first block and the block count of an EdgeFilter over
+	//its (src, dst) pairs, which HasEdge asks before searching the CSR
+	bool edge_filter_;
+	char* edge_filter_buffer_;
+	size_t edge_filter_size_;
+	const int64_t* edge_filter_index_;
+	const uint64_t* edge_filter_blocks_;
+
+	//label statistics (.graph.labelstats, written with every binary), if
+	//the binary has them
+	char* label_stats_buffer_;
+	size_t label_stats_size_;
+	LabelStats label_stats_;
+
 	//const int* rel_offset_; 
 	//const int* rel_;
 
 	//const int* in_rel_offset_; 
 	//const int* in_rel_;
 	
-	const int* vl_offset_;
+	Offsets vl_offset_;
 	const int* vl_;
 
 	//const int* vl_offset_; 
 	//const int* vl_rel_;
 	
-	const int* el_rel_offset_;
+	Offsets el_rel_offset_;
 	const pair<int, int>* el_rel_;
 
-	const int* vl_rel_offset_;
+	//lean layout (GCARE_LEAN_EDGES at build time): el_rel_ is null and its
+	//r-th edge is found from the out-lists of its label instead, the last
+	//one whose first edge is at or before r (see BuildLabelView)
+	bool lean_;
+	Offsets el_pair_offset_;  //label -> first of its lists
+	const int* el_pair_src_;  //list -> vertex
+	Offsets el_pair_cum_;     //list -> el_rel_ position of its first edge
+
+	Offsets vl_rel_offset_;
 	const int* vl_rel_;
+
+	//search index of the hub lists (at least hub_degree_ entries, 0: none),
+	//built at load time: every HUB_BLOCK-th entry of the list (its fence),
+	//in Eytzinger order so that a search touches few cache lines, with
+	//the fence rank of each slot. HasEdge finds the block that may hold
+	//a target there and scans just that block.
+	static const int HUB_BLOCK = 16;
+	struct HubIndex {
+		size_t base;  //slot 0 of the list's fence in hub_keys_/hub_rank_
+		int size;     //number of fence keys
+	};
+	int hub_degree_;
+	unordered_map<int64_t, HubIndex> hubs_[2];  //list begin -> index, per dir
+	vector<int> hub_keys_, hub_rank_;
+	void BuildHubIndex();
+	bool HubContains(const HubIndex&, const int*, int64_t, int);
+
+	//per-vertex headers (SetVertexHeaders), built at load time: a cache line
+	//per vertex holding its vertex label and, for up to VH_PAIRS edge labels
+	//over both directions, the label and the end of its list relative to
+	//the vertex's first list of that direction. A direction (or vertex
+	//labels) not fitting is VH_SPILL and searched in the arrays as before
+	static const int VH_PAIRS = 5;
+	static const uint8_t VH_SPILL = 255;
+	struct alignas(64) VertexHeader {
+		int64_t base[2];   //adjacency position of the first out (in) list
+		uint8_t count[2];  //inline labels per direction, out ones first
+		uint8_t num_vl;    //0 or 1 vertex labels
+		int vl;
+		struct {
+			int el;
+			uint32_t end;
+		} pair[VH_PAIRS];
+	};
+	bool vertex_headers_;
+	vector<VertexHeader> vheaders_;
+	unsigned sections_; //SetSections
+	void BuildVertexHeaders();
+
+#ifdef DENSE_LABEL_INDEX
+	//(v * el_num_ + el) -> begin of that adjacency list in adj_ (in_adj_);
+	//the list ends where entry + 1 begins. Built at load time
+	vector<int> dense_adj_;
+	vector<int> in_dense_adj_;
+	void BuildDenseIndex();
+#endif
+	//delta layer (see InsertEdge): per (v, el, dir) list, the neighbours
+	//inserted (not in the base) and deleted (from the base), each sorted
+	struct DeltaList {
+		vector<int> ins, del;
+	};
+	typedef unordered_map<int64_t, DeltaList> DeltaMap; //v << 32 | el -> list
+	DeltaMap delta_[2]; //out-lists, in-lists
+	//per label: sorted el_rel_ positions of the deleted base edges, and the
+	//inserted edges, which GetEdge numbers after the remaining base ones
+	struct LabelDelta {
+		vector<int64_t> deleted;
+		vector<pair<int, int>> inserted;
+	};
+	vector<LabelDelta> label_delta_;
+	int64_t delta_edges_; //inserted minus deleted edges
+	int64_t num_updates_; //since construction, see NumUpdates
+	//the updates since the base was read, in order
+	struct Update {
+		int src, dst, el;
+		bool insert;
+	};
+	vector<Update> delta_log_;
+	//the compaction thread, the delta_log_ entries it merges, and whether
+	//it wrote its binary
+	std::thread compaction_;
+	size_t compaction_end_;
+	std::string compaction_prefix_;
+	std::atomic<bool> compaction_done_;
+	//the binary read last (ReadBinary's prefix), and its per-node copies
+	std::string binary_prefix_;
+	vector<std::unique_ptr<DataGraph>> replicas_;
+	static int64_t DeltaKey(int v, int el) { return (int64_t)v << 32 | (uint32_t)el; }
+	const DeltaList* Delta(int v, int el, bool dir) const {
+		const DeltaMap& d = delta_[dir ? 0 : 1];
+		if (d.empty()) return nullptr;
+		auto it = d.find(DeltaKey(v, el));
+		return it == d.end() ? nullptr : &it->second;
+	}
+	bool HasDelta() const { return !delta_[0].empty(); }
+	void  ApplyUpdate(const Update&);
+	int64_t BaseEdgePosition(int, int, int);
+	void  WriteCompacted(const char*, const DeltaMap&);
+
+	//entry pos of the adjacency array of dir, whatever its layout
+	int AdjAt(bool dir, int64_t pos) {
+		if (packed_) return (dir ? packed_adj_ : packed_in_adj_).Get(pos);
+		if (ooc_) return ooc_->Get(dir, pos);
+		return (dir ? adj_ : in_adj_)[pos];
+	}
+	//the base CSR alone, without the delta layer
+	range BaseAdj(int, int, bool);
+	bool  BaseHasEdge(int, int, int, bool);
+	//[begin, end) of the (v, el, dir) list within adj_ (in_adj_)
+	bool  AdjBounds(int, int, bool, int64_t*, int64_t*);
+	//the r-th edge of el_rel_ (ordered by source, then target) into t
+	void  LabelEdge(int, int64_t, int*);
+	size_t EncodedSize(bool, bool);
+	//sections, if given, gets the start of each DataSection
+	void EncodeBinary(char*, bool, bool, uint64_t* sections = nullptr);
+	void ParseBinary(const char*, size_t);
 	
 	RawDataGraph raw_;
 		
 public:
+	DataGraph() : encode_size_(0), buffer_(nullptr), load_mode_(LOAD_COPY), packed_(false), ooc_cache_(0), wide_(false), reorder_(REORDER_NONE),
+		vl_bitmap_(false), vl_bitmap_buffer_(nullptr), vl_bitmap_size_(0),
+		vl_bitmap_offset_(nullptr), vl_bitmap_words_(nullptr), edge_filter_(false), edge_filter_buffer_(nullptr),
+		edge_filter_size_(0), edge_filter_index_(nullptr), edge_filter_blocks_(nullptr),
+		label_stats_buffer_(nullptr), label_stats_size_(0), lean_(false), el_pair_src_(nullptr), hub_degree_(0),
+		vertex_headers_(false), sections_(SECTION_ALL),
+		delta_edges_(0), num_updates_(0), compaction_end_(0), compaction_done_(false) {}
+	~DataGraph() {
+		if (compaction_.joinable()) compaction_.join();
+		UnloadFile(buffer_, encode_size_, load_mode_);
+		UnloadFile(vl_bitmap_buffer_, vl_bitmap_size_, load_mode_);
+		UnloadFile(edge_filter_buffer_, edge_filter_size_, load_mode_);
+		UnloadFile(label_stats_buffer_, label_stats_size_, load_mode_);
+	}
+	DataGraph(const DataGraph&) = delete;
+	DataGraph& operator=(const DataGraph&) = delete;
+
 	//build mode
 	bool HasBinary(const char*);
 	void ReadText(const char*);
@@ -84,18 +342,102 @@ public:
 	size_t BinarySize();
 	void WriteBinary(const char*);
 	void ClearRawData();
+	//whether WriteBinary and BuildBinary compress the adjacency arrays
+	void SetPackedAdj(bool packed) { packed_ = packed; }
+	bool IsPackedAdj() const { return packed_; }
+	//a cache of this many bytes makes ReadBinary leave the adjacency arrays
+	//of a plain (not packed) binary on disk (0, the default: read them in)
+	void SetOutOfCore(size_t cache_bytes) { ooc_cache_ = cache_bytes; }
+	bool IsOutOfCore() const { return ooc_ != nullptr; }
+	void SetReorder(Reorder reorder) { reorder_ = reorder; }
+	//whether WriteBinary and BuildBinary serve edges by label from the CSR
+	//instead of storing el_rel_
+	void SetLeanEdges(bool lean) { lean_ = lean; }
+	//whether WriteBinary and BuildBinary write vertex-label bitmaps
+	void SetVLabelBitmap(bool bitmap) { vl_bitmap_ = bitmap; }
+	//whether WriteBinary and BuildBinary write edge filters
+	void SetEdgeFilter(bool filter) { edge_filter_ = filter; }
+	//lists of at least this many entries get a search index when the graph
+	//is read (0, the default: none); unused on packed graphs
+	void SetHubDegree(int degree) { hub_degree_ = degree; }
+	//whether reading the graph builds per-vertex headers, so that the list
+	//bounds and the label of a vertex with few labels take one cache line
+	//(64 bytes per vertex)
+	void SetVertexHeaders(bool headers) { vertex_headers_ = headers; }
+	//the DataSection bits ReadBinary reads in (all by default); the other
+	//sections of a binary with a section directory are mapped, not read
+	void SetSections(unsigned sections) { sections_ = sections; }
+	//forces the wide layout in BuildBinary, which otherwise picks it only
+	//when needed; MakeBinary/WriteBinary always write the narrow one
+	void SetWideOffsets(bool wide) { wide_ = wide; }
+	//input vertex id -> id in this graph, empty if ids are unchanged
+	const vector<int>& GetVertexMap() const { return vertex_map_; }
+	//BuildBinary keeps just these input vertex (edge) labels, in this order
+	//as labels 0, 1, ..., followed by one label without data that queries
+	//on dropped labels are mapped to; edges of dropped labels are left out,
+	//vertices keep their ids. An empty list keeps every label of its kind.
+	//The kept labels are written next to the binary as .graph.labels
+	void SetLabelProjection(const vector<int>& vlabels, const vector<int>& elabels) {
+		project_vl_ = vlabels;
+		project_el_ = elabels;
+	}
+	//input label -> label in this graph, empty if labels are unchanged
+	const LabelMap& GetVLabelMap() const { return vl_map_; }
+	const LabelMap& GetELabelMap() const { return el_map_; }
+	//of the binary, not loaded if it has none (see LabelStats)
+	const LabelStats& GetLabelStats() const { return label_stats_; }
+	//parallel ReadText + MakeBinary + WriteBinary without the raw edge lists
+	void BuildBinary(const char*, const char*);
+	//raw data from memory instead of ReadText: vertex i gets vlabels[i]
+	void SetRawData(const vector<vector<int>>&, const vector<Edge>&);
+	//a graph inside another file: WriteEmbedded appends the metadata and the
+	//binary (after MakeBinary); AttachEmbedded reads them in place from
+	//memory that must outlive the graph, and returns the end of them
+	void WriteEmbedded(FILE*);
+	const char* AttachEmbedded(const char*);
 
-	void ReadBinary(const char*);
+	//numa_node places a LOAD_COPY read (see LoadFile); GCARE_NUMA=interleave
+	//makes the reads that do not give one LOAD_COPY reads interleaved over
+	//the nodes
+	void ReadBinary(const char*, LoadMode = LOAD_COPY, int numa_node = NUMA_ANY);
+	//GCARE_NUMA=replicate, after ReadBinary: reads a copy of the binary into
+	//the memory of each NUMA node, each on a thread pinned to its node.
+	//Replica(node) is node's copy, or this graph if there is none (no
+	//replication, or a node < 0) or the updates since made them stale
+	void MakeReplicas();
+	DataGraph& Replica(int node) {
+		if (node < 0 || node >= (int) replicas_.size() || HasDelta())
+			return *this;
+		return *replicas_[node];
+	}
+	//after MakeBinary: serves the graph from an in-memory encoding, as
+	//ReadBinary would from the files WriteBinary writes, and drops the raw
+	//data (no vertex-label bitmaps)
+	void LoadRaw();
 	int GetNumVertices();
 	int GetNumVertices(int);
-	int GetNumEdges();
-	int GetNumEdges(int);
+	int64_t GetNumEdges();
+	int64_t GetNumEdges(int);
+	//the distinct sources (dir) or targets of the edges of label el, exact,
+	//as of the binary (updates since are not counted); -1 for binaries
+	//written before they were stored in .meta
+	int64_t GetNumDistinct(int, bool);
 	int GetNumVLabels(int = -1); 
 	int GetNumELabels(int = -1, bool = true); 
 	range GetVLabels(int);
 	range GetELabels(int, bool);
 	int GetELabelIndex(int, int, bool);
+	//on a packed graph the list is decoded, out of core it is read, into a
+	//per-thread buffer that stays valid for the next 7 GetAdj calls of the
+	//same thread
 	range GetAdj(int, int, bool);
+	//hint that GetAdj(v, el, dir) is coming, for issuing many lookups at once
+	void  PrefetchAdj(int, int, bool);
+	//its second stage, a few lookups after PrefetchAdj(v, el, dir): finds
+	//the list from the offsets that brought in and prefetches its head (no
+	//op on a packed graph, whose lists are decoded); out of core, it starts
+	//reading the list's blocks from disk
+	void  PrefetchAdjList(int, int, bool);
 	//range GetRel(int, bool);
 	//range GetUni(int);
 	int   GetAdjSize(int, int, bool);
@@ -104,11 +446,57 @@ public:
 	bool  HasEdge(int, int, int, bool);
 	bool  HasVLabel(int, int);
 	bool  HasELabel(int, int, bool);
-	vector<int> GetRandomVertex(int);
+	vector<int> GetRandomVertex(int, Rng&);
 	vector<int> GetVertex(int, int);
-	vector<int> GetRandomEdge(int);
+	vector<int> GetRandomEdge(int, Rng&);
 	vector<int> GetEdge(int, int);
-	vector<int> GetRandomEdge(int, int, bool);
+	//allocation-free GetEdge(el, i): the i'th edge of el into t
+	void  GetEdge(int, int64_t, int*);
+	vector<int> GetRandomEdge(int, int, bool, Rng&);
+	//a uniform neighbour of the (v, el, dir) list into *other, without
+	//decoding the list; returns the list size (0: none drawn)
+	int   GetRandomAdj(int, int, bool, Rng&, int*);
+	//a uniform neighbour of v over the union of its (label, dir) lists, so
+	//each list is chosen by its size: the neighbour into *other and the
+	//union size into *size; returns the index of the chosen list, or -1 if
+	//the union is empty (and nothing was drawn)
+	int   GetRandomAdj(int, const vector<pair<int, bool>>&, Rng&, int*, int64_t*);
+	//allocation-free GetRandomVertex(vl) / GetRandomEdge(el): write the
+	//sample to t, false if there is none
+	bool  GetRandomVertex(int, Rng&, int*);
+	bool  GetRandomEdge(int, Rng&, int*);
+	//the arrays of the loaded binary into *w, for walks elsewhere (see
+	//GpuWalker); false for packed, out-of-core, wide and lean binaries and
+	//once there were updates, whose arrays are not the graph
+	bool  GetWalkGraph(WalkGraph*);
+
+	//dynamic graphs: edges inserted into and deleted from a delta layer
+	//over the loaded binary, which GetAdj, GetAdjSize, HasEdge, HasELabel,
+	//GetNumEdges, GetEdge, GetRandomEdge and GetRandomAdj merge in on the
+	//fly; the per-vertex label lists (GetELabels and the like) stay those
+	//of the binary. InsertEdge(src, dst, el) is false if the edge is there
+	//already, DeleteEdge if it is not, and both if a vertex or the label is
+	//not in the binary. Not safe against concurrent readers: update
+	//between queries
+	bool  InsertEdge(int, int, int);
+	bool  DeleteEdge(int, int, int);
+	//the number of updates in the delta layer
+	size_t DeltaSize() const { return delta_log_.size(); }
+	//the number of updates ever made, compacted or not: summaries built on
+	//the binary (such as start strata) do not hold after any
+	int64_t NumUpdates() const { return num_updates_; }
+	//writes the graph with the updates so far merged in as a new binary at
+	//prefix, on a thread of its own while the graph keeps serving (and
+	//taking updates); false if one is running already
+	bool  StartCompaction(const char*);
+	//whether the running compaction wrote its binary
+	bool  CompactionDone() const { return compaction_done_; }
+	//waits for the compaction, then serves its binary, with the updates
+	//made since as the delta layer; as ReadBinary, it invalidates what
+	//estimators derived from the graph
+	void  FinishCompaction();
 };
 
+}  // namespace graph
+
 #endif
@@ -1,7 +1,9 @@
 #ifndef DATA_RELATIONS_H_
 #define DATA_RELATIONS_H_
 
-#include "ndvector.h"
+#include "table_view.h"
+#include "mmap_file.h"
+#include "memory.h"
 
 #include <algorithm>
 #include <vector>
@@ -10,20 +12,37 @@
 
 using std::vector;
 using std::unordered_map;
+namespace relational {
+
 class DataGraph {
 
  public:
 //converter--
+  // one graph of the text file, its tables in flat row-major buffers: edge
+  // label l has rows [edge_offset[l], edge_offset[l + 1]) of edge_rows (src,
+  // dst), vertex label l rows [vertex_offset[l], vertex_offset[l + 1]) of
+  // vertex_rows, each in file order
   struct CvtDataGraph {
-    Vector3D table;
-    Vector4D index;
+    vector<size_t> edge_offset, vertex_offset;
+    vector<int> edge_rows, vertex_rows;
 
-    vector<vector<vector<int>>> edge_table; // ith table, jth row, k column(=2)
-    vector<vector<vector<int>>> vlabel; // ith table, jth row, k column(=1)
-    vector<vector<unordered_map<int, vector<int>>>> vidx, eidx; // ith table, jth column, k value, lth element
-    vector<vector<int>> vmap, emap; // i value, (t, c, v) list
+    // value index of table t (edge tables first), column c: distinct values
+    // ascending, the rows with values[i] at [offset[i], offset[i + 1])
+    struct ColumnIndex {
+      vector<int> values;
+      vector<size_t> offset;
+      vector<int> rows;
+    };
+    vector<vector<ColumnIndex>> index;
+    size_t num_values; // # value entries in the .map file
 
-    vector<vector<int>> vidx_max_key, eidx_max_key;
+    int num_tables() const { return base + vertex_offset.size() - 1; }
+    size_t num_rows(int t) const {
+      return t < base ? edge_offset[t + 1] - edge_offset[t] : vertex_offset[t - base + 1] - vertex_offset[t - base];
+    }
+    const int* row(int t, size_t i) const {
+      return t < base ? edge_rows.data() + 2 * (edge_offset[t] + i) : vertex_rows.data() + vertex_offset[t - base] + i;
+    }
 
     int vnum;
     int max_vid, max_vlabel, max_elabel;
@@ -31,36 +50,164 @@ class DataGraph {
   };
   
   int* container_;
+  size_t container_size_;
+  LoadMode load_mode_;
+  // .index, .map and .cols files, mapped when present
+  int* index_container_;
+  size_t index_size_;
+  int* map_container_;
+  size_t map_size_;
+  int* columns_container_;
+  size_t columns_size_;
+  LoadMode index_mode_; // of index_container_ and map_container_
+  // .packed and .index.packed files, loaded in place of the two above
+  int* packed_container_;
+  size_t packed_size_;
+  int* packed_index_container_;
+  size_t packed_index_size_;
   vector<CvtDataGraph> g_;
-  vector<int> vec1d_table_, vec1d_index_;
-  uint64_t table_cnt_, idx_cnt_, map_cnt_;
+  // whether Make1DTable and Make1DIndex write to container_,
+  // index_container_ and map_container_ instead of files
+  bool in_memory_;
 
   void Make1DTable(const char*);
-  void Make1DIndex(char*);
+  void Make1DIndex(const char*);
+  void Make1DColumns(const char*);
+  void Make1DPacked(const char*);
 //--converter
   int vnum_;
-  Vector2D map_;
-  Vector3D table_;
-  Vector4D index_;
+  MapView map_;
+  TableView table_;
+  IndexView index_;
+  ColumnsView columns_;
+  PackedView packed_, packed_index_;
   int base_;
   int max_vid_, max_vlabel_, max_elabel_;
+  vector<int64_t> distinct_; // of the selected graph
+  // the graphs of a multi-graph (transaction) binary, each with the meta
+  // line the converter wrote for it; the views above are of graph 0 after
+  // ReadBinary, and ViewGraph points another DataGraph at graph i of it
+  struct GraphMeta {
+    int base, max_vid, max_vlabel, max_elabel;
+    // the distinct values of each column, the (src, dst) of the edge tables
+    // then the vertex tables' one; empty if the meta file has none
+    vector<int64_t> distinct;
+  };
+  vector<GraphMeta> graphs_;
+  int NumGraphs() const { return graphs_.size(); }
+  // the views of graph i of all, which keeps owning the files, so it must
+  // outlive this
+  void ViewGraph(const DataGraph& all, int i);
   DataGraph(void);
+  ~DataGraph(void);
+  DataGraph(const DataGraph&) = delete;
+  DataGraph& operator=(const DataGraph&) = delete;
   int Mapping(int, int, int);
 
+  // whether index_ (or the packed index) and map_ are loaded, i.e. Lookup()
+  // can be used
+  bool HasIndex() const {
+    return (index_container_ != nullptr || packed_index_container_ != nullptr) && map_container_ != nullptr;
+  }
+  // With GCARE_RELATION_PACKED=1 when the binary is written, it also holds
+  // its tables and value index packed (.relation.packed and
+  // .relation.index.packed, see PackedColumn), a fraction of the size of
+  // the int ones; with SetPacked(true) before ReadBinary those are loaded
+  // in their place. table_ and index_ are then empty: the tables are read
+  // through Table(t) and the index through Lookup() into a buffer, and no
+  // hash index is built.
+  void SetPacked(bool on) { use_packed_ = on; }
+  bool Packed() const { return packed_container_ != nullptr; }
+  int NumTables() const { return Packed() ? packed_.size() : table_.size(); }
+  TableReader Table(int t) const {
+    if (!Packed()) return TableReader(table_[t]);
+    NestedView<2> cols = packed_[t];
+    PackedColumn columns[2];
+    for (size_t c = 0; c < cols.size() && c < 2; c++) columns[c] = PackedColumn(cols[c].begin());
+    return TableReader(columns, cols.size());
+  }
+  // With GCARE_RELATION_COLUMNS=1 when the binary is written, it also holds
+  // every table column by column (.relation.cols), so a scan over one
+  // column reads contiguous ints. Column(t, c) is then the values of column
+  // c of table t, row i at [i]; null for binaries without the copy.
+  const int* Column(int t, int c) const {
+    if (columns_container_ == nullptr || t < 0 || (size_t)t >= columns_.size()) return nullptr;
+    NestedView<2> cols = columns_[t];
+    return c >= 0 && (size_t)c < cols.size() ? cols[c].begin() : nullptr;
+  }
+
+  // rows of table t whose column c equals v, or false if (t, c) has no
+  // index; a packed index decodes them into rows, and without it answers
+  // false
+  bool Lookup(int t, int c, int v, const int*& begin, const int*& end, vector<int>* rows = nullptr);
+
+  // With SetHashIndex(true) before ReadBinary, Lookup() answers from an
+  // open-addressing table (table, column, value) -> rows built from index_
+  // and map_ at load: one probe of a 16-byte slot instead of the walk over
+  // the value's map triples and the four offset levels of index_.
+  void SetHashIndex(bool on) { use_hash_index_ = on; }
+  struct HashSlot {
+    uint64_t key;   // HashKey(t, c, v), or EMPTY_SLOT
+    uint32_t begin; // the rows start at index_container_ + begin
+    uint32_t size;
+  };
+  static const uint64_t EMPTY_SLOT = ~0ull;
+  static uint64_t HashKey(int t, int c, int v) {
+    return (static_cast<uint64_t>(t) << 33) | (static_cast<uint64_t>(c) << 32) | static_cast<uint32_t>(v);
+  }
+  bool use_hash_index_;
+  bool use_packed_;
+  vector<HashSlot, CountingAllocator<HashSlot, MEMORY_RELATION>> hash_index_;
+  int hash_shift_; // 64 - log2 of the slots
+  vector<int> hash_columns_; // # indexed columns of each table
+  void BuildHashIndex();
+  // points the views at graph i of the loaded files
+  void SelectGraph(int i);
+  bool owner_; // of the files, false for a ViewGraph
+
   int get_table_id(int _id) { return _id < 0 ? base_ - _id - 1 : _id; }
 
+  // the distinct values of column c of table t (edge tables first), exact,
+  // as MakeBinary counted them into the value index; -1 for binaries
+  // written before they were stored in .meta
+  int64_t NumDistinct(int t, int c) const {
+    size_t i = t < base_ ? 2 * (size_t)t + c : 2 * (size_t)base_ + (t - base_);
+    if (t < 0 || c < 0 || c > (t < base_ ? 1 : 0) || i >= distinct_.size()) return -1;
+    return distinct_[i];
+  }
+  // distinct values per column of each table of a converted graph
+  static vector<int64_t> CountDistinct(const CvtDataGraph&);
+
 
   void WriteBinary(char*);
 
   void ReadText(const char* fn);
+  // a .graph binary serves as well (see ReadGraph), so none is converted
+  // to .relation next to it
   bool HasBinary(const char* fn) { 
     std::string metadata = std::string(fn) + ".relation.meta";
-    return std::filesystem::exists(metadata.c_str());
+    return std::filesystem::exists(metadata.c_str()) || HasGraphBinary(fn);
+  }
+  static bool HasGraphBinary(const char* fn) {
+    return std::filesystem::exists(std::string(fn) + ".graph.meta");
   }
-  void MakeBinary() { }
+  void MakeBinary();
   void WriteBinary(const char* filename);
-  void ReadBinary(const char* fname);
-  void ClearRawData() {}
+  // the .relation binary, or without one the .graph binary (see ReadGraph)
+  void ReadBinary(const char* fname, LoadMode mode = LOAD_COPY);
+  // The tables of the .graph binary at fname, made in memory as the
+  // converter would from its text: edge label l's table holds the (src,
+  // dst) pairs of the graph's l lists, vertex label l's the vertices with
+  // l, all in input ids. Only the value index is built, in parallel.
+  void ReadGraph(const char* fname);
+  void ClearRawData() { g_.clear(); }
+  // text data graph -> binary data at prefix
+  void BuildBinary(const char* text_fn, const char* prefix) {
+    ReadText(text_fn);
+    MakeBinary();
+    WriteBinary(prefix);
+    ClearRawData();
+  }
 /*
   vector<int> GetRandomTuple(int tid) {
     vector<int> ret;
@@ -104,4 +251,6 @@ class DataGraph {
 */
 };
 
+}  // namespace relational
+
 #endif
@@ -0,0 +1,59 @@
+#ifndef EDGE_FILTER_H_
+#define EDGE_FILTER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// A blocked Bloom filter over the (src, dst) pairs of an edge label: an
+// array of 64-byte blocks of 8 words, one cache line each. A pair hashes to
+// one block and sets one bit in each of its words, so a lookup reads a
+// single line. At BITS_PER_EDGE bits per pair about 0.1% of the pairs that
+// are not edges pass.
+class EdgeFilter {
+public:
+  static const int WORDS = 8;
+  static const int BITS_PER_EDGE = 16;
+
+  // blocks for a label of n edges
+  static uint64_t NumBlocks(uint64_t n) {
+    return n == 0 ? 0 : (n * BITS_PER_EDGE + 64 * WORDS - 1) / (64 * WORDS);
+  }
+
+  static uint64_t Hash(int src, int dst) {
+    uint64_t x = (uint64_t)(uint32_t)src << 32 | (uint32_t)dst;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  // the block of h among num_blocks, by its high half
+  static uint64_t Block(uint64_t h, uint64_t num_blocks) {
+    return ((h >> 32) * num_blocks) >> 32;
+  }
+
+  // safe to call from several threads at once
+  static void Add(uint64_t* block, uint64_t h) {
+    for (int w = 0; w < WORDS; w++)
+      __atomic_fetch_or(&block[w], Bit(h, w), __ATOMIC_RELAXED);
+  }
+
+  static bool MayContain(const uint64_t* block, uint64_t h) {
+    for (int w = 0; w < WORDS; w++)
+      if (!(block[w] & Bit(h, w)))
+        return false;
+    return true;
+  }
+
+private:
+  // the bit of word w, from the low half of h (as split block filters do)
+  static uint64_t Bit(uint64_t h, int w) {
+    static const uint32_t SALT[WORDS] = {0x47b6137bu, 0x44974d91u, 0x8824ad5bu,
+                                         0xa2b7289du, 0x705495c7u, 0x2df1424bu,
+                                         0x9efc4947u, 0x5c6bfb31u};
+    return 1ull << (((uint32_t)h * SALT[w]) >> 26);
+  }
+};
+
+#endif
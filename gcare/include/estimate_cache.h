@@ -0,0 +1,104 @@
+#ifndef ESTIMATE_CACHE_H_
+#define ESTIMATE_CACHE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#include "mmap_file.h"
+
+// Estimates kept across runs in a text file of "key\test\tvariance" lines,
+// appended to as queries are estimated. The key (see Key) holds everything
+// the estimate depends on: the method, a hash of its summary, the sampling
+// parameters and the canonical form of the query, so isomorphic queries
+// share an entry and a rebuilt summary invalidates them.
+class EstimateCache {
+public:
+  explicit EstimateCache(const std::string &path) : path_(path) {
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+      size_t tab = line.find('\t');
+      size_t tab2 = line.find('\t', tab + 1);
+      if (tab == std::string::npos || tab2 == std::string::npos)
+        continue;
+      entries_[line.substr(0, tab)] = {
+          std::stod(line.substr(tab + 1, tab2 - tab - 1)),
+          std::stod(line.substr(tab2 + 1))};
+    }
+  }
+
+  bool Find(const std::string &key, double &est, double &variance) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end())
+      return false;
+    est = it->second.first;
+    variance = it->second.second;
+    return true;
+  }
+
+  void Put(const std::string &key, double est, double variance) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[key] = {est, variance};
+    FILE *fp = fopen(path_.c_str(), "a");
+    if (fp == nullptr) {
+      perror(path_.c_str());
+      return;
+    }
+    fprintf(fp, "%s\t%.17g\t%.17g\n", key.c_str(), est, variance);
+    fclose(fp);
+  }
+
+  // 64-bit FNV-1a of the summary file, or of its path and modification
+  // time if it is not a regular file (a directory of sketches); 0 if there
+  // is none
+  static uint64_t Fingerprint(const char *summary) {
+    struct stat st;
+    if (stat(summary, &st) != 0)
+      return 0;
+    uint64_t h = 0xcbf29ce484222325ull;
+    auto add = [&h](const char *p, size_t n) {
+      for (size_t i = 0; i < n; i++)
+        h = (h ^ (unsigned char)p[i]) * 0x100000001b3ull;
+    };
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+      add(summary, strlen(summary));
+      add((const char *)&st.st_mtime, sizeof(st.st_mtime));
+      return h;
+    }
+    size_t size;
+    char *p = LoadFile(summary, size, LOAD_MMAP);
+    if (p == nullptr)
+      return 0;
+    add(p, size);
+    UnloadFile(p, size, LOAD_MMAP);
+    return h;
+  }
+
+  static std::string Key(const std::string &method, uint64_t fingerprint,
+                         double ratio, int seed, int num_iter, double rel_ci,
+                         double budget, const std::string &query,
+                         double target_rse = 0) {
+    char head[256];
+    int n = snprintf(head, sizeof(head), "%s|%016llx|%.17g|%d|%d|%g|%g|",
+                     method.c_str(), (unsigned long long)fingerprint, ratio,
+                     seed, num_iter, rel_ci, budget);
+    // keys of runs without a target are those of before it existed
+    if (target_rse > 0 && n > 0 && n < (int)sizeof(head))
+      snprintf(head + n, sizeof(head) - n, "rse%g|", target_rse);
+    return head + query;
+  }
+
+private:
+  std::string path_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::pair<double, double>> entries_;
+};
+
+#endif
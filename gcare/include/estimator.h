@@ -1,33 +1,67 @@
 #ifndef ESTIMATOR_H_ 
 #define ESTIMATOR_H_ 
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
 #include <vector>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <unordered_map>
+#include <unistd.h>
 
+#include "counters.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "query_arena.h"
+#include "rng.h"
+#include "registry.h"
 
+// The graph and the relational estimators are built from the same headers
+// into namespaces of their own, GCARE_KIND, so one binary can hold both.
 #ifdef RELATION
   #include "data_relations.h"
   #include "query_relations.h"
+  #define GCARE_KIND relational
+  #define GCARE_KIND_NAME "relation"
 #else
     #include "data_graph.h"
     #include "query_graph.h"
+  #define GCARE_KIND graph
+  #define GCARE_KIND_NAME "graph"
 #endif
 
 using namespace std;
 
+namespace GCARE_KIND {
+
 class Estimator {
 public:
 
-  enum ErrCode { NORMAL, TIMEOUT };
+  //MEMORY: the query went over its memory budget (see SetMemoryBudget)
+  enum ErrCode { NORMAL, TIMEOUT, MEMORY };
 	unsigned long long int dp_time_;
 	int num_est_card_;
 	int num_memoi_;
 
-  void Summarize(DataGraph& g, const char* fn, double p) {
+  // builds and writes the summary at fn; with resume, builders that
+	// checkpoint (see WriteCheckpoint) continue from the checkpoint a killed
+	// build of the same summary left at fn.ckpt, which a finished build
+	// removes
+  void Summarize(DataGraph& g, const char* fn, double p, bool resume = false) {
+		checkpoint_ = string(fn) + ".ckpt";
+		resume_ = resume;
+		build_start_ = last_checkpoint_ = std::chrono::steady_clock::now();
+		build_report_.clear();
 		PrepareSummaryStructure(g, p);
 		WriteSummary(fn);
+		remove(checkpoint_.c_str());
+		checkpoint_.clear();
 	}
 
 	double Run(DataGraph& gin, QueryGraph& qin, double p) {
@@ -35,17 +69,90 @@ public:
 		q = &qin;
 		sample_ratio = p;
 		subquery_card_.clear();
+		subquery_var_.clear();
+		nested_est_.assign(nested_ratios_.size(), 1.0);
+		partial_ = false;
+		num_samples_ = 0;
+		arena_.Reset();
+		auto run_start = std::chrono::steady_clock::now();
+#ifndef RELATION
+		//a query the labels of the data rule out has no matches to sample;
+		//its sub-patterns may have, so not when they are estimated too
+		if (!prefixes_on_ && ProvablyEmpty()) {
+			num_subqueries_ = 0;
+			selectivity_ = 1.0;
+			variance_ = 0.0;
+			std::fill(nested_est_.begin(), nested_est_.end(), 0.0);
+			RecordMetrics(run_start);
+			return 0.0;
+		}
+#endif
+		//the hardware counters of each phase, with --perf (see PerfProbe)
+		PerfProbe& perf = ThreadPerf();
 		Init();
+		perf.Mark(PERF_INIT);
+		bool stopping = (stop_ci_ > 0 || stop_budget_ > 0) && EstimatesMean();
+		bool tracking = stopping || progress_every_ > 0;
+		start_ = std::chrono::steady_clock::now();
 		
 		num_subqueries_ = DecomposeQuery();
+		perf.Mark(PERF_DECOMPOSE);
 		for (int j = 0; j < num_subqueries_; j++) {
+			string key;
+			if (in_batch_ && !(key = SubqueryKey(j)).empty()) {
+				auto it = batch_cache_.find(key);
+				if (it != batch_cache_.end()) {
+					subquery_card_.push_back(it->second);
+					subquery_var_.push_back(-1.0);
+					for (double& est : nested_est_) est *= it->second;
+					continue;
+				}
+			}
 			card_vec_.clear();
-			while (GetSubstructure(j)) {
-				double est_card = EstCard(j);
+			mean_ = m2_ = 0.0;
+			while (true) {
+				bool found;
+				{
+					GCARE_TIMER(get_substructure_ns);
+					found = GetSubstructure(j);
+				}
+				if (!found) break;
+				double est_card;
+				{
+					GCARE_TIMER(est_card_ns);
+					est_card = EstCard(j);
+				}
+				GCARE_COUNT(substructures);
+				if (est_card == 0) GCARE_COUNT(rejected_walks);
 				card_vec_.push_back(est_card);
+				if (tracking) {
+					Observe(est_card);
+					if (stopping && Converged()) break;
+					if (progress_every_ > 0 && card_vec_.size() % progress_every_ == 0 &&
+							!ReportProgress(j))
+						break;
+				}
+				//past a partial deadline every later subquery stops after
+				//its first substructure
+				if ((card_vec_.size() & 63) == 0 || partial_) {
+					if (partial_on_deadline_ && !OverMemory() && DeadlinePassed()) {
+						partial_ = true;
+						break;
+					}
+					CheckDeadline();
+				}
 			}
+			if (progress_every_ > 0) ReportProgress(j);
+			perf.Mark(PERF_SAMPLE);
+			num_samples_ += card_vec_.size();
 			double agg_card = AggCard();
 			subquery_card_.push_back(agg_card);
+			subquery_var_.push_back(AggVariance());
+			for (size_t i = 0; i < nested_ratios_.size(); i++)
+				nested_est_[i] *= nested_ratios_[i] < sample_ratio ?
+					AggCardAt(j, nested_ratios_[i]) : agg_card;
+			if (!key.empty()) batch_cache_[key] = agg_card;
+			perf.Mark(PERF_AGGREGATE);
 		}
 		
 		double ret = 1.0;
@@ -53,24 +160,165 @@ public:
 			ret *= subquery_card_[j];
 		}
 		selectivity_ = GetSelectivity();
+		perf.Mark(PERF_AGGREGATE);
 		ret *= selectivity_;
+		//of a product of independent estimates: E[prod x^2] - prod E[x]^2
+		double second = 1.0;
+		variance_ = 0.0;
+		for (int j = 0; j < num_subqueries_ && variance_ >= 0; j++) {
+			if (subquery_var_[j] < 0)
+				variance_ = -1.0;
+			second *= subquery_card_[j] * subquery_card_[j] + subquery_var_[j];
+		}
+		if (variance_ >= 0)
+			variance_ = std::max(0.0, second * selectivity_ * selectivity_ - ret * ret);
+		for (double& est : nested_est_) est *= selectivity_;
+		//loops that stopped at DeadlinePassed() may have left the estimate
+		//of a query over its budget partial
+		if (OverMemory()) throw MEMORY;
+		RecordMetrics(run_start);
 		return ret;
 	}
 
+	// Runs each query of qs in turn, like Run(), but shares the AggCard() of
+	// subqueries with equal SubqueryKey()s across the batch, so overlapping
+	// workloads estimate each distinct subquery once.
+	vector<double> RunBatch(DataGraph& gin, vector<QueryGraph>& qs, double p) {
+		vector<double> res;
+		res.reserve(qs.size());
+		batch_cache_.clear();
+		in_batch_ = true;
+		try {
+			for (QueryGraph& qin : qs)
+				res.push_back(Run(gin, qin, p));
+		} catch (...) {
+			in_batch_ = false;
+			throw;
+		}
+		in_batch_ = false;
+		batch_cache_.clear();
+		return res;
+	}
+
+#ifndef RELATION
+	// Estimates the connected sub-patterns of qin given by masks (see
+	// QueryGraph::Subgraph), one estimate each, or all of them if masks is
+	// empty, which then gets their masks (see ConnectedEdgeSets), as a
+	// join-order optimiser needs. Isomorphic sub-patterns are estimated
+	// once, and equal subqueries share their AggCard() as in RunBatch(), so
+	// summaries' star and partition results are reused. An estimator that
+	// SharesPrefixes() runs qin first and estimates the sub-patterns its
+	// walks' prefixes cover from those walks, with no runs of their own.
+	vector<double> RunSubpatterns(DataGraph& gin, QueryGraph& qin, double p, vector<uint64_t>& masks) {
+		if (masks.empty())
+			masks = qin.ConnectedEdgeSets();
+		vector<double> res(masks.size(), 0.0);
+		unordered_map<uint64_t, double> known;
+		if (SharesPrefixes()) {
+			int n = qin.GetNumEdges();
+			uint64_t all = n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+			prefixes_on_ = true;
+			try {
+				known[all] = Run(gin, qin, p);
+			} catch (...) {
+				prefixes_on_ = false;
+				throw;
+			}
+			prefixes_on_ = false;
+			PrefixEstimates(known);
+		}
+		//the sub-patterns left, each isomorphism class once
+		vector<QueryGraph> subs;
+		unordered_map<string, int> class_of;
+		vector<int> sub_of(masks.size(), -1);
+		for (size_t i = 0; i < masks.size(); i++) {
+			auto it = known.find(masks[i]);
+			if (it != known.end()) {
+				res[i] = it->second;
+				continue;
+			}
+			QueryGraph sub = qin.Subgraph(masks[i]);
+			auto ins = class_of.emplace(sub.CanonicalForm(), subs.size());
+			if (ins.second)
+				subs.push_back(std::move(sub));
+			sub_of[i] = ins.first->second;
+		}
+		vector<double> est = RunBatch(gin, subs, p);
+		for (size_t i = 0; i < masks.size(); i++)
+			if (sub_of[i] >= 0)
+				res[i] = est[sub_of[i]];
+		return res;
+	}
+#endif
+
+	// build mode: the bytes the summary file should stay within and the
+	// seconds its build should take, 0 for no limit. Builders that can
+	// coarsen their summary (cset, sumrdf, bsk, cs) do so to fit, and say
+	// what they gave up in BuildReport(); the others build as usual.
+	void SetBuildBudget(size_t bytes, double seconds) {
+		max_summary_bytes_ = bytes;
+		max_build_seconds_ = seconds;
+	}
+
+	// build mode: after Summarize(), how the builder met its budget, empty
+	// if it had nothing to report
+	const string& BuildReport() const {
+		return build_report_;
+	}
+
 	//method-specific functions to be implemented
 	
 	//build mode
 	virtual void PrepareSummaryStructure(DataGraph&, double) = 0; 
 	virtual void WriteSummary(const char*) = 0; 
+	//whether the summary is the same for every ratio and seed, so that one
+	//build serves all of them
+	virtual bool FixedSummary() { return false; }
+	//applies the edge updates in the file, one "+ src dst el" (insertion) or
+	//"- src dst el" (deletion) per line, to the summary at the path built on
+	//g, instead of rebuilding it on the updated graph; false if the method
+	//cannot
+	virtual bool UpdateSummary(DataGraph&, const char*, const char*) { return false; }
 	
 	//query mode
 	virtual void ReadSummary(const char*) = 0; 
+	//instead of ReadSummary, takes the summary another instance of the
+	//method read, read-only and shared with it, so that the instances of
+	//in-process threads hold one copy and keep only their per-query state
+	//apart; false if the method cannot (the caller then reads its own)
+	virtual bool ShareSummary(const Estimator&) { return false; }
 	virtual void Init() = 0;
 	virtual int DecomposeQuery() = 0; 
 	virtual bool GetSubstructure(int) = 0; 
 	virtual double EstCard(int) = 0; 
 	virtual double AggCard() = 0;
 	virtual double GetSelectivity() = 0;
+	//whether AggCard() is the mean of card_vec_, so that sampling may stop
+	//once the mean is known well enough (see SetStopping)
+	virtual bool EstimatesMean() { return false; }
+	//whether AggCardAt() can give the estimate of a smaller ratio from the
+	//substructures sampled at the current one (see SetNestedRatios)
+	virtual bool Nests() { return EstimatesMean(); }
+	//after DecomposeQuery(): a string that is equal for two subqueries
+	//(of the same or different queries) only if their AggCard() is, or
+	//empty if the subquery may not be cached, e.g. for sampled estimates
+	virtual string SubqueryKey(int) { return string(); }
+	//whether Run() with prefixes_on_ can estimate the sub-patterns its
+	//samples' prefixes match, and after such a run those estimates by edge
+	//mask (see RunSubpatterns)
+	virtual bool SharesPrefixes() { return false; }
+	virtual void PrefixEstimates(unordered_map<uint64_t, double>&) {}
+	//the DataSection bits of the data graph it reads besides its summary;
+	//all by default
+	virtual unsigned DataSections() { return ~0u; }
+
+	virtual ~Estimator() {}
+
+	// reseeds the sampling RNG; Run() draws all its randomness from it
+	void Seed(uint64_t seed) {
+		rng_.Seed(seed);
+		seed_ = seed;
+	}
 
     void SetDataGraph(DataGraph* _g) {
         g = _g;
@@ -80,7 +328,299 @@ public:
         return g;
     }
 
+	// Lets the sampling of estimators whose estimate is a mean stop early: once
+	// the 95% confidence half-width of the mean is at most rel_ci times the
+	// mean, or once Run() has taken budget seconds. Zero disables
+	// either criterion; the sample size set by the ratio stays the maximum.
+	void SetStopping(double rel_ci, double budget) {
+		stop_ci_ = rel_ci;
+		stop_budget_ = budget;
+	}
+
+	// Nested sampling: Run() at the largest of ratios also estimates the query
+	// at each of them, as if sampling had stopped after its share of the
+	// substructures, so a sweep over ratios costs about one run at the
+	// largest. Only for estimators that Nests(); empty turns it off.
+	void SetNestedRatios(const vector<double>& ratios) {
+		nested_ratios_ = ratios;
+	}
+
+	// after Run(): the estimate at each ratio given to SetNestedRatios
+	const vector<double>& GetNestedEstimates() const {
+		return nested_est_;
+	}
+
+	// A snapshot of the substructures estimated so far for the current
+	// subquery; the estimate of a mean estimator (see EstimatesMean) is mean.
+	struct Progress {
+		int subquery = -1;
+		size_t samples = 0;
+		double mean = 0.0;
+		double variance = 0.0; //of one sample
+		double elapsed = 0.0;  //seconds since Run() started
+	};
+
+	// Delivers the progress to callback every `every` substructures and once
+	// at the end of each subquery; returning false ends the subquery with
+	// the samples taken so far. every = 0 turns progress tracking off.
+	void SetProgress(size_t every, std::function<bool(const Progress&)> callback = nullptr) {
+		progress_every_ = every;
+		progress_callback_ = callback;
+	}
+
+	// the latest snapshot, safe to poll from another thread during Run()
+	Progress GetProgress() {
+		std::lock_guard<std::mutex> lock(progress_mutex_);
+		return progress_;
+	}
+
+	// In-process runs cannot be killed from outside, so they carry a
+	// wall-clock deadline instead; long loops poll it via CheckDeadline().
+	// With partial, Run() stops sampling at the deadline and estimates from
+	// the substructures so far (see Partial()) instead of throwing; loops
+	// that cannot stop early throw TIMEOUT still.
+	void SetDeadline(std::chrono::steady_clock::time_point deadline, bool partial = false) {
+		cancelled_ = false;
+		deadline_ = deadline;
+		has_deadline_ = true;
+		partial_on_deadline_ = partial;
+	}
+
+	// after Run(): the substructures estimated over all subqueries, the
+	// weight of its estimate when merged with others of the same query
+	size_t NumSamples() const {
+		return num_samples_;
+	}
+
+	// after Run(): whether the deadline cut its sampling short
+	bool Partial() const {
+		return partial_;
+	}
+
+	// after Run(): the variance of its estimate, from the spread of the
+	// substructures' estimates, or -1 if the estimator cannot tell
+	double Variance() const {
+		return variance_;
+	}
+
+	void ClearDeadline() {
+		has_deadline_ = false;
+	}
+
+	// Ends a Run() on another thread early, as if its deadline had passed:
+	// with partial it estimates from the substructures so far, else it
+	// throws TIMEOUT. Safe to call from any thread; SetDeadline clears it.
+	void Cancel() {
+		cancelled_ = true;
+	}
+
+	// In-process runs cannot be killed for their memory either, so they may
+	// carry a budget their allocations are charged to: past its limit the
+	// deadline counts as passed, and CheckDeadline() and the end of Run()
+	// throw MEMORY rather than estimate. Null clears it.
+	void SetMemoryBudget(MemoryBudget* budget) {
+		memory_budget_ = budget;
+	}
+
+	// Run() records its duration and samples to this series of Metrics, -1
+	// for none; a forked iteration's are recorded by its parent instead
+	void SetMetricsSeries(int series) {
+		metrics_series_ = series;
+	}
+	int GetMetricsSeries() const {
+		return metrics_series_;
+	}
+
 protected:
+#ifndef RELATION
+	// whether q provably has no matches in g: a label without data, a bound
+	// vertex without its label or an edge, or a query vertex whose labels
+	// no data vertex has together (see LabelStats). False if in doubt, as
+	// after edge updates, which the statistics do not see; GCARE_EMPTY_CHECK=0
+	// checks nothing
+	bool ProvablyEmpty() {
+		const char* check = getenv("GCARE_EMPTY_CHECK");
+		if ((check && atoi(check) == 0) || g->NumUpdates() > 0)
+			return false;
+		const LabelStats& stats = g->GetLabelStats();
+		int vnum = g->GetNumVertices(), vl_num = g->GetNumVLabels(), el_num = g->GetNumELabels();
+		vector<pair<int, int>> keys; //(el, d) of a query vertex's edges
+		for (int u = 0; u < q->GetNumVertices(); u++) {
+			int vl = q->GetVLabel(u), b = q->GetBound(u);
+			if (vl >= vl_num || (vl >= 0 && g->GetNumVertices(vl) == 0) || b >= vnum)
+				return true;
+			if (b >= 0 && vl >= 0 && !g->HasVLabel(b, vl))
+				return true;
+			keys.clear();
+			for (int d = 0; d < 2; d++)
+				for (auto& e : q->GetAdj(u, d == 0)) {
+					if (e.second < 0)
+						continue;
+					if (e.second >= el_num || g->GetNumEdges(e.second) == 0 ||
+							(b >= 0 && g->GetAdjSize(b, e.second, d == 0) == 0))
+						return true;
+					keys.emplace_back(e.second, d);
+				}
+			if (!stats.Loaded())
+				continue;
+			for (size_t i = 0; i < keys.size(); i++) {
+				if (vl >= 0 && !stats.Carries(vl, keys[i].first, keys[i].second))
+					return true;
+				for (size_t j = i + 1; j < keys.size(); j++)
+					if (!stats.Joins(keys[i].first, keys[i].second, keys[j].first, keys[j].second))
+						return true;
+			}
+		}
+		return false;
+	}
+#endif
+
+	void RecordMetrics(std::chrono::steady_clock::time_point run_start) {
+		if (metrics_series_ < 0) return;
+		Metrics& metrics = Metrics::Get();
+		metrics.Count(metrics_series_, METRIC_ITERATIONS);
+		if (partial_) metrics.Count(metrics_series_, METRIC_PARTIAL_ITERATIONS);
+		metrics.Record(metrics_series_, METRIC_ITERATION_SECONDS,
+			std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - run_start).count());
+		metrics.Record(metrics_series_, METRIC_ITERATION_SAMPLES, num_samples_);
+	}
+
+	inline bool OverMemory() const {
+		return memory_budget_ != nullptr && memory_budget_->Exceeded();
+	}
+
+	inline bool DeadlinePassed() const {
+		return OverMemory() || cancelled_.load(std::memory_order_relaxed) ||
+			(has_deadline_ && std::chrono::steady_clock::now() > deadline_);
+	}
+
+	inline void CheckDeadline() const {
+		if (OverMemory()) throw MEMORY;
+		if (DeadlinePassed()) throw TIMEOUT;
+	}
+
+	// rebuilds c, a std::pmr container of the query's state, empty on the
+	// arena; what it held went with the arena's Reset() at the start of
+	// Run(), so Init() calls this instead of clear()
+	template <class C>
+	void Fresh(C& c) {
+		new (&c) C(arena_.Resource());
+	}
+
+	// adds x, just pushed to card_vec_, to its running mean and variance
+	// (Welford)
+	void Observe(double x) {
+		size_t n = card_vec_.size();
+		double delta = x - mean_;
+		mean_ += delta / n;
+		m2_ += delta * (x - mean_);
+	}
+
+	//the AggCard() of subquery j had it been sampled at ratio < sample_ratio:
+	//by default that of the first ratio / sample_ratio of card_vec_
+	virtual double AggCardAt(int j, double ratio) {
+		size_t keep = (size_t)(card_vec_.size() * (ratio / sample_ratio) + 1e-9);
+		vector<double> rest(card_vec_.begin() + keep, card_vec_.end());
+		card_vec_.resize(keep);
+		double res = AggCard();
+		card_vec_.insert(card_vec_.end(), rest.begin(), rest.end());
+		return res;
+	}
+
+	//the variance of AggCard() for the subquery just sampled, -1 if unknown:
+	//by default, of a mean estimator, that of the mean of card_vec_ (none
+	//drawn: the subquery had nothing to sample, and 0 is certain)
+	virtual double AggVariance() {
+		size_t n = card_vec_.size();
+		if (!EstimatesMean() || n == 1)
+			return -1.0;
+		if (n == 0)
+			return 0.0;
+		double mean = 0.0, m2 = 0.0;
+		for (double x : card_vec_)
+			mean += x;
+		mean /= n;
+		for (double x : card_vec_)
+			m2 += (x - mean) * (x - mean);
+		return m2 / (n - 1) / n;
+	}
+
+	//build mode: whether the build has taken its max_build_seconds_
+	bool BuildTimeUp() const {
+		return max_build_seconds_ > 0 &&
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start_).count() >= max_build_seconds_;
+	}
+
+	//build mode: whether a checkpoint is due, GCARE_CHECKPOINT_SECONDS
+	//(default 600; 0 at every chance, below 0 never) after the last one or
+	//the start of the build
+	bool CheckpointDue() const {
+		static const double every = []() {
+			const char* s = getenv("GCARE_CHECKPOINT_SECONDS");
+			return s != nullptr ? atof(s) : 600.0;
+		}();
+		return !checkpoint_.empty() && every >= 0 &&
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - last_checkpoint_).count() >= every;
+	}
+
+	//build mode: writes the in-progress state of the build through write
+	//to checkpoint_, by way of a temporary file renamed over it, so a crash
+	//while writing leaves the previous checkpoint whole
+	void WriteCheckpoint(const std::function<void(FILE*)>& write) {
+		string tmp = checkpoint_ + ".tmp";
+		FILE* fp = fopen(tmp.c_str(), "wb");
+		if (fp == nullptr) {
+			fprintf(stderr, "cannot write %s\n", tmp.c_str());
+			return;
+		}
+		write(fp);
+		bool ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+		ok = fclose(fp) == 0 && ok;
+		if (!ok || rename(tmp.c_str(), checkpoint_.c_str()) != 0) {
+			fprintf(stderr, "cannot write %s\n", checkpoint_.c_str());
+			remove(tmp.c_str());
+		}
+		last_checkpoint_ = std::chrono::steady_clock::now();
+	}
+
+	//build mode: the checkpoint to resume from, to be read and closed by the
+	//caller, which starts over if it does not match the build; nullptr
+	//unless resuming and there is one
+	FILE* ReadCheckpoint() const {
+		if (!resume_ || checkpoint_.empty())
+			return nullptr;
+		return fopen(checkpoint_.c_str(), "rb");
+	}
+
+	double Elapsed() const {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+	}
+
+	bool Converged() {
+		size_t n = card_vec_.size();
+		if (stop_budget_ > 0 && (n & 63) == 0 && Elapsed() > stop_budget_)
+			return true;
+		if (stop_ci_ <= 0 || n < MIN_STOP_SAMPLES || mean_ <= 0)
+			return false;
+		double half_width = 1.96 * std::sqrt(m2_ / (n - 1) / n);
+		return half_width <= stop_ci_ * mean_;
+	}
+
+	bool ReportProgress(int subquery) {
+		Progress progress;
+		progress.subquery = subquery;
+		progress.samples = card_vec_.size();
+		progress.mean = mean_;
+		progress.variance = progress.samples > 1 ? m2_ / (progress.samples - 1) : 0.0;
+		progress.elapsed = Elapsed();
+		{
+			std::lock_guard<std::mutex> lock(progress_mutex_);
+			progress_ = progress;
+		}
+		return !progress_callback_ || progress_callback_(progress);
+	}
+
 	DataGraph* g;
 	QueryGraph *q;
 	double sample_ratio;
@@ -88,7 +628,59 @@ protected:
 	int num_subqueries_;
 	double selectivity_;
 	vector<double> subquery_card_; //for each subquery
+	vector<double> subquery_var_;  //AggVariance() of each subquery
+	double variance_ = -1.0;       //see Variance
 	vector<double> card_vec_;      //for each subquery and substructure
+
+	Rng rng_;
+	uint64_t seed_ = 0; //of the last Seed(), naming shared streams
+	QueryArena arena_; //per-query scratch memory, see Fresh
+	string checkpoint_; //build mode: where the build checkpoints, see Summarize
+	bool resume_ = false;
+	std::chrono::steady_clock::time_point build_start_, last_checkpoint_;
+	size_t max_summary_bytes_ = 0; //build mode: see SetBuildBudget
+	double max_build_seconds_ = 0.0;
+	string build_report_;
+	static const size_t MIN_STOP_SAMPLES = 30;
+	double stop_ci_ = 0.0, stop_budget_ = 0.0;
+	double mean_, m2_;
+	std::chrono::steady_clock::time_point start_;
+	size_t progress_every_ = 0;
+	std::function<bool(const Progress&)> progress_callback_;
+	std::mutex progress_mutex_;
+	Progress progress_;
+	vector<double> nested_ratios_, nested_est_;
+	bool in_batch_ = false;
+	bool prefixes_on_ = false; //see SharesPrefixes
+	unordered_map<string, double> batch_cache_; //SubqueryKey -> AggCard
+	bool has_deadline_ = false;
+	bool partial_on_deadline_ = false, partial_ = false;
+	size_t num_samples_ = 0;
+	std::chrono::steady_clock::time_point deadline_;
+	MemoryBudget* memory_budget_ = nullptr;
+	int metrics_series_ = -1;
+	std::atomic<bool> cancelled_{false}; //see Cancel
 };
 
+typedef Estimator* (*EstimatorFactory)();
+
+// method name -> factory of the estimators of this kind
+inline map<string, EstimatorFactory>& EstimatorFactories() {
+	static map<string, EstimatorFactory> factories;
+	return factories;
+}
+
+inline bool RegisterEstimator(const char* method, EstimatorFactory factory) {
+	EstimatorFactories()[method] = factory;
+	Registry::Get().methods[method] = GCARE_KIND_NAME;
+	return true;
+}
+
+}  // namespace GCARE_KIND
+
+// registers Class under method; used once in the estimator's source file
+#define REGISTER_ESTIMATOR(method, Class) \
+	static const bool Class##_registered = \
+		RegisterEstimator(method, []() -> Estimator* { return new Class; })
+
 #endif
@@ -0,0 +1,98 @@
+#ifndef EXACT_COUNT_H_
+#define EXACT_COUNT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "estimator.h"
+
+namespace graph {
+
+// The exact number of homomorphisms of a query into the data graph, as the
+// samplers estimate it, by a worst-case-optimal join: the query vertices are
+// bound one at a time, each to the intersection of the adjacency lists its
+// bound neighbours lead to (simd_search's Intersect), so no intermediate
+// result is larger than the output allows. A connected query starts from the
+// edges of its rarest edge label (or from its bound vertex), which are split
+// among the OpenMP threads; disconnected components are counted apart and
+// multiplied.
+class ExactCounter {
+public:
+	ExactCounter(DataGraph&, QueryGraph&);
+
+	//counts more than limit (0: any number) give up
+	void SetLimit(double limit) { limit_ = limit; }
+	//polled now and then, by any of the threads; true gives up
+	void SetStop(std::function<bool()> stop) { stop_ = stop; }
+
+	//false if it gave up, with count undefined
+	bool Count(double& count);
+
+private:
+	//a level's candidates are the el neighbours of a bound vertex
+	struct Adj {
+		int pos;  //position of the bound neighbour in the order
+		int el;
+		bool dir; //out-neighbours of it, else in-neighbours
+	};
+	struct Check {
+		int a, b, el; //positions of the edge's src and dst
+	};
+	struct Level {
+		int vl, bound;
+		vector<Adj> adj;
+		vector<Check> checks; //edges to verify once this level is bound
+	};
+	//the levels of one component, in binding order
+	struct Plan {
+		enum { VERTEX, EDGE } start;
+		int el; //for EDGE starts
+		vector<Level> levels;
+	};
+	struct Worker;
+
+	void plan(const vector<int>&);
+	double countPlan(const Plan&);
+	bool pass(const Level&, const int*, int);
+	void extend(const Plan&, int, Worker&);
+	bool giveUp(Worker&);
+
+	DataGraph* g_;
+	QueryGraph* q_;
+	vector<Plan> plans_;
+	bool empty_; //a label the data graph lacks
+	double limit_ = 0;
+	std::function<bool()> stop_;
+	std::atomic<bool> stopped_;
+	std::atomic<uint64_t> counted_; //so far over all threads, with a limit
+};
+
+// The method "exact": the ExactCounter's count as the estimate, for the true
+// cardinalities that q-errors need. It has no summary, and a deadline ends
+// it with TIMEOUT.
+class Exact : public Estimator {
+public:
+	void PrepareSummaryStructure(DataGraph&, double) {}
+	void WriteSummary(const char*) {}
+	bool FixedSummary() { return true; }
+	unsigned DataSections() {
+		return SECTION_OUT | SECTION_IN | SECTION_VLABELS | SECTION_EDGES;
+	}
+
+	void ReadSummary(const char*) {}
+	void Init() { counted_ = false; }
+	int DecomposeQuery() { return 1; }
+	bool GetSubstructure(int);
+	double EstCard(int);
+	double AggCard() { return card_vec_.empty() ? 0.0 : card_vec_[0]; }
+	double GetSelectivity() { return 1.0; }
+	string SubqueryKey(int);
+
+private:
+	bool counted_;
+};
+
+}  // namespace graph
+
+#endif
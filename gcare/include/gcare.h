@@ -0,0 +1,69 @@
+#ifndef GCARE_H_
+#define GCARE_H_
+
+/* C API of libgcare: load the data once and run estimates in-process, as
+ * the gcare binaries do in server mode. A handle must not be used by two
+ * threads at once; open one estimator per thread instead (they may share
+ * a graph). Failures return NULL or a nonzero code and are reported on
+ * stderr. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gcare_graph gcare_graph;
+typedef struct gcare_estimator gcare_estimator;
+
+/* how the binary data is brought into memory, see LoadMode */
+enum {
+  GCARE_LOAD_COPY = 0,
+  GCARE_LOAD_MMAP = 1,
+  GCARE_LOAD_HUGEPAGE = 2,
+  GCARE_LOAD_SHM = 3
+};
+
+/* comma-separated names of the linked-in methods */
+const char* gcare_methods(void);
+
+/* loads the binary data at prefix, of kind "graph" or "relation"; with a
+ * non-NULL text, first builds the binary from that text data unless it
+ * exists */
+gcare_graph* gcare_load_graph(const char* kind, const char* prefix,
+                              const char* text, int load_mode);
+void gcare_free_graph(gcare_graph*);
+
+/* an estimator of method on graph, reading the summary at path, which is
+ * built first (with sampling ratio and seed) if it does not exist; the
+ * graph must outlive it */
+gcare_estimator* gcare_open_summary(gcare_graph*, const char* method,
+                                    const char* summary, double ratio,
+                                    int seed);
+void gcare_close(gcare_estimator*);
+
+/* runs iterations estimates of the query given as its "v ..."/"e ..."
+ * lines and writes their mean and mean seconds; 0 on success, nonzero on
+ * a timeout or an empty query */
+int gcare_estimate(gcare_estimator*, const char* query_text, int iterations,
+                   double* est, double* seconds);
+
+/* estimates the connected sub-patterns of the query in one pass, as a
+ * join-order optimiser asks for them: a sub-pattern is the set of its query
+ * edges, bit i standing for the i'th "e" line. With *num_masks > 0 the
+ * first *num_masks of masks are estimated, each into est; with
+ * *num_masks == 0 all connected sub-patterns are, their masks written to
+ * masks and their count to *num_masks, and a code of 3 returned with just
+ * the count if there are more than capacity. Graph data only, of at most 64
+ * query edges; 0 on success */
+int gcare_estimate_subpatterns(gcare_estimator*, const char* query_text,
+                               int iterations, uint64_t* masks,
+                               size_t* num_masks, size_t capacity,
+                               double* est, double* seconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef GPU_WALK_H_
+#define GPU_WALK_H_
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// WanderJoin walks on a GPU (CUDA or HIP, the GCARE_GPU build option): the
+// CSR arrays of a DataGraph are uploaded once per graph, and a batch of
+// walks of a compiled plan runs as one kernel, a thread per walk, returning
+// each walk's 1/P. A walk draws its randomness from a counter-based stream,
+// a hash of (seed, walk, draw), so it needs no generator state and a batch
+// is the same for the same seed whatever the device. RunWalk is both the
+// kernel body and plain C++, so the walk is the same code on either side.
+#if defined(__CUDACC__) || defined(__HIPCC__)
+#define GCARE_HD __host__ __device__
+#else
+#define GCARE_HD
+#endif
+
+// the longest plan a walk on the device takes
+const int GPU_MAX_STEPS = 16;
+
+// The arrays a walk reads, as DataGraph lays them out in a plain narrow
+// binary (see DataGraph::GetWalkGraph); per direction, out first. Host or
+// device pointers.
+struct WalkGraph {
+  int vnum, vl_num, el_num;
+  const int *offset[2];     // vertex -> first of its labels (vnum + 1)
+  const int *label[2];      // sorted labels per vertex (num_labels)
+  const int *adj_offset[2]; // label slot -> first neighbour (num_labels)
+  const int *adj[2];        // the neighbours (num_adj)
+  int64_t num_labels[2], num_adj[2];
+  const int *vl_offset, *vl; // vertex -> its sorted vertex labels
+  int64_t num_vl;
+  const int *el_rel_offset, *el_rel; // edge label -> its (src, dst) pairs
+  int64_t num_el_rel;
+  const int *vl_rel_offset, *vl_rel; // vertex label -> its vertices
+  int64_t num_vl_rel;
+};
+
+// One step of a compiled walk plan (WanderJoin::WalkStep without its query
+// side): an edge step draws a neighbour of the vertex in column col of slot
+// parent over its label list in direction dir, a vertex step checks that
+// vertex's label; bound holds the data vertices required, -1 if free.
+struct GpuStep {
+  int edge, label, dir, parent, col;
+  int bound[2];
+};
+
+// draw of walk under seed: a splitmix64 hash of the three
+GCARE_HD inline uint64_t WalkRandom(uint64_t seed, uint64_t walk, uint64_t draw) {
+  uint64_t z = seed + walk * 0x9e3779b97f4a7c15ull + draw * 0xd1b54a32d192ed03ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+// [0, n) by multiply-shift; its bias, below n / 2^64, does not show at
+// graph sizes
+GCARE_HD inline int64_t WalkUniform(uint64_t r, int64_t n) {
+#if defined(__CUDA_ARCH__) || defined(__HIP_DEVICE_COMPILE__)
+  return (int64_t)__umul64hi(r, (uint64_t)n);
+#else
+  return (int64_t)(((unsigned __int128)r * (uint64_t)n) >> 64);
+#endif
+}
+
+// position of target in the sorted a[0, n), or -1
+GCARE_HD inline int64_t WalkSearch(const int *a, int64_t n, int target) {
+  int64_t lo = 0, hi = n;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (a[mid] < target)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < n && a[lo] == target ? lo : -1;
+}
+
+// walk number walk of the plan of num_steps steps (at most
+// GPU_MAX_STEPS) and its join checks, 4 ints (slot1, col1, slot2,
+// col2) each; returns its 1/P, or 0 if it failed
+GCARE_HD inline double RunWalk(const WalkGraph &g, const GpuStep *steps,
+                               int num_steps, const int *checks, int num_checks,
+                               uint64_t seed, uint64_t walk) {
+  int t[2 * GPU_MAX_STEPS];
+  uint64_t draw = 0;
+  const GpuStep &s0 = steps[0];
+  double inv_prob;
+  if (s0.edge) {
+    int64_t begin = g.el_rel_offset[s0.label], end = g.el_rel_offset[s0.label + 1];
+    if (begin == end)
+      return 0;
+    int64_t r = begin + WalkUniform(WalkRandom(seed, walk, draw++), end - begin);
+    t[0] = g.el_rel[2 * r];
+    t[1] = g.el_rel[2 * r + 1];
+    inv_prob = (double)(end - begin);
+  } else {
+    int64_t begin = g.vl_rel_offset[s0.label], end = g.vl_rel_offset[s0.label + 1];
+    if (begin == end)
+      return 0;
+    t[0] = t[1] = g.vl_rel[begin + WalkUniform(WalkRandom(seed, walk, draw++), end - begin)];
+    inv_prob = (double)(end - begin);
+  }
+  for (int k = 0; k < num_steps; k++) {
+    const GpuStep &s = steps[k];
+    int *cur = t + 2 * k;
+    if (k > 0) {
+      int v = t[2 * s.parent + s.col];
+      if (s.edge) {
+        int d = s.dir ? 0 : 1;
+        int64_t first = g.offset[d][v];
+        int64_t i = WalkSearch(g.label[d] + first, g.offset[d][v + 1] - first, s.label);
+        if (i < 0)
+          return 0;
+        int64_t begin = g.adj_offset[d][first + i], end = g.adj_offset[d][first + i + 1];
+        if (begin == end)
+          return 0;
+        int other = g.adj[d][begin + WalkUniform(WalkRandom(seed, walk, draw++), end - begin)];
+        inv_prob *= (double)(end - begin);
+        cur[0] = s.dir ? v : other;
+        cur[1] = s.dir ? other : v;
+      } else {
+        int64_t first = g.vl_offset[v];
+        if (WalkSearch(g.vl + first, g.vl_offset[v + 1] - first, s.label) < 0)
+          return 0;
+        cur[0] = cur[1] = v;
+      }
+    }
+    if ((s.bound[0] >= 0 && s.bound[0] != cur[0]) ||
+        (s.bound[1] >= 0 && s.bound[1] != cur[1]))
+      return 0;
+  }
+  for (int c = 0; c < num_checks; c++) {
+    const int *j = checks + 4 * c;
+    if (t[2 * j[0] + j[1]] != t[2 * j[2] + j[3]])
+      return 0;
+  }
+  return inv_prob;
+}
+
+// The uploaded arrays of a graph and the buffers of its batches. Only
+// built with GCARE_GPU (src/gpu_walk.cu).
+class GpuWalker {
+public:
+  // the walker of the arrays g (host memory), uploading them at the first
+  // call for them; nullptr, reported on stderr, if there is no device or
+  // they do not fit on it
+  static GpuWalker *For(const WalkGraph &g);
+  ~GpuWalker();
+
+  // n walks of the plan into est, walk w getting RunWalk(..., seed, w); false,
+  // reported on stderr, on a device error. Batches of several threads run
+  // one after the other
+  bool Walk(const GpuStep *steps, int num_steps, const int *checks,
+            int num_checks, int n, uint64_t seed, double *est);
+
+private:
+  GpuWalker() = default;
+  bool Upload(const WalkGraph &g);
+
+  WalkGraph device_ = {};
+  std::vector<void *> arrays_; // device allocations of device_
+  std::mutex lock_;
+  void *plan_ = nullptr;    // steps, then checks
+  double *est_ = nullptr;
+  int capacity_ = 0;        // walks est_ holds
+};
+
+#endif
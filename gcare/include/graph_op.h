@@ -1,72 +1,151 @@
 #ifndef GRAPH_OP_
 #define GRAPH_OP_
 
+#include <algorithm>
+
+#include "counters.h"
 #include "data_graph.h"
 #include "query_graph.h"
 
+namespace graph {
+
+// Enumerates the matches of the edges of q to data_edges, in lexicographic
+// order of candidate positions. candidates[i] lists the data edges query
+// edge i may map to and must already be filtered by its label (label_edges
+// gives the data edges per label for building them). Next() is an
+// explicit-stack depth-first search resuming where the previous match left
+// off; embedding and edge_idx hold the match until the following call.
+// Once an end of a query edge is bound, only the candidates with that end
+// are visited, looked up in by_end (see BuildCandidateIndex). Buffers are
+// kept across Init() calls.
 struct SubgraphMatching {
   DataGraph* g;
   QueryGraph* q;
   vector<Edge> data_edges; // s_edges_
+  vector<vector<int>> label_edges; // edge label -> ascending ids in data_edges
+  vector<vector<int>> label_in_edges; // edge label -> ids by (dst, id)
   vector<vector<int>> candidates; // -> iterators_
-  vector<int> embedding, cur_embedding; // -> tau_
-  vector<int> edge_idx, cur_edge_idx, prev, cur_idx; // -> edges_
-  bool flag;
+  // by_end[0][i], by_end[1][i]: the positions in candidates[i] ordered by
+  // the src, resp. dst, of their data edges, ascending among equal ends
+  vector<vector<int>> by_end[2];
+  vector<int> embedding; // -> tau_
+  vector<int> edge_idx, pos; // -> edges_; pos[i]: position in candidates[i]
+  vector<pair<int, int>> saved; // embedding of the ends of edge i before it
+  bool started;
   SubgraphMatching() {
     g = NULL;
     q = NULL;
-    data_edges.clear();
-    candidates.clear();
-    embedding.clear();
-    cur_embedding.clear();
-    edge_idx.clear();
-    cur_edge_idx.clear();
-    prev.clear();
-    cur_idx.clear();
-    flag = false;
+    started = false;
+  }
+  // label_edges is in the order of data_edges, so by src if data_edges is
+  void BuildLabelIndex() {
+    for (auto& lst : label_edges) lst.clear();
+    for (size_t j = 0; j < data_edges.size(); j++) {
+      int el = data_edges[j].el;
+      if (el >= static_cast<int>(label_edges.size())) label_edges.resize(el + 1);
+      label_edges[el].push_back(j);
+    }
+    label_in_edges = label_edges;
+    for (auto& lst : label_in_edges)
+      std::stable_sort(lst.begin(), lst.end(), [this](int a, int b) {
+        return data_edges[a].dst < data_edges[b].dst;
+      });
+  }
+  // by_end of candidates, once they are set
+  void BuildCandidateIndex() {
+    for (int d = 0; d < 2; d++) {
+      by_end[d].resize(candidates.size());
+      for (size_t i = 0; i < candidates.size(); i++) {
+        const vector<int>& cand = candidates[i];
+        vector<int>& idx = by_end[d][i];
+        idx.resize(cand.size());
+        for (size_t j = 0; j < cand.size(); j++) idx[j] = j;
+        auto less = [&](int a, int b) { return End(cand[a], d) < End(cand[b], d); };
+        if (!std::is_sorted(idx.begin(), idx.end(), less))
+          std::stable_sort(idx.begin(), idx.end(), less);
+      }
+    }
+  }
+  int End(int edge, int d) const {
+    return d ? data_edges[edge].dst : data_edges[edge].src;
   }
   void Init(DataGraph& g_, QueryGraph& q_) {
     g = &g_;
     q = &q_;
-    flag = false;
-    embedding.clear(); embedding.resize(q->GetNumVertices(), -1);
-    cur_embedding.clear(); cur_embedding.resize(q->GetNumVertices(), -1);
-    edge_idx.clear(); edge_idx.resize(candidates.size(), -1);
-    cur_edge_idx.clear(); cur_edge_idx.resize(candidates.size(), -1);
-    cur_idx.clear(); cur_idx.resize(candidates.size(), -1);
+    started = false;
+    embedding.assign(q->GetNumVertices(), -1);
+    edge_idx.assign(candidates.size(), -1);
+    pos.assign(candidates.size(), -1);
+    saved.resize(candidates.size());
   }
-  bool FindMatchedSubgraph(int i) {
-    if (i == candidates.size()) {
-      if (!flag) {
-        return false;
-      }
-      embedding = cur_embedding;
-      edge_idx = cur_edge_idx;
-      prev = cur_idx;
-      return true;
+  bool Next() {
+    int n = candidates.size();
+    if (n == 0) return false;
+    int i = n - 1;
+    if (!started) {
+      started = true;
+      i = 0;
     }
-    int src = q->GetEdge(i).src;
-    int dst = q->GetEdge(i).dst;
-    int el = q->GetEdge(i).el;
-    for (int j = flag ? 0 : std::max(prev[i], 0); j < static_cast<int>(candidates[i].size()); j++) {
-      int d_src = data_edges[candidates[i][j]].src;
-      int d_dst = data_edges[candidates[i][j]].dst;
-      int d_el = data_edges[candidates[i][j]].el;
-      if (cur_embedding[src] != -1 && cur_embedding[src] != d_src) continue;
-      if (cur_embedding[dst] != -1 && cur_embedding[dst] != d_dst) continue;
-      if (el != d_el) continue;
-      if (!flag && prev[i] < j) flag = true;
-      int prev1 = cur_embedding[src];
-      int prev2 = cur_embedding[dst];
-      cur_embedding[src] = d_src;
-      cur_embedding[dst] = d_dst;
-      cur_edge_idx[i] = candidates[i][j];
-      cur_idx[i] = j;
-      if (FindMatchedSubgraph(i + 1)) return true;
-      cur_embedding[src] = prev1;
-      cur_embedding[dst] = prev2;
+    while (i >= 0) {
+      int src = q->GetEdge(i).src;
+      int dst = q->GetEdge(i).dst;
+      if (pos[i] >= 0) {
+        embedding[src] = saved[i].first;
+        embedding[dst] = saved[i].second;
+      }
+      const vector<int>& cand = candidates[i];
+      int j = NextCandidate(i, pos[i] + 1, embedding[src], embedding[dst]);
+      if (j == -1) {
+        pos[i] = -1;
+        i--;
+        continue;
+      }
+      const Edge& e = data_edges[cand[j]];
+      saved[i] = make_pair(embedding[src], embedding[dst]);
+      embedding[src] = e.src;
+      embedding[dst] = e.dst;
+      edge_idx[i] = cand[j];
+      pos[i] = j;
+      if (i == n - 1) {
+        GCARE_COUNT(join_rows);
+        return true;
+      }
+      i++;
     }
     return false;
   }
+
+private:
+  // the first position from j on in candidates[i] whose data edge has src
+  // s and dst d, either -1 if free; -1 if there is none. With an end bound
+  // the positions having it are those of a range of by_end, the shorter
+  // one if both are
+  int NextCandidate(int i, int j, int s, int d) const {
+    const vector<int>& cand = candidates[i];
+    if (s == -1 && d == -1) return j < static_cast<int>(cand.size()) ? j : -1;
+    const int* first = nullptr;
+    const int* last = nullptr;
+    for (int k = 0; k < 2; k++) {
+      int v = k ? d : s;
+      if (v == -1) continue;
+      const vector<int>& idx = by_end[k][i];
+      const int* lo = std::lower_bound(idx.data(), idx.data() + idx.size(), v,
+          [&](int p, int x) { return End(cand[p], k) < x; });
+      const int* hi = std::upper_bound(lo, idx.data() + idx.size(), v,
+          [&](int x, int p) { return x < End(cand[p], k); });
+      if (first == nullptr || hi - lo < last - first) {
+        first = lo;
+        last = hi;
+      }
+    }
+    for (first = std::lower_bound(first, last, j); first != last; ++first) {
+      const Edge& e = data_edges[cand[*first]];
+      if ((s == -1 || e.src == s) && (d == -1 || e.dst == d)) return *first;
+    }
+    return -1;
+  }
 };
+
+}  // namespace graph
+
 #endif
@@ -6,6 +6,9 @@
 #include "../include/query_graph.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
 #include <unordered_map>
 #include <vector>
 #include <boost/functional/hash.hpp>
@@ -14,11 +17,70 @@ using std::unordered_map;
 using std::pair;
 using std::vector;
 
+namespace graph {
+
+// Impr can process queries of at most this many vertices
+#define IMPR_MAX_VERTICES 8
+
+// Fixed-capacity ring buffer holding the sliding window of an Impr walk.
+template <typename T>
+struct WalkWindow {
+  static const int CAP = 16; // power of two > IMPR_MAX_VERTICES
+  T items[CAP];
+  int head = 0, len = 0;
+
+  int size() const { return len; }
+  T& operator[](int i) { return items[(head + i) & (CAP - 1)]; }
+  T& back() { return (*this)[len - 1]; }
+  void push_back(const T& x) {
+    assert(len < CAP);
+    items[(head + len) & (CAP - 1)] = x;
+    len++;
+  }
+  void pop_back() { len--; }
+  void pop_front() {
+    head = (head + 1) & (CAP - 1);
+    len--;
+  }
+  void clear() { head = len = 0; }
+};
+
 class Impr : public Estimator {
  public:
+  // query vertex -> data vertex; -1 past the query's vertices
+  typedef std::array<int, IMPR_MAX_VERTICES> Mapping;
+
+  // The state of one walk. Run on a single chain by default; with
+  // GCARE_IMPR_CHAINS=k, k chains walk on their own threads, each with its
+  // own RNG, and draw their steps from one shared budget
+  struct Chain {
+    WalkWindow<int> xk, case_num;
+    WalkWindow<pair<int, bool>> el;
+    // embeddings already counted for the current sample, kept sorted
+    vector<Mapping> is_duplicate;
+    // The adjacency among the vertices of a sample, built once per sample
+    // by BuildMasks: bit j of mask[l][i] is set if xk[j] is in the list of
+    // xk[i] with label and direction query_labels_[l], and nbrs[i] sums
+    // the sizes of those lists
+    vector<std::array<uint32_t, IMPR_MAX_VERTICES>> mask;
+    Mapping nbrs;
+    double sum;
+    int size;
+    // the labels of the lists EstCard prefetches
+    vector<int> out_el;
+    // steps taken as far as the chain knows, its own and, with several
+    // chains, those of the others when it last drew on the budget
+    int step;
+    Rng* rng; // rng_ for a single chain, own_rng otherwise
+    Rng own_rng;
+    vector<double> cards; // the estimates of the chain's samples
+  };
+
 	//build mode
 	void PrepareSummaryStructure(DataGraph&, double); 
 	void WriteSummary(const char*); 
+	bool FixedSummary() { return true; }
+	unsigned DataSections() { return SECTION_OUT | SECTION_IN | SECTION_VLABELS; }
 	
 	//query mode
 	void Init();
@@ -27,52 +89,75 @@ class Impr : public Estimator {
 	bool GetSubstructure(int); 
 	double EstCard(int);
 	double AggCard();
+	double AggVariance();
 	double GetSelectivity();
+	bool EstimatesMean() { return true; }
 
   double Count(int, double);
   int getBeta(vector<int>, vector<bool>, int);
   off_t StrLen(char*);
   int StrToInt(char*);
   void Preprocess(void);
+  void PrepareShape();
   void DFS(int);
-  pair<int, bool> ChooseELabel(int, vector<pair<int, bool>>&, int&, int&);
-  int Select(vector<int>&, vector<int>&, bool&, int&);
-  bool Check(vector<int>&, vector<int>&, vector<pair<int, bool>>&);
-  bool GetNextSample(vector<int>&, vector<int>&, vector<pair<int, bool>>&, int&, int);
-  double GetWeight(vector<int>&);
-  void FindPaths(int, vector<int>&, int, double);
+  pair<int, bool> ChooseELabel(Rng&, int, vector<pair<int, bool>>&, int&, int&);
+  // EstCard, Select and Check for queries of N vertices, dispatched by
+  // query size; N = 0 takes it from q at run time. With N fixed the loops
+  // over query vertices and walk edges have constant trip counts
+  double EstCardOf(Chain&);
+  template <int N> double EstCardN(Chain&);
+  template <int N> int Select(WalkWindow<int>&, const Mapping&, bool&, int&);
+  template <int N> bool Check(Chain&, const Mapping&);
+  bool GetNextSample(Chain&, int);
+  void BuildMasks(Chain&);
+  double GetWeight(Chain&);
+  void FindPaths(Chain&, int, uint32_t, int, double);
   int GetBeta(int);
 
  private:
+  // runs the chains to the end of the budget, on their own threads
+  void RunChains();
+
   struct ContainerHash {
     size_t operator () (vector<pair<int, bool>> const& c) const {
       return boost::hash_range(c.begin(), c.end());
     }
   };
-  struct Vector1DHash {
-    size_t operator () (vector<int> const& c) const {
-      return boost::hash_range(c.begin(), c.end());
-    }
-  };
   struct Comp {
     bool operator()(const pair<int, int>& lhs, const int& rhs) { return lhs.first < rhs; }
     bool operator()(const int& lhs, const pair<int, int>& rhs) { return lhs < rhs.first; }
     bool operator()(const int& lhs, const int& rhs) { return lhs < rhs; }
   };
-  unordered_map<vector<int>, bool, Vector1DHash> is_duplicate_;
   vector<int> qv_;
   vector<bool> chk_;
   vector<int> indeg_, outdeg_;
   int cnt1_, cnt2_;
   vector<double> est_;
-  double sum_;
-  int size_;
-  vector<int> xk_, case_num_;
-  vector<pair<int, bool>> el_;
-  int beta_, step_, s_num_;
+  int beta_, s_num_;
+  vector<Chain> chains_;
+  // with several chains: the steps they took in all, and their estimates,
+  // chain after chain, which GetSubstructure and EstCard step through
+  std::atomic<int> steps_;
+  vector<double> chain_cards_;
+  size_t chain_pos_;
+  bool chains_run_;
+  vector<int> shape_; // query the members below were prepared for
   vector<pair<int, bool>> query_labels_;
-  vector<vector<int>> pos_embs_;
+  vector<Edge> query_edges_;
+  vector<Mapping> pos_embs_;
+  // query edge k is query_labels_[edge_label_[k]]
+  vector<int> edge_label_;
   vector<int> path_;
+  // q->GetELabel(u, v) of the shape, and the bound and label of each query
+  // vertex, read by the kernels instead of q
+  int elabel_[IMPR_MAX_VERTICES][IMPR_MAX_VERTICES];
+  Mapping bound_, vlabel_;
+  // neighbours whose lists EstCard prefetches ahead (GCARE_INTERLEAVE=d,
+  // default 0 = none)
+  static const int DEFAULT_INTERLEAVE = 0;
+  int interleave_ = DEFAULT_INTERLEAVE;
 };
 
+}  // namespace graph
+
 #endif
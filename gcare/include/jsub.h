@@ -1,13 +1,24 @@
 #ifndef JSUB_H_ 
 #define JSUB_H_
 
+#include <array>
+#include <atomic>
+
 #include "estimator.h"
+#include "memo_table.h"
+#include "candidate_filter.h"
+#include "plan_cache.h"
+#include "start_pool.h"
+#include "start_strata.h"
+
+namespace graph {
 
 class JSUB : public Estimator {
 public:
 	//build mode
 	void PrepareSummaryStructure(DataGraph&, double); 
 	void WriteSummary(const char*); 
+	bool FixedSummary() { return true; }
 	
 	//query mode
 	void ReadSummary(const char*); 
@@ -17,42 +28,134 @@ public:
 	double EstCard(int); 
 	double AggCard();
 	double GetSelectivity();
+	bool EstimatesMean() { return true; }
   
 private:
 	void generateWalkPlans();
-	void generateWalkPlans(int);
-	bool checkBoundedVertices(int, vector<int>);
+	void loadPlans(const string&);
+	bool checkBoundedVertices(int, const array<int, 2>&);
 	bool checkLabelStatistics(int); 
-	int  sampleTuple(int);
+	double sampleTuple(int);
+	bool anchored(int);
+	double anchorTuple(int, array<int, 2>&);
 	int  sampleTuple(int, int, int); 
-	double memoi(int, pair<int, int>);
+	struct DPShard;
+	double memoi(DPShard&, int, pair<int, int>, bool&);
+	void compileDP();
+	inline void enqueue(DPShard&, int, uint64_t);
+	size_t memoShare() const;
+	void trimMemo(vector<MemoTable>&);
+	inline void prefetch(DPShard&, int, size_t, int);
+	bool drawTuple(int, double&, pair<int, int>&);
+	bool runBatch();
 	int  nodeToOffset(int);
+	const vector<int>& nodeTuples(int);
 	int  M(int);
 	
 	int getR1TupleNum(int);
 	int getNextTuple(int);
 
-	//node is similarly as in WanderJoin, i.e., a table in relational model
-	map<int, int> node_to_v_;
+	//node is similarly as in WanderJoin, i.e., a table in relational model;
+	//per-query state of this kind lives on the arena (see Estimator::Fresh)
+	std::pmr::map<int, int> node_to_v_;
 	//use adj_ instead of join_from_ and join_to_
-	vector<vector<tuple<int, int, int>>> adj_; //node id -> vector of (column, joinable node id, joinable node column)
+	std::pmr::vector<std::pmr::vector<tuple<int, int, int>>> adj_; //node id -> vector of (column, joinable node id, joinable node column)
 
-	vector<bool> visited_;
-	vector<int> seq_;
-	vector<pair<int, int>> plan_, counterpart_;
-	vector<vector<pair<int, int>>> plans_, counterparts_;
-	vector<vector<int>> sampled_tuples_;
+	//the walk plans DecomposeQuery tries, in order: per order the node and
+	//its column joining an earlier one, and that node and its column,
+	//(-1, -1) for the first (see generateWalkPlans)
+	std::pmr::vector<std::pmr::vector<pair<int, int>>> plans_, counterparts_;
+	//per plan, the trials DecomposeQuery gives it: the orders of its join
+	//tree that were enumerated
+	std::pmr::vector<int> plan_trials_;
+	//the plans, and the choice, of earlier runs (see PlanCache)
+	PlanCache plan_cache_;
+	PlanCache::Mode plan_cache_mode_;
+	vector<array<int, 2>> sampled_tuples_; //(v, -1) for a vertex node
 
 	int offset_;
 	int node_num_;
-	int sample_cnt_, sample_size_;
+	int sample_size_;
+	//what is left of the sample size; the threads of a batch take the
+	//cost of their DPs from it
+	std::atomic<long> sample_cnt_;
 	int pos_;
 	double inv_prob_;
-	bool out_of_cnt_;
-	vector<map<pair<int, int>, double>> w_; //order -> tuple -> DP result
+
+	//the memo of the DP and the tuples it evaluates next
+	struct DPShard {
+		vector<MemoTable> w; //order -> packed tuple -> DP result
+		vector<vector<uint64_t>> frontier; //order -> tuples to evaluate
+	};
+	//shards_[0] for the sequential DP, shards_[t] for thread t of a batch
+	vector<DPShard> shards_;
+	//GCARE_JSUB_MEMO_MB: the bytes the memo tables may keep between DPs
+	//(0, the default: no limit), see trimMemo; a DP's own entries stay
+	//until it is done, so the memo peaks at this plus the largest DP, which
+	//the sample size bounds
+	size_t memo_bytes_;
+	static const size_t MEMO_ENTRY_BYTES = 48;
+
+	//a child of an order in the chosen plan: the DP multiplies, over the
+	//children, the sum of w(child, t') over the tuples t' joining with t
+	struct DPChild {
+		int  order;
+		bool edge;  //label is an edge label, else a vertex label
+		int  label;
+		bool dir;   //edge: t' = (t[col], nbr) if true, else (nbr, t[col])
+		int  col;   //column of t holding the join vertex
+		int  vertex; //query vertex of the neighbour (edge)
+		bool leaf;  //w(child, .) = 1
+	};
+	std::pmr::vector<std::pmr::vector<DPChild>> children_; //order -> children
+	vector<vector<uint64_t>> frontier_; //order -> tuples to evaluate
+	//tuples the DP prefetches ahead (GCARE_INTERLEAVE=d, default 0 = none)
+	static const int DEFAULT_INTERLEAVE = 0;
+	int interleave_;
+
+	//edge start tuples are drawn by degree stratum when the summary has
+	//strata (GCARE_WJ_STRATA=0 draws uniformly anyway)
+	StartStrata strata_;
+	bool strata_on_;
+
+	//a start node with a bound vertex draws its tuples through that vertex,
+	//and plans starting at such nodes rank first (GCARE_WJ_ANCHOR=0 turns
+	//this off, as for WanderJoin)
+	bool anchor_on_;
+
+	//with GCARE_START_POOL=1, uniform start tuples come from the shared
+	//pool's stream of this run and node (see StartPool)
+	bool pool_on_;
+	vector<StartPool::Stream> start_streams_;
+
+	//with GCARE_CAND_FILTER=1, start tuples are drawn from, and walks and
+	//the DP step onto, candidates of filter_ only; node_tuples_ caches the
+	//candidate tuples of a node, flattened
+	bool filter_on_;
+	CandidateFilter filter_;
+	vector<vector<int>> node_tuples_;
+	vector<bool> node_tuples_built_;
 
 	pair<int, int> r1_tuple_;
 	int r1_tuple_idx_, r1_tuple_num_;
+
+	//with GCARE_JSUB_THREADS=n, the R1 tuples are drawn as one thread
+	//would, a batch at a time, and the DPs of a batch run on n threads;
+	//GetSubstructure() and EstCard() then step through the batch
+	static const int BATCH_PER_THREAD = 16;
+	int num_threads_;
+	vector<pair<int, int>> batch_tuples_;
+	vector<double> batch_inv_prob_, batch_join_, batch_card_;
+	vector<char> batch_out_; //the DP ran out of the sample size
+	size_t batch_pos_;
+	bool batch_last_; //the batch ran out of the sample size
+	//with GCARE_JSUB_SHARED_MEMO=1, the results of the R1 tuples of earlier
+	//batches, read by every thread, so that a tuple drawn again is not
+	//evaluated again in another shard
+	bool shared_on_;
+	MemoTable shared_w_;
 };
 
+}  // namespace graph
+
 #endif
@@ -0,0 +1,74 @@
+#ifndef LABEL_STATS_H_
+#define LABEL_STATS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Which labels meet at a vertex of the data graph: whether some vertex has
+// an edge of label el1 in direction d1 and one of el2 in d2 (el1 == el2 and
+// d1 == d2 too: whether any vertex has such an edge), and whether some
+// vertex of label vl has an edge of el in d; d is 0 for out-edges and 1 for
+// in-edges. A query vertex that needs a combination no data vertex has
+// makes the query provably empty (see Estimator::ProvablyEmpty).
+//
+// .graph.labelstats, written with the binary: vnum, vl_num, el_num, then
+// the (2 el_num)^2 pair bits and the vl_num * 2 el_num vertex-label bits,
+// in 64-bit words. Graphs whose bits would exceed MAX_BITS get none.
+class LabelStats {
+public:
+  static const int64_t MAX_BITS = int64_t(1) << 28;
+
+  // the words of the bits of the labels, the header excluded
+  static int64_t Words(int vl_num, int el_num) {
+    int64_t keys = 2 * (int64_t)el_num;
+    return (keys * keys + 63) / 64 + ((int64_t)vl_num * keys + 63) / 64;
+  }
+  static bool Fits(int vl_num, int el_num) {
+    int64_t keys = 2 * (int64_t)el_num;
+    return keys * keys + (int64_t)vl_num * keys <= MAX_BITS;
+  }
+
+  // words as the body of a file, or as built
+  void Attach(uint64_t* words, int vl_num, int el_num) {
+    words_ = words;
+    vl_num_ = vl_num;
+    el_num_ = el_num;
+    vertex_ = words + (4 * (int64_t)el_num * el_num + 63) / 64;
+  }
+  void Clear() { words_ = nullptr; }
+  bool Loaded() const { return words_ != nullptr; }
+
+  bool Joins(int el1, int d1, int el2, int d2) const {
+    return Bit(words_, Key(el1, d1) * 2 * (int64_t)el_num_ + Key(el2, d2));
+  }
+  bool Carries(int vl, int el, int d) const {
+    return Bit(vertex_, (int64_t)vl * 2 * el_num_ + Key(el, d));
+  }
+
+  // build: records the (el, d) keys of one vertex of vertex labels vl[0,
+  // num_vl); safe to call from several threads at once
+  void AddVertex(const int* keys, size_t num_keys, const int* vl, size_t num_vl) {
+    int64_t row = 2 * (int64_t)el_num_;
+    for (size_t i = 0; i < num_keys; i++) {
+      for (size_t j = 0; j < num_keys; j++)
+        Set(words_, keys[i] * row + keys[j]);
+      for (size_t l = 0; l < num_vl; l++)
+        Set(vertex_, vl[l] * row + keys[i]);
+    }
+  }
+  static int Key(int el, int d) { return 2 * el + d; }
+
+private:
+  static bool Bit(const uint64_t* w, int64_t i) { return (w[i >> 6] >> (i & 63)) & 1; }
+  void Set(uint64_t* w, int64_t i) {
+    uint64_t bit = uint64_t(1) << (i & 63);
+    if (!(__atomic_load_n(&w[i >> 6], __ATOMIC_RELAXED) & bit))
+      __atomic_fetch_or(&w[i >> 6], bit, __ATOMIC_RELAXED);
+  }
+
+  uint64_t* words_ = nullptr;
+  uint64_t* vertex_ = nullptr;
+  int vl_num_ = 0, el_num_ = 0;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef MEMO_TABLE_H_
+#define MEMO_TABLE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "counters.h"
+#include "memory.h"
+
+// Open-addressing (linear probing) map from 64-bit keys to doubles, stored
+// in one contiguous slot array. EMPTY (all ones) cannot be used as a key.
+// Clear() keeps the slots, so a table reused across runs stops allocating
+// once it has grown to the working-set size. With SetClock, Find marks the
+// slots it hits, and Evict keeps the marked entries (CLOCK) to shrink the
+// table to a memory budget.
+class MemoTable {
+public:
+	static const uint64_t EMPTY = ~0ull;
+
+	MemoTable() : size_(0), mask_(0), clock_(false), hand_(0) {}
+
+	// packs a pair of ints (e.g. a sampled tuple) into a key
+	static inline uint64_t Key(int a, int b) {
+		return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+	}
+
+	inline bool Find(uint64_t key, double& value) const {
+		if (size_ == 0) {
+			GCARE_COUNT(memo_misses);
+			return false;
+		}
+		for (size_t i = Hash(key); ; i = (i + 1) & mask_) {
+			const Slot& s = slots_[i];
+			if (s.key == key) {
+				value = s.value;
+				// relaxed, as tables shared by readers are found concurrently
+				if (clock_ && !__atomic_load_n(&ref_[i], __ATOMIC_RELAXED))
+					__atomic_store_n(&ref_[i], 1, __ATOMIC_RELAXED);
+				GCARE_COUNT(memo_hits);
+				return true;
+			}
+			if (s.key == EMPTY) {
+				GCARE_COUNT(memo_misses);
+				return false;
+			}
+		}
+	}
+
+	// inserts or overwrites
+	inline void Insert(uint64_t key, double value) {
+		if ((size_ + 1) * 4 > slots_.size() * 3) Grow();
+		for (size_t i = Hash(key); ; i = (i + 1) & mask_) {
+			Slot& s = slots_[i];
+			if (s.key == key) {
+				s.value = value;
+				return;
+			}
+			if (s.key == EMPTY) {
+				s.key = key;
+				s.value = value;
+				if (clock_) ref_[i] = 1;
+				size_++;
+				return;
+			}
+		}
+	}
+
+	// inserts unless present; returns whether it did
+	inline bool TryInsert(uint64_t key, double value) {
+		if ((size_ + 1) * 4 > slots_.size() * 3) Grow();
+		for (size_t i = Hash(key); ; i = (i + 1) & mask_) {
+			Slot& s = slots_[i];
+			if (s.key == key) return false;
+			if (s.key == EMPTY) {
+				s.key = key;
+				s.value = value;
+				if (clock_) ref_[i] = 1;
+				size_++;
+				return true;
+			}
+		}
+	}
+
+	void Clear() {
+		if (size_ == 0) return;
+		for (Slot& s : slots_) s.key = EMPTY;
+		std::fill(ref_.begin(), ref_.end(), 0);
+		size_ = 0;
+	}
+
+	size_t Size() const { return size_; }
+	// bytes of the slots (and the marks)
+	size_t MemoryBytes() const { return slots_.size() * (sizeof(Slot) + (clock_ ? 1 : 0)); }
+
+	// whether Find marks the entries it hits, for Evict
+	void SetClock(bool clock) {
+		clock_ = clock;
+		ref_.assign(clock ? slots_.size() : 0, 0);
+	}
+
+	// drops entries until at most keep are left, and the slots down to the
+	// fewest that hold them: a hand sweeps the slots on from where it
+	// stopped, dropping the unmarked entries and unmarking the others, so
+	// that the entries inserted or found since it last passed stay; without
+	// SetClock, in slot order
+	void Evict(size_t keep) {
+		if (size_ <= keep && slots_.size() <= Slots(keep)) return;
+		for (size_t n = 0; size_ > keep && n < 2 * slots_.size(); n++) {
+			size_t i = hand_;
+			hand_ = (hand_ + 1) & mask_;
+			if (slots_[i].key == EMPTY) continue;
+			if (clock_ && ref_[i]) {
+				ref_[i] = 0;
+				continue;
+			}
+			slots_[i].key = EMPTY;
+			size_--;
+		}
+		Rehash(Slots(keep));
+	}
+
+	// hint that key is looked up soon
+	inline void Prefetch(uint64_t key) const {
+		if (!slots_.empty()) __builtin_prefetch(&slots_[Hash(key)]);
+	}
+
+private:
+	struct Slot {
+		uint64_t key;
+		double value;
+	};
+
+	inline size_t Hash(uint64_t key) const {
+		key ^= key >> 29;
+		key *= 0x9e3779b97f4a7c15ull;
+		return (key >> 32) & mask_;
+	}
+
+	void Grow() { Rehash(slots_.empty() ? 64 : slots_.size() * 2); }
+
+	// the fewest slots, a power of two, that Insert lets hold n entries
+	static size_t Slots(size_t n) {
+		size_t slots = 64;
+		while ((n + 1) * 4 > slots * 3) slots *= 2;
+		return slots;
+	}
+
+	// the entries, and their marks, into n slots
+	void Rehash(size_t n) {
+		TrackedVector<Slot, MEMORY_MEMO> old;
+		old.swap(slots_);
+		TrackedVector<uint8_t, MEMORY_MEMO> old_ref;
+		old_ref.swap(ref_);
+		slots_.assign(n, Slot{EMPTY, 0});
+		ref_.assign(clock_ ? n : 0, 0);
+		mask_ = n - 1;
+		//at the same place of the new slots
+		hand_ = old.empty() ? 0 : (size_t)((double)hand_ / old.size() * n) & mask_;
+		size_ = 0;
+		for (size_t j = 0; j < old.size(); j++) {
+			if (old[j].key == EMPTY) continue;
+			size_t i = Hash(old[j].key);
+			while (slots_[i].key != EMPTY) i = (i + 1) & mask_;
+			slots_[i] = old[j];
+			if (clock_ && !old_ref.empty()) ref_[i] = old_ref[j];
+			size_++;
+		}
+	}
+
+	TrackedVector<Slot, MEMORY_MEMO> slots_;
+	size_t size_, mask_;
+	// SetClock: a mark per slot, and where Evict's hand stopped
+	bool clock_;
+	mutable TrackedVector<uint8_t, MEMORY_MEMO> ref_;
+	size_t hand_;
+};
+
+#endif
@@ -2,33 +2,49 @@
 #define MEMORY_H_
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <vector>
+#include <sys/resource.h>
 
 using namespace std;
 
-inline int parseLine(char* line) {
-  int i = strlen(line);
-  while (*line < '0' || *line > '9') line++;
-  line[i - 3] = '\0';
-  i = atoi(line);
-  return i;
+// the kB value of a "Name:   1234 kB" line of /proc/self/status
+inline int parseLine(const char* line) {
+  while (*line && (*line < '0' || *line > '9')) line++;
+  return (int)strtol(line, NULL, 10);
 }
 
-inline int getValueOfPhysicalMemoryUsage(){
+// a field of /proc/self/status in kB, or -1 if there is none
+inline int readStatusKB(const char* field) {
 #ifdef __linux__
   FILE* file = fopen("/proc/self/status", "r");
+  if (file == NULL) return -1;
   int result = -1;
+  size_t len = strlen(field);
   char line[128];
 
   while (fgets(line, 128, file) != NULL){
-    if (strncmp(line, "VmRSS:", 6) == 0){
-      result = parseLine(line);
+    if (strncmp(line, field, len) == 0){
+      result = parseLine(line + len);
       break;
     }
   }
   fclose(file);
   return result;
+#else
+  return -1;
+#endif
+}
+
+// current resident set in kB
+inline int getValueOfPhysicalMemoryUsage(){
+#ifdef __linux__
+  return readStatusKB("VmRSS:");
 #elif __APPLE__
   return 0;
 #else
@@ -36,4 +52,127 @@ inline int getValueOfPhysicalMemoryUsage(){
 #endif
 }
 
+// peak resident set in kB since the start of the process or the last
+// resetPeakPhysicalMemoryUsage(); getrusage's lifetime peak where the kernel
+// has no VmHWM
+inline int getPeakPhysicalMemoryUsage() {
+  int hwm = readStatusKB("VmHWM:");
+  if (hwm >= 0) return hwm;
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef __APPLE__
+  return (int)(usage.ru_maxrss / 1024); // bytes there
+#else
+  return (int)usage.ru_maxrss;
+#endif
+}
+
+// restarts the VmHWM peak at the current resident set (Linux 4.0 and later),
+// so that it covers e.g. one query only; false if not supported
+inline bool resetPeakPhysicalMemoryUsage() {
+#ifdef __linux__
+  FILE* file = fopen("/proc/self/clear_refs", "w");
+  if (file == NULL) return false;
+  bool ok = fputs("5", file) >= 0;
+  return fclose(file) == 0 && ok;
+#else
+  return false;
+#endif
+}
+
+// Bytes allocated per subsystem through CountingAllocator (or Allocate/Free
+// for raw buffers), with the peak since the last ResetPeak().
+enum MemorySubsystem { MEMORY_RELATION, MEMORY_MEMO, MEMORY_ARENA, NUM_MEMORY_SUBSYSTEMS };
+
+inline const char* MemorySubsystemName(int subsystem) {
+  static const char* names[NUM_MEMORY_SUBSYSTEMS] = {"relation", "memo", "arena"};
+  return names[subsystem];
+}
+
+// The cap of one query session, an in-process iteration (see
+// QueryParams::memory_limit): what the threads it is attached to (see
+// ScopedMemoryBudget) allocate through the accounts below, net of what they
+// free, is charged to it. Going over the limit only marks it Exceeded();
+// the estimator notices at its next deadline poll and aborts the query (see
+// Estimator::CheckDeadline), as a forked child would be killed.
+struct MemoryBudget {
+  int64_t limit = 0; // bytes, 0 for none
+  std::atomic<int64_t> used{0};
+  std::atomic<bool> exceeded{false};
+
+  explicit MemoryBudget(int64_t limit_bytes = 0) : limit(limit_bytes) {}
+
+  void Charge(int64_t bytes) {
+    int64_t now = used += bytes;
+    if (limit > 0 && now > limit) exceeded.store(true, std::memory_order_relaxed);
+  }
+  bool Exceeded() const { return exceeded.load(std::memory_order_relaxed); }
+};
+
+inline MemoryBudget*& ThreadMemoryBudget() {
+  static thread_local MemoryBudget* budget = nullptr;
+  return budget;
+}
+
+// charges the calling thread's allocations to budget (none if null) for
+// its lifetime; worker threads of a session take one each
+class ScopedMemoryBudget {
+public:
+  explicit ScopedMemoryBudget(MemoryBudget* budget) : saved_(ThreadMemoryBudget()) {
+    ThreadMemoryBudget() = budget;
+  }
+  ~ScopedMemoryBudget() { ThreadMemoryBudget() = saved_; }
+  ScopedMemoryBudget(const ScopedMemoryBudget&) = delete;
+  ScopedMemoryBudget& operator=(const ScopedMemoryBudget&) = delete;
+
+private:
+  MemoryBudget* saved_;
+};
+
+struct MemoryAccount {
+  std::atomic<int64_t> current{0};
+  std::atomic<int64_t> peak{0};
+
+  void Allocate(size_t bytes) {
+    int64_t now = current += bytes;
+    int64_t p = peak.load(std::memory_order_relaxed);
+    while (now > p && !peak.compare_exchange_weak(p, now)) {}
+    if (MemoryBudget* budget = ThreadMemoryBudget()) budget->Charge(bytes);
+  }
+  void Free(size_t bytes) {
+    current -= bytes;
+    if (MemoryBudget* budget = ThreadMemoryBudget()) budget->Charge(-(int64_t)bytes);
+  }
+  void ResetPeak() { peak = current.load(); }
+};
+
+inline MemoryAccount& GetMemoryAccount(int subsystem) {
+  static MemoryAccount accounts[NUM_MEMORY_SUBSYSTEMS];
+  return accounts[subsystem];
+}
+
+template <class T, int Subsystem>
+struct CountingAllocator {
+  typedef T value_type;
+  template <class U> struct rebind { typedef CountingAllocator<U, Subsystem> other; };
+
+  CountingAllocator() {}
+  template <class U> CountingAllocator(const CountingAllocator<U, Subsystem>&) {}
+
+  T* allocate(size_t n) {
+    GetMemoryAccount(Subsystem).Allocate(n * sizeof(T));
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* p, size_t n) {
+    GetMemoryAccount(Subsystem).Free(n * sizeof(T));
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <class U> bool operator==(const CountingAllocator<U, Subsystem>&) const { return true; }
+  template <class U> bool operator!=(const CountingAllocator<U, Subsystem>&) const { return false; }
+};
+
+template <class T, int Subsystem>
+using TrackedVector = std::vector<T, CountingAllocator<T, Subsystem>>;
+
 #endif
@@ -0,0 +1,226 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Live operational metrics of a long-running gcare, server mode (-S) in
+// particular, read in the Prometheus text format from --metrics-port or a
+// "stats" request (see src/metrics.cc). Each method is a series, interned
+// once by name; recording into it is a relaxed add to the calling thread's
+// shard, allocated on its first record, so the hot paths take no lock and
+// share no cache line. A scrape sums the live shards and those of the
+// threads that ended. The histograms are HDR-style: values below 8 exact,
+// then 8 linear sub-buckets per power of two, a relative error of at most
+// 1/8 for the 496 counters of a histogram.
+class MetricsHistogram {
+public:
+  static const int SUB_BITS = 3, SUB = 1 << SUB_BITS;
+  static const int NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+  static int Bucket(uint64_t v) {
+    if (v < SUB) return static_cast<int>(v);
+    int m = 63 - __builtin_clzll(v);
+    return (m - SUB_BITS + 1) * SUB + static_cast<int>((v >> (m - SUB_BITS)) & (SUB - 1));
+  }
+  // the smallest value of bucket b
+  static uint64_t Lower(int b) {
+    if (b < SUB) return b;
+    int m = b / SUB + SUB_BITS - 1;
+    return static_cast<uint64_t>(SUB + b % SUB) << (m - SUB_BITS);
+  }
+
+  // by the owning thread only
+  void Record(uint64_t v) {
+    Bump(count_[Bucket(v)], 1);
+    Bump(sum_, v);
+  }
+
+  // of a scrape
+  void Add(const MetricsHistogram& o) {
+    for (int b = 0; b < NUM_BUCKETS; b++) Bump(count_[b], o.count_[b].load(std::memory_order_relaxed));
+    Bump(sum_, o.sum_.load(std::memory_order_relaxed));
+  }
+  uint64_t Count(int b) const { return count_[b].load(std::memory_order_relaxed); }
+  uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+  uint64_t Total() const {
+    uint64_t n = 0;
+    for (int b = 0; b < NUM_BUCKETS; b++) n += Count(b);
+    return n;
+  }
+  // the value at fraction f of the recorded ones, by nearest rank: the
+  // middle of its bucket
+  uint64_t Quantile(double f) const {
+    uint64_t total = Total(), seen = 0;
+    if (total == 0) return 0;
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(f * total + 0.999999));
+    for (int b = 0; b < NUM_BUCKETS; b++) {
+      seen += Count(b);
+      if (seen >= rank) return b + 1 < NUM_BUCKETS ? (Lower(b) + Lower(b + 1) - 1) / 2 : Lower(b);
+    }
+    return Lower(NUM_BUCKETS - 1);
+  }
+
+private:
+  // a single writer, so no read-modify-write is needed
+  static void Bump(std::atomic<uint64_t>& a, uint64_t v) {
+    a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> count_[NUM_BUCKETS] = {};
+  std::atomic<uint64_t> sum_{0};
+};
+
+enum MetricsCounter {
+  METRIC_QUERIES,           // queries the driver ran
+  METRIC_FAILURES,          // of those, the ones that gave no estimate
+  METRIC_TIMEOUTS,          // failures of an iteration over the timeout
+  METRIC_MEMORY_ERRORS,     // over the memory limit
+  METRIC_CRASHES,           // killed by a signal
+  METRIC_ITERATIONS,        // Estimator::Run() calls that completed
+  METRIC_PARTIAL_ITERATIONS, // of those, the ones the timeout cut short
+  NUM_METRICS_COUNTERS
+};
+
+enum MetricsHistogramId {
+  METRIC_QUERY_SECONDS,     // of a whole query, in microseconds
+  METRIC_ITERATION_SECONDS, // of an iteration, in microseconds
+  METRIC_ITERATION_SAMPLES, // substructures an iteration estimated
+  METRIC_QUERY_MEMO_BYTES,  // peak memo bytes of a query's iterations
+  NUM_METRICS_HISTOGRAMS
+};
+
+struct MetricsSeries {
+  std::atomic<uint64_t> counter[NUM_METRICS_COUNTERS] = {};
+  MetricsHistogram histogram[NUM_METRICS_HISTOGRAMS];
+};
+
+class Metrics {
+public:
+  static const int MAX_SERIES = 64;
+
+  static Metrics& Get() {
+    static Metrics metrics;
+    return metrics;
+  }
+
+  // the series of method, made on first use; -1 past MAX_SERIES methods,
+  // which records nothing
+  int Series(const std::string& method) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < names_.size(); i++)
+      if (names_[i] == method) return i;
+    if (names_.size() == MAX_SERIES) return -1;
+    names_.push_back(method);
+    return names_.size() - 1;
+  }
+
+  void Count(int series, MetricsCounter c, uint64_t n = 1) {
+    MetricsSeries* s = Local(series);
+    if (s == nullptr) return;
+    s->counter[c].store(s->counter[c].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  void Record(int series, MetricsHistogramId h, uint64_t v) {
+    MetricsSeries* s = Local(series);
+    if (s != nullptr) s->histogram[h].Record(v);
+  }
+  // a gauge the driver sets, e.g. the bytes of a series' summary
+  void SetSummaryBytes(int series, uint64_t bytes) {
+    if (series >= 0 && series < MAX_SERIES) summary_bytes_[series].store(bytes, std::memory_order_relaxed);
+  }
+
+  // the names and sums over all threads of the series so far
+  void Scrape(std::vector<std::string>& names, std::vector<MetricsSeries>& sums,
+              std::vector<uint64_t>& summary_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    names = names_;
+    sums = std::vector<MetricsSeries>(names_.size());
+    summary_bytes.assign(names_.size(), 0);
+    for (size_t i = 0; i < names_.size(); i++) {
+      summary_bytes[i] = summary_bytes_[i].load(std::memory_order_relaxed);
+      if (retired_[i] != nullptr) AddSeries(sums[i], *retired_[i]);
+      for (Shard* shard : shards_)
+        if (MetricsSeries* s = shard->series[i].load(std::memory_order_acquire)) AddSeries(sums[i], *s);
+    }
+  }
+
+  std::chrono::steady_clock::time_point Started() const { return started_; }
+
+private:
+  struct Shard {
+    std::atomic<MetricsSeries*> series[MAX_SERIES] = {};
+    ~Shard() {
+      for (auto& s : series) delete s.load();
+    }
+  };
+
+  // folds the shard of an ending thread into retired_
+  struct ShardOwner {
+    Shard* shard = nullptr;
+    ~ShardOwner() {
+      if (shard != nullptr) Get().Retire(shard);
+    }
+  };
+
+  Metrics() : started_(std::chrono::steady_clock::now()) {}
+
+  MetricsSeries* Local(int series) {
+    if (series < 0 || series >= MAX_SERIES) return nullptr;
+    static thread_local ShardOwner owner;
+    if (owner.shard == nullptr) {
+      owner.shard = new Shard;
+      std::lock_guard<std::mutex> lock(mutex_);
+      shards_.push_back(owner.shard);
+    }
+    MetricsSeries* s = owner.shard->series[series].load(std::memory_order_relaxed);
+    if (s == nullptr) {
+      s = new MetricsSeries;
+      owner.shard->series[series].store(s, std::memory_order_release);
+    }
+    return s;
+  }
+
+  void Retire(Shard* shard) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < MAX_SERIES; i++)
+      if (MetricsSeries* s = shard->series[i].load()) {
+        if (retired_[i] == nullptr) retired_[i].reset(new MetricsSeries);
+        AddSeries(*retired_[i], *s);
+      }
+    shards_.erase(std::find(shards_.begin(), shards_.end(), shard));
+    delete shard;
+  }
+
+  static void AddSeries(MetricsSeries& to, const MetricsSeries& from) {
+    for (int c = 0; c < NUM_METRICS_COUNTERS; c++)
+      to.counter[c].store(to.counter[c].load(std::memory_order_relaxed) +
+                              from.counter[c].load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+    for (int h = 0; h < NUM_METRICS_HISTOGRAMS; h++) to.histogram[h].Add(from.histogram[h]);
+  }
+
+  std::mutex mutex_;
+  std::vector<std::string> names_;
+  std::vector<Shard*> shards_;
+  std::unique_ptr<MetricsSeries> retired_[MAX_SERIES];
+  std::atomic<uint64_t> summary_bytes_[MAX_SERIES] = {};
+  std::chrono::steady_clock::time_point started_;
+};
+
+// The Prometheus text of the series so far, and of the process: resident
+// bytes, uptime and the bytes the memory accounts (see memory.h) hold now,
+// in-process iterations' only. In src/metrics.cc, linked into the gcare
+// binaries.
+std::string MetricsText();
+
+// Serves MetricsText() to HTTP GETs of /metrics on port from a thread of
+// its own; false, reported, if the port is unusable.
+bool ServeMetrics(int port);
+
+#endif
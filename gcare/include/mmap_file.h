@@ -0,0 +1,260 @@
+#ifndef MMAP_FILE_H_
+#define MMAP_FILE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "chunked_file.h"
+#include "numa.h"
+
+// How a binary data file is brought into memory.
+//  LOAD_COPY: read into a private heap buffer (the historical behaviour).
+//  LOAD_MMAP: map read-only and pre-fault with MAP_POPULATE, so processes on
+//             one host share a single page-cache copy and skip the copy.
+//  LOAD_MMAP_HUGE: as LOAD_MMAP, additionally asking for transparent huge
+//             pages (best effort; ignored where the kernel cannot do it).
+//  LOAD_SHM:  map read-only a named POSIX shared-memory copy of the file,
+//             /gcare.<dev>.<inode>.<mtime>.<size>: the first process to load
+//             the file creates it, later ones attach to it. The copy stays
+//             resident (it is not evicted like file pages) until it is
+//             removed from /dev/shm; a changed file gets a new one.
+//  LOAD_LAZY: map read-only without pre-faulting; pages come in as they are
+//             touched (for files mostly not read, see DataGraph's
+//             out-of-core mode).
+enum LoadMode { LOAD_COPY, LOAD_MMAP, LOAD_MMAP_HUGE, LOAD_SHM, LOAD_LAZY };
+
+// the mode of summaries: LOAD_MMAP, LOAD_SHM with GCARE_SUMMARY_SHM=1, or
+// LOAD_LAZY with GCARE_SUMMARY_LAZY=1, the summaries whose queries read a
+// few of their sections bringing in just those (see LoadedFile::Claim)
+inline LoadMode SummaryLoadMode() {
+	const char* shm = getenv("GCARE_SUMMARY_SHM");
+	if (shm != nullptr && atoi(shm) == 1)
+		return LOAD_SHM;
+	const char* lazy = getenv("GCARE_SUMMARY_LAZY");
+	return lazy != nullptr && atoi(lazy) == 1 ? LOAD_LAZY : LOAD_MMAP;
+}
+
+// reads [p, p + bytes) of a LOAD_LAZY mapping in at once rather than a page
+// fault at a time: asks the kernel to read it ahead, then touches its pages
+inline void PrefaultRange(const void* p, size_t bytes) {
+	if (bytes == 0)
+		return;
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t begin = (uintptr_t) p / page * page, end = (uintptr_t) p + bytes;
+	madvise((void*) begin, end - begin, MADV_WILLNEED);
+	volatile char sink = 0;
+	for (uintptr_t a = begin; a < end; a += page)
+		sink = sink + *(const char*) a;
+}
+
+// LOAD_SHM of the open file fd: the segment is filled under a private name
+// and then linked to its public one, so no process attaches to it half
+// written; a process losing that race drops its copy
+inline char* LoadShm(const char* fn, int fd, const struct stat& st) {
+	char name[128];
+	snprintf(name, sizeof(name), "/gcare.%lx.%lx.%lx.%lx", (unsigned long) st.st_dev,
+		(unsigned long) st.st_ino, (unsigned long) st.st_mtime, (unsigned long) st.st_size);
+	size_t size = st.st_size;
+	int shm = shm_open(name, O_RDONLY, 0);
+	if (shm == -1) {
+		char tmp[160];
+		snprintf(tmp, sizeof(tmp), "%s.%d", name, (int) getpid());
+		int w = shm_open(tmp, O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (w == -1 || ftruncate(w, size) != 0) {
+			perror(tmp);
+			if (w != -1) {
+				close(w);
+				shm_unlink(tmp);
+			}
+			return nullptr;
+		}
+		void* dst = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, w, 0);
+		close(w);
+		size_t done = 0;
+		while (dst != MAP_FAILED && done < size) {
+			ssize_t n = pread(fd, (char*) dst + done, size - done, done);
+			if (n <= 0)
+				break;
+			done += n;
+		}
+		if (dst != MAP_FAILED)
+			munmap(dst, size);
+		bool linked = done == size
+			&& (link(("/dev/shm" + std::string(tmp)).c_str(), ("/dev/shm" + std::string(name)).c_str()) == 0
+				|| errno == EEXIST);
+		if (!linked)
+			perror(fn);
+		shm_unlink(tmp);
+		if (!linked)
+			return nullptr;
+		shm = shm_open(name, O_RDONLY, 0);
+		if (shm == -1) {
+			perror(name);
+			return nullptr;
+		}
+	}
+	void* ptr = mmap(0, size, PROT_READ, MAP_SHARED | MAP_POPULATE, shm, 0);
+	close(shm);
+	if (ptr == MAP_FAILED) {
+		perror(name);
+		return nullptr;
+	}
+	return static_cast<char*>(ptr);
+}
+
+// A chunked (compressed) file, see chunked_file.h, inflated into memory of
+// the mode: a heap buffer for LOAD_COPY, else an anonymous mapping, which
+// UnloadFile unmaps as it would the file's. The mapped modes then share no
+// copy between processes, and LOAD_LAZY reads the whole file
+inline char* LoadChunked(const char* fn, int fd, const ChunkedHeader& h, LoadMode mode, int numa_node) {
+	if (!ValidChunkedHeader(fn, h))
+		return nullptr;
+	char* ret;
+	if (mode == LOAD_COPY) {
+		ret = static_cast<char*>(aligned_alloc(64, (h.size / 64 + 1) * 64));
+		if (ret != nullptr)
+			NumaPlace(ret, h.size, numa_node);
+	} else {
+		void* ptr = mmap(0, std::max<uint64_t>(h.size, 1), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		ret = ptr == MAP_FAILED ? nullptr : static_cast<char*>(ptr);
+#ifdef MADV_HUGEPAGE
+		if (ret != nullptr && mode == LOAD_MMAP_HUGE)
+			madvise(ret, h.size, MADV_HUGEPAGE);
+#endif
+	}
+	if (ret == nullptr) {
+		perror(fn);
+		return nullptr;
+	}
+	if (!ReadChunked(fd, fn, h, ret)) {
+		if (mode == LOAD_COPY)
+			free(ret);
+		else
+			munmap(ret, std::max<uint64_t>(h.size, 1));
+		return nullptr;
+	}
+	if (mode != LOAD_COPY)
+		mprotect(ret, h.size, PROT_READ);
+	return ret;
+}
+
+// Loads the whole file; returns nullptr on failure. size is set to the file
+// size, that of the file inflated if it is chunked. The result must be
+// released with UnloadFile using the same mode (any mode but LOAD_COPY
+// unmaps it). numa_node places a LOAD_COPY buffer (see NumaPlace); the
+// mapped modes share the page cache, placed by the kernel.
+inline char* LoadFile(const char* fn, size_t& size, LoadMode mode, int numa_node = NUMA_ANY) {
+	int fd = open(fn, O_RDONLY);
+	if (fd == -1) {
+		perror(fn);
+		return nullptr;
+	}
+	struct stat fileinfo;
+	if (fstat(fd, &fileinfo) == -1) {
+		perror(fn);
+		close(fd);
+		return nullptr;
+	}
+	size = fileinfo.st_size;
+	char* ret = nullptr;
+	ChunkedHeader chunked;
+	if (ReadChunkedHeader(fd, chunked)) {
+		ret = LoadChunked(fn, fd, chunked, mode, numa_node);
+		size = chunked.size;
+	} else if (mode == LOAD_COPY) {
+		// cache-line aligned like a mapping, for summaries laid out so
+		ret = static_cast<char*>(aligned_alloc(64, (size / 64 + 1) * 64));
+		if (ret != nullptr)
+			NumaPlace(ret, size, numa_node);
+		size_t done = 0;
+		while (ret && done < size) {
+			ssize_t n = read(fd, ret + done, size - done);
+			if (n <= 0) {
+				perror(fn);
+				free(ret);
+				ret = nullptr;
+				break;
+			}
+			done += n;
+		}
+	} else if (mode == LOAD_SHM) {
+		ret = LoadShm(fn, fd, fileinfo);
+	} else {
+		void* ptr = mmap(0, size, PROT_READ, MAP_SHARED | (mode == LOAD_LAZY ? 0 : MAP_POPULATE), fd, 0);
+		if (ptr == MAP_FAILED) {
+			perror(fn);
+		} else {
+#ifdef MADV_HUGEPAGE
+			if (mode == LOAD_MMAP_HUGE)
+				madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+			if (mode != LOAD_LAZY)
+				madvise(ptr, size, MADV_WILLNEED);
+			ret = static_cast<char*>(ptr);
+		}
+	}
+	close(fd);
+	return ret;
+}
+
+inline void UnloadFile(char* buffer, size_t size, LoadMode mode) {
+	if (buffer == nullptr) return;
+	if (mode == LOAD_COPY)
+		free(buffer);
+	else
+		munmap(buffer, size);
+}
+
+// A loaded file the query mode views of several estimator instances point
+// into (see Estimator::ShareSummary): the last instance to let go of it
+// unloads it. A LOAD_LAZY file may be split into sections its reader
+// numbers, each brought in by the first query that needs it
+struct LoadedFile {
+	char* data;
+	size_t size;
+	LoadMode mode;
+
+	LoadedFile(char* d, size_t s, LoadMode m) : data(d), size(s), mode(m) {}
+	LoadedFile(const LoadedFile&) = delete;
+	LoadedFile& operator=(const LoadedFile&) = delete;
+	~LoadedFile() { UnloadFile(data, size, mode); }
+
+	// n sections, none brought in yet
+	void Sections(size_t n) {
+		fetched_.reset(new std::atomic<bool>[n]);
+		for (size_t i = 0; i < n; i++)
+			fetched_[i].store(false, std::memory_order_relaxed);
+		num_sections_ = n;
+	}
+	// true once per section s of a LOAD_LAZY file, for the caller to bring
+	// it in (see PrefaultRange); safe to call from several threads at once
+	bool Claim(size_t s) {
+		return mode == LOAD_LAZY && s < num_sections_
+			&& !fetched_[s].exchange(true, std::memory_order_relaxed);
+	}
+
+private:
+	std::unique_ptr<std::atomic<bool>[]> fetched_;
+	size_t num_sections_ = 0;
+};
+
+// LoadFile into a LoadedFile, nullptr if it cannot be loaded
+inline std::shared_ptr<LoadedFile> LoadShared(const char* fn, LoadMode mode) {
+	size_t size;
+	char* data = LoadFile(fn, size, mode);
+	if (data == nullptr)
+		return nullptr;
+	return std::make_shared<LoadedFile>(data, size, mode);
+}
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// NUMA placement of the data graph for threaded runs, GCARE_NUMA=
+//  interleave: the graph's pages are spread round-robin over the nodes, so
+//              the walks of all sockets share the memory bandwidth of all.
+//  replicate:  every node gets a copy of the graph; the worker threads are
+//              pinned to the nodes in turn and read their node's copy.
+// On a single node, or without GCARE_NUMA, nothing changes. The placement
+// uses the mbind and sched_setaffinity system calls, so it needs no libnuma.
+enum NumaMode { NUMA_OFF, NUMA_INTERLEAVE, NUMA_REPLICATE };
+
+// placements for NumaPlace and LoadFile besides a node number
+const int NUMA_ANY = -1;
+const int NUMA_INTERLEAVE_ALL = -2;
+
+inline NumaMode GetNumaMode() {
+	const char* mode = getenv("GCARE_NUMA");
+	if (mode == nullptr || *mode == 0)
+		return NUMA_OFF;
+	if (strcmp(mode, "interleave") == 0)
+		return NUMA_INTERLEAVE;
+	if (strcmp(mode, "replicate") == 0)
+		return NUMA_REPLICATE;
+	static bool warned = false;
+	if (!warned) {
+		fprintf(stderr, "unknown GCARE_NUMA %s, ignored\n", mode);
+		warned = true;
+	}
+	return NUMA_OFF;
+}
+
+// a sysfs list like "0-3,8-11"
+inline std::vector<int> ParseCpuList(const std::string& list) {
+	std::vector<int> ids;
+	const char* p = list.c_str();
+	while (*p != 0 && *p != '\n') {
+		char* end;
+		long first = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		long last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (long i = first; i <= last; i++)
+			ids.push_back((int) i);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return ids;
+}
+
+// the cpus of each online node, by node number; a single entry if the
+// topology is unknown
+inline const std::vector<std::vector<int>>& NumaNodes() {
+	static const std::vector<std::vector<int>> nodes = []() {
+		auto read = [](const std::string& path) {
+			std::string text;
+			FILE* fp = fopen(path.c_str(), "r");
+			if (fp != nullptr) {
+				char buf[4096];
+				if (fgets(buf, sizeof(buf), fp) != nullptr)
+					text = buf;
+				fclose(fp);
+			}
+			return text;
+		};
+		std::vector<std::vector<int>> nodes;
+		for (int node : ParseCpuList(read("/sys/devices/system/node/online"))) {
+			if ((int) nodes.size() <= node)
+				nodes.resize(node + 1);
+			nodes[node] = ParseCpuList(read("/sys/devices/system/node/node" +
+				std::to_string(node) + "/cpulist"));
+		}
+		if (nodes.empty())
+			nodes.resize(1);
+		return nodes;
+	}();
+	return nodes;
+}
+
+// whether GCARE_NUMA asks for a placement that matters here
+inline bool NumaActive() {
+	return GetNumaMode() != NUMA_OFF && NumaNodes().size() > 1;
+}
+
+// Asks that the not yet touched pages of [addr, addr + size) come from node
+// (preferred, not bound) or, with NUMA_INTERLEAVE_ALL, from all nodes in
+// turn. Best effort: false if the kernel refused.
+inline bool NumaPlace(void* addr, size_t size, int node) {
+	const int MPOL_PREFERRED_ = 1, MPOL_INTERLEAVE_ = 3;
+	size_t num_nodes = NumaNodes().size();
+	if (node == NUMA_ANY || num_nodes <= 1)
+		return true;
+	const size_t bits = 8 * sizeof(unsigned long);
+	std::vector<unsigned long> mask(num_nodes / bits + 1, 0);
+	for (size_t n = 0; n < num_nodes; n++)
+		if (node == NUMA_INTERLEAVE_ALL ? !NumaNodes()[n].empty() : (int) n == node)
+			mask[n / bits] |= 1UL << (n % bits);
+	// mbind takes whole pages: those inside the range
+	size_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t begin = ((uintptr_t) addr + page - 1) / page * page;
+	uintptr_t end = ((uintptr_t) addr + size) / page * page;
+	if (begin >= end)
+		return true;
+	return syscall(SYS_mbind, (void*) begin, end - begin,
+		node == NUMA_INTERLEAVE_ALL ? MPOL_INTERLEAVE_ : MPOL_PREFERRED_,
+		mask.data(), mask.size() * bits + 1, 0) == 0;
+}
+
+// the node the calling thread was pinned to, NUMA_ANY if none
+inline int& CurrentNumaNode() {
+	static thread_local int node = NUMA_ANY;
+	return node;
+}
+
+// pins the calling thread to the cpus of node; false, leaving it as it
+// was, if that cannot be done
+inline bool PinToNumaNode(int node) {
+	const std::vector<std::vector<int>>& nodes = NumaNodes();
+	if (node < 0 || node >= (int) nodes.size() || nodes[node].empty())
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : nodes[node])
+		if (cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		return false;
+	CurrentNumaNode() = node;
+	return true;
+}
+
+// pins worker thread number worker to the nodes with cpus in turn
+inline bool PinWorkerToNumaNode(int worker) {
+	const std::vector<std::vector<int>>& nodes = NumaNodes();
+	std::vector<int> cpu_nodes;
+	for (size_t node = 0; node < nodes.size(); node++)
+		if (!nodes[node].empty())
+			cpu_nodes.push_back(node);
+	return !cpu_nodes.empty() && worker >= 0 &&
+		PinToNumaNode(cpu_nodes[worker % cpu_nodes.size()]);
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef PACKED_ADJ_H_
+#define PACKED_ADJ_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// The adjacency array of one direction of a DataGraph, compressed in blocks
+// of BLOCK consecutive entries: each block keeps its minimum and the
+// bit-packed differences to it, all of one width (frame of reference).
+// Blocks are cut by position, not by list, so the block of an entry is its
+// position / BLOCK and no per-list header is needed; the i-th neighbour of a
+// list, as random walks draw it, is then read in O(1).
+class PackedAdj {
+public:
+  static const int BLOCK = 128;
+
+  // packs values[0, n)
+  void Build(const int* values, size_t n);
+
+  // the file form (Build first), written after the entry count
+  void Write(FILE* fp) const;
+  // reads the file form in place, from memory outliving this; returns its
+  // end, or nullptr if it doesn't hold n entries
+  const char* Attach(const char* buffer, size_t n);
+
+  // the file form and its size in bytes
+  const char* Data() const { return (const char*)(offset_ - 2); }
+  size_t Bytes() const { return bytes_; }
+
+  int Get(size_t pos) const {
+    size_t block = pos / BLOCK;
+    unsigned bits = bits_[block];
+    uint64_t bit = (uint64_t)(pos % BLOCK) * bits;
+    uint64_t word;
+    memcpy_word(&word, payload_ + offset_[block] + bit / 8);
+    return base_[block] + (int)((word >> (bit % 8)) & ((1ull << bits) - 1));
+  }
+
+  // whether the sorted entries [begin, end) contain target
+  bool Contains(size_t begin, size_t end, int target) const;
+
+  // writes entries [begin, end) to out, a block at a time
+  void Decode(size_t begin, size_t end, int* out) const;
+
+private:
+  static void memcpy_word(uint64_t* word, const uint8_t* p) {
+    __builtin_memcpy(word, p, sizeof(uint64_t));
+  }
+
+  size_t num_blocks_ = 0, bytes_ = 0;
+  const int* base_ = nullptr;         // block -> minimum
+  const uint8_t* bits_ = nullptr;     // block -> width of the differences
+  const uint64_t* offset_ = nullptr;  // block -> first payload byte
+  const uint8_t* payload_ = nullptr;  // followed by 8 bytes of padding
+  std::vector<uint64_t> storage_;     // the file form, if built here
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef PACKED_COLUMN_H_
+#define PACKED_COLUMN_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "simd_search.h"
+
+// A frame-of-reference, bit-packed int column of the relational binary
+// (see DataGraph::SetPacked). The column is cut in blocks of BLOCK values,
+// each stored as its minimum, the base, and the differences to it in the
+// fewest bits that hold the largest, so vertex ids sorted or clustered
+// within a table, and the ascending rows of a value in the index, take a
+// few bits each instead of 32. A column is one run of ints: its size and
+// # ints, then per block its base, the offset of its words from the first
+// block's and its bit width, then the words, each block's 4 * width of
+// them, and a pad word. A value is two adjacent words shifted; a run of
+// them is unpacked a block at a time by UnpackBits.
+class PackedColumn {
+ public:
+  static const int BLOCK = 128;
+
+  PackedColumn() : data_(nullptr) {}
+  explicit PackedColumn(const int* data) : data_(data) {}
+
+  size_t size() const { return data_ == nullptr ? 0 : static_cast<uint32_t>(data_[0]); }
+  // # ints of the column, the size of its run
+  size_t ints() const { return static_cast<uint32_t>(data_[1]); }
+
+  int operator[](size_t i) const {
+    const int* h = data_ + 2 + 3 * (i / BLOCK);
+    int width = h[2];
+    if (width == 0) return h[0];
+    uint64_t bit = (i % BLOCK) * width;
+    const uint32_t* p = words() + static_cast<uint32_t>(h[1]) + (bit >> 5);
+    uint64_t w = p[0] | static_cast<uint64_t>(p[1]) << 32;
+    uint32_t mask = width == 32 ? ~0u : (1u << width) - 1;
+    return static_cast<int>(static_cast<uint32_t>(h[0]) + (static_cast<uint32_t>(w >> (bit & 31)) & mask));
+  }
+
+  // out[0, end - begin) = the values [begin, end)
+  void Decode(size_t begin, size_t end, int* out) const {
+    int buf[BLOCK];
+    while (begin < end) {
+      size_t b = begin / BLOCK, first = b * BLOCK;
+      size_t n = std::min<size_t>(BLOCK, size() - first);
+      // whole blocks go straight to out, the ends through buf
+      bool whole = begin == first && end >= first + n;
+      int* dst = whole ? out : buf;
+      const int* h = data_ + 2 + 3 * b;
+      if (h[2] == 0)
+        std::fill(dst, dst + n, h[0]);
+      else
+        UnpackBits(words() + static_cast<uint32_t>(h[1]), h[2], h[0], n, dst);
+      size_t last = std::min(end, first + n);
+      if (!whole) std::copy(buf + (begin - first), buf + (last - first), out);
+      out += last - begin;
+      begin = last;
+    }
+  }
+
+  // appends the run of values[0, n) to out
+  static void Pack(const int* values, size_t n, std::vector<int>& out) {
+    size_t num_blocks = (n + BLOCK - 1) / BLOCK;
+    size_t start = out.size();
+    out.push_back(static_cast<int>(n));
+    out.push_back(0);
+    size_t headers = out.size();
+    out.resize(headers + 3 * num_blocks);
+    size_t words = out.size();
+    for (size_t b = 0; b < num_blocks; b++) {
+      const int* v = values + b * BLOCK;
+      size_t m = std::min<size_t>(BLOCK, n - b * BLOCK);
+      int base = *std::min_element(v, v + m);
+      uint32_t top = 0;
+      for (size_t i = 0; i < m; i++) top |= static_cast<uint32_t>(v[i]) - static_cast<uint32_t>(base);
+      int width = top == 0 ? 0 : 32 - __builtin_clz(top);
+      int* h = out.data() + headers + 3 * b;
+      h[0] = base;
+      h[1] = static_cast<int>(out.size() - words);
+      h[2] = width;
+      // the block is BLOCK values wide even when m is short, 4 * width words
+      size_t at = out.size();
+      out.resize(at + 4 * width, 0);
+      uint32_t* w = reinterpret_cast<uint32_t*>(out.data() + at);
+      for (size_t i = 0; i < m && width > 0; i++) {
+        uint64_t bit = i * width;
+        uint64_t d = static_cast<uint64_t>(static_cast<uint32_t>(v[i]) - static_cast<uint32_t>(base)) << (bit & 31);
+        w[bit >> 5] |= static_cast<uint32_t>(d);
+        if ((bit & 31) + width > 32) w[(bit >> 5) + 1] |= static_cast<uint32_t>(d >> 32);
+      }
+    }
+    out.push_back(0); // the pad word
+    out[start + 1] = static_cast<int>(out.size() - start);
+  }
+
+ private:
+  const uint32_t* words() const {
+    return reinterpret_cast<const uint32_t*>(data_ + 2 + 3 * ((size() + BLOCK - 1) / BLOCK));
+  }
+
+  const int* data_;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hardware counters of the phases of Estimator::Run, read through
+// perf_event_open when a query runs with --perf: Init(), DecomposeQuery(),
+// the GetSubstructure()/EstCard() loop, and AggCard() with GetSelectivity().
+// They count the user-space work of the thread that calls Run(), so the
+// threads an estimator starts itself are not in them. Like Counters, each
+// thread records into its own PerfCounters, which the backend starts before
+// and collects after every iteration into its QueryResult.
+enum PerfPhase { PERF_INIT, PERF_DECOMPOSE, PERF_SAMPLE, PERF_AGGREGATE, NUM_PERF_PHASES };
+enum PerfEvent { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_DTLB_MISSES,
+                 PERF_BRANCH_MISSES, NUM_PERF_EVENTS };
+
+struct PerfCounters {
+  // per phase and event, scaled up by the time the event was multiplexed
+  // out; an event the kernel or the CPU does not offer counts nothing and
+  // is left out of ToJson
+  uint64_t count[NUM_PERF_PHASES][NUM_PERF_EVENTS] = {};
+  bool opened[NUM_PERF_EVENTS] = {};
+
+  void Clear() { *this = PerfCounters(); }
+
+  void Add(const PerfCounters& o) {
+    for (int p = 0; p < NUM_PERF_PHASES; p++)
+      for (int e = 0; e < NUM_PERF_EVENTS; e++)
+        count[p][e] += o.count[p][e];
+    for (int e = 0; e < NUM_PERF_EVENTS; e++)
+      opened[e] |= o.opened[e];
+  }
+
+  std::string ToJson() const {
+    static const char* phases[NUM_PERF_PHASES] = {"init", "decompose", "sample", "aggregate"};
+    static const char* events[NUM_PERF_EVENTS] = {"cycles", "instructions", "llc_misses",
+                                                  "dtlb_misses", "branch_misses"};
+    std::string s = "{";
+    for (int p = 0; p < NUM_PERF_PHASES; p++) {
+      if (p > 0) s += ",";
+      s += std::string("\"") + phases[p] + "\":{";
+      bool first = true;
+      for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        if (!opened[e]) continue;
+        if (!first) s += ",";
+        first = false;
+        s += std::string("\"") + events[e] + "\":" + std::to_string(count[p][e]);
+      }
+      s += "}";
+    }
+    return s + "}";
+  }
+};
+
+// The counters of the calling thread: Start() opens them, once per thread
+// and process (a forked child cannot read its parent's), and Mark(phase)
+// adds what they counted since the previous Start() or Mark() to phase. Both
+// are no-ops unless Start() was given on.
+class PerfProbe {
+public:
+  ~PerfProbe() { Close(); }
+
+  void Start(bool on) {
+    on_ = on;
+    result_.Clear();
+    if (!on_) return;
+    if (pid_ != getpid()) Open();
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) result_.opened[e] = fd_[e] >= 0;
+    Read(last_);
+  }
+
+  void Mark(PerfPhase phase) {
+    if (!on_) return;
+    uint64_t now[NUM_PERF_EVENTS];
+    Read(now);
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+      // scaled counts of a multiplexed event may step back a little
+      if (now[e] > last_[e]) result_.count[phase][e] += now[e] - last_[e];
+      last_[e] = now[e];
+    }
+  }
+
+  const PerfCounters& Result() const { return result_; }
+
+private:
+  void Open() {
+    Close();
+    pid_ = getpid();
+    static const uint32_t types[NUM_PERF_EVENTS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HARDWARE};
+    static const uint64_t configs[NUM_PERF_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+            PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        PERF_COUNT_HW_BRANCH_MISSES};
+    // each event on its own rather than as a group, so that one the PMU
+    // cannot schedule alongside the others still counts, multiplexed
+    int opened = 0, error = 0;
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[e];
+      attr.config = configs[e];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fd_[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      if (fd_[e] >= 0)
+        opened++;
+      else
+        error = errno;
+    }
+    static bool warned = false;
+    if (opened == 0 && !warned) {
+      // e.g. kernel.perf_event_paranoid > 2, or no PMU in a VM
+      fprintf(stderr, "perf counters unavailable: %s\n", strerror(error));
+      warned = true;
+    }
+  }
+
+  void Close() {
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+      if (fd_[e] >= 0) close(fd_[e]);
+      fd_[e] = -1;
+    }
+    pid_ = -1;
+  }
+
+  void Read(uint64_t* out) {
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+      uint64_t v[3]; // value, time enabled, time running
+      out[e] = 0;
+      if (fd_[e] < 0 || read(fd_[e], v, sizeof(v)) != (ssize_t)sizeof(v)) continue;
+      out[e] = v[2] > 0 && v[2] < v[1] ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+    }
+  }
+
+  bool on_ = false;
+  pid_t pid_ = -1;
+  int fd_[NUM_PERF_EVENTS] = {-1, -1, -1, -1, -1};
+  uint64_t last_[NUM_PERF_EVENTS] = {};
+  PerfCounters result_;
+};
+
+inline PerfProbe& ThreadPerf() {
+  static thread_local PerfProbe probe;
+  return probe;
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef PLAN_CACHE_H_
+#define PLAN_CACHE_H_
+
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "query_graph.h"
+
+namespace graph {
+
+// The walk plans of wj and jsub, kept by an estimator instance across its
+// runs for queries of the same structure, so the iterations of a query
+// (in-process, see --no-fork) and later queries of the same shape skip the
+// plan enumeration. The plans only depend on the structure and on the
+// enumeration budget, so reusing them leaves the estimates as they were.
+//
+// GCARE_PLAN_CACHE=0 turns the cache off; 2 also reuses the plan the
+// trials of the first run chose, skipping the trials of later runs. That
+// makes an iteration's estimate depend on the runs before it on the same
+// instance, so it is not the default.
+class PlanCache {
+public:
+	enum Mode { OFF = 0, PLANS = 1, CHOICE = 2 };
+
+	struct Entry {
+		std::vector<std::vector<std::pair<int, int>>> plans, counterparts;
+		std::vector<int> trials; //jsub: the trials of each plan
+		int chosen = -1;   //plan chosen by the trials, -1 if none yet
+		double cost = 0.0; //its cost as the trials observed it
+	};
+
+	// entries kept at most; the cache starts over once it is full
+	static const size_t MAX_ENTRIES = 4096;
+
+	static Mode ModeFromEnv() {
+		const char* mode = getenv("GCARE_PLAN_CACHE");
+		if (mode == nullptr)
+			return PLANS;
+		int m = atoi(mode);
+		return m <= 0 ? OFF : m == 1 ? PLANS : CHOICE;
+	}
+
+	// the labels and edges of q as numbered, which vertices are bound, and
+	// budget, the bound of the enumeration
+	static std::string Key(QueryGraph& q, long budget) {
+		std::string key = std::to_string(budget) + "|";
+		for (int v = 0; v < q.GetNumVertices(); v++)
+			key += std::to_string(q.GetVLabel(v)) + (q.GetBound(v) >= 0 ? "b," : ",");
+		key += "|";
+		for (int i = 0; i < q.GetNumEdges(); i++) {
+			Edge e = q.GetEdge(i);
+			key += std::to_string(e.src) + "," + std::to_string(e.dst) + "," +
+				std::to_string(e.el) + ";";
+		}
+		return key;
+	}
+
+	Entry* Find(const std::string& key) {
+		auto it = entries_.find(key);
+		return it == entries_.end() ? nullptr : &it->second;
+	}
+
+	Entry& Insert(const std::string& key) {
+		if (entries_.size() >= MAX_ENTRIES)
+			entries_.clear();
+		return entries_[key];
+	}
+
+private:
+	std::unordered_map<std::string, Entry> entries_;
+};
+
+}  // namespace graph
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef QUERY_ARENA_H_
+#define QUERY_ARENA_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+
+#include "memory.h"
+
+// Monotonic memory for the scratch state of one query: std::pmr containers
+// built on Resource() allocate by bumping a pointer, free nothing, and are
+// all dropped at once by Reset(). The arena keeps one buffer, regrown at
+// Reset() to what the previous query used in all, so after the largest
+// query a Reset() costs O(1) and queries stop calling malloc. Accounted to
+// MEMORY_ARENA.
+class QueryArena {
+public:
+	static const size_t MIN_BUFFER = 64 << 10;
+
+	QueryArena() {}
+	QueryArena(const QueryArena&) = delete;
+	QueryArena& operator=(const QueryArena&) = delete;
+
+	~QueryArena() {
+		pool_.reset();
+		overflow_.Release();
+		GetMemoryAccount(MEMORY_ARENA).Free(size_);
+	}
+
+	std::pmr::memory_resource* Resource() {
+		if (!pool_)
+			Reset();
+		return &*pool_;
+	}
+
+	// invalidates everything allocated since the last Reset(); containers
+	// on the arena must be rebuilt (see Estimator::Fresh) before use
+	void Reset() {
+		if (pool_ && overflow_.bytes == 0) {
+			pool_->release();
+			return;
+		}
+		size_t size = std::max(MIN_BUFFER, size_ + overflow_.bytes);
+		pool_.reset();
+		overflow_.Release();
+		GetMemoryAccount(MEMORY_ARENA).Free(size_);
+		buffer_.reset(new char[size]);
+		size_ = size;
+		GetMemoryAccount(MEMORY_ARENA).Allocate(size_);
+		pool_.emplace(buffer_.get(), size_, &overflow_);
+	}
+
+private:
+	// the chunks a query needs beyond the buffer, counted to size the next
+	// buffer
+	struct Overflow : std::pmr::memory_resource {
+		size_t bytes = 0;
+
+		void Release() {
+			GetMemoryAccount(MEMORY_ARENA).Free(bytes);
+			bytes = 0;
+		}
+
+		void* do_allocate(size_t n, size_t align) override {
+			bytes += n;
+			GetMemoryAccount(MEMORY_ARENA).Allocate(n);
+			return std::pmr::new_delete_resource()->allocate(n, align);
+		}
+		void do_deallocate(void* p, size_t n, size_t align) override {
+			std::pmr::new_delete_resource()->deallocate(p, n, align);
+		}
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+			return this == &other;
+		}
+	};
+
+	Overflow overflow_;
+	std::unique_ptr<char[]> buffer_;
+	size_t size_ = 0;
+	std::optional<std::pmr::monotonic_buffer_resource> pool_;
+};
+
+#endif
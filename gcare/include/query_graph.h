@@ -1,9 +1,13 @@
 #ifndef QUERY_GRAPH_H_
 #define QUERY_GRAPH_H_
 
+#include <cstdint>
 #include <vector>
 #include <string>
 #include "util.h"
+#include "query_text.h"
+
+namespace graph {
 
 class QueryGraph {
 private:
@@ -24,6 +28,8 @@ public:
 	}
 	void ReadText(const char*);
     void ReadText(std::vector<std::string>&);
+	//query q of text, empty if there is none
+	void Read(const QueryText& text, size_t q);
 	inline int GetNumVertices() { return vnum_; }
 	inline int GetNumEdges() { return enum_; }
 	Edge GetEdge(int i) { return edge_[i]; }; 
@@ -31,8 +37,26 @@ public:
 	int GetELabel(int, int);
 	inline int GetVLabel(int v) { return vl_[v]; }
 	inline int GetBound(int v) { return bound_[v]; }
+	//rewrites bound data vertices through an input -> data id map
+	void MapBounds(const vector<int>&);
+	//rewrites the vertex and edge labels through input -> data label maps
+	void MapLabels(const LabelMap&, const LabelMap&);
+	//equal for isomorphic queries (same labels and bindings) as long as
+	//vertices with equal label, binding and incident edge labels are few
+	//enough to try all their orders; otherwise only for equal numbering
+	string CanonicalForm();
+	//the sub-pattern of the edges in mask (bit i for edge i): those edges
+	//and the vertices they join, renumbered in order, with their labels
+	//and bindings
+	QueryGraph Subgraph(uint64_t mask);
+	//the masks of the connected sub-patterns, by size and then mask, at
+	//most max of them; empty beyond MAX_PATTERN_EDGES edges
+	vector<uint64_t> ConnectedEdgeSets(size_t max = SIZE_MAX);
+	static const int MAX_PATTERN_EDGES = 64;
 
   string fn_; // XXX
 };
 
+}  // namespace graph
+
 #endif
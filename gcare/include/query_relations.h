@@ -8,7 +8,11 @@
 #include <cassert>
 #include <iostream>
 
+#include "query_text.h"
+
 using std::vector;
+namespace relational {
+
 class QueryGraph {
 public:
 
@@ -65,68 +69,6 @@ public:
         void print() { std::cout << "v " << id << " " << lbl << " " << bound <<  "\n"; }
     };
 
-    void ParseFile(const char* filename, std::vector<Vertex> &vertices, std::vector<Edge> &edges) {
-        char buf[1111];
-        FILE* fp = fopen(filename, "r");
-        while (fgets(buf, 1111, fp) != NULL) {
-            if (buf[0] == '\n') continue;
-            int buflen = 0;
-            while (buf[buflen++] != '\n') {
-                if (buf[buflen] == ' ') {
-                    buf[buflen] = 0;
-                }
-            }
-            if (buf[0] == 'v') { // parse vertex
-                int id = strtol(buf + 2, 0, 0);
-                int offset = 2 + strlen(buf + 2) + 1;
-                int lbl = strtol(buf + offset, 0, 0);
-                offset += strlen(buf + offset) + 1;
-                int bound = -1;
-                if (offset < buflen)
-                    bound = strtol(buf + offset, 0, 0);
-                vertices.emplace_back(id, lbl, bound);
-            } else if (buf[0] == 'e') { // parse edge
-                int srcid = strtol(buf + 2, 0, 0);
-                int offset = 2 + strlen(buf + 2) + 1;
-                int dstid = strtol(buf + offset, 0, 0);
-                offset += strlen(buf + offset) + 1;
-                int lbl = strtol(buf + offset, 0, 0);
-                edges.emplace_back(srcid, dstid, lbl); 
-            }
-        }
-        fclose(fp);
-    }
-
-    void ParseText(std::vector<std::string> &text, std::vector<Vertex> &vertices, std::vector<Edge> &edges) {
-        for (auto &line : text) {
-            char* buf = (char*) line.c_str();
-            if (buf[0] == '\n') continue;
-            int buflen = 0;
-            while (buf[buflen++] != '\n') {
-                if (buf[buflen] == ' ') {
-                    buf[buflen] = 0;
-                }
-            }
-            if (buf[0] == 'v') { // parse vertex
-                int id = strtol(buf + 2, 0, 0);
-                int offset = 2 + strlen(buf + 2) + 1;
-                int lbl = strtol(buf + offset, 0, 0);
-                offset += strlen(buf + offset) + 1;
-                int bound = -1;
-                if (offset < buflen)
-                    bound = strtol(buf + offset, 0, 0);
-                vertices.emplace_back(id, lbl, bound);
-            } else if (buf[0] == 'e') { // parse edge
-                int srcid = strtol(buf + 2, 0, 0);
-                int offset = 2 + strlen(buf + 2) + 1;
-                int dstid = strtol(buf + offset, 0, 0);
-                offset += strlen(buf + offset) + 1;
-                int lbl = strtol(buf + offset, 0, 0);
-                edges.emplace_back(srcid, dstid, lbl); 
-            }
-        }
-    }
-
     void ConvertToRelations(std::vector<Vertex> &vertices, std::vector<Edge> &edges) {
         //=============================================
         //1. Find valid attributes (i.e. join attributes and bound attributes)
@@ -198,25 +140,35 @@ public:
 
 
     void ReadText(const char* filename) {
-        std::vector<Vertex> vertices;
-        std::vector<Edge> edges;
-        //=============================================
-        //1. Parse the query graph
-	    //---------------------------------------------
-        ParseFile(filename, vertices, edges);
-	    //---------------------------------------------
-        //2. Convert the query graph to a query relations
-        ConvertToRelations(vertices, edges);
-        //=============================================
+        QueryText text;
+        text.ReadFile(filename);
+        Read(text, 0);
     }
 
-    void ReadText(std::vector<std::string> &text) {
+    void ReadText(std::vector<std::string> &lines) {
+        QueryText text;
+        text.ReadLines(lines);
+        Read(text, 0);
+    }
+
+    // query q of text, no relations if there is none
+    void Read(const QueryText& text, size_t q) {
         std::vector<Vertex> vertices;
         std::vector<Edge> edges;
         //=============================================
-        //1. Parse the query graph
+        //1. Take the query graph
 	    //---------------------------------------------
-        ParseText(text, vertices, edges);
+        if (q < text.size()) {
+            const QueryText::Query& query = text.queries[q];
+            for (size_t i = query.vertex_begin; i < query.vertex_end; ++i) {
+                const QueryText::Vertex& v = text.vertices[i];
+                vertices.emplace_back(v.id, v.label, v.bound);
+            }
+            for (size_t i = query.edge_begin; i < query.edge_end; ++i) {
+                const QueryText::Edge& e = text.edges[i];
+                edges.emplace_back(e.src, e.dst, e.label);
+            }
+        }
 	    //---------------------------------------------
         //2. Convert the query graph to a query relations
         ConvertToRelations(vertices, edges);
@@ -242,4 +194,7 @@ public:
     void ReadText(const char*);
 */
 };
+
+}  // namespace relational
+
 #endif
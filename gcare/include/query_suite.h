@@ -0,0 +1,84 @@
+#ifndef QUERY_SUITE_H_
+#define QUERY_SUITE_H_
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "query_text.h"
+
+// The queries of a suite, as --batch and gcare_bench_suite take it: a file
+// of queries opened by "t # ID" lines (see QueryText), a directory of query
+// files, or a file listing them, one per line. A file holding several
+// queries stands for each of them as "path#ID" (or "path#k", the k-th, if it
+// has no ID); a file that cannot be read stands for one empty query.
+class QuerySuite {
+public:
+  struct Entry {
+    size_t text;  // into texts
+    size_t query; // of the text
+    std::string name;
+  };
+
+  std::vector<std::unique_ptr<QueryText>> texts;
+  std::vector<Entry> entries;
+
+  // false, reported on stderr, if input cannot be read
+  bool Read(const std::string &input) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> paths;
+    texts.clear();
+    entries.clear();
+    std::error_code ec;
+    if (fs::is_directory(input, ec)) {
+      for (auto &entry : fs::directory_iterator(input, ec))
+        if (entry.is_regular_file(ec))
+          paths.push_back(entry.path().string());
+      std::sort(paths.begin(), paths.end());
+    } else {
+      texts.emplace_back(new QueryText);
+      if (!texts[0]->ReadFile(input.c_str()))
+        return false;
+      if (texts[0]->size() > 0) {
+        paths.push_back(input);
+      } else {
+        texts.clear();
+        std::ifstream in(input);
+        for (std::string line; getline(in, line);) {
+          if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+          if (!line.empty())
+            paths.push_back(line);
+        }
+      }
+    }
+    for (size_t k = texts.size(); k < paths.size(); k++) {
+      texts.emplace_back(new QueryText);
+      if (!fs::exists(paths[k], ec))
+        std::cerr << paths[k] << " does not exist\n";
+      else
+        texts[k]->ReadFile(paths[k].c_str());
+    }
+    for (size_t k = 0; k < paths.size(); k++) {
+      const QueryText &text = *texts[k];
+      if (text.size() <= 1) {
+        entries.push_back(Entry{k, 0, paths[k]});
+        continue;
+      }
+      for (size_t i = 0; i < text.size(); i++) {
+        const std::string &id = text.queries[i].name;
+        entries.push_back(
+            Entry{k, i, paths[k] + "#" + (id.empty() ? std::to_string(i) : id)});
+      }
+    }
+    return true;
+  }
+
+  const QueryText &Text(const Entry &entry) const { return *texts[entry.text]; }
+};
+
+#endif
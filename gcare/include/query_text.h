@@ -0,0 +1,177 @@
+#ifndef QUERY_TEXT_H_
+#define QUERY_TEXT_H_
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mmap_file.h"
+
+// The queries of a text file, read by the graph and the relational
+// QueryGraph alike. A file holds one query, its "v ID LABEL [BOUND]" and "e
+// SRC DST LABEL" lines, or a suite of them, each opened by a "t # ID" line
+// as in the data files. The file is mapped and scanned once into flat
+// vertex and edge arrays, lines of any length, with no allocation per line
+// or per query; other lines are skipped.
+class QueryText {
+public:
+  struct Vertex {
+    int id, label, bound; // bound -1 if not given
+  };
+  struct Edge {
+    int src, dst, label;
+  };
+  // the vertices [vertex_begin, vertex_end) and edges [edge_begin,
+  // edge_end) of a query; name is the ID of its "t" line, if it has one
+  struct Query {
+    std::string name;
+    size_t vertex_begin, vertex_end, edge_begin, edge_end;
+  };
+
+  std::vector<Vertex> vertices;
+  std::vector<Edge> edges;
+  std::vector<Query> queries;
+
+  size_t size() const { return queries.size(); }
+
+  // false, reported on stderr, if path cannot be read
+  bool ReadFile(const char* path) {
+    Clear();
+    FILE* fp = fopen(path, "r");
+    if (fp == nullptr) {
+      perror(path);
+      return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    bool empty = ftell(fp) == 0;
+    fclose(fp);
+    if (empty)
+      return true;
+    size_t size;
+    char* data = LoadFile(path, size, LOAD_MMAP);
+    if (data == nullptr)
+      return false;
+    Parse(data, data + size);
+    UnloadFile(data, size, LOAD_MMAP);
+    return true;
+  }
+
+  void ReadLines(const std::vector<std::string>& lines) {
+    Clear();
+    for (const std::string& line : lines)
+      ParseLine(line.data(), line.data() + line.size());
+  }
+
+  // the query normalised to "v ...;e ...;" lines, equal for equal queries
+  // written with different spacing
+  std::string Key(size_t q) const {
+    const Query& query = queries[q];
+    std::string key;
+    char buf[64];
+    for (size_t i = query.vertex_begin; i < query.vertex_end; i++) {
+      const Vertex& v = vertices[i];
+      snprintf(buf, sizeof(buf), "v %d %d %d;", v.id, v.label, v.bound);
+      key += buf;
+    }
+    for (size_t i = query.edge_begin; i < query.edge_end; i++) {
+      const Edge& e = edges[i];
+      snprintf(buf, sizeof(buf), "e %d %d %d;", e.src, e.dst, e.label);
+      key += buf;
+    }
+    return key;
+  }
+
+  // the query as its "v ID LABEL BOUND" and "e SRC DST LABEL" lines
+  std::vector<std::string> Lines(size_t q) const {
+    const Query& query = queries[q];
+    std::vector<std::string> lines;
+    char buf[64];
+    for (size_t i = query.vertex_begin; i < query.vertex_end; i++) {
+      const Vertex& v = vertices[i];
+      snprintf(buf, sizeof(buf), "v %d %d %d", v.id, v.label, v.bound);
+      lines.push_back(buf);
+    }
+    for (size_t i = query.edge_begin; i < query.edge_end; i++) {
+      const Edge& e = edges[i];
+      snprintf(buf, sizeof(buf), "e %d %d %d", e.src, e.dst, e.label);
+      lines.push_back(buf);
+    }
+    return lines;
+  }
+
+private:
+  void Clear() {
+    vertices.clear();
+    edges.clear();
+    queries.clear();
+  }
+
+  void Parse(const char* p, const char* end) {
+    while (p < end) {
+      const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+      if (eol == nullptr)
+        eol = end;
+      ParseLine(p, eol);
+      p = eol + 1;
+    }
+  }
+
+  static bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+  // the next token of [p, end) as an int, or fallback if there is none
+  static int NextInt(const char*& p, const char* end, int fallback) {
+    while (p < end && IsSpace(*p))
+      p++;
+    if (p == end)
+      return fallback;
+    bool negative = *p == '-';
+    if (negative || *p == '+')
+      p++;
+    long value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+      value = value * 10 + (*p - '0');
+    while (p < end && !IsSpace(*p))
+      p++;
+    return static_cast<int>(negative ? -value : value);
+  }
+
+  void Open(std::string name) {
+    queries.push_back(Query{std::move(name), vertices.size(), vertices.size(),
+                            edges.size(), edges.size()});
+  }
+
+  void ParseLine(const char* p, const char* end) {
+    if (end - p < 2 || !IsSpace(p[1]))
+      return;
+    char kind = *p;
+    p += 2;
+    if (kind == 't') {
+      // "t # ID": the ID is the last token
+      while (end > p && IsSpace(end[-1]))
+        end--;
+      const char* name = end;
+      while (name > p && !IsSpace(name[-1]))
+        name--;
+      Open(std::string(name, end));
+    } else if (kind == 'v') {
+      if (queries.empty())
+        Open(std::string());
+      int id = NextInt(p, end, 0);
+      int label = NextInt(p, end, -1);
+      int bound = NextInt(p, end, -1);
+      vertices.push_back(Vertex{id, label, bound});
+      queries.back().vertex_end = vertices.size();
+    } else if (kind == 'e') {
+      if (queries.empty())
+        Open(std::string());
+      int src = NextInt(p, end, 0);
+      int dst = NextInt(p, end, 0);
+      int label = NextInt(p, end, 0);
+      edges.push_back(Edge{src, dst, label});
+      queries.back().edge_end = edges.size();
+    }
+  }
+};
+
+#endif
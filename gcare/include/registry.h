@@ -0,0 +1,203 @@
+#ifndef REGISTRY_H_
+#define REGISTRY_H_
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "counters.h"
+#include "memory.h"
+#include "mmap_file.h"
+#include "perf_counters.h"
+
+// Estimators register themselves by method name together with the kind of
+// data they run on ("graph" or "relation", see REGISTER_ESTIMATOR in
+// estimator.h), and every kind registers one Backend that loads its data.
+// Registration runs in static initialisers, so a binary offers exactly the
+// methods linked into it and main() needs no list of its own.
+
+// the most ratios of one nested run, see QueryParams::ratios
+const int MAX_NESTED_RATIOS = 16;
+
+struct QueryResult {
+  double est;
+  double nested_est[MAX_NESTED_RATIOS]; // for each of QueryParams::ratios
+  double time;
+  int m_est; // peak resident set in kB
+  int64_t m_subsystem[NUM_MEMORY_SUBSYSTEMS]; // peak bytes, see memory.h
+  bool partial; // est is of the samples before the timeout
+  size_t samples; // see Estimator::NumSamples
+  double variance; // of est, see Estimator::Variance
+  Counters counters;
+  PerfCounters perf; // with QueryParams::perf
+};
+
+class EstimateCache;
+class QueryText;
+class WorkStealingPool;
+
+struct QueryParams {
+  int num_iter;
+  int seed;
+  double ratio;
+  bool fork;
+  int num_threads;
+  double rel_ci = 0.0; // early stop, see Estimator::SetStopping
+  double budget = 0.0;
+  // pool the iterations by inverse variance and run them only until the
+  // pooled standard error is at most this fraction of the estimate; 0 runs
+  // all num_iter and averages them
+  double target_rse = 0.0;
+  size_t progress_every = 0; // see Estimator::SetProgress
+  bool report_memory = false;
+  // read the hardware counters of each phase of every iteration (see
+  // PerfProbe)
+  bool perf = false;
+  // in-process iterations: abort one whose tracked allocations exceed this
+  // many bytes, 0 for no limit (see MemoryBudget)
+  int64_t memory_limit = 0;
+  EstimateCache* cache = nullptr; // see EstimateCache
+  // nested sampling: estimate at each of these ratios in one run at ratio,
+  // their maximum (see Estimator::SetNestedRatios); empty for just ratio
+  std::vector<double> ratios;
+  // batch mode: an iteration of a mean estimator runs as this many chunks
+  // at ratio / split, which idle workers may take over (see Runner::Submit)
+  int split = 1;
+  double timeout = 300; // seconds per iteration
+  // at the timeout, estimate from the samples so far instead of failing
+  // (see Estimator::SetDeadline)
+  bool partial = false;
+
+  QueryParams(int num_iter, int seed, double ratio, bool fork = true,
+              int num_threads = 1)
+      : num_iter(num_iter), seed(seed), ratio(ratio), fork(fork),
+        num_threads(num_threads) {}
+};
+
+// One method running on the data of the Backend that created it.
+class Runner {
+public:
+  virtual ~Runner() {}
+
+  // build mode: builds and writes the summary, returns the seconds taken;
+  // with resume, from the checkpoint of an interrupted build of it (see
+  // Estimator::Summarize)
+  virtual double Summarize(const char* summary, double p, int seed,
+                           bool resume = false) = 0;
+  // build mode: the budget of the next Summarize, and what that made of
+  // it (see Estimator::SetBuildBudget)
+  virtual void SetBuildBudget(size_t bytes, double seconds) = 0;
+  virtual std::string BuildReport() = 0;
+  // build mode: whether the summary is the same for every p and seed (see
+  // Estimator::FixedSummary)
+  virtual bool FixedSummary() = 0;
+  // build mode: writes the summary of the last Summarize to summary too
+  virtual void WriteSummary(const char* summary) = 0;
+  // build mode: applies the edge updates in the file updates to summary
+  // (see Estimator::UpdateSummary), returns the seconds taken, or -1 if the
+  // method cannot
+  virtual double UpdateSummary(const char* summary, const char* updates) = 0;
+
+  // query mode: instances is the number of estimators for in-process
+  // threads, each reading the summary
+  virtual void ReadSummary(const char* summary, int instances) = 0;
+
+  // runs the iterations on the query in the file path, or in text if given,
+  // with one slot of query_result per iteration (shared memory when
+  // forking), and averages them into est and time; false on a timeout or
+  // crash, or if there is not exactly one query, reported on stderr. With query_params.ratios, nested_est gets
+  // the average estimate at each of them.
+  virtual bool Query(const char* path, std::vector<std::string>* text,
+                     const QueryParams& query_params,
+                     QueryResult* query_result, double& est, double& time,
+                     std::vector<double>* nested_est = nullptr) = 0;
+
+  // estimates the connected sub-patterns of the query given as its "v"/"e"
+  // lines in text, each a mask of its edges (bit i for the i'th "e" line),
+  // in one pass over them (see Estimator::RunSubpatterns): those of masks,
+  // or all of them if masks is empty, which then gets them. est gets the
+  // mean over the iterations, run in process, and time their mean seconds;
+  // false, reported on stderr, on a timeout, a query of more than 64 edges,
+  // or a method that cannot
+  virtual bool QuerySubpatterns(std::vector<std::string>& text,
+                                const QueryParams& query_params,
+                                std::vector<uint64_t>& masks,
+                                std::vector<double>& est, double& time) {
+    return false;
+  }
+
+  // batch mode: queues the iterations of query index of text on pool, whose
+  // workers w run on estimator instance w (so ReadSummary needs
+  // pool.Size() instances), and calls done with the averaged est and time
+  // once all of them ran, from the worker that ran the last; ok is false
+  // on a timeout, partial whether one cut an iteration short instead
+  typedef std::function<void(bool ok, double est, double time, bool partial)>
+      Done;
+  virtual void Submit(WorkStealingPool& pool, const QueryText& text,
+                      size_t index, const QueryParams& query_params,
+                      Done done) = 0;
+
+  // server mode: rebuilds the summary from the binary data at prefix on a
+  // thread of low priority and writes it to summary, while the queries go
+  // on with the summary read; the queries after it is done use the new
+  // one. False if the method cannot, or a rebuild is running already
+  virtual bool StartRebuild(const char* prefix, const char* summary,
+                            double p, int seed) {
+    return false;
+  }
+};
+
+// The data of one kind, loaded once and shared by all of its Runners.
+class Backend {
+public:
+  virtual ~Backend() {}
+
+  // builds the binary data at prefix from the text data graph unless it
+  // exists already
+  virtual void Build(const char* text, const char* prefix) = 0;
+  // build mode, before Build: the graph data keeps just these vertex and
+  // edge labels (see DataGraph::SetLabelProjection)
+  virtual void SetLabelProjection(const std::vector<int>& vlabels,
+                                  const std::vector<int>& elabels) {}
+  // query mode, before Load: the methods that will run, so only the data
+  // they read need be loaded
+  virtual void SetMethods(const std::vector<std::string>& methods) {}
+  virtual void Load(const char* prefix, LoadMode mode) = 0;
+  virtual Runner* NewRunner(const std::string& method) = 0;
+  // server mode: inserts or deletes the edge src -> dst labelled el in the
+  // loaded data (see DataGraph::InsertEdge); false if it cannot
+  virtual bool UpdateEdge(bool insert, int src, int dst, int el) {
+    return false;
+  }
+  // server mode: how many times the updates were merged into the binary
+  // data so far (see GCARE_COMPACT_UPDATES)
+  virtual int Compactions() { return 0; }
+};
+
+typedef Backend* (*BackendFactory)();
+
+struct Registry {
+  std::map<std::string, std::string> methods; // method -> kind
+  std::map<std::string, BackendFactory> backends; // kind -> factory
+
+  static Registry& Get() {
+    static Registry registry;
+    return registry;
+  }
+
+  // the kind of method, or an empty string if no such method is linked in
+  std::string KindOf(const std::string& method) const {
+    auto it = methods.find(method);
+    return it == methods.end() ? std::string() : it->second;
+  }
+
+  std::string MethodList() const {
+    std::string list;
+    for (auto& m : methods)
+      list += (list.empty() ? "" : ", ") + m.first;
+    return list;
+  }
+};
+
+#endif
@@ -8,10 +8,12 @@
 #include <cassert>
 #include <cstring>
 #include <algorithm>
-#include <unordered_map>
-#include <boost/functional/hash.hpp>
 #include <sstream>
 
+#include "memory.h"
+
+namespace relational {
+
 template<typename CellType>
 struct Relation {
 
@@ -22,6 +24,7 @@ struct Relation {
     uint64_t max_rows_;
 
     CellType* data_;
+    size_t alloc_bytes_ = 0; // of data_, accounted to MEMORY_RELATION
 
     struct Row {
         CellType* data_;
@@ -49,15 +52,15 @@ struct Relation {
     Relation(uint64_t num_cols, uint64_t num_rows)
     : num_rows_(num_rows), data_(NULL), max_rows_(num_rows), num_cols_(num_cols)
     {
-        data_ = (CellType*) malloc(sizeof(CellType) * num_cols_ * num_rows);
+        data_ = allocRows(num_cols_, num_rows);
+        alloc_bytes_ = data_ ? sizeof(CellType) * num_cols_ * num_rows : 0;
     }
 
     ~Relation() {
-        if (data_) free(data_);
+        freeRows();
     }
     void clear() {
-        if (data_) free(data_);
-        data_ = NULL;
+        freeRows();
         max_rows_ = 0;
         num_rows_ = 0;
     }
@@ -68,16 +71,23 @@ struct Relation {
         return Row(data_ + (num_cols_ * r), num_cols_);
     }
 
-    void handleOverflow() {
-        uint64_t new_max_rows = max_rows_ == 0 ? 1 : max_rows_ * 2;
-        CellType* new_data = (CellType*) malloc(sizeof(CellType) * num_cols_ * new_max_rows);
-
+    // Grows the capacity to at least num_rows rows, keeping the rows. The
+    // block is realloc'ed, which glibc serves for large (mmap'ed) blocks by
+    // mremap, so growing a big relation moves pages instead of copying rows.
+    void reserve(uint64_t num_rows) {
+        if (num_rows <= max_rows_ || num_cols_ == 0) return;
+        size_t bytes = sizeof(CellType) * num_cols_ * num_rows;
+        CellType* new_data = (CellType*) realloc(data_, bytes);
         if (!new_data) throw ErrCode::MEMORY;
-
-        memcpy((void*) new_data, (void*) data_, sizeof(CellType) * num_cols_ * max_rows_);
-        free((void*) data_);
-        max_rows_ = new_max_rows;
+        GetMemoryAccount(MEMORY_RELATION).Free(alloc_bytes_);
+        GetMemoryAccount(MEMORY_RELATION).Allocate(bytes);
         data_ = new_data;
+        max_rows_ = num_rows;
+        alloc_bytes_ = bytes;
+    }
+
+    void handleOverflow() {
+        reserve(max_rows_ < MIN_GROWTH_ROWS ? MIN_GROWTH_ROWS : max_rows_ * 2);
     }
     
     void append(std::vector<CellType> &vals) {
@@ -98,31 +108,36 @@ struct Relation {
         num_rows_++;
     }
 
+    // appends num_rows rows laid out back to back at vals, growing once
+    void append(const CellType* vals, uint64_t num_rows) {
+        if (num_rows_ + num_rows > max_rows_)
+            reserve(std::max(num_rows_ + num_rows, max_rows_ * 2));
+        if (num_rows > 0)
+            memcpy((void*) (data_ + num_cols_ * num_rows_), (const void*) vals,
+                    sizeof(CellType) * num_cols_ * num_rows);
+        num_rows_ += num_rows;
+    }
+
     void swap(Relation &other) {
         std::swap(data_, other.data_);        
         std::swap(num_cols_, other.num_cols_);
         std::swap(num_rows_, other.num_rows_);
         std::swap(max_rows_, other.max_rows_);
+        std::swap(alloc_bytes_, other.alloc_bytes_);
     }
 
     uint64_t size() { return num_rows_; }
 
-    template <typename T>
-    struct ContainerHash {
-        size_t operator()(T const&c) const {
-            return boost::hash_range(c.begin(), c.end());
-        }
-    };
-
+    // Hash join on this (after the swap: the smaller side, which is built)
+    // and rr, leaving the result in this and clearing rr. Up to two join
+    // columns are packed into one 64-bit key (compared exactly); any further
+    // ones, or wider cells, are compared on probe. Both sides are radix
+    // partitioned so each build table stays in cache, all tables live in one
+    // open-addressing array, and the output is sized by a counting probe and
+    // then written row by row in place.
     void join(std::vector<int> &lcols, std::vector<int> &rcols, Relation<CellType> &rr) {
 
         Relation<CellType> &lr = *this;
-        if (lr.size() == 0 || rr.size() == 0) {
-            lr.clear();
-            rr.clear();
-            return;
-        }
-        
         if (lr.size() > rr.size()) {
             lr.swap(rr);
             lcols.swap(rcols);
@@ -147,41 +162,166 @@ struct Relation {
                 nr_pos.push_back(i);
             }
         }
+        bool exact = l_pos.size() <= 2 && sizeof(CellType) <= sizeof(uint32_t);
+
+        // 2. Radix partition both sides by key hash
+        int bits = 0;
+        while ((lr.size() >> bits) > JOIN_PARTITION_ROWS && bits < JOIN_MAX_RADIX_BITS) bits++;
+        uint64_t num_parts = 1ull << bits;
+        RowIds l_hash, r_hash, l_rows, r_rows, l_begin, r_begin;
+        partition(lr, l_pos, bits, l_hash, l_rows, l_begin);
+        partition(rr, r_pos, bits, r_hash, r_rows, r_begin);
 
-        // 2. Build hash table of the left relation
-        std::unordered_multimap<std::vector<CellType>, uint64_t, ContainerHash<std::vector<CellType>>> hash_table;
-        
-        std::vector<CellType> key(l_pos.size());
-        for (uint64_t i = 0; i < lr.size(); ++i) {
-            for (size_t j = 0; j < key.size(); ++j) {
-                key[j] = lr[i][l_pos[j]];
+        // 3. Build: per partition, a power-of-two region of the slot array
+        // at most half full; rows with one key are chained through next
+        std::vector<uint64_t> t_begin(num_parts + 1, 0);
+        for (uint64_t p = 0; p < num_parts; ++p) {
+            uint64_t cap = 1;
+            while (cap < 2 * (l_begin[p + 1] - l_begin[p])) cap <<= 1;
+            t_begin[p + 1] = t_begin[p] + cap;
+        }
+        TrackedVector<JoinSlot, MEMORY_RELATION> slots(t_begin[num_parts], JoinSlot{0, NONE, 0});
+        RowIds next(lr.size());
+        for (uint64_t p = 0; p < num_parts; ++p) {
+            uint64_t mask = t_begin[p + 1] - t_begin[p] - 1;
+            JoinSlot* table = slots.data() + t_begin[p];
+            for (uint64_t k = l_begin[p]; k < l_begin[p + 1]; ++k) {
+                uint64_t i = l_rows[k];
+                uint64_t key = packKey(lr.data_ + lr.num_cols_ * i, l_pos);
+                uint64_t s = l_hash[i] & mask;
+                while (table[s].head != NONE && table[s].key != key) s = (s + 1) & mask;
+                table[s].key = key;
+                next[i] = table[s].head;
+                table[s].head = i;
+                table[s].count++;
+            }
+        }
+
+        // 4. Probe: count the output, remembering the slot of each probe row
+        RowIds r_slot(rr.size(), NONE);
+        uint64_t total = 0;
+        for (uint64_t p = 0; p < num_parts; ++p) {
+            uint64_t mask = t_begin[p + 1] - t_begin[p] - 1;
+            const JoinSlot* table = slots.data() + t_begin[p];
+            for (uint64_t k = r_begin[p]; k < r_begin[p + 1]; ++k) {
+                uint64_t i = r_rows[k];
+                const CellType* row = rr.data_ + rr.num_cols_ * i;
+                uint64_t key = packKey(row, r_pos);
+                uint64_t s = r_hash[i] & mask;
+                while (table[s].head != NONE && table[s].key != key) s = (s + 1) & mask;
+                if (table[s].head == NONE) continue;
+                r_slot[i] = t_begin[p] + s;
+                if (exact) {
+                    total += table[s].count;
+                    continue;
+                }
+                for (uint64_t l = table[s].head; l != NONE; l = next[l])
+                    total += sameKey(lr.data_ + lr.num_cols_ * l, l_pos, row, r_pos);
             }
-            hash_table.emplace(key, i);
         }
 
-        std::vector<CellType> tuple(ncols.size());
+        // 5. Write the output rows: all columns of lr, then the rest of rr
         Relation<CellType> nr(ncols.size());
-        // 3. Do join
+        if (total > 0) {
+            nr.data_ = allocRows(nr.num_cols_, total);
+            if (!nr.data_) throw ErrCode::MEMORY;
+            nr.num_rows_ = nr.max_rows_ = total;
+            nr.alloc_bytes_ = sizeof(CellType) * nr.num_cols_ * total;
+        }
+        CellType* out = nr.data_;
+        size_t l_width = lcols.size();
         for (uint64_t i = 0; i < rr.size(); ++i) {
-            for (size_t j = 0; j < key.size(); ++j) {
-                key[j] = rr[i][r_pos[j]];
-            }
-            auto range = hash_table.equal_range(key);
-            for (auto it = range.first; it != range.second; ++it) {
-                uint64_t idx = it->second;
-                for (size_t j = 0; j < lcols.size(); ++j) {
-                    tuple[j] = lr[idx][j];
-                }
+            if (r_slot[i] == NONE) continue;
+            const CellType* row = rr.data_ + rr.num_cols_ * i;
+            for (uint64_t l = slots[r_slot[i]].head; l != NONE; l = next[l]) {
+                const CellType* lrow = lr.data_ + lr.num_cols_ * l;
+                if (!exact && !sameKey(lrow, l_pos, row, r_pos)) continue;
+                memcpy(out, lrow, sizeof(CellType) * l_width);
                 for (size_t j = 0; j < nr_pos.size(); ++j) {
-                    tuple[j + lcols.size()] = rr[i][nr_pos[j]];
+                    out[j + l_width] = row[nr_pos[j]];
                 }
-                nr.append(tuple);
+                out += nr.num_cols_;
             }
         }
+        assert(out == nr.data_ + nr.num_cols_ * total);
         rr.clear();
         lcols.swap(ncols);
         lr.swap(nr);
     }
+
+private:
+    typedef TrackedVector<uint64_t, MEMORY_RELATION> RowIds;
+
+    static CellType* allocRows(uint64_t num_cols, uint64_t num_rows) {
+        size_t bytes = sizeof(CellType) * num_cols * num_rows;
+        CellType* data = (CellType*) malloc(bytes);
+        if (data) GetMemoryAccount(MEMORY_RELATION).Allocate(bytes);
+        return data;
+    }
+
+    void freeRows() {
+        if (data_) free(data_);
+        GetMemoryAccount(MEMORY_RELATION).Free(alloc_bytes_);
+        data_ = NULL;
+        alloc_bytes_ = 0;
+    }
+
+    // the first capacity handleOverflow gives, so that small relations do
+    // not grow row by row
+    static const uint64_t MIN_GROWTH_ROWS = 16;
+    // build partitions of at most this many rows keep their table in cache
+    static const uint64_t JOIN_PARTITION_ROWS = 2048;
+    static const int JOIN_MAX_RADIX_BITS = 12;
+    static const uint64_t NONE = ~0ull;
+
+    struct JoinSlot {
+        uint64_t key;
+        uint64_t head;  // first build row with key, or NONE for an empty slot
+        uint64_t count; // # build rows with key
+    };
+
+    static inline uint64_t packKey(const CellType* row, const std::vector<uint64_t>& pos) {
+        uint64_t key = 0;
+        for (size_t j = 0; j < pos.size() && j < 2; ++j)
+            key = (key << 32) | (uint32_t) row[pos[j]];
+        return key;
+    }
+
+    static inline bool sameKey(const CellType* a, const std::vector<uint64_t>& a_pos,
+            const CellType* b, const std::vector<uint64_t>& b_pos) {
+        for (size_t j = 0; j < a_pos.size(); ++j)
+            if (a[a_pos[j]] != b[b_pos[j]]) return false;
+        return true;
+    }
+
+    static inline uint64_t mix(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ull;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // hash[i]: key hash of row i; rows: row ids grouped by partition (the
+    // top bits of the hash), partition p at [begin[p], begin[p + 1])
+    static void partition(Relation<CellType>& r, const std::vector<uint64_t>& pos, int bits,
+            RowIds& hash, RowIds& rows, RowIds& begin) {
+        uint64_t n = r.size();
+        hash.resize(n);
+        begin.assign((1ull << bits) + 1, 0);
+        for (uint64_t i = 0; i < n; ++i) {
+            hash[i] = mix(packKey(r.data_ + r.num_cols_ * i, pos));
+            begin[(bits == 0 ? 0 : hash[i] >> (64 - bits)) + 1]++;
+        }
+        for (size_t p = 1; p < begin.size(); ++p) begin[p] += begin[p - 1];
+        std::vector<uint64_t> fill(begin.begin(), begin.end() - 1);
+        rows.resize(n);
+        for (uint64_t i = 0; i < n; ++i)
+            rows[fill[bits == 0 ? 0 : hash[i] >> (64 - bits)]++] = i;
+    }
 };
 
+}  // namespace relational
+
 #endif
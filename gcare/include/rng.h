@@ -0,0 +1,64 @@
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <cstdint>
+
+// xoshiro256** (Blackman & Vigna) seeded through splitmix64.
+// Every Estimator owns one, so concurrent runs share no state and each run
+// is reproducible from its seed alone.
+class Rng {
+public:
+	typedef uint64_t result_type;
+
+	explicit Rng(uint64_t seed = 0) { Seed(seed); }
+
+	void Seed(uint64_t seed) {
+		for (int i = 0; i < 4; i++) {
+			seed += 0x9e3779b97f4a7c15ull;
+			uint64_t z = seed;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			s_[i] = z ^ (z >> 31);
+		}
+	}
+
+	inline uint64_t Next() {
+		uint64_t result = Rotl(s_[1] * 5, 7) * 9;
+		uint64_t t = s_[1] << 17;
+		s_[2] ^= s_[0];
+		s_[3] ^= s_[1];
+		s_[1] ^= s_[2];
+		s_[0] ^= s_[3];
+		s_[2] ^= t;
+		s_[3] = Rotl(s_[3], 45);
+		return result;
+	}
+
+	// unbiased integer in [0, n) for n > 0 (Lemire's multiply-shift method)
+	inline uint64_t Uniform(uint64_t n) {
+		__uint128_t m = (__uint128_t)Next() * n;
+		uint64_t low = (uint64_t)m;
+		if (low < n) {
+			uint64_t threshold = -n % n;
+			while (low < threshold) {
+				m = (__uint128_t)Next() * n;
+				low = (uint64_t)m;
+			}
+		}
+		return (uint64_t)(m >> 64);
+	}
+
+	// UniformRandomBitGenerator interface, for seeding <random> engines
+	static constexpr uint64_t min() { return 0; }
+	static constexpr uint64_t max() { return UINT64_MAX; }
+	inline uint64_t operator()() { return Next(); }
+
+private:
+	static inline uint64_t Rotl(uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	uint64_t s_[4];
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SIMD_SEARCH_H_
+#define SIMD_SEARCH_H_
+
+#include <cstdint>
+
+#include "util.h"
+
+// Search kernels over sorted int lists (adjacency and label lists), the
+// MinHash kernels of the SumRDF summary builder and the histogram dot
+// product of CSet.
+// AVX-512, AVX2, NEON and scalar variants are compiled in; the widest one the
+// CPU supports is picked at startup. GCARE_SIMD=avx512|avx2|neon|scalar
+// forces a variant, e.g. for comparing them.
+
+// first element >= target in [begin, end)
+const int* LowerBound(const int* begin, const int* end, int target);
+
+bool Contains(range r, int target);
+
+// found[i] = whether targets[i] is in r (targets need not be sorted);
+// returns the number found
+int ContainsBatch(range r, const int* targets, int n, bool* found);
+
+// writes the intersection of a and b to out (may be NULL to only count)
+// and returns its size; out needs room for the smaller of the two
+int Intersect(range a, range b, int* out);
+
+// mins[k] = min(mins[k], val * a[k] + b[k]) for k < n, in wrapping 32-bit
+// arithmetic: the MinHash signature update of one hashed value
+void MinHashUpdate(int val, const int* a, const int* b, int n, int* mins);
+
+// number of k < n with a[k] == b[k]
+int CountEqual(const int* a, const int* b, int n);
+
+// sum of a[k] * b[k] for k < n, exact in 64 bits
+int64_t DotProduct(const int* a, const int* b, int n);
+
+// out[i] = base + the width bits of words from bit i * width on, for i < n
+// and 0 < width <= 32, in wrapping 32-bit arithmetic: the unpacking of a
+// frame-of-reference block (see packed_column.h). words must be readable
+// one word past the last of those bits.
+void UnpackBits(const uint32_t* words, int width, int base, int n, int* out);
+
+// name of the variant in use
+const char* SimdKernelName();
+
+#endif
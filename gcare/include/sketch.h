@@ -2,13 +2,64 @@
 #define SKETCH_H_
 
 #include "data_relations.h"
+#include "mmap_file.h"
 #include "query_relations.h"
 #include "util.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <map>
 #include <math.h>
 #include <set>
+#include <tuple>
+
+namespace relational {
+
+// what identifies a sketch: its table, active column, hash sizes and join
+// columns, and the columns and values it is bound to (online sketches), at
+// most two of each since tables have two columns; the unused slots are 0,
+// so keys compare and hash as plain ints
+struct SketchKey {
+  int t, active_col;
+  int num_hash, num_join, num_bounds;
+  int hash_sizes[2], join_cols[2], bound_cols[2], bounds[2];
+
+  SketchKey(int _t, int _active_col, const vector<int> &_hash_sizes,
+            const vector<int> &_join_cols, const vector<int> &_bounds = {},
+            const vector<int> &_bound_cols = {}) {
+    memset(this, 0, sizeof(*this));
+    assert(_hash_sizes.size() <= 2 && _join_cols.size() <= 2 &&
+           _bounds.size() <= 2 && _bounds.size() == _bound_cols.size());
+    t = _t;
+    active_col = _active_col;
+    num_hash = _hash_sizes.size();
+    num_join = _join_cols.size();
+    num_bounds = _bounds.size();
+    std::copy(_hash_sizes.begin(), _hash_sizes.end(), hash_sizes);
+    std::copy(_join_cols.begin(), _join_cols.end(), join_cols);
+    std::copy(_bounds.begin(), _bounds.end(), bounds);
+    std::copy(_bound_cols.begin(), _bound_cols.end(), bound_cols);
+  }
+
+  bool operator==(const SketchKey &o) const {
+    return memcmp(this, &o, sizeof(*this)) == 0;
+  }
+};
+
+struct SketchKeyHash {
+  size_t operator()(const SketchKey &k) const {
+    const int *w = (const int *)&k;
+    uint64_t h = 0;
+    for (size_t i = 0; i < sizeof(k) / sizeof(int); i++)
+      h = (h ^ (uint32_t)w[i]) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 32);
+  }
+};
+
+class Sketch;
+typedef unordered_map<SketchKey, Sketch *, SketchKeyHash> SketchMap;
 
 class Sketch {
 public:
@@ -23,291 +74,216 @@ public:
   map<int, map<int, int>> l2gIndex;
   map<int, map<int, int>> g2lIndex;
 
+  // the counts, row-major over hash_sizes; points into store, or into a
+  // mapped sketch archive in query mode
+  const int *data;
+  vector<int> store;
+  // a sparse sketch of an archive (nnz >= 0) has only its non-zero counts,
+  // nz_counts[i] being that of bucket nz_ids[i], ids ascending, and no data
+  int nnz;
+  const int *nz_ids, *nz_counts;
+
   Sketch(int _t, int _active_col, vector<int> &_join_cols,
          vector<int> &_hash_sizes, vector<int> &_bounds,
          vector<int> &_bound_cols, DataGraph *_g)
       : t(_t), active_col(_active_col), join_cols(_join_cols),
         hash_sizes(_hash_sizes), bounds(_bounds), bound_cols(_bound_cols),
-        g(_g) {}
+        g(_g), data(nullptr), nnz(-1), nz_ids(nullptr), nz_counts(nullptr) {}
 
-  virtual int access(int boundID, int gVarIndex, vector<int> &arr) = 0;
-  virtual ~Sketch() = default;
-};
-
-class ZeroDimensionalSketchUnc : public Sketch {
-public:
-  int unc[1];
+  int size() const {
+    int n = 1;
+    for (int h : hash_sizes)
+      n *= h;
+    return n;
+  }
 
-  ZeroDimensionalSketchUnc(int _t, int _active_col, vector<int> &_join_cols,
-                           vector<int> &_hash_sizes, vector<int> &_bounds,
-                           vector<int> &_bound_cols, DataGraph *_g, string file)
-      : Sketch(_t, _active_col, _join_cols, _hash_sizes, _bounds, _bound_cols,
-               _g) {
-    if (file.length() == 0) {
-      unc[0] = 0;
-      populate();
-    } else {
-      deserialize(file);
+  // file: a text sketch written by earlier versions, one count per line;
+  // neither file nor mapped: zero, for build() to fill from the data graph
+  void load(const string &file, const int *mapped) {
+    if (mapped != nullptr) {
+      data = mapped;
+      return;
+    }
+    store.assign(size(), 0);
+    if (file.length() != 0) {
+      ifstream in(file.c_str());
+      string line;
+      int i = 0;
+      while (getline(in, line)) {
+        assert(i < store.size());
+        store[i++] = stoi(line);
+      }
+      assert(i == store.size());
+      in.close();
     }
+    data = store.data();
   }
 
-  void deserialize(string file) {
-    ifstream in(file.c_str());
-    string line;
-    while (getline(in, line))
-      unc[0] = stoi(line);
-    in.close();
+  // the n non-zero counts of a sparse archive sketch, in place of data
+  void setSparse(const int *ids, const int *counts, int n) {
+    data = nullptr;
+    nnz = n;
+    nz_ids = ids;
+    nz_counts = counts;
   }
 
-  void populate() {
-    if (g->table_[t].size() == 0)
-      return;
+  // the count of bucket b
+  int at(int b) const {
+    if (nnz < 0)
+      return data[b];
+    const int *p = std::lower_bound(nz_ids, nz_ids + nnz, b);
+    return p != nz_ids + nnz && *p == b ? nz_counts[p - nz_ids] : 0;
+  }
 
-    if (bounds.size() == 0) {
-      unc[0] = g->table_[t].size();
+  // f(b, count) for the buckets b in [lo, hi) with a non-zero count,
+  // ascending
+  template <class F> void scan(int lo, int hi, F f) const {
+    if (nnz < 0) {
+      for (int b = lo; b < hi; b++)
+        if (data[b] != 0)
+          f(b, data[b]);
       return;
     }
+    const int *end = nz_ids + nnz;
+    for (const int *p = std::lower_bound(nz_ids, end, lo); p != end && *p < hi;
+         p++)
+      f(*p, nz_counts[p - nz_ids]);
+  }
 
-    for (int i = 0; i < g->table_[t].size(); i++) {
-      bool match = true;
-      for (int j = 0; j < bounds.size(); j++) {
-        if (bounds[j] != g->table_[t][i][bound_cols[j]])
-          match = false;
+  // the bucket of a row: its join columns modulo hash_sizes, row-major
+  int bucket(const int *row) const {
+    int b = 0;
+    for (size_t k = 0; k < join_cols.size(); k++)
+      b = b * hash_sizes[k] + row[join_cols[k]] % hash_sizes[k];
+    return b;
+  }
+
+  bool matches(const int *row) const {
+    for (size_t j = 0; j < bounds.size(); j++)
+      if (row[bound_cols[j]] != bounds[j])
+        return false;
+    return true;
+  }
+
+  // the rows of table t that can match the bounds, rows [0, n) if ids is
+  // null: those the index gives for the most selective bound column, which
+  // a packed index decodes into rows
+  void candidates(const int *&ids, size_t &n, vector<int> &rows) const {
+    ids = nullptr;
+    n = g->Table(t).size();
+    bool indexed = false;
+    if (!g->HasIndex())
+      return;
+    vector<int> decoded;
+    for (size_t j = 0; j < bounds.size(); j++) {
+      const int *begin, *end;
+      if (!g->Lookup(t, bound_cols[j], bounds[j], begin, end, &decoded))
+        continue;
+      if (!indexed || (size_t)(end - begin) < n) {
+        if (begin != nullptr && begin == decoded.data())
+          rows.swap(decoded);
+        ids = begin;
+        n = end - begin;
+        indexed = true;
       }
-      if (match)
-        unc[0]++;
     }
+    if (indexed && ids == nullptr)
+      n = 0;
   }
 
-  int access(int boundID, int gVarIndex, vector<int> &arr) { return unc[0]; }
+  static void build(const vector<Sketch *> &sketches);
+
+  virtual int access(int boundID, int gVarIndex, vector<int> &arr) = 0;
+  virtual ~Sketch() = default;
 };
 
-class ZeroDimensionalSketchCon : public Sketch {
+class ZeroDimensionalSketchUnc : public Sketch {
 public:
-  map<int, vector<int>> con;
-
-  ZeroDimensionalSketchCon(int _t, int _active_col, vector<int> &_join_cols,
+  ZeroDimensionalSketchUnc(int _t, int _active_col, vector<int> &_join_cols,
                            vector<int> &_hash_sizes, vector<int> &_bounds,
-                           vector<int> &_bound_cols, DataGraph *_g, string file)
+                           vector<int> &_bound_cols, DataGraph *_g, string file,
+                           const int *mapped = nullptr)
       : Sketch(_t, _active_col, _join_cols, _hash_sizes, _bounds, _bound_cols,
                _g) {
-    assert(hash_sizes.size() == 1);
-    assert(hash_sizes[0] == 1);
-
-    if (file.length() == 0) {
-      con[0].resize(hash_sizes[0]);
-      populate();
-    } else {
-      deserialize(file);
-    }
+    load(file, mapped);
   }
 
-  void deserialize(string file) {
-    ifstream in(file.c_str());
-    string line;
-    while (getline(in, line))
-      con[0].push_back(stoi(line));
-    assert(con[0].size() == hash_sizes[0]);
-    in.close();
-  }
+  int unc() const { return at(0); }
 
-  void populate() {
-    if (g->table_[t].size() == 0)
-      return;
+  int access(int boundID, int gVarIndex, vector<int> &arr) { return at(0); }
+};
 
-    map<int, int> cnt;
-    for (int i = 0; i < g->table_[t].size(); i++) {
-      bool match = true;
-      for (int j = 0; j < bounds.size(); j++) {
-        if (bounds[j] != g->table_[t][i][bound_cols[j]])
-          match = false;
-      }
-      if (match) {
-        int v = g->table_[t][i][active_col];
-        cnt[v]++;
-      }
-    }
-    for (auto p : cnt) {
-      if (p.second > con[0][0])
-        con[0][0] = p.second;
-    }
+class ZeroDimensionalSketchCon : public Sketch {
+public:
+  ZeroDimensionalSketchCon(int _t, int _active_col, vector<int> &_join_cols,
+                           vector<int> &_hash_sizes, vector<int> &_bounds,
+                           vector<int> &_bound_cols, DataGraph *_g, string file,
+                           const int *mapped = nullptr)
+      : Sketch(_t, _active_col, _join_cols, _hash_sizes, _bounds, _bound_cols,
+               _g) {
+    assert(hash_sizes.size() == 1);
+    assert(hash_sizes[0] == 1);
+    load(file, mapped);
   }
 
   int access(int boundID, int gVarIndex, vector<int> &arr) {
     assert(arr[gVarIndex] == 0);
 
-    return con[g2lIndex[boundID][gVarIndex]][arr[l2gIndex[boundID][0]]];
+    return at(arr[l2gIndex[boundID][0]]);
   }
 };
 
 class OneDimensionalSketchUnc : public Sketch {
 public:
-  vector<int> unc;
-
   OneDimensionalSketchUnc(int _t, int _active_col, vector<int> &_join_cols,
                           vector<int> &_hash_sizes, vector<int> &_bounds,
-                          vector<int> &_bound_cols, DataGraph *_g, string file)
+                          vector<int> &_bound_cols, DataGraph *_g, string file,
+                          const int *mapped = nullptr)
       : Sketch(_t, _active_col, _join_cols, _hash_sizes, _bounds, _bound_cols,
                _g) {
-    if (file.length() == 0) {
-      unc.resize(hash_sizes[0], 0);
-      populate();
-    } else {
-      deserialize(file);
-    }
-  }
-
-  void deserialize(string file) {
-    unc.clear();
-    ifstream in(file.c_str());
-    string line;
-    while (getline(in, line))
-      unc.push_back(stoi(line));
-    assert(unc.size() == hash_sizes[0]);
-    in.close();
-  }
-
-  void populate() {
-    assert(join_cols.size() == 1);
-    assert(hash_sizes.size() == 1);
-
-    if (g->table_[t].size() == 0)
-      return;
-
-    for (int i = 0; i < g->table_[t].size(); i++) {
-      bool match = true;
-      for (int j = 0; j < bounds.size(); j++) {
-        if (bounds[j] != g->table_[t][i][bound_cols[j]])
-          match = false;
-      }
-      if (match) {
-        int h = g->table_[t][i][join_cols[0]] % hash_sizes[0];
-        unc[h]++;
-      }
-    }
+    load(file, mapped);
   }
 
   int access(int boundID, int gVarIndex, vector<int> &arr) {
     if (l2gIndex[boundID].empty())
-      return unc[0];
+      return at(0);
     else {
       assert(gVarIndex == -1);
       assert(l2gIndex[boundID][0] < arr.size());
       assert(arr[l2gIndex[boundID][0]] < hash_sizes[0]);
 
-      return unc[arr[l2gIndex[boundID][0]]];
+      return at(arr[l2gIndex[boundID][0]]);
     }
   }
 };
 
 class OneDimensionalSketchCon : public Sketch {
 public:
-  map<int, vector<int>> con;
-
   OneDimensionalSketchCon(int _t, int _active_col, vector<int> &_join_cols,
                           vector<int> &_hash_sizes, vector<int> &_bounds,
-                          vector<int> &_bound_cols, DataGraph *_g, string file)
+                          vector<int> &_bound_cols, DataGraph *_g, string file,
+                          const int *mapped = nullptr)
       : Sketch(_t, _active_col, _join_cols, _hash_sizes, _bounds, _bound_cols,
                _g) {
-    if (file.length() == 0) {
-      con[0].resize(hash_sizes[0]);
-      populate();
-    } else {
-      deserialize(file);
-    }
-  }
-
-  void deserialize(string file) {
-    ifstream in(file.c_str());
-    string line;
-    while (getline(in, line))
-      con[0].push_back(stoi(line));
-    assert(con[0].size() == hash_sizes[0]);
-    in.close();
-  }
-
-  void populate() {
-    assert(join_cols.size() == 1);
-    assert(hash_sizes.size() == 1);
-
-    if (g->table_[t].size() == 0)
-      return;
-
-    vector<map<int, int>> cnt(hash_sizes[0]);
-    for (int i = 0; i < g->table_[t].size(); i++) {
-      bool match = true;
-      for (int j = 0; j < bounds.size(); j++) {
-        if (bounds[j] != g->table_[t][i][bound_cols[j]])
-          match = false;
-      }
-      if (match) {
-        int v = g->table_[t][i][active_col];
-        int h = g->table_[t][i][join_cols[0]] % hash_sizes[0];
-        cnt[h][v]++;
-      }
-    }
-    for (int h = 0; h < hash_sizes[0]; h++) {
-      for (auto p : cnt[h]) {
-        if (p.second > con[0][h])
-          con[0][h] = p.second;
-      }
-    }
+    load(file, mapped);
   }
 
   int access(int boundID, int gVarIndex, vector<int> &arr) {
-    int res = con[g2lIndex[boundID][gVarIndex]][arr[l2gIndex[boundID][0]]];
-    return res;
+    assert(g2lIndex[boundID][gVarIndex] == 0);
+
+    return at(arr[l2gIndex[boundID][0]]);
   }
 };
 
 class TwoDimensionalSketchUnc : public Sketch {
 public:
-  vector<vector<int>> unc;
-
   TwoDimensionalSketchUnc(int _t, int _active_col, vector<int> &_join_cols,
                           vector<int> &_hash_sizes, vector<int> &_bounds,
-                          vector<int> &_bound_cols, DataGraph *_g, string file)
+                          vector<int> &_bound_cols, DataGraph *_g, string file,
+                          const int *mapped = nullptr)
       : Sketch(_t, _active_col, _join_cols, _hash_sizes, _bounds, _bound_cols,
                _g) {
-    unc.resize(hash_sizes[0], vector<int>(hash_sizes[1], 0));
-    if (file.length() == 0) {
-      populate();
-    } else {
-      deserialize(file);
-    }
-  }
-
-  void deserialize(string file) {
-    ifstream in(file.c_str());
-    string line;
-    int i = 0;
-    while (getline(in, line)) {
-      unc[i / hash_sizes[1]][i % hash_sizes[1]] = stoi(line);
-      i++;
-    }
-    assert(i == hash_sizes[0] * hash_sizes[1]);
-    in.close();
-  }
-
-  void populate() {
-    assert(join_cols.size() == 2);
-    assert(hash_sizes.size() == 2);
-
-    if (g->table_[t].size() == 0)
-      return;
-
-    for (int i = 0; i < g->table_[t].size(); i++) {
-      bool match = true;
-      for (int j = 0; j < bounds.size(); j++) {
-        if (bounds[j] != g->table_[t][i][bound_cols[j]])
-          match = false;
-      }
-      if (match) {
-        int h0 = g->table_[t][i][join_cols[0]] % hash_sizes[0];
-        int h1 = g->table_[t][i][join_cols[1]] % hash_sizes[1];
-        unc[h0][h1]++;
-      }
-    }
+    load(file, mapped);
   }
 
   int access(int boundID, int gVarIndex, vector<int> &arr) {
@@ -317,70 +293,20 @@ public:
     assert(arr[l2gIndex[boundID][0]] < hash_sizes[0]);
     assert(arr[l2gIndex[boundID][1]] < hash_sizes[1]);
 
-    return unc[arr[l2gIndex[boundID][0]]][arr[l2gIndex[boundID][1]]];
+    return at(arr[l2gIndex[boundID][0]] * hash_sizes[1] +
+              arr[l2gIndex[boundID][1]]);
   }
 };
 
 class TwoDimensionalSketchCon : public Sketch {
 public:
-  map<int, vector<vector<int>>> con;
-
   TwoDimensionalSketchCon(int _t, int _active_col, vector<int> &_join_cols,
                           vector<int> &_hash_sizes, vector<int> &_bounds,
-                          vector<int> &_bound_cols, DataGraph *_g, string file)
+                          vector<int> &_bound_cols, DataGraph *_g, string file,
+                          const int *mapped = nullptr)
       : Sketch(_t, _active_col, _join_cols, _hash_sizes, _bounds, _bound_cols,
                _g) {
-    con[0].resize(hash_sizes[0], vector<int>(hash_sizes[1], 0));
-    con[1].resize(hash_sizes[0], vector<int>(hash_sizes[1], 0));
-    if (file.length() == 0) {
-      populate();
-    } else {
-      deserialize(file);
-    }
-  }
-
-  void deserialize(string file) {
-    ifstream in(file.c_str());
-    string line;
-    int i = 0;
-    while (getline(in, line)) {
-      con[0][i / hash_sizes[1]][i % hash_sizes[1]] = stoi(line);
-      i++;
-    }
-    assert(i == hash_sizes[0] * hash_sizes[1]);
-    in.close();
-  }
-
-  void populate() {
-    assert(join_cols.size() == 2);
-    assert(hash_sizes.size() == 2);
-
-    if (g->table_[t].size() == 0)
-      return;
-
-    vector<vector<map<int, int>>> cnt(hash_sizes[0],
-                                      vector<map<int, int>>(hash_sizes[1]));
-    for (int i = 0; i < g->table_[t].size(); i++) {
-      bool match = true;
-      for (int j = 0; j < bounds.size(); j++) {
-        if (bounds[j] != g->table_[t][i][bound_cols[j]])
-          match = false;
-      }
-      if (match) {
-        int v = g->table_[t][i][active_col];
-        int h0 = g->table_[t][i][join_cols[0]] % hash_sizes[0];
-        int h1 = g->table_[t][i][join_cols[1]] % hash_sizes[1];
-        cnt[h0][h1][v]++;
-      }
-    }
-    for (int h0 = 0; h0 < hash_sizes[0]; h0++) {
-      for (int h1 = 0; h1 < hash_sizes[1]; h1++) {
-        for (auto p : cnt[h0][h1]) {
-          if (p.second > con[0][h0][h1])
-            con[0][h0][h1] = p.second;
-        }
-      }
-    }
+    load(file, mapped);
   }
 
   int access(int boundID, int gVarIndex, vector<int> &arr) {
@@ -391,11 +317,117 @@ public:
     assert(arr[l2gIndex[boundID][0]] < hash_sizes[0]);
     assert(arr[l2gIndex[boundID][1]] < hash_sizes[1]);
 
-    return con[g2lIndex[boundID][gVarIndex]][arr[l2gIndex[boundID][0]]]
-              [arr[l2gIndex[boundID][1]]];
+    return at(arr[l2gIndex[boundID][0]] * hash_sizes[1] +
+              arr[l2gIndex[boundID][1]]);
+  }
+};
+
+// The counts of a sketch over some of the rows matching its bounds: rows
+// per bucket, and for a conditional sketch the (bucket, value of the
+// active column) pair of every row, whose longest run per bucket once
+// sorted is its count; counts of disjoint rows add up.
+struct SketchCounts {
+  vector<int> rows;
+  vector<uint64_t> pairs;
+
+  void count(const Sketch &s, const int *row) {
+    int b = s.bucket(row);
+    if (s.active_col < 0)
+      rows[b]++;
+    else
+      pairs.push_back((uint64_t)b << 32 | (uint32_t)row[s.active_col]);
+  }
+
+  void add(const SketchCounts &o) {
+    for (size_t b = 0; b < o.rows.size(); b++)
+      rows[b] += o.rows[b];
+    pairs.insert(pairs.end(), o.pairs.begin(), o.pairs.end());
   }
 };
 
+// Fills sketches made without a file or mapping. Sketches of one table
+// with the same bounds share a pass over the rows that can match them,
+// found through the index of a bound column if the data has one; the
+// passes are split into chunks of rows counted in parallel and summed per
+// sketch in chunk order, so the counts do not depend on the threads.
+inline void Sketch::build(const vector<Sketch *> &sketches) {
+  const size_t CHUNK_ROWS = 1 << 16;
+  map<tuple<int, vector<int>, vector<int>>, vector<Sketch *>> groups;
+  for (Sketch *s : sketches)
+    groups[make_tuple(s->t, s->bound_cols, s->bounds)].push_back(s);
+
+  struct Chunk {
+    const vector<Sketch *> *sketches;
+    const int *ids;
+    size_t begin, end;
+    vector<SketchCounts> counts;
+  };
+  vector<Chunk> chunks;
+  vector<pair<Sketch *, vector<size_t>>> merges; // sketch, its chunks
+  vector<vector<int>> rows(groups.size()); // of a packed index, per group
+  size_t next = 0;
+  for (auto &group : groups) {
+    const vector<Sketch *> &members = group.second;
+    const int *ids;
+    size_t n;
+    members[0]->candidates(ids, n, rows[next++]);
+    size_t first = chunks.size();
+    for (size_t b = 0; b == 0 || b < n; b += CHUNK_ROWS)
+      chunks.push_back(Chunk{&members, ids, b, std::min(b + CHUNK_ROWS, n), {}});
+    for (size_t k = 0; k < members.size(); k++) {
+      merges.emplace_back(members[k], vector<size_t>());
+      for (size_t c = first; c < chunks.size(); c++)
+        merges.back().second.push_back(c);
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (size_t c = 0; c < chunks.size(); c++) {
+    Chunk &chunk = chunks[c];
+    const vector<Sketch *> &members = *chunk.sketches;
+    TableReader table = members[0]->g->Table(members[0]->t);
+    chunk.counts.resize(members.size());
+    for (size_t k = 0; k < members.size(); k++)
+      chunk.counts[k].rows.assign(members[k]->size(), 0);
+    int buf[2];
+    for (size_t p = chunk.begin; p < chunk.end; p++) {
+      const int *row = table.Row(chunk.ids ? chunk.ids[p] : p, buf);
+      if (!members[0]->matches(row))
+        continue;
+      for (size_t k = 0; k < members.size(); k++)
+        chunk.counts[k].count(*members[k], row);
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (size_t m = 0; m < merges.size(); m++) {
+    Sketch *s = merges[m].first;
+    SketchCounts total;
+    total.rows.assign(s->size(), 0);
+    for (size_t c : merges[m].second) {
+      const Chunk &chunk = chunks[c];
+      size_t k = std::find(chunk.sketches->begin(), chunk.sketches->end(), s) -
+                 chunk.sketches->begin();
+      total.add(chunk.counts[k]);
+    }
+    if (s->active_col < 0) {
+      s->store = total.rows;
+    } else {
+      vector<uint64_t> &pairs = total.pairs;
+      std::sort(pairs.begin(), pairs.end());
+      for (size_t i = 0; i < pairs.size();) {
+        size_t e = i;
+        while (e < pairs.size() && pairs[e] == pairs[i])
+          e++;
+        int &c = s->store[pairs[i] >> 32];
+        c = std::max(c, (int)(e - i));
+        i = e;
+      }
+    }
+    s->data = s->store.data();
+  }
+}
+
 class OfflineSketch {
 public:
   int t; // data table id
@@ -408,6 +440,16 @@ public:
   vector<vector<int>> unc_2D;
   vector<vector<vector<int>>> con_2D; // active col
 
+  // sorted[c]: the rows as (column c value << 32 | other value), ascending,
+  // so the rows of one value form a run; released once populated
+  vector<uint64_t> sorted[2];
+
+  // hash sizes and the output layout are set up here; the counts are filled
+  // in by sort() and merge() over row ranges of each column, then count()
+  // over ranges of its value runs (see split()) for every configuration,
+  // into the clear()ed counts or, for several ranges, into counts of their
+  // own added by combine(); the tasks of a step are independent, so a build
+  // can run them in parallel within and across tables
   OfflineSketch(int _t, int _buckets, DataGraph *_g)
       : t(_t), buckets(_buckets), g(_g) {
     int h = buckets;
@@ -424,97 +466,235 @@ public:
       h_sizes.push_back(h);
     num_hash = h_sizes.size();
 
-    populate();
-  }
-
-  void populate() {
-
-    // edge label table
     if (t < g->base_) {
-
       unc_2D.resize(num_hash * num_hash); // partition on both columns
       con_2D.resize(2, vector<vector<int>>(num_hash * num_hash));
+    } else {
+      unc_2D.resize(num_hash);
+      con_2D.resize(1, vector<vector<int>>(num_hash * num_hash));
+    }
+  }
 
-      for (int a = 0; a < num_hash; a++) {
-        for (int b = 0; b < num_hash; b++) {
-          int hs0 = h_sizes[a];
-          int hs1 = h_sizes[b];
+  int num_cols() const { return t < g->base_ ? 2 : 1; }
 
-          if ((hs0 - 1) * (hs1 - 1) > buckets)
-            continue;
+  // hash configurations: (a, b) pairs within the budget for an edge table,
+  // a for a vertex table; those beyond the budget are skipped()
+  int num_configs() const {
+    return t < g->base_ ? num_hash * num_hash : num_hash;
+  }
 
-          vector<int> &unc = unc_2D[a * num_hash + b];
-          vector<int> &con0 = con_2D[0][a * num_hash + b];
-          vector<int> &con1 = con_2D[1][a * num_hash + b];
-          unc.resize(hs0 * hs1, 0);
-          con0.resize(hs0 * hs1, 0);
-          con1.resize(hs0 * hs1, 0);
-
-          vector<map<int, int>> cnt0;
-          vector<map<int, int>> cnt1;
-          cnt0.resize(hs0 * hs1);
-          cnt1.resize(hs0 * hs1);
-
-          for (int i = 0; i < g->table_[t].size(); i++) {
-            int v0 = g->table_[t][i][0];
-            int v1 = g->table_[t][i][1];
-            int h0 = v0 % hs0;
-            int h1 = v1 % hs1;
-            cnt0[h0 * hs1 + h1][v0]++;
-            cnt1[h0 * hs1 + h1][v1]++;
-            unc[h0 * hs1 + h1]++;
-          }
-          for (int h0 = 0; h0 < hs0; h0++) {
-            for (int h1 = 0; h1 < hs1; h1++) {
-              for (auto p : cnt0[h0 * hs1 + h1]) {
-                if (p.second > con0[h0 * hs1 + h1])
-                  con0[h0 * hs1 + h1] = p.second;
-              }
-              for (auto p : cnt1[h0 * hs1 + h1]) {
-                if (p.second > con1[h0 * hs1 + h1])
-                  con1[h0 * hs1 + h1] = p.second;
-              }
-            }
-          }
-        }
+  size_t num_rows() const { return g->Table(t).size(); }
+
+  // sorted[c][begin, end), sized num_rows() beforehand, filled from those
+  // rows and sorted, to be merged with the ranges next to it
+  void sort(int c, size_t begin, size_t end) {
+    TableReader table = g->Table(t);
+    vector<uint64_t> &keys = sorted[c];
+    if (table.packed()) {
+      // the range of each column unpacked in one go
+      vector<int> values(end - begin), others(num_cols() == 2 ? end - begin : 0);
+      table.ReadColumn(c, begin, end, values.data());
+      if (num_cols() == 2)
+        table.ReadColumn(1 - c, begin, end, others.data());
+      for (size_t i = begin; i < end; i++) {
+        uint32_t v = values[i - begin];
+        uint32_t w = num_cols() == 2 ? others[i - begin] : 0;
+        keys[i] = (uint64_t)v << 32 | w;
       }
+      std::sort(keys.begin() + begin, keys.begin() + end);
+      return;
     }
-    // vertex label table
-    else {
+    const int *col = g->Column(t, c);
+    const int *other = num_cols() == 2 ? g->Column(t, 1 - c) : nullptr;
+    for (size_t i = begin; i < end; i++) {
+      uint32_t v = col ? col[i] : table.Value(i, c);
+      uint32_t w = num_cols() == 2 ? (other ? other[i] : table.Value(i, 1 - c)) : 0;
+      keys[i] = (uint64_t)v << 32 | w;
+    }
+    std::sort(keys.begin() + begin, keys.begin() + end);
+  }
 
-      unc_2D.resize(num_hash); // partition on both columns
-      con_2D.resize(1, vector<vector<int>>(num_hash * num_hash));
+  void merge(int c, size_t begin, size_t mid, size_t end) {
+    vector<uint64_t> &keys = sorted[c];
+    std::inplace_merge(keys.begin() + begin, keys.begin() + mid,
+                       keys.begin() + end);
+  }
 
-      for (int a = 0; a < num_hash; a++) {
-        int hs = h_sizes[a];
+  // the bounds of up to parts ranges of sorted[c] of about equal rows, each
+  // starting at a new value
+  vector<size_t> split(int c, int parts) const {
+    const vector<uint64_t> &keys = sorted[c];
+    vector<size_t> bounds(1, 0);
+    for (int p = 1; p < parts; p++) {
+      size_t i = std::max(keys.size() * p / parts, bounds.back());
+      while (i < keys.size() && i > 0 && keys[i] >> 32 == keys[i - 1] >> 32)
+        i++;
+      if (i > bounds.back() && i < keys.size())
+        bounds.push_back(i);
+    }
+    bounds.push_back(keys.size());
+    return bounds;
+  }
 
-        vector<int> &unc = unc_2D[a];
-        vector<int> &con = con_2D[0][a];
-        unc.resize(hs, 0);
-        con.resize(hs, 0);
+  // whether a hash configuration is beyond the budget, and has no counts
+  bool skipped(int config) const {
+    if (t >= g->base_)
+      return false;
+    int hs0 = h_sizes[config / num_hash], hs1 = h_sizes[config % num_hash];
+    return (long)(hs0 - 1) * (hs1 - 1) > buckets; // overflows int past 2^16
+  }
 
-        vector<map<int, int>> cnt(hs);
+  int config_size(int config) const {
+    if (t >= g->base_)
+      return h_sizes[config];
+    return h_sizes[config / num_hash] * h_sizes[config % num_hash];
+  }
 
-        for (int i = 0; i < g->table_[t].size(); i++) {
-          int v = g->table_[t][i][0];
-          int h = v % hs;
-          cnt[h][v]++;
-          unc[h]++;
+  // the counts of one hash configuration over the value runs of sorted[c]
+  // in [begin, end), which must start at runs: unc (of an edge table, from
+  // column 0 only) and con_2D[c], zeroed config_size() arrays
+  void count(int config, int c, size_t begin, size_t end, vector<int> &unc,
+             vector<int> &con) const {
+    const vector<uint64_t> &keys = sorted[c];
+    if (t < g->base_) {
+      int hs0 = h_sizes[config / num_hash];
+      int hs1 = h_sizes[config % num_hash];
+
+      // the degree of each value of column c towards every bucket of the
+      // other column, maxed into the bucket of (value, other)
+      int hs = c == 0 ? hs0 : hs1, other_hs = c == 0 ? hs1 : hs0;
+      vector<int> deg(other_hs, 0);
+      vector<int> touched;
+      for (size_t i = begin; i < end;) {
+        uint32_t v = keys[i] >> 32;
+        size_t e = i;
+        for (; e < end && (uint32_t)(keys[e] >> 32) == v; e++) {
+          int h = (uint32_t)keys[e] % other_hs;
+          if (deg[h]++ == 0)
+            touched.push_back(h);
         }
-        for (int h = 0; h < hs; h++) {
-          for (auto p : cnt[h]) {
-            if (p.second > con[h])
-              con[h] = p.second;
-          }
+        int hv = v % hs;
+        for (int h : touched) {
+          int idx = c == 0 ? hv * hs1 + h : h * hs1 + hv;
+          if (c == 0)
+            unc[idx] += deg[h];
+          if (deg[h] > con[idx])
+            con[idx] = deg[h];
+          deg[h] = 0;
         }
+        touched.clear();
+        i = e;
       }
+    } else {
+      int hs = h_sizes[config];
+      for (size_t i = begin; i < end;) {
+        uint64_t v = keys[i] >> 32;
+        size_t e = i;
+        while (e < end && keys[e] >> 32 == v)
+          e++;
+        int h = v % hs;
+        int deg = e - i;
+        unc[h] += deg;
+        if (deg > con[h])
+          con[h] = deg;
+        i = e;
+      }
+    }
+  }
+
+  // zeroed counts of a configuration, for count() or combine() to fill
+  void clear(int config) {
+    int n = config_size(config);
+    unc_2D[config].assign(n, 0);
+    for (int c = 0; c < num_cols(); c++)
+      con_2D[c][config].assign(n, 0);
+  }
+
+  // adds the counts of a range of column c to the configuration's
+  void combine(int config, int c, const vector<int> &unc,
+               const vector<int> &con) {
+    vector<int> &u = unc_2D[config];
+    vector<int> &m = con_2D[c][config];
+    for (size_t i = 0; i < u.size(); i++) {
+      u[i] += unc[i];
+      m[i] = std::max(m[i], con[i]);
+    }
+  }
+
+  void release() {
+    for (auto &keys : sorted)
+      vector<uint64_t>().swap(keys);
+  }
+
+  // the ints append() adds to an archive for this table, at most when
+  // some are written sparse
+  size_t archive_ints() const {
+    size_t n = 0;
+    for (int config = 0; config < num_configs(); config++)
+      if (!skipped(config))
+        n += (num_cols() + 1) * (ARCHIVE_ENTRY + config_size(config));
+    return n;
+  }
+
+  // the counts of a built table, for a checkpoint of the build
+  void save(FILE *fp) const {
+    for (int config = 0; config < num_configs(); config++) {
+      if (skipped(config))
+        continue;
+      fwrite(unc_2D[config].data(), sizeof(int), unc_2D[config].size(), fp);
+      for (int c = 0; c < num_cols(); c++)
+        fwrite(con_2D[c][config].data(), sizeof(int), con_2D[c][config].size(), fp);
     }
   }
 
-  // write sketches into different files
-  void serialize(const char *dir) {
-    string fn(dir);
-    fn += "/";
+  // the counts save() wrote, in place of building the table; false if the
+  // file ends first
+  bool load(FILE *fp) {
+    for (int config = 0; config < num_configs(); config++) {
+      if (skipped(config))
+        continue;
+      clear(config);
+      size_t n = config_size(config);
+      if (fread(unc_2D[config].data(), sizeof(int), n, fp) != n)
+        return false;
+      for (int c = 0; c < num_cols(); c++)
+        if (fread(con_2D[c][config].data(), sizeof(int), n, fp) != n)
+          return false;
+    }
+    return true;
+  }
+
+  // appends the directory entries and counts of this table's sketches to
+  // an archive, see write(); with sparse, those under half non-zero are
+  // written sparse
+  void append(vector<int> &entries, vector<int> &counts, bool sparse) const {
+    auto add = [&](int active_col, int hs0, int hs1, const vector<int> &c) {
+      int entry[ARCHIVE_ENTRY] = {t, active_col, 0, 1, 1, -1, -1,
+                                  (int)counts.size(), -1};
+      if (hs0 > 1 && hs1 > 1) {
+        entry[2] = 2;
+        entry[3] = hs0, entry[4] = hs1, entry[5] = 0, entry[6] = 1;
+      } else if (hs0 > 1) {
+        entry[2] = 1;
+        entry[3] = hs0, entry[5] = 0;
+      } else if (hs1 > 1) {
+        entry[2] = 1;
+        entry[3] = hs1, entry[5] = 1;
+      }
+      size_t nnz = c.size() - std::count(c.begin(), c.end(), 0);
+      if (sparse && 2 * nnz < c.size()) {
+        entry[8] = nnz;
+        for (size_t b = 0; b < c.size(); b++)
+          if (c[b] != 0)
+            counts.push_back(b);
+        for (int x : c)
+          if (x != 0)
+            counts.push_back(x);
+      } else {
+        counts.insert(counts.end(), c.begin(), c.end());
+      }
+      entries.insert(entries.end(), entry, entry + ARCHIVE_ENTRY);
+    };
 
     if (t < g->base_) {
       for (int a = 0; a < num_hash; a++) {
@@ -522,102 +702,152 @@ public:
           int hs0 = h_sizes[a];
           int hs1 = h_sizes[b];
 
-          if ((hs0 - 1) * (hs1 - 1) > buckets)
+          if (skipped(a * num_hash + b))
             continue;
 
-          // unc
-          string name(fn);
-          if (hs0 > 1 && hs1 > 1)
-            name += "2d_" + to_string(t) + "_-1_" + to_string(hs0) + "_" +
-                    to_string(hs1) + "_0_1_.txt";
-          else if (hs0 > 1 && hs1 == 1)
-            name += "1d_" + to_string(t) + "_-1_" + to_string(hs0) + "_0_.txt";
-          else if (hs0 == 1 && hs1 > 1)
-            name += "1d_" + to_string(t) + "_-1_" + to_string(hs1) + "_1_.txt";
-          else
-            name += "0d_" + to_string(t) + "_-1_.txt";
-          // cout << "serializing a sketch to " << name << endl;
-          ofstream out(name.c_str());
-
-          vector<int> &unc = unc_2D[a * num_hash + b];
-          for (int h0 = 0; h0 < hs0; h0++) {
-            for (int h1 = 0; h1 < hs1; h1++) {
-              out << unc[h0 * hs1 + h1] << endl;
-            }
-          }
-          out.close();
-
-          // con
-          for (int active_col = 0; active_col <= 1; active_col++) {
-            string name(fn);
-            if (hs0 > 1 && hs1 > 1)
-              name += "2d_" + to_string(t) + "_" + to_string(active_col) + "_" +
-                      to_string(hs0) + "_" + to_string(hs1) + "_0_1_.txt";
-            else if (hs0 > 1 && hs1 == 1)
-              name += "1d_" + to_string(t) + "_" + to_string(active_col) + "_" +
-                      to_string(hs0) + "_0_.txt";
-            else if (hs0 == 1 && hs1 > 1)
-              name += "1d_" + to_string(t) + "_" + to_string(active_col) + "_" +
-                      to_string(hs1) + "_1_.txt";
-            else
-              name +=
-                  "0d_" + to_string(t) + "_" + to_string(active_col) + "_.txt";
-            // cout << "serializing a sketch to " << name << endl;
-            ofstream out(name.c_str());
-
-            vector<int> &con = con_2D[active_col][a * num_hash + b];
-            for (int h0 = 0; h0 < hs0; h0++) {
-              for (int h1 = 0; h1 < hs1; h1++) {
-                out << con[h0 * hs1 + h1] << endl;
-              }
-            }
-            out.close();
-          }
+          add(-1, hs0, hs1, unc_2D[a * num_hash + b]);
+          for (int active_col = 0; active_col <= 1; active_col++)
+            add(active_col, hs0, hs1, con_2D[active_col][a * num_hash + b]);
         }
       }
     } else {
       for (int a = 0; a < num_hash; a++) {
-        int hs = h_sizes[a];
+        add(-1, h_sizes[a], 1, unc_2D[a]);
+        add(0, h_sizes[a], 1, con_2D[0][a]);
+      }
+    }
+  }
 
-        // unc
-        string name(fn);
-        if (hs > 1)
-          name += "1d_" + to_string(t) + "_-1_" + to_string(hs) + "_0_.txt";
-        else
-          name += "0d_" + to_string(t) + "_-1_.txt";
-        // cout << "serializing a sketch to " << name << endl;
-        ofstream out(name.c_str());
+  // sketch archive: ARCHIVE_MAGIC, ARCHIVE_VERSION, n, then n entries of
+  // (t, active_col, dimensions, hash sizes[2], join cols[2], offset into
+  // the counts, nnz), then the counts of every sketch: row-major, or if nnz
+  // >= 0 the ascending ids of its nnz non-zero buckets then their counts;
+  // all ints. Version 1 entries have no nnz, every sketch being row-major.
+  static const int ARCHIVE_MAGIC = 0x4b534253; // "SBSK"
+  static const int ARCHIVE_VERSION = 2;
+  static const int ARCHIVE_ENTRY = 9;
+
+  // GCARE_BSK_SPARSE=1 writes the sketches that are mostly zero sparse
+  static void write(const char *fn, const vector<OfflineSketch *> &sketches) {
+    const char *env = getenv("GCARE_BSK_SPARSE");
+    bool sparse = env != nullptr && atoi(env) == 1;
+    int n = sketches.size();
+    vector<vector<int>> entries(n), counts(n);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < n; i++)
+      sketches[i]->append(entries[i], counts[i], sparse);
+
+    int header[3] = {ARCHIVE_MAGIC, ARCHIVE_VERSION, 0};
+    int offset = 0;
+    for (int i = 0; i < n; i++) {
+      header[2] += entries[i].size() / ARCHIVE_ENTRY;
+      for (size_t e = 0; e < entries[i].size(); e += ARCHIVE_ENTRY)
+        entries[i][e + 7] += offset;
+      offset += counts[i].size();
+    }
+    FILE *fp = fopen(fn, "wb");
+    if (fp == nullptr) {
+      fprintf(stderr, "cannot write %s\n", fn);
+      exit(EXIT_FAILURE);
+    }
+    fwrite(header, sizeof(int), 3, fp);
+    for (auto &e : entries)
+      fwrite(e.data(), sizeof(int), e.size(), fp);
+    for (auto &c : counts)
+      fwrite(c.data(), sizeof(int), c.size(), fp);
+    fclose(fp);
+  }
 
-        vector<int> &unc = unc_2D[a];
-        for (int h = 0; h < hs; h++) {
-          out << unc[h] << endl;
-        }
-        out.close();
-
-        // con
-        for (int active_col = 0; active_col <= 0; active_col++) {
-          string name(fn);
-          if (hs > 1)
-            name += "1d_" + to_string(t) + "_" + to_string(active_col) + "_" +
-                    to_string(hs) + "_0_.txt";
-          else
-            name +=
-                "0d_" + to_string(t) + "_" + to_string(active_col) + "_.txt";
-          // cout << "serializing a sketch to " << name << endl;
-          ofstream out(name.c_str());
-
-          vector<int> &con = con_2D[active_col][a];
-          for (int h = 0; h < hs; h++) {
-            out << con[h] << endl;
-          }
-          out.close();
-        }
+  // the entries of an archive of size ints by table, entries[t] those of
+  // table t, and the largest hash size of its one-dimensional sketches, the
+  // counts left untouched; returns false if it is not one
+  static bool index(const int *archive, size_t size,
+                    vector<vector<int>> &entries, int &max_buckets) {
+    entries.clear();
+    max_buckets = 0;
+    if (size < 3 || archive[0] != ARCHIVE_MAGIC ||
+        (archive[1] != 1 && archive[1] != ARCHIVE_VERSION))
+      return false;
+    size_t n = archive[2];
+    size_t entry_ints = archive[1] == 1 ? 8 : ARCHIVE_ENTRY;
+    const int *counts = archive + 3 + n * entry_ints;
+    if (3 + n * entry_ints > size)
+      return false;
+    for (size_t i = 0; i < n; i++) {
+      const int *e = archive + 3 + i * entry_ints;
+      int nnz = entry_ints > 8 ? e[8] : -1;
+      int t = e[0], dims = e[2];
+      if (t < 0 || dims < 0 || dims > 2)
+        return false;
+      const int *data = counts + e[7];
+      if (data + (nnz >= 0 ? 2 * nnz : dims == 2 ? e[3] * e[4] : e[3]) >
+          archive + size)
+        return false;
+      if ((size_t)t >= entries.size())
+        entries.resize(t + 1);
+      entries[t].push_back(i);
+      if (dims == 1)
+        max_buckets = std::max(max_buckets, e[3]);
+    }
+    return true;
+  }
+
+  // sketches viewing the counts of the entries of an archive index() took,
+  // which must stay mapped while they are in use; with prefault, their
+  // counts are read in at once (see PrefaultRange)
+  static void attach(const int *archive, const vector<int> &entries,
+                     SketchMap &sketch_map, DataGraph *g, bool prefault) {
+    size_t n = archive[2];
+    size_t entry_ints = archive[1] == 1 ? 8 : ARCHIVE_ENTRY;
+    const int *counts = archive + 3 + n * entry_ints;
+    sketch_map.reserve(sketch_map.size() + entries.size());
+    for (int i : entries) {
+      const int *e = archive + 3 + i * entry_ints;
+      int nnz = entry_ints > 8 ? e[8] : -1;
+      int t = e[0], active_col = e[1], dims = e[2];
+      vector<int> join_cols, hash_sizes, bounds, bound_cols;
+      for (int d = 0; d < dims; d++) {
+        hash_sizes.push_back(e[3 + d]);
+        join_cols.push_back(e[5 + d]);
+      }
+      if (dims == 0)
+        hash_sizes.push_back(1);
+      const int *data = counts + e[7];
+      if (prefault)
+        PrefaultRange(data, (nnz >= 0 ? 2 * nnz : dims == 2 ? e[3] * e[4] : e[3]) * sizeof(int));
+
+      Sketch *s;
+      if (dims == 0) {
+        if (active_col == -1)
+          s = new ZeroDimensionalSketchUnc(t, active_col, join_cols, hash_sizes,
+                                           bounds, bound_cols, g, "", data);
+        else
+          s = new ZeroDimensionalSketchCon(t, active_col, join_cols, hash_sizes,
+                                           bounds, bound_cols, g, "", data);
+      } else if (dims == 1) {
+        if (active_col == -1)
+          s = new OneDimensionalSketchUnc(t, active_col, join_cols, hash_sizes,
+                                          bounds, bound_cols, g, "", data);
+        else
+          s = new OneDimensionalSketchCon(t, active_col, join_cols, hash_sizes,
+                                          bounds, bound_cols, g, "", data);
+      } else {
+        if (active_col == -1)
+          s = new TwoDimensionalSketchUnc(t, active_col, join_cols, hash_sizes,
+                                          bounds, bound_cols, g, "", data);
+        else
+          s = new TwoDimensionalSketchCon(t, active_col, join_cols, hash_sizes,
+                                          bounds, bound_cols, g, "", data);
       }
+      if (nnz >= 0)
+        s->setSparse(data, data + nnz, nnz);
+      sketch_map[SketchKey(t, active_col, hash_sizes, join_cols)] = s;
     }
   }
 
+  // a directory of text sketches written by earlier versions
   static void deserialize(const char *dir,
-                          unordered_map<string, Sketch *> &sketch_map,
+                          SketchMap &sketch_map,
                           DataGraph *g) {
     namespace fs = std::filesystem;
     for (auto &dir_entry : fs::recursive_directory_iterator(dir)) {
@@ -667,28 +897,11 @@ public:
         continue;
       }
 
-      string probe;
-      probe.append(to_string(t));
-      probe.append("[");
-      probe.append(to_string(active_col));
-      probe.append("][");
-      for (int h : hash_sizes) {
-        probe.append(to_string(h));
-        probe.append(", ");
-      }
-      probe.append("][");
-      for (int c : join_cols) {
-        probe.append(to_string(c));
-        probe.append(", ");
-      }
-      probe.append("][");
-      probe.append("]");
-
-      // cout << "deserializing to " << probe << endl;
-
-      sketch_map[probe] = s;
+      sketch_map[SketchKey(t, active_col, hash_sizes, join_cols)] = s;
     }
   }
 };
 
+}  // namespace relational
+
 #endif
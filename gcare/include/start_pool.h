@@ -0,0 +1,57 @@
+#ifndef START_POOL_H_
+#define START_POOL_H_
+
+#include <cstdint>
+#include <memory>
+#include "data_graph.h"
+
+namespace graph {
+
+// Start tuples of walks shared by the sampling estimators (GCARE_START_POOL=1,
+// WanderJoin and JSUB): a stream of uniform draws of the edges of an edge
+// label, or the vertices of a vertex label, is drawn once into the pool and
+// read by every estimator that opens it. The streams are named by the
+// estimator's seed and the query node the walks start from, so the
+// iterations of different methods with the same seed start from the same
+// tuples (common random numbers, which sharpen comparisons between them)
+// and the draws, with their label lookups, are made once. A stream is
+// uniform over its label, so 1/P of a draw stays the label's size; each
+// reader checks its own bound vertices on it. The pool is process-wide and
+// dropped whole once it holds MAX_DRAWS, the open streams keeping theirs.
+class StartPool {
+public:
+	// the draws of a stream, see start_pool.cc
+	struct Draws;
+	static const size_t CHUNK = 4096;
+	static const size_t MAX_DRAWS = 1 << 24;
+
+	// reads a stream from its first draw on
+	class Stream {
+	public:
+		Stream() : pos_(0), chunk_(nullptr) {}
+		// whether Open gave it a stream
+		bool IsOpen() const { return draws_ != nullptr; }
+		// the next draw into t (t[1] = t[0] for a vertex); false if the
+		// label has none
+		bool Next(int* t);
+
+	private:
+		friend class StartPool;
+		std::shared_ptr<Draws> draws_;
+		size_t pos_;
+		const int* chunk_; //the chunk of pos_, CHUNK pairs
+	};
+
+	// stream number stream of the edges (edge) or vertices of label in g
+	static Stream Open(DataGraph& g, bool edge, int label, uint64_t stream);
+	// the stream of an estimator seeded with seed, starting at query node
+	static uint64_t StreamOf(uint64_t seed, int node) {
+		return seed * 0x9e3779b97f4a7c15ull ^ (uint64_t)(uint32_t)node;
+	}
+	// whether GCARE_START_POOL=1 asks for the pool
+	static bool Enabled();
+};
+
+}  // namespace graph
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef START_STRATA_H_
+#define START_STRATA_H_
+
+#include <cstdint>
+#include <vector>
+#include "data_graph.h"
+#include "mmap_file.h"
+#include "rng.h"
+
+namespace graph {
+
+// Degree strata of the edges of every edge label, for drawing the start
+// tuple of a walk by importance instead of uniformly: an edge (s, d) falls
+// in stratum floor(log2(deg(s) * deg(d))) (total degrees), and stratum h
+// is drawn with probability
+//   1/2 * n_h / n + 1/2 * n_h * 2^(h/2) / sum_k n_k * 2^(k/2),
+// the uniform half bounding the variance by twice that of uniform draws.
+// Inside a stratum edges are drawn uniformly, so 1/P(edge) = n_h / P(h).
+//
+// Summary layout (ints): MAGIC, VERSION, number of labels, then per label
+// the number of strata S, S (stratum, n_h) pairs and the n edge indices
+// grouped by stratum.
+class StartStrata {
+public:
+	static const int MAGIC = 0x54525453; //"STRT"
+	static const int VERSION = 1;
+
+	StartStrata() : summary_(nullptr), summary_size_(0) {}
+	~StartStrata() { UnloadFile(summary_, summary_size_, LOAD_MMAP); }
+
+	void Build(DataGraph&);
+	void Write(const char*);
+	//false, and no strata, if there is no summary at fn
+	bool Read(const char*);
+	bool Empty() const { return labels_.empty(); }
+
+	//an edge of el into t, drawn by stratum; returns 1/P(t), 0 if el has
+	//no edges
+	double Sample(DataGraph&, int, Rng&, int*);
+
+private:
+	struct Label {
+		int num_strata;
+		const int* strata;     //(stratum, n_h) pairs
+		const int* edges;      //edge indices grouped by stratum
+		vector<double> cum;    //cumulative P(h)
+		vector<int> begin;     //first index in edges per stratum
+	};
+	void attach(const int*, const int*);
+
+	vector<Label> labels_;
+	vector<int> built_;   //build mode: the summary body
+	char* summary_;
+	size_t summary_size_;
+};
+
+}  // namespace graph
+
+#endif
@@ -11,12 +11,19 @@
 #include "data_graph.h"
 #include "util.h"
 #include "graph_op.h"
+#include "memo_table.h"
+
+namespace graph {
 
 class SumRDF : public Estimator {
 public:
+  SumRDF() : summary_(nullptr), summary_size_(0) {}
+  ~SumRDF() { UnloadFile(summary_, summary_size_, LOAD_MMAP); }
+
 	//build mode
 	void PrepareSummaryStructure(DataGraph&, double); 
 	void WriteSummary(const char*); 
+	bool UpdateSummary(DataGraph&, const char*, const char*);
 	
 	//query mode
 	void Init();
@@ -26,16 +33,40 @@ public:
 	double EstCard(int);
 	double AggCard();
 	double GetSelectivity();
+	string SubqueryKey(int);
+	unsigned DataSections() { return 0; }
 
 private:
+  // C, O and I of a resource or bucket as sorted label lists, compared and
+  // hashed in place for grouping
   class Type {
   public:
-    set<int> classes_;
-    set<int> outgoing_;
-    set<int> incoming_;
+    vector<int> classes_;
+    vector<int> outgoing_;
+    vector<int> incoming_;
     Type();
-    string ToString();
-    string ToStringByClass();
+    // adds label x to the sorted list s
+    static void Insert(vector<int>& s, int x) {
+      auto it = std::lower_bound(s.begin(), s.end(), x);
+      if (it == s.end() || *it != x) s.insert(it, x);
+    }
+    // sorts the lists filled by push_back and drops duplicates
+    void Normalize();
+    bool operator==(const Type& o) const {
+      return classes_ == o.classes_ && outgoing_ == o.outgoing_ && incoming_ == o.incoming_;
+    }
+    size_t Hash() const;
+    size_t ClassHash() const { return boost::hash_range(classes_.begin(), classes_.end()); }
+  };
+  struct TypeHasher {
+    size_t operator()(const Type& t) const { return t.Hash(); }
+  };
+  // types equal in their classes only
+  struct ClassHasher {
+    size_t operator()(const Type& t) const { return t.ClassHash(); }
+  };
+  struct ClassEqual {
+    bool operator()(const Type& a, const Type& b) const { return a.classes_ == b.classes_; }
   };
   class Resource {
    public:
@@ -76,8 +107,23 @@ private:
     void ComputeQuery(QueryGraph&);
     bool IsContained(vector<int>&, vector<int>&);
   };
+  static const int SUMRDF_MAGIC = 0x46445253; // "SRDF"
+  static const int SUMRDF_VERSION = 1;
+  // checkpoint of the merge rounds of CreateSummary: CHECKPOINT_MAGIC,
+  // CHECKPOINT_VERSION, #buckets and multiplicity of the typed summary,
+  // target_ and threshold_ it was merged for, the rounds done, the
+  // multiplicity before the last, then mu_ and the erased buckets
+  static const int CHECKPOINT_MAGIC = 0x4b434453; // "SDCK"
+  static const int CHECKPOINT_VERSION = 1;
+
   Summary sm_;
+  // query mode: the summary graph, weights and bucket resources point into
+  // summary_ (or into the vectors below for text summaries)
+  char* summary_;
+  size_t summary_size_;
   DataGraph s_;
+  const int* s_w1_;
+  const int* s_w2_;
   vector<Edge> s_edges_;
   vector<Resource> g_resources_, q_resources_;
   vector<Bucket> s_buckets_;
@@ -87,21 +133,42 @@ private:
   int scheme_rows_, scheme_cols_;
   double threshold_;
   int n_, m_;
-  vector<vector<int>> a_, b_;
+  vector<int> a_, b_; // MinHash scheme, [row * scheme_cols_ + col]
   vector<vector<int>> bucket_lst_;
-  vector<int> signatures_;
+  vector<vector<int>> signatures_; // per thread: [type_idx][row][col]
+
+  // An embedding of q in the summary and the scratch state of evaluating
+  // it; there is one per thread evaluating embeddings
+  struct Evaluation {
+    vector<int> tau_; // query vertex -> bucket
+    vector<int> edges_; // query edge -> summary edge
+    vector<int> query_image_;
+    vector<double> minimal_; // MinimalSolutions per partition for tau_
+    vector<char> unifiable_; // IsTauUnifiable per partition for tau_
+    vector<char> chk_; // per query vertex, in Solutions()
+    MemoTable atom_factors_; // (summary edge, multiplicity) -> AtomFactor
+  };
+  static const int BATCH_PER_THREAD = 16;
 
-  vector<int> tau_;
   vector<vector<int>> iterators_;
   vector<Partition> partitions_;
-  vector<int> query_image_;
-  vector<int> edges_, w1_, w2_;
+  vector<int> partition_order_; // partitions_ by # blocks, ascending
+  vector<Evaluation> evals_; // per thread
+  // embeddings are enumerated a batch at a time and evaluated in parallel;
+  // GetSubstructure() and EstCard() then step through the batch
+  vector<vector<int>> batch_tau_, batch_edges_;
+  vector<double> batch_card_;
+  size_t batch_size_, batch_pos_;
+  bool exhausted_; // smo_ has no more embeddings
+  int num_threads_;
+  vector<int> w1_, w2_;
   int pos_;
   double result_;
   bool is_init_;
   SubgraphMatching smo_;
+  vector<int> bucket_of_; // resource -> bucket, -1 if in none
+  vector<vector<signed char>> fits_; // [query vertex][bucket]: Includes, -1 unknown
   vector<vector<int>> blocks_;
-  bool *solution_chk;
 
   void AddEdgeToSummary(int, int, int, unordered_map<int, unordered_map<int, unordered_map<int, int>>>&);
   void AddEdgeToSummary(int, int, int, unordered_set<Edge,EdgeHasher> &);
@@ -110,41 +177,73 @@ private:
   void CreateSummary(DataGraph&, double);
   void MakeBucketListByType();
   void MakeBucketList();
-  void CalcSignatureSize();
-  void CreateSignature(int);
-  void UpdateSignature(int, int, int);
-  double Similarity(int, int);
-  int SchemeHash(int, int, int, int);
+  void CalcSignatureSize(int);
+  void CreateSignature(int, vector<int>&, int);
+  double Similarity(int, int, const vector<int>&);
+  void MergeBucketList(int, vector<int>&, vector<char>&, vector<std::pair<int, int>>&, vector<int>&, int);
+  void UpdateSummaryEdges(const vector<int>&);
+  void ValueSignature(const vector<int>&, int*);
+  void WriteMergeState(FILE*, const vector<char>&, int, int);
+  bool ReadMergeState(FILE*, vector<char>&, int&, int&);
+  // the value hashed by the MinHash scheme for neighbour (x, y), in
+  // wrapping 32-bit arithmetic
+  static int SchemeValue(int x, int y) {
+    return (int) (((unsigned) x * 127 + (unsigned) y) * 31);
+  }
   int BinHash(int);
-  void ShallowMerge(int, int);
+  int ShallowMerge(int, int);
   void CreateBasePartition();
   void ComputePartitions();
   void TrivialPartition(vector<int>&);
   int FindIncrementable(vector<int>&, vector<int>&);
   int FindDecrementable(vector<int>&);
   bool Includes(Type&, Type&);
-  void Evaluate(int);
-  double QueryFactor(Partition&);
-  double MinimalSolutions(Partition&i);
-  double Solutions(Partition&);
-  double AtomFactor(Partition&, int);
-  int GetWeight(Partition&, int);
+  bool Evaluate(Evaluation&, double&);
+  double QueryFactor(Evaluation&, Partition&);
+  double MinimalSolutions(Evaluation&, Partition&);
+  double Solutions(Evaluation&, Partition&);
+  double AtomFactor(Evaluation&, Partition&, int);
+  int GetWeight(Evaluation&, Partition&, int);
   bool IsUnifiable(Partition&, vector<int>&, int);
   void ReplaceGamma(Partition&, int, int);
   void WriteSummaryFile(const char*); 
+  void ReadTextSummary(const char*);
+  void SetSummaryEdges();
+  void SetBucketOf(int v, int b) {
+    if (v >= (int) bucket_of_.size()) bucket_of_.resize(v + 1, -1);
+    bucket_of_[v] = b;
+  }
+  // the bucket of a bound resource: -1 for an unbound vertex (v == -1), -2
+  // if v is in no bucket
+  int BucketOf(int v) {
+    if (v == -1) return -1;
+    if (v < 0 || v >= (int) bucket_of_.size() || bucket_of_[v] < 0) return -2;
+    return bucket_of_[v];
+  }
   size_t DataGraphSize(DataGraph&);
   size_t SummaryGraphSize(DataGraph&);
   int Find(int v) {
-    return mu_[v] == v ? v : Find(mu_[v]);
+    int root = v;
+    while (mu_[root] != root) root = mu_[root];
+    while (mu_[v] != root) {
+      int next = mu_[v];
+      mu_[v] = root;
+      v = next;
+    }
+    return root;
   }
-  void Union(int v1, int v2) {
+  // returns the root that was merged away, or -1
+  int Union(int v1, int v2) {
     v1 = Find(v1);
     v2 = Find(v2);
-    if (v1 == v2) return;
+    if (v1 == v2) return -1;
     if (mu_[v1] > mu_[v2]) std::swap(v1, v2);
     mu_[v2] = v1;
+    return v2;
   }
 };
 
+}  // namespace graph
+
 #endif
 
@@ -0,0 +1,132 @@
+#ifndef TABLE_VIEW_H_
+#define TABLE_VIEW_H_
+
+#include <cstddef>
+
+#include "packed_column.h"
+
+// Read-only views over the nested int layout Make1DTable and Make1DIndex
+// write. A level of n lists is n ints, entry i holding the offset from
+// itself to the start of list i; list i ends where list i + 1 starts, so
+// each level is followed by an end entry or by the next level, whose first
+// entry points to where this level's lists end. Header-only and inline, so
+// an access like table_[t][i][c] compiles down to a few adjacent loads.
+template <int Depth>
+class NestedView {
+ public:
+  constexpr NestedView() : array_(nullptr), size_(0) {}
+  constexpr NestedView(const int* array, size_t size) : array_(array), size_(size) {}
+
+  NestedView<Depth - 1> operator[](size_t i) const {
+    return NestedView<Depth - 1>(array_ + i + array_[i], array_[i + 1] - array_[i] + 1);
+  }
+  constexpr size_t size() const { return size_; }
+
+ private:
+  const int* array_;
+  size_t size_;
+};
+
+template <>
+class NestedView<1> {
+ public:
+  constexpr NestedView() : array_(nullptr), size_(0) {}
+  constexpr NestedView(const int* array, size_t size) : array_(array), size_(size) {}
+
+  constexpr int operator[](size_t i) const { return array_[i]; }
+  constexpr size_t size() const { return size_; }
+  constexpr const int* begin() const { return array_; }
+  constexpr const int* end() const { return array_ + size_; }
+
+ private:
+  const int* array_;
+  size_t size_;
+};
+
+// One table: size() rows of width() ints each. Make1DTable writes the rows
+// of a table back to back, so row i is found by stride, not by its entry.
+class RowsView {
+ public:
+  constexpr RowsView() : data_(nullptr), size_(0), width_(0) {}
+  constexpr RowsView(const int* data, size_t size, size_t width)
+      : data_(data), size_(size), width_(width) {}
+
+  constexpr const int* operator[](size_t i) const { return data_ + i * width_; }
+  constexpr size_t size() const { return size_; }
+  constexpr size_t width() const { return width_; }
+  constexpr const int* begin() const { return data_; }
+  constexpr const int* end() const { return data_ + size_ * width_; }
+
+ private:
+  const int* data_;
+  size_t size_, width_;
+};
+
+// table -> row -> column
+class TableView {
+ public:
+  constexpr TableView() {}
+  constexpr TableView(const int* array, size_t size) : tables_(array, size) {}
+
+  RowsView operator[](size_t t) const {
+    NestedView<2> rows = tables_[t];
+    if (rows.size() == 0) return RowsView();
+    NestedView<1> first = rows[0];
+    return RowsView(first.begin(), rows.size(), first.size());
+  }
+  constexpr size_t size() const { return tables_.size(); }
+
+ private:
+  NestedView<3> tables_;
+};
+
+// One table, whichever way the binary is held: row-major in a RowsView or
+// packed column by column (see DataGraph::SetPacked). Row(i, buf) points
+// at row i, decoding it into buf, room for width() ints, if packed; scans
+// of a column go through ReadColumn, which unpacks whole blocks.
+class TableReader {
+ public:
+  TableReader() : packed_(false), width_(0) {}
+  explicit TableReader(RowsView rows) : rows_(rows), packed_(false), width_(rows.width()) {}
+  TableReader(const PackedColumn* columns, size_t width) : packed_(true), width_(width) {
+    for (size_t c = 0; c < width && c < 2; c++) columns_[c] = columns[c];
+  }
+
+  size_t size() const { return packed_ ? columns_[0].size() : rows_.size(); }
+  size_t width() const { return width_; }
+  bool packed() const { return packed_; }
+
+  const int* Row(size_t i, int* buf) const {
+    if (!packed_) return rows_[i];
+    for (size_t c = 0; c < width_; c++) buf[c] = columns_[c][i];
+    return buf;
+  }
+  int Value(size_t i, size_t c) const { return packed_ ? columns_[c][i] : rows_[i][c]; }
+  // out[0, end - begin) = column c of rows [begin, end)
+  void ReadColumn(size_t c, size_t begin, size_t end, int* out) const {
+    if (packed_) {
+      columns_[c].Decode(begin, end, out);
+      return;
+    }
+    for (size_t i = begin; i < end; i++) *out++ = rows_[i][c];
+  }
+
+ private:
+  RowsView rows_;
+  PackedColumn columns_[2]; // tables are at most 2 wide
+  bool packed_;
+  size_t width_;
+};
+
+// table -> column -> the column's values, row by row (see
+// DataGraph::Column)
+typedef NestedView<3> ColumnsView;
+// table -> column -> value ordinal -> ascending row ids
+typedef NestedView<4> IndexView;
+// table -> column -> the column packed (PackedColumn); of the packed index,
+// the column's value offsets packed and then its rows
+typedef NestedView<3> PackedView;
+// value -> (table, column, value ordinal) triples, see DataGraph::Mapping
+typedef NestedView<2> MapView;
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The requests a server (-S) served, recorded with --record so that the
+// same traffic can be replayed against another build with --replay. A trace
+// is the magic "GCTRACE1" followed by one record per request: its kind
+// byte, then as LEB128 varints the microseconds since the previous record,
+// the zigzagged seed and the lengths of the method and the text, then the
+// ratio as a raw double and the method and text bytes. A query's text is
+// its "v"/"e" lines joined by newlines, an edge update's "SRC DST EL".
+struct TraceRecord {
+  enum Kind : uint8_t { QUERY = 0, INSERT = 1, DELETE = 2 };
+  Kind kind;
+  uint64_t micros; // since the first record
+  int seed;
+  double ratio;
+  std::string method; // empty for updates
+  std::string text;
+};
+
+class TraceWriter {
+public:
+  ~TraceWriter() {
+    if (fp_ != nullptr)
+      fclose(fp_);
+  }
+
+  // false, reported on stderr, if path cannot be written
+  bool Open(const char *path) {
+    fp_ = fopen(path, "wb");
+    if (fp_ == nullptr) {
+      perror(path);
+      return false;
+    }
+    fwrite(MAGIC, 1, 8, fp_);
+    return true;
+  }
+
+  // records a request arriving now; flushed, so a killed server leaves a
+  // whole trace
+  void Append(TraceRecord::Kind kind, const std::string &method, double ratio,
+              int seed, const std::string &text) {
+    auto now = std::chrono::steady_clock::now();
+    if (!started_) {
+      last_ = now;
+      started_ = true;
+    }
+    uint64_t delta =
+        std::chrono::duration_cast<std::chrono::microseconds>(now - last_)
+            .count();
+    last_ = now;
+    std::string buf(1, (char)kind);
+    PutVarint(buf, delta);
+    PutVarint(buf, ((uint64_t)(int64_t)seed << 1) ^ (uint64_t)((int64_t)seed >> 63));
+    PutVarint(buf, method.size());
+    PutVarint(buf, text.size());
+    buf.append((const char *)&ratio, sizeof(ratio));
+    buf += method;
+    buf += text;
+    fwrite(buf.data(), 1, buf.size(), fp_);
+    fflush(fp_);
+  }
+
+  static constexpr const char *MAGIC = "GCTRACE1";
+
+private:
+  static void PutVarint(std::string &buf, uint64_t x) {
+    while (x >= 0x80) {
+      buf += (char)(x | 0x80);
+      x >>= 7;
+    }
+    buf += (char)x;
+  }
+
+  FILE *fp_ = nullptr;
+  bool started_ = false;
+  std::chrono::steady_clock::time_point last_;
+};
+
+// false, reported on stderr, if path is not a whole trace
+inline bool ReadTrace(const char *path, std::vector<TraceRecord> &records) {
+  records.clear();
+  FILE *fp = fopen(path, "rb");
+  if (fp == nullptr) {
+    perror(path);
+    return false;
+  }
+  std::string data;
+  char chunk[1 << 16];
+  for (size_t n; (n = fread(chunk, 1, sizeof(chunk), fp)) > 0;)
+    data.append(chunk, n);
+  fclose(fp);
+  const char *p = data.data(), *end = p + data.size();
+  bool ok = data.size() >= 8 && memcmp(p, TraceWriter::MAGIC, 8) == 0;
+  p += 8;
+  auto varint = [&p, end, &ok]() {
+    uint64_t x = 0;
+    for (int shift = 0; ok; shift += 7) {
+      if (p == end || shift > 63) {
+        ok = false;
+        break;
+      }
+      uint8_t b = *p++;
+      x |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        break;
+    }
+    return x;
+  };
+  uint64_t micros = 0;
+  while (ok && p < end) {
+    TraceRecord r;
+    r.kind = (TraceRecord::Kind)*p++;
+    micros += varint();
+    r.micros = micros;
+    uint64_t seed = varint();
+    r.seed = (int)(int64_t)((seed >> 1) ^ -(seed & 1));
+    uint64_t method_size = varint(), text_size = varint();
+    if (!ok || r.kind > TraceRecord::DELETE ||
+        (uint64_t)(end - p) < sizeof(double) + method_size + text_size) {
+      ok = false;
+      break;
+    }
+    memcpy(&r.ratio, p, sizeof(double));
+    p += sizeof(double);
+    r.method.assign(p, method_size);
+    p += method_size;
+    r.text.assign(p, text_size);
+    p += text_size;
+    records.push_back(std::move(r));
+  }
+  if (!ok)
+    fprintf(stderr, "%s is not a gcare trace\n", path);
+  return ok;
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef UTIL_H_
 #define UTIL_H_
 
+#include <algorithm>
 #include <boost/functional/hash.hpp>
 #include <string>
 #include <vector>
@@ -85,6 +86,29 @@ struct Edge {
 	}
 };
 
+// Input label -> label of a graph built on a label projection (see
+// DataGraph::SetLabelProjection); a label the projection dropped goes to
+// none, a label without data. Empty: labels are unchanged.
+struct LabelMap {
+	vector<int> to; //input label -> label, -1 if dropped
+	int none = -1;
+
+	bool empty() const { return to.empty(); }
+	int operator()(int l) const {
+		if (to.empty() || l < 0) return l;
+		return l < (int)to.size() && to[l] >= 0 ? to[l] : none;
+	}
+	//the map of a projection keeping the input labels kept, in order
+	static LabelMap Of(const vector<int>& kept) {
+		LabelMap m;
+		if (kept.empty()) return m;
+		m.to.assign(*max_element(kept.begin(), kept.end()) + 1, -1);
+		for (size_t i = 0; i < kept.size(); i++) m.to[kept[i]] = i;
+		m.none = kept.size();
+		return m;
+	}
+};
+
 struct EdgeHasher {
 	std::size_t operator () (const Edge &key) const 
 	{
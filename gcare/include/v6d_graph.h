@@ -0,0 +1,19 @@
+#ifndef V6D_GRAPH_H_
+#define V6D_GRAPH_H_
+
+#include <cstdint>
+#include "data_graph.h"
+
+namespace graph {
+
+// Builds g in memory from a graph resident in vineyard: the fragments of
+// the ArrowFragmentGroup object_id local to this instance, opened through
+// the glogs v6d store (htap_impl::GraphHandleImpl), with no text or binary
+// files in between. Vertices get dense ids by (fragment, vertex label,
+// offset), the labels are the vineyard label ids, and every outgoing edge
+// of a local inner vertex becomes an edge. Only built with GCARE_V6D.
+void LoadV6dGraph(DataGraph& g, uint64_t object_id);
+
+}  // namespace graph
+
+#endif
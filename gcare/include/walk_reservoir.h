@@ -0,0 +1,76 @@
+#ifndef WALK_RESERVOIR_H_
+#define WALK_RESERVOIR_H_
+
+#include <map>
+#include <vector>
+#include "data_graph.h"
+#include "mmap_file.h"
+#include "rng.h"
+
+namespace graph {
+
+// Reservoirs of completed random walks of the label paths and stars a
+// workload uses most, for WanderJoin to take the first steps of its walks
+// from instead of sampling them online. A pattern is a walk of k edge
+// steps as WanderJoin compiles it: step 0 an edge of its label drawn
+// uniformly, step j > 0 an edge of its label from the vertex in column col
+// of step parent, the earliest step holding it, forward (from the edge's
+// src) if dir. Every step reaches a new vertex, so the pattern is a tree
+// and its walks need no join checks. At build time each pattern gets
+// walks walks on the data, of which a reservoir keeps SIZE successful
+// ones; a draw picks one of the walks uniformly, failing if it failed, so
+// 1/P of a drawn walk is an unbiased estimate as that of a walk made
+// online, only correlated with the other draws of the same reservoir.
+//
+// Summary layout (ints): MAGIC, VERSION, number of patterns, then per
+// pattern its steps k, the 4k ints of its key, (label, dir, parent, col)
+// per step, walks, successes, kept, then per kept walk its 1/P (a double,
+// two ints) and its 2k ints of tuples.
+class WalkReservoir {
+public:
+	static const int MAGIC = 0x56534552; //"RESV"
+	static const int VERSION = 1;
+	static const int MIN_STEPS = 2, MAX_STEPS = 4;
+	static const int SIZE = 1 << 14;
+
+	struct Step {
+		int label, dir, parent, col;
+	};
+
+	WalkReservoir() : summary_(nullptr), summary_size_(0) {}
+	~WalkReservoir() { UnloadFile(summary_, summary_size_, LOAD_MMAP); }
+
+	//the patterns of at least MIN_STEPS of the queries of workload (a
+	//suite, a directory of query files or a file listing them, see
+	//QuerySuite), the num_patterns in most of them, walks walks each;
+	//false, and none, if workload cannot be read
+	bool Build(DataGraph&, const char*, int, int, Rng&);
+	//removes fn if there are no patterns
+	void Write(const char*);
+	//false, and no patterns, if there is no summary at fn
+	bool Read(const char*);
+	bool Empty() const { return patterns_.empty(); }
+
+	//the pattern of steps, -1 if there is none
+	int Find(const vector<Step>&) const;
+	//a walk of pattern into t, 2 ints per step; returns its 1/P, 0 if the
+	//walk drawn failed
+	double Draw(int, Rng&, int*) const;
+
+private:
+	struct Pattern {
+		int steps, walks, successes, kept;
+		const int* walk; //kept walks of 2 + 2 * steps ints
+	};
+	void attach(const int*, const int*);
+
+	vector<Pattern> patterns_;
+	std::map<vector<int>, int> index_; //key -> pattern
+	vector<int> built_;   //build mode: the summary body
+	char* summary_;
+	size_t summary_size_;
+};
+
+}  // namespace graph
+
+#endif
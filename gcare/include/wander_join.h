@@ -1,14 +1,24 @@
 #ifndef WANDER_JOIN_H_
 #define WANDER_JOIN_H_
 
+#include <array>
 #include <random>
 #include "../include/estimator.h"
+#include "../include/candidate_filter.h"
+#include "../include/exact_count.h"
+#include "../include/plan_cache.h"
+#include "../include/start_pool.h"
+#include "../include/start_strata.h"
+#include "../include/walk_reservoir.h"
+
+namespace graph {
 
 class WanderJoin : public Estimator {
 public:
 	//build mode
 	void PrepareSummaryStructure(DataGraph&, double); 
 	void WriteSummary(const char*); 
+	bool FixedSummary() { return true; }
 
 	//query mode
 	void ReadSummary(const char*); 
@@ -17,16 +27,53 @@ public:
 	bool GetSubstructure(int); 
 	double EstCard(int); 
 	double AggCard();
+	double AggVariance();
 	double GetSelectivity();
+	bool EstimatesMean() { return true; }
+	bool SharesPrefixes() { return true; }
+	void PrefixEstimates(unordered_map<uint64_t, double>&);
 	
 private:
 	void generateWalkPlans();
 	void generateWalkPlans(int);
-	bool checkBoundedVertices(int, vector<int>);
-	bool checkLabelStatistics(int);
-	bool checkNonTreeEdges(vector<pair<int, int>>&);
-	int  sampleTuple(int);
-	int  sampleTuple(int, int, int);
+	//one node of a compiled walk plan
+	struct WalkStep {
+		int  node;     //walk node (query edge or labelled query vertex)
+		bool edge;     //label is an edge label, else a vertex label
+		int  label;
+		bool dir;      //edge node: extended from its src (true) or dst
+		int  parent;   //slot of the tuple it extends (-1 for the start)
+		int  col;      //column of the parent tuple holding the join vertex
+		int  bound[2]; //data vertices required in its columns, -1 if free
+		int  vertex[2]; //query vertices of its columns
+	};
+
+	void compileWalkPlans();
+	WalkStep compileStep(int, int, int, bool);
+	bool checkBoundedVertices(const WalkStep&, const int*);
+	bool checkLabelStatistics(const WalkStep&);
+	bool checkNonTreeEdges(int, const int*, size_t);
+	double walk(int, int*, int&);
+	bool drawStart(const WalkStep&, Rng&, int*);
+	bool anchored(const WalkStep&);
+	double anchorStart(const WalkStep&, Rng&, int*);
+	bool boundNode(int);
+	double walkStart(const WalkStep&, int*, int&);
+	void matchReservoir();
+	double walkPrefix(int, int*, int&, int&);
+	double extend(int, int*, int, int, int&);
+	double walkTree(int, int*, int&);
+	bool walkBatch(int);
+	struct Lane;
+	void walkLane(Lane&, Rng&, double*, int);
+	void recordPrefix(Lane&, double*, int, int);
+	void recordTrial(double, int);
+	void loadPlans();
+	bool pilotExact();
+	bool decomposeBidirectional(int);
+	double bidirStart(int, int*);
+	int walkArm(int, int, double&);
+	double walkBidirectional();
 
 	int offset_; //# vertex labels in query
 	bool plans_generated_, plan_chosen_;
@@ -35,22 +82,171 @@ private:
 
 	//each node represents a table in relational model
 	//each edge (with an edge label) and a vertex (with a vertex label) corresponds to a node
-	map<int, int> node_to_v_; //node id to query vertex id
+	std::pmr::map<int, int> node_to_v_; //node id to query vertex id
 	vector<bool> visited_;
 	//(from_[i], to_[i]) is the i'th pair of joinable nodes
 	vector<pair<int, int>> join_from_, join_to_; 
 
 	int pos_;
 	vector<pair<int, int>> counterpart_, plan_;
-	vector<vector<pair<int, int>>> counterparts_, plans_;
-	vector<int> success_cnt_;
-	vector<vector<double>> est_;
-	vector<vector<int>> num_idx_lookup_;
+	//per-query state of this kind lives on the arena (see Estimator::Fresh)
+	std::pmr::vector<std::pmr::vector<pair<int, int>>> counterparts_, plans_;
+
+	//running (Welford) statistics of a plan's trial walks
+	struct PlanStats {
+		long n = 0, success = 0;
+		double mean = 0, m2 = 0, lookups = 0;
+		void Add(double est, int lookup) {
+			n++;
+			success += est != 0;
+			double delta = est - mean;
+			mean += delta / n;
+			m2 += delta * (est - mean);
+			lookups += lookup;
+		}
+		//variance of the estimate times mean index lookups per walk
+		double Cost() const {
+			return m2 / (n - 1) * (lookups / n);
+		}
+	};
+	static const int TRIAL_WALKS = 64;      //walks per plan in the first round
+	static const int MIN_TRIAL_SUCCESS = 2; //to be ranked at all
+	vector<PlanStats> plan_stats_;
+	//the plans, and the choice, of earlier runs (see PlanCache)
+	PlanCache plan_cache_;
+	PlanCache::Mode plan_cache_mode_;
+	string plan_key_;
+	vector<int> active_plans_;
+	int active_pos_;
+	long round_walks_, round_left_;
+
+	//per plan: its steps (start node first) and the join conditions as
+	//(slot1, c1, slot2, c2)
+	std::pmr::vector<std::pmr::vector<WalkStep>> programs_;
+	std::pmr::vector<std::pmr::vector<array<int, 4>>> join_checks_;
 
-	vector<vector<int>> sampled_tuples_;
+	vector<int> walk_tuples_; //[slot][2] of the current walk
 	bool valid_;
 	double inv_prob_;
+
+	//once a plan is chosen, walks run batch_size_ at a time in lock-step
+	//(GCARE_WJ_BATCH, 0 = one walk per call); batch_est_ holds their 1/P
+	int batch_size_, batch_pos_;
+	vector<double> batch_est_;
+	//the walks of a batch in lock-step: with GCARE_WJ_THREADS=n, the batch
+	//is cut into n lanes of consecutive walks, each walked on its own thread
+	//from its own RNG (seeded from rng_ per batch) into its own part of
+	//batch_est_; one lane, on rng_, otherwise. Not with the start pool,
+	//whose streams are drawn in order
+	struct Lane {
+		vector<int> tuples; //[pos][walk][2]
+		vector<int> alive;
+		vector<const int*> pick;
+		vector<int> drawn; //picks of a packed graph, read by value
+		vector<double> prefix_sum; //see prefix_sum_
+		Rng rng;
+	};
+	static const int MIN_LANE_WALKS = 64; //fewer walks are not split
+	int num_threads_;
+	vector<Lane> lanes_;
+
+	//with GCARE_WJ_GPU=1 in a GCARE_GPU build, the batches run on the GPU
+	//(GCARE_WJ_BATCH defaults to GPU_BATCH walks then); not with the
+	//candidate filter or start strata, whose draws are the host's. gpu_plan_
+	//is the chosen plan as GpuSteps
+	static const int GPU_BATCH = 1 << 18;
+	GpuWalker* gpu_;
+	vector<GpuStep> gpu_plan_;
+
+	//with prefixes_on_ (see RunSubpatterns), the batched walks of the
+	//chosen plan also sum, per k, the 1/P of their first k + 1 steps where
+	//those succeed, over prefix_walks_ walks: each prefix is a walk of the
+	//sub-pattern of its steps' nodes. The GPU and one-at-a-time walks do
+	//not record them
+	vector<double> prefix_sum_;
+	long prefix_walks_;
+
+	//tree sampling (GCARE_WJ_BRANCH > 1): a walk shares its first
+	//branch_at_ steps (GCARE_WJ_BRANCH_AT, default 1: the start tuple) among
+	//branch_ independent completions and reports 1/P(prefix) times their
+	//mean, which is unbiased; each completion costs one sample. Walks then
+	//run one at a time
+	int branch_, branch_at_;
+
+	//edge start tuples are drawn by degree stratum when the summary has
+	//strata (GCARE_WJ_STRATA=0 draws uniformly anyway)
+	StartStrata strata_;
+	bool strata_on_;
+
+	//a start node with a bound vertex starts its walks there, drawing the
+	//rest of the tuple from the vertex's list, and plans start at such
+	//nodes if the query has any (GCARE_WJ_ANCHOR=0 samples the node's whole
+	//label and leaves it to the bound check, as before)
+	bool anchor_on_;
+
+	//with a walk reservoir in the summary (see WalkReservoir, built with
+	//GCARE_WJ_RESERVOIR), a plan whose first steps are one of its patterns
+	//takes them from it, reuse_[p] being (pattern, steps), or (-1, 1); then
+	//only the remaining steps are walked. Not with the candidate filter,
+	//prefix estimates or the GPU, nor after edge updates
+	//(GCARE_WJ_RESERVOIR=0 ignores it)
+	WalkReservoir reservoir_;
+	bool reservoir_on_;
+	vector<pair<int, int>> reuse_;
+
+	//with GCARE_START_POOL=1, uniform start tuples come from the shared
+	//pool's stream of this run and start node (see StartPool)
+	bool pool_on_;
+	vector<StartPool::Stream> start_streams_;
+
+	//with GCARE_CAND_FILTER=1, walks start from and step onto candidates of
+	//filter_ only, and 1/P(si) counts those; start_tuples_ holds the
+	//candidate tuples of each start node, flattened
+	bool filter_on_;
+	CandidateFilter filter_;
+	vector<vector<int>> start_tuples_;
+
+	//bidirectional walks (GCARE_WJ_BIDIR=n): a query that is a path or a
+	//cycle of at least n edges, with no bound vertices, is cut at its
+	//middle vertex into two arms walked towards it, and a sample joins
+	//bidir_walks_ walks of each arm (GCARE_WJ_BIDIR_WALKS, default 64) on
+	//where they end, through meet_ (end vertex -> summed 1/P of the first
+	//arm). Each walk of a path's arm starts at an end of the path, from a
+	//uniform edge of starts_[arm]; both arms of a cycle start from the
+	//one uniform edge of starts_[0], the cycle's rarest label. With
+	//independent arms E[1/P(a) 1/P(b) [a, b meet]] summed over the pairs is
+	//the number of matches, so the sample is unbiased; it succeeds if any
+	//pair meets, where a one-way walk of a long path must survive every
+	//step and one of a cycle must also hit its closing edge. Samples run
+	//one at a time, in place of the plans; not with the candidate filter
+	//or prefix estimates. Cycles gain the most: a path's arms meet by
+	//chance, which pays where its one-way walks mostly die
+	struct BidirStart {
+		int label;
+		int vlabel[2]; //of the query vertices of its columns, -1 if none
+	};
+	struct ArmStep {
+		int label;
+		bool dir;   //out of the vertex walked from (its src) if true
+		int vlabel; //of the query vertex reached, -1 if none
+	};
+	bool bidir_on_, bidir_cycle_;
+	int bidir_walks_;
+	vector<BidirStart> starts_;
+	vector<ArmStep> arms_[2];
+	int arm_col_[2]; //column of its start tuple an arm walks on from
+	unordered_map<int, double> meet_;
+
+	//with GCARE_EXACT_BELOW=n, once PILOT_WALKS walks estimate at most n
+	//matches, the query is counted exactly instead (see ExactCounter),
+	//giving up past EXACT_LIMIT_FACTOR * n; exact_ is the count, or -1
+	static const int PILOT_WALKS = 256;
+	static const int EXACT_LIMIT_FACTOR = 4;
+	double exact_below_, exact_;
+	bool pilot_done_;
 };
 
+}  // namespace graph
+
 #endif
 
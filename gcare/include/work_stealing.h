@@ -0,0 +1,140 @@
+#ifndef WORK_STEALING_H_
+#define WORK_STEALING_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads, each with a deque of tasks: a worker runs
+// the newest task of its own deque and, when that is empty, steals the
+// oldest task of another's. Tasks submitted by a task go to its worker's
+// deque, so a long task can split off the rest of its work for idle
+// workers to steal (see HasIdle) and a batch of tasks of very different
+// lengths finishes in about its total work divided by the workers.
+class WorkStealingPool {
+public:
+  typedef std::function<void()> Task;
+
+  explicit WorkStealingPool(int workers) {
+    for (int w = 0; w < workers; w++)
+      queues_.emplace_back(new Queue);
+    for (int w = 0; w < workers; w++)
+      threads_.emplace_back([this, w]() { Work(w); });
+  }
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &t : threads_)
+      t.join();
+  }
+
+  int Size() const { return (int)queues_.size(); }
+
+  // queues task on the calling worker's deque, or on the next deque in turn
+  // if called from outside the pool; task must not throw
+  void Submit(Task task) {
+    int w = WorkerId();
+    if (w < 0)
+      w = next_++ % queues_.size();
+    pending_++;
+    {
+      std::lock_guard<std::mutex> lock(queues_[w]->mutex);
+      queues_[w]->tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_++;
+    }
+    wake_.notify_one();
+  }
+
+  // blocks until every task submitted so far, and every task they
+  // submitted, has run
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return pending_ == 0; });
+  }
+
+  // whether a worker waits for work, so that splitting a task would pay
+  bool HasIdle() const { return idle_ > 0; }
+
+  // the index of the calling worker, -1 outside the pool
+  static int WorkerId() { return worker_id(); }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  static int &worker_id() {
+    static thread_local int id = -1;
+    return id;
+  }
+
+  // the newest task of w, else the oldest of the others, starting after w
+  bool Pop(int w, Task &task) {
+    int n = queues_.size();
+    for (int k = 0; k < n; k++) {
+      Queue &q = *queues_[(w + k) % n];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.tasks.empty())
+        continue;
+      if (k == 0) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      } else {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void Work(int w) {
+    worker_id() = w;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_++;
+        wake_.wait(lock, [this]() { return stop_ || queued_ > 0; });
+        idle_--;
+        if (stop_)
+          return;
+        queued_--;
+      }
+      // a queued task may be taken by a thief first, but then its count
+      // was taken for another one still queued
+      Task task;
+      while (!Pop(w, task))
+        std::this_thread::yield();
+      task();
+      if (--pending_ == 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_; // guards stop_ and queued_
+  std::condition_variable wake_, done_;
+  bool stop_ = false;
+  long queued_ = 0; // tasks in the deques not yet claimed by a worker
+  std::atomic<long> pending_{0}; // tasks submitted and not finished
+  std::atomic<int> idle_{0};
+  std::atomic<unsigned> next_{0};
+};
+
+#endif
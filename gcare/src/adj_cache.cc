@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../include/adj_cache.h"
+
+namespace {
+
+std::atomic<uint64_t> next_cache_id{1};
+
+// an aligned block buffer of the calling thread, for blocks read past the
+// cache
+char* ThreadBlock() {
+  struct Buffer {
+    char* data = static_cast<char*>(aligned_alloc(4096, AdjCache::BLOCK));
+    ~Buffer() { free(data); }
+  };
+  static thread_local Buffer buf;
+  return buf.data;
+}
+
+}  // namespace
+
+// An io_uring driven through its system calls and shared rings (liburing is
+// not needed): reads are submitted one at a time and reaped by the thread
+// that owns the ring.
+struct AdjCache::Ring {
+  int fd = -1;
+  unsigned entries = 0, inflight = 0;
+  bool broken = false; // a submission failed: read synchronously instead
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  io_uring_sqe* sqes;
+  io_uring_cqe* cqes;
+  void *sq_ptr = MAP_FAILED, *cq_ptr = MAP_FAILED, *sqe_ptr = MAP_FAILED;
+  size_t sq_len = 0, cq_len = 0, sqe_len = 0;
+
+  bool Init(unsigned n) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, n, &p);
+    if (fd < 0)
+      return false;
+    entries = p.sq_entries;
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+      sq_len = cq_len = std::max(sq_len, cq_len);
+    sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+      return false;
+    cq_ptr = single ? sq_ptr
+                    : mmap(nullptr, cq_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqe_len = p.sq_entries * sizeof(io_uring_sqe);
+    sqe_ptr = mmap(nullptr, sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQES);
+    if (cq_ptr == MAP_FAILED || sqe_ptr == MAP_FAILED)
+      return false;
+    char* sq = static_cast<char*>(sq_ptr);
+    sq_head = (unsigned*)(sq + p.sq_off.head);
+    sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + p.sq_off.array);
+    char* cq = static_cast<char*>(cq_ptr);
+    cq_head = (unsigned*)(cq + p.cq_off.head);
+    cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    sqes = static_cast<io_uring_sqe*>(sqe_ptr);
+    return true;
+  }
+
+  ~Ring() {
+    if (sqe_ptr != MAP_FAILED)
+      munmap(sqe_ptr, sqe_len);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+      munmap(cq_ptr, cq_len);
+    if (sq_ptr != MAP_FAILED)
+      munmap(sq_ptr, sq_len);
+    if (fd >= 0)
+      close(fd);
+  }
+
+  // false if the read could not be submitted
+  bool Submit(int file, char* buf, unsigned len, uint64_t off, uint64_t user) {
+    if (broken || inflight == entries)
+      return false;
+    unsigned tail = *sq_tail;
+    unsigned idx = tail & *sq_mask;
+    io_uring_sqe* sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user;
+    sq_array[idx] = idx;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0) != 1) {
+      __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+      broken = true;
+      return false;
+    }
+    inflight++;
+    return true;
+  }
+
+  // the next completion; with wait, blocks for one if any read is in flight
+  bool Complete(bool wait, uint64_t* user, int* res) {
+    for (;;) {
+      unsigned head = *cq_head;
+      if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        const io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        *user = cqe->user_data;
+        *res = cqe->res;
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        inflight--;
+        return true;
+      }
+      if (!wait || inflight == 0)
+        return false;
+      syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    }
+  }
+};
+
+AdjCache::AdjCache() = default;
+
+AdjCache::~AdjCache() {
+  //the kernel may still be writing into the arena
+  for (auto& ring : rings_) {
+    uint64_t user;
+    int res;
+    while (ring->Complete(true, &user, &res)) {
+    }
+  }
+  rings_.clear();
+  free(arena_);
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool AdjCache::Open(const char* path, size_t capacity) {
+  fd_ = open(path, O_RDONLY | O_DIRECT);
+  direct_ = fd_ >= 0;
+  struct stat st;
+  if (direct_ && (fstat(fd_, &st) != 0 ||
+                  pread(fd_, ThreadBlock(), BLOCK, 0) < std::min<off_t>(st.st_size, BLOCK))) {
+    //the file system takes no direct reads
+    close(fd_);
+    direct_ = false;
+  }
+  if (!direct_)
+    fd_ = open(path, O_RDONLY);
+  if (fd_ < 0 || fstat(fd_, &st) != 0) {
+    perror(path);
+    return false;
+  }
+  file_size_ = st.st_size;
+  id_ = next_cache_id++;
+  size_t per_shard = std::max<size_t>(capacity / BLOCK / NUM_SHARDS, 2);
+  arena_ = static_cast<char*>(aligned_alloc(4096, per_shard * NUM_SHARDS * BLOCK));
+  if (arena_ == nullptr) {
+    perror("out-of-core adjacency cache");
+    return false;
+  }
+  shards_.reset(new Shard[NUM_SHARDS]);
+  for (int s = 0; s < NUM_SHARDS; s++) {
+    shards_[s].slots.resize(per_shard);
+    for (size_t i = 0; i < per_shard; i++)
+      shards_[s].slots[i].data = arena_ + (s * per_shard + i) * BLOCK;
+  }
+  return true;
+}
+
+void AdjCache::ReadBlock(int64_t block, char* out) {
+  uint64_t off = (uint64_t)block * BLOCK;
+  size_t want = std::min<uint64_t>(BLOCK, file_size_ - off), done = 0;
+  while (done < want) {
+    //whole blocks, as direct reads need; the file's end cuts the last short
+    ssize_t n = pread(fd_, out + done, BLOCK - done, off + done);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR)
+        continue;
+      perror("out-of-core adjacency read");
+      exit(EXIT_FAILURE);
+    }
+    done += n;
+  }
+}
+
+AdjCache::Ring* AdjCache::ThreadRing() {
+  static thread_local uint64_t id = 0;
+  static thread_local Ring* ring = nullptr;
+  if (id == id_)
+    return ring;
+  id = id_;
+  std::unique_ptr<Ring> r(new Ring);
+  if (!r->Init(64)) {
+    ring = nullptr;
+    return ring;
+  }
+  ring = r.get();
+  std::lock_guard<std::mutex> l(rings_lock_);
+  rings_.push_back(std::move(r));
+  return ring;
+}
+
+AdjCache::Slot* AdjCache::Victim(Shard& shard) {
+  size_t n = shard.slots.size();
+  for (size_t i = 0; i < 2 * n; i++) {
+    Slot& s = shard.slots[shard.hand];
+    shard.hand = (shard.hand + 1) % n;
+    if (s.state == Slot::FREE)
+      return &s;
+    if (s.pins > 0 || s.state == Slot::LOADING)
+      continue;
+    if (s.referenced) {
+      s.referenced = false;
+      continue;
+    }
+    return &s;
+  }
+  return nullptr;
+}
+
+void AdjCache::Reap(Ring* ring, Slot* wait) {
+  uint64_t user;
+  int res;
+  while (ring->Complete(wait != nullptr, &user, &res)) {
+    Slot* s = reinterpret_cast<Slot*>(user);
+    //a failed or short read (past a direct read's limits) is done again
+    if (res < (int)std::min<uint64_t>(BLOCK, file_size_ - (uint64_t)s->block * BLOCK)) {
+      ring->broken = true;
+      ReadBlock(s->block, s->data);
+    }
+    Shard& shard = ShardOf(s->block);
+    {
+      std::lock_guard<std::mutex> l(shard.lock);
+      s->state = Slot::READY;
+      s->owner = nullptr;
+      s->pins--;
+    }
+    if (s == wait)
+      return;
+  }
+}
+
+const char* AdjCache::Pin(int64_t block, char* buf, Shard** shard, Slot** slot) {
+  Shard& sh = ShardOf(block);
+  *shard = nullptr;
+  *slot = nullptr;
+  Ring* ring = ThreadRing();
+  if (ring != nullptr && ring->inflight > 0)
+    Reap(ring, nullptr);
+  for (;;) {
+    std::unique_lock<std::mutex> l(sh.lock);
+    auto it = sh.index.find(block);
+    if (it != sh.index.end()) {
+      Slot& s = sh.slots[it->second];
+      if (s.state == Slot::READY) {
+        s.referenced = true;
+        s.pins++;
+        hits_++;
+        *shard = &sh;
+        *slot = &s;
+        return s.data;
+      }
+      Ring* owner = s.owner;
+      l.unlock();
+      if (owner != nullptr && owner == ring) {
+        //our own read ahead: wait for it to land
+        Reap(owner, &s);
+        continue;
+      }
+      break; //another thread is reading it: read our own copy
+    }
+    Slot* s = Victim(sh);
+    if (s == nullptr)
+      break;
+    if (s->block >= 0)
+      sh.index.erase(s->block);
+    s->block = block;
+    s->state = Slot::LOADING;
+    s->owner = nullptr;
+    s->pins = 1;
+    s->referenced = true;
+    sh.index[block] = s - sh.slots.data();
+    l.unlock();
+    misses_++;
+    ReadBlock(block, s->data);
+    l.lock();
+    s->state = Slot::READY;
+    *shard = &sh;
+    *slot = s;
+    return s->data;
+  }
+  misses_++;
+  ReadBlock(block, buf);
+  return buf;
+}
+
+void AdjCache::Unpin(Shard* shard, Slot* slot) {
+  if (shard == nullptr)
+    return;
+  std::lock_guard<std::mutex> l(shard->lock);
+  slot->pins--;
+}
+
+int AdjCache::Get(bool dir, int64_t pos) {
+  uint64_t off = Offset(dir, pos);
+  Shard* shard;
+  Slot* slot;
+  const char* data = Pin(off / BLOCK, ThreadBlock(), &shard, &slot);
+  int v;
+  memcpy(&v, data + off % BLOCK, sizeof(int));
+  Unpin(shard, slot);
+  return v;
+}
+
+void AdjCache::Read(bool dir, int64_t begin, int64_t end, int* out) {
+  uint64_t off = Offset(dir, begin), last = Offset(dir, end);
+  char* dst = reinterpret_cast<char*>(out);
+  while (off < last) {
+    Shard* shard;
+    Slot* slot;
+    const char* data = Pin(off / BLOCK, ThreadBlock(), &shard, &slot);
+    size_t n = std::min<uint64_t>(last - off, BLOCK - off % BLOCK);
+    memcpy(dst, data + off % BLOCK, n);
+    Unpin(shard, slot);
+    dst += n;
+    off += n;
+  }
+}
+
+bool AdjCache::Contains(bool dir, int64_t begin, int64_t end, int target) {
+  //one block per probe: the part of [begin, end) in the block of the
+  //middle entry either holds the answer or halves the range
+  while (begin < end) {
+    int64_t mid = begin + (end - begin) / 2;
+    uint64_t block = Offset(dir, mid) / BLOCK;
+    int64_t first = std::max<int64_t>(begin,
+        ((int64_t)(block * BLOCK) - (int64_t)Offset(dir, 0)) / (int64_t)sizeof(int));
+    int64_t last = std::min<int64_t>(end,
+        ((int64_t)((block + 1) * BLOCK) - (int64_t)Offset(dir, 0)) / (int64_t)sizeof(int));
+    Shard* shard;
+    Slot* slot;
+    const char* data = Pin(block, ThreadBlock(), &shard, &slot);
+    const int* entries = reinterpret_cast<const int*>(data + Offset(dir, first) % BLOCK);
+    int64_t n = last - first;
+    int lo = entries[0], hi = entries[n - 1];
+    bool found = target >= lo && target <= hi && std::binary_search(entries, entries + n, target);
+    Unpin(shard, slot);
+    if (target >= lo && target <= hi)
+      return found;
+    if (target < lo)
+      end = first;
+    else
+      begin = last;
+  }
+  return false;
+}
+
+void AdjCache::Prefetch(bool dir, int64_t begin, int64_t end) {
+  //a walk reads one entry of the list: its first blocks are enough
+  const uint64_t MAX_BLOCKS = 4;
+  if (begin >= end)
+    return;
+  Ring* ring = ThreadRing();
+  if (ring != nullptr)
+    Reap(ring, nullptr);
+  uint64_t first = Offset(dir, begin) / BLOCK;
+  uint64_t last = std::min((Offset(dir, end) - 1) / BLOCK, first + MAX_BLOCKS - 1);
+  if (ring == nullptr || ring->broken) {
+    if (!direct_)
+      posix_fadvise(fd_, first * BLOCK, (last - first + 1) * BLOCK, POSIX_FADV_WILLNEED);
+    return;
+  }
+  for (uint64_t block = first; block <= last; block++) {
+    Shard& sh = ShardOf(block);
+    std::unique_lock<std::mutex> l(sh.lock);
+    auto it = sh.index.find(block);
+    if (it != sh.index.end()) {
+      sh.slots[it->second].referenced = true;
+      continue;
+    }
+    Slot* s = Victim(sh);
+    if (s == nullptr)
+      continue;
+    if (s->block >= 0)
+      sh.index.erase(s->block);
+    s->block = block;
+    s->state = Slot::LOADING;
+    s->owner = ring;
+    s->pins = 1;
+    s->referenced = true;
+    sh.index[block] = s - sh.slots.data();
+    l.unlock();
+    if (ring->Submit(fd_, s->data, BLOCK, block * BLOCK, reinterpret_cast<uint64_t>(s))) {
+      prefetched_++;
+      continue;
+    }
+    l.lock();
+    sh.index.erase(block);
+    s->block = -1;
+    s->state = Slot::FREE;
+    s->owner = nullptr;
+    s->pins = 0;
+    return;
+  }
+}
@@ -0,0 +1,204 @@
+#include "../include/auto_select.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+
+namespace graph {
+
+namespace {
+
+// the root of v in a union-find forest
+int find_root(vector<int>& parent, int v) {
+  while (parent[v] != v)
+    v = parent[v] = parent[parent[v]];
+  return v;
+}
+
+// Rough weights from the methods' designs, for when nothing was observed
+// yet: the samplers draw ratio * |rarest label| walks (wj, jsub) or
+// embeddings (impr) costing more the longer they are, cset reads one
+// summary entry per star, and sumrdf's summary join grows exponentially
+// with the query.
+struct Prior {
+  const char* method;
+  double w[QueryFeatures::NUM];
+};
+
+const Prior PRIORS[] = {
+    // bias, vertices, edges, cycles, bound, log edges, log ratio
+    {"wj", {-16.0, 0.0, 0.3, 0.2, 0.0, 1.0, 1.0}},
+    {"jsub", {-15.3, 0.0, 0.3, 0.2, 0.0, 1.0, 1.0}},
+    {"impr", {-14.0, 0.5, 0.0, 0.0, 0.0, 1.0, 1.0}},
+    {"cset", {-11.5, 0.0, 0.2, 0.0, 0.0, 0.0, 0.0}},
+    {"sumrdf", {-9.2, 0.8, 0.0, 0.5, -0.3, 0.0, 0.0}},
+};
+
+// weight of the prior, in observations, per direction of the features
+const double RIDGE = 1.0;
+
+// solves a x = b by Gaussian elimination with partial pivoting; false if a
+// is singular
+bool solve(int n, double a[][QueryFeatures::NUM], double* b, double* x) {
+  for (int c = 0; c < n; c++) {
+    int pivot = c;
+    for (int r = c + 1; r < n; r++)
+      if (fabs(a[r][c]) > fabs(a[pivot][c]))
+        pivot = r;
+    if (fabs(a[pivot][c]) < 1e-12)
+      return false;
+    std::swap_ranges(a[c], a[c] + n, a[pivot]);
+    std::swap(b[c], b[pivot]);
+    for (int r = c + 1; r < n; r++) {
+      double f = a[r][c] / a[c][c];
+      for (int k = c; k < n; k++)
+        a[r][k] -= f * a[c][k];
+      b[r] -= f * b[c];
+    }
+  }
+  for (int c = n - 1; c >= 0; c--) {
+    double s = b[c];
+    for (int k = c + 1; k < n; k++)
+      s -= a[c][k] * x[k];
+    x[c] = s / a[c][c];
+  }
+  return true;
+}
+
+std::mutex log_mutex;
+
+} // namespace
+
+QueryFeatures::QueryFeatures(QueryGraph& q, DataGraph& g) {
+  int n = q.GetNumVertices(), m = q.GetNumEdges();
+  // independent cycles of the undirected query: m - n + components
+  vector<int> parent(n);
+  for (int v = 0; v < n; v++)
+    parent[v] = v;
+  int components = n;
+  int64_t rarest = -1;
+  for (int i = 0; i < m; i++) {
+    Edge e = q.GetEdge(i);
+    int a = find_root(parent, e.src), b = find_root(parent, e.dst);
+    if (a != b) {
+      parent[a] = b;
+      components--;
+    }
+    int64_t size = g.GetNumEdges(e.el);
+    if (rarest < 0 || size < rarest)
+      rarest = size;
+  }
+  if (rarest < 0)
+    rarest = g.GetNumVertices();
+  int bound = 0;
+  for (int v = 0; v < n; v++)
+    bound += q.GetBound(v) >= 0;
+  x[BIAS] = 1.0;
+  x[VERTICES] = n;
+  x[EDGES] = m;
+  x[CYCLES] = m - n + components;
+  x[BOUND] = bound;
+  x[LOG_EDGES] = log(1.0 + rarest);
+  x[LOG_RATIO] = 0.0;
+}
+
+LinearCostModel::LinearCostModel() {
+  for (const Prior& p : PRIORS) {
+    Weights& w = weights_[p.method];
+    std::copy(p.w, p.w + NUM, w.prior);
+    std::copy(p.w, p.w + NUM, w.w);
+  }
+}
+
+double LinearCostModel::LogSeconds(const std::string& method,
+                                   const double* x) const {
+  auto it = weights_.find(method);
+  if (it == weights_.end())
+    return 0.0;
+  double s = 0.0;
+  for (int i = 0; i < NUM; i++)
+    s += it->second.w[i] * x[i];
+  return s;
+}
+
+// minimises |X w - y|^2 + RIDGE |w - prior|^2 over the observations so far
+void LinearCostModel::Observe(const std::string& method, const double* x,
+                              double seconds) {
+  Weights& w = weights_[method];
+  double y = log(std::max(seconds, 1e-6));
+  for (int i = 0; i < NUM; i++) {
+    for (int j = 0; j < NUM; j++)
+      w.xtx[i][j] += x[i] * x[j];
+    w.xty[i] += x[i] * y;
+  }
+  double a[NUM][NUM], b[NUM];
+  for (int i = 0; i < NUM; i++) {
+    for (int j = 0; j < NUM; j++)
+      a[i][j] = w.xtx[i][j] + (i == j ? RIDGE : 0.0);
+    b[i] = w.xty[i] + RIDGE * w.prior[i];
+  }
+  double fitted[NUM];
+  if (solve(NUM, a, b, fitted))
+    std::copy(fitted, fitted + NUM, w.w);
+}
+
+void LinearCostModel::ReadLog(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if (fp == nullptr)
+    return;
+  char method[64];
+  double x[NUM], seconds;
+  x[QueryFeatures::BIAS] = 1.0;
+  while (fscanf(fp, "%63s %lf %lf %lf %lf %lf %lf %lf", method, &x[1], &x[2],
+                &x[3], &x[4], &x[5], &x[6], &seconds) == 8)
+    Observe(method, x, seconds);
+  fclose(fp);
+}
+
+void LinearCostModel::AppendLog(const char* path, const std::string& method,
+                                const double* x, double seconds) {
+  std::lock_guard<std::mutex> lock(log_mutex);
+  FILE* fp = fopen(path, "a");
+  if (fp == nullptr) {
+    perror(path);
+    return;
+  }
+  fprintf(fp, "%s", method.c_str());
+  for (int i = 1; i < NUM; i++)
+    fprintf(fp, " %.9g", x[i]);
+  fprintf(fp, " %.9g\n", seconds);
+  fclose(fp);
+}
+
+AutoChoice ChooseEstimator(const CostModel& model,
+                           const vector<AutoCandidate>& candidates,
+                           QueryFeatures& f, double budget, double ratio) {
+  double log_budget = log(budget);
+  AutoChoice fastest{-1, ratio, 0.0};
+  // cyclic queries try the candidates that suit them first
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t c = 0; c < candidates.size(); c++) {
+      const AutoCandidate& candidate = candidates[c];
+      if ((pass == 0) != (candidate.cyclic || !f.Cyclic()))
+        continue;
+      for (int cut = 1; cut <= AUTO_MAX_RATIO_CUT; cut *= 2) {
+        double r = ratio / cut;
+        f.x[QueryFeatures::LOG_RATIO] = candidate.samples ? log(r) : 0.0;
+        double t = model.LogSeconds(candidate.method, f.x);
+        if (t <= log_budget)
+          return AutoChoice{(int)c, r, t};
+        if (fastest.candidate < 0 || t < fastest.log_seconds)
+          fastest = AutoChoice{(int)c, r, t};
+        if (!candidate.samples)
+          break;
+      }
+    }
+  }
+  if (fastest.candidate >= 0)
+    f.x[QueryFeatures::LOG_RATIO] =
+        candidates[fastest.candidate].samples ? log(fastest.ratio) : 0.0;
+  return fastest;
+}
+
+}  // namespace graph
@@ -0,0 +1,1560 @@
+// The backend of one kind of data: built once without and once with
+// -DRELATION, into the graph and the relational namespace respectively (see
+// estimator.h), each registering itself for the estimators of its kind.
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <omp.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+#ifndef RELATION
+#include "../include/auto_select.h"
+#endif
+#include "../include/estimate_cache.h"
+#include "../include/estimator.h"
+#include "../include/memory.h"
+#include "../include/metrics.h"
+#include "../include/query_text.h"
+#include "../include/registry.h"
+#include "../include/work_stealing.h"
+#ifdef GCARE_V6D
+#include "../include/v6d_graph.h"
+#endif
+
+namespace GCARE_KIND {
+
+namespace {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// the memory peaks so far, of the process and of each subsystem
+void record_memory(QueryResult *query_result) {
+  query_result->m_est = getPeakPhysicalMemoryUsage();
+  for (int s = 0; s < NUM_MEMORY_SUBSYSTEMS; s++)
+    query_result->m_subsystem[s] = GetMemoryAccount(s).peak;
+}
+
+void record_nested(Estimator *estimator, QueryResult *query_result) {
+  const vector<double> &nested = estimator->GetNestedEstimates();
+  std::copy(nested.begin(), nested.end(), query_result->nested_est);
+}
+
+void reset_memory_peaks() {
+  resetPeakPhysicalMemoryUsage();
+  for (int s = 0; s < NUM_MEMORY_SUBSYSTEMS; s++)
+    GetMemoryAccount(s).ResetPeak();
+}
+
+// seconds of query_params.timeout as a duration
+Clock::duration timeout_of(const QueryParams &query_params) {
+  return std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(query_params.timeout));
+}
+
+// Runs one iteration in the calling process. The timeout is enforced by the
+// estimator polling its deadline, so no child process or polling is needed.
+void run_in_process(Estimator *estimator, DataGraph &g, QueryGraph &q,
+                    double p, int seed, const QueryParams &query_params,
+                    QueryResult *query_result) {
+  estimator->Seed(seed);
+  estimator->SetDeadline(std::chrono::steady_clock::now() +
+                             timeout_of(query_params),
+                         query_params.partial);
+  ThreadCounters().Clear();
+  ThreadPerf().Start(query_params.perf);
+  MemoryBudget budget(query_params.memory_limit);
+  ScopedMemoryBudget charge(query_params.memory_limit > 0 ? &budget : nullptr);
+  if (query_params.memory_limit > 0)
+    estimator->SetMemoryBudget(&budget);
+  try {
+    auto chkpt = Clock::now();
+    query_result->est = estimator->Run(g, q, p);
+    auto elapsed = chrono::duration<double>(Clock::now() - chkpt);
+    query_result->time =
+        chrono::duration_cast<chrono::microseconds>(elapsed).count() / 1e6;
+    record_nested(estimator, query_result);
+    query_result->counters = ThreadCounters();
+    query_result->perf = ThreadPerf().Result();
+    query_result->partial = estimator->Partial();
+    query_result->samples = estimator->NumSamples();
+    query_result->variance = estimator->Variance();
+    record_memory(query_result);
+  } catch (Estimator::ErrCode e) {
+    estimator->ClearDeadline();
+    estimator->SetMemoryBudget(nullptr);
+    std::cerr << (e == Estimator::MEMORY ? "memory limit exceeded\n" : "timeout\n");
+    throw;
+  }
+  estimator->ClearDeadline();
+  estimator->SetMemoryBudget(nullptr);
+}
+
+// Forks one child per iteration of [first, last) and keeps up to
+// num_threads of them running at once. Child i seeds with seed + i and
+// reports through query_result[i], so the results do not depend on the
+// degree of parallelism. A crash or timeout of any child kills the remaining ones and
+// fails the whole query. With query_params.partial a child stops sampling at
+// the timeout by itself and is only killed if it overruns that by a grace
+// period, being stuck where it cannot stop early.
+void run_forked(Estimator *estimator, DataGraph &g, QueryGraph &q,
+                const QueryParams &query_params, QueryResult *query_result,
+                int first, int last) {
+  int seed = query_params.seed;
+  double p = query_params.ratio;
+  size_t num_threads = std::max(query_params.num_threads, 1);
+  Clock::duration timeout = timeout_of(query_params);
+  Clock::duration kill_after = timeout;
+  if (query_params.partial)
+    kill_after += std::max<Clock::duration>(std::chrono::seconds(1),
+                                            timeout / 10);
+  vector<pair<int, Clock::time_point>> running; // (pid, start time)
+  auto kill_running = [&running]() {
+    for (auto &child : running)
+      kill(child.first, SIGKILL);
+    for (auto &child : running)
+      waitpid(child.first, NULL, 0);
+    running.clear();
+  };
+  int next_iter = first;
+  while (next_iter < last || !running.empty()) {
+    while (next_iter < last && running.size() < num_threads) {
+      int i = next_iter++;
+      query_result[i].est = query_result[i].time = 0.0;
+      query_result[i].m_est = 0;
+      std::fill(query_result[i].m_subsystem,
+                query_result[i].m_subsystem + NUM_MEMORY_SUBSYSTEMS, 0);
+      query_result[i].counters.Clear();
+      query_result[i].perf.Clear();
+      query_result[i].partial = false;
+      query_result[i].samples = 0;
+      query_result[i].variance = -1.0;
+      int child_pid = fork();
+      if (child_pid == 0) {
+        estimator->SetMetricsSeries(-1);
+        estimator->Seed(seed + i);
+        if (query_params.partial)
+          estimator->SetDeadline(std::chrono::steady_clock::now() + timeout,
+                                 true);
+        ThreadCounters().Clear();
+        reset_memory_peaks();
+        ThreadPerf().Start(query_params.perf);
+        auto chkpt = Clock::now();
+        query_result[i].est = estimator->Run(g, q, p);
+        auto elapsed = chrono::duration<double>(Clock::now() - chkpt);
+        query_result[i].time =
+            chrono::duration_cast<chrono::microseconds>(elapsed).count() / 1e6;
+        record_nested(estimator, &query_result[i]);
+        query_result[i].counters = ThreadCounters();
+        query_result[i].perf = ThreadPerf().Result();
+        query_result[i].partial = estimator->Partial();
+        query_result[i].samples = estimator->NumSamples();
+        query_result[i].variance = estimator->Variance();
+        record_memory(&query_result[i]);
+        shmdt(query_result);
+        exit(EXIT_SUCCESS);
+      }
+      assert(child_pid > 0);
+      running.emplace_back(child_pid, Clock::now());
+    }
+    usleep(100000); // sleep 0.1 second
+    for (size_t k = 0; k < running.size();) {
+      int child_status = 0;
+      int wait_result = waitpid(running[k].first, &child_status, WNOHANG);
+      if (wait_result != 0 && WIFEXITED(child_status)) {
+        running.erase(running.begin() + k);
+        continue;
+      } else if (wait_result != 0 && WIFSIGNALED(child_status)) {
+        int signal = WTERMSIG(child_status);
+        std::cerr << "child signaled exit " << signal << "\n";
+        running.erase(running.begin() + k);
+        kill_running();
+        throw signal;
+      }
+      if (Clock::now() - running[k].second > kill_after) {
+        std::cerr << "timeout\n";
+        kill_running();
+        throw Estimator::ErrCode::TIMEOUT;
+      }
+      k++;
+    }
+  }
+  // what the children's Run() recorded went with them
+  int series = estimator->GetMetricsSeries();
+  for (int i = first; i < last && series >= 0; i++) {
+    Metrics &metrics = Metrics::Get();
+    metrics.Count(series, METRIC_ITERATIONS);
+    if (query_result[i].partial)
+      metrics.Count(series, METRIC_PARTIAL_ITERATIONS);
+    metrics.Record(series, METRIC_ITERATION_SECONDS,
+                   (uint64_t)(query_result[i].time * 1e6));
+    metrics.Record(series, METRIC_ITERATION_SAMPLES, query_result[i].samples);
+  }
+}
+
+// The graph worker number worker reads: with GCARE_NUMA its thread is pinned
+// to a node at its first run, and reads that node's replica if there are.
+DataGraph &numa_local(DataGraph &g, int worker) {
+#ifndef RELATION
+  if (CurrentNumaNode() == NUMA_ANY && NumaActive())
+    PinWorkerToNumaNode(worker);
+  return g.Replica(CurrentNumaNode());
+#else
+  return g;
+#endif
+}
+
+// Runs the iterations [first, last) in-process, spread over one estimator
+// instance per thread. Each iteration seeds its instance with seed + i, so
+// the results do not depend on the number of threads.
+void run_threaded(vector<Estimator *> &estimators, DataGraph &g, QueryGraph &q,
+                  const QueryParams &query_params, QueryResult *query_result,
+                  int first, int last) {
+  int seed = query_params.seed;
+  double p = query_params.ratio;
+  // the first error of any iteration, which fails the query
+  std::atomic<int> error(Estimator::NORMAL);
+#pragma omp parallel for num_threads(estimators.size()) schedule(dynamic, 1)
+  for (int i = first; i < last; i++) {
+    if (error != Estimator::NORMAL)
+      continue;
+    try {
+      int t = omp_get_thread_num();
+      run_in_process(estimators[t], numa_local(g, t), q, p, seed + i,
+                     query_params, &query_result[i]);
+    } catch (Estimator::ErrCode e) {
+      int none = Estimator::NORMAL;
+      error.compare_exchange_strong(none, e);
+    }
+  }
+  if (error != Estimator::NORMAL)
+    throw (Estimator::ErrCode)error.load();
+}
+
+// one "progress,subquery,samples,mean,variance,elapsed" line on stderr
+bool print_progress(const Estimator::Progress &progress) {
+  fprintf(stderr, "progress,%d,%zu,%g,%g,%g\n", progress.subquery,
+          progress.samples, progress.mean, progress.variance,
+          progress.elapsed);
+  return true;
+}
+
+// The pool of the estimates of iterations [0, n), as --target-rse takes
+// them: each weighted by the inverse of its variance, with the standard
+// error sqrt(1 / the sum of the weights). An iteration of unknown variance,
+// or of none (no spread among its samples, as of walks that all failed),
+// would get no or all the weight, so then they weigh equally and the
+// standard error is that of their mean. Failed iterations are left out;
+// false if no standard error can be had.
+bool pool_iterations(const QueryResult *query_result, int n, double &est,
+                     double &se) {
+  vector<const QueryResult *> ok;
+  bool weighted = true;
+  for (int i = 0; i < n; i++)
+    if (query_result[i].est > -1e9) {
+      ok.push_back(&query_result[i]);
+      weighted &= query_result[i].variance > 0;
+    }
+  if (ok.empty())
+    return false;
+  if (weighted) {
+    double sum = 0.0, weights = 0.0;
+    for (const QueryResult *r : ok) {
+      sum += r->est / r->variance;
+      weights += 1.0 / r->variance;
+    }
+    est = sum / weights;
+    se = std::sqrt(1.0 / weights);
+    return true;
+  }
+  est = 0.0;
+  for (const QueryResult *r : ok)
+    est += r->est;
+  est /= ok.size();
+  if (ok.size() == 1) {
+    se = std::sqrt(ok[0]->variance);
+    return ok[0]->variance >= 0;
+  }
+  double m2 = 0.0;
+  for (const QueryResult *r : ok)
+    m2 += (r->est - est) * (r->est - est);
+  se = std::sqrt(m2 / (ok.size() - 1) / ok.size());
+  return true;
+}
+
+// the fewest iterations, counted from the first and at least
+// MIN_POOLED_ITERATIONS, of at most n whose pool meets target_rse; 0 if
+// none does
+const int MIN_POOLED_ITERATIONS = 2;
+int pooled_iterations(const QueryResult *query_result, int n,
+                      double target_rse) {
+  for (int k = MIN_POOLED_ITERATIONS; k <= n; k++) {
+    double est, se;
+    if (pool_iterations(query_result, k, est, se) && est > 0 &&
+        se <= target_rse * est)
+      return k;
+  }
+  return 0;
+}
+
+#ifdef RELATION
+// A method on a multi-graph (transaction) binary: one estimator of it per
+// graph, each on that graph's view, and the estimate of a query the sum of
+// theirs, as each of its embeddings lies in one graph. The graphs are
+// built and estimated in parallel, each alone on its thread; graph i's
+// summary is at summary.g<i>, and summary itself just holds their number.
+class GraphsEstimator : public Estimator {
+public:
+  GraphsEstimator(const vector<unique_ptr<DataGraph>> &graphs,
+                  EstimatorFactory factory)
+      : graphs_(graphs) {
+    for (size_t i = 0; i < graphs.size(); i++)
+      parts_.emplace_back(factory());
+  }
+
+  void PrepareSummaryStructure(DataGraph &, double p) { build_ratio_ = p; }
+
+  void WriteSummary(const char *fn) {
+    int n = parts_.size();
+    vector<string> reports(n);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < n; i++) {
+      parts_[i]->Seed(seed_ + i);
+      parts_[i]->SetBuildBudget(max_summary_bytes_ / n, max_build_seconds_);
+      parts_[i]->Summarize(*graphs_[i], PartSummary(fn, i).c_str(),
+                           build_ratio_, resume_);
+      reports[i] = parts_[i]->BuildReport();
+    }
+    for (int i = 0; i < n; i++)
+      if (!reports[i].empty())
+        build_report_ += "graph " + to_string(i) + ": " + reports[i] + "\n";
+    FILE *fp = fopen(fn, "w");
+    if (fp == nullptr) {
+      perror(fn);
+      exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "%d\n", n);
+    fclose(fp);
+  }
+
+  bool FixedSummary() { return parts_[0]->FixedSummary(); }
+
+  void ReadSummary(const char *fn) {
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < parts_.size(); i++) {
+      parts_[i]->SetDataGraph(graphs_[i].get());
+      parts_[i]->ReadSummary(PartSummary(fn, i).c_str());
+    }
+  }
+
+  bool ShareSummary(const Estimator &from) {
+    auto other = dynamic_cast<const GraphsEstimator *>(&from);
+    if (other == nullptr)
+      return false;
+    for (size_t i = 0; i < parts_.size(); i++) {
+      parts_[i]->SetDataGraph(graphs_[i].get());
+      if (!parts_[i]->ShareSummary(*other->parts_[i]))
+        return false;
+    }
+    return true;
+  }
+
+  // the parts draw their seeds from this one's, and keep its limits
+  void Init() {
+    for (auto &part : parts_) {
+      part->Seed(rng_.Next());
+      part->SetStopping(stop_ci_, stop_budget_);
+      if (has_deadline_)
+        part->SetDeadline(deadline_, partial_on_deadline_);
+      else
+        part->ClearDeadline();
+      part->SetMemoryBudget(memory_budget_);
+    }
+  }
+
+  int DecomposeQuery() {
+    done_ = false;
+    return 1;
+  }
+
+  bool GetSubstructure(int) { return !done_; }
+
+  // a deadline or a budget the parts throw at goes on up from here
+  double EstCard(int) {
+    done_ = true;
+    int n = parts_.size();
+    vector<double> est(n, 0.0);
+    vector<char> failed(n, NORMAL);
+    bool partial = false;
+#pragma omp parallel for schedule(dynamic, 1) reduction(|| : partial)
+    for (int i = 0; i < n; i++) {
+      ScopedMemoryBudget charge(memory_budget_);
+      QueryGraph part_q = *q;
+      try {
+        est[i] = parts_[i]->Run(*graphs_[i], part_q, sample_ratio);
+        partial = partial || parts_[i]->Partial();
+      } catch (ErrCode e) {
+        failed[i] = e;
+      }
+    }
+    for (int i = 0; i < n; i++)
+      if (failed[i] != NORMAL)
+        throw (ErrCode)failed[i];
+    partial_ = partial;
+    double sum = 0.0;
+    for (double e : est)
+      sum += e;
+    return sum;
+  }
+
+  double AggCard() { return card_vec_[0]; }
+  double GetSelectivity() { return 1.0; }
+
+private:
+  static string PartSummary(const char *fn, int i) {
+    return string(fn) + ".g" + to_string(i);
+  }
+
+  const vector<unique_ptr<DataGraph>> &graphs_;
+  vector<unique_ptr<Estimator>> parts_;
+  double build_ratio_ = 0.0;
+  bool done_ = false;
+};
+#endif
+
+class EstimatorRunner : public Runner {
+public:
+  EstimatorRunner(DataGraph &g, const string &method,
+                  std::function<Estimator *()> factory)
+      : g_(g), method_(method), factory_(factory),
+        metrics_series_(Metrics::Get().Series(method)),
+        estimators_(1, NewEstimator()) {}
+
+  ~EstimatorRunner() {
+    if (rebuild_.joinable())
+      rebuild_.join();
+    delete pending_.exchange(nullptr);
+    for (Estimator *estimator : estimators_)
+      delete estimator;
+  }
+
+  double Summarize(const char *summary, double p, int seed, bool resume) {
+    estimators_[0]->Seed(seed);
+    reset_memory_peaks();
+    auto chkpt = Clock::now();
+    estimators_[0]->Summarize(g_, summary, p, resume);
+    auto elapsed = chrono::duration<double>(Clock::now() - chkpt);
+    return chrono::duration_cast<chrono::milliseconds>(elapsed).count() / 1e3;
+  }
+
+  void SetBuildBudget(size_t bytes, double seconds) {
+    estimators_[0]->SetBuildBudget(bytes, seconds);
+  }
+
+  string BuildReport() { return estimators_[0]->BuildReport(); }
+
+  bool FixedSummary() { return estimators_[0]->FixedSummary(); }
+
+  // see Estimator::EstimatesMean
+  bool EstimatesMean() { return estimators_[0]->EstimatesMean(); }
+
+  // instance i of those ReadSummary made, for runners that drive the
+  // estimator themselves (see RaceRunner)
+  Estimator *Instance(int i) { return estimators_[i]; }
+
+  void WriteSummary(const char *summary) {
+    estimators_[0]->WriteSummary(summary);
+  }
+
+  double UpdateSummary(const char *summary, const char *updates) {
+    auto chkpt = Clock::now();
+    if (!estimators_[0]->UpdateSummary(g_, summary, updates))
+      return -1;
+    auto elapsed = chrono::duration<double>(Clock::now() - chkpt);
+    return chrono::duration_cast<chrono::milliseconds>(elapsed).count() / 1e3;
+  }
+
+  // in-process threads need an estimator instance each; they share the
+  // summary of the first where the method can
+  void ReadSummary(const char *summary, int instances) {
+    summary_ = summary;
+    estimators_[0]->ReadSummary(summary);
+    while ((int)estimators_.size() < instances) {
+      estimators_.push_back(NewEstimator());
+      if (!estimators_.back()->ShareSummary(*estimators_[0]))
+        estimators_.back()->ReadSummary(summary);
+    }
+  }
+
+  // The rebuilt estimators read the summary as it was written to
+  // summary.rebuild, then it is renamed to summary; they are handed over
+  // through pending_ and swapped in between two queries, when none is on
+  // the old ones, which go then.
+  bool StartRebuild(const char *prefix, const char *summary, double p,
+                    int seed) {
+    AdoptRebuild();
+    if (rebuild_.joinable())
+      return false;
+    int instances = estimators_.size();
+    rebuild_ = std::thread([=, prefix = string(prefix),
+                            summary = string(summary)]() {
+      setpriority(PRIO_PROCESS, syscall(SYS_gettid), REBUILD_NICE);
+      string tmp = summary + ".rebuild";
+      {
+        DataGraph g;
+        g.ReadBinary(prefix.c_str());
+        std::unique_ptr<Estimator> builder(factory_());
+        builder->Seed(seed);
+        builder->Summarize(g, tmp.c_str(), p);
+      }
+      auto *next = new vector<Estimator *>;
+      next->push_back(NewEstimator());
+      (*next)[0]->ReadSummary(tmp.c_str());
+      while ((int)next->size() < instances) {
+        next->push_back(NewEstimator());
+        if (!next->back()->ShareSummary(*(*next)[0]))
+          next->back()->ReadSummary(tmp.c_str());
+      }
+      rename_summary(tmp, summary);
+      delete pending_.exchange(next);
+    });
+    return true;
+  }
+
+  bool Query(const char *path, vector<string> *text,
+             const QueryParams &query_params, QueryResult *query_result,
+             double &est, double &time, vector<double> *nested_est) {
+    AdoptRebuild();
+    bool nested = !query_params.ratios.empty();
+    if (nested && (!estimators_[0]->Nests() ||
+                   query_params.ratios.size() > (size_t)MAX_NESTED_RATIOS)) {
+      cerr << method_ << " cannot estimate at several ratios in one run\n";
+      return false;
+    }
+    QueryText query_text;
+    if (text != nullptr)
+      query_text.ReadLines(*text);
+    else if (!query_text.ReadFile(path))
+      return false;
+    if (query_text.size() != 1) {
+      cerr << path << " holds " << query_text.size()
+           << " queries, not one (see --batch)\n";
+      return false;
+    }
+    QueryGraph q;
+    q.Read(query_text, 0);
+#ifndef RELATION
+    // bound vertices and labels are given in input ids
+    q.MapBounds(g_.GetVertexMap());
+    q.MapLabels(g_.GetVLabelMap(), g_.GetELabelMap());
+#endif
+    string cache_key;
+    if (query_params.cache != nullptr && !nested) {
+      auto chkpt = Clock::now();
+      cache_key = CacheKey(q, query_text, 0, query_params);
+      double variance;
+      if (query_params.cache->Find(cache_key, est, variance)) {
+        // nothing ran, so there are no peaks or counters to report
+        for (int i = 0; i < query_params.num_iter; i++)
+          query_result[i] = QueryResult();
+        time = chrono::duration<double>(Clock::now() - chkpt).count();
+        return true;
+      }
+    }
+    int num_iter = query_params.num_iter;
+    // in-process iterations share the process, so their peaks are the
+    // query's; forked children restart theirs
+    if (!query_params.fork)
+      reset_memory_peaks();
+    for (Estimator *estimator : estimators_) {
+      estimator->SetStopping(query_params.rel_ci, query_params.budget);
+      estimator->SetProgress(query_params.progress_every, print_progress);
+      estimator->SetNestedRatios(query_params.ratios);
+    }
+    // pooled: in waves of as many iterations as run at once, until a
+    // prefix of them meets the target; the later ones count as not run
+    bool pooled = query_params.target_rse > 0 && !nested &&
+                  estimators_[0]->EstimatesMean();
+    int wave = !pooled ? num_iter
+               : query_params.fork ? std::max(query_params.num_threads, 1)
+                                   : (int)estimators_.size();
+    try {
+      for (int first = 0; first < num_iter; first += wave) {
+        int last = std::min(num_iter, first + wave);
+        if (query_params.fork)
+          run_forked(estimators_[0], g_, q, query_params, query_result, first,
+                     last);
+        else
+          run_threaded(estimators_, g_, q, query_params, query_result, first,
+                       last);
+        int used = pooled ? pooled_iterations(query_result, last,
+                                              query_params.target_rse)
+                          : 0;
+        if (used > 0) {
+          for (int i = used; i < num_iter; i++)
+            query_result[i] = QueryResult();
+          num_iter = used;
+          break;
+        }
+      }
+    } catch (Estimator::ErrCode e) {
+      cerr << path << " error with code " << e << "\n";
+      Metrics::Get().Count(metrics_series_, e == Estimator::MEMORY
+                                                ? METRIC_MEMORY_ERRORS
+                                                : METRIC_TIMEOUTS);
+      return false;
+    } catch (int e) {
+      cerr << path << " error with signal " << e << "\n";
+      Metrics::Get().Count(metrics_series_, METRIC_CRASHES);
+      return false;
+    }
+    vector<double> est_vec;
+    double avg_est = 0.0, avg_time = 0.0;
+    if (nested_est != nullptr)
+      nested_est->assign(query_params.ratios.size(), 0.0);
+    for (int i = 0; i < num_iter; i++) {
+      if (query_result[i].est > -1e9) {
+        est_vec.push_back(query_result[i].est);
+        avg_time += query_result[i].time;
+        for (size_t r = 0; nested_est != nullptr && r < nested_est->size(); r++)
+          (*nested_est)[r] += query_result[i].nested_est[r];
+      }
+    }
+    if (nested_est != nullptr)
+      for (double &e : *nested_est)
+        e /= est_vec.size();
+    for (double e : est_vec)
+      avg_est += e;
+    est = avg_est / est_vec.size();
+    time = avg_time / est_vec.size();
+    double se;
+    if (pooled && pool_iterations(query_result, num_iter, est, se))
+      cerr << "pooled," << num_iter << "," << se << "\n";
+    // estimates cut short by the timeout are not kept
+    bool partial = false;
+    for (int i = 0; i < num_iter; i++)
+      partial |= query_result[i].partial;
+    if (query_params.cache != nullptr && !nested && !partial &&
+        !est_vec.empty()) {
+      double variance = 0.0;
+      for (double e : est_vec)
+        variance += (e - est) * (e - est);
+      variance /= est_vec.size();
+      query_params.cache->Put(cache_key, est, variance);
+    }
+    return true;
+  }
+
+#ifndef RELATION
+  bool QuerySubpatterns(vector<string> &text, const QueryParams &query_params,
+                        vector<uint64_t> &masks, vector<double> &est,
+                        double &time) {
+    AdoptRebuild();
+    QueryText query_text;
+    query_text.ReadLines(text);
+    if (query_text.size() != 1) {
+      cerr << "<subpatterns> holds " << query_text.size()
+           << " queries, not one\n";
+      return false;
+    }
+    QueryGraph q;
+    q.Read(query_text, 0);
+    q.MapBounds(g_.GetVertexMap());
+    q.MapLabels(g_.GetVLabelMap(), g_.GetELabelMap());
+    if (q.GetNumEdges() > QueryGraph::MAX_PATTERN_EDGES) {
+      cerr << "<subpatterns> has more than " << QueryGraph::MAX_PATTERN_EDGES
+           << " edges\n";
+      return false;
+    }
+    Estimator *estimator = estimators_[0];
+    estimator->SetStopping(query_params.rel_ci, query_params.budget);
+    estimator->SetProgress(0);
+    estimator->SetNestedRatios(vector<double>());
+    est.clear();
+    auto chkpt = Clock::now();
+    try {
+      for (int i = 0; i < query_params.num_iter; i++) {
+        estimator->Seed(query_params.seed + i);
+        estimator->SetDeadline(std::chrono::steady_clock::now() +
+                               timeout_of(query_params));
+        vector<double> iter =
+            estimator->RunSubpatterns(g_, q, query_params.ratio, masks);
+        est.resize(iter.size(), 0.0);
+        for (size_t m = 0; m < iter.size(); m++)
+          est[m] += iter[m] / query_params.num_iter;
+      }
+    } catch (Estimator::ErrCode e) {
+      estimator->ClearDeadline();
+      cerr << "<subpatterns> error with code " << e << "\n";
+      return false;
+    }
+    estimator->ClearDeadline();
+    time = chrono::duration<double>(Clock::now() - chkpt).count() /
+           query_params.num_iter;
+    return true;
+  }
+#endif
+
+  // Each iteration is one task, or split chunks at ratio / split seeded
+  // (seed + i) * split + c, whose mean is then the iteration's estimate. A
+  // task runs its chunks in turn but hands the second half of those left
+  // to the pool whenever a worker is idle, so one long iteration spreads
+  // over the idle workers while the results do not depend on who ran what.
+  void Submit(WorkStealingPool &pool, const QueryText &text, size_t index,
+              const QueryParams &query_params, Done done) {
+    struct Batch {
+      QueryGraph q;
+      QueryParams params;
+      int split;
+      Done done;
+      string cache_key;
+      std::mutex mutex;
+      vector<double> est, time; // per iteration, summed over the chunks
+      std::atomic<int> tasks;
+      std::atomic<bool> timed_out{false}, partial{false};
+      Batch(const QueryParams &params) : params(params) {}
+    };
+    auto batch = std::make_shared<Batch>(query_params);
+    batch->q.Read(text, index);
+#ifndef RELATION
+    batch->q.MapBounds(g_.GetVertexMap());
+    batch->q.MapLabels(g_.GetVLabelMap(), g_.GetELabelMap());
+#endif
+    if (query_params.cache != nullptr) {
+      auto chkpt = Clock::now();
+      batch->cache_key = CacheKey(batch->q, text, index, query_params);
+      double est, variance;
+      if (query_params.cache->Find(batch->cache_key, est, variance)) {
+        done(true, est,
+             chrono::duration<double>(Clock::now() - chkpt).count(), false);
+        return;
+      }
+    }
+    int num_iter = query_params.num_iter;
+    batch->split = estimators_[0]->EstimatesMean()
+                       ? std::max(query_params.split, 1) : 1;
+    batch->done = done;
+    batch->est.assign(num_iter, 0.0);
+    batch->time.assign(num_iter, 0.0);
+    batch->tasks = num_iter;
+    for (int i = 0; i < num_iter; i++)
+      pool.Submit([this, &pool, batch, i]() {
+        RunChunks(pool, batch, i, 0, batch->split);
+      });
+  }
+
+private:
+  // isomorphic graph queries share a key through their canonical form;
+  // relational queries are keyed by their normalised text
+  string CacheKey(QueryGraph &q, const QueryText &text, size_t index,
+                  const QueryParams &query_params) {
+    if (!fingerprinted_) {
+      fingerprint_ = EstimateCache::Fingerprint(summary_.c_str());
+      fingerprinted_ = true;
+    }
+#ifndef RELATION
+    string query = q.CanonicalForm();
+#else
+    string query = text.Key(index);
+#endif
+    return EstimateCache::Key(method_, fingerprint_, query_params.ratio,
+                              query_params.seed, query_params.num_iter,
+                              query_params.rel_ci, query_params.budget,
+                              query, query_params.target_rse);
+  }
+
+  template <class Batch>
+  void RunChunks(WorkStealingPool &pool, std::shared_ptr<Batch> batch, int i,
+                 int begin, int end) {
+    Estimator *estimator = estimators_[WorkStealingPool::WorkerId()];
+    const QueryParams &params = batch->params;
+    estimator->SetStopping(params.rel_ci, params.budget);
+    estimator->SetProgress(0);
+    estimator->SetNestedRatios(vector<double>());
+    while (begin < end && !batch->timed_out) {
+      if (end - begin > 1 && pool.HasIdle()) {
+        int mid = (begin + end + 1) / 2;
+        batch->tasks++;
+        pool.Submit([this, &pool, batch, i, mid, end]() {
+          RunChunks(pool, batch, i, mid, end);
+        });
+        end = mid;
+      }
+      // chunks may run on several threads, so each gets its own copy
+      QueryGraph q = batch->q;
+      QueryResult result;
+      int seed = batch->split > 1 ? (params.seed + i) * batch->split + begin
+                                  : params.seed + i;
+      try {
+        run_in_process(estimator, numa_local(g_, WorkStealingPool::WorkerId()),
+                       q, params.ratio / batch->split, seed, params, &result);
+      } catch (Estimator::ErrCode e) {
+        batch->timed_out = true;
+        break;
+      }
+      {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        batch->est[i] += result.est;
+        batch->time[i] += result.time;
+        if (result.partial)
+          batch->partial = true;
+      }
+      begin++;
+    }
+    if (--batch->tasks > 0)
+      return;
+    if (batch->timed_out) {
+      batch->done(false, 0.0, 0.0, false);
+      return;
+    }
+    vector<double> est_vec;
+    double est = 0.0, time = 0.0;
+    for (size_t k = 0; k < batch->est.size(); k++) {
+      double e = batch->est[k] / batch->split;
+      if (e > -1e9) {
+        est_vec.push_back(e);
+        time += batch->time[k];
+      }
+    }
+    for (double e : est_vec)
+      est += e;
+    est /= est_vec.size();
+    time /= est_vec.size();
+    if (params.cache != nullptr && !batch->partial && !est_vec.empty()) {
+      double variance = 0.0;
+      for (double e : est_vec)
+        variance += (e - est) * (e - est);
+      params.cache->Put(batch->cache_key, est, variance / est_vec.size());
+    }
+    batch->done(true, est, time, batch->partial);
+  }
+
+  // swaps in the estimators of a finished rebuild, if any
+  void AdoptRebuild() {
+    vector<Estimator *> *next = pending_.exchange(nullptr);
+    if (next == nullptr)
+      return;
+    rebuild_.join();
+    for (Estimator *estimator : estimators_)
+      delete estimator;
+    estimators_.swap(*next);
+    delete next;
+    fingerprinted_ = false;
+  }
+
+  // renames the files of the summary at from, from and from.*, to to
+  static void rename_summary(const string &from, const string &to) {
+    namespace fs = std::filesystem;
+    fs::path p(from);
+    fs::path dir = p.has_parent_path() ? p.parent_path() : fs::path(".");
+    string name = p.filename().string();
+    std::error_code ec;
+    vector<fs::path> files;
+    for (auto &entry : fs::directory_iterator(dir, ec)) {
+      string f = entry.path().filename().string();
+      if (f == name || f.compare(0, name.size() + 1, name + ".") == 0)
+        files.push_back(entry.path());
+    }
+    for (const fs::path &f : files) {
+      fs::path target = dir / (fs::path(to).filename().string() +
+                               f.filename().string().substr(name.size()));
+      if (fs::is_directory(target, ec))
+        fs::remove_all(target, ec);
+      fs::rename(f, target, ec);
+      if (ec)
+        cerr << "cannot rename " << f << ": " << ec.message() << "\n";
+    }
+  }
+
+  // the nice of a rebuild thread
+  static const int REBUILD_NICE = 19;
+
+  // an instance that records its runs to the method's metrics
+  Estimator *NewEstimator() {
+    Estimator *estimator = factory_();
+    estimator->SetMetricsSeries(metrics_series_);
+    return estimator;
+  }
+
+  DataGraph &g_;
+  string method_;
+  string summary_;
+  bool fingerprinted_ = false;
+  uint64_t fingerprint_ = 0;
+  std::function<Estimator *()> factory_;
+  int metrics_series_; // of method_, see Metrics
+  vector<Estimator *> estimators_;
+  // the rebuild running, and the estimators of one that is done
+  std::thread rebuild_;
+  std::atomic<vector<Estimator *> *> pending_{nullptr};
+};
+
+#ifndef RELATION
+// The method "auto": runs each query with the candidate estimator and ratio
+// that ChooseEstimator picks for it (see auto_select.h), announced as an
+// "auto,METHOD,RATIO" line on stderr. A candidate's summary is that of auto
+// with the method in its name, so -b -m auto builds them all; query mode
+// leaves out those that need a summary (not samplers) and have none.
+//
+// GCARE_AUTO_METHODS lists the candidates in order of preference (default
+// AUTO_METHODS), GCARE_AUTO_BUDGET gives the seconds an iteration should
+// take (default AUTO_BUDGET), and with GCARE_AUTO_LOG=path the cost model
+// learns from the observations in path and appends those of every run.
+const char *AUTO_METHODS = "wj,jsub,impr,sumrdf,cset";
+const double AUTO_BUDGET = 1.0;
+// independence over the stars misses the correlation along cycles
+const char *AUTO_ACYCLIC_METHODS[] = {"cset"};
+
+class AutoRunner : public Runner {
+public:
+  explicit AutoRunner(DataGraph &g) : g_(g) {
+    const char *methods = getenv("GCARE_AUTO_METHODS");
+    for (const string &method : tokenize(methods ? methods : AUTO_METHODS, ",")) {
+      auto it = EstimatorFactories().find(method);
+      if (it == EstimatorFactories().end()) {
+        cerr << "GCARE_AUTO_METHODS: unknown method " << method
+             << ", ignored\n";
+        continue;
+      }
+      runners_.emplace_back(new EstimatorRunner(g, method, it->second));
+      bool cyclic = true;
+      for (const char *acyclic : AUTO_ACYCLIC_METHODS)
+        cyclic &= method != acyclic;
+      all_.push_back(AutoCandidate{method, runners_.back()->EstimatesMean(),
+                                   cyclic});
+    }
+    const char *budget = getenv("GCARE_AUTO_BUDGET");
+    budget_ = budget != nullptr ? atof(budget) : AUTO_BUDGET;
+    const char *log = getenv("GCARE_AUTO_LOG");
+    if (log != nullptr) {
+      log_ = log;
+      model_.ReadLog(log);
+    }
+  }
+
+  double Summarize(const char *summary, double p, int seed, bool resume) {
+    double time = 0.0;
+    for (size_t c = 0; c < all_.size(); c++)
+      time += runners_[c]->Summarize(SummaryOf(summary, c).c_str(), p, seed,
+                                     resume);
+    return time;
+  }
+
+  // each candidate's summary gets the whole budget
+  void SetBuildBudget(size_t bytes, double seconds) {
+    for (auto &runner : runners_)
+      runner->SetBuildBudget(bytes, seconds);
+  }
+
+  string BuildReport() {
+    string report;
+    for (size_t c = 0; c < all_.size(); c++) {
+      string r = runners_[c]->BuildReport();
+      if (!r.empty())
+        report += (report.empty() ? "" : " ") + all_[c].method + ":" + r;
+    }
+    return report;
+  }
+
+  bool FixedSummary() { return false; }
+
+  void WriteSummary(const char *summary) {
+    for (size_t c = 0; c < all_.size(); c++)
+      runners_[c]->WriteSummary(SummaryOf(summary, c).c_str());
+  }
+
+  // the candidates are rebuilt instead
+  double UpdateSummary(const char *summary, const char *updates) {
+    return -1;
+  }
+
+  void ReadSummary(const char *summary, int instances) {
+    candidates_.clear();
+    runner_of_.clear();
+    for (size_t c = 0; c < all_.size(); c++) {
+      string path = SummaryOf(summary, c);
+      if (!all_[c].samples && access(path.c_str(), R_OK) != 0)
+        continue;
+      runners_[c]->ReadSummary(path.c_str(), instances);
+      candidates_.push_back(all_[c]);
+      runner_of_.push_back(runners_[c].get());
+    }
+    if (candidates_.empty())
+      cerr << "auto has no candidate with a summary at " << summary << "\n";
+  }
+
+  bool Query(const char *path, vector<string> *text,
+             const QueryParams &query_params, QueryResult *query_result,
+             double &est, double &time, vector<double> *nested_est) {
+    QueryText query_text;
+    if (text != nullptr)
+      query_text.ReadLines(*text);
+    else if (!query_text.ReadFile(path))
+      return false;
+    if (query_text.size() != 1) {
+      cerr << path << " holds " << query_text.size()
+           << " queries, not one (see --batch)\n";
+      return false;
+    }
+    if (candidates_.empty())
+      return false;
+    QueryParams params = query_params;
+    QueryFeatures f = Features(query_text, 0);
+    int c = Choose(f, params);
+    if (!runner_of_[c]->Query(path, text, params, query_result, est, time,
+                              nested_est))
+      return false;
+    Observe(c, f, time);
+    return true;
+  }
+
+  void Submit(WorkStealingPool &pool, const QueryText &text, size_t index,
+              const QueryParams &query_params, Done done) {
+    if (candidates_.empty()) {
+      done(false, 0.0, 0.0, false);
+      return;
+    }
+    QueryParams params = query_params;
+    QueryFeatures f = Features(text, index);
+    int c = Choose(f, params);
+    runner_of_[c]->Submit(pool, text, index, params,
+                          [this, c, f, done](bool ok, double est, double time,
+                                             bool partial) {
+                            if (ok)
+                              Observe(c, f, time);
+                            done(ok, est, time, partial);
+                          });
+  }
+
+private:
+  // summary with auto in its name replaced by candidate c's method
+  string SummaryOf(const string &summary, size_t c) {
+    size_t at = summary.rfind(".auto.");
+    if (at == string::npos)
+      return summary + "." + all_[c].method;
+    return summary.substr(0, at) + "." + all_[c].method +
+           summary.substr(at + 5);
+  }
+
+  QueryFeatures Features(const QueryText &text, size_t index) {
+    QueryGraph q;
+    q.Read(text, index);
+    q.MapLabels(g_.GetVLabelMap(), g_.GetELabelMap());
+    return QueryFeatures(q, g_);
+  }
+
+  // the candidate for f, with params.ratio set to its ratio
+  int Choose(QueryFeatures &f, QueryParams &params) {
+    AutoChoice choice;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      choice = ChooseEstimator(model_, candidates_, f, budget_, params.ratio);
+    }
+    if (candidates_[choice.candidate].samples)
+      params.ratio = choice.ratio;
+    fprintf(stderr, "auto,%s,%g\n", candidates_[choice.candidate].method.c_str(),
+            params.ratio);
+    return choice.candidate;
+  }
+
+  void Observe(int c, const QueryFeatures &f, double time) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    model_.Observe(candidates_[c].method, f.x, time);
+    if (!log_.empty())
+      LinearCostModel::AppendLog(log_.c_str(), candidates_[c].method, f.x,
+                                 time);
+  }
+
+  DataGraph &g_;
+  vector<std::unique_ptr<EstimatorRunner>> runners_; // one per method
+  vector<AutoCandidate> all_; // of runners_
+  // those with a summary, and their runners
+  vector<AutoCandidate> candidates_;
+  vector<EstimatorRunner *> runner_of_;
+  std::mutex mutex_; // guards model_ and the log
+  LinearCostModel model_;
+  double budget_;
+  string log_;
+};
+
+const bool auto_registered =
+    (Registry::Get().methods["auto"] = GCARE_KIND_NAME, true);
+
+// The method "race": runs the candidate estimators on each query at once,
+// one thread each on the same graph, and answers with the first mean
+// estimator whose estimate is confident: positive, of at least
+// RACE_MIN_SAMPLES samples, with a 95% confidence half-width within --ci of
+// it (default RACE_CI), which is also where the estimator stops sampling.
+// The others are then cancelled (see Estimator::Cancel). Without a
+// confident estimate by the deadline, the runs still going estimate from
+// the samples they have, and the answer falls back to one that is not a
+// mean and finished (e.g. cset's), else to the positive estimate of the
+// narrowest confidence interval. The winner is announced as a
+// "race,METHOD" line on stderr. Races run in process whatever -f says, one
+// iteration after the other; each candidate's summary is named as for auto.
+//
+// GCARE_RACE_METHODS lists the candidates (default RACE_METHODS) and
+// GCARE_RACE_BUDGET the seconds a race may take (default RACE_BUDGET, and
+// never more than --timeout).
+const char *RACE_METHODS = "jsub,wj,cset";
+const double RACE_BUDGET = 1.0;
+const double RACE_CI = 0.1;
+const size_t RACE_MIN_SAMPLES = 30;
+
+class RaceRunner : public Runner {
+public:
+  explicit RaceRunner(DataGraph &g) : g_(g) {
+    const char *methods = getenv("GCARE_RACE_METHODS");
+    for (const string &method : tokenize(methods ? methods : RACE_METHODS, ",")) {
+      auto it = EstimatorFactories().find(method);
+      if (it == EstimatorFactories().end()) {
+        cerr << "GCARE_RACE_METHODS: unknown method " << method
+             << ", ignored\n";
+        continue;
+      }
+      runners_.emplace_back(new EstimatorRunner(g, method, it->second));
+      methods_.push_back(method);
+    }
+    const char *budget = getenv("GCARE_RACE_BUDGET");
+    budget_ = budget != nullptr ? atof(budget) : RACE_BUDGET;
+  }
+
+  double Summarize(const char *summary, double p, int seed, bool resume) {
+    double time = 0.0;
+    for (size_t c = 0; c < runners_.size(); c++)
+      time += runners_[c]->Summarize(SummaryOf(summary, c).c_str(), p, seed,
+                                     resume);
+    return time;
+  }
+
+  void SetBuildBudget(size_t bytes, double seconds) {
+    for (auto &runner : runners_)
+      runner->SetBuildBudget(bytes, seconds);
+  }
+
+  string BuildReport() {
+    string report;
+    for (size_t c = 0; c < runners_.size(); c++) {
+      string r = runners_[c]->BuildReport();
+      if (!r.empty())
+        report += (report.empty() ? "" : " ") + methods_[c] + ":" + r;
+    }
+    return report;
+  }
+
+  bool FixedSummary() { return false; }
+
+  void WriteSummary(const char *summary) {
+    for (size_t c = 0; c < runners_.size(); c++)
+      runners_[c]->WriteSummary(SummaryOf(summary, c).c_str());
+  }
+
+  double UpdateSummary(const char *summary, const char *updates) {
+    return -1;
+  }
+
+  // as for auto, a candidate that needs a summary and has none sits out
+  void ReadSummary(const char *summary, int instances) {
+    racing_.clear();
+    for (size_t c = 0; c < runners_.size(); c++) {
+      string path = SummaryOf(summary, c);
+      if (!runners_[c]->EstimatesMean() && access(path.c_str(), R_OK) != 0)
+        continue;
+      runners_[c]->ReadSummary(path.c_str(), instances);
+      racing_.push_back(c);
+    }
+    if (racing_.empty())
+      cerr << "race has no candidate with a summary at " << summary << "\n";
+  }
+
+  bool Query(const char *path, vector<string> *text,
+             const QueryParams &query_params, QueryResult *query_result,
+             double &est, double &time, vector<double> *nested_est) {
+    QueryText query_text;
+    if (text != nullptr)
+      query_text.ReadLines(*text);
+    else if (!query_text.ReadFile(path))
+      return false;
+    if (query_text.size() != 1) {
+      cerr << path << " holds " << query_text.size()
+           << " queries, not one (see --batch)\n";
+      return false;
+    }
+    if (racing_.empty())
+      return false;
+    QueryGraph q = Parse(query_text, 0);
+    est = time = 0.0;
+    for (int i = 0; i < query_params.num_iter; i++) {
+      query_result[i] = QueryResult();
+      if (!Race(q, query_params, 0, query_params.seed + i, query_result[i]))
+        return false;
+      est += query_result[i].est;
+      time += query_result[i].time;
+    }
+    est /= query_params.num_iter;
+    time /= query_params.num_iter;
+    return true;
+  }
+
+  // each iteration's race is a task of its own, on the instances of the
+  // worker running it
+  void Submit(WorkStealingPool &pool, const QueryText &text, size_t index,
+              const QueryParams &query_params, Done done) {
+    if (racing_.empty()) {
+      done(false, 0.0, 0.0, false);
+      return;
+    }
+    struct Batch {
+      QueryParams params;
+      QueryGraph q;
+      std::mutex mutex;
+      double est = 0.0, time = 0.0;
+      bool ok = true, partial = false;
+      std::atomic<int> tasks;
+      Done done;
+      Batch(const QueryParams &params, Done done)
+          : params(params), tasks(params.num_iter), done(done) {}
+    };
+    auto batch = std::make_shared<Batch>(query_params, done);
+    batch->q = Parse(text, index);
+    for (int i = 0; i < query_params.num_iter; i++) {
+      pool.Submit([this, batch, i]() {
+        QueryResult result;
+        bool ok = Race(batch->q, batch->params, WorkStealingPool::WorkerId(),
+                       batch->params.seed + i, result);
+        {
+          std::lock_guard<std::mutex> lock(batch->mutex);
+          batch->ok = batch->ok && ok;
+          batch->est += result.est;
+          batch->time += result.time;
+          batch->partial = batch->partial || result.partial;
+        }
+        if (--batch->tasks > 0)
+          return;
+        int n = batch->params.num_iter;
+        batch->done(batch->ok, batch->est / n, batch->time / n,
+                    batch->partial);
+      });
+    }
+  }
+
+private:
+  string SummaryOf(const string &summary, size_t c) {
+    size_t at = summary.rfind(".race.");
+    if (at == string::npos)
+      return summary + "." + methods_[c];
+    return summary.substr(0, at) + "." + methods_[c] + summary.substr(at + 5);
+  }
+
+  QueryGraph Parse(const QueryText &text, size_t index) {
+    QueryGraph q;
+    q.Read(text, index);
+    // bound vertices and labels are given in input ids
+    q.MapBounds(g_.GetVertexMap());
+    q.MapLabels(g_.GetVLabelMap(), g_.GetELabelMap());
+    return q;
+  }
+
+  // one race on the candidates' instance, its answer in result; false if
+  // no candidate answered
+  bool Race(const QueryGraph &q, const QueryParams &params, int instance,
+            int seed, QueryResult &result) {
+    int n = racing_.size();
+    struct Lane {
+      bool ok = false, partial = false, mean = false;
+      double est = 0.0, variance = -1.0;
+      size_t samples = 0;
+      double done_at = 0.0; // seconds into the race
+    };
+    vector<Lane> lanes(n);
+    vector<Estimator *> estimators(n);
+    double rel_ci = params.rel_ci > 0 ? params.rel_ci : RACE_CI;
+    auto start = Clock::now();
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(
+                            std::min(budget_, params.timeout)));
+    for (int l = 0; l < n; l++) {
+      Estimator *estimator = runners_[racing_[l]]->Instance(instance);
+      estimator->Seed(seed);
+      estimator->SetStopping(rel_ci, 0.0);
+      estimator->SetProgress(0);
+      estimator->SetNestedRatios(vector<double>());
+      estimator->SetDeadline(deadline, true);
+      estimators[l] = estimator;
+    }
+    std::mutex mutex;
+    int winner = -1;
+    vector<std::thread> threads;
+    for (int l = 0; l < n; l++) {
+      threads.emplace_back([&, l]() {
+        Estimator *estimator = estimators[l];
+        Lane lane;
+        QueryGraph lane_q = q;
+        try {
+          lane.est = estimator->Run(numa_local(g_, instance), lane_q,
+                                    params.ratio);
+          lane.ok = true;
+          lane.partial = estimator->Partial();
+          lane.variance = estimator->Variance();
+          lane.samples = estimator->NumSamples();
+        } catch (Estimator::ErrCode) {
+        }
+        lane.done_at = chrono::duration<double>(Clock::now() - start).count();
+        lane.mean = estimator->EstimatesMean();
+        bool confident = lane.ok && lane.mean && lane.est > 0 &&
+                         lane.samples >= RACE_MIN_SAMPLES &&
+                         lane.variance >= 0 &&
+                         1.96 * std::sqrt(lane.variance) <= rel_ci * lane.est;
+        std::lock_guard<std::mutex> lock(mutex);
+        lanes[l] = lane;
+        if (confident && winner < 0) {
+          winner = l;
+          for (int other = 0; other < n; other++)
+            if (other != l)
+              estimators[other]->Cancel();
+        }
+      });
+    }
+    for (std::thread &thread : threads)
+      thread.join();
+    for (Estimator *estimator : estimators)
+      estimator->ClearDeadline();
+    if (winner < 0)
+      winner = Fallback(lanes);
+    result.time = chrono::duration<double>(Clock::now() - start).count();
+    if (winner < 0) {
+      cerr << "race: no candidate answered\n";
+      return false;
+    }
+    const Lane &lane = lanes[winner];
+    result.est = lane.est;
+    result.partial = lane.partial;
+    result.variance = lane.variance;
+    result.samples = lane.samples;
+    fprintf(stderr, "race,%s\n", methods_[racing_[winner]].c_str());
+    return true;
+  }
+
+  // without a confident estimate: the first complete one that is not a
+  // mean, else the positive one of the narrowest relative confidence
+  // interval, else any
+  template <class Lane> static int Fallback(const vector<Lane> &lanes) {
+    int best = -1;
+    for (size_t l = 0; l < lanes.size(); l++)
+      if (lanes[l].ok && !lanes[l].mean && !lanes[l].partial &&
+          (best < 0 || lanes[l].done_at < lanes[best].done_at))
+        best = l;
+    if (best >= 0)
+      return best;
+    double narrowest = std::numeric_limits<double>::infinity();
+    for (size_t l = 0; l < lanes.size(); l++) {
+      if (!lanes[l].ok || lanes[l].est <= 0)
+        continue;
+      double width = lanes[l].variance >= 0
+                         ? std::sqrt(lanes[l].variance) / lanes[l].est
+                         : std::numeric_limits<double>::max();
+      if (best < 0 || width < narrowest) {
+        best = l;
+        narrowest = width;
+      }
+    }
+    for (size_t l = 0; best < 0 && l < lanes.size(); l++)
+      if (lanes[l].ok)
+        best = l;
+    return best;
+  }
+
+  DataGraph &g_;
+  vector<std::unique_ptr<EstimatorRunner>> runners_; // one per method
+  vector<string> methods_;                           // of runners_
+  vector<int> racing_; // those with a summary
+  double budget_;
+};
+
+const bool race_registered =
+    (Registry::Get().methods["race"] = GCARE_KIND_NAME, true);
+#endif
+
+class DataBackend : public Backend {
+public:
+  void Build(const char *text, const char *prefix) {
+#ifdef GCARE_V6D
+    if (strncmp(prefix, "v6d:", 4) == 0)
+      return;
+#endif
+    if (!g_.HasBinary(prefix)) {
+      std::cout << "There is no binary\n";
+#ifndef RELATION
+      // GCARE_PACKED_ADJ=1 writes the adjacency lists compressed
+      const char *packed = getenv("GCARE_PACKED_ADJ");
+      g_.SetPackedAdj(packed != nullptr && string(packed) == "1");
+      // GCARE_WIDE_OFFSETS=1 forces 64-bit offsets, which graphs beyond
+      // INT_MAX adjacency entries get anyway
+      const char *wide = getenv("GCARE_WIDE_OFFSETS");
+      g_.SetWideOffsets(wide != nullptr && string(wide) == "1");
+      // GCARE_LEAN_EDGES=1 drops the per-label edge copy (el_rel_)
+      const char *lean = getenv("GCARE_LEAN_EDGES");
+      g_.SetLeanEdges(lean != nullptr && string(lean) == "1");
+      // GCARE_VLABEL_BITMAP=1 adds bitmaps for frequent vertex labels
+      const char *bitmap = getenv("GCARE_VLABEL_BITMAP");
+      g_.SetVLabelBitmap(bitmap != nullptr && string(bitmap) == "1");
+      // GCARE_EDGE_FILTER=1 adds per-label filters answering HasEdge misses
+      const char *filter = getenv("GCARE_EDGE_FILTER");
+      g_.SetEdgeFilter(filter != nullptr && string(filter) == "1");
+      // GCARE_REORDER=degree|bfs|rcm relabels the vertices for locality
+      const char *reorder = getenv("GCARE_REORDER");
+      string order = reorder != nullptr ? reorder : "";
+      if (order == "degree")
+        g_.SetReorder(REORDER_DEGREE);
+      else if (order == "bfs")
+        g_.SetReorder(REORDER_BFS);
+      else if (order == "rcm")
+        g_.SetReorder(REORDER_RCM);
+      else if (!order.empty())
+        std::cerr << "unknown GCARE_REORDER " << order << ", ignored\n";
+#endif
+      g_.BuildBinary(text, prefix);
+    }
+  }
+
+#ifndef RELATION
+  void SetLabelProjection(const vector<int> &vlabels,
+                          const vector<int> &elabels) {
+    g_.SetLabelProjection(vlabels, elabels);
+  }
+
+  // the sections of the graph the methods read; all for one that is not an
+  // estimator (auto)
+  void SetMethods(const vector<string> &methods) {
+    unsigned sections = 0;
+    for (const string &method : methods) {
+      auto it = EstimatorFactories().find(method);
+      if (it == EstimatorFactories().end()) {
+        sections = SECTION_ALL;
+        break;
+      }
+      std::unique_ptr<Estimator> estimator(it->second());
+      sections |= estimator->DataSections();
+    }
+    g_.SetSections(sections & SECTION_ALL);
+  }
+#endif
+
+  void Load(const char *prefix, LoadMode mode) {
+#ifdef GCARE_V6D
+    // v6d:<object id> reads the fragment group resident in vineyard
+    if (strncmp(prefix, "v6d:", 4) == 0) {
+      LoadV6dGraph(g_, strtoull(prefix + 4, nullptr, 10));
+      return;
+    }
+#endif
+#ifndef RELATION
+    // GCARE_HUB_DEGREE=n indexes adjacency lists of at least n entries
+    const char *hub = getenv("GCARE_HUB_DEGREE");
+    if (hub != nullptr)
+      g_.SetHubDegree(atoi(hub));
+    // GCARE_VERTEX_HEADERS=1 packs each vertex's list bounds in a cache line
+    const char *headers = getenv("GCARE_VERTEX_HEADERS");
+    g_.SetVertexHeaders(headers != nullptr && string(headers) == "1");
+    // GCARE_OUT_OF_CORE=n leaves the adjacency on disk behind an n MB cache
+    const char *ooc = getenv("GCARE_OUT_OF_CORE");
+    if (ooc != nullptr)
+      g_.SetOutOfCore((size_t)std::max(atoll(ooc), 0LL) << 20);
+#else
+    // GCARE_HASH_INDEX=1 answers value lookups from a hash index
+    const char *hash = getenv("GCARE_HASH_INDEX");
+    g_.SetHashIndex(hash != nullptr && string(hash) == "1");
+    // GCARE_RELATION_PACKED=1 reads the packed tables and index the binary
+    // was written with under the same setting
+    const char *packed = getenv("GCARE_RELATION_PACKED");
+    g_.SetPacked(packed != nullptr && string(packed) == "1");
+#endif
+    g_.ReadBinary(prefix, mode);
+#ifdef RELATION
+    graph_views_.clear();
+    for (int i = 0; i < g_.NumGraphs() && g_.NumGraphs() > 1; i++) {
+      graph_views_.emplace_back(new DataGraph);
+      graph_views_.back()->ViewGraph(g_, i);
+    }
+#endif
+#ifndef RELATION
+    // GCARE_NUMA=replicate copies the graph to every NUMA node
+    g_.MakeReplicas();
+    prefix_ = prefix;
+    // GCARE_COMPACT_UPDATES=n merges the edge updates into a new binary at
+    // prefix once n of them piled up
+    const char *compact = getenv("GCARE_COMPACT_UPDATES");
+    compact_updates_ = compact != nullptr ? std::max(atoi(compact), 0) : 0;
+#endif
+  }
+
+#ifndef RELATION
+  // a compaction runs in the background and is swapped in at the first
+  // update after it finished
+  bool UpdateEdge(bool insert, int src, int dst, int el) {
+    bool ok = insert ? g_.InsertEdge(src, dst, el) : g_.DeleteEdge(src, dst, el);
+    if (g_.CompactionDone()) {
+      g_.FinishCompaction();
+      compactions_++;
+    }
+    else if (compact_updates_ > 0 && g_.DeltaSize() >= compact_updates_ &&
+             prefix_.compare(0, 4, "v6d:") != 0)
+      g_.StartCompaction(prefix_.c_str());
+    return ok;
+  }
+#endif
+
+  Runner *NewRunner(const string &method) {
+#ifndef RELATION
+    if (method == "auto")
+      return new AutoRunner(g_);
+    if (method == "race")
+      return new RaceRunner(g_);
+#endif
+    auto it = EstimatorFactories().find(method);
+    if (it == EstimatorFactories().end())
+      return nullptr;
+#ifdef RELATION
+    if (!graph_views_.empty()) {
+      EstimatorFactory factory = it->second;
+      auto &graphs = graph_views_;
+      return new EstimatorRunner(g_, method, [factory, &graphs]() {
+        return new GraphsEstimator(graphs, factory);
+      });
+    }
+#endif
+    return new EstimatorRunner(g_, method, it->second);
+  }
+
+#ifndef RELATION
+  int Compactions() { return compactions_; }
+#endif
+
+private:
+  DataGraph g_;
+#ifdef RELATION
+  // of each graph of a multi-graph binary, none for a single graph
+  vector<unique_ptr<DataGraph>> graph_views_;
+#endif
+#ifndef RELATION
+  string prefix_;
+  size_t compact_updates_ = 0;
+  int compactions_ = 0;
+#endif
+};
+
+const bool registered = (Registry::Get().backends[GCARE_KIND_NAME] =
+                             []() -> Backend * { return new DataBackend; },
+                         true);
+
+} // namespace
+
+}  // namespace GCARE_KIND
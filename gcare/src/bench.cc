@@ -0,0 +1,287 @@
+// Micro-benchmarks of the DataGraph primitives the estimators spend their
+// time in, on a synthetic power-law graph or a loaded .graph binary:
+//
+//   gcare_bench                        # synthetic graph, default size
+//   gcare_bench -d data/yago           # the binary data/yago.graph
+//   gcare_bench -V 1000000 -E 8000000  # synthetic, given size
+//
+// Each primitive runs over a precomputed array of random arguments, so the
+// timed loop does not include drawing them. Prints ns/op and, where the
+// kernel allows perf counters, cache misses per op (best of the repetitions).
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../include/data_graph.h"
+#include "../include/rng.h"
+#include "../include/simd_search.h"
+
+using namespace graph;
+namespace po = boost::program_options;
+
+namespace {
+
+// hardware cache misses of this thread, or unavailable (e.g. in containers
+// with perf_event_paranoid > 2)
+class CacheMissCounter {
+public:
+  CacheMissCounter() {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~CacheMissCounter() {
+    if (fd_ >= 0) close(fd_);
+  }
+  bool Available() const { return fd_ >= 0; }
+  void Start() {
+    if (fd_ < 0) return;
+    ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  long long Stop() {
+    if (fd_ < 0) return 0;
+    ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+    long long count = 0;
+    if (read(fd_, &count, sizeof(count)) != sizeof(count)) return 0;
+    return count;
+  }
+
+private:
+  int fd_;
+};
+
+// keeps results alive so the loops are not optimised away
+volatile long long sink;
+
+void report(const char *name, size_t ops, int reps, CacheMissCounter &misses,
+            const std::function<long long()> &body) {
+  body(); // warm-up
+  double best_ns = 1e300, best_misses = 0;
+  for (int r = 0; r < reps; r++) {
+    misses.Start();
+    auto start = std::chrono::steady_clock::now();
+    sink = body();
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start).count();
+    long long m = misses.Stop();
+    if (ns < best_ns) {
+      best_ns = ns;
+      best_misses = m;
+    }
+  }
+  if (misses.Available())
+    printf("%-28s %10.2f ns/op %10.3f misses/op\n", name, best_ns / ops,
+           best_misses / ops);
+  else
+    printf("%-28s %10.2f ns/op %10s misses/op\n", name, best_ns / ops, "n/a");
+}
+
+// Chung-Lu graph: both ends drawn with probability proportional to
+// (i + 1)^(-1 / (alpha - 1)), i.e. power-law degrees with exponent alpha;
+// edge and vertex labels are Zipf-like, so a few labels dominate as in RDF
+void build_synthetic(DataGraph &g, int num_vertices, long long num_edges,
+                     int num_elabels, int num_vlabels, double alpha,
+                     uint64_t seed) {
+  Rng rng(seed);
+  auto cdf = [](int n, double exponent) {
+    vector<double> c(n);
+    double sum = 0;
+    for (int i = 0; i < n; i++) c[i] = sum += std::pow(i + 1.0, -exponent);
+    for (double &x : c) x /= sum;
+    return c;
+  };
+  auto draw = [&rng](const vector<double> &c) {
+    double u = (rng.Next() >> 11) * 0x1.0p-53;
+    return (int)(std::lower_bound(c.begin(), c.end(), u) - c.begin());
+  };
+  vector<double> vertex_cdf = cdf(num_vertices, 1.0 / (alpha - 1.0));
+  vector<double> elabel_cdf = cdf(num_elabels, 1.0);
+  vector<double> vlabel_cdf = cdf(num_vlabels, 1.0);
+
+  // vertex ids are shuffled so that high degrees are not all adjacent
+  vector<int> perm(num_vertices);
+  for (int i = 0; i < num_vertices; i++) perm[i] = i;
+  for (int i = num_vertices - 1; i > 0; i--)
+    std::swap(perm[i], perm[rng.Uniform(i + 1)]);
+
+  vector<vector<int>> vlabels(num_vertices);
+  for (auto &labels : vlabels) labels.push_back(draw(vlabel_cdf));
+  vector<Edge> edges;
+  edges.reserve(num_edges);
+  for (long long i = 0; i < num_edges; i++) {
+    int src = perm[draw(vertex_cdf)], dst = perm[draw(vertex_cdf)];
+    edges.emplace_back(src, dst, draw(elabel_cdf));
+  }
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  // through the embedded layout, which needs no file
+  g.SetRawData(vlabels, edges);
+  g.MakeBinary();
+  char *buffer = nullptr;
+  size_t size = 0;
+  FILE *fp = open_memstream(&buffer, &size);
+  g.WriteEmbedded(fp);
+  fclose(fp);
+  static vector<char> storage;
+  storage.assign(buffer, buffer + size);
+  free(buffer);
+  g.ClearRawData();
+  g.AttachEmbedded(storage.data());
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  po::options_description desc("gcare_bench options");
+  desc.add_options()("help,h", "Display help message")(
+      "data,d", po::value<string>(), "binary datafile (default: synthetic)")(
+      "vertices,V", po::value<int>()->default_value(1 << 20),
+      "synthetic graph: vertices")(
+      "edges,E", po::value<long long>()->default_value(8 << 20),
+      "synthetic graph: edges before removing duplicates")(
+      "elabels", po::value<int>()->default_value(64),
+      "synthetic graph: edge labels")(
+      "vlabels", po::value<int>()->default_value(16),
+      "synthetic graph: vertex labels")(
+      "alpha", po::value<double>()->default_value(2.1),
+      "synthetic graph: power-law exponent of the degrees")(
+      "ops,n", po::value<size_t>()->default_value(1 << 22),
+      "operations per timed loop")(
+      "reps,r", po::value<int>()->default_value(5), "timed repetitions")(
+      "seed,s", po::value<uint64_t>()->default_value(0), "random seed");
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  if (vm.count("help")) {
+    cout << desc;
+    return 0;
+  }
+  size_t ops = vm["ops"].as<size_t>();
+  int reps = std::max(vm["reps"].as<int>(), 1);
+  uint64_t seed = vm["seed"].as<uint64_t>();
+
+  DataGraph g;
+  auto start = std::chrono::steady_clock::now();
+  if (vm.count("data")) {
+    g.ReadBinary(vm["data"].as<string>().c_str());
+  } else {
+    build_synthetic(g, vm["vertices"].as<int>(), vm["edges"].as<long long>(),
+                    vm["elabels"].as<int>(), vm["vlabels"].as<int>(),
+                    vm["alpha"].as<double>(), seed);
+  }
+  double load_s = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start).count();
+  int num_vertices = g.GetNumVertices(), num_elabels = g.GetNumELabels();
+  printf("graph: %d vertices, %lld edges, %d edge labels (%.2f s to %s)\n",
+         num_vertices, (long long)g.GetNumEdges(), num_elabels, load_s,
+         vm.count("data") ? "load" : "generate");
+  printf("search kernels: %s\n", SimdKernelName());
+  if (num_vertices == 0 || num_elabels == 0) return 0;
+
+  // arguments: a vertex, and a label it has in the direction, so that
+  // lookups hit as in the estimators' walks; a random pair for HasEdge, half
+  // of them real edges
+  Rng rng(seed + 1);
+  struct Arg {
+    int v, el, other;
+    bool dir;
+  };
+  vector<Arg> args(ops);
+  vector<int> elabels;
+  for (size_t i = 0; i < ops; i++) {
+    Arg &a = args[i];
+    a.dir = rng.Uniform(2);
+    a.v = rng.Uniform(num_vertices);
+    range labels = g.GetELabels(a.v, a.dir);
+    a.el = labels.begin == labels.end
+               ? rng.Uniform(num_elabels)
+               : labels.begin[rng.Uniform(labels.end - labels.begin)];
+    range adj = g.GetAdj(a.v, a.el, a.dir);
+    a.other = adj.begin != adj.end && rng.Uniform(2)
+                  ? adj.begin[rng.Uniform(adj.end - adj.begin)]
+                  : (int)rng.Uniform(num_vertices);
+  }
+  for (int el = 0; el < num_elabels; el++)
+    if (g.GetNumEdges(el) > 0) elabels.push_back(el);
+  vector<int> random_labels(ops);
+  for (int &el : random_labels) el = elabels[rng.Uniform(elabels.size())];
+
+  CacheMissCounter misses;
+  report("GetAdj", ops, reps, misses, [&]() {
+    long long sum = 0;
+    for (const Arg &a : args) {
+      range r = g.GetAdj(a.v, a.el, a.dir);
+      sum += r.end - r.begin;
+    }
+    return sum;
+  });
+  report("GetELabelIndex", ops, reps, misses, [&]() {
+    long long sum = 0;
+    for (const Arg &a : args) sum += g.GetELabelIndex(a.v, a.el, a.dir);
+    return sum;
+  });
+  report("HasEdge", ops, reps, misses, [&]() {
+    long long sum = 0;
+    for (const Arg &a : args) sum += g.HasEdge(a.v, a.other, a.el, a.dir);
+    return sum;
+  });
+  report("GetRandomEdge", ops, reps, misses, [&]() {
+    Rng r(seed + 2);
+    long long sum = 0;
+    int t[2];
+    for (int el : random_labels) {
+      g.GetRandomEdge(el, r, t);
+      sum += t[0];
+    }
+    return sum;
+  });
+
+  // search() and Contains() on sorted lists of a given length, the lists
+  // laid out back to back as in the binary graph
+  for (int len : {4, 16, 64, 256, 4096}) {
+    size_t num_lists = std::max<size_t>(1, (1 << 24) / len);
+    vector<int> lists(num_lists * len);
+    for (size_t l = 0; l < num_lists; l++) {
+      int value = 0;
+      for (int i = 0; i < len; i++) lists[l * len + i] = value += 1 + rng.Uniform(4);
+    }
+    vector<pair<int, int>> probes(ops); // (list, target)
+    for (auto &p : probes)
+      p = make_pair((int)rng.Uniform(num_lists), (int)rng.Uniform(len * 5 / 2 + 1));
+    char name[64];
+    snprintf(name, sizeof(name), "search (len %d)", len);
+    report(name, ops, reps, misses, [&]() {
+      long long sum = 0;
+      for (auto &p : probes) {
+        int begin = p.first * len;
+        sum += search(lists.data(), begin, begin + len, p.second);
+      }
+      return sum;
+    });
+    snprintf(name, sizeof(name), "Contains (len %d)", len);
+    report(name, ops, reps, misses, [&]() {
+      long long sum = 0;
+      for (auto &p : probes) {
+        const int *begin = lists.data() + (size_t)p.first * len;
+        sum += Contains(range{begin, begin + len}, p.second);
+      }
+      return sum;
+    });
+  }
+  return 0;
+}
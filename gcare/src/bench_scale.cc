@@ -0,0 +1,475 @@
+// Scalability benchmark: sweeps synthetic graph sizes, edge label counts and
+// thread counts, and reports for each the throughput of the DataGraph
+// primitives and of the estimators, their speedup and parallel efficiency
+// over one thread, and the memory taken:
+//
+//   gcare_bench_scale                              # defaults below
+//   gcare_bench_scale --scales 16,18,20 --elabels 4,64 -t 8 -m wj,cset
+//   gcare_bench_scale -t 16 --threads-list 1,2,4,8,16 -f csv -o scale.csv
+//
+// The graphs are R-MAT graphs of 2^scale vertices and edge-factor edges per
+// vertex, with Zipf-like edge and vertex labels, built in-process through
+// the embedded layout, so no text or binary files are involved. The
+// estimators build their summaries once per graph (in a scratch directory)
+// and run on path and star queries drawn by random walks on the graph, so
+// none is empty; every thread runs its own estimator instance, sharing the
+// summary where the method can, as the in-process threads of gcare do.
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <omp.h>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "../include/estimator.h"
+#include "../include/memory.h"
+#include "../include/rng.h"
+
+using namespace graph;
+namespace po = boost::program_options;
+
+namespace {
+
+// keeps results alive so the loops are not optimised away
+volatile long long sink;
+
+// R-MAT (Chakrabarti et al.): each edge descends scale levels of the
+// adjacency matrix, into the quadrants with probabilities a, b, c and
+// 1 - a - b - c, each level's probabilities perturbed by up to noise so
+// that the degrees are smooth rather than stepped; edge and vertex labels
+// are Zipf-like, so a few labels dominate as in RDF
+void build_rmat(DataGraph &g, vector<char> &storage, int scale,
+                int edge_factor, int num_elabels, int num_vlabels, double a,
+                double b, double c, uint64_t seed) {
+  Rng rng(seed);
+  auto uniform = [&rng]() { return (rng.Next() >> 11) * 0x1.0p-53; };
+  auto zipf = [](int n) {
+    vector<double> cdf(n);
+    double sum = 0;
+    for (int i = 0; i < n; i++) cdf[i] = sum += 1.0 / (i + 1.0);
+    for (double &x : cdf) x /= sum;
+    return cdf;
+  };
+  auto draw = [&uniform](const vector<double> &cdf) {
+    return (int)(std::lower_bound(cdf.begin(), cdf.end(), uniform()) -
+                 cdf.begin());
+  };
+  vector<double> elabel_cdf = zipf(num_elabels);
+  vector<double> vlabel_cdf = zipf(num_vlabels);
+  const double noise = 0.1;
+
+  int num_vertices = 1 << scale;
+  // vertex ids are shuffled so that high degrees are not all adjacent
+  vector<int> perm(num_vertices);
+  for (int i = 0; i < num_vertices; i++) perm[i] = i;
+  for (int i = num_vertices - 1; i > 0; i--)
+    std::swap(perm[i], perm[rng.Uniform(i + 1)]);
+
+  vector<vector<int>> vlabels(num_vertices);
+  for (auto &labels : vlabels) labels.push_back(draw(vlabel_cdf));
+  long long num_edges = (long long)edge_factor * num_vertices;
+  vector<Edge> edges;
+  edges.reserve(num_edges);
+  for (long long i = 0; i < num_edges; i++) {
+    int src = 0, dst = 0;
+    for (int level = 0; level < scale; level++) {
+      double pa = a * (1 - noise + 2 * noise * uniform());
+      double pb = b * (1 - noise + 2 * noise * uniform());
+      double pc = c * (1 - noise + 2 * noise * uniform());
+      double pd = (1 - a - b - c) * (1 - noise + 2 * noise * uniform());
+      double u = uniform() * (pa + pb + pc + pd);
+      int right = u >= pa && (u < pa + pb || u >= pa + pb + pc);
+      int down = u >= pa + pb;
+      src = src << 1 | down;
+      dst = dst << 1 | right;
+    }
+    edges.emplace_back(perm[src], perm[dst], draw(elabel_cdf));
+  }
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  // through the embedded layout, which needs no file
+  g.SetRawData(vlabels, edges);
+  g.MakeBinary();
+  char *buffer = nullptr;
+  size_t size = 0;
+  FILE *fp = open_memstream(&buffer, &size);
+  g.WriteEmbedded(fp);
+  fclose(fp);
+  storage.assign(buffer, buffer + size);
+  free(buffer);
+  g.ClearRawData();
+  g.AttachEmbedded(storage.data());
+}
+
+// A query of edges edges drawn by a random walk from a random edge, as its
+// "v"/"e" lines with unlabelled vertices: a path if star is false, else
+// edges all from the first vertex of the walk. Empty if the walk got stuck
+// within tries attempts.
+vector<string> random_query(DataGraph &g, int edges, bool star, Rng &rng,
+                            int tries = 100) {
+  int num_elabels = g.GetNumELabels();
+  for (int attempt = 0; attempt < tries; attempt++) {
+    int el = rng.Uniform(num_elabels);
+    if (g.GetNumEdges(el) == 0) continue;
+    int t[2];
+    g.GetRandomEdge(el, rng, t);
+    vector<int> vertices = {t[0], t[1]};
+    vector<string> lines = {"e 0 1 " + to_string(el)};
+    bool stuck = false;
+    for (int i = 1; i < edges && !stuck; i++) {
+      int from = star ? 0 : (int)vertices.size() - 1;
+      int v = vertices[from];
+      stuck = true;
+      // a label and direction the vertex has, to a vertex not in the walk
+      for (int k = 0; k < 8 && stuck; k++) {
+        bool dir = rng.Uniform(2);
+        range labels = g.GetELabels(v, dir);
+        if (labels.begin == labels.end) continue;
+        int l = labels.begin[rng.Uniform(labels.end - labels.begin)];
+        int other;
+        if (g.GetRandomAdj(v, l, dir, rng, &other) == 0 ||
+            std::find(vertices.begin(), vertices.end(), other) !=
+                vertices.end())
+          continue;
+        int id = vertices.size();
+        vertices.push_back(other);
+        lines.push_back("e " + to_string(dir ? from : id) + " " +
+                        to_string(dir ? id : from) + " " + to_string(l));
+        stuck = false;
+      }
+    }
+    if (stuck) continue;
+    vector<string> query;
+    for (size_t v = 0; v < vertices.size(); v++)
+      query.push_back("v " + to_string(v) + " -1");
+    query.insert(query.end(), lines.begin(), lines.end());
+    return query;
+  }
+  return {};
+}
+
+// One measured configuration.
+struct Row {
+  int scale, elabels;
+  long long edges;
+  string workload; // a primitive or a method
+  int threads;
+  double ops_per_s;
+  double speedup, efficiency; // over the run of the fewest threads
+  int peak_rss_kb;
+  size_t summary_bytes;
+};
+
+vector<int> int_list(const string &s) {
+  vector<int> list;
+  std::stringstream in(s);
+  for (string item; getline(in, item, ',');)
+    if (!item.empty()) list.push_back(std::stoi(item));
+  return list;
+}
+
+// the operations per second of body(ops, thread) over threads threads,
+// the best of reps repetitions after a warm-up
+double throughput(int threads, size_t ops, int reps,
+                  const std::function<long long(size_t, int)> &body) {
+  double best = 0;
+  for (int r = 0; r <= reps; r++) {
+    auto start = std::chrono::steady_clock::now();
+    long long sum = 0;
+#pragma omp parallel num_threads(threads) reduction(+ : sum)
+    {
+      int t = omp_get_thread_num(), n = omp_get_num_threads();
+      size_t share = ops / n + (size_t(t) < ops % n);
+      sum += body(share, t);
+    }
+    sink = sum;
+    double s = std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start).count();
+    if (r > 0) best = std::max(best, ops / std::max(s, 1e-9));
+  }
+  return best;
+}
+
+void write_table(std::ostream &out, const vector<Row> &rows) {
+  char line[256];
+  snprintf(line, sizeof(line), "%5s %7s %11s %-14s %7s %14s %8s %6s %10s %12s\n",
+           "scale", "elabels", "edges", "workload", "threads", "ops/s",
+           "speedup", "eff", "peak kB", "summary B");
+  out << line;
+  for (const Row &r : rows) {
+    snprintf(line, sizeof(line),
+             "%5d %7d %11lld %-14s %7d %14.1f %8.2f %6.2f %10d %12zu\n",
+             r.scale, r.elabels, r.edges, r.workload.c_str(), r.threads,
+             r.ops_per_s, r.speedup, r.efficiency, r.peak_rss_kb,
+             r.summary_bytes);
+    out << line;
+  }
+}
+
+void write_csv(std::ostream &out, const vector<Row> &rows) {
+  out << "scale,elabels,edges,workload,threads,ops_per_s,speedup,"
+         "efficiency,peak_rss_kb,summary_bytes\n";
+  out.precision(12);
+  for (const Row &r : rows)
+    out << r.scale << "," << r.elabels << "," << r.edges << "," << r.workload
+        << "," << r.threads << "," << r.ops_per_s << "," << r.speedup << ","
+        << r.efficiency << "," << r.peak_rss_kb << "," << r.summary_bytes
+        << "\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  po::options_description desc("gcare_bench_scale options");
+  desc.add_options()("help,h", "Display help message")(
+      "scales", po::value<string>()->default_value("14,16,18"),
+      "graph sizes, log2 of the vertices, separated by commas")(
+      "edge-factor", po::value<int>()->default_value(8),
+      "edges per vertex before removing duplicates")(
+      "elabels", po::value<string>()->default_value("8,64"),
+      "edge label counts, separated by commas")(
+      "vlabels", po::value<int>()->default_value(16), "vertex labels")(
+      "rmat", po::value<string>()->default_value("0.57,0.19,0.19"),
+      "R-MAT quadrant probabilities a,b,c")(
+      "threads,t", po::value<int>()->default_value(omp_get_max_threads()),
+      "most threads; the sweep doubles from 1 up to it")(
+      "threads-list", po::value<string>(),
+      "thread counts, separated by commas, instead of doubling")(
+      "method,m", po::value<string>()->default_value("wj"),
+      "estimator methods, separated by commas; empty for primitives only")(
+      "ratio,p", po::value<double>()->default_value(0.001), "sampling ratio")(
+      "queries,q", po::value<int>()->default_value(8),
+      "queries per shape (paths and stars)")(
+      "query-edges", po::value<int>()->default_value(3), "edges per query")(
+      "runs", po::value<int>()->default_value(64),
+      "estimator runs per configuration, spread over the queries")(
+      "ops,n", po::value<size_t>()->default_value(1 << 22),
+      "primitive operations per configuration")(
+      "reps,r", po::value<int>()->default_value(3), "timed repetitions")(
+      "format,f", po::value<string>()->default_value("table"),
+      "table or csv")("output,o", po::value<string>(),
+                      "output file (default: stdout)")(
+      "seed,s", po::value<uint64_t>()->default_value(0), "random seed");
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  if (vm.count("help")) {
+    cout << desc;
+    return 0;
+  }
+  string format = vm["format"].as<string>();
+  if (format != "table" && format != "csv") {
+    cout << "unknown format " << format << endl;
+    return -1;
+  }
+  vector<int> scales = int_list(vm["scales"].as<string>());
+  vector<int> elabel_counts = int_list(vm["elabels"].as<string>());
+  vector<int> thread_counts;
+  if (vm.count("threads-list")) {
+    thread_counts = int_list(vm["threads-list"].as<string>());
+  } else {
+    int max_threads = std::max(vm["threads"].as<int>(), 1);
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+  }
+  thread_counts.erase(std::remove_if(thread_counts.begin(), thread_counts.end(),
+                                     [](int t) { return t < 1; }),
+                      thread_counts.end());
+  std::sort(thread_counts.begin(), thread_counts.end());
+  thread_counts.erase(std::unique(thread_counts.begin(), thread_counts.end()),
+                      thread_counts.end());
+  if (scales.empty() || elabel_counts.empty() || thread_counts.empty()) {
+    cout << "nothing to sweep" << endl;
+    return -1;
+  }
+  int max_threads = thread_counts.back();
+  vector<double> rmat;
+  for (const string &x : tokenize(vm["rmat"].as<string>(), ","))
+    rmat.push_back(std::stod(x));
+  if (rmat.size() != 3 || rmat[0] + rmat[1] + rmat[2] >= 1) {
+    cout << "--rmat needs a,b,c of a sum below 1" << endl;
+    return -1;
+  }
+  vector<string> methods = tokenize(vm["method"].as<string>(), ",");
+  for (const string &m : methods)
+    if (!EstimatorFactories().count(m)) {
+      cout << "unknown method " << m << " (available: "
+           << Registry::Get().MethodList() << ")" << endl;
+      return -1;
+    }
+  size_t ops = std::max<size_t>(vm["ops"].as<size_t>(), 1);
+  int reps = std::max(vm["reps"].as<int>(), 1);
+  int runs = std::max(vm["runs"].as<int>(), 1);
+  double p = vm["ratio"].as<double>();
+  uint64_t seed = vm["seed"].as<uint64_t>();
+
+  char scratch[] = "/tmp/gcare_bench_scale.XXXXXX";
+  if (mkdtemp(scratch) == nullptr) {
+    perror("scratch directory");
+    return -1;
+  }
+
+  vector<Row> rows;
+  // appends the rows of workload over the thread counts, relative to the
+  // first of them
+  auto sweep = [&](int scale, int elabels, long long edges,
+                   const string &workload, size_t summary_bytes,
+                   size_t workload_ops,
+                   const std::function<long long(size_t, int)> &body) {
+    double base = 0;
+    for (int threads : thread_counts) {
+      resetPeakPhysicalMemoryUsage();
+      Row r;
+      r.scale = scale;
+      r.elabels = elabels;
+      r.edges = edges;
+      r.workload = workload;
+      r.threads = threads;
+      r.ops_per_s = throughput(threads, workload_ops, reps, body);
+      if (base == 0) base = r.ops_per_s;
+      r.speedup = r.ops_per_s / base;
+      r.efficiency = r.speedup * thread_counts[0] / threads;
+      r.peak_rss_kb = getPeakPhysicalMemoryUsage();
+      r.summary_bytes = summary_bytes;
+      rows.push_back(r);
+      cerr << workload << " scale " << scale << " elabels " << elabels
+           << " threads " << threads << ": " << r.ops_per_s << " ops/s\n";
+    }
+  };
+
+  for (int scale : scales) {
+    for (int elabels : elabel_counts) {
+      DataGraph g;
+      vector<char> storage;
+      build_rmat(g, storage, scale, vm["edge-factor"].as<int>(), elabels,
+                 vm["vlabels"].as<int>(), rmat[0], rmat[1], rmat[2], seed);
+      long long edges = g.GetNumEdges();
+      int num_vertices = g.GetNumVertices();
+      int num_elabels = g.GetNumELabels();
+      cerr << "graph: scale " << scale << ", " << num_vertices
+           << " vertices, " << edges << " edges, " << num_elabels
+           << " edge labels, " << storage.size() << " bytes\n";
+      if (num_vertices == 0 || edges == 0) continue;
+
+      // arguments as in gcare_bench: a vertex and a label it has in the
+      // direction; a random pair for HasEdge, half of them real edges
+      Rng rng(seed + 1);
+      struct Arg {
+        int v, el, other;
+        bool dir;
+      };
+      vector<Arg> args(std::min<size_t>(ops, 1 << 20));
+      for (Arg &a : args) {
+        a.dir = rng.Uniform(2);
+        a.v = rng.Uniform(num_vertices);
+        range labels = g.GetELabels(a.v, a.dir);
+        a.el = labels.begin == labels.end
+                   ? rng.Uniform(num_elabels)
+                   : labels.begin[rng.Uniform(labels.end - labels.begin)];
+        range adj = g.GetAdj(a.v, a.el, a.dir);
+        a.other = adj.begin != adj.end && rng.Uniform(2)
+                      ? adj.begin[rng.Uniform(adj.end - adj.begin)]
+                      : (int)rng.Uniform(num_vertices);
+      }
+      // each thread starts at its own offset of the arguments
+      auto arg = [&args](size_t i, int t) -> const Arg & {
+        return args[(i + (size_t)t * 7919) % args.size()];
+      };
+      sweep(scale, elabels, edges, "GetAdj", 0, ops, [&](size_t n, int t) {
+        long long sum = 0;
+        for (size_t i = 0; i < n; i++) {
+          const Arg &a = arg(i, t);
+          range r = g.GetAdj(a.v, a.el, a.dir);
+          sum += r.end - r.begin;
+        }
+        return sum;
+      });
+      sweep(scale, elabels, edges, "HasEdge", 0, ops, [&](size_t n, int t) {
+        long long sum = 0;
+        for (size_t i = 0; i < n; i++) {
+          const Arg &a = arg(i, t);
+          sum += g.HasEdge(a.v, a.other, a.el, a.dir);
+        }
+        return sum;
+      });
+      sweep(scale, elabels, edges, "GetRandomAdj", 0, ops,
+            [&](size_t n, int t) {
+              Rng r(seed + 2 + t);
+              long long sum = 0;
+              int other = 0;
+              for (size_t i = 0; i < n; i++) {
+                const Arg &a = arg(i, t);
+                sum += g.GetRandomAdj(a.v, a.el, a.dir, r, &other) + other;
+              }
+              return sum;
+            });
+
+      if (methods.empty()) continue;
+      vector<QueryGraph> queries;
+      for (bool star : {false, true})
+        for (int i = 0; i < vm["queries"].as<int>(); i++) {
+          vector<string> lines =
+              random_query(g, vm["query-edges"].as<int>(), star, rng);
+          if (lines.empty()) continue;
+          queries.emplace_back();
+          queries.back().ReadText(lines);
+        }
+      if (queries.empty()) {
+        cerr << "no queries could be drawn\n";
+        continue;
+      }
+      for (const string &method : methods) {
+        EstimatorFactory factory = EstimatorFactories()[method];
+        string summary = string(scratch) + "/" + method;
+        vector<unique_ptr<Estimator>> estimators;
+        estimators.emplace_back(factory());
+        estimators[0]->Seed(seed);
+        estimators[0]->Summarize(g, summary.c_str(), p);
+        estimators[0]->ReadSummary(summary.c_str());
+        while ((int)estimators.size() < max_threads) {
+          estimators.emplace_back(factory());
+          if (!estimators.back()->ShareSummary(*estimators[0]))
+            estimators.back()->ReadSummary(summary.c_str());
+        }
+        struct stat st;
+        size_t summary_bytes = stat(summary.c_str(), &st) == 0 ? st.st_size : 0;
+        sweep(scale, elabels, edges, method, summary_bytes, runs,
+              [&](size_t n, int t) {
+                Estimator &e = *estimators[t];
+                long long sum = 0;
+                for (size_t i = 0; i < n; i++) {
+                  e.Seed(seed + i * max_threads + t);
+                  sum += (long long)e.Run(
+                      g, queries[(i * max_threads + t) % queries.size()], p);
+                }
+                return sum;
+              });
+        estimators.clear();
+        remove(summary.c_str());
+      }
+    }
+  }
+  std::filesystem::remove_all(scratch);
+
+  std::ofstream file;
+  if (vm.count("output")) {
+    file.open(vm["output"].as<string>());
+    if (!file) {
+      perror(vm["output"].as<string>().c_str());
+      return -1;
+    }
+  }
+  std::ostream &out = vm.count("output") ? file : cout;
+  if (format == "csv")
+    write_csv(out, rows);
+  else
+    write_table(out, rows);
+  return 0;
+}
@@ -0,0 +1,402 @@
+// End-to-end benchmark of the estimators over a query suite: the data and
+// every method's summary are loaded once, each query runs its iterations
+// in-process, and one row per query and method gives the estimate, its
+// q-error against the true cardinality, the latency percentiles of the
+// iterations, the samples drawn and the peak resident set:
+//
+//   gcare_bench_suite -d data/yago -m wj,jsub,cset -i patterns/ -g truth.txt
+//   gcare_bench_suite -d data/yago -m wj,exact -i suite.txt -f json -o out.json
+//
+// The summaries are those gcare -b builds, PREFIX.METHOD.pRATIO.sSEED with
+// PREFIX the data prefix or --summaries. The truth file holds "NAME COUNT"
+// (or "NAME,COUNT") lines, NAME being the query's name as --batch prints it,
+// its file name, or that without extension; queries it lacks take the
+// estimate of the method "exact" as truth when that runs too. A summary of
+// each method's q-errors and latencies goes to stderr.
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#include "../include/query_suite.h"
+#include "../include/registry.h"
+#include "../include/util.h"
+
+namespace po = boost::program_options;
+
+namespace {
+
+const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+// One method, run on every query.
+struct Method {
+  string name;
+  string summary;
+  double p;
+  Runner *runner;
+};
+
+// The outcome of one method on one query.
+struct Row {
+  string query;
+  const Method *method;
+  bool ok = false;
+  bool partial = false;
+  double est = NaN, truth = NaN, q_error = NaN;
+  vector<double> times; // of the iterations
+  double samples = 0;   // mean per iteration
+  int peak_rss_kb = 0;
+};
+
+// the value at fraction f of the sorted values, by nearest rank
+double percentile(vector<double> values, double f) {
+  if (values.empty())
+    return NaN;
+  std::sort(values.begin(), values.end());
+  size_t rank = (size_t)std::ceil(f * values.size());
+  return values[std::min(std::max<size_t>(rank, 1), values.size()) - 1];
+}
+
+// max(est / truth, truth / est), both taken as at least 1
+double q_error(double est, double truth) {
+  est = std::max(est, 1.0);
+  truth = std::max(truth, 1.0);
+  return std::max(est / truth, truth / est);
+}
+
+std::map<string, double> read_truth(const string &path) {
+  std::map<string, double> truth;
+  std::ifstream in(path);
+  if (!in)
+    cerr << path << " cannot be read\n";
+  for (string line; getline(in, line);) {
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    string name;
+    double count;
+    if (fields >> name >> count)
+      truth[name] = count;
+  }
+  return truth;
+}
+
+// the truth of the query name: by name, file name, or file name without
+// extension, keeping any "#ID"
+double find_truth(const std::map<string, double> &truth, const string &name) {
+  size_t slash = name.rfind('/');
+  string base = slash == string::npos ? name : name.substr(slash + 1);
+  size_t hash = base.find('#');
+  string id = hash == string::npos ? string() : base.substr(hash);
+  string stem = base.substr(0, hash);
+  size_t dot = stem.rfind('.');
+  if (dot != string::npos && dot > 0)
+    stem.erase(dot);
+  for (const string &key : {name, base, stem + id}) {
+    auto it = truth.find(key);
+    if (it != truth.end())
+      return it->second;
+  }
+  return NaN;
+}
+
+// a double as JSON, null if it is not finite
+string json_number(double x) {
+  if (!std::isfinite(x))
+    return "null";
+  std::ostringstream os;
+  os.precision(12);
+  os << x;
+  return os.str();
+}
+
+// a string as a JSON string
+string json_string(const string &s) {
+  string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+// a string as a CSV field
+string csv_field(const string &s) {
+  if (s.find_first_of(",\"\n") == string::npos)
+    return s;
+  string out = "\"";
+  for (char c : s) {
+    if (c == '"')
+      out += '"';
+    out += c;
+  }
+  return out + "\"";
+}
+
+const double LATENCY_PERCENTILES[] = {0.5, 0.9, 0.99};
+const char *const LATENCY_NAMES[] = {"p50", "p90", "p99"};
+
+void write_csv(std::ostream &out, const vector<Row> &rows) {
+  out << "query,method,ratio,estimate,truth,q_error,iterations";
+  for (const char *name : LATENCY_NAMES)
+    out << ",latency_" << name;
+  out << ",latency_max,samples,peak_rss_kb,partial\n";
+  out.precision(12);
+  for (const Row &row : rows) {
+    out << csv_field(row.query) << "," << row.method->name << ","
+        << row.method->p << "," << row.est << "," << row.truth << ","
+        << row.q_error << "," << row.times.size();
+    for (double f : LATENCY_PERCENTILES)
+      out << "," << percentile(row.times, f);
+    out << "," << percentile(row.times, 1.0) << "," << row.samples << ","
+        << row.peak_rss_kb << "," << row.partial << "\n";
+  }
+}
+
+// per method: the q-errors of the queries with a truth, and the mean
+// iteration latencies of all it ran
+struct Summary {
+  const Method *method;
+  size_t queries = 0, failed = 0;
+  vector<double> q_errors, latencies;
+  int peak_rss_kb = 0;
+};
+
+vector<Summary> summarize(const vector<Method> &methods,
+                          const vector<Row> &rows) {
+  vector<Summary> summaries(methods.size());
+  for (size_t j = 0; j < methods.size(); j++)
+    summaries[j].method = &methods[j];
+  for (size_t k = 0; k < rows.size(); k++) {
+    const Row &row = rows[k];
+    Summary &s = summaries[k % methods.size()];
+    s.queries++;
+    if (!row.ok) {
+      s.failed++;
+      continue;
+    }
+    if (!std::isnan(row.q_error))
+      s.q_errors.push_back(row.q_error);
+    double sum = 0;
+    for (double t : row.times)
+      sum += t;
+    s.latencies.push_back(sum / row.times.size());
+    s.peak_rss_kb = std::max(s.peak_rss_kb, row.peak_rss_kb);
+  }
+  return summaries;
+}
+
+const double Q_ERROR_PERCENTILES[] = {0.5, 0.9, 0.99, 1.0};
+const char *const Q_ERROR_NAMES[] = {"p50", "p90", "p99", "max"};
+
+void write_json(std::ostream &out, const vector<Row> &rows,
+                const vector<Summary> &summaries) {
+  out << "{\"queries\":[";
+  for (size_t k = 0; k < rows.size(); k++) {
+    const Row &row = rows[k];
+    out << (k ? ",\n" : "\n") << "{\"query\":" << json_string(row.query)
+        << ",\"method\":" << json_string(row.method->name)
+        << ",\"ratio\":" << json_number(row.method->p)
+        << ",\"estimate\":" << json_number(row.est)
+        << ",\"truth\":" << json_number(row.truth)
+        << ",\"q_error\":" << json_number(row.q_error)
+        << ",\"latency\":{";
+    for (size_t i = 0; i < 3; i++)
+      out << json_string(LATENCY_NAMES[i]) << ":"
+          << json_number(percentile(row.times, LATENCY_PERCENTILES[i])) << ",";
+    out << "\"max\":" << json_number(percentile(row.times, 1.0))
+        << "},\"times\":[";
+    for (size_t i = 0; i < row.times.size(); i++)
+      out << (i ? "," : "") << json_number(row.times[i]);
+    out << "],\"samples\":" << json_number(row.samples)
+        << ",\"peak_rss_kb\":" << row.peak_rss_kb
+        << ",\"partial\":" << (row.partial ? "true" : "false") << "}";
+  }
+  out << "\n],\"methods\":[";
+  for (size_t j = 0; j < summaries.size(); j++) {
+    const Summary &s = summaries[j];
+    out << (j ? ",\n" : "\n") << "{\"method\":" << json_string(s.method->name)
+        << ",\"queries\":" << s.queries << ",\"failed\":" << s.failed
+        << ",\"q_error\":{";
+    for (size_t i = 0; i < 4; i++)
+      out << (i ? "," : "") << json_string(Q_ERROR_NAMES[i]) << ":"
+          << json_number(percentile(s.q_errors, Q_ERROR_PERCENTILES[i]));
+    out << "},\"latency\":{";
+    for (size_t i = 0; i < 3; i++)
+      out << (i ? "," : "") << json_string(LATENCY_NAMES[i]) << ":"
+          << json_number(percentile(s.latencies, LATENCY_PERCENTILES[i]));
+    out << "},\"peak_rss_kb\":" << s.peak_rss_kb << "}";
+  }
+  out << "\n]}\n";
+}
+
+void print_summaries(const vector<Summary> &summaries) {
+  for (const Summary &s : summaries) {
+    cerr << s.method->name << ": " << s.queries << " queries, " << s.failed
+         << " failed; q-error";
+    for (size_t i = 0; i < 4; i++)
+      cerr << " " << Q_ERROR_NAMES[i] << " "
+           << percentile(s.q_errors, Q_ERROR_PERCENTILES[i]);
+    cerr << " (" << s.q_errors.size() << " with truth); seconds";
+    for (size_t i = 0; i < 3; i++)
+      cerr << " " << LATENCY_NAMES[i] << " "
+           << percentile(s.latencies, LATENCY_PERCENTILES[i]);
+    cerr << "; peak " << s.peak_rss_kb << " kB\n";
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  po::options_description desc("gcare_bench_suite");
+  desc.add_options()("help,h", "Display help message")(
+      "data,d", po::value<string>(), "binary data prefix")(
+      "method,m", po::value<string>(),
+      "estimator methods, separated by commas")(
+      "input,i", po::value<string>(),
+      "the queries: a directory of query files, a file listing them, or a "
+      "suite of \"t # ID\" queries")(
+      "truth,g", po::value<string>(),
+      "true cardinalities, \"NAME COUNT\" lines")(
+      "summaries", po::value<string>(),
+      "prefix of the summaries (default: the data prefix)")(
+      "ratio,p", po::value<double>()->default_value(0.03), "sampling ratio")(
+      "iteration,n", po::value<int>()->default_value(10),
+      "iterations per query")("seed,s", po::value<int>()->default_value(0),
+                              "random seed")(
+      "threads,t", po::value<int>()->default_value(1),
+      "iterations run concurrently")(
+      "timeout", po::value<double>()->default_value(300),
+      "seconds an iteration may take before the query fails")(
+      "format,f", po::value<string>()->default_value("csv"), "csv or json")(
+      "output,o", po::value<string>(), "output file (default: stdout)");
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  if (vm.count("help") || !vm.count("data") || !vm.count("method") ||
+      !vm.count("input")) {
+    cout << desc;
+    return -1;
+  }
+  string format = vm["format"].as<string>();
+  if (format != "csv" && format != "json") {
+    cout << "unknown format " << format << endl;
+    return -1;
+  }
+
+  string data = vm["data"].as<string>();
+  string prefix = vm.count("summaries") ? vm["summaries"].as<string>() : data;
+  double p = vm["ratio"].as<double>();
+  int seed = vm["seed"].as<int>();
+  int num_threads = std::max(vm["threads"].as<int>(), 1);
+  std::ostringstream ratio;
+  ratio << p;
+
+  vector<Method> methods;
+  std::map<string, std::unique_ptr<Backend>> backends;
+  for (const string &name : tokenize(vm["method"].as<string>(), ",")) {
+    string kind = Registry::Get().KindOf(name);
+    if (kind.empty()) {
+      cout << "unknown method " << name << " (available: "
+           << Registry::Get().MethodList() << ")" << endl;
+      return -1;
+    }
+    if (!backends.count(kind)) {
+      backends[kind].reset(Registry::Get().backends[kind]());
+      backends[kind]->Load(data.c_str(), LOAD_COPY);
+    }
+    Method m;
+    m.name = name;
+    m.p = p;
+    m.summary = prefix + "." + name;
+    if (name == "bsk") {
+      const char *budget = getenv("GCARE_BSK_BUDGET");
+      if (budget == nullptr) {
+        cout << "bsk needs GCARE_BSK_BUDGET" << endl;
+        return -1;
+      }
+      m.summary += string(".b") + budget;
+      m.p = std::stod(budget);
+    } else {
+      m.summary += ".p" + ratio.str();
+    }
+    m.summary += ".s" + to_string(seed);
+    m.runner = backends[kind]->NewRunner(name);
+    m.runner->ReadSummary(m.summary.c_str(), num_threads);
+    methods.push_back(m);
+  }
+
+  QuerySuite suite;
+  if (!suite.Read(vm["input"].as<string>()))
+    return -1;
+  std::map<string, double> truth;
+  if (vm.count("truth"))
+    truth = read_truth(vm["truth"].as<string>());
+
+  int num_iter = std::max(vm["iteration"].as<int>(), 1);
+  QueryParams params(num_iter, seed, p, false, num_threads);
+  params.timeout = vm["timeout"].as<double>();
+  params.report_memory = true;
+  vector<QueryResult> results(num_iter);
+  vector<Row> rows;
+  for (const QuerySuite::Entry &entry : suite.entries) {
+    const QueryText &text = suite.Text(entry);
+    vector<string> lines;
+    if (text.size() > 0)
+      lines = text.Lines(entry.query);
+    size_t first = rows.size();
+    double exact = NaN;
+    for (const Method &m : methods) {
+      Row row;
+      row.query = entry.name;
+      row.method = &m;
+      params.ratio = m.p;
+      double est, time;
+      if (!lines.empty() && m.runner->Query(entry.name.c_str(), &lines, params,
+                                            results.data(), est, time)) {
+        row.ok = true;
+        row.est = est;
+        for (const QueryResult &r : results) {
+          row.times.push_back(r.time);
+          row.samples += r.samples / (double)num_iter;
+          row.peak_rss_kb = std::max(row.peak_rss_kb, r.m_est);
+          row.partial |= r.partial;
+        }
+        if (m.name == "exact")
+          exact = est;
+      }
+      rows.push_back(row);
+    }
+    double t = find_truth(truth, entry.name);
+    if (std::isnan(t))
+      t = exact;
+    for (size_t k = first; k < rows.size(); k++) {
+      rows[k].truth = t;
+      if (rows[k].ok && !std::isnan(t))
+        rows[k].q_error = q_error(rows[k].est, t);
+    }
+  }
+
+  vector<Summary> summaries = summarize(methods, rows);
+  std::ofstream file;
+  if (vm.count("output")) {
+    file.open(vm["output"].as<string>());
+    if (!file) {
+      perror(vm["output"].as<string>().c_str());
+      return -1;
+    }
+  }
+  std::ostream &out = vm.count("output") ? file : cout;
+  if (format == "json")
+    write_json(out, rows, summaries);
+  else
+    write_csv(out, rows);
+  print_summaries(summaries);
+  for (Method &m : methods)
+    delete m.runner;
+  return 0;
+}
@@ -5,8 +5,14 @@
 #include <filesystem>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <cstring>
 
-BoundSketch::BoundSketch() {
+namespace relational {
+
+REGISTER_ESTIMATOR("bsk", BoundSketch);
+
+BoundSketch::BoundSketch() : num_queries_(0), summary_(nullptr), summary_size_(0), summary_mode_(LOAD_MMAP), built_buckets_(0) {
     sketch_map_.clear();
     offline_skethces_.clear();
 }
@@ -16,48 +22,222 @@ void BoundSketch::PrepareSummaryStructure(DataGraph& g, double ratio) {
     buckets_ = ratio;
     assert(buckets_ >= 1);
 
+    int num = g.NumTables();
+    //under a byte budget, the largest budget of buckets up to ratio, by
+    //halving, whose archive fits; the queries read it off the sketches
+    if (max_summary_bytes_ > 0) {
+        auto bytes = [&](int buckets) {
+            size_t ints = 3;
+            for (int t = 0; t < num; t++)
+                ints += OfflineSketch(t, buckets, &g).archive_ints();
+            return sizeof(int) * ints;
+        };
+        while (buckets_ > 1 && bytes(buckets_) > max_summary_bytes_)
+            buckets_ /= 2;
+        if (buckets_ < ratio)
+            build_report_ = "budget " + to_string(buckets_) + " of " + to_string((int)ratio);
+        if (bytes(buckets_) > max_summary_bytes_)
+            build_report_ += string(build_report_.empty() ? "" : ", ") + "the coarsest sketches take " + to_string(bytes(buckets_)) + " bytes";
+    }
     offline_skethces_.clear();
-#ifdef PARALLEL_BUILD
-    int num = g.table_.size();
-    omp_lock_t lock;
-    omp_init_lock(&lock);
-    omp_set_num_threads(16);
-#pragma omp parallel for num_threads(16) 
-    for (int t = 0; t < num; t++) 
-    {
-        OfflineSketch *s = new OfflineSketch(t, buckets_, &g);
-        omp_set_lock(&lock);
-        offline_skethces_.push_back(s);
-        omp_unset_lock(&lock);
+    for (int t = 0; t < num; t++)
+        offline_skethces_.push_back(new OfflineSketch(t, buckets_, &g));
+
+    //the tables are built a group of at least CHECKPOINT_ROWS rows at a
+    //time, those done checkpointed between groups when due
+    int done = 0;
+    if (FILE* fp = ReadCheckpoint()) {
+        done = loadSketches(fp);
+        if (done > 0)
+            fprintf(stderr, "bsk: resuming after %d of %d tables\n", done, num);
+        else
+            fprintf(stderr, "bsk: checkpoint is of another build, starting over\n");
+        fclose(fp);
     }
-#else
-    for (int t = 0; t < g.table_.size(); t++) {
-        OfflineSketch *s = new OfflineSketch(t, buckets_, &g);
-        offline_skethces_.push_back(s);
+    while (done < num) {
+        int end = done;
+        size_t rows = 0;
+        while (end < num && rows < CHECKPOINT_ROWS)
+            rows += offline_skethces_[end++]->num_rows();
+        buildSketches(vector<OfflineSketch*>(offline_skethces_.begin() + done, offline_skethces_.begin() + end));
+        done = end;
+        if (done < num && CheckpointDue())
+            WriteCheckpoint([&](FILE* fp) { saveSketches(fp, done); });
     }
 #endif
+}
+
+//builds the counts of the sketches of some tables
+void BoundSketch::buildSketches(const vector<OfflineSketch*>& sketches) {
+#ifndef ONLINE
+    //a table is split into ranges of at least MIN_RANGE rows, up to one
+    //per thread, so a large one keeps the threads busy on its own
+    const size_t MIN_RANGE = 1 << 16;
+    size_t num_threads = omp_get_max_threads();
+    auto num_ranges = [&](size_t rows) {
+        return std::max<size_t>(1, std::min(num_threads, rows / MIN_RANGE));
+    };
+
+    //1. sort each column by ranges, then merge them pairwise
+    struct Column {
+        OfflineSketch* s;
+        int c;
+        vector<size_t> bounds;
+    };
+    vector<Column> columns;
+    for (OfflineSketch* s : sketches) {
+        size_t rows = s->num_rows(), n = num_ranges(rows);
+        for (int c = 0; c < s->num_cols(); c++) {
+            s->sorted[c].resize(rows);
+            vector<size_t> bounds;
+            for (size_t r = 0; r <= n; r++)
+                bounds.push_back(rows * r / n);
+            columns.push_back(Column{s, c, bounds});
+        }
+    }
+    vector<pair<int, int>> tasks; //(column, first range)
+    for (int i = 0; i < (int)columns.size(); i++)
+        for (int r = 0; r + 1 < (int)columns[i].bounds.size(); r++)
+            tasks.emplace_back(i, r);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < (int)tasks.size(); i++) {
+        Column& col = columns[tasks[i].first];
+        int r = tasks[i].second;
+        col.s->sort(col.c, col.bounds[r], col.bounds[r + 1]);
+    }
+    for (int width = 1; ; width *= 2) {
+        tasks.clear();
+        for (int i = 0; i < (int)columns.size(); i++) {
+            int n = columns[i].bounds.size() - 1;
+            for (int r = 0; r + width < n; r += 2 * width)
+                tasks.emplace_back(i, r);
+        }
+        if (tasks.empty())
+            break;
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int i = 0; i < (int)tasks.size(); i++) {
+            Column& col = columns[tasks[i].first];
+            int r = tasks[i].second, n = col.bounds.size() - 1;
+            col.s->merge(col.c, col.bounds[r], col.bounds[r + width], col.bounds[std::min(r + 2 * width, n)]);
+        }
+    }
+
+    //2. count every (table, hash configuration) by column and range of
+    //value runs; a column of several ranges counts them apart and adds
+    //them up in order
+    struct Part {
+        OfflineSketch* s;
+        int config, c;
+        size_t begin, end;
+        bool own; //counts of its own, to combine
+        vector<int> unc, con;
+    };
+    vector<Part> parts;
+    for (OfflineSketch* s : sketches) {
+        for (int c = 0; c < s->num_cols(); c++) {
+            vector<size_t> bounds = s->split(c, num_ranges(s->num_rows()));
+            for (int config = 0; config < s->num_configs(); config++) {
+                if (s->skipped(config))
+                    continue;
+                if (c == 0)
+                    s->clear(config);
+                for (size_t r = 0; r + 1 < bounds.size(); r++)
+                    parts.push_back(Part{s, config, c, bounds[r], bounds[r + 1], bounds.size() > 2, {}, {}});
+            }
+        }
+    }
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < (int)parts.size(); i++) {
+        Part& p = parts[i];
+        if (!p.own) {
+            p.s->count(p.config, p.c, p.begin, p.end, p.s->unc_2D[p.config], p.s->con_2D[p.c][p.config]);
+            continue;
+        }
+        p.unc.assign(p.s->config_size(p.config), 0);
+        p.con.assign(p.s->config_size(p.config), 0);
+        p.s->count(p.config, p.c, p.begin, p.end, p.unc, p.con);
+    }
+    for (Part& p : parts) {
+        if (p.own)
+            p.s->combine(p.config, p.c, p.unc, p.con);
+    }
+    for (OfflineSketch* s : sketches)
+        s->release();
 #endif
 }
 
+//checkpoint of a build (see CHECKPOINT_MAGIC) whose first done tables are
+//built
+void BoundSketch::saveSketches(FILE* fp, int done) {
+    int header[5] = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, buckets_, (int)offline_skethces_.size(), done};
+    fwrite(header, sizeof(int), 5, fp);
+    for (OfflineSketch* s : offline_skethces_) {
+        uint64_t rows = s->num_rows();
+        fwrite(&rows, sizeof(rows), 1, fp);
+    }
+    for (int t = 0; t < done; t++)
+        offline_skethces_[t]->save(fp);
+}
+
+//the tables a checkpoint of this build has built, their counts loaded; 0
+//if it is of another build
+int BoundSketch::loadSketches(FILE* fp) {
+    int header[5];
+    if (fread(header, sizeof(int), 5, fp) != 5 || header[0] != CHECKPOINT_MAGIC ||
+        header[1] != CHECKPOINT_VERSION || header[2] != buckets_ ||
+        header[3] != (int)offline_skethces_.size() || header[4] < 0 || header[4] > header[3])
+        return 0;
+    for (OfflineSketch* s : offline_skethces_) {
+        uint64_t rows;
+        if (fread(&rows, sizeof(rows), 1, fp) != 1 || rows != s->num_rows())
+            return 0;
+    }
+    for (int t = 0; t < header[4]; t++)
+        if (!offline_skethces_[t]->load(fp))
+            return 0;
+    return header[4];
+}
+
 void BoundSketch::WriteSummary(const char* fn) {
 #ifndef ONLINE
     namespace fs = std::filesystem;
-	fs::create_directory(fn);
-    int num = offline_skethces_.size();
-#ifdef PARALLEL_BUILD
-#pragma omp parallel for num_threads(16) 
-#endif
-    for (int i = 0; i < num; i++) 
-    {
-        offline_skethces_[i]->serialize(fn);
-    }
+    //replaces a text summary directory of an earlier version
+    if (fs::is_directory(fn))
+        fs::remove_all(fn);
+    OfflineSketch::write(fn, offline_skethces_);
 #endif
 }
 
 void BoundSketch::ReadSummary(const char* fn) {
     sketch_map_.clear();
+    last_use_.clear();
 #ifndef ONLINE
-	OfflineSketch::deserialize(fn, sketch_map_, g);
+    namespace fs = std::filesystem;
+    UnloadFile(summary_, summary_size_, summary_mode_);
+    summary_ = nullptr;
+    summary_size_ = 0;
+    archive_entries_.clear();
+    //a build under a byte budget may have had fewer buckets than asked
+    //for; the largest one-dimensional sketch has all of them
+    built_buckets_ = 0;
+    if (fs::is_directory(fn)) {
+        OfflineSketch::deserialize(fn, sketch_map_, g);
+        for (auto& p : sketch_map_)
+            if (p.first.num_hash == 1)
+                built_buckets_ = std::max(built_buckets_, p.first.hash_sizes[0]);
+    } else {
+        summary_mode_ = SummaryLoadMode();
+        summary_ = LoadFile(fn, summary_size_, summary_mode_);
+        if (summary_ == nullptr) {
+            fprintf(stderr, "cannot load %s\n", fn);
+            exit(EXIT_FAILURE);
+        }
+        if (!OfflineSketch::index((const int*) summary_, summary_size_ / sizeof(int),
+                archive_entries_, built_buckets_)) {
+            fprintf(stderr, "%s: corrupt or unsupported sketch archive\n", fn);
+            exit(EXIT_FAILURE);
+        }
+    }
     for (OfflineSketch* s : offline_skethces_)
         delete s;
     offline_skethces_.clear();
@@ -68,7 +248,36 @@ void BoundSketch::Init() {
     sketch_build_time_ = 0;
 	buckets_ = sample_ratio;
     assert(buckets_ >= 1);
+    if (built_buckets_ > 0 && built_buckets_ < buckets_) {
+        buckets_ = built_buckets_;
+    }
 	bf_index_ = -1;
+    const char* prune = getenv("GCARE_BSK_PRUNE");
+    prune_ = prune == nullptr || strcmp(prune, "0") != 0;
+    pruned_card_ = -1;
+    const char* cache = getenv("GCARE_BSK_CACHE");
+    cache_capacity_ = cache != nullptr ? atol(cache) : 4096;
+    num_queries_++;
+}
+
+//drops the least recently used online sketches beyond cache_capacity_;
+//called before a query looks any up, so none is in use
+void BoundSketch::evictSketches() {
+    if (last_use_.size() <= cache_capacity_)
+        return;
+    vector<pair<long, SketchKey>> byUse;
+    byUse.reserve(last_use_.size());
+    for (auto& p : last_use_)
+        byUse.emplace_back(p.second, p.first);
+    size_t excess = byUse.size() - cache_capacity_;
+    nth_element(byUse.begin(), byUse.begin() + excess, byUse.end(),
+        [](const pair<long, SketchKey>& a, const pair<long, SketchKey>& b) { return a.first < b.first; });
+    for (size_t i = 0; i < excess; i++) {
+        auto it = sketch_map_.find(byUse[i].second);
+        delete it->second;
+        sketch_map_.erase(it);
+        last_use_.erase(byUse[i].second);
+    }
 }
 
 int BoundSketch::DecomposeQuery() {
@@ -76,11 +285,18 @@ int BoundSketch::DecomposeQuery() {
 }
 
 //generates all bounding formulae as an intialization
-//and returns a bounding formula (with index bf_index_) for each call
+//and returns a bounding formula (with index bf_index_) for each call;
+//in the (default) pruned mode the first call evaluates all of them and
+//EstCard returns their minimum once
 bool BoundSketch::GetSubstructure(int subquery_index) {
 	if (bf_index_ == -1) {
 		getJoinAttributeCovers();
         getBoundFormulae();
+        if (prune_ && has_join_attribute_ && !bound_formulae_.empty()) {
+            pruned_card_ = minBoundFormula();
+            bf_index_ = bound_formulae_.size() - 1;
+            return true;
+        }
 	}
     bf_index_++;
     if (bf_index_ == bound_formulae_.size())
@@ -162,8 +378,12 @@ void BoundSketch::getJoinAttributeCovers(int pos) {
 //generate all bounding formulae
 void BoundSketch::getBoundFormulae() {
     bound_formulae_.clear();
+#ifdef ONLINE
+    evictSketches();
+#endif
 
     int curr = 0;
+    vector<Sketch*> fresh; //built online for this query
 
     for (auto& map : rel_to_covered_attributes_) {
         vector<Sketch*> uncL;
@@ -272,45 +492,32 @@ void BoundSketch::getBoundFormulae() {
             vector<int> bounds;
             vector<int> bound_cols;
 
-            /* build a probe to see if we already saw this particular sketch from another query */
-            string probe;
+            /* look the sketch up, online ones also by their bounds */
             int alias = g->get_table_id(rel.id); 
-            probe.append(to_string(alias));
-            probe.append("[");
-			//this wastes computation for TwoDimensionalSketchCon!
-            probe.append(to_string(active_col));
-            probe.append("][");
-            for (int h : hash_sizes) {
-                probe.append(to_string(h));
-                probe.append(", ");
-            }
-            probe.append("][");
-            for (int c : join_cols) {
-                probe.append(to_string(c));
-                probe.append(", ");
-            }
-            probe.append("][");
             for (auto& a : rel.attrs) {
 #ifdef ONLINE
                 if (a.is_bound) {
-                    probe.append(to_string(a.pos)); 
-                    probe.append(":"); 
-                    probe.append(to_string(a.bound)); 
-                    probe.append(", ");
                     bounds.push_back(a.bound);
                     bound_cols.push_back(a.pos);
                 }
 #endif
             }
-            probe.append("]");
-            if (sketch_map_.find(probe) != sketch_map_.end()) {
-                s = sketch_map_[probe];
+            if (alias >= 0 && alias < archive_entries_.size() && !archive_entries_[alias].empty()) {
+                OfflineSketch::attach((const int*) summary_, archive_entries_[alias], sketch_map_, g,
+                    summary_mode_ == LOAD_LAZY);
+                vector<int>().swap(archive_entries_[alias]);
+            }
+			//this wastes computation for TwoDimensionalSketchCon!
+            SketchKey key(alias, active_col, hash_sizes, join_cols, bounds, bound_cols);
+            auto found = sketch_map_.find(key);
+            if (found != sketch_map_.end()) {
+                s = found->second;
             } else {
 #ifndef ONLINE
                 assert(false); //should have been preprocessed offline! 
 #endif
-                auto ckpt = chrono::high_resolution_clock::now();
-                //# of partitioned attributes
+                //# of partitioned attributes; counted below, with the others
+                //this query needs
                 if (join_attrs_specific.size() == 0) {
                     if (active_col == -1)
                         s = new ZeroDimensionalSketchUnc(alias, active_col, join_cols, hash_sizes, bounds, bound_cols, g, ""); 
@@ -332,10 +539,12 @@ void BoundSketch::getBoundFormulae() {
                     cerr << "you're asking for too many attributes..." << endl;
                     exit(-1);
                 }
-                auto elapsed_nano = chrono::high_resolution_clock::now() - ckpt;
-                sketch_build_time_ += (double) elapsed_nano.count() / 1000000; //in milliseconds
-                sketch_map_[probe] = s;
+                sketch_map_.emplace(key, s);
+                fresh.push_back(s);
             }
+#ifdef ONLINE
+            last_use_[key] = num_queries_;
+#endif
 
             for (int i = 0; i < join_attrs_specific.size(); i++) {
                 s->l2gIndex[curr][i] = join_attrs_specific[i];
@@ -380,32 +589,85 @@ void BoundSketch::getBoundFormulae() {
             bound_formulae_.push_back(bf);
         }
     }
+
+    //count the new sketches together, then recompile the formulae over
+    //their counts
+    if (!fresh.empty()) {
+        auto ckpt = chrono::high_resolution_clock::now();
+        Sketch::build(fresh);
+        auto elapsed_nano = chrono::high_resolution_clock::now() - ckpt;
+        sketch_build_time_ += (double) elapsed_nano.count() / 1000000; //in milliseconds
+        for (BoundFormula& bf : bound_formulae_)
+            bf.compile();
+    }
 }
 
 //returns the summation of the selected bounding formula (with index bf_index_) 
 //instantiated with counts and maximum degrees of partitions 
 double BoundSketch::EstCard(int subquery_index) {
+    if (pruned_card_ >= 0)
+        return pruned_card_;
     BoundFormula& bf = bound_formulae_[bf_index_];
     if (!has_join_attribute_) {
         ZeroDimensionalSketchUnc* u = (ZeroDimensionalSketchUnc*) bf.uncList[0];
         bf_index_ = bound_formulae_.size(); //no next GetSubstructure
-        return u->unc[0];
+        return u->unc();
     }
     else {
-        long res = 0;
-        CrossProductIterator cp(bf.hash_sizes);
-        if (cp.totalBuckets > 1) {
-            while (cp.hasNext()) {
-                res += bf.execute(cp.next());
-            }
-        } else {
-            vector<int> index(bf.hash_sizes.size(), 0);
-            res = bf.execute(index);
+        double res = 0;
+        //about 1024 buckets between deadline checks
+        long block = std::max(1024 / bf.inner, 1);
+        for (long r = 0; r < bf.rows; r += block) {
+            res += bf.sum(r, std::min(r + block, bf.rows));
+            CheckDeadline();
+        }
+        return res;
+    }
+}
+
+//branch and bound over the formulae: evaluated in parallel in ascending
+//order of a cheap upper bound (the product of each sketch's total), and
+//abandoned as soon as the partial sum exceeds the smallest full sum so
+//far; since the terms are non-negative the minimum is unchanged
+double BoundSketch::minBoundFormula() {
+    int n = bound_formulae_.size();
+    vector<pair<double, int>> order(n);
+    for (int i = 0; i < n; i++) {
+        BoundFormula& bf = bound_formulae_[i];
+        double bound = 1;
+        for (int k = 0; k < bf.counts.size(); k++) {
+            bool unc = k < bf.uncList.size();
+            Sketch* s = unc ? bf.uncList[k] : bf.conList[k - bf.uncList.size()];
+            long total = 0;
+            s->scan(0, s->size(), [&](int, int c) { total = unc ? total + c : std::max(total, (long) c); });
+            bound *= total;
         }
-        if (res < 0)
-            res = numeric_limits<long>::max();
-        return (double) res;
+        order[i] = make_pair(bound, i);
     }
+    sort(order.begin(), order.end());
+
+    std::atomic<double> best(numeric_limits<double>::max());
+    std::atomic<bool> timeout(false);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < n; i++) {
+        BoundFormula& bf = bound_formulae_[order[i].second];
+        double res = 0;
+        long block = std::max(1024 / bf.inner, 1);
+        for (long r = 0; r < bf.rows && !timeout; r += block) {
+            res += bf.sum(r, std::min(r + block, bf.rows));
+            if (res > best)
+                break;
+            if (DeadlinePassed())
+                timeout = true;
+        }
+        double cur = best;
+        while (res < cur && !best.compare_exchange_weak(cur, res))
+            ;
+    }
+    //exceptions must not leave the parallel region
+    if (timeout)
+        CheckDeadline();
+    return best;
 }
 
 //min
@@ -421,7 +683,7 @@ double BoundSketch::AggCard() {
 
 double BoundSketch::GetSelectivity() {
 #ifdef ONLINE
-    cout << "online sketch build time: " << sketch_build_time_ << endl;
+    cerr << "online sketch build time: " << sketch_build_time_ << endl;
 #endif
     return 1;
 }
@@ -429,4 +691,7 @@ double BoundSketch::GetSelectivity() {
 BoundSketch::~BoundSketch() {
     for (auto& p : sketch_map_)
         delete p.second;
+    UnloadFile(summary_, summary_size_, summary_mode_);
 }
+
+}  // namespace relational
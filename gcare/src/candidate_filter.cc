@@ -0,0 +1,97 @@
+#include "../include/candidate_filter.h"
+
+namespace graph {
+
+void CandidateFilter::Build(DataGraph& g, QueryGraph& q) {
+	g_ = &g;
+	int vnum = g.GetNumVertices();
+	int qnum = q.GetNumVertices();
+	bits_.assign(qnum, vector<uint64_t>((vnum + 63) / 64, 0));
+
+	//local: label, binding and incident edge labels
+	for (int u = 0; u < qnum; u++) {
+		int vl = q.GetVLabel(u);
+		int bound = q.GetBound(u);
+		int begin = bound >= 0 ? bound : 0;
+		int end = bound >= 0 ? std::min(bound + 1, vnum) : vnum;
+		for (int v = begin; v < end; v++) {
+			if (vl != -1 && !g.HasVLabel(v, vl))
+				continue;
+			bool pass = true;
+			for (int d = 0; d < 2 && pass; d++)
+				for (auto& e : q.GetAdj(u, d == 0))
+					if (!g.HasELabel(v, e.second, d == 0)) {
+						pass = false;
+						break;
+					}
+			if (pass)
+				bits_[u][v >> 6] |= 1ull << (v & 63);
+		}
+	}
+
+	//one round of refinement: a candidate neighbour along every query edge
+	for (int u = 0; u < qnum; u++) {
+		for (size_t i = 0; i < bits_[u].size(); i++) {
+			for (uint64_t word = bits_[u][i]; word; word &= word - 1) {
+				int v = i * 64 + __builtin_ctzll(word);
+				bool pass = true;
+				for (int d = 0; d < 2 && pass; d++)
+					for (auto& e : q.GetAdj(u, d == 0))
+						if (CountAdj(v, e.second, d == 0, e.first) == 0) {
+							pass = false;
+							break;
+						}
+				if (!pass)
+					bits_[u][i] &= ~(1ull << (v & 63));
+			}
+		}
+	}
+}
+
+void CandidateFilter::Tuples(int label, int u, int w, vector<int>& out) {
+	out.clear();
+	if (w < 0) {
+		int n = g_->GetNumVertices(label);
+		for (int i = 0; i < n; i++) {
+			int v = g_->GetVertex(label, i)[0];
+			if (Pass(u, v)) {
+				out.push_back(v);
+				out.push_back(v);
+			}
+		}
+		return;
+	}
+	int64_t n = g_->GetNumEdges(label);
+	for (int64_t i = 0; i < n; i++) {
+		vector<int> t = g_->GetEdge(label, i);
+		if (Pass(u, t[0]) && Pass(w, t[1])) {
+			out.push_back(t[0]);
+			out.push_back(t[1]);
+		}
+	}
+}
+
+int CandidateFilter::CountAdj(int v, int el, bool dir, int w) {
+	range r = g_->GetAdj(v, el, dir);
+	int cnt = 0;
+	for (const int* p = r.begin; p != r.end; p++)
+		cnt += Pass(w, *p);
+	return cnt;
+}
+
+int CandidateFilter::PickAdj(int v, int el, bool dir, int w, Rng& rng, int* other) {
+	range r = g_->GetAdj(v, el, dir);
+	int cnt = 0;
+	for (const int* p = r.begin; p != r.end; p++)
+		cnt += Pass(w, *p);
+	if (cnt == 0)
+		return 0;
+	int k = rng.Uniform(cnt);
+	for (const int* p = r.begin; ; p++)
+		if (Pass(w, *p) && k-- == 0) {
+			*other = *p;
+			return cnt;
+		}
+}
+
+}  // namespace graph
@@ -0,0 +1,232 @@
+#include "../include/cluster.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sstream>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// one line without its newline; false at EOF
+bool read_line(FILE *in, string &line) {
+  char *buffer = nullptr;
+  size_t capacity = 0;
+  ssize_t n = getline(&buffer, &capacity, in);
+  if (n < 0) {
+    free(buffer);
+    return false;
+  }
+  line.assign(buffer, n);
+  free(buffer);
+  while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+    line.pop_back();
+  return true;
+}
+
+// a connected stream socket to host:port, -1 on failure
+int connect_to(const string &address) {
+  size_t colon = address.rfind(':');
+  if (colon == string::npos)
+    return -1;
+  string host = address.substr(0, colon), port = address.substr(colon + 1);
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+    return -1;
+  int fd = -1;
+  for (struct addrinfo *ai = res; ai != nullptr; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+} // namespace
+
+Cluster::~Cluster() {
+  for (Connection &c : workers_) {
+    if (c.in != nullptr)
+      fclose(c.in);
+    if (c.out != nullptr)
+      fclose(c.out);
+  }
+}
+
+bool Cluster::Splits(const string &method) {
+  return method == "wj" || method == "jsub" || method == "impr" ||
+         method == "cs";
+}
+
+bool Cluster::Connect(const vector<string> &workers) {
+  for (const string &address : workers) {
+    int fd = connect_to(address);
+    if (fd < 0) {
+      std::cerr << "cannot connect to worker " << address << "\n";
+      return false;
+    }
+    Connection c;
+    c.address = address;
+    c.in = fdopen(fd, "r");
+    c.out = fdopen(dup(fd), "w");
+    workers_.push_back(c);
+  }
+  return !workers_.empty();
+}
+
+// The requests go out to all workers before any reply is read, so the
+// workers sample concurrently.
+bool Cluster::Query(const string &method, const vector<string> &text,
+                    const QueryParams &query_params, double &est,
+                    double &time, bool &partial) {
+  int n = workers_.size();
+  int num_iter = query_params.num_iter;
+  auto chkpt = std::chrono::steady_clock::now();
+  for (int w = 0; w < n; w++) {
+    FILE *out = workers_[w].out;
+    fprintf(out, "query %s %.17g %d %d %.17g %d\n", method.c_str(),
+            query_params.ratio / n, query_params.seed + w * num_iter, num_iter,
+            query_params.timeout, query_params.partial ? 1 : 0);
+    for (const string &line : text)
+      fprintf(out, "%s\n", line.c_str());
+    fprintf(out, "end\n");
+    fflush(out);
+  }
+  // per iteration: sum of est * samples, samples, and est for no samples
+  vector<double> weighted(num_iter, 0.0), samples(num_iter, 0.0),
+      unweighted(num_iter, 0.0);
+  bool ok = true;
+  partial = false;
+  for (int w = 0; w < n; w++) {
+    string line;
+    int count = -1;
+    if (!read_line(workers_[w].in, line) ||
+        sscanf(line.c_str(), "ok %d", &count) != 1 || count != num_iter) {
+      std::cerr << "worker " << workers_[w].address << ": "
+                << (line.empty() ? "connection lost" : line) << "\n";
+      ok = false;
+      continue;
+    }
+    for (int i = 0; i < num_iter; i++) {
+      double e, s, t;
+      int p = 0;
+      if (!read_line(workers_[w].in, line) ||
+          sscanf(line.c_str(), "%lf %lf %lf %d", &e, &s, &t, &p) != 4) {
+        std::cerr << "worker " << workers_[w].address << ": bad reply\n";
+        ok = false;
+        // read the rest of the reply, so the next request on this
+        // connection does not take its lines for its own
+        while (++i < num_iter && read_line(workers_[w].in, line))
+          ;
+        break;
+      }
+      weighted[i] += e * s;
+      samples[i] += s;
+      unweighted[i] += e / n;
+      partial |= p != 0;
+    }
+  }
+  if (!ok)
+    return false;
+  est = 0.0;
+  for (int i = 0; i < num_iter; i++)
+    est += samples[i] > 0 ? weighted[i] / samples[i] : unweighted[i];
+  est /= num_iter;
+  time = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       chkpt).count() / num_iter;
+  return true;
+}
+
+bool ServeWorker(int port, std::map<string, Runner *> &runners,
+                 const QueryParams &query_params) {
+  // a driver going away must not kill the worker
+  signal(SIGPIPE, SIG_IGN);
+  int fd = socket(AF_INET6, SOCK_STREAM, 0);
+  int on = 1, off = 0;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  struct sockaddr_in6 addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 16) != 0) {
+    perror("listen");
+    return false;
+  }
+  // result slots, shared with forked iterations and grown on demand
+  int slots = 0, shmid = -1;
+  QueryResult *query_result = nullptr;
+  while (true) {
+    int conn = accept(fd, nullptr, nullptr);
+    if (conn < 0)
+      continue;
+    FILE *in = fdopen(conn, "r");
+    FILE *out = fdopen(dup(conn), "w");
+    string line;
+    while (read_line(in, line)) {
+      if (line.empty())
+        continue;
+      std::istringstream header(line);
+      string command, method;
+      QueryParams params = query_params;
+      params.cache = nullptr;
+      params.ratios.clear();
+      int partial = 0;
+      header >> command >> method >> params.ratio >> params.seed >>
+          params.num_iter >> params.timeout >> partial;
+      params.partial = partial != 0;
+      vector<string> text;
+      while (read_line(in, line) && line != "end")
+        text.push_back(line);
+      auto it = runners.find(method);
+      if (command != "query" || header.fail() || params.num_iter < 1) {
+        fprintf(out, "error bad request\n");
+      } else if (it == runners.end()) {
+        fprintf(out, "error unknown method %s\n", method.c_str());
+      } else {
+        if (params.num_iter > slots) {
+          if (query_result != nullptr) {
+            shmdt(query_result);
+            shmctl(shmid, IPC_RMID, NULL);
+          }
+          slots = params.num_iter;
+          shmid = shmget(IPC_PRIVATE, sizeof(QueryResult) * slots,
+                         0666 | IPC_CREAT);
+          query_result = (QueryResult *)shmat(shmid, (void *)0, 0);
+        }
+        double est, time;
+        if (!it->second->Query("<remote>", &text, params, query_result, est,
+                               time)) {
+          fprintf(out, "error query failed\n");
+        } else {
+          fprintf(out, "ok %d\n", params.num_iter);
+          for (int i = 0; i < params.num_iter; i++)
+            fprintf(out, "%.17g %zu %.17g %d\n", query_result[i].est,
+                    query_result[i].samples, query_result[i].time,
+                    query_result[i].partial ? 1 : 0);
+        }
+      }
+      fflush(out);
+    }
+    fclose(in);
+    fclose(out);
+  }
+}
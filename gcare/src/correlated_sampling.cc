@@ -1,12 +1,189 @@
 #include "../include/correlated_sampling.h"
 #include <random>
+#include <unordered_map>
 
-const uint64_t M61 = 2305843009213693951ull;
+namespace relational {
 
-double CorrelatedSampling::Hash(std::pair<uint64_t, uint64_t> &seed, int x) {
-    uint64_t res = seed.first * x + seed.second;
-    res = res % M61;
-    return static_cast<double>(res) / static_cast<double>(M61);
+REGISTER_ESTIMATOR("cs", CorrelatedSampling);
+
+// hashes are 32 bits: a tuple is kept on a when h_a(x) < Threshold(pmin_a)
+const uint64_t HASH_RANGE = 1ull << 32;
+
+// h(x) = ((seed.first * x + seed.second) mod 2^64) >> 32, 2-universal
+// (multiply-add-shift) for an odd seed.first
+static inline uint32_t HashMS(const std::pair<uint64_t, uint64_t> &seed, int x) {
+    return (seed.first * static_cast<uint32_t>(x) + seed.second) >> 32;
+}
+
+// smallest r with r / 2^32 >= p, exact as 2^32 is a power of two
+static uint64_t Threshold(double p) {
+    return std::min(HASH_RANGE, static_cast<uint64_t>(std::ceil(p * HASH_RANGE)));
+}
+
+// summary file: SUMMARY_MAGIC, SUMMARY_VERSION, the number of tables and of
+// values (ints), the base seed and, per table and column, the offset of its
+// row ids after the offsets, then the end (uint64_t), the base hash of
+// every value (uint32_t) and the row ids (ints)
+static const int SUMMARY_MAGIC = 0x50534353; // "SCSP"
+static const int SUMMARY_VERSION = 2;
+static const std::pair<uint64_t, uint64_t> BASE_SEED(0x9E3779B97F4A7C15ull, 0x0545F4914F6CDD1Dull);
+
+// the base hash H(x), from the summary's hash column where it has x
+inline uint32_t CorrelatedSampling::BaseHash(int x) const {
+    return static_cast<uint32_t>(x) < num_values_ ? hashes_[x] : HashMS(base_seed_, x);
+}
+
+// h_a(x): with a summary the base hash shifted by a's offset (mod 2^32),
+// else a's own
+inline uint32_t CorrelatedSampling::AttrHash(int attr, int x) const {
+    if (summary_ == nullptr) return HashMS(seeds_[attr], x);
+    return BaseHash(x) + shifts_[attr];
+}
+
+void CorrelatedSampling::PrepareSummaryStructure(DataGraph& data, double) {
+    int max_value = -1;
+    int num_tables = data.NumTables();
+    std::vector<int> column;
+    for (int t = 0; t < num_tables; ++t) {
+        auto table = data.Table(t);
+        column.resize(table.size());
+        for (size_t c = 0; c < table.width(); ++c) {
+            table.ReadColumn(c, 0, table.size(), column.data());
+            for (int v : column) max_value = std::max(max_value, v);
+        }
+    }
+    // the summary only speeds the samples up, so one that would not fit
+    // the byte budget is not built and the samples scan the tables
+    scan_only_ = false;
+    if (max_summary_bytes_ > 0) {
+        size_t bytes = 4 * sizeof(int) + (3 + 2 * num_tables) * sizeof(uint64_t) +
+            (max_value + 1) * sizeof(uint32_t);
+        for (int t = 0; t < num_tables; ++t)
+            bytes += sizeof(int) * data.Table(t).size() * std::min<size_t>(data.Table(t).width(), 2);
+        if (bytes > max_summary_bytes_) {
+            build_report_ = "no summary (" + std::to_string(bytes) + " bytes), the samples scan the tables";
+            hash_column_.clear();
+            orders_.clear();
+            scan_only_ = true;
+            return;
+        }
+    }
+    hash_column_.resize(max_value + 1);
+    for (int x = 0; x <= max_value; ++x) hash_column_[x] = HashMS(BASE_SEED, x);
+    orders_.assign(num_tables * 2, std::vector<int>());
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < orders_.size(); ++i) {
+        auto table = data.Table(i / 2);
+        size_t c = i % 2;
+        if (c >= table.width()) continue;
+        const int* col = data.Column(i / 2, c);
+        std::vector<int> values;
+        if (col == nullptr) {
+            values.resize(table.size());
+            table.ReadColumn(c, 0, table.size(), values.data());
+            col = values.data();
+        }
+        std::vector<std::pair<uint32_t, int>> keys(table.size());
+        for (size_t r = 0; r < table.size(); ++r) keys[r] = std::make_pair(hash_column_[col[r]], (int) r);
+        std::sort(keys.begin(), keys.end());
+        orders_[i].resize(keys.size());
+        for (size_t r = 0; r < keys.size(); ++r) orders_[i][r] = keys[r].second;
+    }
+}
+
+void CorrelatedSampling::WriteSummary(const char* fn) {
+    if (scan_only_) {
+        remove(fn);
+        return;
+    }
+    FILE* fp = fopen(fn, "wb");
+    if (fp == nullptr) {
+        fprintf(stderr, "cannot write %s\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    int header[4] = {SUMMARY_MAGIC, SUMMARY_VERSION, static_cast<int>(orders_.size() / 2),
+        static_cast<int>(hash_column_.size())};
+    uint64_t seed[2] = {BASE_SEED.first, BASE_SEED.second};
+    std::vector<uint64_t> offsets(1, 0);
+    for (auto& order : orders_) offsets.push_back(offsets.back() + order.size());
+    fwrite(header, sizeof(int), 4, fp);
+    fwrite(seed, sizeof(uint64_t), 2, fp);
+    fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), fp);
+    fwrite(hash_column_.data(), sizeof(uint32_t), hash_column_.size(), fp);
+    for (auto& order : orders_) fwrite(order.data(), sizeof(int), order.size(), fp);
+    fclose(fp);
+}
+
+// without a summary file the samples scan the tables
+void CorrelatedSampling::ReadSummary(const char* fn) {
+    summary_.reset();
+    columns_.clear();
+    if (!std::filesystem::exists(fn)) return;
+    summary_ = LoadShared(fn, SummaryLoadMode());
+    if (summary_ == nullptr) {
+        fprintf(stderr, "cannot load %s\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    const char* data = summary_->data;
+    size_t summary_size = summary_->size;
+    const int* header = reinterpret_cast<const int*>(data);
+    const uint64_t* seed = reinterpret_cast<const uint64_t*>(data + 4 * sizeof(int));
+    const uint64_t* offsets = seed + 2;
+    size_t num = 0, hashes_at = 0, ids_at = 0;
+    bool ok = summary_size >= 4 * sizeof(int) + 3 * sizeof(uint64_t) &&
+        header[0] == SUMMARY_MAGIC && header[1] == SUMMARY_VERSION && header[2] >= 0 && header[3] >= 0;
+    if (ok) {
+        num = header[2] * 2;
+        hashes_at = 4 * sizeof(int) + (3 + num) * sizeof(uint64_t);
+        ids_at = hashes_at + header[3] * sizeof(uint32_t);
+        ok = ids_at <= summary_size && offsets[num] <= (summary_size - ids_at) / sizeof(int);
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: corrupt or unsupported cs summary\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    base_seed_ = std::make_pair(seed[0], seed[1]);
+    hashes_ = reinterpret_cast<const uint32_t*>(data + hashes_at);
+    num_values_ = header[3];
+    const int* ids = reinterpret_cast<const int*>(data + ids_at);
+    for (size_t i = 0; i < num; ++i) columns_.emplace_back(ids + offsets[i], offsets[i + 1] - offsets[i]);
+}
+
+// the summary is only read, so instances share it as it is, or the lack of it
+bool CorrelatedSampling::ShareSummary(const Estimator& from) {
+    auto other = dynamic_cast<const CorrelatedSampling*>(&from);
+    if (other == nullptr) return false;
+    summary_ = other->summary_;
+    hashes_ = other->hashes_;
+    num_values_ = other->num_values_;
+    columns_ = other->columns_;
+    base_seed_ = other->base_seed_;
+    return true;
+}
+
+// Sets ids to the rows of table t whose column c has AttrHash(attr, x) <
+// threshold, if the summary holds that column and there are fewer than
+// limit of them. Those are the x with H(x) in the cyclic range [-shift_a,
+// -shift_a + threshold) mod 2^32: one or two runs of the column's order.
+bool CorrelatedSampling::SummaryRows(int t, int c, int attr, uint64_t threshold, size_t limit,
+        std::vector<int>& ids) const {
+    size_t col = t * 2 + c;
+    auto table = g->Table(t);
+    if (col >= columns_.size() || columns_[col].second != table.size()) return false;
+    const int* order = columns_[col].first;
+    size_t n = columns_[col].second;
+    auto lower = [&](uint64_t h) -> size_t {
+        return std::partition_point(order, order + n, [&](int r) { return BaseHash(table.Value(r, c)) < h; }) - order;
+    };
+    uint64_t lo = (HASH_RANGE - shifts_[attr]) % HASH_RANGE, hi = lo + threshold;
+    std::pair<size_t, size_t> runs[2] = {{lower(lo), n}, {0, 0}};
+    if (hi <= HASH_RANGE) runs[0].second = lower(hi);
+    else runs[1].second = lower(hi - HASH_RANGE);
+    size_t total = (runs[0].second - runs[0].first) + runs[1].second;
+    if (total >= limit) return false;
+    ids.clear();
+    for (auto& run : runs) ids.insert(ids.end(), order + run.first, order + run.second);
+    return true;
 }
 
 double CorrelatedSampling::EstCard(int subquery_index) {
@@ -21,57 +198,320 @@ double CorrelatedSampling::EstCard(int subquery_index) {
     return ans;
 }
 
+namespace {
+
+// A sample projected on its join attributes: its distinct rows in
+// lexicographic order, each weighted by the number of join results it
+// stands for (initially the number of sampled tuples projecting onto it).
+struct CountedRelation {
+    std::vector<int> attrs; // column order
+    std::vector<int> rows;  // attrs.size() ints per row
+    std::vector<uint64_t> weight;
+
+    size_t size() const { return weight.size(); }
+    const int* row(size_t i) const { return rows.data() + i * attrs.size(); }
+    int col(int attr) const {
+        for (size_t k = 0; k < attrs.size(); ++k)
+            if (attrs[k] == attr) return k;
+        return -1;
+    }
+
+    // sorts and merges rows given as flat, attrs.size() ints each
+    void assign(std::vector<int>& flat, std::vector<uint64_t>& w) {
+        size_t width = attrs.size(), n = w.size();
+        std::vector<size_t> idx(n);
+        for (size_t i = 0; i < n; ++i) idx[i] = i;
+        std::sort(idx.begin(), idx.end(), [&](size_t a, size_t b) {
+            return std::lexicographical_compare(flat.begin() + a * width, flat.begin() + (a + 1) * width,
+                flat.begin() + b * width, flat.begin() + (b + 1) * width);
+        });
+        rows.clear();
+        weight.clear();
+        for (size_t i : idx) {
+            const int* r = flat.data() + i * width;
+            if (!weight.empty() && std::equal(r, r + width, rows.end() - width)) {
+                weight.back() += w[i];
+                continue;
+            }
+            rows.insert(rows.end(), r, r + width);
+            weight.push_back(w[i]);
+        }
+    }
+
+    // keeps the attributes with shared[a] of rel; tuples binding one
+    // attribute to two values (self loops) are dropped
+    void build(Relation<int>& sample, QueryGraph::Relation& rel, const std::vector<bool>& shared) {
+        attrs.clear();
+        for (auto& attr : rel.attrs)
+            if (shared[attr.id] && col(attr.id) < 0) attrs.push_back(attr.id);
+        std::sort(attrs.begin(), attrs.end());
+        std::vector<int> flat;
+        std::vector<uint64_t> w;
+        flat.reserve(sample.size() * attrs.size());
+        for (uint64_t i = 0; i < sample.size(); ++i) {
+            auto tuple = sample[i];
+            bool pass = true;
+            for (size_t k = 0; k < rel.attrs.size() && pass; ++k)
+                for (size_t l = 0; l < k; ++l)
+                    if (rel.attrs[l].id == rel.attrs[k].id && tuple[l] != tuple[k]) pass = false;
+            if (!pass) continue;
+            for (int a : attrs) {
+                size_t k = 0;
+                while (rel.attrs[k].id != a) k++;
+                flat.push_back(tuple[k]);
+            }
+            w.push_back(1);
+        }
+        assign(flat, w);
+    }
+
+    // changes the column order to order (a permutation of attrs)
+    void reorder(const std::vector<int>& order) {
+        std::vector<int> perm;
+        for (int a : order) perm.push_back(col(a));
+        std::vector<int> flat;
+        flat.reserve(rows.size());
+        for (size_t i = 0; i < size(); ++i)
+            for (int k : perm) flat.push_back(row(i)[k]);
+        attrs = order;
+        std::vector<uint64_t> w;
+        w.swap(weight);
+        assign(flat, w);
+    }
+
+    // drops rows of weight 0; returns whether any is left
+    bool compact() {
+        size_t width = attrs.size(), n = 0;
+        for (size_t i = 0; i < size(); ++i) {
+            if (weight[i] == 0) continue;
+            std::copy(rows.begin() + i * width, rows.begin() + (i + 1) * width, rows.begin() + n * width);
+            weight[n++] = weight[i];
+        }
+        rows.resize(n * width);
+        weight.resize(n);
+        return n > 0;
+    }
+};
+
+// packs the values of row at cols (at most two, as relations have at most
+// two attributes) into a key
+inline uint64_t packKey(const int* row, const std::vector<int>& cols) {
+    assert(cols.size() <= 2);
+    uint64_t key = 0;
+    for (int k : cols) key = (key << 32) | (uint32_t) row[k];
+    return key;
+}
+
+// Worst-case optimal (generic) join counting sum over all bindings of the
+// product of the weights of the rows they select. Attributes are bound one
+// at a time in order, intersecting the values every relation containing it
+// allows for its already bound prefix.
+struct GenericJoin {
+    std::vector<CountedRelation*> rels; // columns ordered by order
+    std::vector<int> order;
+    std::vector<std::vector<std::pair<int, int>>> at; // level -> (relation, column)
+
+    typedef std::pair<size_t, size_t> Range;
+
+    // rows of r within range whose column c equals v (rows in range agree on
+    // every earlier column, so column c is sorted)
+    Range equalRange(const CountedRelation& r, Range range, int c, int v) const {
+        size_t lo = range.first, hi = range.second;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (r.row(mid)[c] < v) lo = mid + 1; else hi = mid;
+        }
+        size_t b = lo;
+        hi = range.second;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (r.row(mid)[c] <= v) lo = mid + 1; else hi = mid;
+        }
+        return Range(b, lo);
+    }
+
+    uint64_t count(size_t level, std::vector<Range>& ranges) const {
+        if (level == order.size()) {
+            // every relation is down to the single row it selects
+            GCARE_COUNT(join_rows);
+            uint64_t w = 1;
+            for (size_t r = 0; r < rels.size(); ++r) w *= rels[r]->weight[ranges[r].first];
+            return w;
+        }
+        const auto& parts = at[level];
+        size_t s = 0;
+        for (size_t k = 1; k < parts.size(); ++k) {
+            const Range& a = ranges[parts[k].first];
+            const Range& b = ranges[parts[s].first];
+            if (a.second - a.first < b.second - b.first) s = k;
+        }
+        const CountedRelation& sr = *rels[parts[s].first];
+        int sc = parts[s].second;
+        Range srange = ranges[parts[s].first];
+        std::vector<Range> saved(parts.size());
+        for (size_t k = 0; k < parts.size(); ++k) saved[k] = ranges[parts[k].first];
+        uint64_t total = 0;
+        for (size_t i = srange.first; i < srange.second; ) {
+            int v = sr.row(i)[sc];
+            bool pass = true;
+            for (size_t k = 0; k < parts.size() && pass; ++k) {
+                Range r = equalRange(*rels[parts[k].first], saved[k], parts[k].second, v);
+                ranges[parts[k].first] = r;
+                pass = r.first < r.second;
+            }
+            if (pass) total += count(level + 1, ranges);
+            i = equalRange(sr, Range(i, srange.second), sc, v).second;
+        }
+        for (size_t k = 0; k < parts.size(); ++k) ranges[parts[k].first] = saved[k];
+        return total;
+    }
+};
+
+}
+
+// Counts the join of the samples without materialising it. Each sample is
+// first projected on its join attributes with multiplicities. A GYO
+// reduction then peels off ears (relations whose remaining attributes lie
+// in one other relation), in order, each passing its counts grouped by the
+// shared attributes to that relation, which drops the rows they do not
+// join with. An acyclic query is left with a single relation whose weights
+// sum to the count; a cyclic core is counted with a generic join.
 uint64_t CorrelatedSampling::EstCard_(DataGraph& data_graph, QueryGraph& query_graph) {        
+    size_t n = query_graph.relations_.size();
     if (samples_.size() == 0) return 0.0;
-    Relation<int> &sample_l = samples_[0]; 
-    if (sample_l.size() == 0) return 0.0;
-
-    vector<bool> chk_sample(query_graph.relations_.size(), false); // if chk_sample[i] is true, then the sample i is joined to sample_l
-    vector<bool> chk_attr(query_graph.num_attrs(), false); // if chk_attr[i] is true, then the sample_l contains the attribute i
-    //==============================================
-    // 1. Start from table 0
-    // ---------------------------------------------
-    chk_sample[0] = true;
-    auto &relation_l = query_graph.relations_[0];
-    // 1-1 make colum names for sample 0
-    std::vector<int> cols_l(relation_l.size());
-    for (size_t i = 0; i < cols_l.size(); ++i) {
-        int cname = relation_l[i].id;
-        cols_l[i] = cname;
-        chk_attr[cname] = true;
-    }
-    // start join the remaining samples on the table 0
-    std::vector<int> cols_r;
-    for (int i = 0; i < query_graph.relations_.size() - 1; ++i) {
-        // choose a sample using a heuristic method
-        int t = 0, mx = 0;
-        for (int j = 1; j < query_graph.relations_.size(); ++j) {
-            if (chk_sample[j]) continue;
-            if (samples_[j].size() == 0) return 0.0;
-            auto &attrs = query_graph.relations_[j].attrs;
-            int cnt = 0;
-            for (int k = 0; k < attrs.size(); ++k) {
-                auto &attr = attrs[k];
-                if (chk_attr[attr.id]) cnt++;
-            }
-            if (mx < cnt) {
-                mx = cnt;
-                t = j;
+
+    // 1. Project the samples on the attributes shared by several relations
+    std::vector<int> ref(query_graph.num_attrs(), 0);
+    for (auto& rel : query_graph.relations_) {
+        for (size_t k = 0; k < rel.attrs.size(); ++k) {
+            bool dup = false;
+            for (size_t l = 0; l < k; ++l) dup |= rel.attrs[l].id == rel.attrs[k].id;
+            if (!dup) ref[rel.attrs[k].id]++;
+        }
+    }
+    std::vector<bool> shared(ref.size());
+    for (size_t a = 0; a < ref.size(); ++a) shared[a] = ref[a] > 1;
+    std::vector<CountedRelation> rels(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (samples_[i].size() == 0) return 0.0;
+        rels[i].build(samples_[i], query_graph.relations_[i], shared);
+        if (rels[i].size() == 0) return 0.0;
+    }
+
+    // 2. GYO reduction: ears and the relation each one is attached to
+    std::vector<std::vector<int>> live(n);
+    for (size_t i = 0; i < n; ++i) live[i] = rels[i].attrs;
+    std::vector<bool> removed(n, false);
+    std::vector<std::pair<int, int>> ears; // (ear, parent)
+    size_t num_live = n;
+    for (bool changed = true; changed && num_live > 1; ) {
+        changed = false;
+        for (size_t i = 0; i < n && num_live > 1; ++i) {
+            if (removed[i]) continue;
+            auto& as = live[i];
+            as.erase(std::remove_if(as.begin(), as.end(), [&](int a) { return ref[a] == 1; }), as.end());
+            for (size_t j = 0; j < n; ++j) {
+                if (j == i || removed[j]) continue;
+                if (!std::includes(live[j].begin(), live[j].end(), as.begin(), as.end())) continue;
+                for (int a : as) ref[a]--;
+                removed[i] = true;
+                num_live--;
+                ears.emplace_back(i, j);
+                changed = true;
+                break;
             }
         }
-        chk_sample[t] = true;
-        auto &attrs = query_graph.relations_[t].attrs;
-        cols_r.resize(attrs.size());
-        Relation<int> &sample_r = samples_[t]; 
-        for (size_t j = 0; j < attrs.size(); ++j) {
-            int cname = attrs[j].id;
-            cols_r[j] = cname; //pos;
-            chk_attr[cname] = true;
+    }
+
+    // 3. Semi-join the ears into their parents, carrying their counts along
+    std::unordered_map<uint64_t, uint64_t> msg;
+    for (auto& ear : ears) {
+        CountedRelation& c = rels[ear.first];
+        CountedRelation& p = rels[ear.second];
+        std::vector<int> c_cols, p_cols;
+        for (size_t k = 0; k < c.attrs.size(); ++k) {
+            int pc = p.col(c.attrs[k]);
+            if (pc < 0) continue;
+            c_cols.push_back(k);
+            p_cols.push_back(pc);
+        }
+        msg.clear();
+        for (size_t i = 0; i < c.size(); ++i) msg[packKey(c.row(i), c_cols)] += c.weight[i];
+        for (size_t i = 0; i < p.size(); ++i) {
+            auto it = msg.find(packKey(p.row(i), p_cols));
+            p.weight[i] = it == msg.end() ? 0 : p.weight[i] * it->second;
+        }
+        if (!p.compact()) return 0.0;
+    }
+
+    GenericJoin gj;
+    for (size_t i = 0; i < n; ++i)
+        if (!removed[i]) gj.rels.push_back(&rels[i]);
+    if (gj.rels.size() == 1) {
+        uint64_t total = 0;
+        for (uint64_t w : gj.rels[0]->weight) total += w;
+        return total;
+    }
+
+    // 4. Cyclic core. Every prefix of the attribute order is a level of the
+    // join's search tree, so the order is picked greedily to keep the
+    // estimated number of bindings of each prefix small: binding a
+    // multiplies them by the fewest values a relation containing it allows,
+    // its distinct values in a if no other attribute of the relation is
+    // bound yet, else its rows per distinct value of that attribute (the
+    // relations have at most two attributes). Ties go to the attribute in
+    // most relations.
+    std::vector<int> cnt(ref.size(), 0);
+    for (auto* r : gj.rels)
+        for (int a : r->attrs) cnt[a]++;
+    std::vector<std::vector<double>> distinct(gj.rels.size());
+    for (size_t r = 0; r < gj.rels.size(); ++r) {
+        const CountedRelation& c = *gj.rels[r];
+        for (size_t k = 0; k < c.attrs.size(); ++k) {
+            std::vector<int> vals(c.size());
+            for (size_t i = 0; i < c.size(); ++i) vals[i] = c.row(i)[k];
+            std::sort(vals.begin(), vals.end());
+            distinct[r].push_back(std::unique(vals.begin(), vals.end()) - vals.begin());
+        }
+    }
+    std::vector<bool> bound(cnt.size(), false);
+    for (size_t a = 0; a < cnt.size(); ++a) bound[a] = cnt[a] == 0;
+    while (true) {
+        int best = -1;
+        double best_fanout = 0.0;
+        for (size_t a = 0; a < cnt.size(); ++a) {
+            if (bound[a]) continue;
+            double fanout = -1.0;
+            for (size_t r = 0; r < gj.rels.size(); ++r) {
+                const CountedRelation& c = *gj.rels[r];
+                int k = c.col(a);
+                if (k < 0) continue;
+                double f = distinct[r][k];
+                for (size_t l = 0; l < c.attrs.size(); ++l)
+                    if (l != (size_t) k && bound[c.attrs[l]]) f = c.size() / distinct[r][l];
+                if (fanout < 0 || f < fanout) fanout = f;
+            }
+            if (best < 0 || fanout < best_fanout || (fanout == best_fanout && cnt[a] > cnt[best])) {
+                best = a;
+                best_fanout = fanout;
+            }
         }
-        sample_l.join(cols_l, cols_r, sample_r);
-        if (sample_l.size() == 0) return 0.0;
+        if (best < 0) break;
+        bound[best] = true;
+        gj.order.push_back(best);
     }
-    return sample_l.size();
+    std::vector<int> level(cnt.size());
+    for (size_t l = 0; l < gj.order.size(); ++l) level[gj.order[l]] = l;
+    gj.at.resize(gj.order.size());
+    for (size_t r = 0; r < gj.rels.size(); ++r) {
+        std::vector<int> order = gj.rels[r]->attrs;
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return level[a] < level[b]; });
+        gj.rels[r]->reorder(order);
+        for (size_t k = 0; k < order.size(); ++k) gj.at[level[order[k]]].emplace_back(r, k);
+    }
+    std::vector<GenericJoin::Range> ranges;
+    for (auto* r : gj.rels) ranges.emplace_back(0, r->size());
+    return gj.count(0, ranges);
 }
 
 void CorrelatedSampling::Init() {
@@ -81,24 +521,14 @@ void CorrelatedSampling::Init() {
     m3_ = -1;
 }
 
-bool CorrelatedSampling::GetSubstructure(int subquery_index) {
-    if (!status_) return false;
-    status_ = false;
-    DataGraph& data = *g;
+// marks the join attributes of the query and gives each its
+// min_{A_{R_i} \ni a} p^{\frac{1}{|A_{R_i}|}}, 1 for the others
+void CorrelatedSampling::JoinProbs(double ratio, std::vector<bool>& is_join_attribute,
+        std::vector<double>& pmins) {
     QueryGraph& query = *q;
-
-    int rand_val = rand();
-    std::mt19937 generator_csj(rand_val);
-    std::uniform_int_distribution<uint64_t> dis_csj(0, M61 - 1);
-
-    //=============================================
-    // 1. preprocess
-    //---------------------------------------------
     size_t num_attrs = query.num_attrs();
-    seeds_.resize(num_attrs, std::make_pair<uint64_t, uint64_t>(0, 0));
-    std::vector<bool> is_join_attribute(num_attrs, false);
-    pmins_.resize(num_attrs, 1.0);
-    vector<double> sample_probs(query.relations_.size(), 1.0);
+    is_join_attribute.assign(num_attrs, false);
+    pmins.assign(num_attrs, 1.0);
     for (size_t i = 0; i < query.relations_.size(); ++i) {
         auto & rel = query.relations_[i];
         // calculate p^{\frac{1}{|A_{R_i}|}}
@@ -111,50 +541,168 @@ bool CorrelatedSampling::GetSubstructure(int subquery_index) {
                 num_join_attrs += 1;
             }
         }
-        double sample_prob = pow(sample_ratio, 1.0 / static_cast<double>(num_join_attrs));
+        double sample_prob = pow(ratio, 1.0 / static_cast<double>(num_join_attrs));
         assert(num_join_attrs <= 2);
         assert(num_join_attrs >= 1);
-        sample_probs[i] = sample_prob;
-        // num_join_attrs == 2 ? sample_prob : std::sqrt(sample_prob);
         // calculate min_{A_{R_i} \ni a} p^{\frac{1}{|A_{R_i}|}}
         for (size_t j = 0; j < rel.attrs.size(); ++j) {
             auto &attr = rel.attrs[j];
             if (attr.is_bound) { // the bound attribute is not a join attribute
             } else if (attr.ref_cnt > 1) { // this is a join attribute. calculate minimum probability of it among related relations
-                pmins_[attr.id] = std::min(sample_prob, pmins_[attr.id]);
+                pmins[attr.id] = std::min(sample_prob, pmins[attr.id]);
+            }
+        }
+    }
+}
+
+// The hashes do not depend on the ratio, so the sample at a smaller ratio is
+// the part of the current one whose join attributes hash below the smaller
+// thresholds: the join is estimated again on that part alone.
+double CorrelatedSampling::AggCardAt(int subquery_index, double ratio) {
+    if (ratio >= sample_ratio || samples_.empty()) return AggCard();
+    QueryGraph& query = *q;
+    std::vector<bool> is_join_attribute;
+    std::vector<double> pmins;
+    JoinProbs(ratio, is_join_attribute, pmins);
+    std::vector<uint64_t> thresholds(pmins.size(), 0);
+    for (size_t i = 0; i < pmins.size(); ++i) {
+        if (is_join_attribute[i]) thresholds[i] = Threshold(pmins[i]);
+    }
+    std::vector<Relation<int>> nested(samples_.size());
+    for (size_t i = 0; i < samples_.size(); ++i) {
+        auto &rel = query.relations_[i];
+        nested[i].SetNumCols(rel.attrs.size());
+        // a row stays with the ratio of the thresholds of its join
+        // attributes; reserve that share, growth takes the rest
+        double keep = 1.0;
+        for (auto &attr : rel.attrs) {
+            if (!attr.is_bound && attr.ref_cnt > 1)
+                keep *= pmins[attr.id] / pmins_[attr.id];
+        }
+        nested[i].reserve(static_cast<uint64_t>(samples_[i].size() * std::min(1.0, keep * 1.1)) + 1);
+        for (uint64_t r = 0; r < samples_[i].size(); ++r) {
+            auto tuple = samples_[i][r];
+            bool pass = true;
+            for (size_t k = 0; k < rel.attrs.size() && pass; ++k) {
+                auto &attr = rel.attrs[k];
+                if (!attr.is_bound && attr.ref_cnt > 1)
+                    pass = AttrHash(attr.id, tuple[k]) < thresholds[attr.id];
             }
+            if (pass) nested[i].append(tuple.data_);
         }
     }
+    samples_.swap(nested);
+    pmins_.swap(pmins);
+    double res = EstCard(subquery_index);
+    samples_.swap(nested);
+    pmins_.swap(pmins);
+    return res;
+}
+
+bool CorrelatedSampling::GetSubstructure(int subquery_index) {
+    if (!status_) return false;
+    status_ = false;
+    DataGraph& data = *g;
+    QueryGraph& query = *q;
+
+    std::mt19937 generator_csj(rng_.Next());
+    std::uniform_int_distribution<uint64_t> dis_csj;
+
+    //=============================================
+    // 1. preprocess
+    //---------------------------------------------
+    size_t num_attrs = query.num_attrs();
+    seeds_.resize(num_attrs, std::make_pair<uint64_t, uint64_t>(0, 0));
+    std::vector<bool> is_join_attribute;
+    JoinProbs(sample_ratio, is_join_attribute, pmins_);
     // Prepare seed of h_a for each join attribute
     for (size_t i = 0; i < num_attrs; ++i) {
         if (!is_join_attribute[i]) continue;
-        seeds_[i] = std::make_pair<uint64_t, uint64_t>(dis_csj(generator_csj), dis_csj(generator_csj));
+        seeds_[i].first = dis_csj(generator_csj) | 1;
+        seeds_[i].second = dis_csj(generator_csj);
+    }
+    // with a summary, the shifts of the base hash instead
+    shifts_.assign(num_attrs, 0);
+    for (size_t i = 0; i < num_attrs && summary_ != nullptr; ++i) {
+        if (is_join_attribute[i]) shifts_[i] = static_cast<uint32_t>(dis_csj(generator_csj));
     }
     //=============================================
     // 2. Create the sample s_0 as a list of relations <S1, ..., Sn>
     //---------------------------------------------
-    samples_.resize(query.relations_.size()); // change code to resize samples_ once
-    for (size_t i = 0; i < query.relations_.size(); ++i) {
+    std::vector<uint64_t> thresholds(num_attrs, 0);
+    for (size_t i = 0; i < num_attrs; ++i) {
+        if (is_join_attribute[i]) thresholds[i] = Threshold(pmins_[i]);
+    }
+    // 2-1 Candidate rows: the fewest of those the index gives for a bound
+    // attribute and those the summary gives for a join attribute, else all
+    size_t num_rels = query.relations_.size();
+    std::vector<const int*> cand_begin(num_rels, nullptr), cand_end(num_rels, nullptr);
+    std::vector<size_t> num_cands(num_rels);
+    std::vector<std::vector<int>> cand_ids(num_rels);
+    std::vector<int> ids;
+    for (size_t i = 0; i < num_rels; ++i) {
         auto &rel = query.relations_[i];
-        int t = data.get_table_id(rel.id); // get table id 
-
-        auto &sample = samples_[i];
-        sample.SetNumCols(rel.attrs.size());
-
-        double sample_prob = sample_probs[i];
-        vector<int> tuple(rel.attrs.size());
-
-        // Sample the tuples for sample i
-        for (size_t j = 0; j < data.table_[t].size(); j++) {
+        int t = data.get_table_id(rel.id);
+        num_cands[i] = data.Table(t).size();
+        for (auto &attr : rel.attrs) {
+            const int *begin, *end;
+            if (!attr.is_bound || !data.HasIndex() || !data.Lookup(t, attr.pos, attr.bound, begin, end, &ids)) continue;
+            if (cand_begin[i] == nullptr || static_cast<size_t>(end - begin) < num_cands[i]) {
+                // rows a packed index decoded into ids move with it
+                if (begin != nullptr && begin == ids.data()) cand_ids[i].swap(ids);
+                cand_begin[i] = begin;
+                cand_end[i] = end;
+                num_cands[i] = end - begin;
+            }
+        }
+        for (auto &attr : rel.attrs) {
+            if (attr.is_bound || attr.ref_cnt < 2) continue;
+            if (!SummaryRows(t, attr.pos, attr.id, thresholds[attr.id], num_cands[i], ids)) continue;
+            cand_ids[i].swap(ids);
+            cand_begin[i] = cand_ids[i].data();
+            cand_end[i] = cand_begin[i] + cand_ids[i].size();
+            num_cands[i] = cand_ids[i].size();
+        }
+    }
+    // 2-2 Filter the candidates in chunks, in parallel across relations and rows
+    struct Chunk {
+        size_t rel, begin, end;
+        std::vector<int> tuples;
+    };
+    const size_t CHUNK_ROWS = 1 << 16;
+    std::vector<Chunk> chunks;
+    for (size_t i = 0; i < num_rels; ++i) {
+        for (size_t b = 0; b < num_cands[i]; b += CHUNK_ROWS) {
+            chunks.push_back(Chunk{i, b, std::min(b + CHUNK_ROWS, num_cands[i]), {}});
+        }
+    }
+#pragma omp parallel for schedule(dynamic)
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        Chunk &chunk = chunks[c];
+        auto &rel = query.relations_[chunk.rel];
+        int t = data.get_table_id(rel.id);
+        auto table = data.Table(t);
+        const int* ids = cand_begin[chunk.rel];
+        size_t width = rel.attrs.size();
+        std::vector<int> tuple(width, 0); // bound and non-join attributes stay 0
+        // each attribute's column, read contiguously when the binary has them
+        std::vector<const int*> cols(width);
+        bool by_column = true;
+        for (size_t k = 0; k < width; ++k) {
+            cols[k] = data.Column(t, rel.attrs[k].pos);
+            by_column = by_column && cols[k] != nullptr;
+        }
+        int buf[2];
+        for (size_t p = chunk.begin; p < chunk.end; ++p) {
+            size_t r = ids ? ids[p] : p;
+            const int* row = by_column ? nullptr : table.Row(r, buf);
             bool pass = true;
-            for (size_t k = 0; k < rel.attrs.size(); ++k) {
+            for (size_t k = 0; k < width; ++k) {
                 auto &attr = rel.attrs[k];
-                int pos = attr.pos;
-                auto val = data.table_[t][j][pos];
+                int val = by_column ? cols[k][r] : row[attr.pos];
                 if (!attr.is_bound) {
                     if (attr.ref_cnt < 2) continue;
-                    double h_a = Hash(seeds_[attr.id], val);
-                    if (h_a >= pmins_[attr.id]) { // drop this tuple
+                    if (AttrHash(attr.id, val) >= thresholds[attr.id]) { // drop this tuple
                         pass = false;
                         break;
                     }
@@ -164,11 +712,27 @@ bool CorrelatedSampling::GetSubstructure(int subquery_index) {
                     break;
                 }
             }
-            if (pass) {
-                samples_[i].append(tuple);
-            }
+            if (pass) chunk.tuples.insert(chunk.tuples.end(), tuple.begin(), tuple.end());
         }
     }
+    samples_.resize(num_rels); // change code to resize samples_ once
+    for (size_t i = 0; i < num_rels; ++i) {
+        samples_[i].SetNumCols(query.relations_[i].attrs.size());
+    }
+    // every sample is sized once, to the rows its chunks passed
+    std::vector<uint64_t> num_rows(num_rels, 0);
+    for (Chunk &chunk : chunks) {
+        num_rows[chunk.rel] += chunk.tuples.size() / samples_[chunk.rel].num_cols_;
+    }
+    for (size_t i = 0; i < num_rels; ++i) {
+        samples_[i].reserve(samples_[i].size() + num_rows[i]);
+    }
+    for (Chunk &chunk : chunks) {
+        auto &sample = samples_[chunk.rel];
+        sample.append(chunk.tuples.data(), chunk.tuples.size() / sample.num_cols_);
+    }
     //=============================================
     return true;
 }
+
+}  // namespace relational
@@ -1,187 +1,999 @@
 #include "../include/cset.h"
+#include "../include/simd_search.h"
 #include <boost/functional/hash.hpp>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <omp.h>
+#include <set>
+#include <tuple>
+#include <unordered_map>
 
-void CharacteristicSets::PrepareSummaryStructure(DataGraph& g, double ratio) {
-    const int MAX = 1e8;
-    map<size_t, int> idx; //hash value of a characterisic set (CSet) to an index to csets_
-    
-    //build characterisic sets with forward stars
-    csets_.clear();
-    csets_.resize(g.GetNumVertices(), CSet()); 
-    int ccnt = 0;
-    for (int srcid = 0; srcid < g.GetNumVertices(); srcid++) {
-        vector<int> freq(g.GetNumVLabels(srcid) + g.GetNumELabels(srcid, true), 0);
-        size_t hv = 0;
-        auto r = g.GetVLabels(srcid);
-        int i = 0;
-        for (; r.begin != r.end; r.begin++) {
-            int vl = *r.begin;
-            boost::hash_combine(hv, vl);
-            freq[i]++;
-            i++;
-        }
-        r = g.GetELabels(srcid, true);
-        i = 0;
-        for (; r.begin != r.end; r.begin++) {
-            int el = *r.begin;
-            boost::hash_combine(hv, el + g.GetNumVLabels());
-            freq[g.GetNumVLabels(srcid) + i] += g.GetAdjSize(srcid, el, true);
-            i++;
-        }
-
-        if (idx.find(hv) == idx.end()) { 
-            assert(csets_[ccnt].count_ == 0);
-            idx[hv] = ccnt++;
-        }
-
-        i = idx[hv];
-        csets_[i].count_++;
-        csets_[i].vid_ = srcid;
-        if (csets_[i].count_ == 1) {
-            csets_[i].freq_ = freq;
+namespace graph {
+
+REGISTER_ESTIMATOR("cset", CharacteristicSets);
+
+namespace {
+
+//characteristic sets of a range of vertices, in order of first occurrence
+struct CSetTable {
+    unordered_map<size_t, int> idx; //hash value of a CSet -> index to csets
+    vector<CharacteristicSets::CSet> csets;
+    vector<size_t> hashes;
+
+    //returns the index of vid's set
+    int Add(size_t hv, int vid, const vector<int>& freq) {
+        auto it = idx.find(hv);
+        if (it == idx.end()) {
+            it = idx.emplace(hv, csets.size()).first;
+            csets.push_back(CharacteristicSets::CSet());
+            hashes.push_back(hv);
+        }
+        auto& c = csets[it->second];
+        c.count_++;
+        c.vid_ = vid;
+        if (c.count_ == 1) {
+            c.freq_ = freq;
         } else {
             for (size_t j = 0; j < freq.size(); j++)
-                csets_[i].freq_[j] += freq[j];
+                c.freq_[j] += freq[j];
         }
+        return it->second;
     }
-    csets_.erase(csets_.begin() + ccnt, csets_.end());
 
-    //build characterisic sets with backward stars
-    idx.clear();
-    rev_csets_.clear();
-    rev_csets_.resize(g.GetNumVertices(), CSet());
-    ccnt = 0;
-    for (int dstid = 0; dstid < g.GetNumVertices(); dstid++) {
-        vector<int> freq(g.GetNumELabels(dstid, false), 0);
-        size_t hv = 0;
-        auto r = g.GetELabels(dstid, false);
-        int i = 0;
-        for (; r.begin != r.end; r.begin++) {
-            int el = *r.begin;
-            boost::hash_combine(hv, el);
-            freq[i] += g.GetAdjSize(dstid, el, false);
-            i++;
+    //appends the sets of the following vertex range; returns the index of
+    //each of its sets in this table
+    vector<int> Merge(CSetTable& next) {
+        vector<int> moved(next.csets.size());
+        for (size_t k = 0; k < next.csets.size(); k++) {
+            auto& c = next.csets[k];
+            auto it = idx.find(next.hashes[k]);
+            if (it == idx.end()) {
+                moved[k] = csets.size();
+                idx.emplace(next.hashes[k], csets.size());
+                hashes.push_back(next.hashes[k]);
+                csets.push_back(std::move(c));
+                continue;
+            }
+            moved[k] = it->second;
+            auto& d = csets[it->second];
+            d.count_ += c.count_;
+            d.vid_ = c.vid_;
+            for (size_t j = 0; j < c.freq_.size(); j++)
+                d.freq_[j] += c.freq_[j];
         }
+        return moved;
+    }
+};
 
-        if (idx.find(hv) == idx.end()) { 
-            assert(rev_csets_[ccnt].count_ == 0);
-            idx[hv] = ccnt++;
+//the index block of n sets whose label keys collect(i, keys) gives:
+//num_keys, offset[num_keys + 1], ids[], slots[], the slot of a key being
+//its position among the keys of the set, which is that of its frequency
+void buildIndex(int n, const std::function<void(int, vector<int>&)>& collect,
+        vector<int>& out) {
+    vector<int> keys;
+    vector<int> off(1, 0);
+    for (int i = 0; i < n; i++) {
+        collect(i, keys);
+        for (int k : keys) {
+            if (k + 2 > (int)off.size()) off.resize(k + 2, 0);
+            off[k + 1]++;
         }
+    }
+    for (size_t k = 1; k < off.size(); k++) off[k] += off[k - 1];
+    int num_keys = off.size() - 1;
+    out.assign(1, num_keys);
+    out.insert(out.end(), off.begin(), off.end());
+    out.resize(out.size() + 2 * (size_t)off.back());
+    int* ids = out.data() + num_keys + 2;
+    int* slots = ids + off.back();
+    vector<int> pos(off.begin(), off.end() - 1);
+    for (int i = 0; i < n; i++) {
+        collect(i, keys);
+        for (size_t j = 0; j < keys.size(); j++) {
+            slots[pos[keys[j]]] = j;
+            ids[pos[keys[j]]++] = i;
+        }
+    }
+}
 
-        i = idx[hv];
-        rev_csets_[i].count_++;
-        rev_csets_[i].vid_ = dstid;
-        if (rev_csets_[i].count_ == 1) {
-            rev_csets_[i].freq_ = freq;
-        } else {
-            for (size_t j = 0; j < freq.size(); j++)
-                rev_csets_[i].freq_[j] += freq[j];
+//the label keys of vertex v's star: for a forward star its vertex labels,
+//then offset + el for its out-edge labels el, for a backward star its
+//in-edge labels; ascending, as the labels of a vertex are
+void starKeys(DataGraph& g, int v, bool dir, int offset, vector<int>& keys) {
+    keys.clear();
+    if (dir) {
+        range vl = g.GetVLabels(v);
+        for (const int* l = vl.begin; l != vl.end; l++) keys.push_back(*l);
+    }
+    range el = g.GetELabels(v, dir);
+    for (const int* l = el.begin; l != el.end; l++)
+        if (*l >= 0) keys.push_back((dir ? offset : 0) + *l);
+}
+
+//keys of the sets are taken from their representative vertices, which have
+//the same labels as every other vertex of the set
+void buildIndex(DataGraph& g, int n, const int* vid, bool dir, int offset,
+        vector<int>& out) {
+    buildIndex(n, [&](int i, vector<int>& keys) {
+        starKeys(g, vid[i], dir, offset, keys);
+    }, out);
+}
+
+//index blocks before version 5 have no slots
+const int* attachIndex(const int* p, CharacteristicSets::Postings& index, bool slots = true) {
+    index.num_keys = *p++;
+    index.offset = p;
+    index.ids = p + index.num_keys + 1;
+    index.slots = index.ids + index.offset[index.num_keys];
+    return slots ? index.slots + index.offset[index.num_keys] : index.slots;
+}
+
+//the hash PrepareSummaryStructure groups vid's forward (dir) or backward
+//star by, and, if freq is given, the star: for a forward star the count of
+//each vertex label and then the out-degree of each out-edge label, for a
+//backward star the in-degree of each in-edge label
+size_t starHash(DataGraph& g, int vid, bool dir, vector<int>* freq) {
+    size_t hv = 0;
+    int i = 0;
+    if (freq != nullptr)
+        freq->assign((dir ? g.GetNumVLabels(vid) : 0) + g.GetNumELabels(vid, dir), 0);
+    if (dir) {
+        for (auto r = g.GetVLabels(vid); r.begin != r.end; r.begin++, i++) {
+            boost::hash_combine(hv, *r.begin);
+            if (freq != nullptr) (*freq)[i]++;
         }
     }
-    rev_csets_.erase(rev_csets_.begin() + ccnt, rev_csets_.end());
+    int offset = dir ? g.GetNumVLabels() : 0;
+    for (auto r = g.GetELabels(vid, dir); r.begin != r.end; r.begin++, i++) {
+        boost::hash_combine(hv, *r.begin + offset);
+        if (freq != nullptr) (*freq)[i] += g.GetAdjSize(vid, *r.begin, dir);
+    }
+    return hv;
+}
+
+//GCARE_CSET_SAMPLE: 0 builds from every vertex, 1 (uniform) or 2
+//(degree) from a sample
+int sampleMode() {
+    static const int mode = []() {
+        const char* sample = getenv("GCARE_CSET_SAMPLE");
+        string s = sample != nullptr ? sample : "";
+        if (s == "uniform") return 1;
+        if (s == "degree") return 2;
+        if (!s.empty()) std::cerr << "unknown GCARE_CSET_SAMPLE " << s << ", ignored\n";
+        return 0;
+    }();
+    return mode;
+}
+
+//a set expected to have fewer sampled vertices than this is built exactly
+const double RARE_HITS = 8;
+
+//bits to tell apart the ids of size sets
+int idBits(int size) {
+    int bits = 0;
+    while ((1ll << bits) < size) bits++;
+    return bits;
+}
+
+//ids, bits bits each, into words as VertexMap::Get reads them
+vector<uint64_t> packIds(const vector<int>& ids, int bits) {
+    vector<uint64_t> words(((uint64_t)ids.size() * bits + 63) / 64, 0);
+    for (size_t v = 0; v < ids.size() && bits > 0; v++) {
+        uint64_t at = (uint64_t)v * bits;
+        words[at / 64] |= (uint64_t)ids[v] << (at % 64);
+        if (at % 64 + bits > 64) words[at / 64 + 1] |= (uint64_t)ids[v] >> (64 - at % 64);
+    }
+    return words;
+}
+
+}
+
+bool CharacteristicSets::FixedSummary() {
+    return sampleMode() == 0;
+}
+
+//Vertex v is sampled with probability rate[v], and weight[v] becomes
+//1 / rate[v] (0 if it is not): ratio for every vertex, or under degree
+//sampling a rate per stratum of vertices whose total degree has the same
+//bit length, proportional to the square root of that degree (so that hubs,
+//whose stars vary most, are sampled more) and scaled to ratio * n
+//vertices in all. The draws hash the vertex with the estimator's seed.
+//The sets, their counts and the vertex map stay exact, from the hashes of
+//all stars; the frequencies of a set are those of its sampled stars,
+//scaled to its count, unless RARE_HITS says the sample is too thin for
+//it, or missed it, when its stars are counted exactly.
+void CharacteristicSets::sampleStars(DataGraph& g, double ratio, vector<double>& weight) {
+    int n = g.GetNumVertices();
+    uint64_t salt = rng_.Next();
+    vector<double> rate(n, ratio);
+    if (sampleMode() == 2) {
+        vector<int> stratum(n);
+        const int NUM_STRATA = 64;
+        vector<int64_t> size(NUM_STRATA, 0);
+        #pragma omp parallel
+        {
+            vector<int64_t> local(NUM_STRATA, 0);
+            #pragma omp for schedule(dynamic, 4096)
+            for (int vid = 0; vid < n; vid++) {
+                uint64_t degree = 1;
+                for (int dir = 0; dir < 2; dir++)
+                    for (auto r = g.GetELabels(vid, dir == 0); r.begin != r.end; r.begin++)
+                        degree += g.GetAdjSize(vid, *r.begin, dir == 0);
+                stratum[vid] = 63 - __builtin_clzll(degree);
+                local[stratum[vid]]++;
+            }
+            #pragma omp critical
+            for (int s = 0; s < NUM_STRATA; s++) size[s] += local[s];
+        }
+        //the scale c of rates min(1, c * 2^(s/2)) that samples ratio * n
+        //vertices, by bisection
+        auto expected = [&](double c) {
+            double e = 0;
+            for (int s = 0; s < NUM_STRATA; s++)
+                e += size[s] * std::min(1.0, c * std::exp2(s / 2.0));
+            return e;
+        };
+        double lo = 0, hi = 1;
+        for (int k = 0; k < 60; k++) {
+            double c = (lo + hi) / 2;
+            (expected(c) < ratio * n ? lo : hi) = c;
+        }
+        for (int vid = 0; vid < n; vid++)
+            rate[vid] = std::min(1.0, hi * std::exp2(stratum[vid] / 2.0));
+    }
+    weight.assign(n, 0);
+    #pragma omp parallel for schedule(static, 4096)
+    for (int vid = 0; vid < n; vid++) {
+        uint64_t h = (uint64_t)vid ^ salt;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        if ((h >> 11) * 0x1.0p-53 < rate[vid]) weight[vid] = 1 / rate[vid];
+    }
+
+    vector<int> freq;
+    for (int dir = 0; dir < 2; dir++) {
+        auto& cs = dir == 0 ? csets_ : rev_csets_;
+        const vector<int>& set_of = vertex_sets_[dir];
+        //the weighted stars of each set, and the expected hits of its count
+        vector<double> hits(cs.size(), 0), wcount(cs.size(), 0);
+        vector<vector<double>> wfreq(cs.size());
+        for (int vid = 0; vid < n; vid++) {
+            int k = set_of[vid];
+            hits[k] += rate[vid];
+            if (weight[vid] == 0) continue;
+            starHash(g, vid, dir == 0, &freq);
+            wcount[k] += weight[vid];
+            wfreq[k].resize(freq.size(), 0);
+            for (size_t j = 0; j < freq.size(); j++) wfreq[k][j] += weight[vid] * freq[j];
+        }
+        vector<char> exact(cs.size(), 0);
+        for (size_t k = 0; k < cs.size(); k++) {
+            exact[k] = wcount[k] == 0 || hits[k] < RARE_HITS;
+            if (exact[k]) continue;
+            cs[k].freq_.resize(wfreq[k].size());
+            for (size_t j = 0; j < wfreq[k].size(); j++)
+                cs[k].freq_[j] = llround(wfreq[k][j] * cs[k].count_ / wcount[k]);
+        }
+        for (int vid = 0; vid < n; vid++) {
+            int k = set_of[vid];
+            if (!exact[k]) continue;
+            starHash(g, vid, dir == 0, &freq);
+            cs[k].freq_.resize(freq.size(), 0);
+            for (size_t j = 0; j < freq.size(); j++) cs[k].freq_[j] += freq[j];
+        }
+    }
+}
+
+void CharacteristicSets::PrepareSummaryStructure(DataGraph& g, double ratio) {
+    const int MAX = 1e8;
+    //GCARE_CSET_SAMPLE: the frequencies and histograms from a sample of
+    //ratio of the vertices (see sampleStars)
+    bool sampled = sampleMode() != 0 && ratio > 0 && ratio < 1;
+    
+    //build characterisic sets with forward and backward stars, each thread
+    //over a contiguous vertex range; merging the ranges in order gives the
+    //same sets, in the same order, as one sequential pass. Sampled, the
+    //stars are just hashed, to find the sets and their counts
+    int num_threads = omp_get_max_threads();
+    int n = g.GetNumVertices();
+    auto begin_of = [&](int t) { return (int)((long long)n * t / num_threads); };
+    vector<CSetTable> fwd(num_threads), bwd(num_threads);
+    //until the merge, the index into the table of the vertex's thread
+    vertex_sets_[0].assign(n, 0);
+    vertex_sets_[1].assign(n, 0);
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int t = omp_get_thread_num();
+        int begin = begin_of(t);
+        int end = begin_of(t + 1);
+        vector<int> freq;
+        vector<int>* star = sampled ? nullptr : &freq;
+        for (int vid = begin; vid < end; vid++) {
+            size_t hv = starHash(g, vid, true, star);
+            vertex_sets_[0][vid] = fwd[t].Add(hv, vid, freq);
+            hv = starHash(g, vid, false, star);
+            vertex_sets_[1][vid] = bwd[t].Add(hv, vid, freq);
+        }
+    }
+    for (int t = 1; t < num_threads; t++) {
+        vector<int> moved[2] = {fwd[0].Merge(fwd[t]), bwd[0].Merge(bwd[t])};
+        for (int dir = 0; dir < 2; dir++)
+            for (int vid = begin_of(t); vid < begin_of(t + 1); vid++)
+                vertex_sets_[dir][vid] = moved[dir][vertex_sets_[dir][vid]];
+    }
+    csets_ = std::move(fwd[0].csets);
+    rev_csets_ = std::move(bwd[0].csets);
+    vector<double> weight; //of each vertex, if sampled
+    if (sampled)
+        sampleStars(g, ratio, weight);
+    for (int dir = 0; dir < 2; dir++) {
+        auto& cs = dir == 0 ? csets_ : rev_csets_;
+        vector<int> vid;
+        for (auto& c : cs) vid.push_back(c.vid_);
+        buildIndex(g, vid.size(), vid.data(), dir == 0, g.GetNumVLabels(), postings_data_[dir]);
+    }
+
+    const char* vertex_map = getenv("GCARE_CSET_VERTEX_MAP");
+    write_vertex_map_ = vertex_map != nullptr && atoi(vertex_map) == 1;
 
     //build histograms for basic join selectivity estimation
     num_buckets_ = std::min(g.GetNumVertices() + 1, (int)(csets_.size() + rev_csets_.size()));
     if (num_buckets_ > MAX / (g.GetNumVLabels() + g.GetNumELabels()))
         num_buckets_ = MAX / (g.GetNumVLabels() + g.GetNumELabels());
+    //under a byte budget the histograms get what the sets and their index
+    //leave, in whole HIST_ALIGN rows of buckets
+    if (max_summary_bytes_ > 0) {
+        size_t fixed = sizeof(int) * (2 + 4 + HIST_ALIGN + 4 + postings_data_[0].size() + postings_data_[1].size());
+        for (auto* cs : {&csets_, &rev_csets_}) {
+            fixed += sizeof(int) * (3 * cs->size() + 2);
+            for (auto& c : *cs) fixed += sizeof(int) * c.freq_.size();
+        }
+        //the vertex map goes first if the sets leave no room for it
+        size_t map_bytes = 0;
+        if (write_vertex_map_) {
+            for (auto* cs : {&csets_, &rev_csets_})
+                map_bytes += ((uint64_t)n * idBits(cs->size()) + 63) / 64 * sizeof(uint64_t);
+            if (fixed + map_bytes > max_summary_bytes_) {
+                write_vertex_map_ = false;
+                build_report_ = "no vertex map";
+            } else {
+                fixed += map_bytes;
+            }
+        }
+        int num_hist = g.GetNumVLabels() + g.GetNumELabels();
+        //a row of stride ints and an int64 total per label and direction
+        size_t per_label = 2 * sizeof(int64_t);
+        size_t left = max_summary_bytes_ > fixed + num_hist * per_label ?
+            (max_summary_bytes_ - fixed - num_hist * per_label) / (2 * sizeof(int) * num_hist) : 0;
+        int fit = std::max<int>(1, left / HIST_ALIGN * HIST_ALIGN);
+        if (fit < num_buckets_) {
+            build_report_ += string(build_report_.empty() ? "" : ", ") + "histogram buckets " + to_string(fit) + " of " + to_string(num_buckets_);
+            num_buckets_ = fit;
+        }
+        if (fixed > max_summary_bytes_)
+            build_report_ += string(build_report_.empty() ? "" : ", ") + "sets alone take " + to_string(fixed) + " bytes";
+    }
     bucket_size_ = (g.GetNumVertices() + g.GetNumVLabels()) / num_buckets_;
     bucket_size_ = std::max(1, bucket_size_);
 
     hist_.clear();
     hist_.resize(g.GetNumVLabels() + g.GetNumELabels(), vector<vector<int>>(2, vector<int>(num_buckets_, 0)));
-    for (int srcid = 0; srcid < g.GetNumVertices(); srcid++) {
-        auto r = g.GetVLabels(srcid);
-        for (; r.begin != r.end; r.begin++) {
-            int vl = *r.begin;
-            hist_[vl][0][(srcid + g.GetNumVLabels()) % num_buckets_]++;
-            hist_[vl][1][vl % num_buckets_]++;
-        }
-        r = g.GetELabels(srcid, true);
-        for (; r.begin != r.end; r.begin++) {
-            int el = *r.begin;
-            auto adj = g.GetAdj(srcid, el, true);
-            for (; adj.begin != adj.end; adj.begin++) {
-                int dstid = *adj.begin; 
-                hist_[g.GetNumVLabels() + el][0][(srcid + g.GetNumVLabels()) % num_buckets_]++;
-                hist_[g.GetNumVLabels() + el][1][(dstid + g.GetNumVLabels()) % num_buckets_]++;
+    //an edge counts in the src bucket of its src and the dst bucket of its
+    //dst, so every entry follows from one vertex's degrees; vertex v lands
+    //in bucket (v + |VL|) % num_buckets_, so threads owning disjoint bucket
+    //ranges never write the same entry
+    int vl_num = g.GetNumVLabels();
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int t = omp_get_thread_num();
+        int b_begin = (long long)num_buckets_ * t / num_threads;
+        int b_end = (long long)num_buckets_ * (t + 1) / num_threads;
+        for (long long base = 0; base < (long long)g.GetNumVertices() + vl_num; base += num_buckets_) {
+            int begin = std::max(0LL, base + b_begin - vl_num);
+            int end = std::min((long long)g.GetNumVertices(), base + b_end - vl_num);
+            for (int vid = begin; vid < end; vid++) {
+                if (sampled && weight[vid] == 0) continue;
+                //sampled, the entries of a vertex stand for 1 / rate of them
+                auto scale = [&](int x) { return sampled ? (int)llround(x * weight[vid]) : x; };
+                int b = (vid + vl_num) % num_buckets_;
+                auto r = g.GetVLabels(vid);
+                for (; r.begin != r.end; r.begin++)
+                    hist_[*r.begin][0][b] += scale(1);
+                r = g.GetELabels(vid, true);
+                for (; r.begin != r.end; r.begin++)
+                    hist_[vl_num + *r.begin][0][b] += scale(g.GetAdjSize(vid, *r.begin, true));
+                r = g.GetELabels(vid, false);
+                for (; r.begin != r.end; r.begin++)
+                    hist_[vl_num + *r.begin][1][b] += scale(g.GetAdjSize(vid, *r.begin, false));
             }
         }
     }
+    //the vertex label itself is the "dst" of a vertex label triple
+    for (int vl = 0; vl < vl_num; vl++)
+        hist_[vl][1][vl % num_buckets_] += g.GetNumVertices(vl);
 }
 
-void CharacteristicSets::WriteSummary(const char* fn) {
-    FILE* fp = fopen(fn, "w");
-    fprintf(fp, "%zu\n", csets_.size());
-    for (size_t i = 0; i < csets_.size(); i++) {
-        fprintf(fp, "%d %d %zu\n", csets_[i].count_, csets_[i].vid_, csets_[i].freq_.size());
-        for (int cnt : csets_[i].freq_)
-            fprintf(fp, "%d ", cnt);
-        fprintf(fp, "\n");
-    }
-    fprintf(fp, "%zu\n", rev_csets_.size());
-    for (size_t i = 0; i < rev_csets_.size(); i++) {
-        fprintf(fp, "%d %d %zu\n", rev_csets_[i].count_, rev_csets_[i].vid_, rev_csets_[i].freq_.size());
-        for (int cnt : rev_csets_[i].freq_)
-            fprintf(fp, "%d ", cnt);
-        fprintf(fp, "\n");
-    }
-    fprintf(fp, "%d %d %zu\n", num_buckets_, bucket_size_, hist_.size()); 
+//binary summary: CSET_MAGIC, CSET_VERSION, then for forward and backward
+//sets: n, count[n], vid[n], freq_offset[n + 1], freq[]; then num_buckets,
+//bucket_size, num_hist, stride (since version 3), zeros up to a multiple
+//of HIST_ALIGN ints, hist[num_hist][2][stride] with rows zero-padded to
+//stride (a multiple of HIST_ALIGN), the int64 totals[num_hist][2] of the
+//rows; then the forward and backward index blocks (since version 2, with
+//slots since version 5); then
+//(since version 4) n, the bits of a forward and of a backward set id, a
+//zero int if need be to reach a multiple of 2 ints, and unless n is 0 the
+//uint64 words of the forward and then the backward set of each of the n
+//vertices, packed as VertexMap reads them; all ints unless noted. Versions
+//before 3 have no stride, padding or totals.
+static void writeCSets(FILE* fp, const vector<CharacteristicSets::CSet>& csets) {
+    int n = csets.size();
+    vector<int> buf;
+    buf.reserve(3 * n + 2);
+    buf.push_back(n);
+    for (auto& c : csets) buf.push_back(c.count_);
+    for (auto& c : csets) buf.push_back(c.vid_);
+    buf.push_back(0);
+    for (auto& c : csets) buf.push_back(buf.back() + c.freq_.size());
+    fwrite(buf.data(), sizeof(int), buf.size(), fp);
+    for (auto& c : csets)
+        fwrite(c.freq_.data(), sizeof(int), c.freq_.size(), fp);
+}
 
-    string hist_fn = string(fn) + ".hist";
-    FILE* hp = fopen(hist_fn.c_str(), "w");
+void CharacteristicSets::WriteSummary(const char* fn) {
+    FILE* fp = fopen(fn, "wb");
+    int header[2] = {CSET_MAGIC, CSET_VERSION};
+    fwrite(header, sizeof(int), 2, fp);
+    writeCSets(fp, csets_);
+    writeCSets(fp, rev_csets_);
+    int stride = (num_buckets_ + HIST_ALIGN - 1) / HIST_ALIGN * HIST_ALIGN;
+    int hist_header[4] = {num_buckets_, bucket_size_, (int)hist_.size(), stride};
+    fwrite(hist_header, sizeof(int), 4, fp);
+    long ints = ftell(fp) / sizeof(int);
+    vector<int> row((HIST_ALIGN - ints % HIST_ALIGN) % HIST_ALIGN, 0);
+    fwrite(row.data(), sizeof(int), row.size(), fp);
+    vector<int64_t> totals;
     for (int label = 0; label < hist_.size(); label++) {
         for (int i = 0; i < 2; i++) {
-            fwrite(hist_[label][i].data(), sizeof(int), num_buckets_, hp);
+            row.assign(hist_[label][i].begin(), hist_[label][i].end());
+            row.resize(stride, 0);
+            fwrite(row.data(), sizeof(int), stride, fp);
+            int64_t total = 0;
+            for (int h : hist_[label][i]) total += h;
+            totals.push_back(total);
         }
     }
-    fclose(hp);
+    fwrite(totals.data(), sizeof(int64_t), totals.size(), fp);
+    for (int dir = 0; dir < 2; dir++)
+        fwrite(postings_data_[dir].data(), sizeof(int), postings_data_[dir].size(), fp);
+    int map_header[4] = {write_vertex_map_ ? (int)vertex_sets_[0].size() : 0,
+        idBits(csets_.size()), idBits(rev_csets_.size()), 0};
+    ints = ftell(fp) / sizeof(int);
+    fwrite(map_header, sizeof(int), 3 + (ints + 3) % 2, fp);
+    if (write_vertex_map_)
+        for (int dir = 0; dir < 2; dir++) {
+            vector<uint64_t> words = packIds(vertex_sets_[dir], map_header[1 + dir]);
+            fwrite(words.data(), sizeof(uint64_t), words.size(), fp);
+        }
+    fclose(fp);
+
+    //fn.vsets: n, then the forward and the backward set of each of the n
+    //vertices; only UpdateSummary reads it
+    string vsets = string(fn) + ".vsets";
+    fp = fopen(vsets.c_str(), "wb");
+    int n = vertex_sets_[0].size();
+    fwrite(&n, sizeof(int), 1, fp);
+    for (int dir = 0; dir < 2; dir++)
+        fwrite(vertex_sets_[dir].data(), sizeof(int), n, fp);
+    fclose(fp);
+}
+
+//points cs into the flat layout at p; returns the end of it
+static const int* attachCSets(const int* p, CharacteristicSets::FlatCSets& cs) {
+    cs.size = *p++;
+    cs.count = p;
+    p += cs.size;
+    cs.vid = p;
+    p += cs.size;
+    cs.freq_offset = p;
+    p += cs.size + 1;
+    cs.freq = p;
+    return p + cs.freq_offset[cs.size];
 }
 
 void CharacteristicSets::ReadSummary(const char* fn) {
+    summary_file_ = LoadShared(fn, SummaryLoadMode());
+    if (summary_file_ == nullptr) {
+        fprintf(stderr, "cannot load %s\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    summary_ = summary_file_->data;
+    summary_size_ = summary_file_->size;
+    text_totals_.clear();
+    const int* p = (const int*) summary_;
+    const int* end = p + summary_size_ / sizeof(int);
+    int version = 0;
+    if (summary_size_ < 2 * sizeof(int) || p[0] != CSET_MAGIC) {
+        //text summary written by earlier versions
+        summary_file_.reset();
+        summary_ = nullptr;
+        summary_size_ = 0;
+        readTextSummary(fn);
+        p = text_summary_.data();
+        end = p + text_summary_.size();
+    } else if (p[1] < 1 || p[1] > CSET_VERSION) {
+        fprintf(stderr, "%s: unsupported summary version %d\n", fn, p[1]);
+        exit(EXIT_FAILURE);
+    } else {
+        version = p[1];
+        p += 2;
+    }
+    p = attachCSets(p, csets_view_);
+    p = attachCSets(p, rev_csets_view_);
+    num_buckets_ = p[0];
+    bucket_size_ = p[1];
+    int num_hist = p[2];
+    if (version >= 3) {
+        hist_stride_ = p[3];
+        p += 4;
+        const int* base = (const int*) summary_;
+        p = base + (p - base + HIST_ALIGN - 1) / HIST_ALIGN * HIST_ALIGN;
+        hist_data_ = p;
+        p = hist_data_ + (size_t)num_hist * 2 * hist_stride_;
+        hist_totals_ = (const int64_t*) p;
+        p += (size_t)num_hist * 2 * sizeof(int64_t) / sizeof(int);
+    } else {
+        hist_stride_ = num_buckets_;
+        hist_data_ = p + 3;
+        p = hist_data_ + (size_t)num_hist * 2 * num_buckets_;
+        text_totals_.assign((size_t)num_hist * 2, 0);
+        for (size_t r = 0; r < text_totals_.size(); r++)
+            for (int b = 0; b < num_buckets_; b++)
+                text_totals_[r] += hist_data_[r * hist_stride_ + b];
+        hist_totals_ = text_totals_.data();
+    }
+    //older summaries have no index, or one without slots; it is built on
+    //first use
+    postings_built_ = version >= 5;
+    if (version >= 2) {
+        p = attachIndex(p, postings_, postings_built_);
+        p = attachIndex(p, rev_postings_, postings_built_);
+    }
+    vertex_map_[0].n = vertex_map_[1].n = 0;
+    if (version >= 4) {
+        int n = p[0];
+        const int* bits = p + 1;
+        p += 3;
+        const int* base = (const int*) summary_;
+        p += (p - base) % 2;
+        for (int dir = 0; dir < 2 && n > 0; dir++) {
+            vertex_map_[dir].n = n;
+            vertex_map_[dir].bits = bits[dir];
+            vertex_map_[dir].words = (const uint64_t*) p;
+            p += ((uint64_t)n * bits[dir] + 63) / 64 * sizeof(uint64_t) / sizeof(int);
+        }
+    }
+    if (p != end) {
+        fprintf(stderr, "%s: corrupt summary\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    num_hist_ = num_hist;
+    if (summary_file_ != nullptr)
+        summary_file_->Sections(3 * (size_t)num_hist);
+}
+
+//every view but those into text_summary_, text_totals_ or postings_data_,
+//which only summaries older than version 3 have, points into the file
+bool CharacteristicSets::ShareSummary(const Estimator& from) {
+    auto other = dynamic_cast<const CharacteristicSets*>(&from);
+    if (other == nullptr || other->summary_file_ == nullptr || !other->text_totals_.empty()
+            || !other->postings_data_[0].empty() || !other->postings_data_[1].empty())
+        return false;
+    summary_file_ = other->summary_file_;
+    summary_ = other->summary_;
+    summary_size_ = other->summary_size_;
+    csets_view_ = other->csets_view_;
+    rev_csets_view_ = other->rev_csets_view_;
+    num_buckets_ = other->num_buckets_;
+    bucket_size_ = other->bucket_size_;
+    hist_data_ = other->hist_data_;
+    hist_stride_ = other->hist_stride_;
+    hist_totals_ = other->hist_totals_;
+    num_hist_ = other->num_hist_;
+    postings_built_ = other->postings_built_;
+    postings_ = other->postings_;
+    rev_postings_ = other->rev_postings_;
+    vertex_map_[0] = other->vertex_map_[0];
+    vertex_map_[1] = other->vertex_map_[1];
+    return true;
+}
+
+//parses a text summary (and its .hist file) into the binary layout
+void CharacteristicSets::readTextSummary(const char* fn) {
+    vector<int>& out = text_summary_;
+    out.clear();
     FILE* fp = fopen(fn, "r");
-    int csize;
-    fscanf(fp, "%d", &csize);
-    while (csize--) {
-        csets_.push_back(CSet());
-        size_t idx = csets_.size() - 1;
-        int size;
-        fscanf(fp, "%d %d %d", &csets_[idx].count_, &csets_[idx].vid_, &size);
-        int tmp;
-        while (size--) {
-            fscanf(fp, "%d", &tmp);
-            csets_[idx].freq_.push_back(tmp);
-        }
-    }
-    fscanf(fp, "%d", &csize);
-    while (csize--) {
-        rev_csets_.push_back(CSet());
-        size_t idx = rev_csets_.size() - 1;
-        int size;
-        fscanf(fp, "%d %d %d", &rev_csets_[idx].count_, &rev_csets_[idx].vid_, &size);
-        int tmp;
-        while (size--) {
-            fscanf(fp, "%d", &tmp);
-            rev_csets_[idx].freq_.push_back(tmp);
-        }
-    }
-    int num_hist;
-    fscanf(fp, "%d %d %d", &num_buckets_, &bucket_size_, &num_hist);
+    for (int dir = 0; dir < 2; dir++) {
+        int csize;
+        fscanf(fp, "%d", &csize);
+        vector<int> count(csize), vid(csize), offset(csize + 1, 0), freq;
+        for (int i = 0; i < csize; i++) {
+            int size;
+            fscanf(fp, "%d %d %d", &count[i], &vid[i], &size);
+            int tmp;
+            while (size--) {
+                fscanf(fp, "%d", &tmp);
+                freq.push_back(tmp);
+            }
+            offset[i + 1] = freq.size();
+        }
+        out.push_back(csize);
+        out.insert(out.end(), count.begin(), count.end());
+        out.insert(out.end(), vid.begin(), vid.end());
+        out.insert(out.end(), offset.begin(), offset.end());
+        out.insert(out.end(), freq.begin(), freq.end());
+    }
+    int num_buckets, bucket_size, num_hist;
+    fscanf(fp, "%d %d %d", &num_buckets, &bucket_size, &num_hist);
     fclose(fp);
+    out.push_back(num_buckets);
+    out.push_back(bucket_size);
+    out.push_back(num_hist);
 
-    hist_.clear();
-    hist_.resize(num_hist, vector<vector<int>>(2, vector<int>(num_buckets_, 0)));
+    size_t hist_begin = out.size();
+    size_t hist_size = (size_t)num_hist * 2 * num_buckets;
+    out.resize(hist_begin + hist_size, 0);
     string hist_fn = string(fn) + ".hist";
     FILE* hp = fopen(hist_fn.c_str(), "r");
-    for (int label = 0; label < num_hist; label++) {
-        for (int i = 0; i < 2; i++) {
-            fread(hist_[label][i].data(), sizeof(int), num_buckets_, hp);
+    fread(out.data() + hist_begin, sizeof(int), hist_size, hp);
+    fclose(hp);
+}
+
+namespace {
+
+//the star of a vertex under update: its keys (see starKeys) with their
+//frequencies, laid out as CSet::freq_
+struct Star {
+    vector<int> keys, freq;
+
+    void Add(int key, int d) {
+        size_t i = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+        if (i == keys.size() || keys[i] != key) {
+            keys.insert(keys.begin() + i, key);
+            freq.insert(freq.begin() + i, 0);
+        }
+        freq[i] += d;
+        if (freq[i] == 0) {
+            keys.erase(keys.begin() + i);
+            freq.erase(freq.begin() + i);
         }
     }
-    fclose(hp);
+
+    //as PrepareSummaryStructure hashes the labels
+    size_t Hash() const {
+        size_t hv = 0;
+        for (int k : keys) boost::hash_combine(hv, k);
+        return hv;
+    }
+};
+
+//writes bytes at p to the int at index pos of fp
+void writeAt(FILE* fp, size_t pos, const void* p, size_t bytes) {
+    fseek(fp, pos * sizeof(int), SEEK_SET);
+    fwrite(p, 1, bytes, fp);
+}
+
+}
+
+//the summary fn of g into the build mode structures, with the vertices'
+//sets from fn.vsets
+void CharacteristicSets::loadForUpdate(DataGraph& g, const char* fn) {
+    size_t size = 0;
+    char* data = LoadFile(fn, size, LOAD_COPY);
+    const int* p = (const int*) data;
+    if (data == nullptr || size < 2 * sizeof(int) || p[0] != CSET_MAGIC || p[1] != CSET_VERSION) {
+        fprintf(stderr, "%s: not a version %d summary, rebuild it\n", fn, CSET_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    p += 2;
+    for (int dir = 0; dir < 2; dir++) {
+        FlatCSets view;
+        p = attachCSets(p, view);
+        auto& cs = dir == 0 ? csets_ : rev_csets_;
+        cs.assign(view.size, CSet());
+        for (int i = 0; i < view.size; i++) {
+            cs[i].count_ = view.count[i];
+            cs[i].vid_ = view.vid[i];
+            cs[i].freq_.assign(view.freq + view.freq_offset[i], view.freq + view.freq_offset[i + 1]);
+        }
+    }
+    num_buckets_ = p[0];
+    bucket_size_ = p[1];
+    int num_hist = p[2];
+    size_t stride = p[3];
+    p += 4;
+    const int* base = (const int*) data;
+    p = base + (p - base + HIST_ALIGN - 1) / HIST_ALIGN * HIST_ALIGN;
+    hist_.assign(num_hist, vector<vector<int>>(2));
+    for (int label = 0; label < num_hist; label++)
+        for (int c = 0; c < 2; c++) {
+            const int* row = p + ((size_t)label * 2 + c) * stride;
+            hist_[label][c].assign(row, row + num_buckets_);
+        }
+    //past the totals and the index blocks, whether it has a vertex map
+    p += (size_t)num_hist * 2 * stride + (size_t)num_hist * 2 * sizeof(int64_t) / sizeof(int);
+    Postings index;
+    p = attachIndex(p, index);
+    p = attachIndex(p, index);
+    write_vertex_map_ = p[0] > 0;
+    UnloadFile(data, size, LOAD_COPY);
+
+    string vsets = string(fn) + ".vsets";
+    FILE* fp = fopen(vsets.c_str(), "rb");
+    int n = -1;
+    if (fp != nullptr && fread(&n, sizeof(int), 1, fp) == 1 && n == g.GetNumVertices()) {
+        for (int dir = 0; dir < 2; dir++) {
+            vertex_sets_[dir].resize(n);
+            if (fread(vertex_sets_[dir].data(), sizeof(int), n, fp) != (size_t)n) n = -1;
+        }
+    }
+    if (fp != nullptr) fclose(fp);
+    if (n != g.GetNumVertices()) {
+        fprintf(stderr, "%s is missing or not of this data graph, rebuild the summary\n", vsets.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+//Every vertex whose star the updates change moves from its set to the set
+//of its new star, found by the hash PrepareSummaryStructure groups by, or
+//else a new one, and every edge moves the histogram entries of its ends.
+//A set left empty is dropped, and a set whose representative moved out
+//takes another of its vertices, which has the set's labels in the updated
+//graph too. The buckets stay those of the build. Unless a set was added or
+//dropped or a label is new, the layout stays the same and only the changed
+//sets, histogram rows and vertices are written over the old summary.
+bool CharacteristicSets::UpdateSummary(DataGraph& g, const char* fn, const char* updates) {
+    loadForUpdate(g, fn);
+    int n = g.GetNumVertices();
+    int vl_num = g.GetNumVLabels();
+    size_t num_hist = hist_.size();
+
+    //per direction: updated vertex -> its star before and after the updates
+    unordered_map<int, pair<Star, Star>> stars[2];
+    auto star = [&](int dir, int v) -> Star& {
+        auto it = stars[dir].find(v);
+        if (it == stars[dir].end()) {
+            Star s;
+            starKeys(g, v, dir == 0, vl_num, s.keys);
+            for (int k : s.keys) {
+                if (dir == 0 && k < vl_num)
+                    s.freq.push_back(1);
+                else
+                    s.freq.push_back(g.GetAdjSize(v, dir == 0 ? k - vl_num : k, dir == 0));
+            }
+            it = stars[dir].emplace(v, std::make_pair(s, s)).first;
+        }
+        return it->second.second;
+    };
+    //(src, dst, el) -> insertions minus deletions so far
+    std::map<std::tuple<int, int, int>, int> added;
+    std::set<pair<int, int>> rows; //changed histogram rows: (label, src/dst)
+
+    FILE* fp = fopen(updates, "r");
+    if (fp == nullptr) {
+        fprintf(stderr, "cannot open %s\n", updates);
+        exit(EXIT_FAILURE);
+    }
+    char line[256];
+    for (int line_no = 1; fgets(line, sizeof(line), fp) != nullptr; line_no++) {
+        char op;
+        int src, dst, el;
+        int fields = sscanf(line, " %c %d %d %d", &op, &src, &dst, &el);
+        if (fields <= 0 || op == '#') continue;
+        if (fields != 4 || (op != '+' && op != '-') || src < 0 || src >= n
+                || dst < 0 || dst >= n || el < 0) {
+            fprintf(stderr, "%s:%d: expected \"+|- src dst el\"\n", updates, line_no);
+            exit(EXIT_FAILURE);
+        }
+        auto edge = std::make_tuple(src, dst, el);
+        int d = op == '+' ? 1 : -1;
+        if (d < 0) {
+            range adj = g.GetAdj(src, el, true);
+            auto eq = std::equal_range(adj.begin, adj.end, dst);
+            auto it = added.find(edge);
+            if ((eq.second - eq.first) + (it == added.end() ? 0 : it->second) <= 0) {
+                fprintf(stderr, "%s:%d: no edge %d %d %d to delete, skipped\n", updates, line_no, src, dst, el);
+                continue;
+            }
+        }
+        added[edge] += d;
+        star(0, src).Add(vl_num + el, d);
+        star(1, dst).Add(el, d);
+        int label = vl_num + el;
+        if (label >= (int)hist_.size())
+            hist_.resize(label + 1, vector<vector<int>>(2, vector<int>(num_buckets_, 0)));
+        hist_[label][0][(src + vl_num) % num_buckets_] += d;
+        hist_[label][1][(dst + vl_num) % num_buckets_] += d;
+        rows.emplace(label, 0);
+        rows.emplace(label, 1);
+    }
+    fclose(fp);
+
+    bool relayout = hist_.size() != num_hist;
+    vector<int> changed[2]; //sets whose count, representative or freq changed
+    vector<int> moved[2]; //vertices whose set changed
+    vector<vector<int>> keys[2]; //of each set, for the index
+    for (int dir = 0; dir < 2; dir++) {
+        auto& cs = dir == 0 ? csets_ : rev_csets_;
+        auto& sets = vertex_sets_[dir];
+        unordered_map<size_t, int> idx;
+        keys[dir].resize(cs.size());
+        for (size_t i = 0; i < cs.size(); i++) {
+            starKeys(g, cs[i].vid_, dir == 0, vl_num, keys[dir][i]);
+            size_t hv = 0;
+            for (int k : keys[dir][i]) boost::hash_combine(hv, k);
+            idx.emplace(hv, i);
+        }
+        size_t num_sets = cs.size();
+        for (auto& s : stars[dir]) {
+            int v = s.first;
+            const Star& before = s.second.first;
+            const Star& after = s.second.second;
+            if (before.freq == after.freq && before.keys == after.keys) continue;
+            int from = sets[v];
+            cs[from].count_--;
+            for (size_t j = 0; j < before.freq.size(); j++)
+                cs[from].freq_[j] -= before.freq[j];
+            auto it = idx.find(after.Hash());
+            if (it == idx.end()) {
+                it = idx.emplace(after.Hash(), cs.size()).first;
+                cs.push_back(CSet());
+                cs.back().vid_ = v;
+                cs.back().freq_.assign(after.freq.size(), 0);
+                keys[dir].push_back(after.keys);
+            }
+            int to = it->second;
+            cs[to].count_++;
+            for (size_t j = 0; j < after.freq.size(); j++)
+                cs[to].freq_[j] += after.freq[j];
+            if (to != from) {
+                sets[v] = to;
+                moved[dir].push_back(v);
+            }
+            changed[dir].push_back(from);
+            changed[dir].push_back(to);
+        }
+        std::sort(changed[dir].begin(), changed[dir].end());
+        changed[dir].erase(std::unique(changed[dir].begin(), changed[dir].end()), changed[dir].end());
+
+        //drop the empty sets, keeping the order of the others
+        vector<int> index(cs.size(), -1);
+        size_t kept = 0;
+        for (size_t i = 0; i < cs.size(); i++) {
+            if (cs[i].count_ == 0) continue;
+            index[i] = kept;
+            if (kept != i) {
+                cs[kept] = std::move(cs[i]);
+                keys[dir][kept] = std::move(keys[dir][i]);
+            }
+            kept++;
+        }
+        relayout |= kept != num_sets || cs.size() != num_sets;
+        cs.resize(kept);
+        keys[dir].resize(kept);
+        if (kept != index.size()) {
+            for (int& i : sets) i = index[i];
+            for (int& i : changed[dir]) i = index[i];
+            changed[dir].erase(std::remove(changed[dir].begin(), changed[dir].end(), -1), changed[dir].end());
+        }
+
+        //a vertex still in the set for those whose representative left
+        vector<char> orphan(cs.size(), 0);
+        int orphans = 0;
+        for (int i : changed[dir])
+            if (sets[cs[i].vid_] != i) {
+                orphan[i] = 1;
+                orphans++;
+            }
+        for (int v = 0; v < n && orphans > 0; v++)
+            if (orphan[sets[v]]) {
+                orphan[sets[v]] = 0;
+                cs[sets[v]].vid_ = v;
+                orphans--;
+            }
+    }
+
+    if (relayout) {
+        for (int dir = 0; dir < 2; dir++)
+            buildIndex(keys[dir].size(), [&](int i, vector<int>& k) { k = keys[dir][i]; },
+                    postings_data_[dir]);
+        WriteSummary(fn);
+        return true;
+    }
+
+    fp = fopen(fn, "r+b");
+    size_t pos = 2;
+    for (int dir = 0; dir < 2; dir++) {
+        auto& cs = dir == 0 ? csets_ : rev_csets_;
+        size_t num_sets = cs.size();
+        vector<size_t> offset(1, 0);
+        for (auto& c : cs) offset.push_back(offset.back() + c.freq_.size());
+        size_t count_at = pos + 1, vid_at = count_at + num_sets;
+        size_t freq_at = vid_at + 2 * num_sets + 1;
+        for (int i : changed[dir]) {
+            writeAt(fp, count_at + i, &cs[i].count_, sizeof(int));
+            writeAt(fp, vid_at + i, &cs[i].vid_, sizeof(int));
+            writeAt(fp, freq_at + offset[i], cs[i].freq_.data(), cs[i].freq_.size() * sizeof(int));
+        }
+        pos = freq_at + offset.back();
+    }
+    pos += 4;
+    pos = (pos + HIST_ALIGN - 1) / HIST_ALIGN * HIST_ALIGN;
+    size_t stride = (num_buckets_ + HIST_ALIGN - 1) / HIST_ALIGN * HIST_ALIGN;
+    size_t totals_at = pos + num_hist * 2 * stride;
+    for (auto& r : rows) {
+        size_t row = (size_t)r.first * 2 + r.second;
+        const vector<int>& h = hist_[r.first][r.second];
+        writeAt(fp, pos + row * stride, h.data(), h.size() * sizeof(int));
+        int64_t total = 0;
+        for (int x : h) total += x;
+        writeAt(fp, totals_at + row * sizeof(int64_t) / sizeof(int), &total, sizeof(int64_t));
+    }
+    fclose(fp);
+
+    string vsets = string(fn) + ".vsets";
+    fp = fopen(vsets.c_str(), "r+b");
+    for (int dir = 0; dir < 2; dir++)
+        for (int v : moved[dir])
+            writeAt(fp, 1 + (size_t)dir * n + v, &vertex_sets_[dir][v], sizeof(int));
+    fclose(fp);
+
+    //the set ids keep their width, so the vertex map ending the summary is
+    //packed again in place
+    if (write_vertex_map_ && (!moved[0].empty() || !moved[1].empty())) {
+        vector<uint64_t> words[2];
+        for (int dir = 0; dir < 2; dir++)
+            words[dir] = packIds(vertex_sets_[dir], idBits(dir == 0 ? csets_.size() : rev_csets_.size()));
+        fp = fopen(fn, "r+b");
+        fseek(fp, -(long)((words[0].size() + words[1].size()) * sizeof(uint64_t)), SEEK_END);
+        for (int dir = 0; dir < 2; dir++)
+            fwrite(words[dir].data(), sizeof(uint64_t), words[dir].size(), fp);
+        fclose(fp);
+    }
+    return true;
+}
+
+//cand_ = ids of the sets having every label in keys, shortest list first
+void CharacteristicSets::findCandidates(vector<int>& keys, const Postings& index, int size) {
+    cand_.clear();
+    cand_pos_ = 0;
+    if (keys.empty()) {
+        for (int i = 0; i < size; i++) cand_.push_back(i);
+        return;
+    }
+    auto length = [&](int k) { range r = index.Get(k); return r.end - r.begin; };
+    std::sort(keys.begin(), keys.end(), [&](int a, int b) { return length(a) < length(b); });
+    range r = index.Get(keys[0]);
+    cand_.assign(r.begin, r.end);
+    for (size_t j = 1; j < keys.size() && !cand_.empty(); j++) {
+        range c {cand_.data(), cand_.data() + cand_.size()};
+        cand_tmp_.resize(cand_.size());
+        cand_tmp_.resize(Intersect(c, index.Get(keys[j]), cand_tmp_.data()));
+        cand_.swap(cand_tmp_);
+    }
 }
 
 void CharacteristicSets::Init() {
     offset_ = g->GetNumVLabels();
+    if (!postings_built_) {
+        buildIndex(*g, csets_view_.size, csets_view_.vid, true, offset_, postings_data_[0]);
+        buildIndex(*g, rev_csets_view_.size, rev_csets_view_.vid, false, offset_, postings_data_[1]);
+        attachIndex(postings_data_[0].data(), postings_);
+        attachIndex(postings_data_[1].data(), rev_postings_);
+        postings_built_ = true;
+    }
     covered_.clear();
     dq_.clear();
     pos_ = -1;
@@ -304,9 +1116,37 @@ int CharacteristicSets::DecomposeQuery() {
             dq_.push_back(make_pair(-i, true));
         }
     }
+    fetchSections();
     return dq_.size();
 }
 
+//a LOAD_LAZY summary is brought in by the labels of the queries: the first
+//query having key k reads in its forward index list (section k), its
+//backward one (num_hist_ + k, of an edge label) and its histogram rows
+//(2 num_hist_ + k); the sets themselves come in as the stars touch them
+void CharacteristicSets::fetchSections() {
+    if (summary_file_ == nullptr || summary_file_->mode != LOAD_LAZY)
+        return;
+    auto list = [](const Postings& index, int key) {
+        range r = index.Get(key);
+        size_t bytes = (r.end - r.begin) * sizeof(int);
+        PrefaultRange(r.begin, bytes);
+        if (bytes > 0)
+            PrefaultRange(index.Slots(key), bytes);
+    };
+    for (auto& node : nodes_) {
+        int key = node.third;
+        if (key >= num_hist_)
+            continue;
+        if (summary_file_->Claim(key))
+            list(postings_, key);
+        if (key >= offset_ && summary_file_->Claim(num_hist_ + key - offset_))
+            list(rev_postings_, key - offset_);
+        if (summary_file_->Claim(2 * (size_t)num_hist_ + key))
+            PrefaultRange(HistRow(key, 0), 2 * hist_stride_ * sizeof(int));
+    }
+}
+
 bool CharacteristicSets::GetSubstructure(int subquery_index) {
     int v = dq_[subquery_index].first;
     //an edge between unlabeled vertices
@@ -318,115 +1158,104 @@ bool CharacteristicSets::GetSubstructure(int subquery_index) {
         pos_ = -2; 
         return true;
     }
-    //forward star
-    if (dq_[subquery_index].second) {
-        for (int i = pos_ + 1; i < csets_.size(); i++) {
-            bool flag = true;
-            for (int j = 0; j < rdf_q_adj_lists_[v].size(); j++) {
-                int pi = rdf_q_adj_lists_[v][j].second - offset_;
-                int srcid = csets_[i].vid_;
-                if (pi >= 0) {
-                    if (!g->HasELabel(srcid, pi, true)) {
-                        flag = false;
-                        break;
-                    }
-                } else {
-                    if (!g->HasVLabel(srcid, pi + offset_)) {
-                        flag = false;
-                        break;
-                    }
-                }
-            }
-            if (!flag)
-                continue;
-            pos_ = i;
-            return true; 
-        }
-    } else {
-    //backward star
-        for (int i = pos_ + 1; i < rev_csets_.size(); i++) {
-            bool flag = true;
-            for (int j = 0; j < rdf_q_rev_adj_lists_[v].size(); j++) {
-                int pi = rdf_q_rev_adj_lists_[v][j].second - offset_; 
-                assert(pi >= 0);
-                int dstid = rev_csets_[i].vid_;
-                int begin, end;
-                if (!g->HasELabel(dstid, pi, false)) {
-                    flag = false;
+    //the sets to visit are looked up once per star
+    if (pos_ == -1) {
+        bool forward = dq_[subquery_index].second;
+        auto& adj = forward ? rdf_q_adj_lists_[v] : rdf_q_rev_adj_lists_[v];
+        cand_keys_.clear();
+        for (auto& t : adj)
+            cand_keys_.push_back(forward ? t.second : t.second - offset_);
+        const VertexMap& map = vertex_map_[forward ? 0 : 1];
+        int bound = v - offset_ >= 0 ? q->GetBound(v - offset_) : -1;
+        if (bound != -1 && bound < map.n) {
+            //a bound center's star is that of its own set, if the set has
+            //every label of it
+            int set = map.Get(bound);
+            const Postings& index = forward ? postings_ : rev_postings_;
+            cand_.assign(1, set);
+            cand_pos_ = 0;
+            for (int k : cand_keys_) {
+                range r = index.Get(k);
+                if (!std::binary_search(r.begin, r.end, set)) {
+                    cand_.clear();
                     break;
                 }
             }
-            if (!flag) 
-                continue;
-            pos_ = i;
-            return true; 
+        } else if (forward) {
+            findCandidates(cand_keys_, postings_, csets_view_.size);
+        } else {
+            findCandidates(cand_keys_, rev_postings_, rev_csets_view_.size);
         }
+        estimateStars(subquery_index);
+    }
+    if (cand_pos_ < cand_.size()) {
+        pos_ = cand_[cand_pos_++];
+        return true;
     }
     pos_ = -1;
     return false;
 }
 
-//please refer to the original paper for details,
-//especially about computing "o" values
+//please refer to the original paper for details, especially about
+//computing "o" values. The star of a set is the product, over the
+//predicates of the center, of the set's frequency of the predicate over
+//its count if the other end is free, and the least inverse frequency of
+//those whose other end is bound; all of cand_ is estimated at once, a
+//predicate at a time, its frequencies read at the slots the index gives
+void CharacteristicSets::estimateStars(int subquery_index) {
+    int v = dq_[subquery_index].first;
+    bool forward = dq_[subquery_index].second;
+    const FlatCSets& cs = forward ? csets_view_ : rev_csets_view_;
+    const Postings& index = forward ? postings_ : rev_postings_;
+    auto& adj = forward ? rdf_q_adj_lists_[v] : rdf_q_rev_adj_lists_[v];
+    size_t n = cand_.size();
+    star_count_.resize(n);
+    star_freq_.resize(n);
+    star_m_.assign(n, 1.0);
+    star_o_.assign(n, 1.0);
+    star_est_.resize(n);
+    double* count = star_count_.data();
+    double* freq = star_freq_.data();
+    double* m = star_m_.data();
+    double* o = star_o_.data();
+    double* est = star_est_.data();
+    for (size_t c = 0; c < n; c++) {
+        assert(cs.count[cand_[c]] > 0);
+        count[c] = cs.count[cand_[c]];
+    }
+    for (auto& t : adj) {
+        int pi = t.second - offset_;
+        //a vertex label of a forward star
+        if (pi < 0) continue;
+        int key = forward ? t.second : pi;
+        //cand_ is ascending and within the key's ids
+        range r = index.Get(key);
+        const int* slots = index.Slots(key);
+        const int* it = r.begin;
+        for (size_t c = 0; c < n; c++) {
+            it = std::lower_bound(it, r.end, cand_[c]);
+            assert(it != r.end && *it == cand_[c]);
+            freq[c] = cs.Freq(cand_[c], slots[it - r.begin]);
+        }
+        if (q->GetBound(t.first - offset_) != -1) {
+            for (size_t c = 0; c < n; c++) o[c] = std::min(o[c], 1.0 / freq[c]);
+        } else {
+            for (size_t c = 0; c < n; c++) m[c] *= freq[c] / count[c];
+        }
+    }
+    for (size_t c = 0; c < n; c++) est[c] = count[c] * m[c] * o[c];
+    if (v - offset_ >= 0 && q->GetBound(v - offset_) != -1)
+        for (size_t c = 0; c < n; c++) est[c] /= count[c];
+}
+
+//the estimate estimateStars gave the set at pos_
 double CharacteristicSets::EstCard(int subquery_index) {
     int v = dq_[subquery_index].first;
     //an edge between unlabeled vertices
     if (v < 0) {
         return getNodeSelectivity(-v);
     }
-    double res = 0.0;
-    //forward star
-    if (dq_[subquery_index].second) {
-        double m = 1.0, o = 1.0;
-        for (int j = 0; j < rdf_q_adj_lists_[v].size(); j++) {
-            int pi = rdf_q_adj_lists_[v][j].second - offset_; 
-            if (pi < 0) {
-                continue;
-            }
-            int oi = rdf_q_adj_lists_[v][j].first - offset_;
-            assert(csets_[pos_].count_ > 0);
-            int srcid = csets_[pos_].vid_;
-            assert(g->GetAdjSize(srcid, pi, true) > 0);
-            int i = g->GetELabelIndex(srcid, pi, true);
-            assert(i >= 0);
-            if (q->GetBound(oi) != -1) {
-                int bound = q->GetBound(oi);
-                o = std::min(o, (double)1.0 / csets_[pos_].freq_[g->GetNumVLabels(srcid) + i]); 
-            } else {
-                m *= (double)(csets_[pos_].freq_[g->GetNumVLabels(srcid) + i]) / csets_[pos_].count_;
-            }
-        }
-        res = (double)(csets_[pos_].count_) * m * o;
-        if (v - offset_ >= 0 && q->GetBound(v - offset_) != -1) {
-            assert(csets_[pos_].count_ > 0);
-            res /= csets_[pos_].count_;
-        }
-    } else {
-    //backward star
-        double m = 1.0, o = 1.0;
-        for (int j = 0; j < rdf_q_rev_adj_lists_[v].size(); j++) {
-            int pi = rdf_q_rev_adj_lists_[v][j].second - offset_; 
-            assert(pi >= 0);
-            int oi = rdf_q_rev_adj_lists_[v][j].first - offset_;
-            assert(rev_csets_[pos_].count_ > 0);
-            int dstid = rev_csets_[pos_].vid_;
-            assert(g->GetAdjSize(dstid, pi, false) > 0);
-            int i = g->GetELabelIndex(dstid, pi, false);
-            assert(i >= 0);
-            if (q->GetBound(oi) != -1) {
-                int bound = q->GetBound(oi); 
-                o = std::min(o, 1.0 / rev_csets_[pos_].freq_[i]); 
-            } else {
-                m *= (double)(rev_csets_[pos_].freq_[i]) / rev_csets_[pos_].count_;
-            }
-        }
-        res = (double)(rev_csets_[pos_].count_) * m * o;
-        if (v - offset_ >= 0 && q->GetBound(v - offset_) != -1) {
-            assert(rev_csets_[pos_].count_ > 0);
-            res /= rev_csets_[pos_].count_;
-        }
-    }
-    return res;
+    return star_est_[cand_pos_ - 1];
 }
 
 //sum
@@ -448,9 +1277,42 @@ double CharacteristicSets::GetSelectivity() {
     return res;
 }
 
+//a star is determined by its direction, whether its center is bound, and
+//the predicate labels (with the boundness of their other ends) EstCard()
+//reads; an edge between unlabeled vertices by getNodeSelectivity()'s inputs
+string CharacteristicSets::SubqueryKey(int subquery_index) {
+    int v = dq_[subquery_index].first;
+    if (v < 0) {
+        const auto& node = nodes_[-v];
+        string key = "e" + to_string(node.third);
+        if (node.third >= offset_) {
+            key += ',' + to_string(q->GetBound(node.first - offset_));
+            key += ',' + to_string(q->GetBound(node.second - offset_));
+        }
+        return key;
+    }
+    bool forward = dq_[subquery_index].second;
+    auto& adj = forward ? rdf_q_adj_lists_[v] : rdf_q_rev_adj_lists_[v];
+    vector<pair<int, int>> preds;
+    for (auto& t : adj) {
+        int bound = t.second >= offset_ && q->GetBound(t.first - offset_) != -1;
+        preds.emplace_back(t.second, bound);
+    }
+    sort(preds.begin(), preds.end());
+    string key = forward ? "f" : "b";
+    int bound = v - offset_ >= 0 ? q->GetBound(v - offset_) : -1;
+    key += to_string(bound != -1);
+    //which set a bound center is in, with a vertex map
+    if (bound != -1 && bound < vertex_map_[forward ? 0 : 1].n)
+        key += ':' + to_string(vertex_map_[forward ? 0 : 1].Get(bound));
+    for (auto& p : preds)
+        key += ';' + to_string(p.first) + ',' + to_string(p.second);
+    return key;
+}
+
 double CharacteristicSets::getNodeSelectivity(int nodeid) {
     int el = nodes_[nodeid].third - offset_;
-    if (el < 0) return hist_[el + offset_][1][(el + offset_) % num_buckets_];
+    if (el < 0) return Hist(el + offset_, 1, (el + offset_) % num_buckets_);
     int srcid = q->GetBound(nodes_[nodeid].first - offset_);
     int dstid = q->GetBound(nodes_[nodeid].second - offset_); 
     if (el >= g->GetNumELabels())
@@ -482,10 +1344,12 @@ double CharacteristicSets::getPairwiseSelectivity(int i, int j) {
     } else if (nodes_[i].second == nodes_[j].second) {
         c1 = c2 = 1;
     }
-    //use basic join selectivity estimation
-    for (int b = 0; b < num_buckets_; b++) {
-        assert(bucket_size_ > 0);
-        sum += (double)(hist_[el1][c1][b]) * hist_[el2][c2][b] / bucket_size_;
-    }
+    //use basic join selectivity estimation; a row of zeros joins nothing
+    if (hist_totals_[(size_t)el1 * 2 + c1] == 0 || hist_totals_[(size_t)el2 * 2 + c2] == 0)
+        return 0.0;
+    assert(bucket_size_ > 0);
+    sum = (double)DotProduct(HistRow(el1, c1), HistRow(el2, c2), num_buckets_) / bucket_size_;
     return sum / cnt1 / cnt2;
 }
+
+}  // namespace graph
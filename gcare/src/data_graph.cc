@@ -1,4 +1,6 @@
+#include "../include/counters.h"
 #include "../include/data_graph.h"
+#include "../include/simd_search.h"
 
 #include <algorithm>
 #include <fstream>
@@ -10,8 +12,13 @@
 #include <string>
 #include <cstring>
 #include <cassert>
+#include <cinttypes>
+#include <climits>
 #include <filesystem>
 #include <iostream>
+#include <omp.h>
+namespace graph {
+
 void DataGraph::ReadText(const char* fn) {
     // std::cout << "DataGraph::ReadText " << fn << "\n";
 	raw_.max_vl_ = raw_.max_el_ = -1;
@@ -51,12 +58,246 @@ void DataGraph::ReadText(const char* fn) {
     // std::cout << "~DataGraph::ReadText " << fn << "\n";
 }
 
+namespace {
+
+// Old -> new vertex ids for a reorder mode, over the undirected adjacency
+// nbr[start[u], start[u+1]) of every vertex u.
+vector<int> VertexOrder(Reorder mode, int vnum, const vector<size_t>& start, const vector<int>& nbr) {
+	auto degree = [&](int u) { return start[u + 1] - start[u]; };
+	vector<int> by_degree(vnum);
+	for (int u = 0; u < vnum; u++) by_degree[u] = u;
+	stable_sort(by_degree.begin(), by_degree.end(),
+		[&](int a, int b) { return degree(a) > degree(b); });
+
+	vector<int> order;
+	order.reserve(vnum);
+	if (mode == REORDER_DEGREE) {
+		order = by_degree;
+	} else {
+		//BFS from the highest (RCM: lowest) degree vertex left unvisited
+		vector<char> visited(vnum, 0);
+		vector<int> next;
+		auto seed = [&](int u) {
+			if (visited[u]) return;
+			visited[u] = 1;
+			size_t head = order.size();
+			order.push_back(u);
+			for (; head < order.size(); head++) {
+				int v = order[head];
+				next.clear();
+				for (size_t i = start[v]; i < start[v + 1]; i++)
+					if (!visited[nbr[i]]) {
+						visited[nbr[i]] = 1;
+						next.push_back(nbr[i]);
+					}
+				if (mode == REORDER_RCM)
+					stable_sort(next.begin(), next.end(),
+						[&](int a, int b) { return degree(a) < degree(b); });
+				order.insert(order.end(), next.begin(), next.end());
+			}
+		};
+		if (mode == REORDER_RCM) {
+			for (auto it = by_degree.rbegin(); it != by_degree.rend(); ++it) seed(*it);
+			reverse(order.begin(), order.end());
+		} else {
+			for (int u : by_degree) seed(u);
+		}
+	}
+	vector<int> perm(vnum);
+	for (int i = 0; i < vnum; i++) perm[order[i]] = i;
+	return perm;
+}
+
+// writes the old -> new id map of a reordered graph, or removes a stale one
+void WritePerm(const string& fname, const vector<int>& perm) {
+	string perm_fn = fname + ".perm";
+	if (perm.empty()) {
+		std::filesystem::remove(perm_fn);
+		return;
+	}
+	FILE* f = fopen(perm_fn.c_str(), "w");
+	fwrite(perm.data(), sizeof(int), perm.size(), f);
+	fclose(f);
+}
+
+// .graph.labels: the input labels a projection kept, "v" then the vertex
+// labels and "e" then the edge labels, each on a line of its own, in the
+// order of their ids; a kind that kept everything has no line. Without a
+// projection, a stale file is removed.
+void WriteLabels(const string& fname, const vector<int>& vlabels, const vector<int>& elabels) {
+	string labels_fn = fname + ".labels";
+	if (vlabels.empty() && elabels.empty()) {
+		std::filesystem::remove(labels_fn);
+		return;
+	}
+	FILE* f = fopen(labels_fn.c_str(), "w");
+	for (auto kind : {make_pair('v', &vlabels), make_pair('e', &elabels)}) {
+		if (kind.second->empty()) continue;
+		fprintf(f, "%c", kind.first);
+		for (int l : *kind.second) fprintf(f, " %d", l);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+}
+
+// .graph.vlbits: vnum, vl_num, word offset of each label's bitmap (-1:
+// none), then the bitmaps, all 64-bit. A label gets one if at least 1/64 of
+// the vertices carry it, so the bitmaps take at most 8 bytes per vertex
+// label. Without enabled, a stale file is removed.
+template <typename O>
+void WriteVLabelBitmap(const string& fname, bool enabled, int vnum, int vl_num,
+		const vector<O>& vl_offset, const vector<int>& vl) {
+	string bits_fn = fname + ".vlbits";
+	if (!enabled) {
+		std::filesystem::remove(bits_fn);
+		return;
+	}
+	vector<int64_t> cnt(vl_num, 0);
+	for (int l : vl) cnt[l]++;
+	size_t words_per_label = ((size_t)vnum + 63) / 64;
+	vector<int64_t> header(2 + vl_num, -1);
+	header[0] = vnum;
+	header[1] = vl_num;
+	int64_t num_words = 0;
+	for (int l = 0; l < vl_num; l++)
+		if (cnt[l] > 0 && cnt[l] * 64 >= vnum) {
+			header[2 + l] = num_words;
+			num_words += words_per_label;
+		}
+	vector<uint64_t> words(num_words, 0);
+	for (int u = 0; u < vnum; u++)
+		for (O i = vl_offset[u]; i < vl_offset[u + 1]; i++) {
+			int64_t w = header[2 + vl[i]];
+			if (w >= 0) words[w + u / 64] |= 1ull << (u % 64);
+		}
+	FILE* f = fopen(bits_fn.c_str(), "w");
+	fwrite(header.data(), sizeof(int64_t), header.size(), f);
+	if (num_words > 0) fwrite(words.data(), sizeof(uint64_t), num_words, f);
+	fclose(f);
+}
+
+// .graph.edgefilter: vnum, el_num, the first block and the block count of
+// each label's EdgeFilter, padded to a block, then the blocks, all 64-bit.
+// Built from the out-CSR; without enabled, a stale file is removed.
+template <typename O>
+void WriteEdgeFilter(const string& fname, bool enabled, int vnum, int el_num, const vector<O>& offset,
+		const vector<int>& label, const vector<O>& adj_offset, const vector<int>& adj) {
+	string filter_fn = fname + ".edgefilter";
+	if (!enabled) {
+		std::filesystem::remove(filter_fn);
+		return;
+	}
+	const int W = EdgeFilter::WORDS;
+	vector<int64_t> cnt(el_num, 0);
+	for (O i = 0; i < offset[vnum]; i++)
+		cnt[label[i]] += adj_offset[i + 1] - adj_offset[i];
+	vector<int64_t> header((2 + 2 * (size_t)el_num + W - 1) / W * W, 0);
+	header[0] = vnum;
+	header[1] = el_num;
+	int64_t num_blocks = 0;
+	for (int el = 0; el < el_num; el++) {
+		header[2 + 2 * el] = num_blocks;
+		header[3 + 2 * el] = EdgeFilter::NumBlocks(cnt[el]);
+		num_blocks += header[3 + 2 * el];
+	}
+	vector<uint64_t> blocks(num_blocks * W, 0);
+#pragma omp parallel for schedule(dynamic, 1024)
+	for (int u = 0; u < vnum; u++)
+		for (O i = offset[u]; i < offset[u + 1]; i++) {
+			const int64_t* f = &header[2 + 2 * label[i]];
+			for (O j = adj_offset[i]; j < adj_offset[i + 1]; j++) {
+				uint64_t h = EdgeFilter::Hash(u, adj[j]);
+				EdgeFilter::Add(&blocks[(f[0] + EdgeFilter::Block(h, f[1])) * W], h);
+			}
+		}
+	FILE* f = fopen(filter_fn.c_str(), "w");
+	fwrite(header.data(), sizeof(int64_t), header.size(), f);
+	if (num_blocks > 0) fwrite(blocks.data(), sizeof(uint64_t), blocks.size(), f);
+	fclose(f);
+}
+
+// .graph.labelstats: vnum, vl_num, el_num, then the bits of LabelStats,
+// all 64-bit. Built from the labels of each vertex's out- and in-lists; a
+// graph with too many labels for them gets none, and a stale file is
+// removed.
+template <typename O, typename P>
+void WriteLabelStats(const string& fname, int vnum, int vl_num, int el_num, const vector<O>& vl_offset,
+		const vector<int>& vl, const vector<P>& offset, const vector<int>& label, const vector<P>& in_offset,
+		const vector<int>& in_label) {
+	string stats_fn = fname + ".labelstats";
+	if (!LabelStats::Fits(vl_num, el_num)) {
+		std::filesystem::remove(stats_fn);
+		return;
+	}
+	vector<uint64_t> words(3 + LabelStats::Words(vl_num, el_num), 0);
+	words[0] = vnum;
+	words[1] = vl_num;
+	words[2] = el_num;
+	LabelStats stats;
+	stats.Attach(words.data() + 3, vl_num, el_num);
+#pragma omp parallel
+	{
+		vector<int> keys;
+#pragma omp for schedule(dynamic, 1024)
+		for (int u = 0; u < vnum; u++) {
+			keys.clear();
+			for (P i = offset[u]; i < offset[u + 1]; i++)
+				keys.push_back(LabelStats::Key(label[i], 0));
+			for (P i = in_offset[u]; i < in_offset[u + 1]; i++)
+				keys.push_back(LabelStats::Key(in_label[i], 1));
+			stats.AddVertex(keys.data(), keys.size(), vl.data() + vl_offset[u], vl_offset[u + 1] - vl_offset[u]);
+		}
+	}
+	FILE* f = fopen(stats_fn.c_str(), "w");
+	fwrite(words.data(), sizeof(uint64_t), words.size(), f);
+	fclose(f);
+}
+
+}  // namespace
+
 void DataGraph::MakeBinary() {
     // std::cout << "DataGraph::MakeBinary\n";
 	int vnum = raw_.vlabels_.size();
 	auto& out = raw_.out_edges_;
 	auto& in = raw_.in_edges_;
 
+	//RawDataGraph keeps int offsets; larger graphs go through BuildBinary
+	if (out.size() > (size_t)INT_MAX) {
+		fprintf(stderr, "MakeBinary: %zu edges need the wide layout of BuildBinary\n", out.size());
+		exit(EXIT_FAILURE);
+	}
+
+	raw_.perm_.clear();
+	if (reorder_ != REORDER_NONE) {
+		vector<size_t> start(vnum + 1, 0);
+		for (auto& e : out) {
+			start[e.src + 1]++;
+			start[e.dst + 1]++;
+		}
+		for (int u = 0; u < vnum; u++) start[u + 1] += start[u];
+		vector<int> nbr(start[vnum]);
+		{
+			vector<size_t> pos(start.begin(), start.end() - 1);
+			for (auto& e : out) {
+				nbr[pos[e.src]++] = e.dst;
+				nbr[pos[e.dst]++] = e.src;
+			}
+		}
+		raw_.perm_ = VertexOrder(reorder_, vnum, start, nbr);
+		auto& perm = raw_.perm_;
+		for (auto& e : out) {
+			e.src = perm[e.src];
+			e.dst = perm[e.dst];
+		}
+		for (auto& e : in) {
+			e.src = perm[e.src];
+			e.dst = perm[e.dst];
+		}
+		vector<vector<int>> vlabels(vnum);
+		for (int u = 0; u < vnum; u++) vlabels[perm[u]].swap(raw_.vlabels_[u]);
+		raw_.vlabels_.swap(vlabels);
+	}
+
 	sort(out.begin(), out.end());
 	sort(in.begin(), in.end());
 	out.erase(unique(out.begin(), out.end()), out.end());
@@ -156,6 +397,95 @@ void DataGraph::MakeBinary() {
 }
 
 size_t DataGraph::BinarySize() {
+	return EncodedSize(packed_, lean_);
+}
+
+namespace {
+
+//packed lists start 8-byte aligned within the .graph body
+size_t PackedPadding(size_t pos) { return (8 - pos % 8) % 8; }
+
+//bits of the layout field that ends the first metadata line; plain narrow
+//binaries omit it
+const int LAYOUT_PACKED = 1;
+const int LAYOUT_WIDE = 2;
+const int LAYOUT_LEAN = 4;
+
+//the section directory ending .meta: "sections", its version (1) and the
+//body offset at which each DataSection starts
+void WriteSections(FILE* fp, const uint64_t* starts) {
+	fprintf(fp, "sections 1");
+	for (int s = 0; s < NUM_SECTIONS; s++)
+		fprintf(fp, " %" PRIu64, starts[s]);
+	fprintf(fp, "\n");
+}
+
+//edge label -> the distinct sources of its edges, then edge label -> its
+//distinct targets: a vertex has an edge of el out (in) iff its out- (in-)
+//list has an entry of el, so these are the entries of each label, counted
+//in parallel
+template <typename O>
+vector<int64_t> CountDistinct(int vnum, int el_num, const vector<O>& out_offset,
+		const vector<int>& out_label, const vector<O>& in_offset, const vector<int>& in_label) {
+	vector<int64_t> cnt(2 * (size_t)el_num, 0);
+	for (int d = 0; d < 2 && el_num > 0; d++) {
+		const int* label = d ? in_label.data() : out_label.data();
+		int64_t n = d ? in_offset[vnum] : out_offset[vnum];
+		int64_t* c = cnt.data() + (size_t)d * el_num;
+#pragma omp parallel for schedule(static) reduction(+ : c[:el_num])
+		for (int64_t i = 0; i < n; i++)
+			c[label[i]]++;
+	}
+	return cnt;
+}
+
+//the line after the section directory: "distinct", its version (1) and
+//the counts of CountDistinct
+void WriteDistinct(FILE* fp, const vector<int64_t>& cnt) {
+	fprintf(fp, "distinct 1");
+	for (int64_t c : cnt)
+		fprintf(fp, " %" PRId64, c);
+	fprintf(fp, "\n");
+}
+
+// The lean layout's stand-in for el_rel_: the out-lists of each edge label
+// in vertex order, as pair_offset (label -> first list), pair_src (list ->
+// its vertex) and pair_cum (list -> el_rel_ position of its first edge).
+struct LabelView {
+	vector<int64_t> pair_offset, pair_cum;
+	vector<int> pair_src;
+};
+
+template <typename O>
+LabelView BuildLabelView(int vnum, int el_num, const vector<O>& offset,
+		const vector<int>& label, const vector<O>& adj_offset) {
+	LabelView view;
+	vector<int64_t> edges(el_num + 1, 0);
+	view.pair_offset.assign(el_num + 1, 0);
+	for (int64_t i = 0; i < (int64_t)offset[vnum]; i++) {
+		view.pair_offset[label[i] + 1]++;
+		edges[label[i] + 1] += adj_offset[i + 1] - adj_offset[i];
+	}
+	for (int el = 0; el < el_num; el++) {
+		view.pair_offset[el + 1] += view.pair_offset[el];
+		edges[el + 1] += edges[el];
+	}
+	view.pair_src.resize(view.pair_offset[el_num]);
+	view.pair_cum.resize(view.pair_offset[el_num]);
+	vector<int64_t> pos(view.pair_offset.begin(), view.pair_offset.end() - 1);
+	for (int u = 0; u < vnum; u++)
+		for (int64_t i = offset[u]; i < (int64_t)offset[u + 1]; i++) {
+			int el = label[i];
+			view.pair_src[pos[el]] = u;
+			view.pair_cum[pos[el]++] = edges[el];
+			edges[el] += adj_offset[i + 1] - adj_offset[i];
+		}
+	return view;
+}
+
+}  // namespace
+
+size_t DataGraph::EncodedSize(bool packed, bool lean) {
 	size_t ret = 0;
 
 	size_t vn = raw_.vlabels_.size();
@@ -164,20 +494,29 @@ size_t DataGraph::BinarySize() {
 	ret += sizeof(int);
 	ret += sizeof(int) * raw_.label_.size() * 2;
 	ret += sizeof(int);
-	ret += sizeof(int) * raw_.adj_.size();
+	if (packed)
+		ret += PackedPadding(ret) + raw_.packed_adj_.Bytes();
+	else
+		ret += sizeof(int) * raw_.adj_.size();
 
 	ret += sizeof(int) * (vn + 1); 
 	ret += sizeof(int);
 	ret += sizeof(int) * raw_.in_label_.size() * 2;
 	ret += sizeof(int);
-	ret += sizeof(int) * raw_.in_adj_.size();
+	if (packed)
+		ret += PackedPadding(ret) + raw_.packed_in_adj_.Bytes();
+	else
+		ret += sizeof(int) * raw_.in_adj_.size();
 
 	ret += sizeof(int) * (vn + 1); 
 	ret += sizeof(int);
 	ret += sizeof(int) * raw_.vl_.size();
 
 	ret += sizeof(int) * (raw_.max_el_ + 2);
-	ret += sizeof(pair<int, int>) * raw_.out_edges_.size(); 
+	if (lean)
+		ret += sizeof(int) * (raw_.max_el_ + 2 + 2 * raw_.offset_[vn]);
+	else
+		ret += sizeof(pair<int, int>) * raw_.out_edges_.size(); 
 
 	ret += sizeof(int) * (raw_.max_vl_ + 2); 
 	ret += sizeof(int) * raw_.vl_.size();
@@ -194,25 +533,57 @@ void DataGraph::WriteBinary(const char* filename) {
   string fname = string(filename) + ".graph";
   // std::cout << "DataGraph::WriteBinary" << fname << "\n";
 	string metadata = fname + ".meta";
-	FILE* fp = fopen(metadata.c_str(), "w");
+	if (packed_) {
+		raw_.packed_adj_.Build(raw_.adj_.data(), raw_.adj_.size());
+		raw_.packed_in_adj_.Build(raw_.in_adj_.data(), raw_.in_adj_.size());
+	}
 	size_t encode_size = BinarySize();
+	char* buffer = new char[encode_size];
+	uint64_t sections[NUM_SECTIONS];
+	EncodeBinary(buffer, packed_, lean_, sections);
 
 	int vn = raw_.vlabels_.size();
 	int en = raw_.out_edges_.size(); 
 
-	fprintf(fp, "%d %d %d %d %zu\n", vn, en, raw_.max_vl_+1, raw_.max_el_+1, encode_size);
+	int layout = (packed_ ? LAYOUT_PACKED : 0) | (lean_ ? LAYOUT_LEAN : 0);
+	FILE* fp = fopen(metadata.c_str(), "w");
+	fprintf(fp, "%d %d %d %d %zu", vn, en, raw_.max_vl_+1, raw_.max_el_+1, encode_size);
+	if (layout != 0)
+		fprintf(fp, " %d", layout);
+	fprintf(fp, "\n");
 	for (int vl = 0; vl <= raw_.max_vl_; vl++)
 		fprintf(fp, "%d ", raw_.vl_cnt_[vl]); 
 	fprintf(fp, "\n");
 	for (int el = 0; el <= raw_.max_el_; el++)
 		fprintf(fp, "%d ", raw_.el_cnt_[el]); 
 	fprintf(fp, "\n");
+	WriteSections(fp, sections);
+	WriteDistinct(fp, CountDistinct(vn, raw_.max_el_ + 1, raw_.offset_, raw_.label_,
+		raw_.in_offset_, raw_.in_label_));
 	fclose(fp);
 
-	char* buffer = new char[encode_size];
+	FILE* f = fopen(fname.c_str(), "w");
+	fwrite(buffer, 1, encode_size, f);
+	// cout << "wrote " << encode_size << " bytes to file " << fname << endl;
+	fclose(f);
+	delete[] buffer;
+	WritePerm(fname, raw_.perm_);
+	WriteLabels(fname, project_vl_, project_el_);
+	WriteVLabelBitmap(fname, vl_bitmap_, vn, raw_.max_vl_ + 1, raw_.vl_offset_, raw_.vl_);
+	WriteEdgeFilter(fname, edge_filter_, vn, raw_.max_el_ + 1, raw_.offset_, raw_.label_, raw_.adj_offset_, raw_.adj_);
+	WriteLabelStats(fname, vn, raw_.max_vl_ + 1, raw_.max_el_ + 1, raw_.vl_offset_, raw_.vl_, raw_.offset_,
+			raw_.label_, raw_.in_offset_, raw_.in_label_);
+    // std::cout << "~DataGraph::WriteBinary" << fname << "\n";
+}
+
+//the body of the .graph file (EncodedSize(packed, lean) bytes) from the
+//raw data
+void DataGraph::EncodeBinary(char* buffer, bool packed, bool lean, uint64_t* sections) {
+	int vn = raw_.vlabels_.size();
 	char* orig = buffer;
 	int size[1] = {0};
 
+	if (sections) sections[0] = buffer - orig;
 	{
 		assert(raw_.offset_.size() == vn + 1);
 		assert(raw_.offset_.back() + 1 == raw_.label_.size());
@@ -235,12 +606,21 @@ void DataGraph::WriteBinary(const char* filename) {
 		memcpy(buffer, size, sizeof(int));
 		buffer += sizeof(int);
 
-		size_t adj_size = sizeof(int) * raw_.adj_.size();
 		assert(raw_.adj_offset_.back() == raw_.adj_.size());
-		memcpy(buffer, raw_.adj_.data(), adj_size);
-		buffer += adj_size;
+		if (packed) {
+			size_t pad = PackedPadding(buffer - orig);
+			memset(buffer, 0, pad);
+			buffer += pad;
+			memcpy(buffer, raw_.packed_adj_.Data(), raw_.packed_adj_.Bytes());
+			buffer += raw_.packed_adj_.Bytes();
+		} else {
+			size_t adj_size = sizeof(int) * raw_.adj_.size();
+			memcpy(buffer, raw_.adj_.data(), adj_size);
+			buffer += adj_size;
+		}
 	}
 
+	if (sections) sections[1] = buffer - orig;
 	{
 		assert(raw_.in_offset_.size() == vn + 1);
 		assert(raw_.in_offset_.back() + 1 == raw_.in_label_.size());
@@ -263,12 +643,21 @@ void DataGraph::WriteBinary(const char* filename) {
 		memcpy(buffer, size, sizeof(int));
 		buffer += sizeof(int);
 
-		size_t adj_size = sizeof(int) * raw_.in_adj_.size();
 		assert(raw_.in_adj_offset_.back() == raw_.in_adj_.size());
-		memcpy(buffer, raw_.in_adj_.data(), adj_size);
-		buffer += adj_size;
+		if (packed) {
+			size_t pad = PackedPadding(buffer - orig);
+			memset(buffer, 0, pad);
+			buffer += pad;
+			memcpy(buffer, raw_.packed_in_adj_.Data(), raw_.packed_in_adj_.Bytes());
+			buffer += raw_.packed_in_adj_.Bytes();
+		} else {
+			size_t adj_size = sizeof(int) * raw_.in_adj_.size();
+			memcpy(buffer, raw_.in_adj_.data(), adj_size);
+			buffer += adj_size;
+		}
 	}
 
+	if (sections) sections[2] = buffer - orig;
 	{
 		assert(raw_.vl_offset_.size() == vn + 1);
 		size_t offset_size = sizeof(int) * raw_.vl_offset_.size();
@@ -284,6 +673,7 @@ void DataGraph::WriteBinary(const char* filename) {
 		buffer += label_size;
 	}
 
+	if (sections) sections[3] = buffer - orig;
 	{
 		assert(raw_.el_rel_.size() == raw_.max_el_ + 1);
 		size[0] = 0;  
@@ -294,12 +684,29 @@ void DataGraph::WriteBinary(const char* filename) {
 		}
 		memcpy(buffer, size, sizeof(int));
 		buffer += sizeof(int);
-		for (int el = 0; el <= raw_.max_el_; el++) {
-			memcpy(buffer, raw_.el_rel_[el].data(), sizeof(pair<int, int>) * raw_.el_rel_[el].size()); 
-			buffer += sizeof(pair<int, int>) * raw_.el_rel_[el].size();
+		if (lean) {
+			LabelView view = BuildLabelView(vn, raw_.max_el_ + 1, raw_.offset_, raw_.label_, raw_.adj_offset_);
+			for (int64_t x : view.pair_offset) {
+				size[0] = x;
+				memcpy(buffer, size, sizeof(int));
+				buffer += sizeof(int);
+			}
+			memcpy(buffer, view.pair_src.data(), sizeof(int) * view.pair_src.size());
+			buffer += sizeof(int) * view.pair_src.size();
+			for (int64_t x : view.pair_cum) {
+				size[0] = x;
+				memcpy(buffer, size, sizeof(int));
+				buffer += sizeof(int);
+			}
+		} else {
+			for (int el = 0; el <= raw_.max_el_; el++) {
+				memcpy(buffer, raw_.el_rel_[el].data(), sizeof(pair<int, int>) * raw_.el_rel_[el].size()); 
+				buffer += sizeof(pair<int, int>) * raw_.el_rel_[el].size();
+			}
 		}
 	}
 
+	if (sections) sections[4] = buffer - orig;
 	{
 		assert(raw_.vl_rel_.size() == raw_.max_vl_ + 1);
 		size[0] = 0;  
@@ -316,111 +723,537 @@ void DataGraph::WriteBinary(const char* filename) {
 		}
 	}
 
-	assert((buffer - orig) == encode_size);
-	FILE* f = fopen(fname.c_str(), "w");
-	fwrite(orig, 1, encode_size, f);
-	// cout << "wrote " << (buffer - orig) << " bytes to file " << fname << endl;
-	fclose(f);
-    // std::cout << "~DataGraph::WriteBinary" << fname << "\n";
+	assert((size_t)(buffer - orig) == EncodedSize(packed, lean));
+}
+
+void DataGraph::SetRawData(const vector<vector<int>>& vlabels, const vector<Edge>& edges) {
+	raw_.max_vl_ = raw_.max_el_ = -1;
+	raw_.vlabels_.clear();
+	for (auto& labels : vlabels) {
+		raw_.vlabels_.push_back(vector<int>());
+		for (int vl : labels) {
+			if (vl < 0) continue;
+			raw_.vlabels_.back().push_back(vl);
+			raw_.max_vl_ = std::max(raw_.max_vl_, vl);
+		}
+	}
+	raw_.out_edges_.clear();
+	raw_.in_edges_.clear();
+	for (auto& e : edges) {
+		raw_.out_edges_.emplace_back(e.src, e.dst, e.el);
+		raw_.in_edges_.emplace_back(e.dst, e.src, e.el);
+		raw_.max_el_ = std::max(raw_.max_el_, e.el);
+	}
+	raw_.el_cnt_.assign(raw_.max_el_ + 1, 0);
+	raw_.vl_cnt_.assign(raw_.max_vl_ + 1, 0);
+	raw_.el_rel_.assign(raw_.max_el_ + 1, vector<pair<int, int>>());
+	raw_.vl_rel_.assign(raw_.max_vl_ + 1, vector<int>());
+}
+
+//embedded layout: vnum, enum, vl_num, el_num, vl_cnt[vl_num], el_cnt[el_num],
+//encode_size (size_t), then the .graph body
+void DataGraph::WriteEmbedded(FILE* fp) {
+	int header[4] = {(int)raw_.vlabels_.size(), (int)raw_.out_edges_.size(),
+		raw_.max_vl_ + 1, raw_.max_el_ + 1};
+	fwrite(header, sizeof(int), 4, fp);
+	fwrite(raw_.vl_cnt_.data(), sizeof(int), raw_.vl_cnt_.size(), fp);
+	fwrite(raw_.el_cnt_.data(), sizeof(int), raw_.el_cnt_.size(), fp);
+	//embedded graphs are always plain: the header has no layout field
+	size_t encode_size = EncodedSize(false, false);
+	fwrite(&encode_size, sizeof(size_t), 1, fp);
+	vector<char> buffer(encode_size);
+	EncodeBinary(buffer.data(), false, false);
+	fwrite(buffer.data(), 1, encode_size, fp);
+}
+
+const char* DataGraph::AttachEmbedded(const char* buffer) {
+	const int* header = (const int*) buffer;
+	vnum_ = header[0];
+	enum_ = header[1];
+	vl_num_ = header[2];
+	el_num_ = header[3];
+	header += 4;
+	vl_cnt_.assign(header, header + vl_num_);
+	header += vl_num_;
+	el_cnt_.assign(header, header + el_num_);
+	el_distinct_.clear();
+	header += el_num_;
+	size_t encode_size;
+	memcpy(&encode_size, header, sizeof(size_t));
+	buffer = (const char*) header + sizeof(size_t);
+
+	UnloadFile(buffer_, encode_size_, load_mode_);
+	buffer_ = nullptr;
+	encode_size_ = 0;
+	UnloadFile(vl_bitmap_buffer_, vl_bitmap_size_, load_mode_);
+	vl_bitmap_buffer_ = nullptr;
+	vl_bitmap_offset_ = nullptr;
+	UnloadFile(edge_filter_buffer_, edge_filter_size_, load_mode_);
+	edge_filter_buffer_ = nullptr;
+	edge_filter_index_ = nullptr;
+	UnloadFile(label_stats_buffer_, label_stats_size_, load_mode_);
+	label_stats_buffer_ = nullptr;
+	label_stats_.Clear();
+	packed_ = false;
+	ooc_.reset();
+	wide_ = false;
+	lean_ = false;
+	vertex_map_.clear();
+	ParseBinary(buffer, encode_size);
+	return buffer + encode_size;
 }
 
-void DataGraph::ReadBinary(const char* filename) {
+void DataGraph::ReadBinary(const char* filename, LoadMode mode, int numa_node) {
   string fname = string(filename) + ".graph";
+	if (numa_node == NUMA_ANY && GetNumaMode() == NUMA_INTERLEAVE && NumaActive()) {
+		mode = LOAD_COPY;
+		numa_node = NUMA_INTERLEAVE_ALL;
+	}
+	replicas_.clear();
+	binary_prefix_ = filename;
     // std::cout << "DataGraph::ReadBinary" << fname << "\n";
 	string metadata = fname + ".meta";
 	FILE* fp = fopen(metadata.c_str(), "r");
 	size_t encode_size;
-	fscanf(fp, "%d %d %d %d %zu", &vnum_, &enum_, &vl_num_, &el_num_, &encode_size);
+	char line[256];
+	int layout = 0;
+	if (fp == nullptr || fgets(line, sizeof(line), fp) == nullptr ||
+		sscanf(line, "%d %" SCNd64 " %d %d %zu %d", &vnum_, &enum_, &vl_num_, &el_num_, &encode_size, &layout) < 5) {
+		fprintf(stderr, "cannot read %s\n", metadata.c_str());
+		exit(EXIT_FAILURE);
+	}
+	packed_ = (layout & LAYOUT_PACKED) != 0;
+	wide_ = (layout & LAYOUT_WIDE) != 0;
+	lean_ = (layout & LAYOUT_LEAN) != 0;
+	ooc_.reset();
+	bool chunked = ooc_cache_ > 0 && IsChunkedFile(fname.c_str());
+	if (ooc_cache_ > 0 && (packed_ || chunked))
+		fprintf(stderr, "out-of-core mode needs a plain binary, %s is %s: read in\n", fname.c_str(),
+			packed_ ? "packed" : "compressed");
+	if (ooc_cache_ > 0 && !packed_ && !chunked) {
+		//the arrays besides the adjacency come in as touched, the adjacency
+		//stays on disk
+		mode = LOAD_LAZY;
+		ooc_.reset(new AdjCache);
+		if (!ooc_->Open(fname.c_str(), ooc_cache_))
+			exit(EXIT_FAILURE);
+	}
 
 	vl_cnt_.resize(vl_num_);
 	el_cnt_.resize(el_num_);
 	for (int vl = 0; vl < vl_num_; vl++)
 		fscanf(fp, "%d ", &vl_cnt_[vl]); 
 	for (int el = 0; el < el_num_; el++)
-		fscanf(fp, "%d ", &el_cnt_[el]); 
+		fscanf(fp, "%" SCNd64 " ", &el_cnt_[el]); 
+	uint64_t sections[NUM_SECTIONS];
+	int version = 0;
+	bool directory = fscanf(fp, "sections %d", &version) == 1 && version == 1;
+	for (int s = 0; directory && s < NUM_SECTIONS; s++)
+		directory = fscanf(fp, "%" SCNu64, &sections[s]) == 1 && sections[s] <= encode_size
+			&& (s == 0 ? sections[s] == 0 : sections[s] >= sections[s - 1]);
+	el_distinct_.assign(2 * (size_t)el_num_, 0);
+	bool distinct = directory && fscanf(fp, " distinct %d", &version) == 1 && version == 1;
+	for (size_t i = 0; distinct && i < el_distinct_.size(); i++)
+		distinct = fscanf(fp, "%" SCNd64, &el_distinct_[i]) == 1;
+	if (!distinct)
+		el_distinct_.clear();
 	fclose(fp);
+	//some of the sections: map the binary and read just those in
+	bool subset = directory && (sections_ & SECTION_ALL) != SECTION_ALL && !ooc_
+		&& numa_node == NUMA_ANY && mode != LOAD_SHM;
+	if (subset)
+		mode = LOAD_LAZY;
+
+	UnloadFile(buffer_, encode_size_, load_mode_);
+	UnloadFile(vl_bitmap_buffer_, vl_bitmap_size_, load_mode_);
+	vl_bitmap_buffer_ = nullptr;
+	vl_bitmap_offset_ = nullptr;
+	UnloadFile(edge_filter_buffer_, edge_filter_size_, load_mode_);
+	edge_filter_buffer_ = nullptr;
+	edge_filter_index_ = nullptr;
+	UnloadFile(label_stats_buffer_, label_stats_size_, load_mode_);
+	label_stats_buffer_ = nullptr;
+	label_stats_.Clear();
+	load_mode_ = mode;
+	size_t file_size = 0;
+	buffer_ = LoadFile(fname.c_str(), file_size, mode, numa_node);
+	if (buffer_ == nullptr || file_size != encode_size) {
+		fprintf(stderr, "cannot load %s\n", fname.c_str());
+		exit(EXIT_FAILURE);
+	}
+	encode_size_ = encode_size;
+	ParseBinary(buffer_, encode_size);
+	if (ooc_) {
+		//read the rest in now: the out-arrays, the in-arrays up to their
+		//adjacency, and the label indexes after it
+		uint64_t cut[4] = {ooc_->ArrayBegin(true), ooc_->ArrayEnd(true),
+			ooc_->ArrayBegin(false), ooc_->ArrayEnd(false)};
+		uint64_t page = sysconf(_SC_PAGESIZE);
+		auto willneed = [&](uint64_t begin, uint64_t end) {
+			begin = begin / page * page;
+			if (begin < end)
+				madvise(buffer_ + begin, end - begin, MADV_WILLNEED);
+		};
+		willneed(0, cut[0]);
+		willneed(cut[1], cut[2]);
+		willneed(cut[3], encode_size);
+	}
+	if (subset) {
+		for (int s = 0; s < NUM_SECTIONS; s++) {
+			uint64_t end = s + 1 < NUM_SECTIONS ? sections[s + 1] : encode_size;
+			if ((sections_ & (1u << s)) && sections[s] < end)
+				PrefaultRange(buffer_ + sections[s], end - sections[s]);
+		}
+	}
 
-	FILE* f = fopen(fname.c_str(), "r");
-	char* buffer = new char[encode_size];
-	fread(buffer, 1, encode_size, f);
-	fclose(f);
-	char* orig = buffer;
-
-	{
-		offset_ = (const int*) buffer;
-		assert(offset_[0] == 0);
-		buffer += sizeof(int) * (vnum_ + 1);
-
-		int* size = (int*) buffer;
-		assert(offset_[vnum_] + 1 == size[0]);
-		buffer += sizeof(int);
-
-		label_ = (const int*) buffer;
-		buffer += sizeof(int) * size[0];
-		adj_offset_ = (const int*) buffer;
-		buffer += sizeof(int) * size[0];
-
-		size = (int*) buffer;
-		buffer += sizeof(int);
+	project_vl_.clear();
+	project_el_.clear();
+	ifstream labels(fname + ".labels");
+	for (string line; getline(labels, line);) {
+		if (line.empty()) continue;
+		auto tok = parse(line, " ");
+		vector<int>& kept = tok[0] == "v" ? project_vl_ : project_el_;
+		for (size_t i = 1; i < tok.size(); i++) kept.push_back(stoi(tok[i]));
+	}
+	vl_map_ = LabelMap::Of(project_vl_);
+	el_map_ = LabelMap::Of(project_el_);
+
+	vertex_map_.clear();
+	string perm_fn = fname + ".perm";
+	if (std::filesystem::exists(perm_fn)) {
+		vertex_map_.resize(vnum_);
+		FILE* f = fopen(perm_fn.c_str(), "r");
+		if (f == nullptr || fread(vertex_map_.data(), sizeof(int), vnum_, f) != (size_t)vnum_) {
+			fprintf(stderr, "cannot read %s\n", perm_fn.c_str());
+			exit(EXIT_FAILURE);
+		}
+		fclose(f);
+	}
 
-		adj_ = (const int*) buffer;
-		buffer += sizeof(int) * size[0];
+	string bits_fn = fname + ".vlbits";
+	if (std::filesystem::exists(bits_fn)) {
+		vl_bitmap_buffer_ = LoadFile(bits_fn.c_str(), vl_bitmap_size_, mode, numa_node);
+		const int64_t* header = (const int64_t*) vl_bitmap_buffer_;
+		if (vl_bitmap_buffer_ == nullptr || vl_bitmap_size_ < sizeof(int64_t) * (2 + vl_num_)
+				|| header[0] != vnum_ || header[1] != vl_num_) {
+			fprintf(stderr, "cannot load %s\n", bits_fn.c_str());
+			exit(EXIT_FAILURE);
+		}
+		vl_bitmap_offset_ = header + 2;
+		vl_bitmap_words_ = (const uint64_t*) (header + 2 + vl_num_);
 	}
 
-	{
-		in_offset_ = (const int*) buffer;
-		assert(in_offset_[0] == 0);
-		buffer += sizeof(int) * (vnum_ + 1);
+	string filter_fn = fname + ".edgefilter";
+	if (std::filesystem::exists(filter_fn)) {
+		edge_filter_buffer_ = LoadFile(filter_fn.c_str(), edge_filter_size_, mode, numa_node);
+		const int64_t* header = (const int64_t*) edge_filter_buffer_;
+		const int W = EdgeFilter::WORDS;
+		size_t header_words = (2 + 2 * (size_t)el_num_ + W - 1) / W * W;
+		if (edge_filter_buffer_ == nullptr || edge_filter_size_ < sizeof(int64_t) * header_words
+				|| header[0] != vnum_ || header[1] != el_num_
+				|| edge_filter_size_ != sizeof(int64_t) * (header_words
+					+ W * (el_num_ == 0 ? 0 : header[2 * el_num_] + header[2 * el_num_ + 1]))) {
+			fprintf(stderr, "cannot load %s\n", filter_fn.c_str());
+			exit(EXIT_FAILURE);
+		}
+		edge_filter_index_ = header + 2;
+		edge_filter_blocks_ = (const uint64_t*) (header + header_words);
+	}
 
-		int* size = (int*) buffer;
-		assert(in_offset_[vnum_] + 1 == size[0]);
-		buffer += sizeof(int);
+	//binaries of earlier versions have no label statistics: no empty checks
+	string stats_fn = fname + ".labelstats";
+	if (std::filesystem::exists(stats_fn)) {
+		label_stats_buffer_ = LoadFile(stats_fn.c_str(), label_stats_size_, mode, numa_node);
+		uint64_t* header = (uint64_t*) label_stats_buffer_;
+		if (label_stats_buffer_ == nullptr || label_stats_size_ < 3 * sizeof(uint64_t)
+				|| header[0] != (uint64_t)vnum_ || header[1] != (uint64_t)vl_num_ || header[2] != (uint64_t)el_num_
+				|| label_stats_size_ != sizeof(uint64_t) * (3 + LabelStats::Words(vl_num_, el_num_)))
+			fprintf(stderr, "%s is not of this binary, ignored\n", stats_fn.c_str());
+		else
+			label_stats_.Attach(header + 3, vl_num_, el_num_);
+	}
+    // std::cout << "~DataGraph::ReadBinary" << fname << "\n";
+}
 
-		in_label_ = (const int*) buffer;
-		buffer += sizeof(int) * size[0];
-		in_adj_offset_ = (const int*) buffer;
-		buffer += sizeof(int) * size[0];
+void DataGraph::MakeReplicas() {
+	replicas_.clear();
+	if (GetNumaMode() != NUMA_REPLICATE || !NumaActive() || binary_prefix_.empty() || ooc_)
+		return;
+	size_t num_nodes = NumaNodes().size();
+	vector<std::unique_ptr<DataGraph>> replicas(num_nodes);
+	vector<std::thread> threads;
+	for (size_t node = 0; node < num_nodes; node++) {
+		if (NumaNodes()[node].empty())
+			continue; //a memory-only node, which no thread reads from
+		replicas[node].reset(new DataGraph);
+		replicas[node]->SetHubDegree(hub_degree_);
+		replicas[node]->SetVertexHeaders(vertex_headers_);
+		//first touch, the hub index included, on the node itself
+		threads.emplace_back([this, &replicas, node]() {
+			PinToNumaNode(node);
+			replicas[node]->ReadBinary(binary_prefix_.c_str(), LOAD_COPY, node);
+		});
+	}
+	for (std::thread& t : threads)
+		t.join();
+	for (auto& replica : replicas)
+		if (replica == nullptr)
+			return; //Replica would have no copy for some node
+	replicas_ = std::move(replicas);
+}
 
-		size = (int*) buffer;
-		buffer += sizeof(int);
+void DataGraph::LoadRaw() {
+	ooc_.reset();
+	if (packed_) {
+		raw_.packed_adj_.Build(raw_.adj_.data(), raw_.adj_.size());
+		raw_.packed_in_adj_.Build(raw_.in_adj_.data(), raw_.in_adj_.size());
+	}
+	vnum_ = raw_.vlabels_.size();
+	enum_ = raw_.out_edges_.size();
+	vl_num_ = raw_.max_vl_ + 1;
+	el_num_ = raw_.max_el_ + 1;
+	wide_ = false;
+	vl_cnt_.assign(raw_.vl_cnt_.begin(), raw_.vl_cnt_.end());
+	el_cnt_.assign(raw_.el_cnt_.begin(), raw_.el_cnt_.end());
+	el_distinct_ = CountDistinct(vnum_, el_num_, raw_.offset_, raw_.label_, raw_.in_offset_, raw_.in_label_);
+
+	UnloadFile(buffer_, encode_size_, load_mode_);
+	UnloadFile(vl_bitmap_buffer_, vl_bitmap_size_, load_mode_);
+	vl_bitmap_buffer_ = nullptr;
+	vl_bitmap_offset_ = nullptr;
+	UnloadFile(edge_filter_buffer_, edge_filter_size_, load_mode_);
+	edge_filter_buffer_ = nullptr;
+	edge_filter_index_ = nullptr;
+	UnloadFile(label_stats_buffer_, label_stats_size_, load_mode_);
+	label_stats_buffer_ = nullptr;
+	label_stats_.Clear();
+	load_mode_ = LOAD_COPY;
+	encode_size_ = BinarySize();
+	buffer_ = static_cast<char*>(malloc(encode_size_));
+	EncodeBinary(buffer_, packed_, lean_);
+	vertex_map_ = raw_.perm_;
+	raw_ = RawDataGraph();
+	ParseBinary(buffer_, encode_size_);
+}
 
-		in_adj_ = (const int*) buffer;
-		buffer += sizeof(int) * size[0];
+//points the arrays into a .graph body
+void DataGraph::ParseBinary(const char* buffer, size_t encode_size) {
+	const char* orig = buffer;
+	//updates are relative to the binary they were made on
+	delta_[0].clear();
+	delta_[1].clear();
+	label_delta_.clear();
+	delta_edges_ = 0;
+	delta_log_.clear();
+	//an array size: int, or int64_t in the wide layout
+	auto size = [&]() {
+		int64_t n;
+		if (wide_) {
+			memcpy(&n, buffer, sizeof(int64_t));
+			buffer += sizeof(int64_t);
+		} else {
+			n = *(const int*) buffer;
+			buffer += sizeof(int);
+		}
+		return n;
+	};
+
+	for (int d = 0; d < 2; d++) {
+		Offsets& offset = d == 0 ? offset_ : in_offset_;
+		const int*& label = d == 0 ? label_ : in_label_;
+		Offsets& adj_o = d == 0 ? adj_offset_ : in_adj_offset_;
+		const int*& adj = d == 0 ? adj_ : in_adj_;
+		PackedAdj& packed = d == 0 ? packed_adj_ : packed_in_adj_;
+
+		buffer = offset.Attach(buffer, vnum_ + 1, wide_);
+		assert(offset[0] == 0);
+
+		int64_t n = size();
+		assert(offset[vnum_] + 1 == n);
+		label = (const int*) buffer;
+		buffer += sizeof(int) * n;
+		buffer = adj_o.Attach(buffer, n, wide_);
+
+		n = size();
+		if (packed_) {
+			adj = nullptr;
+			buffer += PackedPadding(buffer - orig);
+			buffer = packed.Attach(buffer, n);
+			if (buffer == nullptr) {
+				fprintf(stderr, "corrupt packed adjacency\n");
+				exit(EXIT_FAILURE);
+			}
+		} else if (ooc_) {
+			adj = nullptr;
+			ooc_->SetArray(d == 0, buffer - orig, n);
+			buffer += sizeof(int) * n;
+		} else {
+			adj = (const int*) buffer;
+			buffer += sizeof(int) * n;
+		}
 	}
 
 	{
-		vl_offset_ = (const int*) buffer;
+		buffer = vl_offset_.Attach(buffer, vnum_ + 1, wide_);
 		assert(vl_offset_[0] == 0);
-		buffer += sizeof(int) * (vnum_ + 1);
-
-		int* size = (int*) buffer;
-		buffer += sizeof(int);
 
+		int64_t n = size();
 		vl_ = (const int*) buffer;
-		buffer += sizeof(int) * size[0];
+		buffer += sizeof(int) * n;
 	}
 
 	{
-		el_rel_offset_ = (const int*) buffer; 
+		buffer = el_rel_offset_.Attach(buffer, el_num_ + 1, wide_);
 		assert(el_rel_offset_[0] == 0);
-		buffer += sizeof(int) * (el_num_ + 1);
 
-		el_rel_ = (const pair<int, int>*) buffer;
-		buffer += sizeof(pair<int, int>) * el_rel_offset_[el_num_];
+		if (lean_) {
+			el_rel_ = nullptr;
+			buffer = el_pair_offset_.Attach(buffer, el_num_ + 1, wide_);
+			int64_t n = el_pair_offset_[el_num_];
+			el_pair_src_ = (const int*) buffer;
+			buffer += sizeof(int) * n;
+			buffer = el_pair_cum_.Attach(buffer, n, wide_);
+		} else {
+			el_rel_ = (const pair<int, int>*) buffer;
+			buffer += sizeof(pair<int, int>) * el_rel_offset_[el_num_];
+		}
 	}
 
 	{
-		vl_rel_offset_ = (const int*) buffer; 
+		buffer = vl_rel_offset_.Attach(buffer, vl_num_ + 1, wide_);
 		assert(vl_rel_offset_[0] == 0);
-		buffer += sizeof(int) * (vl_num_ + 1);
 
 		vl_rel_ = (const int*) buffer;
 		buffer += sizeof(int) * vl_rel_offset_[vl_num_];
 	}
 	assert((buffer - orig) == encode_size);
-    // std::cout << "~DataGraph::ReadBinary" << fname << "\n";
+#ifdef DENSE_LABEL_INDEX
+	BuildDenseIndex();
+#endif
+	BuildHubIndex();
+	BuildVertexHeaders();
 }
 
+namespace {
+
+//lays the sorted keys[0, n) out in Eytzinger (BFS) order at eyt[1, n],
+//with their ranks in rank
+void Eytzinger(const int* keys, int n, int* eyt, int* rank, int& i, int k) {
+	if (k > n) return;
+	Eytzinger(keys, n, eyt, rank, i, 2 * k);
+	eyt[k] = keys[i];
+	rank[k] = i++;
+	Eytzinger(keys, n, eyt, rank, i, 2 * k + 1);
+}
+
+}  // namespace
+
+void DataGraph::BuildVertexHeaders() {
+	static_assert(sizeof(VertexHeader) == 64, "a vertex header is a cache line");
+	vheaders_.clear();
+	if (!vertex_headers_) return;
+	vheaders_.resize(vnum_);
+#pragma omp parallel for schedule(static)
+	for (int v = 0; v < vnum_; v++) {
+		VertexHeader& h = vheaders_[v];
+		memset(&h, 0, sizeof(h));
+		int64_t num_vl = vl_offset_[v + 1] - vl_offset_[v];
+		h.num_vl = num_vl <= 1 ? num_vl : VH_SPILL;
+		h.vl = num_vl == 1 ? vl_[vl_offset_[v]] : -1;
+		int used = 0;
+		for (int d = 0; d < 2; d++) {
+			const Offsets& offset = d == 0 ? offset_ : in_offset_;
+			const int* label = d == 0 ? label_ : in_label_;
+			const Offsets& adj_o = d == 0 ? adj_offset_ : in_adj_offset_;
+			int64_t first = offset[v], n = offset[v + 1] - first;
+			h.base[d] = adj_o[first];
+			if (used + n > VH_PAIRS || adj_o[first + n] - h.base[d] > UINT32_MAX) {
+				h.count[d] = VH_SPILL;
+				continue;
+			}
+			for (int64_t k = 0; k < n; k++) {
+				h.pair[used + k].el = label[first + k];
+				h.pair[used + k].end = adj_o[first + k + 1] - h.base[d];
+			}
+			h.count[d] = n;
+			used += n;
+		}
+	}
+}
+
+void DataGraph::BuildHubIndex() {
+	for (int d = 0; d < 2; d++) hubs_[d].clear();
+	hub_keys_.clear();
+	hub_rank_.clear();
+	if (hub_degree_ <= 0 || packed_ || ooc_) return;
+	vector<int> fence;
+	for (int d = 0; d < 2; d++) {
+		const Offsets& offset = d == 0 ? offset_ : in_offset_;
+		const Offsets& adj_o  = d == 0 ? adj_offset_ : in_adj_offset_;
+		const int* adj = d == 0 ? adj_ : in_adj_;
+		for (int64_t i = 0; i < offset[vnum_]; i++) {
+			int64_t begin = adj_o[i], end = adj_o[i+1];
+			if (end - begin < hub_degree_) continue;
+			fence.clear();
+			for (int64_t j = begin; j < end; j += HUB_BLOCK) fence.push_back(adj[j]);
+			HubIndex h;
+			h.base = hub_keys_.size();
+			h.size = fence.size();
+			hub_keys_.resize(h.base + h.size + 1);
+			hub_rank_.resize(h.base + h.size + 1);
+			int rank = 0;
+			Eytzinger(fence.data(), h.size, hub_keys_.data() + h.base, hub_rank_.data() + h.base, rank, 1);
+			hubs_[d][begin] = h;
+		}
+	}
+}
+
+bool DataGraph::HubContains(const HubIndex& h, const int* list, int64_t len, int target) {
+	const int* eyt = hub_keys_.data() + h.base;
+	//descend to the first fence key > target, prefetching four levels ahead
+	size_t k = 1;
+	while (k <= (size_t)h.size) {
+		__builtin_prefetch(eyt + 16 * k);
+		k = 2 * k + (eyt[k] <= target);
+	}
+	k >>= __builtin_ffsll(~k);
+	int above = k == 0 ? h.size : hub_rank_[h.base + k];
+	if (above == 0) return false;
+	int64_t block = (int64_t)(above - 1) * HUB_BLOCK;
+	const int* b = list + block;
+	return Contains(range{b, list + std::min<int64_t>(len, block + HUB_BLOCK)}, target);
+}
+
+#ifdef DENSE_LABEL_INDEX
+void DataGraph::BuildDenseIndex() {
+	//the index holds int positions, which a wide graph outgrows
+	if (wide_) {
+		fprintf(stderr, "DENSE_LABEL_INDEX needs a graph without wide offsets\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int d = 0; d < 2; d++) {
+		const Offsets& offset = d == 0 ? offset_ : in_offset_;
+		const int* label  = d == 0 ? label_ : in_label_;
+		const Offsets& adj_o  = d == 0 ? adj_offset_ : in_adj_offset_;
+		vector<int>& dense = d == 0 ? dense_adj_ : in_dense_adj_;
+
+		//labels of a vertex are sorted and adj_o is global, so a missing
+		//label simply gets the begin of the next present one (an empty list)
+		dense.resize((size_t)vnum_ * el_num_ + 1);
+		#pragma omp parallel for schedule(static)
+		for (int v = 0; v < vnum_; v++) {
+			int i = offset[v], end = offset[v+1];
+			int* row = dense.data() + (size_t)v * el_num_;
+			for (int el = 0; el < el_num_; el++) {
+				while (i < end && label[i] < el) i++;
+				row[el] = adj_o[i];
+			}
+		}
+		dense[(size_t)vnum_ * el_num_] = adj_o[offset[vnum_]];
+	}
+}
+#endif
+
 void DataGraph::ClearRawData() {
 	raw_.vl_cnt_.clear();
 	raw_.el_cnt_.clear();
@@ -439,6 +1272,490 @@ void DataGraph::ClearRawData() {
 	raw_.vl_.clear();
 	raw_.vl_rel_.clear();
 	raw_.el_rel_.clear();
+	raw_.perm_.clear();
+	raw_.packed_adj_ = PackedAdj();
+	raw_.packed_in_adj_ = PackedAdj();
+}
+
+// Direct text-to-binary conversion. Produces exactly the files
+// ReadText/MakeBinary/WriteBinary produce, but parses the text in parallel
+// chunks over a mapping and builds both CSRs by a counting sort on the
+// endpoint, so no global edge list (RawDataGraph::out_edges_/in_edges_) is
+// ever materialised. Peak memory is about 16 bytes per input edge.
+namespace {
+
+struct TextChunk {
+	const char* begin;
+	const char* end;
+};
+
+// splits [begin, end) into n pieces that start at line boundaries
+vector<TextChunk> SplitLines(const char* begin, const char* end, int n) {
+	vector<TextChunk> ret;
+	size_t step = (end - begin) / n + 1;
+	const char* b = begin;
+	while (b < end) {
+		const char* e = (size_t)(end - b) > step ? b + step : end;
+		while (e < end && *(e - 1) != '\n') e++;
+		ret.push_back({b, e});
+		b = e;
+	}
+	return ret;
+}
+
+// the labels of a text line through a label projection: dropped vertex
+// labels become -1, which the readers skip, and dropped edge labels are
+// removed from their line
+struct LineProjection {
+	LabelMap vl, el;
+
+	void Apply(char type, vector<long>& tok) const {
+		if (type == 'v' && !vl.empty()) {
+			for (size_t i = 1; i < tok.size(); i++)
+				if (tok[i] >= 0)
+					tok[i] = tok[i] < (long)vl.to.size() ? vl.to[tok[i]] : -1;
+		} else if (type == 'e' && !el.empty() && tok.size() >= 2) {
+			size_t n = 2;
+			for (size_t i = 2; i < tok.size(); i++)
+				if (tok[i] >= 0 && tok[i] < (long)el.to.size() && el.to[tok[i]] >= 0)
+					tok[n++] = el.to[tok[i]];
+			tok.resize(n);
+		}
+	}
+};
+
+// calls f(type, ints) for every 'v'/'e' line of the chunk, where ints holds
+// the integer tokens following the first token, projected if projection is
+// given
+template <typename F>
+void ForEachLine(const TextChunk& chunk, vector<long>& ints, F f,
+		const LineProjection* projection = nullptr) {
+	const char* p = chunk.begin;
+	while (p < chunk.end) {
+		const char* eol = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+		if (eol == nullptr) eol = chunk.end;
+		char type = *p;
+		if (type == 'v' || type == 'e') {
+			ints.clear();
+			while (p < eol && *p != ' ' && *p != '\t') p++;
+			while (p < eol) {
+				while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+				if (p == eol) break;
+				bool neg = *p == '-';
+				if (neg || *p == '+') p++;
+				long val = 0;
+				while (p < eol && *p >= '0' && *p <= '9') val = val * 10 + (*p++ - '0');
+				ints.push_back(neg ? -val : val);
+				while (p < eol && *p != ' ' && *p != '\t') p++;
+			}
+			if (projection != nullptr) projection->Apply(type, ints);
+			f(type, ints);
+		}
+		p = eol + 1;
+	}
+}
+
+inline uint64_t PackAdj(int el, int v) {
+	return (static_cast<uint64_t>(el) << 32) | static_cast<uint32_t>(v);
+}
+inline int AdjLabel(uint64_t x) { return static_cast<int>(x >> 32); }
+inline int AdjVertex(uint64_t x) { return static_cast<int>(x & 0xffffffffu); }
+
+// One direction of the CSR: offset_/label_/adj_offset_/adj_ in file order.
+// Offsets are kept wide here and narrowed on writing unless the graph
+// needs the wide layout.
+struct Csr {
+	vector<int64_t> offset, adj_offset;
+	vector<int> label, adj;
+};
+
+// Sorts and deduplicates each vertex's bucket of packed (el, nbr) entries in
+// place and lays them out as a CSR. start holds the bucket boundaries.
+void BuildCsr(int vnum, const vector<size_t>& start, vector<uint64_t>& bucket, Csr& csr) {
+	vector<int> nadj(vnum + 1, 0), nlabel(vnum + 1, 0);
+#pragma omp parallel for schedule(dynamic, 1024)
+	for (int u = 0; u < vnum; u++) {
+		auto b = bucket.begin() + start[u], e = bucket.begin() + start[u + 1];
+		sort(b, e);
+		e = unique(b, e);
+		nadj[u] = e - b;
+		int labels = 0;
+		for (auto it = b; it != e; ++it)
+			if (it == b || AdjLabel(*it) != AdjLabel(*(it - 1))) labels++;
+		nlabel[u] = labels;
+	}
+	// exclusive prefix sums
+	vector<size_t> adj_pos(vnum + 1, 0);
+	csr.offset.resize(vnum + 1);
+	csr.offset[0] = 0;
+	for (int u = 0; u < vnum; u++) {
+		adj_pos[u + 1] = adj_pos[u] + nadj[u];
+		csr.offset[u + 1] = csr.offset[u] + nlabel[u];
+	}
+	size_t num_labels = csr.offset[vnum];
+	csr.label.resize(num_labels + 1);
+	csr.adj_offset.resize(num_labels + 1);
+	csr.adj.resize(adj_pos[vnum]);
+#pragma omp parallel for schedule(dynamic, 1024)
+	for (int u = 0; u < vnum; u++) {
+		const uint64_t* b = bucket.data() + start[u];
+		int64_t li = csr.offset[u];
+		size_t ai = adj_pos[u];
+		for (int i = 0; i < nadj[u]; i++) {
+			if (i == 0 || AdjLabel(b[i]) != AdjLabel(b[i - 1])) {
+				csr.label[li] = AdjLabel(b[i]);
+				csr.adj_offset[li] = ai;
+				li++;
+			}
+			csr.adj[ai++] = AdjVertex(b[i]);
+		}
+	}
+	csr.label[num_labels] = -1;
+	csr.adj_offset[num_labels] = adj_pos[vnum];
+}
+
+template <typename T>
+void WriteArray(FILE* f, const T* data, size_t n) {
+	if (n > 0) fwrite(data, sizeof(T), n, f);
+}
+
+// offsets (and array sizes) as int64_t in the wide layout, else as int
+void WriteOffsets(FILE* f, const int64_t* data, size_t n, bool wide) {
+	if (wide) {
+		WriteArray(f, data, n);
+		return;
+	}
+	vector<int> narrow(std::min<size_t>(n, 1 << 20));
+	for (size_t i = 0; i < n; i += narrow.size()) {
+		size_t len = std::min(narrow.size(), n - i);
+		copy(data + i, data + i + len, narrow.begin());
+		WriteArray(f, narrow.data(), len);
+	}
+}
+
+void WriteSize(FILE* f, int64_t size, bool wide) {
+	WriteOffsets(f, &size, 1, wide);
+}
+
+// packed: csr.adj compressed (see EncodeBinary), or null for the plain form
+void WriteCsr(FILE* f, const Csr& csr, const PackedAdj* packed, bool wide) {
+	WriteOffsets(f, csr.offset.data(), csr.offset.size(), wide);
+	WriteSize(f, csr.label.size(), wide);
+	WriteArray(f, csr.label.data(), csr.label.size());
+	WriteOffsets(f, csr.adj_offset.data(), csr.adj_offset.size(), wide);
+	WriteSize(f, csr.adj.size(), wide);
+	if (packed) {
+		char zero[8] = {0};
+		WriteArray(f, zero, PackedPadding(ftell(f)));
+		WriteArray(f, packed->Data(), packed->Bytes());
+	} else {
+		WriteArray(f, csr.adj.data(), csr.adj.size());
+	}
+}
+
+// relabels both endpoints of every entry through perm (old -> new id)
+void PermuteCsr(int vnum, const vector<int>& perm, Csr& csr) {
+	vector<size_t> start(vnum + 1, 0);
+	for (int u = 0; u < vnum; u++)
+		start[perm[u] + 1] = csr.adj_offset[csr.offset[u + 1]] - csr.adj_offset[csr.offset[u]];
+	for (int u = 0; u < vnum; u++) start[u + 1] += start[u];
+	vector<uint64_t> bucket(start[vnum]);
+#pragma omp parallel for schedule(dynamic, 1024)
+	for (int u = 0; u < vnum; u++) {
+		size_t pos = start[perm[u]];
+		for (int64_t i = csr.offset[u]; i < csr.offset[u + 1]; i++)
+			for (int64_t j = csr.adj_offset[i]; j < csr.adj_offset[i + 1]; j++)
+				bucket[pos++] = PackAdj(csr.label[i], perm[csr.adj[j]]);
+	}
+	csr = Csr();
+	BuildCsr(vnum, start, bucket, csr);
+}
+
+// bytes WriteCsr writes, starting at byte pos of the body
+size_t CsrSize(const Csr& csr, const PackedAdj* packed, size_t pos, bool wide) {
+	size_t o = wide ? sizeof(int64_t) : sizeof(int);
+	size_t ret = o * (csr.offset.size() + csr.adj_offset.size() + 2) + sizeof(int) * csr.label.size();
+	if (packed)
+		return ret + PackedPadding(pos + ret) + packed->Bytes();
+	return ret + sizeof(int) * csr.adj.size();
+}
+
+} // namespace
+
+void DataGraph::BuildBinary(const char* text_fn, const char* filename) {
+	size_t text_size = 0;
+	char* text = LoadFile(text_fn, text_size, LOAD_MMAP);
+	if (text == nullptr) {
+		fprintf(stderr, "cannot read %s\n", text_fn);
+		exit(EXIT_FAILURE);
+	}
+	vector<TextChunk> chunks = SplitLines(text, text + text_size, 4 * omp_get_max_threads());
+	int num_chunks = chunks.size();
+	LineProjection projection;
+	projection.vl = LabelMap::Of(project_vl_);
+	projection.el = LabelMap::Of(project_el_);
+
+	// pass 1: vertex lines (in file order they define vertex ids) and label ranges
+	vector<vector<int>> chunk_vl(num_chunks), chunk_vl_cnt(num_chunks);
+	vector<int> chunk_max_vl(num_chunks, -1), chunk_max_el(num_chunks, -1);
+	vector<size_t> chunk_num_edges(num_chunks, 0);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int c = 0; c < num_chunks; c++) {
+		vector<long> ints;
+		ForEachLine(chunks[c], ints, [&](char type, vector<long>& tok) {
+			if (type == 'v') {
+				int cnt = 0;
+				for (size_t i = 1; i < tok.size(); i++) {
+					if (tok[i] < 0) continue;
+					chunk_vl[c].push_back(tok[i]);
+					chunk_max_vl[c] = std::max(chunk_max_vl[c], (int)tok[i]);
+					cnt++;
+				}
+				chunk_vl_cnt[c].push_back(cnt);
+			} else if (tok.size() >= 2) {
+				for (size_t i = 2; i < tok.size(); i++)
+					chunk_max_el[c] = std::max(chunk_max_el[c], (int)tok[i]);
+				chunk_num_edges[c] += tok.size() - 2;
+			}
+		}, &projection);
+	}
+	int vnum = 0, max_vl = -1, max_el = -1;
+	for (int c = 0; c < num_chunks; c++) {
+		vnum += chunk_vl_cnt[c].size();
+		max_vl = std::max(max_vl, chunk_max_vl[c]);
+		max_el = std::max(max_el, chunk_max_el[c]);
+	}
+	//the projected labels, and the one without data after them
+	if (!project_vl_.empty()) max_vl = project_vl_.size();
+	if (!project_el_.empty()) max_el = project_el_.size();
+
+	// vertex labels, sorted per vertex
+	vector<int64_t> vl_offset(1, 0);
+	vector<int> vl;
+	for (int c = 0; c < num_chunks; c++) {
+		size_t pos = 0;
+		for (int cnt : chunk_vl_cnt[c]) {
+			size_t b = vl.size();
+			vl.insert(vl.end(), chunk_vl[c].begin() + pos, chunk_vl[c].begin() + pos + cnt);
+			sort(vl.begin() + b, vl.end());
+			vl_offset.push_back(vl.size());
+			pos += cnt;
+		}
+		vector<int>().swap(chunk_vl[c]);
+		vector<int>().swap(chunk_vl_cnt[c]);
+	}
+
+	// pass 2: degree counts, i.e. the histogram of the counting sort
+	vector<size_t> out_start(vnum + 1, 0), in_start(vnum + 1, 0);
+	bool bad_vertex = false;
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int c = 0; c < num_chunks; c++) {
+		vector<long> ints;
+		ForEachLine(chunks[c], ints, [&](char type, vector<long>& tok) {
+			if (type != 'e' || tok.size() < 3) return;
+			if (tok[0] < 0 || tok[0] >= vnum || tok[1] < 0 || tok[1] >= vnum) {
+				bad_vertex = true;
+				return;
+			}
+			size_t n = tok.size() - 2;
+#pragma omp atomic
+			out_start[tok[0] + 1] += n;
+#pragma omp atomic
+			in_start[tok[1] + 1] += n;
+		}, &projection);
+	}
+	if (bad_vertex) {
+		fprintf(stderr, "%s: edge endpoint outside the %d declared vertices\n", text_fn, vnum);
+		exit(EXIT_FAILURE);
+	}
+	for (int u = 0; u < vnum; u++) {
+		out_start[u + 1] += out_start[u];
+		in_start[u + 1] += in_start[u];
+	}
+
+	// pass 3: scatter packed (label, neighbour) entries into per-vertex buckets
+	vector<uint64_t> out_bucket(out_start[vnum]), in_bucket(in_start[vnum]);
+	{
+		vector<size_t> out_pos(out_start.begin(), out_start.end() - 1);
+		vector<size_t> in_pos(in_start.begin(), in_start.end() - 1);
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int c = 0; c < num_chunks; c++) {
+			vector<long> ints;
+			ForEachLine(chunks[c], ints, [&](char type, vector<long>& tok) {
+				if (type != 'e' || tok.size() < 3) return;
+				int src = tok[0], dst = tok[1];
+				for (size_t i = 2; i < tok.size(); i++) {
+					int el = tok[i];
+					size_t o, n;
+#pragma omp atomic capture
+					o = out_pos[src]++;
+#pragma omp atomic capture
+					n = in_pos[dst]++;
+					out_bucket[o] = PackAdj(el, dst);
+					in_bucket[n] = PackAdj(el, src);
+				}
+			}, &projection);
+		}
+	}
+	UnloadFile(text, text_size, LOAD_MMAP);
+
+	Csr out, in;
+	BuildCsr(vnum, out_start, out_bucket, out);
+	vector<uint64_t>().swap(out_bucket);
+	BuildCsr(vnum, in_start, in_bucket, in);
+	vector<uint64_t>().swap(in_bucket);
+	int64_t enm = out.adj.size();
+
+	// optional relabelling, over the undirected union of both CSRs
+	vector<int> perm;
+	if (reorder_ != REORDER_NONE) {
+		vector<size_t> start(vnum + 1, 0);
+		for (int u = 0; u < vnum; u++)
+			start[u + 1] = start[u] + (out.adj_offset[out.offset[u + 1]] - out.adj_offset[out.offset[u]])
+				+ (in.adj_offset[in.offset[u + 1]] - in.adj_offset[in.offset[u]]);
+		vector<int> nbr(start[vnum]);
+#pragma omp parallel for schedule(dynamic, 1024)
+		for (int u = 0; u < vnum; u++) {
+			size_t pos = start[u];
+			for (int64_t j = out.adj_offset[out.offset[u]]; j < out.adj_offset[out.offset[u + 1]]; j++)
+				nbr[pos++] = out.adj[j];
+			for (int64_t j = in.adj_offset[in.offset[u]]; j < in.adj_offset[in.offset[u + 1]]; j++)
+				nbr[pos++] = in.adj[j];
+		}
+		perm = VertexOrder(reorder_, vnum, start, nbr);
+		vector<int>().swap(nbr);
+		PermuteCsr(vnum, perm, out);
+		PermuteCsr(vnum, perm, in);
+
+		vector<int64_t> new_offset(vnum + 1, 0);
+		vector<int> new_vl(vl.size());
+		for (int u = 0; u < vnum; u++)
+			new_offset[perm[u] + 1] = vl_offset[u + 1] - vl_offset[u];
+		for (int u = 0; u < vnum; u++) new_offset[u + 1] += new_offset[u];
+		for (int u = 0; u < vnum; u++)
+			copy(vl.begin() + vl_offset[u], vl.begin() + vl_offset[u + 1], new_vl.begin() + new_offset[perm[u]]);
+		vl_offset.swap(new_offset);
+		vl.swap(new_vl);
+	}
+	PackedAdj out_packed, in_packed;
+	if (packed_) {
+		out_packed.Build(out.adj.data(), out.adj.size());
+		in_packed.Build(in.adj.data(), in.adj.size());
+	}
+
+	// edge relations grouped by label, each ordered by (src, dst)
+	vector<int64_t> el_cnt(max_el + 1, 0), el_rel_offset(max_el + 2, 0);
+	vector<pair<int, int>> el_rel(lean_ ? 0 : enm);
+	{
+		int num_blocks = omp_get_max_threads();
+		int block = vnum / num_blocks + 1;
+		vector<vector<int64_t>> block_cnt(num_blocks, vector<int64_t>(max_el + 1, 0));
+#pragma omp parallel for schedule(static, 1)
+		for (int t = 0; t < num_blocks; t++) {
+			for (int u = t * block; u < std::min(vnum, (t + 1) * block); u++)
+				for (int64_t i = out.offset[u]; i < out.offset[u + 1]; i++)
+					block_cnt[t][out.label[i]] += out.adj_offset[i + 1] - out.adj_offset[i];
+		}
+		for (int el = 0; el <= max_el; el++) {
+			int64_t pos = el_rel_offset[el];
+			for (int t = 0; t < num_blocks; t++) {
+				int64_t cnt = block_cnt[t][el];
+				block_cnt[t][el] = pos;
+				pos += cnt;
+			}
+			el_cnt[el] = pos - el_rel_offset[el];
+			el_rel_offset[el + 1] = pos;
+		}
+#pragma omp parallel for schedule(static, 1)
+		for (int t = 0; t < (lean_ ? 0 : num_blocks); t++) {
+			for (int u = t * block; u < std::min(vnum, (t + 1) * block); u++)
+				for (int64_t i = out.offset[u]; i < out.offset[u + 1]; i++) {
+					int64_t& pos = block_cnt[t][out.label[i]];
+					for (int64_t j = out.adj_offset[i]; j < out.adj_offset[i + 1]; j++)
+						el_rel[pos++] = make_pair(u, out.adj[j]);
+				}
+		}
+	}
+
+	// vertex relations grouped by label
+	vector<int> vl_cnt(max_vl + 1, 0);
+	vector<int64_t> vl_rel_offset(max_vl + 2, 0);
+	for (int l : vl) vl_cnt[l]++;
+	for (int l = 0; l <= max_vl; l++) vl_rel_offset[l + 1] = vl_rel_offset[l] + vl_cnt[l];
+	vector<int> vl_rel(vl.size());
+	{
+		vector<int64_t> pos(vl_rel_offset.begin(), vl_rel_offset.end() - 1);
+		for (int u = 0; u < vnum; u++)
+			for (int64_t i = vl_offset[u]; i < vl_offset[u + 1]; i++)
+				vl_rel[pos[vl[i]]++] = u;
+	}
+
+	// the wide layout once any offset outgrows int
+	size_t max_entries = std::max({out.adj.size(), out.label.size(), in.label.size(), vl.size()});
+	bool wide = wide_ || max_entries > (size_t)INT_MAX;
+	size_t o = wide ? sizeof(int64_t) : sizeof(int);
+
+	size_t encode_size = 0;
+	uint64_t sections[NUM_SECTIONS];
+	sections[0] = encode_size;
+	encode_size += CsrSize(out, packed_ ? &out_packed : nullptr, encode_size, wide);
+	sections[1] = encode_size;
+	encode_size += CsrSize(in, packed_ ? &in_packed : nullptr, encode_size, wide);
+	sections[2] = encode_size;
+	encode_size += o * (vl_offset.size() + 1) + sizeof(int) * vl.size();
+	sections[3] = encode_size;
+	encode_size += o * el_rel_offset.size();
+	LabelView view;
+	if (lean_) {
+		view = BuildLabelView(vnum, max_el + 1, out.offset, out.label, out.adj_offset);
+		encode_size += o * (view.pair_offset.size() + view.pair_cum.size()) + sizeof(int) * view.pair_src.size();
+	} else {
+		encode_size += sizeof(pair<int, int>) * el_rel.size();
+	}
+	sections[4] = encode_size;
+	encode_size += o * vl_rel_offset.size() + sizeof(int) * vl_rel.size();
+	int layout = (packed_ ? LAYOUT_PACKED : 0) | (wide ? LAYOUT_WIDE : 0) | (lean_ ? LAYOUT_LEAN : 0);
+
+	string fname = string(filename) + ".graph";
+	string metadata = fname + ".meta";
+	FILE* fp = fopen(metadata.c_str(), "w");
+	fprintf(fp, "%d %" PRId64 " %d %d %zu", vnum, enm, max_vl + 1, max_el + 1, encode_size);
+	if (layout != 0)
+		fprintf(fp, " %d", layout);
+	fprintf(fp, "\n");
+	for (int l = 0; l <= max_vl; l++)
+		fprintf(fp, "%d ", vl_cnt[l]);
+	fprintf(fp, "\n");
+	for (int el = 0; el <= max_el; el++)
+		fprintf(fp, "%" PRId64 " ", el_cnt[el]);
+	fprintf(fp, "\n");
+	WriteSections(fp, sections);
+	WriteDistinct(fp, CountDistinct(vnum, max_el + 1, out.offset, out.label, in.offset, in.label));
+	fclose(fp);
+
+	FILE* f = fopen(fname.c_str(), "w");
+	WriteCsr(f, out, packed_ ? &out_packed : nullptr, wide);
+	WriteCsr(f, in, packed_ ? &in_packed : nullptr, wide);
+	WriteOffsets(f, vl_offset.data(), vl_offset.size(), wide);
+	WriteSize(f, vl.size(), wide);
+	WriteArray(f, vl.data(), vl.size());
+	WriteOffsets(f, el_rel_offset.data(), el_rel_offset.size(), wide);
+	if (lean_) {
+		WriteOffsets(f, view.pair_offset.data(), view.pair_offset.size(), wide);
+		WriteArray(f, view.pair_src.data(), view.pair_src.size());
+		WriteOffsets(f, view.pair_cum.data(), view.pair_cum.size(), wide);
+	} else {
+		WriteArray(f, el_rel.data(), el_rel.size());
+	}
+	WriteOffsets(f, vl_rel_offset.data(), vl_rel_offset.size(), wide);
+	WriteArray(f, vl_rel.data(), vl_rel.size());
+	assert((size_t)ftell(f) == encode_size);
+	fclose(f);
+	WritePerm(fname, perm);
+	WriteLabels(fname, project_vl_, project_el_);
+	WriteVLabelBitmap(fname, vl_bitmap_, vnum, max_vl + 1, vl_offset, vl);
+	WriteEdgeFilter(fname, edge_filter_, vnum, max_el + 1, out.offset, out.label, out.adj_offset, out.adj);
+	WriteLabelStats(fname, vnum, max_vl + 1, max_el + 1, vl_offset, vl, out.offset, out.label, in.offset, in.label);
 }
 
 int DataGraph::GetNumVertices() {
@@ -449,12 +1766,21 @@ int DataGraph::GetNumVertices(int vl) {
 	return vl_cnt_[vl];
 }
 
-int DataGraph::GetNumEdges() {
-	return enum_;
+int64_t DataGraph::GetNumEdges() {
+	return enum_ + delta_edges_;
+}
+
+int64_t DataGraph::GetNumEdges(int el) {
+	if (label_delta_.empty())
+		return el_cnt_[el];
+	const LabelDelta& d = label_delta_[el];
+	return el_cnt_[el] - (int64_t)d.deleted.size() + (int64_t)d.inserted.size();
 }
 
-int DataGraph::GetNumEdges(int el) {
-	return el_cnt_[el];
+int64_t DataGraph::GetNumDistinct(int el, bool dir) {
+	if (el_distinct_.empty() || el < 0 || el >= el_num_)
+		return -1;
+	return el_distinct_[(dir ? 0 : el_num_) + el];
 }
 
 int DataGraph::GetNumVLabels(int v) {
@@ -483,15 +1809,23 @@ range DataGraph::GetVLabels(int v) {
 }
 
 bool DataGraph::HasVLabel(int v, int vl) {
-	int begin = vl_offset_[v];
-	int end   = vl_offset_[v+1];
+	GCARE_COUNT(label_search);
+	if (vl_bitmap_offset_ != nullptr && (unsigned)vl < (unsigned)vl_num_) {
+		int64_t w = vl_bitmap_offset_[vl];
+		if (w >= 0)
+			return (vl_bitmap_words_[w + v / 64] >> (v % 64)) & 1;
+	}
+	if (!vheaders_.empty() && vheaders_[v].num_vl != VH_SPILL)
+		return vheaders_[v].num_vl == 1 && vheaders_[v].vl == vl;
+	int64_t begin = vl_offset_[v];
+	int64_t end   = vl_offset_[v+1];
 
-	int res = search(vl_, begin, end, vl);
+	int res = search(vl_ + begin, 0, end - begin, vl);
 	return res != -1;
 }
 
 range DataGraph::GetELabels(int v, bool dir = true) {
-	const int* offset = dir ? offset_ : in_offset_;
+	const Offsets& offset = dir ? offset_ : in_offset_;
 	const int* label  = dir ? label_  : in_label_;
 
 	range r;
@@ -506,85 +1840,185 @@ bool DataGraph::HasELabel(int v, int el, bool dir = true) {
 }
 
 int DataGraph::GetELabelIndex(int v, int el, bool dir = true) {
-	const int* offset = dir ? offset_ : in_offset_;
+	GCARE_COUNT(label_search);
+	const Offsets& offset = dir ? offset_ : in_offset_;
 	const int* label  = dir ? label_ : in_label_; 
-	const int* adj_o  = dir ? adj_offset_ : in_adj_offset_; 
-	const int* adj    = dir ? adj_   : in_adj_;
 
-	int begin = offset[v];
-	int end   = offset[v+1];
-	int res = search(label, begin, end, el);
-	return res == -1 ? -1 : res - begin;
+	int64_t begin = offset[v];
+	int64_t end   = offset[v+1];
+	return search(label + begin, 0, end - begin, el);
 }
 
-range DataGraph::GetAdj(int v, int el, bool dir = true) {
-	const int* offset = dir ? offset_ : in_offset_;
-	//const pair<int, int>* label  = dir ? label_ : in_label_; 
+bool DataGraph::AdjBounds(int v, int el, bool dir, int64_t* begin, int64_t* end) {
+#ifdef DENSE_LABEL_INDEX
+	if ((unsigned)el >= (unsigned)el_num_) return false;
+	const int* dense  = (dir ? dense_adj_ : in_dense_adj_).data() + (size_t)v * el_num_ + el;
+	*begin = dense[0];
+	*end   = dense[1];
+	return true;
+#else
+	if (!vheaders_.empty()) {
+		const VertexHeader& h = vheaders_[v];
+		int d = dir ? 0 : 1;
+		if (h.count[d] != VH_SPILL) {
+			int k = d == 0 || h.count[0] == VH_SPILL ? 0 : h.count[0];
+			int stop = k + h.count[d];
+			uint32_t prev = 0;
+			for (; k < stop; k++) {
+				if (h.pair[k].el == el) {
+					*begin = h.base[d] + prev;
+					*end   = h.base[d] + h.pair[k].end;
+					return true;
+				}
+				prev = h.pair[k].end;
+			}
+			return false;
+		}
+	}
+	const Offsets& offset = dir ? offset_ : in_offset_;
 	const int* label  = dir ? label_ : in_label_; 
-	const int* adj_o  = dir ? adj_offset_ : in_adj_offset_; 
-	const int* adj    = dir ? adj_   : in_adj_;
+	const Offsets& adj_o  = dir ? adj_offset_ : in_adj_offset_; 
+
+	int64_t first = offset[v];
+	int res = search(label + first, 0, offset[v+1] - first, el);
+	if (res == -1) return false;
+	*begin = adj_o[first + res];
+	*end   = adj_o[first + res + 1];
+	return true;
+#endif
+}
 
+range DataGraph::GetAdj(int v, int el, bool dir = true) {
+	GCARE_COUNT(get_adj);
+	const DeltaList* d = Delta(v, el, dir);
+	range base = BaseAdj(v, el, dir);
+	if (d == nullptr) return base;
+
+	//the base list without del, merged with ins, in a ring of buffers of
+	//its own so that the base list decoded on a packed graph stays valid
+	static thread_local vector<int> scratch[8];
+	static thread_local int next = 0;
+	vector<int>& buf = scratch[next];
+	next = (next + 1) % 8;
+	buf.resize(std::max<size_t>((base.end - base.begin) + d->ins.size(), 1));
+	int* out = buf.data();
+	auto del = d->del.begin();
+	auto ins = d->ins.begin();
+	for (const int* p = base.begin; p != base.end; p++) {
+		while (del != d->del.end() && *del < *p) del++;
+		if (del != d->del.end() && *del == *p) continue;
+		while (ins != d->ins.end() && *ins < *p) *out++ = *ins++;
+		*out++ = *p;
+	}
+	while (ins != d->ins.end()) *out++ = *ins++;
 	range r;
-	r.begin = r.end = adj;
-
-	int begin = offset[v];
-	int end   = offset[v+1];
-	int res = search(label, begin, end, el);
-	if (res == -1) return r;
-	r.begin = adj + adj_o[res];
-	r.end   = adj + adj_o[res+1];
+	r.begin = buf.data();
+	r.end   = out;
 	return r;
+}
 
-	/*int beginL = offset[v];
-	  int endL   = offset[v+1];
-	  int beginB = 0;
-	  int endB   = 0;
-	  if (endL - beginL > BINARY_THRESHOLD) {
-	  int mid;
-	  while (beginL < endL) {
-	  mid = (beginL + endL) / 2;
-	  if (label[mid] < el)
-	  beginL = mid + 1;
-	  else if (label[mid] > el)
-	  endL = mid;
-	  else {
-	  beginB = adj_o[mid]; 
-	  endB   = adj_o[mid+1]; 
-	  break;
-	  }
-	  }
-	  } else {
-	  for (int i = beginL; i < endL; i++) {
-	  if (label[i] == el) {
-	  beginB = adj_o[i]; 
-	  endB   = adj_o[i+1]; 
-	  break;
-	  }
-	  }
-	  }
+range DataGraph::BaseAdj(int v, int el, bool dir) {
+	int64_t begin = 0, end = 0;
+	bool found = AdjBounds(v, el, dir, &begin, &end);
+	if (!packed_ && !ooc_) {
+		const int* adj = dir ? adj_ : in_adj_;
+		range r;
+		r.begin = r.end = adj;
+		if (!found) return r;
+		r.begin = adj + begin;
+		r.end   = adj + end;
+		return r;
+	}
 
-	  range r;
-	  r.begin = adj + beginB;
-	  r.end   = adj + endB;
-	  return r;*/
+	//a ring of decode (read) buffers, so a few lists can be held at once
+	static thread_local vector<int> scratch[8];
+	static thread_local int next = 0;
+	vector<int>& buf = scratch[next];
+	next = (next + 1) % 8;
+	if (!found) end = begin;
+	buf.resize(std::max<int64_t>(end - begin, 1));
+	if (ooc_)
+		ooc_->Read(dir, begin, end, buf.data());
+	else
+		(dir ? packed_adj_ : packed_in_adj_).Decode(begin, end, buf.data());
+	range r;
+	r.begin = buf.data();
+	r.end   = buf.data() + (end - begin);
+	return r;
 }
 
-int DataGraph::GetAdjSize(int v, int el, bool dir = true) {
-	range r = GetAdj(v, el, dir);
-	return r.end - r.begin;
+void DataGraph::PrefetchAdj(int v, int el, bool dir) {
+#ifdef DENSE_LABEL_INDEX
+	if ((unsigned)el < (unsigned)el_num_)
+		__builtin_prefetch((dir ? dense_adj_ : in_dense_adj_).data() + (size_t)v * el_num_ + el);
+#else
+	__builtin_prefetch((dir ? offset_ : in_offset_).Address(v));
+#endif
 }
 
-bool DataGraph::HasEdge(int u, int v, int el, bool dir = true) {
-	int u_adj_size = GetAdjSize(u, el, dir);
-	int v_adj_size = GetAdjSize(v, el, !dir);
+void DataGraph::PrefetchAdjList(int v, int el, bool dir) {
+	int64_t begin, end;
+	if (packed_ || !AdjBounds(v, el, dir, &begin, &end) || begin == end)
+		return;
+	if (ooc_)
+		ooc_->Prefetch(dir, begin, end);
+	else
+		__builtin_prefetch((dir ? adj_ : in_adj_) + begin);
+}
 
-	range r = u_adj_size < v_adj_size ? GetAdj(u, el, dir) : GetAdj(v, el, !dir); 
-	int target = u_adj_size < v_adj_size ? v : u;
+int DataGraph::GetAdjSize(int v, int el, bool dir = true) {
+	GCARE_COUNT(get_adj);
+	int64_t begin, end;
+	int size = AdjBounds(v, el, dir, &begin, &end) ? end - begin : 0;
+	const DeltaList* d = Delta(v, el, dir);
+	if (d != nullptr)
+		size += (int)d->ins.size() - (int)d->del.size();
+	return size;
+}
 
-	int s = 0; 
-	int e = r.end - r.begin;
+bool DataGraph::HasEdge(int u, int v, int el, bool dir = true) {
+	GCARE_COUNT(has_edge);
+	const DeltaList* d = Delta(u, el, dir);
+	if (d != nullptr) {
+		if (std::binary_search(d->ins.begin(), d->ins.end(), v)) return true;
+		if (std::binary_search(d->del.begin(), d->del.end(), v)) return false;
+	}
+	return BaseHasEdge(u, v, el, dir);
+}
 
-	return search(r.begin, s, e, target) != -1;
+bool DataGraph::BaseHasEdge(int u, int v, int el, bool dir) {
+	//most misses end in the label's filter, at one cache line
+	if (edge_filter_index_ != nullptr && (unsigned)el < (unsigned)el_num_) {
+		const int64_t* f = edge_filter_index_ + 2 * el;
+		uint64_t h = EdgeFilter::Hash(dir ? u : v, dir ? v : u);
+		if (f[1] == 0 || !EdgeFilter::MayContain(
+				edge_filter_blocks_ + (f[0] + EdgeFilter::Block(h, f[1])) * EdgeFilter::WORDS, h)) {
+			GCARE_COUNT(edge_filter_misses);
+			return false;
+		}
+	}
+	//look both lists up once and probe the shorter one
+	int64_t ub, ue, vb, ve;
+	if (!AdjBounds(u, el, dir, &ub, &ue) || !AdjBounds(v, el, !dir, &vb, &ve))
+		return false;
+	bool from_u = ue - ub < ve - vb;
+	int64_t begin = from_u ? ub : vb;
+	int64_t end   = from_u ? ue : ve;
+	int target = from_u ? v : u;
+	bool d = from_u ? dir : !dir;
+
+	if (packed_)
+		return (d ? packed_adj_ : packed_in_adj_).Contains(begin, end, target);
+	if (ooc_)
+		return ooc_->Contains(d, begin, end, target);
+	const int* adj = d ? adj_ : in_adj_;
+	if (hub_degree_ > 0 && end - begin >= hub_degree_) {
+		auto& hubs = hubs_[d ? 0 : 1];
+		auto it = hubs.find(begin);
+		if (it != hubs.end())
+			return HubContains(it->second, adj + begin, end - begin, target);
+	}
+	return Contains(range{adj + begin, adj + end}, target);
 
 	/*if (e - s > BINARY_THRESHOLD) {
 	  int mid;
@@ -608,22 +2042,47 @@ bool DataGraph::HasEdge(int u, int v, int el, bool dir = true) {
 	  return false;*/
 }
 
-vector<int> DataGraph::GetRandomEdge(int el) {
+void DataGraph::LabelEdge(int el, int64_t r, int* t) {
+	if (!lean_) {
+		t[0] = el_rel_[r].first;
+		t[1] = el_rel_[r].second;
+		return;
+	}
+	//the last list of el starting at or before r
+	int64_t lo = el_pair_offset_[el], hi = el_pair_offset_[el+1];
+	while (hi - lo > 1) {
+		int64_t mid = lo + (hi - lo) / 2;
+		if (el_pair_cum_[mid] <= r)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	int v = el_pair_src_[lo];
+	int64_t begin, end;
+	AdjBounds(v, el, true, &begin, &end);
+	int64_t pos = begin + (r - el_pair_cum_[lo]);
+	t[0] = v;
+	t[1] = AdjAt(true, pos);
+}
+
+vector<int> DataGraph::GetRandomEdge(int el, Rng& rng) {
 	vector<int> ret;
+	if (!label_delta_.empty()) {
+		ret.resize(2);
+		if (!GetRandomEdge(el, rng, ret.data())) ret.clear();
+		return ret;
+	}
   //std::cout << "GetRandomEdge(" << el << ")\n";
-	int begin = el_rel_offset_[el]; 
-	int end   = el_rel_offset_[el+1]; 
+	int64_t begin = el_rel_offset_[el]; 
+	int64_t end   = el_rel_offset_[el+1]; 
 
 	if (begin == end)
 		return ret;
-	int r = rand();
-  //std::cout << "Random num: " << r << "\n";	
-  	r %= (end - begin);
+	int64_t r = rng.Uniform(end - begin);
   //std::cout << "Random E among " << (end - begin) << " -> " << r << "\n";
 	r += begin;
 	ret.resize(2);
-	ret[0] = el_rel_[r].first;
-	ret[1] = el_rel_[r].second;
+	LabelEdge(el, r, ret.data());
   //int r = (rand() % (end - begin)) + begin; 
 	//ret.push_back(el_rel_[r].first);
 	//ret.push_back(el_rel_[r].second);
@@ -632,32 +2091,33 @@ vector<int> DataGraph::GetRandomEdge(int el) {
 
 vector<int> DataGraph::GetEdge(int el, int i) { // XXX
     vector<int> ret;
-    int begin = el_rel_offset_[el]; 
-    int end   = el_rel_offset_[el+1]; 
+    if (!label_delta_.empty()) {
+        if (GetNumEdges(el) == 0)
+            return ret;
+        ret.resize(2);
+        GetEdge(el, (int64_t)i, ret.data());
+        return ret;
+    }
+    int64_t begin = el_rel_offset_[el]; 
+    int64_t end   = el_rel_offset_[el+1]; 
 
     if (begin == end)
         return ret;
     assert(i < end - begin);
-    int r = i + begin;
+    int64_t r = i + begin;
     ret.resize(2);
-    ret[0] = el_rel_[r].first;
-    ret[1] = el_rel_[r].second;
+    LabelEdge(el, r, ret.data());
     //ret.push_back(el_rel_[r].first);
     //ret.push_back(el_rel_[r].second);
     return ret;
 }
 
-vector<int> DataGraph::GetRandomEdge(int v, int el, bool dir) {
+vector<int> DataGraph::GetRandomEdge(int v, int el, bool dir, Rng& rng) {
     vector<int> ret;
   //std::cout << "GetRandomEdge(" << el << "," << dir << "," << v << ")\n";
-	range r = GetAdj(v, el, dir);
-	if (r.begin == r.end)
+	int other;
+	if (GetRandomAdj(v, el, dir, rng, &other) == 0)
 		return ret;
-	int rv = rand();
-  //std::cout << "Random num: " << rv << "\n";
- 	rv %= (r.end - r.begin);
-  //std::cout << "Random E among " << (r.end - r.begin) << " -> " << rv << "\n";
-	int other = r.begin[rv];
 	ret.resize(2);
 	ret[0] = dir ? v : other;
 	ret[1] = dir ? other : v;
@@ -667,37 +2127,338 @@ vector<int> DataGraph::GetRandomEdge(int v, int el, bool dir) {
 	return ret;
 }
 
-vector<int> DataGraph::GetRandomVertex(int vl) {
+int DataGraph::GetRandomAdj(int v, int el, bool dir, Rng& rng, int* other) {
+	GCARE_COUNT(get_adj);
+	if (Delta(v, el, dir) != nullptr) {
+		range r = GetAdj(v, el, dir);
+		if (r.begin == r.end)
+			return 0;
+		*other = r.begin[rng.Uniform(r.end - r.begin)];
+		return r.end - r.begin;
+	}
+	int64_t begin, end;
+	if (!AdjBounds(v, el, dir, &begin, &end) || begin == end)
+		return 0;
+	int64_t pos = begin + rng.Uniform(end - begin);
+	*other = AdjAt(dir, pos);
+	return end - begin;
+}
+
+int DataGraph::GetRandomAdj(int v, const vector<pair<int, bool>>& labels, Rng& rng, int* other, int64_t* size) {
+	GCARE_COUNT(get_adj);
+	//the lists of one vertex lie in label order in adj_ (in_adj_), so their
+	//bounds are its cumulative degrees; one lookup per label, then a
+	//binary search over the running sums
+	static thread_local vector<int64_t> begins, cum;
+	int n = labels.size();
+	begins.resize(n);
+	cum.resize(n + 1);
+	cum[0] = 0;
+	if (HasDelta()) {
+		//the lists as GetAdj merges them
+		for (int i = 0; i < n; i++)
+			cum[i + 1] = cum[i] + GetAdjSize(v, labels[i].first, labels[i].second);
+		*size = cum[n];
+		if (cum[n] == 0)
+			return -1;
+		int64_t r = rng.Uniform(cum[n]);
+		int i = upper_bound(cum.begin(), cum.begin() + n + 1, r) - cum.begin() - 1;
+		*other = GetAdj(v, labels[i].first, labels[i].second).begin[r - cum[i]];
+		return i;
+	}
+	for (int i = 0; i < n; i++) {
+		int64_t begin = 0, end = 0;
+		AdjBounds(v, labels[i].first, labels[i].second, &begin, &end);
+		begins[i] = begin;
+		cum[i + 1] = cum[i] + (end - begin);
+	}
+	*size = cum[n];
+	if (cum[n] == 0)
+		return -1;
+	int64_t r = rng.Uniform(cum[n]);
+	int i = upper_bound(cum.begin(), cum.begin() + n + 1, r) - cum.begin() - 1;
+	int64_t pos = begins[i] + (r - cum[i]);
+	bool dir = labels[i].second;
+	*other = AdjAt(dir, pos);
+	return i;
+}
+
+vector<int> DataGraph::GetRandomVertex(int vl, Rng& rng) {
 	vector<int> ret;
 
-	int begin = vl_rel_offset_[vl]; 
-	int end   = vl_rel_offset_[vl+1]; 
+	int64_t begin = vl_rel_offset_[vl]; 
+	int64_t end   = vl_rel_offset_[vl+1]; 
 
 	if (begin == end)
 		return ret;
-	int r = rand();
-  //std::cout << "Random num: " << r << "\n";
-	r %= (end - begin);
+	int64_t r = rng.Uniform(end - begin);
   //std::cout << "Random V among " << (end - begin) << " -> " << r << "\n";
 	r += begin; 
 	ret.push_back(vl_rel_[r]);
 	return ret;
 }
 
+bool DataGraph::GetRandomVertex(int vl, Rng& rng, int* t) {
+	int64_t begin = vl_rel_offset_[vl]; 
+	int64_t end   = vl_rel_offset_[vl+1]; 
+	if (begin == end)
+		return false;
+	t[0] = vl_rel_[begin + rng.Uniform(end - begin)];
+	return true;
+}
+
+//with updates, the i-th edge of el is the i-th base edge not deleted, or
+//an inserted one after those
+void DataGraph::GetEdge(int el, int64_t i, int* t) {
+	if (!label_delta_.empty()) {
+		const LabelDelta& d = label_delta_[el];
+		int64_t base = el_cnt_[el] - (int64_t)d.deleted.size();
+		if (i >= base) {
+			t[0] = d.inserted[i - base].first;
+			t[1] = d.inserted[i - base].second;
+			return;
+		}
+		//deleted[j] - j is non-decreasing: the base edges kept before it;
+		//the k deleted ones before i's position are those with it <= i
+		int64_t k = std::partition_point(d.deleted.begin(), d.deleted.end(),
+			[&](const int64_t& pos) { return pos - (&pos - d.deleted.data()) <= i; }) - d.deleted.begin();
+		i += k;
+	}
+	assert(i < el_rel_offset_[el+1] - el_rel_offset_[el]);
+	LabelEdge(el, el_rel_offset_[el] + i, t);
+}
+
+bool DataGraph::GetRandomEdge(int el, Rng& rng, int* t) {
+	if (!label_delta_.empty()) {
+		int64_t n = GetNumEdges(el);
+		if (n == 0)
+			return false;
+		GetEdge(el, rng.Uniform(n), t);
+		return true;
+	}
+	int64_t begin = el_rel_offset_[el]; 
+	int64_t end   = el_rel_offset_[el+1]; 
+	if (begin == end)
+		return false;
+	LabelEdge(el, begin + rng.Uniform(end - begin), t);
+	return true;
+}
+
+bool DataGraph::GetWalkGraph(WalkGraph* w) {
+	if (packed_ || ooc_ || wide_ || lean_ || num_updates_ > 0)
+		return false;
+	w->vnum = vnum_;
+	w->vl_num = vl_num_;
+	w->el_num = el_num_;
+	for (int d = 0; d < 2; d++) {
+		const Offsets& offset = d == 0 ? offset_ : in_offset_;
+		const Offsets& adj_o = d == 0 ? adj_offset_ : in_adj_offset_;
+		w->offset[d] = (const int*) offset.Address(0);
+		w->label[d] = d == 0 ? label_ : in_label_;
+		w->adj_offset[d] = (const int*) adj_o.Address(0);
+		w->adj[d] = d == 0 ? adj_ : in_adj_;
+		w->num_labels[d] = offset[vnum_] + 1;
+		w->num_adj[d] = adj_o[w->num_labels[d] - 1];
+	}
+	w->vl_offset = (const int*) vl_offset_.Address(0);
+	w->vl = vl_;
+	w->num_vl = vl_offset_[vnum_];
+	w->el_rel_offset = (const int*) el_rel_offset_.Address(0);
+	w->el_rel = (const int*) el_rel_;
+	w->num_el_rel = el_rel_offset_[el_num_];
+	w->vl_rel_offset = (const int*) vl_rel_offset_.Address(0);
+	w->vl_rel = vl_rel_;
+	w->num_vl_rel = vl_rel_offset_[vl_num_];
+	return true;
+}
+
 vector<int> DataGraph::GetVertex(int vl, int i) {
     vector<int> ret;
 
-    int begin = vl_rel_offset_[vl]; 
-    int end   = vl_rel_offset_[vl+1]; 
+    int64_t begin = vl_rel_offset_[vl]; 
+    int64_t end   = vl_rel_offset_[vl+1]; 
 
     if (begin == end)
         return ret;
     assert(i < end - begin);
-    int r = i + begin; 
+    int64_t r = i + begin; 
     ret.push_back(vl_rel_[r]);
     return ret;
 }
 
+bool DataGraph::InsertEdge(int src, int dst, int el) {
+	if (src < 0 || src >= vnum_ || dst < 0 || dst >= vnum_ || el < 0 || el >= el_num_
+			|| HasEdge(src, dst, el, true))
+		return false;
+	Update u = {src, dst, el, true};
+	ApplyUpdate(u);
+	delta_log_.push_back(u);
+	num_updates_++;
+	return true;
+}
+
+bool DataGraph::DeleteEdge(int src, int dst, int el) {
+	if (src < 0 || src >= vnum_ || dst < 0 || dst >= vnum_ || el < 0 || el >= el_num_
+			|| !HasEdge(src, dst, el, true))
+		return false;
+	Update u = {src, dst, el, false};
+	ApplyUpdate(u);
+	delta_log_.push_back(u);
+	num_updates_++;
+	return true;
+}
+
+//an insertion of a deleted base edge, or a deletion of an inserted one,
+//takes back the earlier update; the others add to the lists
+void DataGraph::ApplyUpdate(const Update& u) {
+	bool base = BaseHasEdge(u.src, u.dst, u.el, true);
+	bool add = u.insert != base;
+	for (int d = 0; d < 2; d++) {
+		int v = d == 0 ? u.src : u.dst;
+		int other = d == 0 ? u.dst : u.src;
+		auto it = delta_[d].emplace(DeltaKey(v, u.el), DeltaList()).first;
+		vector<int>& list = base ? it->second.del : it->second.ins;
+		auto pos = lower_bound(list.begin(), list.end(), other);
+		if (add)
+			list.insert(pos, other);
+		else
+			list.erase(pos);
+		if (it->second.ins.empty() && it->second.del.empty())
+			delta_[d].erase(it);
+	}
+
+	if (label_delta_.empty())
+		label_delta_.resize(el_num_);
+	LabelDelta& ld = label_delta_[u.el];
+	if (base) {
+		int64_t p = BaseEdgePosition(u.el, u.src, u.dst);
+		auto pos = lower_bound(ld.deleted.begin(), ld.deleted.end(), p);
+		if (add)
+			ld.deleted.insert(pos, p);
+		else
+			ld.deleted.erase(pos);
+	} else if (add) {
+		ld.inserted.emplace_back(u.src, u.dst);
+	} else {
+		auto pos = find(ld.inserted.begin(), ld.inserted.end(), make_pair(u.src, u.dst));
+		*pos = ld.inserted.back();
+		ld.inserted.pop_back();
+	}
+	delta_edges_ += u.insert ? 1 : -1;
+}
+
+//the position of the base edge (src, dst) among the edges of el (see
+//LabelEdge)
+int64_t DataGraph::BaseEdgePosition(int el, int src, int dst) {
+	int64_t first = el_rel_offset_[el];
+	if (!lean_) {
+		const pair<int, int>* begin = el_rel_ + first;
+		const pair<int, int>* end = el_rel_ + el_rel_offset_[el+1];
+		return lower_bound(begin, end, make_pair(src, dst)) - begin;
+	}
+	int64_t lo = el_pair_offset_[el], hi = el_pair_offset_[el+1];
+	while (hi - lo > 1) {
+		int64_t mid = lo + (hi - lo) / 2;
+		if (el_pair_src_[mid] <= src)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	range adj = BaseAdj(src, el, true);
+	return el_pair_cum_[lo] - first + (lower_bound(adj.begin, adj.end, dst) - adj.begin);
+}
+
+bool DataGraph::StartCompaction(const char* prefix) {
+	if (compaction_.joinable())
+		return false;
+	compaction_prefix_ = prefix;
+	compaction_end_ = delta_log_.size();
+	compaction_done_ = false;
+	string tmp = compaction_prefix_ + ".compact";
+	compaction_ = std::thread([this, tmp, snapshot = delta_[0]]() {
+		WriteCompacted(tmp.c_str(), snapshot);
+		compaction_done_ = true;
+	});
+	return true;
+}
+
+//the compaction thread: the base with the out-lists of out merged in,
+//written as a binary of the same layout; reads nothing the updates change
+void DataGraph::WriteCompacted(const char* prefix, const DeltaMap& out) {
+	vector<vector<int>> vlabels(vnum_);
+	vector<Edge> edges;
+	edges.reserve(enum_);
+	for (int v = 0; v < vnum_; v++) {
+		range r = GetVLabels(v);
+		vlabels[v].assign(r.begin, r.end);
+		r = GetELabels(v, true);
+		for (const int* l = r.begin; l != r.end; l++) {
+			if (*l < 0) continue;
+			range adj = BaseAdj(v, *l, true);
+			auto it = out.find(DeltaKey(v, *l));
+			if (it == out.end()) {
+				for (const int* w = adj.begin; w != adj.end; w++)
+					edges.emplace_back(v, *w, *l);
+				continue;
+			}
+			const DeltaList& d = it->second;
+			for (const int* w = adj.begin; w != adj.end; w++)
+				if (!std::binary_search(d.del.begin(), d.del.end(), *w))
+					edges.emplace_back(v, *w, *l);
+			for (int w : d.ins)
+				edges.emplace_back(v, w, *l);
+		}
+	}
+	//lists the base does not have
+	for (auto& it : out) {
+		int v = it.first >> 32, el = (int)(uint32_t)it.first;
+		if (GetELabelIndex(v, el, true) < 0)
+			for (int w : it.second.ins)
+				edges.emplace_back(v, w, el);
+	}
+
+	DataGraph g;
+	g.SetPackedAdj(packed_);
+	g.SetLeanEdges(lean_);
+	g.SetVLabelBitmap(vl_bitmap_buffer_ != nullptr);
+	g.SetEdgeFilter(edge_filter_buffer_ != nullptr);
+	g.SetRawData(vlabels, edges);
+	//labels left without vertices or edges keep their ids
+	g.raw_.max_vl_ = std::max(g.raw_.max_vl_, vl_num_ - 1);
+	g.raw_.max_el_ = std::max(g.raw_.max_el_, el_num_ - 1);
+	g.raw_.vl_cnt_.assign(g.raw_.max_vl_ + 1, 0);
+	g.raw_.el_cnt_.assign(g.raw_.max_el_ + 1, 0);
+	g.raw_.vl_rel_.assign(g.raw_.max_vl_ + 1, vector<int>());
+	g.raw_.el_rel_.assign(g.raw_.max_el_ + 1, vector<pair<int, int>>());
+	g.MakeBinary();
+	g.raw_.perm_ = vertex_map_;
+	g.project_vl_ = project_vl_;
+	g.project_el_ = project_el_;
+	g.WriteBinary(prefix);
+}
+
+void DataGraph::FinishCompaction() {
+	if (!compaction_.joinable())
+		return;
+	compaction_.join();
+	string from = compaction_prefix_ + ".compact.graph";
+	string to = compaction_prefix_ + ".graph";
+	for (const char* ext : {"", ".meta", ".perm", ".labels", ".vlbits", ".edgefilter", ".labelstats"}) {
+		if (std::filesystem::exists(from + ext))
+			std::filesystem::rename(from + ext, to + ext);
+		else
+			std::filesystem::remove(to + ext);
+	}
+	vector<Update> tail(delta_log_.begin() + compaction_end_, delta_log_.end());
+	ReadBinary(compaction_prefix_.c_str(), load_mode_);
+	MakeReplicas();
+	for (const Update& u : tail) {
+		ApplyUpdate(u);
+		delta_log_.push_back(u);
+	}
+	compaction_done_ = false;
+}
+
 /*range DataGraph::GetRel(int el, bool dir = true) {
   const int* offset = dir ? rel_offset_ : in_rel_offset_;
   const int* re     = dir ? rel_        : in_rel_;
@@ -729,3 +2490,5 @@ vector<int> DataGraph::GetVertex(int vl, int i) {
   range r = GetUni(vl);
   return r.end - r.begin;
   }*/
+
+}  // namespace graph
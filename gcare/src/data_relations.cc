@@ -5,48 +5,50 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <cinttypes>
 #include <ctime>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
-#include <map>
 #include <iostream>
-#include <boost/functional/hash.hpp>
+#include <omp.h>
 
 using std::vector;
 using std::string;
 using std::pair;
 using std::make_pair;
 
-off_t StrLen(char* str) {
-	off_t len = 0;
-	while (*(str + len) != '\n' && *(str + len) != ' ')
-		len++;
-	return len;
-}
-
-int StrToInt(char* str) {
-	size_t i = 0;
-	int res = 0;
-  bool flag = false;
-  if (*str == '-') {
-    flag = true;
-    i++;
-  }
-	while (*(str + i) != '\n' && *(str + i) != ' ') {
-		res *= 10;
-		res += static_cast<int>(*(str + i) - '0');
-		i++;
-	}
-  if (flag) res *= -1;
-	return res;
-}
+namespace relational {
 
 DataGraph::DataGraph(void) {
 	g_.clear();
-	table_cnt_ = idx_cnt_ = 0;
     vnum_ = base_ = 0;
+    container_ = nullptr;
+    container_size_ = 0;
+    load_mode_ = LOAD_COPY;
+    index_container_ = map_container_ = nullptr;
+    index_size_ = map_size_ = 0;
+    index_mode_ = LOAD_MMAP;
+    in_memory_ = false;
+    columns_container_ = nullptr;
+    columns_size_ = 0;
+    use_hash_index_ = false;
+    packed_container_ = packed_index_container_ = nullptr;
+    packed_size_ = packed_index_size_ = 0;
+    use_packed_ = false;
+    hash_shift_ = 64;
+    owner_ = true;
+}
+
+DataGraph::~DataGraph(void) {
+    if (!owner_) return;
+    UnloadFile(reinterpret_cast<char*>(container_), container_size_, load_mode_);
+    UnloadFile(reinterpret_cast<char*>(index_container_), index_size_, index_mode_);
+    UnloadFile(reinterpret_cast<char*>(map_container_), map_size_, index_mode_);
+    UnloadFile(reinterpret_cast<char*>(columns_container_), columns_size_, LOAD_MMAP);
+    UnloadFile(reinterpret_cast<char*>(packed_container_), packed_size_, load_mode_);
+    UnloadFile(reinterpret_cast<char*>(packed_index_container_), packed_index_size_, LOAD_MMAP);
 }
 
 int DataGraph::Mapping(int v, int t, int c) {
@@ -57,441 +59,801 @@ int DataGraph::Mapping(int v, int t, int c) {
     return -1;
 }
 
-template <typename T>
-struct ContainerHash {
-	size_t operator()(T const& c) const {
-		return boost::hash_range(c.begin(), c.end());
-	}
+bool DataGraph::Lookup(int t, int c, int v, const int*& begin, const int*& end, vector<int>* rows) {
+    begin = end = nullptr;
+    if (packed_index_container_ != nullptr) {
+        if (rows == nullptr || t < 0 || t >= static_cast<int>(packed_index_.size())) return false;
+        auto columns = packed_index_[t];
+        if (c >= static_cast<int>(columns.size())) return false;
+        int o = v >= 0 && v < static_cast<int>(map_.size()) ? Mapping(v, t, c) : -1;
+        if (o >= 0) {
+            // the column's run is its value offsets, then its rows
+            PackedColumn offsets(columns[c].begin());
+            PackedColumn ids(columns[c].begin() + offsets.ints());
+            size_t b = offsets[o], e = offsets[o + 1];
+            rows->resize(e - b);
+            ids.Decode(b, e, rows->data());
+            begin = rows->data();
+            end = begin + rows->size();
+        }
+        return true;
+    }
+    if (!hash_index_.empty()) {
+        if (t < 0 || t >= static_cast<int>(hash_columns_.size()) || c >= hash_columns_[t]) return false;
+        uint64_t key = HashKey(t, c, v);
+        size_t mask = hash_index_.size() - 1;
+        for (size_t i = (key * 0x9E3779B97F4A7C15ull) >> hash_shift_;; i = (i + 1) & mask) {
+            const HashSlot& slot = hash_index_[i];
+            if (slot.key == key) {
+                begin = index_container_ + slot.begin;
+                end = begin + slot.size;
+                return true;
+            }
+            if (slot.key == EMPTY_SLOT) return true;
+        }
+    }
+    if (t < 0 || t >= static_cast<int>(index_.size())) return false;
+    auto columns = index_[t];
+    if (c >= static_cast<int>(columns.size())) return false;
+    if (v >= 0 && v < static_cast<int>(map_.size())) {
+        int o = Mapping(v, t, c);
+        if (o >= 0) {
+            auto rows = columns[c][o];
+            begin = rows.begin();
+            end = rows.end();
+        }
+    }
+    return true;
+}
+
+// One slot per map triple at a load factor of at most 1/2, filled by a pass
+// over map_ in value order; linear probing keeps a miss within a few slots.
+void DataGraph::BuildHashIndex() {
+    hash_index_.clear();
+    hash_index_.shrink_to_fit();
+    hash_columns_.clear();
+    hash_shift_ = 64;
+    if (!use_hash_index_ || !HasIndex() || index_container_ == nullptr) return;
+    if (index_size_ / sizeof(int) > UINT32_MAX) {
+        fprintf(stderr, "index too large for the hash index, not built\n");
+        return;
+    }
+    size_t num_slots = 0;
+    for (size_t v = 0; v < map_.size(); v++) num_slots += map_[v].size() / 3;
+    size_t capacity = 16;
+    int bits = 4;
+    while (capacity < 2 * num_slots) capacity <<= 1, bits++;
+    hash_index_.assign(capacity, HashSlot{EMPTY_SLOT, 0, 0});
+    hash_shift_ = 64 - bits;
+    hash_columns_.resize(index_.size());
+    for (size_t t = 0; t < index_.size(); t++) hash_columns_[t] = index_[t].size();
+    size_t mask = capacity - 1;
+    for (size_t v = 0; v < map_.size(); v++) {
+        auto triples = map_[v];
+        for (size_t j = 0; j < triples.size(); j += 3) {
+            int t = triples[j], c = triples[j + 1];
+            auto rows = index_[t][c][triples[j + 2]];
+            uint64_t key = HashKey(t, c, v);
+            size_t i = (key * 0x9E3779B97F4A7C15ull) >> hash_shift_;
+            while (hash_index_[i].key != EMPTY_SLOT) i = (i + 1) & mask;
+            hash_index_[i] = HashSlot{key, static_cast<uint32_t>(rows.begin() - index_container_), static_cast<uint32_t>(rows.size())};
+        }
+    }
+}
+
+// Text-to-binary conversion. The text is parsed in parallel chunks over a
+// mapping into flat (src, dst, label) and (vid, label) lists, which a
+// counting sort on the label turns into the tables; each column index is
+// built by sorting (value, row) pairs. The files are then written front to
+// back, offsets coming from prefix sums over the sizes.
+namespace {
+
+struct TextChunk {
+	const char* begin;
+	const char* end;
 };
 
-void DataGraph::ReadText(const char* filename) {
-    // std::cout << "DataGraph::ReadText " << filename << "\n";
-	int fd = open(filename, O_RDONLY, (mode_t)0600);
-	struct stat fileinfo;
-	if (fstat(fd, &fileinfo) == -1) {
-		perror("fstat error");
-		close(fd);
-		exit(0);
-	}
-	char* map = static_cast<char*>(mmap(0, fileinfo.st_size, PROT_READ, MAP_SHARED, fd, 0));
-	if (map == MAP_FAILED) {
-		perror("mmap error");
-		close(fd);
-		exit(0);
-	}
-	off_t base = 0;
-	size_t gnum = 0;
-	unordered_map<vector<int>, int, ContainerHash<vector<int>>> h1, h2; // (t, c, v) -> #
-	unordered_map<vector<int>, int, ContainerHash<vector<int>>> cnt1, cnt2;
-	while (base < fileinfo.st_size) {
-		if (map[base] == '\n') {
-			base++;
-			continue;
-		}
-		off_t linelen;
-		for (linelen = 0; map[base + linelen] != '\n' && base + linelen < fileinfo.st_size; linelen++) { }
-		if (map[base] == 't') {
-			g_.push_back(CvtDataGraph());
-			gnum = g_.size();
-			g_[gnum - 1].max_vid = g_[gnum - 1].max_vlabel = g_[gnum - 1].max_elabel = g_[gnum - 1].base = g_[gnum - 1].vnum = 0;
-			h1.clear();
-			h2.clear();
-			cnt1.clear();
-			cnt2.clear();
-		} else if (map[base] == 'v') {
-			assert(gnum > 0);
-			g_[gnum - 1].vnum++;
-			int vid = StrToInt(map + base + 2);
-			g_[gnum - 1].max_vid = std::max(g_[gnum - 1].max_vid, vid);
-			for (off_t offset = 3 + StrLen(map + base + 2); offset < linelen && base + offset < fileinfo.st_size;
-					offset += StrLen(map + base + offset) + 1) {
-				int vlabel = StrToInt(map + base + offset);
-				g_[gnum - 1].max_vlabel = std::max(g_[gnum - 1].max_vlabel, vlabel);
-
-				if (vlabel == -1)
-					continue;
-
-				if (static_cast<int>(g_[gnum - 1].vlabel.size()) <= vlabel)
-					g_[gnum - 1].vlabel.resize(vlabel + 1);
-				g_[gnum - 1].vlabel[vlabel].push_back(vector<int>{ vid });
-				table_cnt_++;
-
-				if (static_cast<int>(g_[gnum - 1].vidx.size()) <= vlabel)
-					g_[gnum - 1].vidx.resize(vlabel + 1);
-				if (static_cast<int>(g_[gnum - 1].vidx[vlabel].size()) < 1)
-					g_[gnum - 1].vidx[vlabel].resize(1);
-				g_[gnum - 1].vidx[vlabel][0][vid].push_back(g_[gnum - 1].vlabel[vlabel].size() - 1);
-				idx_cnt_++;
-
-				if (static_cast<int>(g_[gnum - 1].vmap.size()) <= vid)
-					g_[gnum - 1].vmap.resize(vid + 1);
-			}
-		} else {
-			assert(gnum > 0);
-			int srcid = StrToInt(map + base + 2);
-			int offset = 2;
-			offset += StrLen(map + base + offset) + 1;
-			int dstid = StrToInt(map + base + offset);
-			offset += StrLen(map + base + offset) + 1;
-			int elabel = StrToInt(map + base + offset);
-			g_[gnum - 1].max_elabel = std::max(g_[gnum - 1].max_elabel, elabel);
-
-			if (static_cast<int>(g_[gnum - 1].edge_table.size()) <= elabel)
-				g_[gnum - 1].edge_table.resize(elabel + 1);
-			g_[gnum - 1].edge_table[elabel].push_back(vector<int>{ srcid, dstid });
-			table_cnt_ += 2;
-
-			if (static_cast<int>(g_[gnum - 1].eidx.size()) <= elabel)
-				g_[gnum - 1].eidx.resize(elabel + 1);
-			if (static_cast<int>(g_[gnum - 1].eidx[elabel].size()) < 2)
-				g_[gnum - 1].eidx[elabel].resize(2);
-			g_[gnum - 1].eidx[elabel][0][srcid].push_back(g_[gnum - 1].edge_table[elabel].size() - 1);
-			g_[gnum - 1].eidx[elabel][1][dstid].push_back(g_[gnum - 1].edge_table[elabel].size() - 1);
-			idx_cnt_ += 2;
-
-			if (static_cast<int>(g_[gnum - 1].emap.size()) <= std::max(srcid, dstid))
-				g_[gnum - 1].emap.resize(std::max(srcid, dstid) + 1);
-		}
-		base += linelen + 1;
+// splits [begin, end) into n pieces that start at line boundaries
+vector<TextChunk> SplitLines(const char* begin, const char* end, int n) {
+	vector<TextChunk> ret;
+	size_t step = (end - begin) / n + 1;
+	const char* b = begin;
+	while (b < end) {
+		const char* e = (size_t)(end - b) > step ? b + step : end;
+		while (e < end && *(e - 1) != '\n') e++;
+		ret.push_back({b, e});
+		b = e;
+	}
+	return ret;
+}
+
+// the lines of a chunk up to the next 't' line (or all of them, for the
+// part before a chunk's first 't' line, which continues the previous graph)
+struct TextPart {
+	vector<int> edges;   // src, dst, label
+	vector<int> vlabels; // vid, label
+	int vnum = 0;
+	int max_vid = 0, max_vlabel = 0, max_elabel = 0;
+	size_t num_values = 0;
+};
+
+// parses the integers of the line [p, eol) after its first token
+void ParseInts(const char* p, const char* eol, vector<long>& ints) {
+	ints.clear();
+	while (p < eol && *p != ' ' && *p != '\t') p++;
+	while (p < eol) {
+		while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+		if (p == eol) break;
+		bool neg = *p == '-';
+		if (neg || *p == '+') p++;
+		long val = 0;
+		while (p < eol && *p >= '0' && *p <= '9') val = val * 10 + (*p++ - '0');
+		ints.push_back(neg ? -val : val);
+		while (p < eol && *p != ' ' && *p != '\t') p++;
 	}
+}
 
-	map_cnt_ += g_.size();
-	for (size_t i = 0; i < g_.size(); i++) {
-		g_[i].base = g_[i].edge_table.size();
-		map_cnt_ += g_[i].emap.size() + g_[i].vmap.size();
-		h1.clear();
-		h2.clear();
-		for (size_t j = 0; j < g_[i].eidx.size(); j++) {
-			g_[i].eidx_max_key.push_back(vector<int>(g_[i].eidx[j].size(), 0));
-			int t = j;
-			for (size_t k = 0; k < g_[i].eidx[j].size(); k++) {
-				g_[i].eidx_max_key[j][k] = 0;
-				int c = k;
-				int cnt = 0;
-				for (auto& it : g_[i].eidx[j][k]) {
-					int v = it.first;
-					vector<int> key{t, c, v};
-					if (h1[key] == 0) {
-						h1[key] = ++cnt;
-						g_[i].emap[v].push_back(t);
-						g_[i].emap[v].push_back(c);
-						g_[i].emap[v].push_back(h1[key] - 1);
-						map_cnt_ += 3;
-					}
-					g_[i].eidx_max_key[j][k] = std::max(g_[i].eidx_max_key[j][k], it.first);
-				}
-			}
-		}
-		for (size_t j = 0; j < g_[i].vidx.size(); j++) {
-			g_[i].vidx_max_key.push_back(vector<int>(g_[i].vidx[j].size(), 0));
-			int t = j + g_[i].base;
-			for (size_t k = 0; k < g_[i].vidx[j].size(); k++) {
-				g_[i].vidx_max_key[j][k] = 0;
-				int c = k;
-				int cnt = 0;
-				for (auto& it : g_[i].vidx[j][k]) {
-					int v = it.first;
-					vector<int> key{t, c, v};
-					if (h2[key] == 0) {
-						h2[key] = ++cnt;
-						g_[i].vmap[v].push_back(t);
-						g_[i].vmap[v].push_back(c);
-						g_[i].vmap[v].push_back(h2[key] - 1);
-						map_cnt_ += 3;
-					}
-					g_[i].vidx_max_key[j][k] = std::max(g_[i].vidx_max_key[j][k], it.first);
+void ParseChunk(const TextChunk& chunk, vector<TextPart>& parts) {
+	parts.assign(1, TextPart());
+	vector<long> ints;
+	const char* p = chunk.begin;
+	while (p < chunk.end) {
+		const char* eol = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+		if (eol == nullptr) eol = chunk.end;
+		char type = *p;
+		if (type == 't') {
+			parts.emplace_back();
+		} else if (type == 'v' || type == 'e') {
+			TextPart& part = parts.back();
+			ParseInts(p, eol, ints);
+			if (type == 'v' && ints.size() >= 1) {
+				int vid = ints[0];
+				part.vnum++;
+				part.max_vid = std::max(part.max_vid, vid);
+				for (size_t i = 1; i < ints.size(); i++) {
+					int vlabel = ints[i];
+					part.max_vlabel = std::max(part.max_vlabel, vlabel);
+					if (vlabel == -1) continue;
+					part.vlabels.push_back(vid);
+					part.vlabels.push_back(vlabel);
+					part.num_values = std::max(part.num_values, (size_t)vid + 1);
 				}
+			} else if (type == 'e' && ints.size() >= 3) {
+				int src = ints[0], dst = ints[1], elabel = ints[2];
+				part.max_elabel = std::max(part.max_elabel, elabel);
+				part.edges.push_back(src);
+				part.edges.push_back(dst);
+				part.edges.push_back(elabel);
+				part.num_values = std::max(part.num_values, (size_t)std::max(src, dst) + 1);
 			}
 		}
-	}
-	close(fd);
-	if (munmap(map, fileinfo.st_size) == -1) {
-		perror("error un-mapping the file");
-		exit(0);
+		p = eol + 1;
 	}
 }
 
-void DataGraph::Make1DTable(const char* dataname) {
-    // std::cout << "DataGraph::Make1DTable to " << dataname << "\n";
-	FILE* fp = fopen(dataname, "w");
-	uint64_t rem = table_cnt_ * 2 + 10;
-	uint64_t unit = 1024;
-	while (rem > 0) {
-		vector<int> tmp(std::min(rem, unit), 0);
-		rem -= fwrite(tmp.data(), sizeof(int), tmp.size(), fp);
-	}
-	fclose(fp);
-
-	int fd_table = open(dataname, O_RDWR | O_CREAT, (mode_t)0600);
-	struct stat fileinfo_table;
-	if (fstat(fd_table, &fileinfo_table) == -1) {
-		perror("fstat error");
-		close(fd_table);
-		exit(0);
-	}
-	int* ptr_table = static_cast<int*>(mmap(0, fileinfo_table.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_table, 0));
-	if (ptr_table == MAP_FAILED) {
-		close(fd_table);
-		perror("Error mapping the file");
-		exit(0);
-	}
-
-	off_t end = g_.size() + 1;
-	off_t size = end - 1;
-	for (size_t i = 0; i < g_.size(); i++) { // t
-		ptr_table[i] = end - i;
-		end += g_[i].edge_table.size() + g_[i].vlabel.size();
-	}
-	ptr_table[size] = end - size;
-	end++;
-	off_t pos = size + 1;
-	size = end - 1;
-	for (size_t i = 0; i < g_.size(); i++) { // r
-		for (size_t j = 0; j < g_[i].edge_table.size(); j++) {
-			assert(pos < fileinfo_table.st_size);
-			ptr_table[pos] = end - pos;
-			pos++;
-			end += g_[i].edge_table[j].size();
-		}
-		for (size_t j = 0; j < g_[i].vlabel.size(); j++) {
-			assert(pos < fileinfo_table.st_size);
-			ptr_table[pos] = end - pos;
-			pos++;
-			end += g_[i].vlabel[j].size();
+// stable counting sort of the width-int records of parts on their last
+// int (the label), dropping it: rows[offset[l], offset[l + 1]) for label l
+void GroupByLabel(const vector<const vector<int>*>& parts, int width,
+		vector<size_t>& offset, vector<int>& rows) {
+	int num_labels = 0;
+	for (auto* part : parts)
+		for (size_t i = width - 1; i < part->size(); i += width)
+			num_labels = std::max(num_labels, (*part)[i] + 1);
+	offset.assign(num_labels + 1, 0);
+	for (auto* part : parts)
+		for (size_t i = width - 1; i < part->size(); i += width)
+			offset[(*part)[i] + 1]++;
+	for (int l = 0; l < num_labels; l++) offset[l + 1] += offset[l];
+	vector<size_t> fill(offset.begin(), offset.end() - 1);
+	rows.resize(offset[num_labels] * (width - 1));
+	for (auto* part : parts) {
+		for (size_t i = 0; i < part->size(); i += width) {
+			int* out = rows.data() + fill[(*part)[i + width - 1]]++ * (width - 1);
+			std::copy(part->begin() + i, part->begin() + i + width - 1, out);
 		}
 	}
-	ptr_table[size] = end - size;
-	end++;
-	pos = size + 1;
-	size = end - 1;
-	for (size_t i = 0; i < g_.size(); i++) {
-		for (size_t j = 0; j < g_[i].edge_table.size(); j++) {
-			for (size_t k = 0; k < g_[i].edge_table[j].size(); k++) {
-				ptr_table[pos] = end - pos;
-				pos++;
-				for (size_t l = 0; l < g_[i].edge_table[j][k].size(); l++)
-					ptr_table[end++] = g_[i].edge_table[j][k][l];
+}
+
+// Buffered, strictly sequential output of a file of size ints, which is
+// preallocated up front. With GCARE_DIRECT_IO=1 the file is opened with
+// O_DIRECT (where the file system allows it), bypassing the page cache: the
+// buffer is block aligned and the tail is padded to a block, then cut off.
+// Given mem, the ints go to a buffer malloc'd into *mem instead, fn only
+// naming it.
+class IntWriter {
+ public:
+	IntWriter(const string& fn, uint64_t size, int** mem = nullptr)
+		: fn_(fn), direct_(false), size_(size), pos_(0), mem_(nullptr), len_(0) {
+		fd_ = -1;
+		if (mem != nullptr) {
+			mem_ = *mem = static_cast<int*>(malloc(std::max<uint64_t>(size_, 1) * sizeof(int)));
+			if (mem_ == nullptr) Fail();
+		} else {
+			const char* direct = getenv("GCARE_DIRECT_IO");
+			direct_ = direct && strcmp(direct, "1") == 0;
+#ifdef O_DIRECT
+			if (direct_) fd_ = open(fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#endif
+			if (fd_ == -1) {
+				direct_ = false;
+				fd_ = open(fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
 			}
+			if (fd_ == -1) Fail();
+			if (size_ > 0) posix_fallocate(fd_, 0, size_ * sizeof(int)); // best effort
 		}
-		for (size_t j = 0; j < g_[i].vlabel.size(); j++) {
-			for (size_t k = 0; k < g_[i].vlabel[j].size(); k++) {
-				ptr_table[pos] = end - pos;
-				pos++;
-				for (size_t l = 0; l < g_[i].vlabel[j][k].size(); l++)
-					ptr_table[end++] = g_[i].vlabel[j][k][l];
+		buf_ = static_cast<int*>(aligned_alloc(BLOCK, BUF_INTS * sizeof(int)));
+		if (buf_ == nullptr) Fail();
+	}
+	~IntWriter() {
+		if (len_ > 0) {
+			size_t bytes = len_ * sizeof(int);
+			if (direct_) {
+				size_t padded = (bytes + BLOCK - 1) / BLOCK * BLOCK;
+				memset(reinterpret_cast<char*>(buf_) + bytes, 0, padded - bytes);
+				bytes = padded;
 			}
+			WriteAll(bytes);
+			pos_ += len_;
+			len_ = 0;
+		}
+		assert(pos_ == size_);
+		if (mem_ == nullptr && (ftruncate(fd_, pos_ * sizeof(int)) != 0 || close(fd_) != 0)) Fail();
+		free(buf_);
+	}
+	inline void Put(int64_t x) {
+		buf_[len_++] = static_cast<int>(x);
+		if (len_ == BUF_INTS) Flush();
+	}
+	void Put(const int* p, size_t n) {
+		while (n > 0) {
+			size_t k = std::min(n, BUF_INTS - len_);
+			memcpy(buf_ + len_, p, k * sizeof(int));
+			len_ += k;
+			p += k;
+			n -= k;
+			if (len_ == BUF_INTS) Flush();
 		}
 	}
-	ptr_table[size] = end - size;
-	if (msync(ptr_table, fileinfo_table.st_size, MS_SYNC)) {
-		perror("fail to sync the file to disk");
-		exit(0);
+	// # ints written so far
+	uint64_t Pos() const { return pos_ + len_; }
+
+ private:
+	static const size_t BLOCK = 4096;
+	static const size_t BUF_INTS = 1 << 20; // 4MB, a multiple of BLOCK
+	void Flush() {
+		WriteAll(len_ * sizeof(int));
+		pos_ += len_;
+		len_ = 0;
+	}
+	void WriteAll(size_t bytes) {
+		if (mem_ != nullptr) {
+			memcpy(mem_ + pos_, buf_, bytes);
+			return;
+		}
+		const char* p = reinterpret_cast<const char*>(buf_);
+		while (bytes > 0) {
+			ssize_t n = write(fd_, p, bytes);
+			if (n <= 0) Fail();
+			p += n;
+			bytes -= n;
+		}
 	}
-	close(fd_table);
-	if (munmap(ptr_table, fileinfo_table.st_size) == -1) {
-		perror("error un-mapping the file");
-		exit(0);
+	void Fail() {
+		perror(fn_.c_str());
+		exit(EXIT_FAILURE);
+	}
+	string fn_;
+	int fd_;
+	bool direct_;
+	uint64_t size_, pos_;
+	int* mem_;
+	int* buf_;
+	size_t len_;
+};
+
+// Writes a level of n lists: entry i is the offset from itself to list i,
+// and the lists are laid out right after the level (and its end entry, if
+// end_entry) in order. Add() gives the list sizes in order.
+class LevelWriter {
+ public:
+	LevelWriter(IntWriter& w, size_t n, bool end_entry)
+		: w_(w), n_(n), i_(0), end_entry_(end_entry) {
+		start_ = w.Pos();
+		child_ = start_ + n + end_entry;
+	}
+	inline void Add(size_t size) {
+		w_.Put(child_ - (start_ + i_++));
+		child_ += size;
+	}
+	void Finish() {
+		assert(i_ == n_);
+		if (end_entry_) w_.Put(child_ - (start_ + n_));
 	}
-    // std::cout << "~DataGraph::Make1DTable to " << dataname << "\n";
-}
 
-void DataGraph::Make1DIndex(char* dataname) {
-    // std::cout << "DataGraph::Make1DIndex to " << dataname << "\n";
-	string fn = static_cast<string>(dataname) + ".index";
+ private:
+	IntWriter& w_;
+	size_t n_, i_;
+	bool end_entry_;
+	uint64_t start_, child_;
+};
 
-	FILE* fp = fopen(fn.c_str(), "w");
-	uint64_t rem = idx_cnt_ * 2 + 1;
-	uint64_t unit = 1024;
-	while (rem > 0) {
-		vector<int> tmp(std::min(rem, unit), 0);
-		rem -= fwrite(tmp.data(), sizeof(int), tmp.size(), fp);
-	}
-	fclose(fp);
+}
 
-	int fd_idx = open(fn.c_str(), O_RDWR | O_CREAT, (mode_t)0600);
-	struct stat fileinfo_idx;
-	if (fstat(fd_idx, &fileinfo_idx) == -1) {
-		perror("fstat error");
-		close(fd_idx);
-		exit(0);
-	}
-	int* ptr_idx = static_cast<int*>(mmap(0, fileinfo_idx.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_idx, 0));
-	if (ptr_idx == MAP_FAILED) {
-		close(fd_idx);
-		perror("Error mapping the file");
-		exit(0);
-	}
-
-	off_t end = g_.size();
-	for (size_t i = 0; i < g_.size(); i++) { // t
-		ptr_idx[i] = end - i;
-		end += g_[i].eidx.size() + g_[i].vidx.size();
-	}
-	off_t size = end;
-	off_t pos = g_.size();
-	for (size_t i = 0; i < g_.size(); i++) { // c
-		for (size_t j = 0; j < g_[i].eidx.size(); j++) {
-			assert(pos < fileinfo_idx.st_size);
-			ptr_idx[pos] = end - pos;
-			pos++;
-			end += g_[i].eidx[j].size();
-		}
-		for (size_t j = 0; j < g_[i].vidx.size(); j++) {
-			assert(pos < fileinfo_idx.st_size);
-			ptr_idx[pos] = end - pos;
-			pos++;
-			end += g_[i].vidx[j].size();
+void DataGraph::ReadText(const char* filename) {
+	size_t text_size = 0;
+	char* text = LoadFile(filename, text_size, LOAD_MMAP);
+	if (text == nullptr) {
+		fprintf(stderr, "cannot read %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	vector<TextChunk> chunks = SplitLines(text, text + text_size, 4 * omp_get_max_threads());
+	int num_chunks = chunks.size();
+	vector<vector<TextPart>> parts(num_chunks);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int c = 0; c < num_chunks; c++)
+		ParseChunk(chunks[c], parts[c]);
+	UnloadFile(text, text_size, LOAD_MMAP);
+
+	// the first part of each chunk continues the graph of the one before
+	vector<vector<TextPart*>> graphs;
+	for (int c = 0; c < num_chunks; c++) {
+		for (size_t i = 0; i < parts[c].size(); i++) {
+			if (i > 0) graphs.emplace_back();
+			if (parts[c][i].vnum == 0 && parts[c][i].edges.empty()) continue;
+			assert(!graphs.empty());
+			graphs.back().push_back(&parts[c][i]);
 		}
 	}
-	pos = size;
-	size = end;
-	for (size_t i = 0; i < g_.size(); i++) { // v
-		for (size_t j = 0; j < g_[i].eidx.size(); j++) {
-			for (size_t k = 0; k < g_[i].eidx[j].size(); k++) {
-				ptr_idx[pos] = end - pos;
-				pos++;
-				end += g_[i].eidx[j][k].size();
-			}
+	g_.clear();
+	g_.resize(graphs.size());
+#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t i = 0; i < graphs.size(); i++) {
+		CvtDataGraph& g = g_[i];
+		g.vnum = g.max_vid = g.max_vlabel = g.max_elabel = 0;
+		g.num_values = 0;
+		vector<const vector<int>*> edges, vlabels;
+		for (TextPart* part : graphs[i]) {
+			g.vnum += part->vnum;
+			g.max_vid = std::max(g.max_vid, part->max_vid);
+			g.max_vlabel = std::max(g.max_vlabel, part->max_vlabel);
+			g.max_elabel = std::max(g.max_elabel, part->max_elabel);
+			g.num_values = std::max(g.num_values, part->num_values);
+			edges.push_back(&part->edges);
+			vlabels.push_back(&part->vlabels);
 		}
-		for (size_t j = 0; j < g_[i].vidx.size(); j++) {
-			for (size_t k = 0; k < g_[i].vidx[j].size(); k++) {
-				ptr_idx[pos] = end - pos;
-				pos++;
-				end += g_[i].vidx[j][k].size();
-			}
+		GroupByLabel(edges, 3, g.edge_offset, g.edge_rows);
+		GroupByLabel(vlabels, 2, g.vertex_offset, g.vertex_rows);
+		g.base = g.edge_offset.size() - 1;
+		for (TextPart* part : graphs[i]) {
+			vector<int>().swap(part->edges);
+			vector<int>().swap(part->vlabels);
 		}
 	}
-	end++;
-	pos = size;
-	size = end - 1;
-	for (size_t i = 0; i < g_.size(); i++) { // i
-		for (size_t j = 0; j < g_[i].eidx.size(); j++) {
-			for (size_t k = 0; k < g_[i].eidx[j].size(); k++) {
-				for (auto& it : g_[i].eidx[j][k]) {
-					ptr_idx[pos] = end - pos;
-					pos++;
-					for (int e : it.second)
-						ptr_idx[end++] = e;
-				}
-			}
-		}
-		for (size_t j = 0; j < g_[i].vidx.size(); j++) {
-			for (size_t k = 0; k < g_[i].vidx[j].size(); k++) {
-				for (auto& it : g_[i].vidx[j][k]) {
-					ptr_idx[pos] = end - pos;
-					pos++;
-					for (int e : it.second)
-						ptr_idx[end++] = e;
+}
+
+// builds the value index of every column
+void DataGraph::MakeBinary() {
+	vector<pair<int, int>> columns; // (graph, table)
+	for (size_t i = 0; i < g_.size(); i++) {
+		g_[i].index.assign(g_[i].num_tables(), vector<CvtDataGraph::ColumnIndex>());
+		for (int t = 0; t < g_[i].num_tables(); t++) columns.emplace_back(i, t);
+	}
+#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t k = 0; k < columns.size(); k++) {
+		CvtDataGraph& g = g_[columns[k].first];
+		int t = columns[k].second;
+		size_t n = g.num_rows(t);
+		if (n == 0) continue; // the old converter made no columns for these
+		int width = t < g.base ? 2 : 1;
+		g.index[t].resize(width);
+		vector<uint64_t> keys(n);
+		for (int c = 0; c < width; c++) {
+			for (size_t r = 0; r < n; r++)
+				keys[r] = (static_cast<uint64_t>(static_cast<uint32_t>(g.row(t, r)[c])) << 32) | r;
+			std::sort(keys.begin(), keys.end());
+			CvtDataGraph::ColumnIndex& idx = g.index[t][c];
+			idx.rows.resize(n);
+			for (size_t r = 0; r < n; r++) {
+				int v = keys[r] >> 32;
+				if (r == 0 || v != idx.values.back()) {
+					idx.values.push_back(v);
+					idx.offset.push_back(r);
 				}
+				idx.rows[r] = keys[r] & 0xffffffffu;
 			}
+			idx.offset.push_back(n);
 		}
 	}
-	ptr_idx[size] = end - size;
-	if (msync(ptr_idx, fileinfo_idx.st_size, MS_SYNC)) {
-		perror("fail to sync the file to disk");
-		exit(0);
-	}
-	close(fd_idx);
-	if (munmap(ptr_idx, fileinfo_idx.st_size) == -1) {
-		perror("error un-mapping the file");
-		exit(0);
-	}
+}
 
-	fn = static_cast<string>(dataname) + ".map";
+vector<int64_t> DataGraph::CountDistinct(const CvtDataGraph& g) {
+	vector<int64_t> distinct;
+	for (int t = 0; t < g.num_tables(); t++)
+		for (int c = 0; c < (t < g.base ? 2 : 1); c++)
+			distinct.push_back(c < (int)g.index[t].size() ? g.index[t][c].values.size() : 0);
+	return distinct;
+}
 
-	fp = fopen(fn.c_str(), "w");
-	rem = map_cnt_ + 1;
-	unit = 1024;
-	// std::cout << "rem: " << rem << std::endl;
-	while (rem > 0) {
-		vector<int> tmp(std::min(rem, unit), 0);
-		rem -= fwrite(tmp.data(), sizeof(int), tmp.size(), fp);
+void DataGraph::Make1DTable(const char* dataname) {
+	// graph -> table -> row -> column, each level with an end entry
+	size_t num_tables = 0, num_rows = 0, num_cells = 0;
+	for (auto& g : g_) {
+		num_tables += g.num_tables();
+		num_rows += g.edge_rows.size() / 2 + g.vertex_rows.size();
+		num_cells += g.edge_rows.size() + g.vertex_rows.size();
+	}
+	uint64_t size = (g_.size() + 1) + (num_tables + 1) + (num_rows + 1) + num_cells;
+	if (in_memory_) container_size_ = size * sizeof(int);
+	IntWriter w(dataname, size, in_memory_ ? &container_ : nullptr);
+	LevelWriter graphs(w, g_.size(), true);
+	for (auto& g : g_) graphs.Add(g.num_tables());
+	graphs.Finish();
+	LevelWriter tables(w, num_tables, true);
+	for (auto& g : g_)
+		for (int t = 0; t < g.num_tables(); t++) tables.Add(g.num_rows(t));
+	tables.Finish();
+	LevelWriter rows(w, num_rows, true);
+	for (auto& g : g_) {
+		for (size_t r = 0; r < g.edge_rows.size() / 2; r++) rows.Add(2);
+		for (size_t r = 0; r < g.vertex_rows.size(); r++) rows.Add(1);
+	}
+	rows.Finish();
+	for (auto& g : g_) {
+		w.Put(g.edge_rows.data(), g.edge_rows.size());
+		w.Put(g.vertex_rows.data(), g.vertex_rows.size());
 	}
-	fclose(fp);
+}
 
-	int fd_map = open(fn.c_str(), O_RDWR | O_CREAT, (mode_t)0600);
-	struct stat fileinfo_map;
-	if (fstat(fd_map, &fileinfo_map) == -1) {
-		perror("fstat error");
-		close(fd_map);
-		exit(0);
+void DataGraph::Make1DIndex(const char* dataname) {
+	// graph -> table -> column -> value -> row; only the value level has an
+	// end entry, each other level being followed by the next
+	vector<const CvtDataGraph::ColumnIndex*> columns;
+	size_t num_tables = 0, num_values = 0, num_cells = 0;
+	for (auto& g : g_) {
+		num_tables += g.num_tables();
+		for (auto& table : g.index)
+			for (auto& idx : table) {
+				columns.push_back(&idx);
+				num_values += idx.values.size();
+				num_cells += idx.rows.size();
+			}
 	}
-	int* ptr_map = static_cast<int*>(mmap(0, fileinfo_map.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_map, 0));
-	if (ptr_map == MAP_FAILED) {
-		close(fd_map);
-		perror("Error mapping the file");
-		exit(0);
+	{
+		uint64_t size = g_.size() + num_tables + columns.size() + (num_values + 1) + num_cells;
+		if (in_memory_) index_size_ = size * sizeof(int);
+		IntWriter w(string(dataname) + ".index", size, in_memory_ ? &index_container_ : nullptr);
+		LevelWriter graphs(w, g_.size(), false);
+		for (auto& g : g_) graphs.Add(g.num_tables());
+		graphs.Finish();
+		LevelWriter tables(w, num_tables, false);
+		for (auto& g : g_)
+			for (auto& table : g.index) tables.Add(table.size());
+		tables.Finish();
+		LevelWriter cols(w, columns.size(), false);
+		for (auto* idx : columns) cols.Add(idx->values.size());
+		cols.Finish();
+		LevelWriter values(w, num_values, true);
+		for (auto* idx : columns)
+			for (size_t i = 0; i < idx->values.size(); i++) values.Add(idx->offset[i + 1] - idx->offset[i]);
+		values.Finish();
+		for (auto* idx : columns) w.Put(idx->rows.data(), idx->rows.size());
 	}
 
-	end = g_.size();
-	for (size_t i = 0; i < g_.size(); i++) { // v
-		ptr_map[i] = end - i;
-		end += std::max(g_[i].emap.size(), g_[i].vmap.size());
-	}
-	end++;
-	size = end - 1;
-	pos = g_.size();
+	// graph -> value -> (table, column, ordinal of the value in the column)
+	// triples, the value level with an end entry
+	size_t total_values = 0, num_triples = 0;
+	for (auto& g : g_) {
+		total_values += g.num_values;
+		for (auto& table : g.index)
+			for (auto& idx : table) num_triples += idx.values.size();
+	}
+	uint64_t size = g_.size() + (total_values + 1) + 3 * num_triples;
+	if (in_memory_) map_size_ = size * sizeof(int);
+	IntWriter w(string(dataname) + ".map", size, in_memory_ ? &map_container_ : nullptr);
+	LevelWriter graphs(w, g_.size(), false);
+	for (auto& g : g_) graphs.Add(g.num_values);
+	graphs.Finish();
+	// the triples of each graph are gathered in parallel, the sizes of its
+	// values' lists kept for the value level, written in order after
+	vector<vector<int>> triples(g_.size());
+	vector<vector<size_t>> sizes(g_.size());
+#pragma omp parallel for schedule(dynamic, 1)
 	for (size_t i = 0; i < g_.size(); i++) {
-		for (size_t v = 0; v < std::max(g_[i].emap.size(), g_[i].vmap.size()); v++) {
-			assert(pos < fileinfo_map.st_size);
-			ptr_map[pos] = end - pos;
-			pos++;
-			if (v < g_[i].emap.size())
-				for (size_t j = 0; j < g_[i].emap[v].size(); j++)
-					ptr_map[end++] = g_[i].emap[v][j];
-			if (v < g_[i].vmap.size())
-				for (size_t j = 0; j < g_[i].vmap[v].size(); j++)
-					ptr_map[end++] = g_[i].vmap[v][j];
-		}
-	}
-	ptr_map[size] = end - size;
-	if (msync(ptr_map, fileinfo_map.st_size, MS_SYNC)) {
-		perror("fail to sync the file to disk");
-		exit(0);
+		CvtDataGraph& g = g_[i];
+		vector<size_t>& b = sizes[i]; // triple offsets per value
+		b.assign(g.num_values + 1, 0);
+		for (auto& table : g.index)
+			for (auto& idx : table)
+				for (int v : idx.values) b[v + 1] += 3;
+		for (size_t v = 0; v < g.num_values; v++) b[v + 1] += b[v];
+		triples[i].resize(b[g.num_values]);
+		for (size_t t = 0; t < g.index.size(); t++)
+			for (size_t c = 0; c < g.index[t].size(); c++) {
+				auto& vals = g.index[t][c].values;
+				for (size_t o = 0; o < vals.size(); o++) {
+					int* out = triples[i].data() + b[vals[o]];
+					b[vals[o]] += 3;
+					out[0] = t;
+					out[1] = c;
+					out[2] = o;
+				}
+			}
 	}
-	close(fd_map);
-	if (munmap(ptr_map, fileinfo_map.st_size) == -1) {
-		perror("error un-mapping the file");
-		exit(0);
+	// the fill moved each value's offset to where the next one's starts
+	LevelWriter values(w, total_values, true);
+	for (size_t i = 0; i < g_.size(); i++)
+		for (size_t v = 0; v < g_[i].num_values; v++)
+			values.Add(sizes[i][v] - (v > 0 ? sizes[i][v - 1] : 0));
+	values.Finish();
+	for (auto& t : triples) w.Put(t.data(), t.size());
+}
+
+void DataGraph::Make1DColumns(const char* dataname) {
+	// graph -> table -> column -> row, each level with an end entry, as
+	// Make1DTable; a table has its columns even without rows
+	size_t num_tables = 0, num_columns = 0, num_cells = 0;
+	for (auto& g : g_) {
+		num_tables += g.num_tables();
+		num_columns += 2 * g.base + (g.num_tables() - g.base);
+		num_cells += g.edge_rows.size() + g.vertex_rows.size();
+	}
+	IntWriter w(string(dataname) + ".cols",
+		(g_.size() + 1) + (num_tables + 1) + (num_columns + 1) + num_cells);
+	LevelWriter graphs(w, g_.size(), true);
+	for (auto& g : g_) graphs.Add(g.num_tables());
+	graphs.Finish();
+	LevelWriter tables(w, num_tables, true);
+	for (auto& g : g_)
+		for (int t = 0; t < g.num_tables(); t++) tables.Add(t < g.base ? 2 : 1);
+	tables.Finish();
+	LevelWriter cols(w, num_columns, true);
+	for (auto& g : g_)
+		for (int t = 0; t < g.num_tables(); t++)
+			for (int c = 0; c < (t < g.base ? 2 : 1); c++) cols.Add(g.num_rows(t));
+	cols.Finish();
+	vector<int> column;
+	for (auto& g : g_)
+		for (int t = 0; t < g.num_tables(); t++) {
+			int width = t < g.base ? 2 : 1;
+			column.resize(g.num_rows(t));
+			for (int c = 0; c < width; c++) {
+				for (size_t r = 0; r < column.size(); r++) column[r] = g.row(t, r)[c];
+				w.Put(column.data(), column.size());
+			}
+		}
+}
+
+namespace {
+
+// writes runs[k][c], k over the tables of the graphs in order, as graph ->
+// table -> column -> run, each level with an end entry, as Make1DColumns
+void WriteRuns(const string& fn, const vector<DataGraph::CvtDataGraph>& graphs,
+		const vector<vector<vector<int>>>& runs) {
+	size_t num_columns = 0, num_ints = 0;
+	for (auto& table : runs)
+		for (auto& run : table) {
+			num_columns++;
+			num_ints += run.size();
+		}
+	IntWriter w(fn, (graphs.size() + 1) + (runs.size() + 1) + (num_columns + 1) + num_ints);
+	LevelWriter levels(w, graphs.size(), true);
+	for (auto& g : graphs) levels.Add(g.num_tables());
+	levels.Finish();
+	LevelWriter tables(w, runs.size(), true);
+	for (auto& table : runs) tables.Add(table.size());
+	tables.Finish();
+	LevelWriter cols(w, num_columns, true);
+	for (auto& table : runs)
+		for (auto& run : table) cols.Add(run.size());
+	cols.Finish();
+	for (auto& table : runs)
+		for (auto& run : table) w.Put(run.data(), run.size());
+}
+
+}
+
+void DataGraph::Make1DPacked(const char* dataname) {
+	// every table column, and every index column's value offsets and rows,
+	// packed in parallel
+	vector<pair<int, int>> tables; // (graph, table)
+	for (size_t i = 0; i < g_.size(); i++)
+		for (int t = 0; t < g_[i].num_tables(); t++) tables.emplace_back(i, t);
+	vector<vector<vector<int>>> runs(tables.size()), index_runs(tables.size());
+#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t k = 0; k < tables.size(); k++) {
+		CvtDataGraph& g = g_[tables[k].first];
+		int t = tables[k].second;
+		int width = t < g.base ? 2 : 1;
+		vector<int> column(g.num_rows(t));
+		runs[k].resize(width);
+		for (int c = 0; c < width; c++) {
+			for (size_t r = 0; r < column.size(); r++) column[r] = g.row(t, r)[c];
+			PackedColumn::Pack(column.data(), column.size(), runs[k][c]);
+		}
+		index_runs[k].resize(g.index[t].size());
+		for (size_t c = 0; c < g.index[t].size(); c++) {
+			CvtDataGraph::ColumnIndex& idx = g.index[t][c];
+			vector<int> offset(idx.offset.begin(), idx.offset.end());
+			PackedColumn::Pack(offset.data(), offset.size(), index_runs[k][c]);
+			PackedColumn::Pack(idx.rows.data(), idx.rows.size(), index_runs[k][c]);
+		}
 	}
+	WriteRuns(string(dataname) + ".packed", g_, runs);
+	WriteRuns(string(dataname) + ".index.packed", g_, index_runs);
 }
 
 void DataGraph::WriteBinary(const char* dataname) {
   string fname = string(dataname) + ".relation";
   // std::cout << "DataGraph::WriteBinary to " << fname << "\n";
   Make1DTable(fname.c_str());
+  Make1DIndex(fname.c_str());
+  const char* columns = getenv("GCARE_RELATION_COLUMNS");
+  if (columns && atoi(columns) == 1)
+    Make1DColumns(fname.c_str());
+  else
+    std::filesystem::remove(fname + ".cols"); // of an earlier build
+  const char* packed = getenv("GCARE_RELATION_PACKED");
+  if (packed && atoi(packed) == 1) {
+    Make1DPacked(fname.c_str());
+  } else {
+    std::filesystem::remove(fname + ".packed");
+    std::filesystem::remove(fname + ".index.packed");
+  }
 	string fn = fname + ".meta";
 	FILE* fp = fopen(fn.c_str(), "w");
 	fprintf(fp, "%zu\n", g_.size());
 	for (size_t i = 0; i < g_.size(); i++)
-		fprintf(fp, "%zu %d %d %d\n", g_[i].edge_table.size(), g_[i].max_vid, g_[i].max_vlabel, g_[i].max_elabel);
+		fprintf(fp, "%d %d %d %d\n", g_[i].base, g_[i].max_vid, g_[i].max_vlabel, g_[i].max_elabel);
+	// then per graph "distinct", the number of its columns and their
+	// distinct values (see NumDistinct)
+	for (size_t i = 0; i < g_.size(); i++) {
+		vector<int64_t> distinct = CountDistinct(g_[i]);
+		fprintf(fp, "distinct %zu", distinct.size());
+		for (int64_t d : distinct) fprintf(fp, " %" PRId64, d);
+		fprintf(fp, "\n");
+	}
 	fclose(fp);
     // std::cout << "~DataGraph::WriteBinary to " << fname << "\n";
 }
 
-void DataGraph::ReadBinary(const char* dataname) {
+
+namespace {
+
+// list i of a level, as NestedView reads it; end_entries leaves out that
+// many entries at its end, the end entry of the level below
+template <class View>
+View SubList(const int* level, int i, int end_entries = 0) {
+    return View(level + i + level[i], level[i + 1] - level[i] + 1 - end_entries);
+}
+
+}
+
+// Every file starts with a level of one list per graph. The table and the
+// column levels end in an end entry, so graph i's tables run up to graph
+// i + 1's, as do its index tables, which have none; but the value level
+// of the map has one, which the last graph's values would take in.
+void DataGraph::SelectGraph(int i) {
+    const GraphMeta& m = graphs_[i];
+    base_ = m.base;
+    max_vid_ = m.max_vid;
+    max_vlabel_ = m.max_vlabel;
+    max_elabel_ = m.max_elabel;
+    distinct_ = m.distinct;
+    table_ = TableView();
+    if (container_ != nullptr)
+        table_ = SubList<TableView>(container_, i);
+    index_ = IndexView();
+    map_ = MapView();
+    if (HasIndex()) {
+        if (index_container_ != nullptr)
+            index_ = SubList<IndexView>(index_container_, i);
+        map_ = SubList<MapView>(map_container_, i, i + 1 == NumGraphs());
+    }
+    packed_ = packed_index_ = PackedView();
+    if (Packed()) {
+        packed_ = SubList<PackedView>(packed_container_, i);
+        packed_index_ = SubList<PackedView>(packed_index_container_, i);
+    }
+    columns_ = ColumnsView();
+    if (columns_container_ != nullptr)
+        columns_ = SubList<ColumnsView>(columns_container_, i);
+}
+
+void DataGraph::ViewGraph(const DataGraph& all, int i) {
+    owner_ = false;
+    container_ = all.container_;
+    container_size_ = all.container_size_;
+    load_mode_ = all.load_mode_;
+    index_container_ = all.index_container_;
+    index_size_ = all.index_size_;
+    map_container_ = all.map_container_;
+    map_size_ = all.map_size_;
+    columns_container_ = all.columns_container_;
+    columns_size_ = all.columns_size_;
+    packed_container_ = all.packed_container_;
+    packed_size_ = all.packed_size_;
+    packed_index_container_ = all.packed_index_container_;
+    packed_index_size_ = all.packed_index_size_;
+    graphs_ = all.graphs_;
+    use_hash_index_ = all.use_hash_index_;
+    SelectGraph(i);
+    BuildHashIndex();
+}
+
+void DataGraph::ReadBinary(const char* dataname, LoadMode mode) {
   string fname = string(dataname) + ".relation";
   // std::cout << "DataGraph::ReadBinary from " << fname << "\n";
 	string metadata = fname + ".meta";
+	if (!std::filesystem::exists(metadata) && HasGraphBinary(dataname)) {
+		ReadGraph(dataname);
+		return;
+	}
 	FILE* fp = fopen(metadata.c_str(), "r");
-	int gnum;
-	fscanf(fp, "%d", &gnum);
-	fscanf(fp, "%d%d%d%d", &base_, &max_vid_, &max_vlabel_, &max_elabel_);
+	int gnum = 0;
+	if (fp == nullptr || fscanf(fp, "%d", &gnum) != 1 || gnum < 1) {
+		fprintf(stderr, "cannot read %s\n", metadata.c_str());
+		exit(EXIT_FAILURE);
+	}
+	graphs_.assign(gnum, GraphMeta());
+	for (GraphMeta& m : graphs_)
+		fscanf(fp, "%d%d%d%d", &m.base, &m.max_vid, &m.max_vlabel, &m.max_elabel);
+	// binaries written by earlier versions have no distinct counts
+	for (GraphMeta& m : graphs_) {
+		size_t n = 0;
+		if (fscanf(fp, " distinct %zu", &n) != 1) break;
+		m.distinct.resize(n);
+		for (int64_t& d : m.distinct)
+			if (fscanf(fp, "%" SCNd64, &d) != 1) d = -1;
+	}
 	fclose(fp);
 
-	int fd = open(fname.c_str(), O_RDONLY, (mode_t)0600);
-	struct stat fileinfo;
-	fstat(fd, &fileinfo);
-	int* ptr = static_cast<int*>(mmap(0, fileinfo.st_size, PROT_READ, MAP_SHARED, fd, 0));
-    container_ = static_cast<int*>(malloc(fileinfo.st_size));
-    memcpy(container_, ptr, fileinfo.st_size);
+    UnloadFile(reinterpret_cast<char*>(container_), container_size_, load_mode_);
+    UnloadFile(reinterpret_cast<char*>(packed_container_), packed_size_, load_mode_);
+    UnloadFile(reinterpret_cast<char*>(packed_index_container_), packed_index_size_, LOAD_MMAP);
+    container_ = packed_container_ = packed_index_container_ = nullptr;
+    load_mode_ = mode;
+    // the packed tables and index in place of the int ones, if asked for
+    string packed_fn = fname + ".packed", packed_index_fn = fname + ".index.packed";
+    bool packed = use_packed_ && std::filesystem::exists(packed_fn) && std::filesystem::exists(packed_index_fn);
+    if (use_packed_ && !packed)
+        fprintf(stderr, "%s has no packed tables, reading the int ones\n", fname.c_str());
+    string table_fn = packed ? packed_fn : fname;
+    int*& tables = packed ? packed_container_ : container_;
+    tables = reinterpret_cast<int*>(LoadFile(table_fn.c_str(), packed ? packed_size_ : container_size_, mode));
+    if (tables == nullptr) {
+        fprintf(stderr, "cannot load %s\n", table_fn.c_str());
+        exit(EXIT_FAILURE);
+    }
 
-    table_.array_ = container_ + container_[0];
-    table_.size_ = container_[1] - container_[0] + 1;
-	if (munmap(ptr, fileinfo.st_size) == -1) {
-		perror("error un-mapping the file");
-		exit(0);
-	}
-	close(fd);
+    // value index; binaries written by earlier versions have none
+    UnloadFile(reinterpret_cast<char*>(index_container_), index_size_, index_mode_);
+    UnloadFile(reinterpret_cast<char*>(map_container_), map_size_, index_mode_);
+    index_container_ = map_container_ = nullptr;
+    index_mode_ = LOAD_MMAP;
+    string index_fn = packed ? packed_index_fn : fname + ".index", map_fn = fname + ".map";
+    if (std::filesystem::exists(index_fn) && std::filesystem::exists(map_fn)) {
+        int*& index = packed ? packed_index_container_ : index_container_;
+        index = reinterpret_cast<int*>(LoadFile(index_fn.c_str(), packed ? packed_index_size_ : index_size_, LOAD_MMAP));
+        map_container_ = reinterpret_cast<int*>(LoadFile(map_fn.c_str(), map_size_, LOAD_MMAP));
+        if (index == nullptr || map_container_ == nullptr) {
+            fprintf(stderr, "cannot load %s\n", index ? map_fn.c_str() : index_fn.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    // the column-major copy, if the binary was written with one
+    UnloadFile(reinterpret_cast<char*>(columns_container_), columns_size_, LOAD_MMAP);
+    columns_container_ = nullptr;
+    string columns_fn = fname + ".cols";
+    if (std::filesystem::exists(columns_fn)) {
+        columns_container_ = reinterpret_cast<int*>(LoadFile(columns_fn.c_str(), columns_size_, LOAD_MMAP));
+        if (columns_container_ == nullptr) {
+            fprintf(stderr, "cannot load %s\n", columns_fn.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    SelectGraph(0);
+    BuildHashIndex();
     // std::cout << "~DataGraph::ReadBinary from " << fname << "\n";
 }
+
+}  // namespace relational
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include "../include/exact_count.h"
+#include "../include/simd_search.h"
+
+namespace graph {
+
+REGISTER_ESTIMATOR("exact", Exact);
+
+//the threads poll the limit and the stop callback every STEP_CHECK steps
+static const uint64_t STEP_CHECK = 4096;
+
+//per thread: the binding, and per level its candidates
+struct ExactCounter::Worker {
+	vector<int> m;
+	vector<vector<int>> cand;
+	vector<int> tmp;
+	uint64_t count = 0, reported = 0, steps = 0;
+
+	explicit Worker(size_t levels) : m(levels), cand(levels) {}
+};
+
+ExactCounter::ExactCounter(DataGraph& g, QueryGraph& q)
+	: g_(&g), q_(&q), stopped_(false), counted_(0) {
+	int n = q.GetNumVertices();
+	empty_ = false;
+	for (int v = 0; v < n; v++) {
+		int vl = q.GetVLabel(v);
+		if (vl >= g.GetNumVLabels() || q.GetBound(v) >= g.GetNumVertices())
+			empty_ = true;
+	}
+	for (int i = 0; i < q.GetNumEdges(); i++)
+		if (q.GetEdge(i).el >= g.GetNumELabels())
+			empty_ = true;
+	if (empty_)
+		return;
+
+	//the connected components of the undirected query
+	vector<int> comp(n, -1);
+	for (int v = 0; v < n; v++) {
+		if (comp[v] >= 0)
+			continue;
+		vector<int> members = {v};
+		comp[v] = v;
+		for (size_t k = 0; k < members.size(); k++)
+			for (int d = 0; d < 2; d++)
+				for (auto& e : q.GetAdj(members[k], d == 0))
+					if (comp[e.first] < 0) {
+						comp[e.first] = v;
+						members.push_back(e.first);
+					}
+		plan(members);
+	}
+}
+
+//orders the component: its bound vertex, else the ends of its rarest
+//non-loop edge, first; then always the vertex with the most edges to those
+//ordered already, so each level after the start has a bound neighbour
+void ExactCounter::plan(const vector<int>& members) {
+	QueryGraph& q = *q_;
+	Plan p;
+	vector<int> order;
+	int start_edge = -1;
+	for (int v : members)
+		if (q.GetBound(v) >= 0) {
+			order.push_back(v);
+			break;
+		}
+	if (order.empty()) {
+		int64_t rarest = -1;
+		for (int i = 0; i < q.GetNumEdges(); i++) {
+			Edge e = q.GetEdge(i);
+			if (e.src == e.dst || std::find(members.begin(), members.end(), e.src) == members.end())
+				continue;
+			int64_t size = g_->GetNumEdges(e.el);
+			if (rarest < 0 || size < rarest) {
+				rarest = size;
+				start_edge = i;
+			}
+		}
+	}
+	if (start_edge >= 0) {
+		Edge e = q.GetEdge(start_edge);
+		order.push_back(e.src);
+		order.push_back(e.dst);
+		p.start = Plan::EDGE;
+		p.el = e.el;
+	} else {
+		if (order.empty())
+			order.push_back(members[0]); //a lone vertex, maybe with loops
+		p.start = Plan::VERTEX;
+		p.el = -1;
+	}
+	size_t start_levels = order.size();
+
+	vector<int> pos(q.GetNumVertices(), -1);
+	for (size_t k = 0; k < order.size(); k++)
+		pos[order[k]] = k;
+	while (order.size() < members.size()) {
+		int best = -1, best_links = -1;
+		for (int v : members) {
+			if (pos[v] >= 0)
+				continue;
+			int links = 0;
+			for (int d = 0; d < 2; d++)
+				for (auto& e : q.GetAdj(v, d == 0))
+					links += pos[e.first] >= 0;
+			if (links > best_links) {
+				best = v;
+				best_links = links;
+			}
+		}
+		pos[best] = order.size();
+		order.push_back(best);
+	}
+
+	p.levels.resize(order.size());
+	for (size_t k = 0; k < order.size(); k++) {
+		p.levels[k].vl = q.GetVLabel(order[k]);
+		p.levels[k].bound = q.GetBound(order[k]);
+	}
+	for (int i = 0; i < q.GetNumEdges(); i++) {
+		if (i == start_edge)
+			continue;
+		Edge e = q.GetEdge(i);
+		int a = pos[e.src], b = pos[e.dst];
+		if (a < 0)
+			continue; //another component's
+		size_t level = std::max(a, b);
+		if (a == b || level < start_levels)
+			p.levels[level].checks.push_back(Check{a, b, e.el});
+		else if (b > a)
+			p.levels[level].adj.push_back(Adj{a, e.el, true});
+		else
+			p.levels[level].adj.push_back(Adj{b, e.el, false});
+	}
+	plans_.push_back(p);
+}
+
+bool ExactCounter::pass(const Level& l, const int* m, int level) {
+	int v = m[level];
+	if (l.bound >= 0 && v != l.bound)
+		return false;
+	if (l.vl != -1 && !g_->HasVLabel(v, l.vl))
+		return false;
+	for (const Check& c : l.checks)
+		if (!g_->HasEdge(m[c.a], m[c.b], c.el, true))
+			return false;
+	return true;
+}
+
+bool ExactCounter::giveUp(Worker& w) {
+	if (limit_ > 0) {
+		uint64_t total = counted_ += w.count - w.reported;
+		w.reported = w.count;
+		if (total > limit_)
+			stopped_ = true;
+	}
+	if (stop_ && stop_())
+		stopped_ = true;
+	return stopped_;
+}
+
+void ExactCounter::extend(const Plan& p, int level, Worker& w) {
+	if (level == (int)p.levels.size()) {
+		w.count++;
+		return;
+	}
+	if (++w.steps % STEP_CHECK == 0 && giveUp(w))
+		return;
+	if (stopped_.load(std::memory_order_relaxed))
+		return;
+	const Level& l = p.levels[level];
+	int* m = w.m.data();
+	bool leaf = level + 1 == (int)p.levels.size() &&
+		l.vl == -1 && l.bound < 0 && l.checks.empty();
+
+	//the smallest list first, intersected with the others in turn; a
+	//packed graph's lists are only valid for a few GetAdj calls, so the
+	//candidates are copied
+	size_t smallest = 0;
+	int n = -1;
+	for (size_t k = 0; k < l.adj.size(); k++) {
+		int size = g_->GetAdjSize(m[l.adj[k].pos], l.adj[k].el, l.adj[k].dir);
+		if (n < 0 || size < n) {
+			n = size;
+			smallest = k;
+		}
+	}
+	if (n == 0)
+		return;
+	if (leaf && l.adj.size() == 1) {
+		w.count += n;
+		return;
+	}
+	const Adj& s = l.adj[smallest];
+	range r = g_->GetAdj(m[s.pos], s.el, s.dir);
+	w.cand[level].assign(r.begin, r.end);
+	for (size_t k = 0; k < l.adj.size() && n > 0; k++) {
+		if (k == smallest)
+			continue;
+		const Adj& a = l.adj[k];
+		range o = g_->GetAdj(m[a.pos], a.el, a.dir);
+		if ((int)w.tmp.size() < n)
+			w.tmp.resize(n);
+		vector<int>& cand = w.cand[level];
+		n = Intersect(range{cand.data(), cand.data() + n}, o, w.tmp.data());
+		std::swap(cand, w.tmp);
+	}
+	if (leaf) {
+		w.count += n;
+		return;
+	}
+	const vector<int>& cand = w.cand[level];
+	for (int k = 0; k < n; k++) {
+		m[level] = cand[k];
+		if (pass(l, m, level))
+			extend(p, level + 1, w);
+	}
+}
+
+double ExactCounter::countPlan(const Plan& p) {
+	counted_ = 0;
+	int64_t n;
+	int first = -1;
+	if (p.start == Plan::EDGE)
+		n = g_->GetNumEdges(p.el);
+	else if ((first = p.levels[0].bound) >= 0)
+		n = 1;
+	else
+		n = g_->GetNumVertices();
+
+	double total = 0;
+#pragma omp parallel reduction(+:total)
+	{
+		Worker w(p.levels.size());
+		int* m = w.m.data();
+#pragma omp for schedule(dynamic, 64)
+		for (int64_t i = 0; i < n; i++) {
+			if (stopped_.load(std::memory_order_relaxed) ||
+					(++w.steps % STEP_CHECK == 0 && giveUp(w)))
+				continue;
+			int level;
+			if (p.start == Plan::EDGE) {
+				g_->GetEdge(p.el, i, m);
+				if (!pass(p.levels[0], m, 0) || !pass(p.levels[1], m, 1))
+					continue;
+				level = 2;
+			} else {
+				m[0] = first >= 0 ? first : i;
+				if (!pass(p.levels[0], m, 0))
+					continue;
+				level = 1;
+			}
+			extend(p, level, w);
+		}
+		total += w.count;
+	}
+	return total;
+}
+
+bool ExactCounter::Count(double& count) {
+	stopped_ = false;
+	count = 0;
+	if (empty_)
+		return true;
+	double total = 1;
+	for (const Plan& p : plans_) {
+		total *= countPlan(p);
+		if (stopped_ || (limit_ > 0 && total > limit_))
+			return false;
+		if (total == 0)
+			break;
+	}
+	count = total;
+	return true;
+}
+
+bool Exact::GetSubstructure(int) {
+	if (counted_)
+		return false;
+	return counted_ = true;
+}
+
+double Exact::EstCard(int) {
+	ExactCounter counter(*g, *q);
+	counter.SetStop([this]() { return DeadlinePassed(); });
+	double count;
+	if (!counter.Count(count))
+		throw TIMEOUT;
+	return count;
+}
+
+//exact counts can be shared by isomorphic queries
+string Exact::SubqueryKey(int) {
+	return q->CanonicalForm();
+}
+
+}  // namespace graph
@@ -0,0 +1,145 @@
+// The C API of libgcare (include/gcare.h), on top of the Registry: the
+// estimators and backends of the kinds linked into the library register
+// themselves as they do for the binaries.
+#include <sstream>
+#include <unistd.h>
+
+#include "../include/gcare.h"
+#include "../include/query_graph.h"
+#include "../include/query_text.h"
+#include "../include/registry.h"
+
+struct gcare_graph {
+  std::string kind;
+  Backend *backend;
+};
+
+struct gcare_estimator {
+  Runner *runner;
+  double ratio;
+  int seed;
+  std::vector<QueryResult> results;
+};
+
+const char *gcare_methods(void) {
+  static std::string list;
+  if (list.empty())
+    for (auto &m : Registry::Get().methods)
+      list += (list.empty() ? "" : ",") + m.first;
+  return list.c_str();
+}
+
+gcare_graph *gcare_load_graph(const char *kind, const char *prefix,
+                              const char *text, int load_mode) {
+  auto it = Registry::Get().backends.find(kind);
+  if (it == Registry::Get().backends.end()) {
+    fprintf(stderr, "gcare: unknown kind %s\n", kind);
+    return nullptr;
+  }
+  gcare_graph *g = new gcare_graph{kind, it->second()};
+  if (text != nullptr)
+    g->backend->Build(text, prefix);
+  g->backend->Load(prefix, load_mode == GCARE_LOAD_MMAP      ? LOAD_MMAP
+                           : load_mode == GCARE_LOAD_HUGEPAGE ? LOAD_MMAP_HUGE
+                           : load_mode == GCARE_LOAD_SHM      ? LOAD_SHM
+                                                              : LOAD_COPY);
+  return g;
+}
+
+void gcare_free_graph(gcare_graph *g) {
+  if (g == nullptr)
+    return;
+  delete g->backend;
+  delete g;
+}
+
+gcare_estimator *gcare_open_summary(gcare_graph *g, const char *method,
+                                    const char *summary, double ratio,
+                                    int seed) {
+  if (Registry::Get().KindOf(method) != g->kind) {
+    fprintf(stderr, "gcare: method %s does not run on %s data\n", method,
+            g->kind.c_str());
+    return nullptr;
+  }
+  Runner *runner = g->backend->NewRunner(method);
+  if (runner == nullptr)
+    return nullptr;
+  if (access(summary, F_OK) != 0)
+    runner->Summarize(summary, ratio, seed);
+  runner->ReadSummary(summary, 1);
+  return new gcare_estimator{runner, ratio, seed, {}};
+}
+
+void gcare_close(gcare_estimator *e) {
+  if (e == nullptr)
+    return;
+  delete e->runner;
+  delete e;
+}
+
+// the nonempty lines of query_text
+static std::vector<std::string> query_lines(const char *query_text) {
+  std::vector<std::string> text;
+  std::istringstream in(query_text);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (!line.empty())
+      text.push_back(line);
+  }
+  return text;
+}
+
+int gcare_estimate(gcare_estimator *e, const char *query_text,
+                   int iterations, double *est, double *seconds) {
+  std::vector<std::string> text = query_lines(query_text);
+  if (text.empty() || iterations < 1)
+    return 1;
+  QueryParams params(iterations, e->seed, e->ratio, false);
+  e->results.resize(iterations);
+  double mean_est, mean_time;
+  if (!e->runner->Query("<gcare_estimate>", &text, params, e->results.data(),
+                        mean_est, mean_time))
+    return 2;
+  *est = mean_est;
+  if (seconds != nullptr)
+    *seconds = mean_time;
+  return 0;
+}
+
+int gcare_estimate_subpatterns(gcare_estimator *e, const char *query_text,
+                               int iterations, uint64_t *masks,
+                               size_t *num_masks, size_t capacity,
+                               double *est, double *seconds) {
+  std::vector<std::string> text = query_lines(query_text);
+  if (text.empty() || iterations < 1)
+    return 1;
+  QueryParams params(iterations, e->seed, e->ratio, false);
+  std::vector<uint64_t> patterns(masks, masks + *num_masks);
+  bool all = patterns.empty();
+  if (all) {
+    // counted first, so that a short buffer costs no estimates
+    QueryText parsed;
+    parsed.ReadLines(text);
+    // the masks do not depend on the labels, so no mapping is needed
+    graph::QueryGraph q;
+    q.Read(parsed, 0);
+    patterns = q.ConnectedEdgeSets();
+    if (patterns.empty())
+      return 2;
+    *num_masks = patterns.size();
+    if (patterns.size() > capacity)
+      return 3;
+  }
+  std::vector<double> ests;
+  double time;
+  if (!e->runner->QuerySubpatterns(text, params, patterns, ests, time))
+    return 2;
+  if (all)
+    std::copy(patterns.begin(), patterns.end(), masks);
+  std::copy(ests.begin(), ests.end(), est);
+  if (seconds != nullptr)
+    *seconds = time;
+  return 0;
+}
@@ -0,0 +1,140 @@
+#include "../include/gpu_walk.h"
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <tuple>
+
+// the runtime calls used here, under their CUDA names
+#ifdef __HIPCC__
+#include <hip/hip_runtime.h>
+#define cudaError_t hipError_t
+#define cudaSuccess hipSuccess
+#define cudaGetDeviceCount hipGetDeviceCount
+#define cudaGetErrorString hipGetErrorString
+#define cudaGetLastError hipGetLastError
+#define cudaMalloc hipMalloc
+#define cudaFree hipFree
+#define cudaMemcpy hipMemcpy
+#define cudaMemcpyHostToDevice hipMemcpyHostToDevice
+#define cudaMemcpyDeviceToHost hipMemcpyDeviceToHost
+#else
+#include <cuda_runtime.h>
+#endif
+
+namespace {
+
+const int THREADS = 256;
+// join checks a plan of GPU_MAX_STEPS can have: two per shared vertex of a
+// pair of its steps
+const int MAX_CHECKS = 2 * GPU_MAX_STEPS * GPU_MAX_STEPS;
+
+bool Check(cudaError_t err, const char *what) {
+  if (err == cudaSuccess)
+    return true;
+  fprintf(stderr, "gpu walks: %s: %s\n", what, cudaGetErrorString(err));
+  return false;
+}
+
+__global__ void WalkKernel(WalkGraph g, const GpuStep *steps, int num_steps,
+                           const int *checks, int num_checks, int n,
+                           uint64_t seed, double *est) {
+  int w = blockIdx.x * blockDim.x + threadIdx.x;
+  if (w < n)
+    est[w] = RunWalk(g, steps, num_steps, checks, num_checks, seed, w);
+}
+
+} // namespace
+
+// one walker per loaded graph, told apart by where its arrays are and how
+// many there are of them; a graph that could not be uploaded is not tried
+// again
+GpuWalker *GpuWalker::For(const WalkGraph &g) {
+  static std::mutex lock;
+  static std::map<std::tuple<const void *, const void *, int64_t>,
+                  std::unique_ptr<GpuWalker>>
+      walkers;
+  std::lock_guard<std::mutex> guard(lock);
+  auto key = std::make_tuple((const void *)g.adj[0], (const void *)g.adj[1],
+                             g.num_adj[0] + g.num_adj[1]);
+  auto it = walkers.find(key);
+  if (it != walkers.end())
+    return it->second.get();
+  std::unique_ptr<GpuWalker> &walker = walkers[key];
+  int devices = 0;
+  if (!Check(cudaGetDeviceCount(&devices), "no device"))
+    return nullptr;
+  if (devices == 0) {
+    fprintf(stderr, "gpu walks: no device\n");
+    return nullptr;
+  }
+  walker.reset(new GpuWalker);
+  if (!walker->Upload(g))
+    walker.reset();
+  return walker.get();
+}
+
+GpuWalker::~GpuWalker() {
+  for (void *p : arrays_)
+    cudaFree(p);
+  cudaFree(plan_);
+  cudaFree(est_);
+}
+
+bool GpuWalker::Upload(const WalkGraph &g) {
+  device_ = g;
+  auto copy = [this](const int *host, int64_t n, const int **out) {
+    void *p = nullptr;
+    size_t bytes = sizeof(int) * (size_t)(n > 0 ? n : 1);
+    if (!Check(cudaMalloc(&p, bytes), "cannot hold the graph"))
+      return false;
+    arrays_.push_back(p);
+    *out = (const int *)p;
+    return n == 0 || Check(cudaMemcpy(p, host, sizeof(int) * (size_t)n,
+                                      cudaMemcpyHostToDevice),
+                           "upload");
+  };
+  for (int d = 0; d < 2; d++)
+    if (!copy(g.offset[d], g.vnum + 1, &device_.offset[d]) ||
+        !copy(g.label[d], g.num_labels[d], &device_.label[d]) ||
+        !copy(g.adj_offset[d], g.num_labels[d], &device_.adj_offset[d]) ||
+        !copy(g.adj[d], g.num_adj[d], &device_.adj[d]))
+      return false;
+  return copy(g.vl_offset, g.vnum + 1, &device_.vl_offset) &&
+         copy(g.vl, g.num_vl, &device_.vl) &&
+         copy(g.el_rel_offset, g.el_num + 1, &device_.el_rel_offset) &&
+         copy(g.el_rel, 2 * g.num_el_rel, &device_.el_rel) &&
+         copy(g.vl_rel_offset, g.vl_num + 1, &device_.vl_rel_offset) &&
+         copy(g.vl_rel, g.num_vl_rel, &device_.vl_rel) &&
+         Check(cudaMalloc(&plan_, sizeof(GpuStep) * GPU_MAX_STEPS +
+                                      sizeof(int) * 4 * MAX_CHECKS),
+               "plan");
+}
+
+bool GpuWalker::Walk(const GpuStep *steps, int num_steps, const int *checks,
+                     int num_checks, int n, uint64_t seed, double *est) {
+  if (num_steps > GPU_MAX_STEPS || num_checks > MAX_CHECKS)
+    return false;
+  std::lock_guard<std::mutex> guard(lock_);
+  if (n > capacity_) {
+    cudaFree(est_);
+    est_ = nullptr;
+    capacity_ = 0;
+    if (!Check(cudaMalloc((void **)&est_, sizeof(double) * n), "batch"))
+      return false;
+    capacity_ = n;
+  }
+  GpuStep *dev_steps = (GpuStep *)plan_;
+  int *dev_checks = (int *)(dev_steps + GPU_MAX_STEPS);
+  if (!Check(cudaMemcpy(dev_steps, steps, sizeof(GpuStep) * num_steps,
+                        cudaMemcpyHostToDevice), "plan") ||
+      (num_checks > 0 &&
+       !Check(cudaMemcpy(dev_checks, checks, sizeof(int) * 4 * num_checks,
+                         cudaMemcpyHostToDevice), "plan")))
+    return false;
+  WalkKernel<<<(n + THREADS - 1) / THREADS, THREADS>>>(
+      device_, dev_steps, num_steps, dev_checks, num_checks, n, seed, est_);
+  return Check(cudaGetLastError(), "launch") &&
+         Check(cudaMemcpy(est, est_, sizeof(double) * n, cudaMemcpyDeviceToHost),
+               "walks");
+}
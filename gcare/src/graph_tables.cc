@@ -0,0 +1,101 @@
+// The relational tables of a .graph binary (see relational::DataGraph::
+// ReadGraph), so that the relational estimators run on the graph data
+// without a .relation conversion of it next to it.
+#include "../include/data_graph.h"
+#include "../include/data_relations.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <omp.h>
+
+namespace relational {
+
+// Each edge table is the concatenation of the out-lists of its label, so
+// its rows are counted and filled from the CSR on their own, in parallel
+// over the labels; the converter then indexes them as it would its own.
+void DataGraph::ReadGraph(const char* dataname) {
+    graph::DataGraph gr;
+    gr.ReadBinary(dataname);
+    int n = gr.GetNumVertices();
+    // id in the graph -> input id
+    vector<int> input_id(n);
+    const vector<int>& vertex_map = gr.GetVertexMap();
+    for (int v = 0; v < n; v++) input_id[vertex_map.empty() ? v : vertex_map[v]] = v;
+    // input label -> label in the graph, -1 if it has no data there
+    auto labels = [](const LabelMap& map, int num) {
+        vector<int> ret;
+        if (map.empty()) {
+            for (int l = 0; l < num; l++) ret.push_back(l);
+        } else {
+            for (size_t l = 0; l < map.to.size(); l++) ret.push_back(map.to[l]);
+        }
+        return ret;
+    };
+    vector<int> els = labels(gr.GetELabelMap(), gr.GetNumELabels());
+    vector<int> vls = labels(gr.GetVLabelMap(), gr.GetNumVLabels());
+
+    g_.assign(1, CvtDataGraph());
+    CvtDataGraph& g = g_[0];
+    int num_el = els.size();
+    g.edge_offset.assign(num_el + 1, 0);
+    for (int l = 0; l < num_el; l++)
+        g.edge_offset[l + 1] = g.edge_offset[l] + (els[l] < 0 ? 0 : gr.GetNumEdges(els[l]));
+    g.edge_rows.resize(2 * g.edge_offset[num_el]);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int l = 0; l < num_el; l++) {
+        if (els[l] < 0) continue;
+        int* out = g.edge_rows.data() + 2 * g.edge_offset[l];
+        for (int v = 0; v < n; v++) {
+            range r = gr.GetAdj(v, els[l], true);
+            for (const int* p = r.begin; p != r.end; p++) {
+                *out++ = input_id[v];
+                *out++ = input_id[*p];
+            }
+        }
+    }
+    // graph label -> input label, for the label lists of the vertices
+    int num_vl = vls.size();
+    vector<int> vl_input(gr.GetNumVLabels() + 1, -1);
+    for (int l = 0; l < num_vl; l++)
+        if (vls[l] >= 0 && vls[l] < (int)vl_input.size()) vl_input[vls[l]] = l;
+    g.vertex_offset.assign(num_vl + 1, 0);
+    for (int v = 0; v < n; v++) {
+        range r = gr.GetVLabels(v);
+        for (const int* p = r.begin; p != r.end; p++)
+            if (*p < (int)vl_input.size() && vl_input[*p] >= 0) g.vertex_offset[vl_input[*p] + 1]++;
+    }
+    for (int l = 0; l < num_vl; l++) g.vertex_offset[l + 1] += g.vertex_offset[l];
+    g.vertex_rows.resize(g.vertex_offset[num_vl]);
+    vector<size_t> fill(g.vertex_offset.begin(), g.vertex_offset.end() - 1);
+    for (int v = 0; v < n; v++) {
+        range r = gr.GetVLabels(v);
+        for (const int* p = r.begin; p != r.end; p++)
+            if (*p < (int)vl_input.size() && vl_input[*p] >= 0)
+                g.vertex_rows[fill[vl_input[*p]]++] = input_id[v];
+    }
+    // the input vertices are in file order, so their values: ids 0 to n - 1
+    g.vnum = n;
+    g.num_values = n;
+    g.max_vid = std::max(n - 1, 0);
+    g.max_vlabel = std::max(num_vl - 1, 0);
+    g.max_elabel = std::max(num_el - 1, 0);
+    g.base = num_el;
+
+    MakeBinary();
+    UnloadFile(reinterpret_cast<char*>(container_), container_size_, load_mode_);
+    UnloadFile(reinterpret_cast<char*>(index_container_), index_size_, index_mode_);
+    UnloadFile(reinterpret_cast<char*>(map_container_), map_size_, index_mode_);
+    UnloadFile(reinterpret_cast<char*>(columns_container_), columns_size_, LOAD_MMAP);
+    columns_container_ = nullptr;
+    load_mode_ = index_mode_ = LOAD_COPY;
+    in_memory_ = true;
+    Make1DTable(dataname);
+    Make1DIndex(dataname);
+    in_memory_ = false;
+    graphs_.assign(1, GraphMeta{g.base, g.max_vid, g.max_vlabel, g.max_elabel, CountDistinct(g)});
+    ClearRawData();
+    SelectGraph(0);
+    BuildHashIndex();
+}
+
+}  // namespace relational
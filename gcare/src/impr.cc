@@ -2,7 +2,9 @@
 #include "../include/data_graph.h"
 #include "../include/query_graph.h"
 #include "../include/estimator.h"
+#include "../include/simd_search.h"
 
+#include <omp.h>
 #include <vector>
 #include <unordered_map>
 
@@ -10,6 +12,10 @@ using std::vector;
 using std::unordered_map;
 using std::pair;
 
+namespace graph {
+
+REGISTER_ESTIMATOR("impr", Impr);
+
 void Impr::PrepareSummaryStructure(DataGraph& g, double p) {
 }
 
@@ -18,9 +24,62 @@ void Impr::WriteSummary(const char* fn) {
 
 // Initialize variables
 void Impr::Init() {
-  // Impr can process 3,4,5 node queries
-  if (q->GetNumVertices() > 5) return;
+  // Impr can process queries of up to IMPR_MAX_VERTICES nodes
+  if (q->GetNumVertices() > IMPR_MAX_VERTICES) return;
+  const char* interleave = getenv("GCARE_INTERLEAVE");
+  interleave_ = interleave ? std::max(0, atoi(interleave)) : DEFAULT_INTERLEAVE;
+  // The embeddings, labels and beta only depend on the query's shape, so
+  // they are kept across runs of the same query
+  vector<int> shape(1, q->GetNumVertices());
+  for (int u = 0; u < q->GetNumVertices(); u++) {
+    for (auto p : q->GetAdj(u, true)) {
+      shape.push_back(u);
+      shape.push_back(p.first);
+      shape.push_back(p.second);
+    }
+  }
+  if (shape != shape_) {
+    PrepareShape();
+    shape_ = shape;
+  }
+  bound_.fill(-1);
+  vlabel_.fill(-1);
+  for (int u = 0; u < q->GetNumVertices(); u++) {
+    bound_[u] = q->GetBound(u);
+    vlabel_[u] = q->GetVLabel(u);
+  }
+  const char* chains = getenv("GCARE_IMPR_CHAINS");
+  //threads of iterations run in-process leave a single chain here
+  int num_chains = chains && !omp_in_parallel() ? std::max(1, atoi(chains)) : 1;
+  chains_.resize(num_chains);
+  for (Chain& c : chains_) {
+    c.xk.clear();
+    c.el.clear();
+    c.case_num.clear();
+    c.mask.resize(query_labels_.size());
+    c.step = 0;
+    c.rng = num_chains > 1 ? &c.own_rng : &rng_;
+    c.cards.clear();
+  }
+  steps_ = 0;
+  chain_cards_.clear();
+  chain_pos_ = 0;
+  chains_run_ = false;
+  int sum = 0;
+  for (size_t u = 0; u < q->GetNumVertices(); u++) {
+    for (auto& p : q->GetAdj(u, true)) {
+      int elabel = p.second;
+      sum += g->GetNumEdges(elabel);
+    }
+  }
+  // Compute the target number of steps as the sampling budget
+  s_num_ = sample_ratio * sum;
+}
+
+void Impr::PrepareShape() {
   pos_embs_.clear();
+  query_labels_.clear();
+  query_edges_.clear();
 	for (int start = 0; start < q->GetNumVertices(); start++) {
 		chk_.clear();
 		chk_.resize(q->GetNumVertices(), false);
@@ -33,28 +92,22 @@ void Impr::Init() {
     for (auto p : q->GetAdj(u, true)) {
       query_labels_.push_back(make_pair(p.second, true));
       query_labels_.push_back(make_pair(p.second, false));
+      query_edges_.push_back(Edge(u, p.first, p.second));
     }
   }
   std::sort(query_labels_.begin(), query_labels_.end());
   query_labels_.erase(std::unique(query_labels_.begin(), query_labels_.end()), query_labels_.end());
-  xk_.clear();
-  el_.clear();
-  case_num_.clear();
-  int sum = 0;
-  for (size_t u = 0; u < q->GetNumVertices(); u++) {
-    for (auto& p : q->GetAdj(u, true)) {
-      int elabel = p.second;
-      sum += g->GetNumEdges(elabel);
-    }
-  }
-  // Compute the target number of steps as the sampling budget
-  s_num_ = sample_ratio * sum;
+  edge_label_.clear();
+  for (auto& e : query_edges_)
+    edge_label_.push_back(std::lower_bound(query_labels_.begin(), query_labels_.end(),
+                                           make_pair(e.el, true)) - query_labels_.begin());
+  for (int u = 0; u < q->GetNumVertices(); u++)
+    for (int v = 0; v < q->GetNumVertices(); v++)
+      elabel_[u][v] = q->GetELabel(u, v);
   chk_.clear(); chk_.resize(q->GetNumVertices(), false);
   path_.clear();
   // Compute the beta value
   beta_ = GetBeta(0);
-  // step_ is the current number of steps during random walks
-  step_ = 0;
 }
 
 void Impr::ReadSummary(const char* fn) {
@@ -98,24 +151,61 @@ int  Impr::DecomposeQuery() {
 }
 
 bool Impr::GetSubstructure(int subgraph_idx) {
-  // Impr can processes 3,4,5 node queries
-  if (q->GetNumVertices() > 5 || beta_ == 0) {
+  if (q->GetNumVertices() > IMPR_MAX_VERTICES || beta_ == 0) {
     return false;
   }
-  if (el_.size() > 0) el_.erase(el_.begin());
-  if (xk_.size() > 0) xk_.erase(xk_.begin());
-  if (case_num_.size() > 0) case_num_.erase(case_num_.begin());
-  // Compute s_{i+1} from s_i, s_i == xk_
-  if (!GetNextSample(xk_, case_num_, el_, step_, s_num_)) {
+  if (chains_.size() > 1) {
+    if (!chains_run_) RunChains();
+    else chain_pos_++;
+    return chain_pos_ < chain_cards_.size();
+  }
+  Chain& c = chains_[0];
+  if (c.el.size() > 0) c.el.pop_front();
+  if (c.xk.size() > 0) c.xk.pop_front();
+  if (c.case_num.size() > 0) c.case_num.pop_front();
+  // Compute s_{i+1} from s_i, s_i == c.xk
+  [[maybe_unused]] int prev_step = c.step;
+  bool found = GetNextSample(c, s_num_);
+  GCARE_COUNT_N(walk_steps, c.step - prev_step);
+  if (!found) {
       return false;
   }
   // if it consumes all sampling budget, stop random walks
-  if (step_ >= s_num_) {
+  if (c.step >= s_num_) {
       return false;
   }
   return true;
 }
 
+// Each chain walks as a single one would, but adds the steps of each
+// sample to steps_ and goes on from the total, so that the chains stop
+// together once they took s_num_ steps in all. The estimates are kept
+// chain after chain; their mean is that of AggCard
+void Impr::RunChains() {
+  chains_run_ = true;
+  for (Chain& c : chains_) c.own_rng.Seed(rng_.Next());
+#pragma omp parallel for schedule(static, 1) num_threads(chains_.size())
+  for (size_t i = 0; i < chains_.size(); i++) {
+    Chain& c = chains_[i];
+    while (!DeadlinePassed()) {
+      if (c.el.size() > 0) c.el.pop_front();
+      if (c.xk.size() > 0) c.xk.pop_front();
+      if (c.case_num.size() > 0) c.case_num.pop_front();
+      int prev_step = c.step;
+      bool found = GetNextSample(c, s_num_);
+      GCARE_COUNT_N(walk_steps, c.step - prev_step);
+      c.step = steps_.fetch_add(c.step - prev_step) + c.step - prev_step;
+      if (!found || c.step >= s_num_) break;
+      prev_step = c.step;
+      c.cards.push_back(EstCardOf(c));
+      c.step = steps_.fetch_add(c.step - prev_step) + c.step - prev_step;
+    }
+  }
+  for (Chain& c : chains_)
+    chain_cards_.insert(chain_cards_.end(), c.cards.begin(), c.cards.end());
+  chain_pos_ = 0;
+}
+
 void Impr::DFS(int srcid) {
 	if (chk_[srcid]) return;
 	chk_[srcid] = true;
@@ -124,8 +214,11 @@ void Impr::DFS(int srcid) {
 		int sum = 0;
 		for (int x : qv_)
 			sum += x;
-		pos_embs_.push_back(qv_);
-		pos_embs_[pos_embs_.size() - 1].push_back((q->GetNumVertices() - 1) * q->GetNumVertices() / 2 - sum);
+		Mapping emb;
+		emb.fill(-1);
+		std::copy(qv_.begin(), qv_.end(), emb.begin());
+		emb[qv_.size()] = (q->GetNumVertices() - 1) * q->GetNumVertices() / 2 - sum;
+		pos_embs_.push_back(emb);
 		return;
 	}
 	for (pair<int, int>& e : q->GetAdj(srcid, true)) {
@@ -149,57 +242,85 @@ void Impr::DFS(int srcid) {
 }
 
 // Choose the next edge label to walk further
-pair<int, bool> Impr::ChooseELabel(int v, vector<pair<int, bool>>& cand, int& res, int& sum) {
-	sum = 0;
-	for (auto& p : cand) {
-    if (!g->HasELabel(v, p.first, p.second)) continue;
-    sum += g->GetAdjSize(v, p.first, p.second);
-	}
-	if (sum == 0) return make_pair(-1, -1);
-  int n = rand() % sum;
-	for (auto& p : cand) {
-    if (!g->HasELabel(v, p.first, p.second)) continue;
-    n -= g->GetAdjSize(v, p.first, p.second);
-    if (n < 0) {
-      res = *(g->GetAdj(v, p.first, p.second).begin + n + g->GetAdjSize(v, p.first, p.second));
-      return make_pair(p.first, p.second);
-    }
-	}
-	return make_pair(-1, -1);
+pair<int, bool> Impr::ChooseELabel(Rng& rng, int v, vector<pair<int, bool>>& cand, int& res, int& sum) {
+	//weighted by degree: a uniform neighbour over all candidate lists
+	int64_t total = 0;
+	int i = g->GetRandomAdj(v, cand, rng, &res, &total);
+	sum = total;
+	if (i == -1) return make_pair(-1, -1);
+	return cand[i];
 }
 
 double Impr::EstCard(int subgraph_index) {
-  assert(static_cast<int>(xk_.size()) == q->GetNumVertices() - 1);
-  is_duplicate_.clear();
+  if (chains_.size() > 1) return chain_cards_[chain_pos_];
+  return EstCardOf(chains_[0]);
+}
+
+double Impr::EstCardOf(Chain& c) {
+  switch (q->GetNumVertices()) {
+  case 3: return EstCardN<3>(c);
+  case 4: return EstCardN<4>(c);
+  case 5: return EstCardN<5>(c);
+  case 6: return EstCardN<6>(c);
+  case 7: return EstCardN<7>(c);
+  case 8: return EstCardN<8>(c);
+  default: return EstCardN<0>(c);
+  }
+}
+
+template <int N>
+double Impr::EstCardN(Chain& c) {
+  const int n = N > 0 ? N : q->GetNumVertices();
+  assert(static_cast<int>(c.xk.size()) == n - 1);
+  BuildMasks(c);
+  c.is_duplicate.clear();
   int f = 0;
-  for (size_t i = 0; i < pos_embs_.size(); i++) {
+  for (const Mapping& emb : pos_embs_) {
     bool dir = false;
-    int sum = 0, selected_el = -1;
-    int selected_v = Select(xk_, pos_embs_[i], dir, selected_el);
+    int selected_el = -1;
+    int selected_v = Select<N>(c.xk, emb, dir, selected_el);
     if (selected_v == -1) continue;
     assert(selected_el != -1);
     if (!g->HasELabel(selected_v, selected_el, dir)) continue;
-    for (auto r = g->GetAdj(selected_v, selected_el, dir); r.begin != r.end; r.begin++) {
-      int nbr = *r.begin;
-      xk_.push_back(nbr);
-      if (Check(xk_, pos_embs_[i], el_)) f++;
-      step_++;
-      xk_.pop_back();
+    // Check reads the lists of the query edges out of the new vertex at
+    // each neighbour; they are prefetched d and 2d neighbours ahead
+    c.out_el.clear();
+    for (auto& e : query_edges_)
+      if (e.src == emb[n - 1]) c.out_el.push_back(e.el);
+    range r = g->GetAdj(selected_v, selected_el, dir);
+    size_t size = r.end - r.begin, d = interleave_;
+    if (c.out_el.empty()) d = 0;
+    for (size_t j = 0; j < std::min(2 * d, size); j++)
+      for (int el : c.out_el) g->PrefetchAdj(r.begin[j], el, true);
+    for (size_t j = 0; j < size; j++) {
+      if (d > 0 && j + 2 * d < size)
+        for (int el : c.out_el) g->PrefetchAdj(r.begin[j + 2 * d], el, true);
+      if (d > 0 && j + d < size)
+        for (int el : c.out_el) g->PrefetchAdjList(r.begin[j + d], el, true);
+      int nbr = r.begin[j];
+      c.xk.push_back(nbr);
+      if (Check<N>(c, emb)) f++;
+      c.step++;
+      c.xk.pop_back();
     }
   }
-  double inv_w = GetWeight(xk_) / (2 * g->GetNumEdges()) * beta_;
+  double inv_w = GetWeight(c) / (2 * g->GetNumEdges()) * beta_;
   assert(beta_ > 0);
   assert(inv_w > 0);
   return static_cast<double>(f) / inv_w;
 }
 
-// Compute s_{i+1} from s_i, s_i == xk
-bool Impr::GetNextSample(vector<int>& xk, vector<int>& case_num, vector<pair<int, bool>>& el, int& step, int s_num) {
+// Compute s_{i+1} from s_i, s_i == c.xk
+bool Impr::GetNextSample(Chain& c, int s_num) {
+	WalkWindow<int>& xk = c.xk;
+	WalkWindow<int>& case_num = c.case_num;
+	WalkWindow<pair<int, bool>>& el = c.el;
+	int& step = c.step;
 	if (el.size() == 0) el.clear();
 	int sum = 0, cnt = 0;
   // if there is no vertex in s_i, insert a vertex chosen randomly
 	if (xk.size() == 0) {
-    int x = rand() % g->GetNumVertices();
+    int x = c.rng->Uniform(g->GetNumVertices());
 		xk.push_back(x);
 		case_num.push_back(-1);
 		step++;
@@ -207,24 +328,24 @@ bool Impr::GetNextSample(vector<int>& xk, vector<int>& case_num, vector<pair<int
 	while (static_cast<int>(xk.size()) < q->GetNumVertices() - 1 && step < s_num) {
 		xk.push_back(-1);
     // Choose edge label to walk further
-		el.push_back(ChooseELabel(xk[xk.size() - 2], query_labels_, xk[xk.size() - 1], sum));
+		el.push_back(ChooseELabel(*c.rng, xk[xk.size() - 2], query_labels_, xk[xk.size() - 1], sum));
 		case_num.push_back(sum);
 		step++;
-		if (el[el.size() - 1].first == -1) {
+		if (el.back().first == -1) {
 			assert(xk.size() > 1);
 			xk.pop_back();
 			case_num.pop_back();
 			el.pop_back();
-			if (xk.size() > 0) xk.erase(xk.begin());
-			if (case_num.size() > 0) case_num.erase(case_num.begin());
-			if (el.size() > 0) el.erase(el.begin());
+			if (xk.size() > 0) xk.pop_front();
+			if (case_num.size() > 0) case_num.pop_front();
+			if (el.size() > 0) el.pop_front();
 			if (xk.size() == 0) {
 				cnt++;
 				if (cnt > 0.1 * g->GetNumVertices()) {
 					return false;
 				}
 				assert(g->GetNumVertices() > 0);
-				xk.push_back(rand() % g->GetNumVertices());
+				xk.push_back(c.rng->Uniform(g->GetNumVertices()));
 				step++;
 				case_num.push_back(-1);
 			}
@@ -234,67 +355,74 @@ bool Impr::GetNextSample(vector<int>& xk, vector<int>& case_num, vector<pair<int
 }
 
 // Check the matching conditions
-bool Impr::Check(vector<int>& v, vector<int>& u, vector<pair<int, bool>>& el) {
-	vector<int> mapping(u.size());
-  int cnt = 0;
-  vector<bool> chk(v.size() - 2, false);
-	for (size_t i = 0; i < u.size(); i++) {
+template <int N>
+bool Impr::Check(Chain& c, const Mapping& u) {
+  const int n = N > 0 ? N : q->GetNumVertices();
+  WalkWindow<int>& v = c.xk;
+  WalkWindow<pair<int, bool>>& el = c.el;
+	Mapping mapping, pos;
+  mapping.fill(-1);
+  int num_chk = n - 2;
+	for (int i = 0; i < n; i++) {
 		mapping[u[i]] = v[i];
+		pos[u[i]] = i;
 	}
-  if (is_duplicate_[mapping]) return false;
-	for (size_t i = 0; i < q->GetNumVertices(); i++) {
+  auto dup = std::lower_bound(c.is_duplicate.begin(), c.is_duplicate.end(), mapping);
+  if (dup != c.is_duplicate.end() && *dup == mapping) return false;
+	for (int i = 0; i < n; i++) {
     // Check binded data vertex
-		if (q->GetBound(i) != -1 && mapping[i] != q->GetBound(i)) return false;
+		if (bound_[i] != -1 && mapping[i] != bound_[i]) return false;
     // Check vertex label
-		if (q->GetVLabel(i) != -1
-      && !binary_search(g->GetVLabels(mapping[i]).begin, g->GetVLabels(mapping[i]).end, q->GetVLabel(i))) return false;
-		for (auto& p : q->GetAdj(i, true)) {
-			int dstid = p.first;
-			int elabel = p.second;
-			int from = mapping[i];
-			int to = mapping[dstid];
-      if (!binary_search(g->GetAdj(from, elabel, true).begin, g->GetAdj(from, elabel, true).end, to)) return false;
-      for (int j = 0; j < static_cast<int>(v.size()) - 2; j++) {
-        if (chk[j]) continue;
-        int elabel = el[j].first;
-        bool dir = el[j].second;
-        if ((dir && v[j] == from && v[j + 1] == to
-          && binary_search(g->GetAdj(v[j], elabel, true).begin,
-          g->GetAdj(v[j], elabel, true).end, v[j + 1]))
-          || (!dir && v[j] == to && v[j + 1] == from
-          && binary_search(g->GetAdj(v[j + 1], elabel, true).begin,
-          g->GetAdj(v[j + 1], elabel, true).end, v[j]))) {
-          chk[j] = true;
-          cnt++;
-          break;
-        }
+		if (vlabel_[i] != -1
+      && !Contains(g->GetVLabels(mapping[i]), vlabel_[i])) return false;
+  }
+  // Walk edge j joins v[j] and v[j + 1] and exists by construction; every
+  // one of them has to be covered by a distinct query edge. chk has bit j
+  // set once walk edge j is covered
+  uint32_t chk = 0, all = (1u << num_chk) - 1;
+  for (size_t k = 0; k < query_edges_.size(); k++) {
+    const Edge& e = query_edges_[k];
+    int a = pos[e.src], b = pos[e.dst];
+    int from = v[a], to = v[b];
+    // only edges at the new vertex, v[n - 1], are not in the masks
+    if (a < n - 1 && b < n - 1 ? !(c.mask[edge_label_[k]][a] >> b & 1)
+        : !Contains(g->GetAdj(from, e.el, true), to)) return false;
+    for (int j = 0; j < num_chk; j++) {
+      if (chk >> j & 1) continue;
+      if (el[j].second ? v[j] == from && v[j + 1] == to
+          : v[j] == to && v[j + 1] == from) {
+        chk |= 1u << j;
+        break;
       }
-		}
-	}
-  if (cnt != chk.size()) return false;
-  return (is_duplicate_[mapping] = true);
+    }
+  }
+  if (chk != all) return false;
+  c.is_duplicate.insert(dup, mapping);
+  return true;
 }
 
 // Select the vertex to refer its adjacency list
-int Impr::Select(vector<int>& xk, vector<int>& qv, bool& dir, int& selected_el) {
+template <int N>
+int Impr::Select(WalkWindow<int>& xk, const Mapping& qv, bool& dir, int& selected_el) {
+  const int n = N > 0 ? N : q->GetNumVertices();
 	int res = -1;
-	int to = qv[qv.size() - 1];
+	int to = qv[n - 1];
 	size_t min = 999999999;
-	for (size_t i = 0; i < xk.size(); i++) {
+	for (int i = 0; i < n - 1; i++) {
 		int from = qv[i];
-		if (q->GetELabel(from, to) != -1) { // dir == true
-			if (min > g->GetAdjSize(xk[i], q->GetELabel(from, to), true) &&
-					g->GetAdjSize(xk[i], q->GetELabel(from, to), true) > 0) {
-				min = g->GetAdjSize(xk[i], q->GetELabel(from, to), true);
-				selected_el = q->GetELabel(from, to);
+		if (elabel_[from][to] != -1) { // dir == true
+			size_t size = g->GetAdjSize(xk[i], elabel_[from][to], true);
+			if (min > size && size > 0) {
+				min = size;
+				selected_el = elabel_[from][to];
 				dir = true;
 				res = xk[i];
 			}
-		} else if (q->GetELabel(to, from) != -1) {
-			if (min > g->GetAdjSize(xk[i], q->GetELabel(to, from), false) &&
-					g->GetAdjSize(xk[i], q->GetELabel(to, from), false) > 0) {
-				min = g->GetAdjSize(xk[i], q->GetELabel(to, from), false);
-				selected_el = q->GetELabel(to, from);
+		} else if (elabel_[to][from] != -1) {
+			size_t size = g->GetAdjSize(xk[i], elabel_[to][from], false);
+			if (min > size && size > 0) {
+				min = size;
+				selected_el = elabel_[to][from];
 				dir = false;
 				res = xk[i];
 			}
@@ -303,50 +431,59 @@ int Impr::Select(vector<int>& xk, vector<int>& qv, bool& dir, int& selected_el)
 	return res;
 }
 
-// Compute the weight W(s_i)
-double Impr::GetWeight(vector<int>& xk) {
-  chk_.clear(); chk_.resize(xk.size(), false);
-  sum_ = 0.0;
-  size_ = 0;
-  for (size_t start = 0; start < xk.size(); start++) {
-    std::fill(chk_.begin(), chk_.end(), false);
-    FindPaths(start, xk, 0, 1.0);
+// One search of each list of each vertex of the sample for all the others
+void Impr::BuildMasks(Chain& c) {
+  WalkWindow<int>& xk = c.xk;
+  int k = xk.size();
+  int targets[IMPR_MAX_VERTICES];
+  bool found[IMPR_MAX_VERTICES];
+  for (int i = 0; i < k; i++) targets[i] = xk[i];
+  for (auto& m : c.mask) m.fill(0);
+  c.nbrs.fill(0);
+  for (size_t l = 0; l < query_labels_.size(); l++) {
+    int el = query_labels_[l].first;
+    bool dir = query_labels_[l].second;
+    for (int i = 0; i < k; i++) {
+      range adj = g->GetAdj(xk[i], el, dir);
+      c.nbrs[i] += adj.end - adj.begin;
+      ContainsBatch(adj, targets, k, found);
+      for (int j = 0; j < k; j++)
+        c.mask[l][i] |= (uint32_t) found[j] << j;
+    }
   }
-  assert(size_ > 0);
-  return static_cast<double>(sum_) / size_;
 }
 
-void Impr::FindPaths(int i, vector<int>& xk, int cnt, double pr) {
+// Compute the weight W(s_i)
+double Impr::GetWeight(Chain& c) {
+  c.sum = 0.0;
+  c.size = 0;
+  for (int start = 0; start < c.xk.size(); start++)
+    FindPaths(c, start, 0, 0, 1.0);
+  assert(c.size > 0);
+  return static_cast<double>(c.sum) / c.size;
+}
+
+// Paths through the sample from vertex i, visited being the vertices on the
+// path so far, as bits
+void Impr::FindPaths(Chain& c, int i, uint32_t visited, int cnt, double pr) {
   if (cnt == q->GetNumVertices() - 2) {
-    size_++;
-    sum_ += pr;
+    c.size++;
+    c.sum += pr;
     return;
   }
-  chk_[i] = true;
-  int num_nbrs = 0;
-  for (auto p : query_labels_) {
-    int el = p.first;
-    bool dir = p.second;
-    num_nbrs += g->GetAdjSize(xk[i], el, dir);
-  }
-  if (cnt == 0) num_nbrs = 1;
-  for (auto p : query_labels_) {
-    int el = p.first;
-    bool dir = p.second;
-    for (size_t j = 0; j < chk_.size(); j++) {
-      if (chk_[j] || !binary_search(g->GetAdj(xk[i], el, dir).begin,
-        g->GetAdj(xk[i], el, dir).end,
-        xk[j])) continue;
+  visited |= 1u << i;
+  int num_nbrs = cnt == 0 ? 1 : c.nbrs[i];
+  for (size_t l = 0; l < query_labels_.size(); l++) {
+    for (uint32_t m = c.mask[l][i] & ~visited; m != 0; m &= m - 1) {
       assert(num_nbrs > 0);
-      FindPaths(j, xk, cnt + 1, pr * 1.0 / num_nbrs);
-      chk_[j] = false;
+      FindPaths(c, __builtin_ctz(m), visited, cnt + 1, pr * 1.0 / num_nbrs);
     }
   }
 }
 
 // Impr uses average for aggregation
 double Impr::AggCard() {
-  if (q->GetNumVertices() > 5 || beta_ == 0) return -1.0;
+  if (q->GetNumVertices() > IMPR_MAX_VERTICES || beta_ == 0) return -1.0;
   if (card_vec_.size() == 0) return 0.0;
   double res = 0.0;
   for (double card : card_vec_)
@@ -354,7 +491,13 @@ double Impr::AggCard() {
   return res / card_vec_.size();
 }
 
+double Impr::AggVariance() {
+  if (q->GetNumVertices() > IMPR_MAX_VERTICES || beta_ == 0) return -1.0;
+  return Estimator::AggVariance();
+}
+
 double Impr::GetSelectivity() {
   return 1.0;
 }
 
+}  // namespace graph
@@ -1,13 +1,26 @@
+#include <algorithm>
 #include <cassert>
+#include <limits>
+#include <omp.h>
+#include <unordered_map>
+#include <boost/functional/hash.hpp>
 #include "../include/jsub.h"
 
+namespace graph {
+
+REGISTER_ESTIMATOR("jsub", JSUB);
+
 void JSUB::PrepareSummaryStructure(DataGraph& g, double p) {
+    strata_.Build(g);
 }
 
 void JSUB::WriteSummary(const char* fn) {
+    strata_.Write(fn);
 }
 
+//summaries of earlier versions were empty: sample uniformly then
 void JSUB::ReadSummary(const char* fn) {
+    strata_.Read(fn);
 }
 
 void JSUB::Init() {
@@ -15,14 +28,11 @@ void JSUB::Init() {
     dp_time_ = num_est_card_ = num_memoi_ = r1_tuple_idx_ = 0;
     offset_ = g->GetNumELabels();
 
-    visited_.clear();
-    adj_.clear();
-    node_to_v_.clear();
-    counterparts_.clear();
-    plans_.clear();
-    counterpart_.clear();
-    plan_.clear();
-    w_.clear();
+    Fresh(adj_);
+    Fresh(node_to_v_);
+    Fresh(counterparts_);
+    Fresh(plans_);
+    Fresh(plan_trials_);
 
     //set sample size
     int sum = 0;
@@ -43,7 +53,46 @@ void JSUB::Init() {
     sample_size_ *= sample_ratio;
     node_num_ = offset_ + e_cnt;
     adj_.resize(node_num_);
-    w_.resize(node_num_);
+    const char* threads = getenv("GCARE_JSUB_THREADS");
+    //threads of iterations run in-process leave a single one here
+    num_threads_ = threads && !omp_in_parallel() ? std::max(1, atoi(threads)) : 1;
+    const char* shared = getenv("GCARE_JSUB_SHARED_MEMO");
+    shared_on_ = num_threads_ > 1 && shared && atoi(shared) == 1;
+    const char* memo_mb = getenv("GCARE_JSUB_MEMO_MB");
+    memo_bytes_ = memo_mb ? (size_t)std::max(atoll(memo_mb), 0LL) << 20 : 0;
+    //keep the tables' slots from the previous run, only empty them (and
+    //down to the budget)
+    shards_.resize(num_threads_);
+    for (auto& shard : shards_) {
+        shard.w.resize(node_num_);
+        for (auto& w : shard.w) {
+            w.Clear();
+            w.SetClock(memo_bytes_ > 0);
+        }
+        if (memo_bytes_ > 0)
+            trimMemo(shard.w);
+    }
+    shared_w_.Clear();
+    shared_w_.SetClock(memo_bytes_ > 0);
+    batch_card_.clear();
+    batch_pos_ = 0;
+    batch_last_ = false;
+    const char* filter = getenv("GCARE_CAND_FILTER");
+    filter_on_ = filter && atoi(filter) == 1;
+    const char* strata = getenv("GCARE_WJ_STRATA");
+    //the strata number the edges of the binary the summary was built on
+    strata_on_ = !strata_.Empty() && !(strata && atoi(strata) == 0) && g->NumUpdates() == 0;
+    const char* anchor = getenv("GCARE_WJ_ANCHOR");
+    anchor_on_ = !(anchor && atoi(anchor) == 0);
+    pool_on_ = StartPool::Enabled();
+    start_streams_.assign(node_num_, StartPool::Stream());
+    const char* interleave = getenv("GCARE_INTERLEAVE");
+    interleave_ = interleave ? std::max(0, atoi(interleave)) : DEFAULT_INTERLEAVE;
+    plan_cache_mode_ = PlanCache::ModeFromEnv();
+    node_tuples_.assign(node_num_, vector<int>());
+    node_tuples_built_.assign(node_num_, false);
+    if (filter_on_)
+        filter_.Build(*g, *q);
     
     //similar to WanderJoin
     for (int i = 0; i < node_num_; i++) {
@@ -121,74 +170,228 @@ void JSUB::Init() {
     }
 }
 
-void JSUB::generateWalkPlans(int cnt) {
-    if (sample_cnt_ == 0) {
-        return;
+namespace {
+
+//nodes from which the start nodes are enumerated in parallel
+const int PARALLEL_PLAN_NODES = 8;
+
+//Enumerates the walk plans of one start node, at most max_plans of them:
+//the orders of the nodes in which every node shares a column with one
+//before it, depth first and trying the nodes in ascending order. A node
+//joins the first node before it that it shares a column with, and is left
+//out of the plan if it shares a second column of its own (it closes a
+//cycle). Prefixes that hold the same nodes, joined the same way, and in
+//which every other node would join the same way end in the same plan
+//suffixes, so each such state is expanded once: met again, it appends the
+//suffixes found under it to the current prefix. The plans and their order
+//are those of a full expansion.
+class PlanEnumerator {
+public:
+    typedef std::pmr::vector<std::pmr::vector<tuple<int, int, int>>> Adj;
+
+    struct Plan {
+        vector<pair<int, int>> plan, counterpart;
+    };
+
+    PlanEnumerator(const Adj& adj, size_t max_plans)
+        : adj_(adj), n_(adj.size()), left_(max_plans) {}
+
+    void Run(int start, vector<Plan>& plans) {
+        plans_ = &plans;
+        join_.assign(n_, Join());
+        in_.assign(n_, false);
+        depth_ = 0;
+        prefix_ = Plan();
+        prefix_.plan.push_back(make_pair(start, -1));
+        prefix_.counterpart.push_back(make_pair(-1, -1));
+        append(start);
+        expand();
     }
-    if (cnt == node_num_ - 1) {
-        sample_cnt_--;
-        plan_.clear();
-        plan_.push_back(make_pair(seq_[0], -1));
-        counterpart_.clear();
-        counterpart_.push_back(make_pair(-1, -1));
-
-        for (int pos1 = 1; pos1 < node_num_; pos1++) {
-            int i = seq_[pos1];
-            bool acyclic = true; 
-            int connected_col = -1;
-            pair<int, int> prev(-1, -1);
-            for (int pos2 = 0; pos2 < pos1; pos2++) {
-                int j = seq_[pos2];
-                for (auto k : adj_[i]) {
-                    if (get<1>(k) == j) { //node i and j is connected
-                        if (connected_col == -1) {
-                            connected_col = get<0>(k);
-                            prev = make_pair(j, get<2>(k));
-                        } else if (connected_col != get<0>(k))
-                            acyclic = false;
-                    }
+
+private:
+    //how a node joins: the node and column before it, its own column, and
+    //whether it shares a second column
+    struct Join {
+        int prev = -1, prev_col = -1, col = -1;
+        bool cyclic = false;
+    };
+
+    //the plans a state ended in, plans_[first, last), and the length of
+    //their prefix up to the state
+    struct Suffixes {
+        size_t first, last, entries;
+    };
+
+    void append(int j) {
+        in_[j] = true;
+        depth_++;
+        for (int i = 0; i < n_; i++) {
+            if (in_[i])
+                continue;
+            for (auto& k : adj_[i]) {
+                if (get<1>(k) != j)
+                    continue;
+                Join& join = join_[i];
+                if (join.col == -1) {
+                    join.col = get<0>(k);
+                    join.prev = j;
+                    join.prev_col = get<2>(k);
+                } else if (join.col != get<0>(k)) {
+                    join.cyclic = true;
                 }
             }
-            if (acyclic) {
-				plan_.push_back(make_pair(i, connected_col));
-                counterpart_.push_back(prev);
-            }
         }
-        plans_.push_back(plan_);
-        counterparts_.push_back(counterpart_);
+    }
 
-		return;
+    vector<int> state() const {
+        vector<int> key;
+        key.reserve(5 * n_);
+        for (int i = 0; i < n_; i++) {
+            const Join& join = join_[i];
+            key.push_back(in_[i] ? 1 : 0);
+            key.push_back(join.prev);
+            key.push_back(join.prev_col);
+            key.push_back(join.col);
+            key.push_back(join.cyclic ? 1 : 0);
+        }
+        return key;
     }
-    for (int i = 0; i < node_num_; i++) {
-        if (visited_[i])
-            continue;
-        for (auto n : adj_[i]) {
-            int j = get<1>(n); 
-            if (visited_[j]) {
-                visited_[i] = true;
-                seq_[cnt + 1] = i;
-                generateWalkPlans(cnt + 1);
-                visited_[i] = false;
-                seq_[cnt + 1] = -1;
-                break;
+
+    void expand() {
+        if (left_ == 0)
+            return;
+        vector<int> key = state();
+        auto found = seen_.find(key);
+        if (found != seen_.end()) {
+            Suffixes s = found->second;
+            for (size_t p = s.first; p < s.last && left_ > 0; p++, left_--) {
+                Plan plan = prefix_;
+                const Plan& suffix = (*plans_)[p];
+                plan.plan.insert(plan.plan.end(), suffix.plan.begin() + s.entries, suffix.plan.end());
+                plan.counterpart.insert(plan.counterpart.end(),
+                                        suffix.counterpart.begin() + s.entries, suffix.counterpart.end());
+                plans_->push_back(std::move(plan));
+            }
+            return;
+        }
+        Suffixes s = {plans_->size(), 0, prefix_.plan.size()};
+        if (depth_ == n_) {
+            plans_->push_back(prefix_);
+            left_--;
+        } else {
+            vector<Join> saved = join_;
+            for (int i = 0; i < n_ && left_ > 0; i++) {
+                if (in_[i] || join_[i].col == -1)
+                    continue;
+                bool acyclic = !join_[i].cyclic;
+                if (acyclic) {
+                    prefix_.plan.push_back(make_pair(i, join_[i].col));
+                    prefix_.counterpart.push_back(make_pair(join_[i].prev, join_[i].prev_col));
+                }
+                append(i);
+                expand();
+                in_[i] = false;
+                depth_--;
+                join_ = saved;
+                if (acyclic) {
+                    prefix_.plan.pop_back();
+                    prefix_.counterpart.pop_back();
+                }
             }
         }
+        s.last = plans_->size();
+        seen_.emplace(std::move(key), s);
     }
+
+    const Adj& adj_;
+    int n_;
+    size_t left_;
+    vector<Join> join_;
+    vector<bool> in_;
+    int depth_;
+    Plan prefix_;
+    std::unordered_map<vector<int>, Suffixes, boost::hash<vector<int>>> seen_;
+    vector<Plan>* plans_;
+};
+
+//a plan's start node and its joins, sorted: the same for every order of
+//one join tree
+vector<int> treeKey(const PlanEnumerator::Plan& p) {
+    vector<array<int, 4>> joins;
+    for (size_t pos = 1; pos < p.plan.size(); pos++)
+        joins.push_back({p.plan[pos].first, p.plan[pos].second,
+                         p.counterpart[pos].first, p.counterpart[pos].second});
+    std::sort(joins.begin(), joins.end());
+    vector<int> key(1, p.plan[0].first);
+    for (auto& j : joins)
+        key.insert(key.end(), j.begin(), j.end());
+    return key;
 }
 
+}  // namespace
+
+//the plans of the start nodes in turn, sample_size_ of them at most over
+//all before duplicates are dropped, in the order DecomposeQuery tries
+//them. Nodes whose tuples are drawn through a bound vertex start first,
+//each in node order. Every start node is enumerated as if it came first, in
+//parallel for large queries, and the lists are cut in start order. Of the
+//plans that walk the same join tree in another order only the first is
+//kept, their walks drawing alike; it gets their trials instead
 void JSUB::generateWalkPlans() {
-    for (int s = 0; s < node_num_; s++) {
-        visited_.clear();
-        seq_.clear();
-        visited_.resize(node_num_, false);
-        seq_.resize(node_num_, -1);
-        visited_[s] = true;
-        seq_[0] = s;
-        generateWalkPlans(0);
+    vector<int> starts;
+    for (int s = 0; s < node_num_; s++)
+        if (anchor_on_ && anchored(s))
+            starts.push_back(s);
+    for (int s = 0; s < node_num_; s++)
+        if (!(anchor_on_ && anchored(s)))
+            starts.push_back(s);
+    size_t max_plans = std::max(sample_size_, 0);
+    vector<vector<PlanEnumerator::Plan>> found(node_num_);
+#pragma omp parallel for schedule(dynamic, 1) if (node_num_ >= PARALLEL_PLAN_NODES)
+    for (int k = 0; k < node_num_; k++) {
+        PlanEnumerator enumerator(adj_, max_plans);
+        enumerator.Run(starts[k], found[k]);
+    }
+    size_t left = max_plans;
+    std::unordered_map<vector<int>, int, boost::hash<vector<int>>> trees;
+    for (auto& plans : found) {
+        for (size_t p = 0; p < plans.size() && left > 0; p++, left--) {
+            auto tree = trees.emplace(treeKey(plans[p]), plans_.size());
+            if (!tree.second) {
+                plan_trials_[tree.first->second]++;
+                continue;
+            }
+            plans_.emplace_back(plans[p].plan.begin(), plans[p].plan.end());
+            counterparts_.emplace_back(plans[p].counterpart.begin(), plans[p].counterpart.end());
+            plan_trials_.push_back(1);
+        }
+    }
+}
+
+//the walk plans of the query, from the plan cache under key if an earlier
+//run of this structure generated them (no cache for an empty key)
+void JSUB::loadPlans(const string& key) {
+    PlanCache::Entry* cached = key.empty() ? nullptr : plan_cache_.Find(key);
+    if (cached != nullptr) {
+        for (size_t p = 0; p < cached->plans.size(); p++) {
+            plans_.emplace_back(cached->plans[p].begin(), cached->plans[p].end());
+            counterparts_.emplace_back(cached->counterparts[p].begin(), cached->counterparts[p].end());
+        }
+        plan_trials_.assign(cached->trials.begin(), cached->trials.end());
+        return;
     }
+    generateWalkPlans();
+    if (key.empty())
+        return;
+    PlanCache::Entry& entry = plan_cache_.Insert(key);
+    for (size_t p = 0; p < plans_.size(); p++) {
+        entry.plans.emplace_back(plans_[p].begin(), plans_[p].end());
+        entry.counterparts.emplace_back(counterparts_[p].begin(), counterparts_[p].end());
+    }
+    entry.trials.assign(plan_trials_.begin(), plan_trials_.end());
 }
 
-bool JSUB::checkBoundedVertices(int node, vector<int> t) {
+bool JSUB::checkBoundedVertices(int node, const array<int, 2>& t) {
 	if (node >= offset_) {
 		auto e = q->GetEdge(node - offset_);
 		if (q->GetBound(e.src) >= 0 && q->GetBound(e.src) != t[0])
@@ -213,7 +416,25 @@ int JSUB::nodeToOffset(int node) {
     }
 }
 
+//candidate tuples of a node, as (v, v) for a vertex node
+const vector<int>& JSUB::nodeTuples(int node) {
+	if (!node_tuples_built_[node]) {
+		node_tuples_built_[node] = true;
+		if (node >= offset_) {
+			auto e = q->GetEdge(node - offset_);
+			filter_.Tuples(e.el, e.src, e.dst, node_tuples_[node]);
+		} else {
+			int u = node_to_v_[node];
+			filter_.Tuples(q->GetVLabel(u), u, -1, node_tuples_[node]);
+		}
+	}
+	return node_tuples_[node];
+}
+
 bool JSUB::checkLabelStatistics(int node) { 
+	//no candidate tuple: the query has no match
+	if (filter_on_ && nodeTuples(node).empty())
+		return false;
 	if (node >= offset_) { 
 		auto e = q->GetEdge(node - offset_);
 		if (g->GetNumEdges(e.el) == 0) {
@@ -229,35 +450,88 @@ bool JSUB::checkLabelStatistics(int node) {
 	return true;
 }
 
+//whether a query vertex of node is bound
+bool JSUB::anchored(int node) {
+	if (node >= offset_) {
+		auto e = q->GetEdge(node - offset_);
+		return q->GetBound(e.src) >= 0 || q->GetBound(e.dst) >= 0;
+	}
+	return q->GetBound(node_to_v_[node]) >= 0;
+}
+
+//a tuple of anchored node into t through its bound vertex: the other end
+//is uniform over the vertex's list, so the inverse probability is the
+//length of that list (1 for a vertex or an edge with both ends bound); 0
+//if there is none
+double JSUB::anchorTuple(int node, array<int, 2>& t) {
+	int n = g->GetNumVertices();
+	if (node < offset_) {
+		int u = node_to_v_[node];
+		t = {q->GetBound(u), -1};
+		return t[0] < n && g->HasVLabel(t[0], q->GetVLabel(u)) ? 1 : 0;
+	}
+	auto e = q->GetEdge(node - offset_);
+	int src = q->GetBound(e.src), dst = q->GetBound(e.dst);
+	if (src >= n || dst >= n)
+		return 0;
+	if (src >= 0 && dst >= 0) {
+		t = {src, dst};
+		return g->HasEdge(src, dst, e.el, true) ? 1 : 0;
+	}
+	bool dir = src >= 0;
+	int v = dir ? src : dst, other;
+	int size = g->GetRandomAdj(v, e.el, dir, rng_, &other);
+	t = dir ? array<int, 2>{v, other} : array<int, 2>{other, v};
+	return size;
+}
+
 //sample from the first node in the walk plan
 //returns inverse probability
-int JSUB::sampleTuple(int node) { 
+double JSUB::sampleTuple(int node) { 
+    GCARE_COUNT(walk_steps);
     assert(sampled_tuples_.size() == 0);
-	int ret;
-	if (node >= offset_) {
+	double ret;
+	array<int, 2> t = {-1, -1};
+	if (anchor_on_ && !filter_on_ && anchored(node)) {
+		ret = anchorTuple(node, t);
+	} else if (filter_on_) {
+		auto& c = nodeTuples(node);
+		int i = rng_.Uniform(c.size() / 2);
+		t = {c[2 * i], node >= offset_ ? c[2 * i + 1] : -1};
+		ret = c.size() / 2;
+	} else if (node >= offset_ && strata_on_) {
+		auto e = q->GetEdge(node - offset_);
+		ret = strata_.Sample(*g, e.el, rng_, t.data());
+	} else if (pool_on_) {
+		bool edge = node >= offset_;
+		int label = edge ? q->GetEdge(node - offset_).el : q->GetVLabel(node_to_v_[node]);
+		StartPool::Stream& s = start_streams_[node];
+		if (!s.IsOpen())
+			s = StartPool::Open(*g, edge, label, StartPool::StreamOf(seed_, node));
+		s.Next(t.data());
+		if (!edge)
+			t[1] = -1;
+		ret = edge ? g->GetNumEdges(label) : g->GetNumVertices(label);
+	} else if (node >= offset_) {
 		auto e = q->GetEdge(node - offset_);
-		vector<int> t = g->GetRandomEdge(e.el);
-		sampled_tuples_.push_back(t);
+		g->GetRandomEdge(e.el, rng_, t.data());
 		ret = g->GetNumEdges(e.el);
 	} else {
 		int u = node_to_v_[node];
 		int vl = q->GetVLabel(u);
         assert(vl != -1);
-		vector<int> t = g->GetRandomVertex(vl); 
-        assert(t.size() == 1);
-        t.push_back(-1);
-        assert(t.size() == 2);
-		sampled_tuples_.push_back(t);
+		g->GetRandomVertex(vl, rng_, t.data());
 		ret = g->GetNumVertices(vl);
-        assert(sampled_tuples_.size() == 1);
-        assert(sampled_tuples_[0].size() == 2);
 	}
+	sampled_tuples_.push_back(t);
 	return ret;
 }
 
 int JSUB::getR1TupleNum(int node) {
     int ret;
-	if (node >= offset_) {
+	if (filter_on_) {
+		return nodeTuples(node).size() / 2;
+	} else if (node >= offset_) {
 		auto e = q->GetEdge(node - offset_);
 		return g->GetNumEdges(e.el);
 	} else {
@@ -273,24 +547,24 @@ int JSUB::getR1TupleNum(int node) {
 int JSUB::getNextTuple(int node) { 
     assert(sampled_tuples_.size() == 0);
 	int ret;
-	if (node >= offset_) {
+	array<int, 2> t = {-1, -1};
+	if (filter_on_) {
+		auto& c = nodeTuples(node);
+		int i = r1_tuple_idx_;
+		t = {c[2 * i], node >= offset_ ? c[2 * i + 1] : -1};
+		ret = c.size() / 2;
+	} else if (node >= offset_) {
 		auto e = q->GetEdge(node - offset_);
-		vector<int> t = g->GetEdge(e.el, r1_tuple_idx_);
-		sampled_tuples_.push_back(t);
+		g->GetEdge(e.el, (int64_t)r1_tuple_idx_, t.data());
 		ret = g->GetNumEdges(e.el);
 	} else {
 		int u = node_to_v_[node];
 		int vl = q->GetVLabel(u);
         assert(vl != -1);
-		vector<int> t = g->GetVertex(vl, r1_tuple_idx_); 
-        assert(t.size() == 1);
-        t.push_back(-1);
-        assert(t.size() == 2);
-		sampled_tuples_.push_back(t);
+		t[0] = g->GetVertex(vl, r1_tuple_idx_)[0];
 		ret = g->GetNumVertices(vl);
-        assert(sampled_tuples_.size() == 1);
-        assert(sampled_tuples_[0].size() == 2);
 	}
+	sampled_tuples_.push_back(t);
     r1_tuple_idx_++;
 	return ret;
 }
@@ -298,12 +572,20 @@ int JSUB::getNextTuple(int node) {
 //sample from subsequent nodes, using graph adj. list
 //returns inverse probability
 int JSUB::sampleTuple(int node, int v, int c) { 
+    GCARE_COUNT(walk_steps);
 	int ret;
 	if (node >= offset_) {
 		auto e = q->GetEdge(node - offset_);
-		auto t = g->GetRandomEdge(v, e.el, c == 0);
-		if (t.size() > 0) {
-			sampled_tuples_.push_back(t);
+		if (filter_on_) {
+			int other;
+			ret = filter_.PickAdj(v, e.el, c == 0, c == 0 ? e.dst : e.src, rng_, &other);
+			if (ret > 0)
+				sampled_tuples_.push_back(c == 0 ? array<int, 2>{v, other} : array<int, 2>{other, v});
+			return ret;
+		}
+		int other;
+		if (g->GetRandomAdj(v, e.el, c == 0, rng_, &other) > 0) {
+			sampled_tuples_.push_back(c == 0 ? array<int, 2>{v, other} : array<int, 2>{other, v});
 			ret = g->GetAdjSize(v, e.el, c == 0);
 		} else
 			ret = 0;
@@ -311,7 +593,7 @@ int JSUB::sampleTuple(int node, int v, int c) {
 		int u = node_to_v_[node];
 		int vl = q->GetVLabel(u);
 		if (g->HasVLabel(v, vl)) {
-			sampled_tuples_.push_back(vector<int>(1, v));
+			sampled_tuples_.push_back(array<int, 2>{v, -1});
 			ret = 1;
 		} else 
 			ret = 0;
@@ -322,8 +604,10 @@ int JSUB::sampleTuple(int node, int v, int c) {
 //for each possible q1 and o, use WanderJoin to estimate |q1|
 //also calculate M(q1) and choose q1, o with min. |q1| * M(q1)
 int JSUB::DecomposeQuery() {
-    sample_cnt_ = sample_size_;
-    generateWalkPlans();
+    string plan_key;
+    if (plan_cache_mode_ != PlanCache::OFF)
+        plan_key = PlanCache::Key(*q, sample_size_);
+    loadPlans(plan_key);
     sample_cnt_ = sample_size_;
     pos_ = -1;
 
@@ -331,62 +615,77 @@ int JSUB::DecomposeQuery() {
         return 1;
     }
 
+    //a plan chosen by an earlier run skips the trials
+    PlanCache::Entry* cached = plan_cache_mode_ == PlanCache::CHOICE
+        ? plan_cache_.Find(plan_key) : nullptr;
+    bool reuse = cached != nullptr && cached->chosen >= 0;
+    if (reuse)
+        pos_ = cached->chosen;
+
     double min_bound = std::numeric_limits<double>::max();
 
-    //i iterates from 0 to n-1, try WanderJoin only once per each plan
-    for (int i = 0, count = sample_size_; i < plans_.size() && count > 0; i++, count--) {
-        sampled_tuples_.clear();
-        assert(sampled_tuples_.size() == 0);
-		inv_prob_ = 1.0;
+    //each plan gets a WanderJoin trial per order of its join tree that was
+    //enumerated, sample_size_ trials at most
+    int count = sample_size_;
+    for (int i = 0; !reuse && i < plans_.size() && count > 0; i++) {
+        for (int trial = 0; trial < plan_trials_[i] && count > 0; trial++, count--) {
+            sampled_tuples_.clear();
+            assert(sampled_tuples_.size() == 0);
+            inv_prob_ = 1.0;
 
-        int start_node = plans_[i][0].first;
-        assert(start_node >= 0 && start_node < node_num_);
-        if (!checkLabelStatistics(start_node))
-			return 1;
-		inv_prob_ *= sampleTuple(start_node);
+            int start_node = plans_[i][0].first;
+            assert(start_node >= 0 && start_node < node_num_);
+            if (!checkLabelStatistics(start_node))
+                return 1;
+            inv_prob_ *= sampleTuple(start_node);
 
-        if (!checkBoundedVertices(start_node, sampled_tuples_[0])) {
-            i = i + 1;
-            continue;
-		}
-        
-        bool valid = true;
-		for (int cur_order = 1; cur_order < plans_[i].size(); cur_order++) {
-			int cur_node = plans_[i][cur_order].first;
-			int cur_col  = plans_[i][cur_order].second;
-			int prev_order = 0;
-			for (int k = 1; k < cur_order; k++) 
-				if (plans_[i][k].first == counterparts_[i][cur_order].first) 
-					prev_order = k;
-			int c = counterparts_[i][cur_order].second;
-			int v = sampled_tuples_[prev_order][c];
-			inv_prob_ *= sampleTuple(cur_node, v, plans_[i][cur_order].second); 
-            if (inv_prob_ == 0) {
-				valid = false;
-				break;
-			}
-            if (!checkBoundedVertices(cur_node, sampled_tuples_.back())) {
-				valid = false;
-				break;
-			}
-        }
+            //an anchored start may have no tuple at all
+            if (inv_prob_ == 0 || !checkBoundedVertices(start_node, sampled_tuples_[0])) {
+                continue;
+            }
 
-		if (!valid) {
-            i = i + 1;
-            continue;
-        }
-        
-        //if sampling succeeds with the current plan and we obtain a nonzero estimate of |q1|,
-        //see if the current plan gives the minimum estimate of |q1| * M(q1)
-        double cur_bound = inv_prob_ * M(i);
-        if (cur_bound < min_bound) {
-            min_bound = cur_bound;
-            pos_ = i;
+            bool valid = true;
+            for (int cur_order = 1; cur_order < plans_[i].size(); cur_order++) {
+                int cur_node = plans_[i][cur_order].first;
+                int cur_col  = plans_[i][cur_order].second;
+                int prev_order = 0;
+                for (int k = 1; k < cur_order; k++)
+                    if (plans_[i][k].first == counterparts_[i][cur_order].first)
+                        prev_order = k;
+                int c = counterparts_[i][cur_order].second;
+                int v = sampled_tuples_[prev_order][c];
+                inv_prob_ *= sampleTuple(cur_node, v, plans_[i][cur_order].second);
+                if (inv_prob_ == 0) {
+                    valid = false;
+                    break;
+                }
+                if (!checkBoundedVertices(cur_node, sampled_tuples_.back())) {
+                    valid = false;
+                    break;
+                }
+            }
+
+            if (!valid) {
+                continue;
+            }
+
+            //if sampling succeeds with the current plan and we obtain a nonzero estimate of |q1|,
+            //see if the current plan gives the minimum estimate of |q1| * M(q1)
+            double cur_bound = inv_prob_ * M(i);
+            if (cur_bound < min_bound) {
+                min_bound = cur_bound;
+                pos_ = i;
+            }
         }
     }
 
     if (pos_ != -1) {
-        sample_cnt_ *= node_num_;
+        if (cached != nullptr && !reuse) {
+            cached->chosen = pos_;
+            cached->cost = min_bound;
+        }
+        compileDP();
+        sample_cnt_ = sample_cnt_ * node_num_;
 #ifdef FULL_DP
         r1_tuple_num_ = getR1TupleNum(plans_[pos_][0].first); 
 #endif
@@ -401,6 +700,17 @@ bool JSUB::GetSubstructure(int subquery_index) {
     if (pos_ == -1) {
         return false;
     }
+    if (num_threads_ > 1) {
+        if (++batch_pos_ < batch_card_.size())
+            return true;
+        return runBatch();
+    }
+    return drawTuple(plans_[pos_][0].first, inv_prob_, r1_tuple_);
+}
+
+//draws the next t1 and its inverse probability, 0 if t1 breaks a bound
+//vertex; false once out of sample size (or of tuples, FULL_DP)
+bool JSUB::drawTuple(int start_node, double& inv_prob, pair<int, int>& tuple) {
 #ifdef FULL_DP
     if (r1_tuple_idx_ >= r1_tuple_num_)
         return false;
@@ -410,22 +720,77 @@ bool JSUB::GetSubstructure(int subquery_index) {
         return false;
     }
 #endif
-    int start_node = plans_[pos_][0].first;
     assert(start_node >= 0 && start_node < node_num_);
     sampled_tuples_.clear();
 #ifdef FULL_DP
-    inv_prob_ = getNextTuple(start_node);
+    inv_prob = getNextTuple(start_node);
 #else
-    inv_prob_ = sampleTuple(start_node);
+    inv_prob = sampleTuple(start_node);
 #endif
     sample_cnt_--;
     
     if (!checkBoundedVertices(start_node, sampled_tuples_[0])) {
-        inv_prob_ = 0;
+        inv_prob = 0;
         return true; 
     }
         
-    r1_tuple_ = make_pair(sampled_tuples_[0][0], sampled_tuples_[0][1]);
+    tuple = make_pair(sampled_tuples_[0][0], sampled_tuples_[0][1]);
+    return true;
+}
+
+//draws a batch of t1 and runs their DPs on num_threads_ threads, each in
+//its own shard; the estimates are kept up to the first DP that ran out of
+//sample size, where one thread would have stopped
+bool JSUB::runBatch() {
+    if (batch_last_)
+        return false;
+    int start_node = plans_[pos_][0].first;
+    size_t batch_size = (size_t)num_threads_ * BATCH_PER_THREAD;
+    batch_tuples_.resize(batch_size);
+    batch_inv_prob_.resize(batch_size);
+    size_t n = 0;
+    while (n < batch_size && drawTuple(start_node, batch_inv_prob_[n], batch_tuples_[n]))
+        n++;
+    if (n == 0)
+        return false;
+    batch_join_.assign(n, 0);
+    batch_card_.assign(n, 0);
+    batch_out_.assign(n, 0);
+#pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads_) if (n > 1)
+    for (size_t i = 0; i < n; i++) {
+        if (batch_inv_prob_[i] == 0)
+            continue;
+        ScopedMemoryBudget charge(memory_budget_); //the shards' memo growth
+        pair<int, int>& t = batch_tuples_[i];
+        double join;
+        if (!shared_on_ || !shared_w_.Find(MemoTable::Key(t.first, t.second), join)) {
+            bool out = false;
+            join = memoi(shards_[omp_get_thread_num()], 0, t, out);
+            batch_out_[i] = out;
+            if (out)
+                continue;
+        }
+        batch_join_[i] = join;
+        batch_card_[i] = batch_inv_prob_[i] * join * M(pos_);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (batch_out_[i]) {
+            n = i + 1;
+            batch_last_ = true;
+        }
+    }
+    batch_card_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        if (batch_inv_prob_[i] == 0)
+            continue;
+        num_est_card_++;
+        num_memoi_++;
+        if (shared_on_ && !batch_out_[i])
+            shared_w_.Insert(MemoTable::Key(batch_tuples_[i].first, batch_tuples_[i].second), batch_join_[i]);
+    }
+    if (shared_on_ && memo_bytes_ > 0 && shared_w_.MemoryBytes() > memoShare())
+        shared_w_.Evict(memoShare() / MEMO_ENTRY_BYTES);
+    batch_pos_ = 0;
     return true;
 }
 
@@ -433,61 +798,207 @@ bool JSUB::GetSubstructure(int subquery_index) {
 //multiply it with the inverse probability of sampling t1
 //finally, multiply with M which is always 1 in our context
 double JSUB::EstCard(int subquery_index) {
+    if (num_threads_ > 1) {
+        return batch_card_[batch_pos_];
+    }
     if (inv_prob_ == 0) {
         return 0;
     }
-    out_of_cnt_ = false;
     num_est_card_++;
-    double join = memoi(0, r1_tuple_); 
-    if (out_of_cnt_) {
+    num_memoi_++;
+    bool out_of_cnt = false;
+    double join = memoi(shards_[0], 0, r1_tuple_, out_of_cnt); 
+    if (out_of_cnt) {
         return 0;
     }
     return inv_prob_ * join * M(pos_);
 }
 
-//perform dynamic programming using the remaining sample_cnt_ 
-double JSUB::memoi(int order, pair<int, int> tuple) {
+void JSUB::compileDP() {
+    auto& plan = plans_[pos_];
+    Fresh(children_);
+    children_.resize(plan.size());
+    for (auto& shard : shards_)
+        shard.frontier.resize(plan.size());
+    for (int order = 0; order < plan.size(); order++) {
+        for (int next = order + 1; next < plan.size(); next++) {
+            if (counterparts_[pos_][next].first != plan[order].first)
+                continue;
+            DPChild c;
+            int node = plan[next].first;
+            c.order = next;
+            c.edge = node >= offset_;
+            c.label = c.edge ? q->GetEdge(node - offset_).el : q->GetVLabel(node_to_v_[node]);
+            c.dir = plan[next].second == 0;
+            c.col = counterparts_[pos_][next].second;
+            c.vertex = -1;
+            if (c.edge) {
+                auto e = q->GetEdge(node - offset_);
+                c.vertex = c.dir ? e.dst : e.src;
+            }
+            children_[order].push_back(c);
+        }
+    }
+    for (auto& cs : children_)
+        for (auto& c : cs)
+            c.leaf = children_[c.order].empty();
+}
+
+//prefetches the adjacency lists tuple i of order k expands: their offsets
+//(stage 0), or the lists themselves once those are in (stage 1)
+inline void JSUB::prefetch(DPShard& s, int k, size_t i, int stage) {
+    uint64_t t = s.frontier[k][i];
+    int tv[2] = {(int)(t >> 32), (int)(uint32_t)t};
+    for (auto& c : children_[k]) {
+        if (!c.edge)
+            continue;
+        if (stage == 0)
+            g->PrefetchAdj(tv[c.col], c.label, c.dir);
+        else
+            g->PrefetchAdjList(tv[c.col], c.label, c.dir);
+    }
+}
+
+//GCARE_JSUB_MEMO_MB: each shard and the shared memo get an equal share
+size_t JSUB::memoShare() const {
+    return memo_bytes_ / (shards_.size() + (shared_on_ ? 1 : 0));
+}
+
+//the tables of a shard back within its share of the budget, each keeping
+//the same fraction of its entries, those CLOCK finds used since it last
+//passed; an evicted tuple is evaluated again, at its cost, if it comes up
+void JSUB::trimMemo(vector<MemoTable>& tables) {
+    size_t bytes = 0, entries = 0;
+    for (auto& w : tables) {
+        bytes += w.MemoryBytes();
+        entries += w.Size();
+    }
+    if (bytes <= memoShare())
+        return;
+    //an entry takes at most MEMO_ENTRY_BYTES once the slots are down to
+    //the fewest that hold it
+    double keep = std::min(1.0, (double)memoShare() / MEMO_ENTRY_BYTES / std::max<size_t>(entries, 1));
+    for (auto& w : tables)
+        w.Evict(w.Size() * keep);
+}
+
+inline void JSUB::enqueue(DPShard& s, int order, uint64_t key) {
+    if (s.w[order].TryInsert(key, std::numeric_limits<double>::quiet_NaN()))
+        s.frontier[order].push_back(key);
+}
+
+//perform dynamic programming using the remaining sample_cnt_;
+//evaluated level by level: first collect, order by order, the tuples not
+//memoised yet (each neighbour costs one unit of sample_cnt_), then fill
+//their values from the last order back to the first. The tuples of an
+//order are independent, so with interleave_ = d both passes keep the
+//lists of the tuples d and 2d ahead in flight (see prefetch), and the
+//memo slots of the neighbours d ahead. The memo and frontier are those of
+//shard s; out_of_cnt tells whether the sample size ran out
+double JSUB::memoi(DPShard& s, int order, pair<int, int> tuple, bool& out_of_cnt) {
 #ifndef FULL_DP
     if (sample_cnt_ <= 0) {
-        out_of_cnt_ = true;
+        out_of_cnt = true;
         return 0;
     }
 #endif
-    num_memoi_++;
-    if (w_[order].find(tuple) != w_[order].end()) {
-        return w_[order][tuple];
+    uint64_t key = MemoTable::Key(tuple.first, tuple.second);
+    double res;
+    if (s.w[order].Find(key, res)) {
+        return res;
     }
-    double res = 1;
-    for (int next = order + 1; next < plans_[pos_].size(); next++) {
-        if (counterparts_[pos_][next].first != plans_[pos_][order].first) {
-            continue;
+
+    //the memo of finished DPs within the budget, before this one grows it
+    if (memo_bytes_ > 0)
+        trimMemo(s.w);
+    for (auto& f : s.frontier)
+        f.clear();
+    enqueue(s, order, key);
+    long cost = 0;
+    size_t d = interleave_;
+    for (int k = order; k < s.frontier.size(); k++) {
+        size_t n = s.frontier[k].size();
+        for (size_t i = 0; d > 0 && i < std::min(2 * d, n); i++)
+            prefetch(s, k, i, 0);
+        for (size_t i = 0; i < n; i++) {
+            if (d > 0 && i + 2 * d < n)
+                prefetch(s, k, i + 2 * d, 0);
+            if (d > 0 && i + d < n)
+                prefetch(s, k, i + d, 1);
+            uint64_t t = s.frontier[k][i];
+            int tv[2] = {(int)(t >> 32), (int)(uint32_t)t};
+            for (auto& c : children_[k]) {
+                int v = tv[c.col];
+                if (c.edge) {
+                    auto r = g->GetAdj(v, c.label, c.dir);
+                    cost += r.end - r.begin;
+                    if (c.leaf)
+                        continue;
+                    for (; r.begin != r.end; r.begin++) {
+                        if (d > 0 && r.begin + d < r.end)
+                            s.w[c.order].Prefetch(c.dir ? MemoTable::Key(v, r.begin[d]) : MemoTable::Key(r.begin[d], v));
+                        if (!filter_on_ || filter_.Pass(c.vertex, *r.begin))
+                            enqueue(s, c.order, c.dir ? MemoTable::Key(v, *r.begin) : MemoTable::Key(*r.begin, v));
+                    }
+                } else if (!c.leaf && g->HasVLabel(v, c.label)) {
+                    enqueue(s, c.order, MemoTable::Key(v, -1));
+                }
+            }
+#ifndef FULL_DP
+            if (cost > sample_cnt_) {
+                //the run ends here; drop the unfinished entries with it
+                for (auto& w : s.w)
+                    w.Clear();
+                sample_cnt_ = 0;
+                out_of_cnt = true;
+                return 0;
+            }
+#endif
         }
-        double sum = 0;
-        int next_node = plans_[pos_][next].first; 
-        int next_col  = plans_[pos_][next].second; 
-        int prev_col  = counterparts_[pos_][next].second;
-        int v = prev_col == 0 ? tuple.first : tuple.second;
-        int c = plans_[pos_][next].second;
-        if (next_node >= offset_) {
-            auto e = q->GetEdge(next_node - offset_);
-            auto r = g->GetAdj(v, e.el, c == 0); 
-            for (; r.begin != r.end; r.begin++) {
-                if (c == 0)
-                    sum += memoi(next, make_pair(v, *r.begin));
-                else
-                    sum += memoi(next, make_pair(*r.begin, v));
-                sample_cnt_--;
-            }             
-        } else {
-            int u = node_to_v_[next_node];
-            int vl = q->GetVLabel(u);
-            if (g->HasVLabel(v, vl)) {
-                sum += memoi(next, make_pair(v, -1));
-            }         
+    }
+
+    for (int k = s.frontier.size() - 1; k >= order; k--) {
+        size_t n = s.frontier[k].size();
+        for (size_t i = 0; d > 0 && i < std::min(2 * d, n); i++)
+            prefetch(s, k, i, 0);
+        for (size_t i = 0; i < n; i++) {
+            if (d > 0 && i + 2 * d < n)
+                prefetch(s, k, i + 2 * d, 0);
+            if (d > 0 && i + d < n)
+                prefetch(s, k, i + d, 1);
+            uint64_t t = s.frontier[k][i];
+            int tv[2] = {(int)(t >> 32), (int)(uint32_t)t};
+            double w = 1;
+            for (auto& c : children_[k]) {
+                int v = tv[c.col];
+                double sum = 0, child;
+                if (c.edge) {
+                    auto r = g->GetAdj(v, c.label, c.dir);
+                    if (c.leaf) {
+                        sum = filter_on_ ? filter_.CountAdj(v, c.label, c.dir, c.vertex) : r.end - r.begin;
+                    } else {
+                        for (; r.begin != r.end; r.begin++) {
+                            if (d > 0 && r.begin + d < r.end)
+                                s.w[c.order].Prefetch(c.dir ? MemoTable::Key(v, r.begin[d]) : MemoTable::Key(r.begin[d], v));
+                            if (filter_on_ && !filter_.Pass(c.vertex, *r.begin))
+                                continue;
+                            s.w[c.order].Find(c.dir ? MemoTable::Key(v, *r.begin) : MemoTable::Key(*r.begin, v), child);
+                            sum += child;
+                        }
+                    }
+                } else if (g->HasVLabel(v, c.label)) {
+                    if (c.leaf)
+                        sum = 1;
+                    else if (s.w[c.order].Find(MemoTable::Key(v, -1), child))
+                        sum = child;
+                }
+                w *= sum;
+            }
+            s.w[k].Insert(t, w);
         }
-        res *= sum;
     }
-    w_[order][tuple] = res;
+    sample_cnt_ -= cost;
+    s.w[order].Find(key, res);
     return res;
 }
 	
@@ -508,3 +1019,5 @@ double JSUB::GetSelectivity() {
 int JSUB::M(int p) {
 	return 1;
 }
+
+}  // namespace graph
@@ -1,146 +1,478 @@
 #include <boost/program_options.hpp>
-#include <boost/regex.hpp>
 #include <chrono>
-#include <ctime>
-#include <exception>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
+#include <iostream>
 #include <limits>
-#include <signal.h>
+#include <memory>
+#include <set>
+#include <sstream>
 #include <stdio.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
-#include <sys/wait.h>
-#include <unistd.h>
+#include <thread>
 
-#ifdef RELATION
-#include "../include/bound_sketch.h"
-#include "../include/correlated_sampling.h"
-#else
-#include "../include/cset.h"
-#include "../include/impr.h"
-#include "../include/jsub.h"
-#include "../include/sumrdf.h"
-#include "../include/wander_join.h"
-#endif
-#include "../include/memory.h"
+#include "../include/chunked_file.h"
+#include "../include/cluster.h"
+#include "../include/estimate_cache.h"
+#include "../include/metrics.h"
+#include "../include/query_suite.h"
+#include "../include/query_text.h"
+#include "../include/registry.h"
+#include "../include/trace.h"
+#include "../include/util.h"
+#include "../include/work_stealing.h"
 
 namespace po = boost::program_options;
 typedef std::numeric_limits<double> dbl;
-typedef std::chrono::high_resolution_clock Clock;
 
-struct QueryResult {
-  double est;
-  double time;
-  int m_est;
+// One requested method and the summary it builds or reads.
+struct Method {
+  string name;
+  string summary;
+  double p;
+  int seed;
+  Runner *runner;
+  Cluster *cluster = nullptr; // with --workers, instead of runner
+  int metrics = -1;           // its series of Metrics, in query mode
 };
 
-struct QueryParams {
-  int num_iter;
-  int seed;
-  double ratio;
+// bytes of the summary at path: every file named path or path.*, and
+// everything below them if they are directories
+uintmax_t summary_bytes(const string &path) {
+  namespace fs = std::filesystem;
+  fs::path p(path);
+  fs::path dir = p.has_parent_path() ? p.parent_path() : fs::path(".");
+  string name = p.filename().string();
+  std::error_code ec;
+  uintmax_t bytes = 0;
+  for (auto &entry : fs::directory_iterator(dir, ec)) {
+    string f = entry.path().filename().string();
+    if (f != name && f.compare(0, name.size() + 1, name + ".") != 0)
+      continue;
+    if (entry.is_directory(ec)) {
+      for (auto &sub : fs::recursive_directory_iterator(entry.path(), ec))
+        if (sub.is_regular_file(ec))
+          bytes += sub.file_size(ec);
+    } else if (entry.is_regular_file(ec)) {
+      bytes += entry.file_size(ec);
+    }
+  }
+  return bytes;
+}
 
-  QueryParams(int num_iter, int seed, double ratio)
-      : num_iter(num_iter), seed(seed), ratio(ratio) {}
-};
+// counts a query of m that started at start in its metrics series, with
+// the peak memo bytes of its iterations if it ran in-process
+void record_query(const Method &m, std::chrono::steady_clock::time_point start,
+                  bool ok, const QueryResult *query_result, int num_iter) {
+  Metrics &metrics = Metrics::Get();
+  metrics.Count(m.metrics, METRIC_QUERIES);
+  if (!ok)
+    metrics.Count(m.metrics, METRIC_FAILURES);
+  metrics.Record(m.metrics, METRIC_QUERY_SECONDS,
+                 std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count());
+  if (ok && query_result != nullptr) {
+    int64_t memo = 0;
+    for (int i = 0; i < num_iter; i++)
+      memo = std::max(memo, query_result[i].m_subsystem[MEMORY_MEMO]);
+    metrics.Record(m.metrics, METRIC_QUERY_MEMO_BYTES, memo);
+  }
+}
 
-void query(Estimator *estimator, DataGraph &g, const QueryParams &query_params,
-           QueryResult *query_result, const char *path) {
-  int num_iter = query_params.num_iter;
-  int seed = query_params.seed;
-  double p = query_params.ratio;
-  try {
-    QueryGraph q;
-    q.ReadText(path);
-    vector<double> est_vec;
-    double avg_est = 0.0, avg_time = 0.0;
-    int num_est = 0;
-    for (int i = 0; i < num_iter; i++) {
-      // do fork
-      int child_pid = fork();
-      if (child_pid == 0) {
-        srand(seed + i);
-        auto chkpt = Clock::now();
-        query_result->est = estimator->Run(g, q, p);
-        auto elapsed = chrono::duration<double>(Clock::now() - chkpt);
-        query_result->time =
-            chrono::duration_cast<chrono::microseconds>(elapsed).count() / 1e6;
-        query_result->m_est =
-            std::max(query_result->m_est, getValueOfPhysicalMemoryUsage());
-        shmdt(query_result);
-        exit(EXIT_SUCCESS);
-      } else if (child_pid > 0) {
-        auto chkpt = Clock::now();
-        while (true) {
-          int child_status = 0;
-          usleep(100000); // sleep 0.1 second
-          int wait_result = waitpid(child_pid, &child_status, WNOHANG);
-          if (wait_result != 0 && WIFEXITED(child_status)) {
-            if (query_result->est > -1e9) {
-              est_vec.push_back(query_result->est);
-              avg_time += query_result->time;
-            }
-            break;
-          } else if (wait_result != 0 && WIFSIGNALED(child_status)) {
-            int signal = WTERMSIG(child_status);
-            std::cerr << "child signaled exit " << WTERMSIG(child_status)
-                      << "\n";
-            throw signal;
-            // throw Estimator::ErrCode::UNKNOWN;
-          }
-          auto elapsed = chrono::duration<double>(Clock::now() - chkpt);
-          double elapsed_milliseconds =
-              chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+// Runs every method on the query and prints one "est,time" line each,
+// prefixed by "method," when there are several. With aligned, a failed
+// method prints "nan,nan" instead of nothing. Returns false if any method
+// failed.
+bool query(vector<Method> &methods, const QueryParams &query_params,
+           QueryResult *query_result, const char *path, vector<string> *text,
+           bool aligned = false) {
+  bool ok = true;
+  for (Method &m : methods) {
+    auto start = std::chrono::steady_clock::now();
+    QueryParams params = query_params;
+    params.ratio = m.p;
+    double est, time;
+    vector<double> nested_est;
+    string prefix = methods.size() > 1 ? m.name + "," : string();
+    // nested ratios give a line each, prefixed by the ratio
+    vector<string> prefixes;
+    for (double ratio : params.ratios) {
+      std::ostringstream os;
+      os << prefix << ratio << ",";
+      prefixes.push_back(os.str());
+    }
+    if (prefixes.empty())
+      prefixes.push_back(prefix);
+    if (m.cluster != nullptr) {
+      // the workers sample, the query goes to them as text
+      vector<string> lines;
+      if (text == nullptr) {
+        std::ifstream file(path);
+        string line;
+        while (getline(file, line))
+          if (!line.empty())
+            lines.push_back(line);
+        text = &lines;
+      }
+      bool cut;
+      bool answered = !text->empty() &&
+                      m.cluster->Query(m.name, *text, params, est, time, cut);
+      if (answered) {
+        cout << prefix << est << "," << time;
+        if (params.partial)
+          cout << (cut ? ",1" : ",0");
+        cout << "\n";
+      } else {
+        if (aligned)
+          cout << prefix << "nan,nan\n";
+        ok = false;
+      }
+      record_query(m, start, answered, nullptr, 0);
+      if (text == &lines)
+        text = nullptr;
+      continue;
+    }
+    bool answered = m.runner->Query(path, text, params, query_result, est,
+                                    time, &nested_est);
+    record_query(m, start, answered, query_result, params.num_iter);
+    if (answered) {
+      if (nested_est.empty())
+        nested_est.push_back(est);
+      std::ostringstream extra;
+#ifdef GCARE_COUNTERS
+      // summed over the iterations, after a tab so "est,time" parses as before
+      Counters counters;
+      for (int i = 0; i < params.num_iter; i++)
+        counters.Add(query_result[i].counters);
+      extra << "\t" << counters.ToJson();
+#endif
+      if (params.report_memory) {
+        // the largest peaks of any iteration
+        int rss = 0;
+        int64_t subsystem[NUM_MEMORY_SUBSYSTEMS] = {0};
+        for (int i = 0; i < params.num_iter; i++) {
+          rss = std::max(rss, query_result[i].m_est);
+          for (int s = 0; s < NUM_MEMORY_SUBSYSTEMS; s++)
+            subsystem[s] = std::max(subsystem[s], query_result[i].m_subsystem[s]);
+        }
+        extra << "\t{\"peak_rss_kb\":" << rss;
+        for (int s = 0; s < NUM_MEMORY_SUBSYSTEMS; s++)
+          extra << ",\"" << MemorySubsystemName(s) << "_peak_bytes\":" << subsystem[s];
+        extra << "}";
+      }
+      if (params.perf) {
+        // summed over the iterations
+        PerfCounters perf;
+        for (int i = 0; i < params.num_iter; i++)
+          perf.Add(query_result[i].perf);
+        extra << "\t{\"perf\":" << perf.ToJson() << "}";
+      }
+      // with --partial, whether the timeout cut any iteration short
+      string partial;
+      if (params.partial) {
+        bool cut = false;
+        for (int i = 0; i < params.num_iter; i++)
+          cut |= query_result[i].partial;
+        partial = cut ? ",1" : ",0";
+      }
+      for (size_t r = 0; r < prefixes.size(); r++)
+        cout << prefixes[r] << nested_est[r] << "," << time << partial
+             << extra.str() << "\n";
+    } else {
+      for (size_t r = 0; aligned && r < prefixes.size(); r++)
+        cout << prefixes[r] << "nan,nan\n";
+      ok = false;
+    }
+    // forked children of the next method must not inherit buffered output
+    cout.flush();
+  }
+  return ok;
+}
 
-          if (elapsed_milliseconds > 5 * 60 * 1000.0) {
-            kill(child_pid, SIGKILL);
-            std::cerr << "timeout\n";
-            do {
-              usleep(1000000); // sleep 1 second
-              waitpid(child_pid, &child_status, WNOHANG);
-            } while (!WIFEXITED(child_status) && !WIFSIGNALED(child_status));
-            throw Estimator::ErrCode::TIMEOUT;
-          }
+// Server mode: the data graph and the summary stay resident and queries are
+// read from stdin, one per request. A request is either a line holding the
+// path of a query file, or an inline query given as its "v ..."/"e ..." lines
+// terminated by an empty line, a line "end", or EOF. Every request produces
+// exactly one "est,time" line per method on stdout ("nan,nan" on failure) so
+// that the output stays aligned with the input. Lines "+ SRC DST EL" and "-
+// SRC DST EL" insert and delete a data edge for the queries after them (see
+// Backend::UpdateEdge) and produce no output. A line "rebuild" rebuilds the
+// summaries from the binary data at data in the background (see
+// Runner::StartRebuild), as does every merge of the updates into it with
+// GCARE_REBUILD_SUMMARIES=1; the queries go on meanwhile, on the summaries
+// they had until the new ones are done. A line "stats" prints the metrics
+// so far (see MetricsText) followed by a line "# EOF". With a trace, every
+// request is recorded to it (see --record).
+void serve(vector<Method> &methods, const QueryParams &query_params,
+           QueryResult *query_result,
+           std::map<string, std::unique_ptr<Backend>> &backends,
+           const string &data, TraceWriter *trace = nullptr) {
+  const char *rebuild_env = getenv("GCARE_REBUILD_SUMMARIES");
+  bool rebuild_on_compact = rebuild_env != nullptr && atoi(rebuild_env) == 1;
+  auto rebuild = [&]() {
+    for (Method &m : methods)
+      if (m.runner != nullptr &&
+          !m.runner->StartRebuild(data.c_str(), m.summary.c_str(), m.p,
+                                  m.seed))
+        cerr << m.name << ": summary not rebuilt\n";
+  };
+  int compactions = 0;
+  // records a query for each method
+  auto record = [&](const vector<string> &text) {
+    string joined;
+    for (const string &l : text)
+      joined += (joined.empty() ? "" : "\n") + l;
+    for (Method &m : methods)
+      trace->Append(TraceRecord::QUERY, m.name, m.p, query_params.seed,
+                    joined);
+  };
+  string line;
+  int num_inline = 0;
+  while (getline(cin, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.empty())
+      continue;
+    if (line.size() > 1 && (line[0] == '+' || line[0] == '-') &&
+        line[1] == ' ') {
+      int src, dst, el;
+      bool ok = false;
+      if (trace != nullptr)
+        trace->Append(line[0] == '+' ? TraceRecord::INSERT
+                                     : TraceRecord::DELETE,
+                      string(), 0.0, 0, line.substr(2));
+      if (sscanf(line.c_str() + 2, "%d %d %d", &src, &dst, &el) == 3)
+        for (auto &b : backends)
+          ok |= b.second->UpdateEdge(line[0] == '+', src, dst, el);
+      if (!ok)
+        cerr << "update " << line << " not applied\n";
+      int merged = 0;
+      for (auto &b : backends)
+        merged += b.second->Compactions();
+      if (merged != compactions && rebuild_on_compact)
+        rebuild();
+      compactions = merged;
+      continue;
+    }
+    if (line == "rebuild") {
+      rebuild();
+      continue;
+    }
+    if (line == "stats") {
+      cout << MetricsText() << "# EOF\n";
+      cout.flush();
+      continue;
+    }
+    if (line.size() > 1 && (line[0] == 'v' || line[0] == 'e') &&
+        line[1] == ' ') {
+      vector<string> text;
+      text.push_back(line);
+      while (getline(cin, line)) {
+        if (!line.empty() && line.back() == '\r')
+          line.pop_back();
+        if (line.empty() || line == "end")
+          break;
+        text.push_back(line);
+      }
+      string name = "<stdin:" + to_string(num_inline++) + ">";
+      if (trace != nullptr)
+        record(text);
+      query(methods, query_params, query_result, name.c_str(), &text, true);
+    } else {
+      if (!std::filesystem::exists(line)) {
+        cerr << line << " does not exist\n";
+        for (Method &m : methods)
+          cout << (methods.size() > 1 ? m.name + "," : string()) << "nan,nan\n";
+        cout.flush();
+        continue;
+      }
+      if (trace != nullptr) {
+        vector<string> text;
+        std::ifstream file(line);
+        for (string l; getline(file, l);)
+          if (!l.empty())
+            text.push_back(l);
+        record(text);
+      }
+      query(methods, query_params, query_result, line.c_str(), nullptr, true);
+    }
+    cout.flush();
+  }
+}
+
+// the value at fraction f of the sorted values, by nearest rank
+double percentile(const vector<double> &sorted, double f) {
+  if (sorted.empty())
+    return 0.0;
+  size_t rank = (size_t)std::ceil(f * sorted.size());
+  return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+// Replay mode: re-issues the requests of a trace (see --record) to the
+// methods, in order and in-process, each at its recorded time scaled by
+// 1 / speed (speed 0: as fast as possible). A request's latency runs from
+// its scheduled time, so it includes waiting for the ones before it, as in
+// the server; its service time from when it started. Prints throughput and
+// latency percentiles as one JSON line. Requests for methods not given are
+// skipped.
+bool replay(vector<Method> &methods, const QueryParams &query_params,
+            QueryResult *query_result,
+            std::map<string, std::unique_ptr<Backend>> &backends,
+            const string &path, double speed) {
+  vector<TraceRecord> records;
+  if (!ReadTrace(path.c_str(), records))
+    return false;
+  typedef std::chrono::steady_clock Clock;
+  vector<double> latency, service;
+  size_t skipped = 0, failed = 0;
+  auto start = Clock::now();
+  for (const TraceRecord &r : records) {
+    Method *m = nullptr;
+    for (Method &candidate : methods)
+      if (candidate.name == r.method)
+        m = &candidate;
+    if (r.kind == TraceRecord::QUERY && (m == nullptr || m->runner == nullptr)) {
+      skipped++;
+      continue;
+    }
+    auto scheduled = start;
+    if (speed > 0) {
+      scheduled += std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(r.micros / 1e6 / speed));
+      std::this_thread::sleep_until(scheduled);
+    }
+    auto begin = Clock::now();
+    if (speed <= 0)
+      scheduled = begin;
+    if (r.kind != TraceRecord::QUERY) {
+      int src, dst, el;
+      if (sscanf(r.text.c_str(), "%d %d %d", &src, &dst, &el) == 3)
+        for (auto &b : backends)
+          b.second->UpdateEdge(r.kind == TraceRecord::INSERT, src, dst, el);
+      continue;
+    }
+    vector<string> text = tokenize(r.text, "\n");
+    QueryParams params = query_params;
+    params.ratio = r.ratio;
+    params.seed = r.seed;
+    double est, time;
+    if (!m->runner->Query("<trace>", &text, params, query_result, est, time))
+      failed++;
+    auto end = Clock::now();
+    latency.push_back(std::chrono::duration<double>(end - scheduled).count());
+    service.push_back(std::chrono::duration<double>(end - begin).count());
+  }
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  std::sort(latency.begin(), latency.end());
+  std::sort(service.begin(), service.end());
+  cout << "{\"requests\":" << latency.size() << ",\"skipped\":" << skipped
+       << ",\"failed\":" << failed << ",\"seconds\":" << seconds
+       << ",\"throughput\":" << (seconds > 0 ? latency.size() / seconds : 0.0);
+  for (auto *times : {&latency, &service}) {
+    cout << ",\"" << (times == &latency ? "latency" : "service") << "\":{";
+    cout << "\"p50\":" << percentile(*times, 0.5)
+         << ",\"p99\":" << percentile(*times, 0.99)
+         << ",\"p999\":" << percentile(*times, 0.999)
+         << ",\"max\":" << percentile(*times, 1.0) << "}";
+  }
+  cout << "}" << endl;
+  return failed == 0;
+}
+
+// Batch mode: input is a query suite (queries opened by "t # ID" lines, see
+// QueryText), or names a directory of query files or a file listing them,
+// one per line. A file holding several queries stands for each of them as
+// "path#ID" (or "path#k", the k-th, if it has no ID). All iterations of all
+// queries and methods run in-process as tasks of one work-stealing pool of
+// num_threads workers (see Runner::Submit), and each query gets a
+// "name,[method,]est,time" line ("nan,nan" on a timeout), in input order.
+// Returns false if any failed.
+bool batch(vector<Method> &methods, const QueryParams &query_params,
+           const string &input, int num_threads) {
+  QuerySuite suite;
+  if (!suite.Read(input))
+    return false;
+  const vector<QuerySuite::Entry> &queries = suite.entries;
+  vector<string> lines(queries.size() * methods.size());
+  std::atomic<bool> ok(true);
+  {
+    WorkStealingPool pool(num_threads);
+    for (size_t k = 0; k < queries.size(); k++) {
+      const QueryText &text = suite.Text(queries[k]);
+      for (size_t j = 0; j < methods.size(); j++) {
+        string prefix = queries[k].name + "," +
+                        (methods.size() > 1 ? methods[j].name + "," : string());
+        string &line = lines[k * methods.size() + j];
+        if (text.size() == 0) {
+          line = prefix + "nan,nan";
+          ok = false;
+          continue;
         }
-      } else {
-        assert(false);
+        QueryParams params = query_params;
+        params.ratio = methods[j].p;
+        methods[j].runner->Submit(
+            pool, text, queries[k].query, params,
+            [prefix, &line, &ok, &query_params](bool done, double est,
+                                                double time, bool partial) {
+              std::ostringstream os;
+              if (done) {
+                os << prefix << est << "," << time;
+                if (query_params.partial)
+                  os << (partial ? ",1" : ",0");
+              } else {
+                os << prefix << "nan,nan";
+                ok = false;
+              }
+              line = os.str();
+            });
       }
     }
-    for (double est : est_vec)
-      avg_est += est;
-    avg_est /= est_vec.size();
-    avg_time /= est_vec.size();
-    // double var = 0.0;
-    // for (double est : est_vec)
-    //   var += (est - avg_est) * (est - avg_est);
-    // var /= est_vec.size();
-    // int precision = std::numeric_limits<double>::max_digits10;
-    // cout.precision(dbl::max_digits10);
-    // fout.precision(dbl::max_digits10);
-    // fout << dir_entry.path().string() << " " << avg_est << " " << avg_time
-    //      << " " << var << endl;
-    // cout << dir_entry.path().string() << " " << avg_est << " " << avg_time
-    //      << " " << var << endl;
-    // fout << est_vec.size();
-    // cout << est_vec.size();
-    // for (double est : est_vec)
-    //   fout << " " << est;
-    // for (double est : est_vec)
-    //   cout << " " << est;
-    // fout << endl;
-    // cout << endl;
-    // int precision = std::numeric_limits<double>::max_digits10;
-    // cout.precision(dbl::max_digits10);
-    cout << avg_est << "," << avg_time << "\n";
-  } catch (Estimator::ErrCode e) {
-    // err_fout << dir_entry.path().string() << " error with code " << e <<
-    // "\n";
-    cerr << path << " error with code " << e << "\n";
-  } catch (int e) {
-    // err_fout << dir_entry.path().string() << " error with the signal " << e
-    // << "\n";
-    cerr << path << " error with signal " << e << "\n";
+    pool.Wait();
   }
+  for (const string &line : lines)
+    cout << line << "\n";
+  cout.flush();
+  return ok;
+}
+
+// the vertex and edge labels of --project, sorted: those of the queries
+// at spec if it is a path, or else the list "vL,eL,..."; false, reported,
+// if spec is neither
+bool project_labels(const string &spec, vector<int> &vlabels,
+                    vector<int> &elabels) {
+  std::set<int> vl, el;
+  std::error_code ec;
+  if (std::filesystem::exists(spec, ec)) {
+    QuerySuite suite;
+    if (!suite.Read(spec))
+      return false;
+    for (auto &text : suite.texts) {
+      for (const QueryText::Vertex &v : text->vertices)
+        if (v.label >= 0)
+          vl.insert(v.label);
+      for (const QueryText::Edge &e : text->edges)
+        el.insert(e.label);
+    }
+  } else {
+    for (const string &label : tokenize(spec, ",")) {
+      char *end = nullptr;
+      long l = label.size() > 1 ? strtol(label.c_str() + 1, &end, 10) : -1;
+      if ((label[0] != 'v' && label[0] != 'e') || end == nullptr || *end ||
+          l < 0) {
+        cout << "--project " << spec << " is neither a path nor a list of "
+             << "vL and eL labels" << endl;
+        return false;
+      }
+      (label[0] == 'v' ? vl : el).insert(l);
+    }
+  }
+  vlabels.assign(vl.begin(), vl.end());
+  elabels.assign(el.begin(), el.end());
+  return true;
 }
 
 int main(int argc, char **argv) {
@@ -148,20 +480,149 @@ int main(int argc, char **argv) {
   po::options_description desc("gCare Framework");
   desc.add_options()("help,h", "Display help message")("query,q", "query mode")(
       "build,b", "build mode")("method,m", po::value<std::string>(),
-                               "estimator method")(
+                               "estimator method, or several separated by commas")(
       "input,i", po::value<std::string>(),
       "input file (in build mode: text data graph, in query mode: text query "
       "graph)")("output,o", po::value<std::string>(),
                 "output directory in query mode")(
       "data,d", po::value<std::string>(), "binary datafile")(
-      "ratio,p", po::value<string>()->default_value("0.03"), "sampling ratio")(
+      "ratio,p", po::value<string>()->default_value("0.03"),
+      "sampling ratio, or comma-separated ratios: build mode builds the "
+      "summary of each, query mode estimates them in one nested run at the "
+      "largest, with its summary (wj, jsub, impr, cs); each gives an "
+      "\"est,time\" line prefixed by the ratio, time being that of the "
+      "whole run")(
       "iteration,n", po::value<int>()->default_value(30),
       "iterations per query")("seed,s", po::value<int>()->default_value(0),
-                              "random seed");
+                              "random seed")(
+      "batch", "query mode: input is a query suite (\"t # ID\" lines opening "
+               "each query), a directory of query files or a file "
+               "listing them; all run in-process on --threads workers that "
+               "steal each other's iterations, printing \"path,est,time\" "
+               "lines, path#ID for a query of a suite")(
+      "split", po::value<int>()->default_value(1),
+      "batch mode: run each iteration of wj, jsub and impr as this many "
+      "chunks at ratio / split, which idle workers take over")(
+      "timeout", po::value<double>()->default_value(300),
+      "query mode: seconds an iteration may take before the query fails")(
+      "partial", "query mode: at the timeout, stop sampling (wj, jsub, impr, "
+                 "cs) and estimate from the samples so far instead of "
+                 "failing; \"est,time\" lines get a third field, 1 if the "
+                 "timeout cut any iteration short")(
+      "listen", po::value<int>(),
+      "query mode: serve as a worker of a --workers driver on this TCP port, "
+      "with the data and summaries loaded")(
+      "workers", po::value<string>(),
+      "query mode: comma-separated host:port of --listen workers, which "
+      "split the sampling of every iteration (wj, jsub, impr, cs) between "
+      "them at ratio / workers each; the data is not loaded here")(
+      "server,S", "query mode: keep the data and summary loaded and read "
+                  "queries (paths or inline text) from stdin, and edge "
+                  "updates (\"+ SRC DST EL\", \"- SRC DST EL\") that the "
+                  "sampling methods see from then on; GCARE_COMPACT_UPDATES=n "
+                  "merges every n of them into the binary, and a line "
+                  "\"rebuild\" (or, with GCARE_REBUILD_SUMMARIES=1, every "
+                  "such merge) rebuilds the summaries in the background; a "
+                  "line \"stats\" prints the metrics, as --metrics-port "
+                  "serves them, ending in \"# EOF\"")(
+      "metrics-port", po::value<int>(),
+      "server mode: serve the live metrics (queries, failures, latency "
+      "histograms and percentiles per method, iterations, memory) in the "
+      "Prometheus text format to HTTP GETs of /metrics on this port")(
+      "record", po::value<string>(),
+      "server mode: record every request, with its method, ratio, seed and "
+      "arrival time, to this binary trace")(
+      "replay", po::value<string>(),
+      "query mode: re-issue the requests of a --record trace to the "
+      "methods given, at their recorded times, and print the throughput "
+      "and latency percentiles as JSON")(
+      "replay-speed", po::value<double>()->default_value(1),
+      "replay mode: speed-up of the recorded times; 0 issues the requests "
+      "as fast as they are served")(
+      "no-fork", "query mode: run iterations in-process with a cooperative "
+                 "timeout instead of forking a child per iteration")(
+      "threads,t", po::value<int>()->default_value(1),
+      "query mode: number of iterations run concurrently; build mode: "
+      "number of summaries built concurrently")(
+      "target", po::value<vector<string>>()->composing(),
+      "build mode: also build the summary of method:ratio:seed; repeatable. "
+      "The data is loaded once for all summaries, and a summary that does "
+      "not depend on the ratio and seed (cset, wj, jsub, impr, cs) is built "
+      "once and written for each")(
+      "project", po::value<string>(),
+      "build mode: build the binary on a projection of the data graph to "
+      "the labels a workload uses, given as a comma-separated list of "
+      "vertex (vL) and edge (eL) labels, or as the queries (a suite, a "
+      "directory of query files or a file listing them, as --batch takes) "
+      "whose labels to keep. The labels are renumbered densely, with the "
+      "map written as DATA.graph.labels, through which queries are read; "
+      "summaries are built on the projection. A kind of label that is not "
+      "given is kept whole. Only when the binary is built")(
+      "resume", "build mode: continue the builds of sumrdf and bsk from the "
+                "checkpoints (SUMMARY.ckpt) that interrupted builds of the "
+                "same summaries left, written every GCARE_CHECKPOINT_SECONDS "
+                "(default 600)")(
+      "max-summary-bytes", po::value<size_t>()->default_value(0),
+      "build mode: coarsen each summary (cset histograms, sumrdf merges, "
+      "bsk budget; cs drops its sort orders) so that its file fits in "
+      "this many bytes; 0 for no limit")(
+      "max-build-seconds", po::value<double>()->default_value(0),
+      "build mode: end sumrdf's merge rounds early, to a coarser summary, "
+      "once its build has taken this many seconds; 0 for no limit. With "
+      "either budget, each build prints \"budget,METHOD,BYTES,SECONDS,"
+      "REPORT\" to stderr: what it achieved and gave up")(
+      "compress", "build mode: store the binary and the summaries built "
+                  "compressed, in blocks that loading inflates in "
+                  "parallel (see include/chunked_file.h)")(
+      "updates", po::value<string>(),
+      "build mode: apply the edge updates in this file, one \"+ SRC DST "
+      "EL\" (insertion) or \"- SRC DST EL\" (deletion) per line, to the "
+      "existing summaries (cset, sumrdf) instead of building them; --data is the "
+      "graph they describe, and the updated summaries describe it with the "
+      "updates, without --input")(
+      "ci", po::value<double>()->default_value(0),
+      "query mode: stop sampling (wj, jsub, impr) once the 95% confidence "
+      "half-width is at most this fraction of the estimate")(
+      "budget", po::value<double>()->default_value(0),
+      "query mode: stop sampling (wj, jsub, impr) after this many seconds "
+      "per iteration")(
+      "target-rse", po::value<double>()->default_value(0),
+      "query mode: weigh the iterations of wj, jsub and impr by the "
+      "inverse of their variance and stop adding them once the pooled "
+      "standard error is at most this fraction of the estimate, -n being "
+      "the most; prints \"pooled,iterations,stderr\" to stderr. Not "
+      "with --batch")(
+      "progress", po::value<size_t>()->default_value(0),
+      "query mode: print the running estimate to stderr every this many "
+      "samples")(
+      "cache", po::value<string>(),
+      "query mode: reuse the estimates of earlier runs stored in this file "
+      "for isomorphic queries with the same summary and parameters, and add "
+      "the new ones")(
+      "memory", "append the peak memory as JSON to every output line: "
+                 "resident set and tracked subsystems per query, resident "
+                 "set and summary size per build")(
+      "memory-limit", po::value<double>()->default_value(0),
+      "query mode with --no-fork or --batch: abort an iteration, and fail "
+      "its query with error code 2, once its tracked allocations "
+      "(relations, memo tables, query arena) exceed this many MB; 0 for "
+      "no limit")(
+      "perf", "query mode: append to every output line, as JSON, the "
+               "hardware counters (cycles, instructions, LLC, dTLB and "
+               "branch misses) of each phase of the estimation, summed "
+               "over the iterations; needs perf_event_open")(
+      "load", po::value<string>()->default_value("copy"),
+      "how the binary data is loaded: copy, mmap (shared page cache) or "
+      "hugepage (mmap with transparent huge pages) or shm (a POSIX "
+      "shared-memory copy shared by all processes, see LOAD_SHM)");
   po::variables_map vm;
   po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
 
-  if (vm.count("help") || !vm.count("input") || !vm.count("data")) {
+  if (vm.count("help") || (!vm.count("data") && !vm.count("workers")) ||
+      (!vm.count("input") &&
+       !(vm.count("query") &&
+         (vm.count("server") || vm.count("listen") || vm.count("replay"))) &&
+       !(vm.count("build") && vm.count("updates")))) {
     cout << desc;
     return -1;
   }
@@ -178,103 +639,310 @@ int main(int argc, char **argv) {
     return -1;
   }
 
-  string input_str = vm["input"].as<string>();
-  string data_str = vm["data"].as<string>();
-  double p = stod(vm["ratio"].as<string>());
+  string input_str = vm.count("input") ? vm["input"].as<string>() : string();
+  string data_str = vm.count("data") ? vm["data"].as<string>() : string();
+  // the largest of the ratios names the summary and is sampled at
+  vector<string> ratio_strs = tokenize(vm["ratio"].as<string>(), ",");
+  if (ratio_strs.empty())
+    ratio_strs.push_back(vm["ratio"].as<string>());
+  vector<double> ratios;
+  string ratio_str;
+  for (const string &r : ratio_strs) {
+    ratios.push_back(stod(r));
+    if (ratios.size() == 1 || ratios.back() > stod(ratio_str))
+      ratio_str = r;
+  }
+  double p = stod(ratio_str);
   int seed = vm["seed"].as<int>();
 
-  string method = vm["method"].as<string>();
-  Estimator *estimator = nullptr;
-  string summary_str = data_str + string(".") + method;
+  LoadMode load_mode = LOAD_COPY;
+  if (vm["load"].as<string>() == "mmap") {
+    load_mode = LOAD_MMAP;
+  } else if (vm["load"].as<string>() == "hugepage") {
+    load_mode = LOAD_MMAP_HUGE;
+  } else if (vm["load"].as<string>() == "shm") {
+    load_mode = LOAD_SHM;
+  } else if (vm["load"].as<string>() != "copy") {
+    cout << "unknown load mode " << vm["load"].as<string>() << endl;
+    cout << desc;
+    return -1;
+  }
 
-#ifdef RELATION
-  if (method == string("cs")) {
-    summary_str = summary_str + ".p" + vm["ratio"].as<string>();
-    estimator = new CorrelatedSampling;
-  } else if (method == string("bsk")) {
-    summary_str = summary_str + ".b" + string(getenv("GCARE_BSK_BUDGET"));
-    estimator = new BoundSketch;
-    p = std::stod(string(getenv("GCARE_BSK_BUDGET")));
+  // one or more comma-separated methods, of either kind of data; every kind
+  // is loaded once and shared by its methods. Build mode builds every
+  // method at every ratio, and every --target.
+  vector<Method> methods;
+  vector<string> kinds;
+  auto add_method = [&](const string &name, const string &ratio,
+                        int seed) -> bool {
+    string kind = Registry::Get().KindOf(name);
+    if (kind.empty()) {
+      cout << "unknown method " << name << " (available: "
+           << Registry::Get().MethodList() << ")" << endl;
+      return false;
+    }
+    if (find(kinds.begin(), kinds.end(), kind) == kinds.end())
+      kinds.push_back(kind);
+    Method m;
+    m.name = name;
+    m.p = stod(ratio);
+    m.seed = seed;
+    m.summary = data_str + string(".") + name;
+    if (name == string("bsk")) {
+      const char *budget = getenv("GCARE_BSK_BUDGET");
+      if (budget == nullptr) {
+        cout << "bsk needs GCARE_BSK_BUDGET" << endl;
+        return false;
+      }
+      m.summary = m.summary + ".b" + budget;
+      m.p = std::stod(budget);
+    } else {
+      m.summary = m.summary + ".p" + ratio;
+    }
+    m.summary = m.summary + ".s" + to_string(seed);
+    for (const Method &other : methods)
+      if (other.summary == m.summary)
+        return true;
+    methods.push_back(m);
+    return true;
+  };
+  vector<string> method_names;
+  if (vm.count("method"))
+    method_names = tokenize(vm["method"].as<string>(), ",");
+  for (const string &name : method_names) {
+    if (!vm.count("build")) {
+      if (!add_method(name, ratio_str, seed))
+        return -1;
+      continue;
+    }
+    for (const string &r : ratio_strs)
+      if (!add_method(name, r, seed))
+        return -1;
+  }
+  if (vm.count("target") && vm.count("build")) {
+    for (const string &target : vm["target"].as<vector<string>>()) {
+      vector<string> parts = tokenize(target, ":");
+      if (parts.size() != 3) {
+        cout << "target " << target << " is not method:ratio:seed" << endl;
+        return -1;
+      }
+      if (!add_method(parts[0], parts[1], stoi(parts[2])))
+        return -1;
+    }
   }
-#else
-  if (method == string("cset")) {
-    summary_str = summary_str + ".p" + vm["ratio"].as<string>();
-    estimator = new CharacteristicSets;
-  } else if (method == string("impr")) {
-    summary_str = summary_str + ".p" + vm["ratio"].as<string>();
-    estimator = new Impr;
-  } else if (method == string("sumrdf")) {
-    summary_str = summary_str + ".p" + vm["ratio"].as<string>();
-    estimator = new SumRDF;
-  } else if (method == string("wj")) {
-    summary_str = summary_str + ".p" + vm["ratio"].as<string>();
-    estimator = new WanderJoin;
-  } else if (method == string("jsub")) {
-    summary_str = summary_str + ".p" + vm["ratio"].as<string>();
-    estimator = new JSUB;
+  if (methods.empty()) {
+    cout << "no method given" << endl;
+    cout << desc;
+    return -1;
   }
-#endif
-  summary_str = summary_str + ".s" + to_string(seed);
 
-  // std::cout << "summary: " << summary_str << "\n";
-  // string output_str = vm["output"].as<string>();
+  // a driver of workers loads nothing itself
+  std::unique_ptr<Cluster> cluster;
+  if (vm.count("workers")) {
+    if (!vm.count("query") || vm.count("batch") || vm.count("listen") ||
+        ratios.size() > 1 || vm.count("cache")) {
+      cout << "--workers takes query or server mode with one ratio" << endl;
+      return -1;
+    }
+    for (const Method &m : methods)
+      if (!Cluster::Splits(m.name)) {
+        cout << "--workers takes sampling methods (wj, jsub, impr, cs), not "
+             << m.name << endl;
+        return -1;
+      }
+    cluster.reset(new Cluster);
+    if (!cluster->Connect(tokenize(vm["workers"].as<string>(), ",")))
+      return -1;
+    kinds.clear();
+  }
+  vector<int> project_vl, project_el;
+  if (vm.count("project") && vm.count("build") &&
+      !project_labels(vm["project"].as<string>(), project_vl, project_el))
+    return -1;
+  std::map<string, std::unique_ptr<Backend>> backends;
+  for (const string &kind : kinds) {
+    backends[kind].reset(Registry::Get().backends[kind]());
+    if (vm.count("project"))
+      backends[kind]->SetLabelProjection(project_vl, project_el);
+    if (vm.count("build") && !vm.count("updates"))
+      backends[kind]->Build(input_str.c_str(), data_str.c_str());
+    if (!vm.count("build")) {
+      vector<string> names;
+      for (const Method &m : methods)
+        if (Registry::Get().KindOf(m.name) == kind)
+          names.push_back(m.name);
+      backends[kind]->SetMethods(names);
+    }
+    // build mode keeps the historical private copy
+    backends[kind]->Load(data_str.c_str(),
+                         vm.count("build") ? LOAD_COPY : load_mode);
+  }
+  for (Method &m : methods) {
+    m.cluster = cluster.get();
+    m.runner = cluster ? nullptr
+                       : backends[Registry::Get().KindOf(m.name)]->NewRunner(
+                             m.name);
+  }
 
-  if (vm.count("build")) {
-    // build mode
-    DataGraph g;
-    if (!g.HasBinary(data_str.c_str())) {
-      std::cout << "There is no binary\n";
-      g.ReadText(input_str.c_str());
-      g.MakeBinary();
-      g.WriteBinary(data_str.c_str());
-      g.ClearRawData();
+  if (vm.count("build") && vm.count("updates")) {
+    string updates = vm["updates"].as<string>();
+    for (Method &m : methods) {
+      double time = m.runner->UpdateSummary(m.summary.c_str(), updates.c_str());
+      if (time < 0) {
+        cout << m.name << " cannot update its summary" << endl;
+        return -1;
+      }
+      if (methods.size() > 1)
+        cout << m.name << "," << m.p << "," << m.seed << ",";
+      cout << time << endl;
+    }
+  } else if (vm.count("build")) {
+    // build mode: targets whose summary does not depend on the ratio and
+    // seed share one build, the others are built concurrently on up to
+    // --threads threads
+    vector<int> build_of(methods.size());
+    vector<int> builds;
+    for (size_t i = 0; i < methods.size(); i++) {
+      build_of[i] = i;
+      for (int b : builds)
+        if (methods[b].name == methods[i].name &&
+            methods[b].runner->FixedSummary())
+          build_of[i] = b;
+      if (build_of[i] == (int)i)
+        builds.push_back(i);
+    }
+    vector<double> build_time(methods.size());
+    size_t max_bytes = vm["max-summary-bytes"].as<size_t>();
+    double max_seconds = vm["max-build-seconds"].as<double>();
+    int num_threads = std::max(vm["threads"].as<int>(), 1);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+    for (size_t k = 0; k < builds.size(); k++) {
+      Method &m = methods[builds[k]];
+      m.runner->SetBuildBudget(max_bytes, max_seconds);
+      build_time[builds[k]] = m.runner->Summarize(m.summary.c_str(), m.p,
+                                                  m.seed, vm.count("resume"));
+    }
+    if (max_bytes > 0 || max_seconds > 0)
+      for (int b : builds) {
+        Method &m = methods[b];
+        uintmax_t bytes = 0;
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(m.summary, ec))
+          bytes = std::filesystem::file_size(m.summary, ec);
+        cerr << "budget," << m.name << "," << bytes << "," << build_time[b]
+             << "," << m.runner->BuildReport() << endl;
+      }
+    for (size_t i = 0; i < methods.size(); i++) {
+      Method &m = methods[i];
+      if (build_of[i] != (int)i) {
+        auto chkpt = std::chrono::steady_clock::now();
+        methods[build_of[i]].runner->WriteSummary(m.summary.c_str());
+        build_time[i] = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - chkpt).count();
+      }
+    }
+    if (vm.count("compress")) {
+      vector<string> files;
+      for (const char *ext : {".graph", ".relation"})
+        files.push_back(data_str + ext);
+      for (int b : builds)
+        files.push_back(methods[b].summary);
+      for (size_t i = 0; i < methods.size(); i++)
+        if (build_of[i] != (int)i)
+          files.push_back(methods[i].summary);
+      for (const string &fn : files) {
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(fn, ec) &&
+            !CompressFile(fn.c_str()))
+          return -1;
+      }
+    }
+    // several ratios or targets prefix their line with method,p,seed
+    bool targets = vm.count("target") || ratio_strs.size() > 1;
+    for (size_t i = 0; i < methods.size(); i++) {
+      Method &m = methods[i];
+      if (targets)
+        cout << m.name << "," << m.p << "," << m.seed << ",";
+      else if (methods.size() > 1)
+        cout << m.name << ",";
+      cout << build_time[i];
+      if (vm.count("memory"))
+        cout << "\t{\"peak_rss_kb\":" << getPeakPhysicalMemoryUsage()
+             << ",\"summary_bytes\":" << summary_bytes(m.summary) << "}";
+      cout << endl;
     }
-    g.ReadBinary(data_str.c_str());
-    srand(seed);
-    auto chkpt = Clock::now();
-    estimator->Summarize(g, summary_str.c_str(), p);
-    auto elapsed = chrono::duration<double>(Clock::now() - chkpt);
-    double summary_build_time =
-        chrono::duration_cast<chrono::milliseconds>(elapsed).count() / 1e3;
-    // std::fstream fout;
-    // string output_fn = output_str;
-    // fout.open(output_fn.c_str(), std::fstream::out);
-    // fout << summary_build_time << endl;
-    // fout.close();
-    cout << summary_build_time << endl;
   } else {
     // query mode
-    //  std::cout << "Query Mode\n";
-    DataGraph g;
-    int chkpt = getValueOfPhysicalMemoryUsage();
-    g.ReadBinary(data_str.c_str());
-    estimator->ReadSummary(summary_str.c_str());
     int num_iter = vm["iteration"].as<int>();
-    // namespace fs = std::filesystem;
-    // std::fstream fout;
-    // string output_fn = output_str;
-    // fout.open(output_fn.c_str(), std::fstream::out);
-    // string err_fn = output_str + ".err";
-    // std::fstream err_fout;
-    // err_fout.open(err_fn.c_str(), std::fstream::out);
-    key_t key = ftok("shmfile", 65);
-    int shmid = shmget(key, sizeof(QueryResult), 0666 | IPC_CREAT);
+    int num_threads = std::max(vm["threads"].as<int>(), 1);
+    if (vm.count("batch") && ratios.size() > 1) {
+      cout << "batch mode takes one ratio" << endl;
+      return -1;
+    }
+    for (Method &m : methods) {
+      m.metrics = Metrics::Get().Series(m.name);
+      if (m.runner != nullptr)
+        Metrics::Get().SetSummaryBytes(m.metrics, summary_bytes(m.summary));
+    }
+    for (Method &m : methods)
+      if (m.runner != nullptr)
+        m.runner->ReadSummary(m.summary.c_str(),
+                              vm.count("no-fork") || vm.count("batch")
+                                  ? num_threads : 1);
+    // one result slot per iteration; private, since children inherit it
+    int shmid = shmget(IPC_PRIVATE, sizeof(QueryResult) * std::max(num_iter, 1),
+                       0666 | IPC_CREAT);
     QueryResult *query_result = (QueryResult *)shmat(shmid, (void *)0, 0);
-    QueryParams query_params(num_iter, seed, p);
-    query(estimator, g, query_params, query_result, input_str.c_str());
-    // for (auto &dir_entry :
-    //      fs::recursive_directory_iterator(input_str.c_str())) {
-    //   if (dir_entry.path().string().find_last_of(".txt") + 1 !=
-    //       dir_entry.path().string().length())
-    //     continue;
-    //   std::cout << "Estimator for " << dir_entry.path().string() << "\n";
-
-    //   // kill
-    // }
+    QueryParams query_params(num_iter, seed, p, !vm.count("no-fork"),
+                             num_threads);
+    query_params.rel_ci = vm["ci"].as<double>();
+    query_params.budget = vm["budget"].as<double>();
+    query_params.target_rse = vm["target-rse"].as<double>();
+    query_params.progress_every = vm["progress"].as<size_t>();
+    query_params.report_memory = vm.count("memory") > 0;
+    query_params.perf = vm.count("perf") > 0;
+    query_params.memory_limit =
+        (int64_t)(vm["memory-limit"].as<double>() * (1 << 20));
+    if (ratios.size() > 1)
+      query_params.ratios = ratios;
+    std::unique_ptr<EstimateCache> cache;
+    if (vm.count("cache")) {
+      cache.reset(new EstimateCache(vm["cache"].as<string>()));
+      query_params.cache = cache.get();
+    }
+    query_params.split = vm["split"].as<int>();
+    query_params.timeout = vm["timeout"].as<double>();
+    query_params.partial = vm.count("partial") > 0;
+    if (vm.count("listen")) {
+      // serves until killed; returns only if the port is unusable
+      std::map<string, Runner *> runners;
+      for (Method &m : methods)
+        runners[m.name] = m.runner;
+      ServeWorker(vm["listen"].as<int>(), runners, query_params);
+    } else if (vm.count("server")) {
+      if (vm.count("metrics-port") &&
+          !ServeMetrics(vm["metrics-port"].as<int>()))
+        return -1;
+      std::unique_ptr<TraceWriter> trace;
+      if (vm.count("record")) {
+        trace.reset(new TraceWriter);
+        if (!trace->Open(vm["record"].as<string>().c_str()))
+          return -1;
+      }
+      serve(methods, query_params, query_result, backends, data_str,
+            trace.get());
+    } else if (vm.count("replay")) {
+      replay(methods, query_params, query_result, backends,
+             vm["replay"].as<string>(), vm["replay-speed"].as<double>());
+    } else if (vm.count("batch")) {
+      batch(methods, query_params, input_str, num_threads);
+    } else {
+      query(methods, query_params, query_result, input_str.c_str(), nullptr);
+    }
     shmdt(query_result);
     shmctl(shmid, IPC_RMID, NULL);
-    // fout.close();
-    // err_fout.close();
   }
+  for (Method &m : methods)
+    delete m.runner;
   return 0;
 }
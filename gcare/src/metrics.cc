@@ -0,0 +1,228 @@
+// The Prometheus exposition of Metrics (include/metrics.h) and the HTTP
+// endpoint of --metrics-port.
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../include/memory.h"
+#include "../include/metrics.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+const char *COUNTER_NAMES[NUM_METRICS_COUNTERS] = {
+    "gcare_queries_total",          "gcare_query_failures_total",
+    "gcare_query_errors_total",     "gcare_query_errors_total",
+    "gcare_query_errors_total",     "gcare_iterations_total",
+    "gcare_partial_iterations_total"};
+const char *COUNTER_HELP[NUM_METRICS_COUNTERS] = {
+    "Queries run.",
+    "Queries that gave no estimate.",
+    "Failed queries by cause: an iteration over the timeout or the memory "
+    "limit, or killed by a signal.",
+    nullptr,
+    nullptr,
+    "Estimator runs (iterations) completed.",
+    "Iterations the timeout cut short (--partial)."};
+const char *ERROR_REASONS[NUM_METRICS_COUNTERS] = {
+    nullptr, nullptr, "timeout", "memory", "crash", nullptr, nullptr};
+
+// the histograms in the unit of their name, their values being in raw
+// units, scale of them to one
+struct HistogramFamily {
+  MetricsHistogramId id;
+  const char *name, *help;
+  double scale;
+  vector<double> le;
+};
+
+const vector<HistogramFamily> &families() {
+  static const vector<HistogramFamily> f = {
+      {METRIC_QUERY_SECONDS, "gcare_query_latency_seconds",
+       "Wall time of a query, all its iterations.", 1e6,
+       {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1,
+        2.5, 5, 10, 30, 60, 300}},
+      {METRIC_ITERATION_SECONDS, "gcare_iteration_seconds",
+       "Time of one estimator run.", 1e6,
+       {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1,
+        2.5, 5, 10, 30, 60, 300}},
+      {METRIC_ITERATION_SAMPLES, "gcare_iteration_samples",
+       "Substructures an estimator run estimated.", 1,
+       {1, 10, 100, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8}},
+      {METRIC_QUERY_MEMO_BYTES, "gcare_query_memo_bytes",
+       "Peak bytes of the memo tables of a query's iterations.", 1,
+       {1 << 10, 1 << 14, 1 << 18, 1 << 20, 1 << 22, 1 << 24, 1 << 26,
+        1 << 28, 1 << 30}},
+  };
+  return f;
+}
+
+string label(const string &method) {
+  string s = "method=\"";
+  for (char c : method) {
+    if (c == '"' || c == '\\')
+      s += '\\';
+    s += c;
+  }
+  return s + "\"";
+}
+
+// the bytes resident now, from /proc/self/statm
+uint64_t resident_bytes() {
+  FILE *fp = fopen("/proc/self/statm", "r");
+  unsigned long size = 0, resident = 0;
+  if (fp != nullptr) {
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+      resident = 0;
+    fclose(fp);
+  }
+  return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+} // namespace
+
+// A bucket counts towards the first le its largest value does not exceed,
+// so the bounds are off by at most the 1/8 of the HDR buckets.
+std::string MetricsText() {
+  vector<string> names;
+  vector<MetricsSeries> sums;
+  vector<uint64_t> summary_bytes;
+  Metrics::Get().Scrape(names, sums, summary_bytes);
+  std::ostringstream out;
+  for (int c = 0; c < NUM_METRICS_COUNTERS; c++) {
+    if (COUNTER_HELP[c] != nullptr)
+      out << "# HELP " << COUNTER_NAMES[c] << " " << COUNTER_HELP[c] << "\n"
+          << "# TYPE " << COUNTER_NAMES[c] << " counter\n";
+    for (size_t i = 0; i < names.size(); i++) {
+      out << COUNTER_NAMES[c] << "{" << label(names[i]);
+      if (ERROR_REASONS[c] != nullptr)
+        out << ",reason=\"" << ERROR_REASONS[c] << "\"";
+      out << "} " << sums[i].counter[c].load() << "\n";
+    }
+  }
+  for (const HistogramFamily &f : families()) {
+    out << "# HELP " << f.name << " " << f.help << "\n"
+        << "# TYPE " << f.name << " histogram\n";
+    for (size_t i = 0; i < names.size(); i++) {
+      const MetricsHistogram &h = sums[i].histogram[f.id];
+      uint64_t seen = 0;
+      int b = 0;
+      for (double le : f.le) {
+        double bound = le * f.scale;
+        for (; b + 1 < MetricsHistogram::NUM_BUCKETS &&
+               MetricsHistogram::Lower(b + 1) - 1 <= bound;
+             b++)
+          seen += h.Count(b);
+        out << f.name << "_bucket{" << label(names[i]) << ",le=\"" << le
+            << "\"} " << seen << "\n";
+      }
+      uint64_t total = h.Total();
+      out << f.name << "_bucket{" << label(names[i]) << ",le=\"+Inf\"} "
+          << total << "\n"
+          << f.name << "_sum{" << label(names[i]) << "} "
+          << h.Sum() / f.scale << "\n"
+          << f.name << "_count{" << label(names[i]) << "} " << total << "\n";
+    }
+  }
+  out << "# HELP gcare_query_latency_quantile_seconds Query latency "
+         "percentiles since start.\n"
+      << "# TYPE gcare_query_latency_quantile_seconds gauge\n";
+  for (size_t i = 0; i < names.size(); i++)
+    for (double q : {0.5, 0.9, 0.99, 0.999})
+      out << "gcare_query_latency_quantile_seconds{" << label(names[i])
+          << ",quantile=\"" << q << "\"} "
+          << sums[i].histogram[METRIC_QUERY_SECONDS].Quantile(q) / 1e6
+          << "\n";
+  out << "# HELP gcare_summary_bytes Bytes of the summary a method has "
+         "loaded.\n"
+      << "# TYPE gcare_summary_bytes gauge\n";
+  for (size_t i = 0; i < names.size(); i++)
+    out << "gcare_summary_bytes{" << label(names[i]) << "} "
+        << summary_bytes[i] << "\n";
+  out << "# HELP gcare_memory_bytes Bytes the tracked subsystems hold now, "
+         "of in-process iterations.\n"
+      << "# TYPE gcare_memory_bytes gauge\n";
+  for (int s = 0; s < NUM_MEMORY_SUBSYSTEMS; s++)
+    out << "gcare_memory_bytes{subsystem=\"" << MemorySubsystemName(s)
+        << "\"} " << GetMemoryAccount(s).current.load() << "\n";
+  out << "# HELP gcare_resident_bytes Resident set of the process, the data "
+         "graph and summaries included.\n"
+      << "# TYPE gcare_resident_bytes gauge\n"
+      << "gcare_resident_bytes " << resident_bytes() << "\n"
+      << "# HELP gcare_uptime_seconds Seconds since the metrics started.\n"
+      << "# TYPE gcare_uptime_seconds gauge\n"
+      << "gcare_uptime_seconds "
+      << std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       Metrics::Get().Started())
+             .count()
+      << "\n";
+  return out.str();
+}
+
+// One request per connection, answered and closed; a scrape is rare and
+// small, so the requests are served one at a time.
+bool ServeMetrics(int port) {
+  signal(SIGPIPE, SIG_IGN);
+  int fd = socket(AF_INET6, SOCK_STREAM, 0);
+  int on = 1, off = 0;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  struct sockaddr_in6 addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 16) != 0) {
+    perror("metrics port");
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  std::thread([fd]() {
+    while (true) {
+      int conn = accept(fd, nullptr, nullptr);
+      if (conn < 0)
+        continue;
+      // the request line and headers, up to the blank line
+      string request;
+      char buf[4096];
+      while (request.find("\r\n\r\n") == string::npos &&
+             request.size() < 65536) {
+        ssize_t n = read(conn, buf, sizeof(buf));
+        if (n <= 0)
+          break;
+        request.append(buf, n);
+      }
+      bool metrics = request.compare(0, 13, "GET /metrics ") == 0 ||
+                     request.compare(0, 13, "GET /metrics?") == 0;
+      string body = metrics ? MetricsText() : "not found\n";
+      std::ostringstream head;
+      head << "HTTP/1.0 " << (metrics ? "200 OK" : "404 Not Found") << "\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n";
+      string response = head.str() + body;
+      for (size_t sent = 0; sent < response.size();) {
+        ssize_t n =
+            write(conn, response.data() + sent, response.size() - sent);
+        if (n <= 0)
+          break;
+        sent += n;
+      }
+      close(conn);
+    }
+  }).detach();
+  return true;
+}
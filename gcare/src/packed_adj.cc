@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cstring>
+#include "../include/packed_adj.h"
+
+// File form, 8-byte aligned: num_blocks, payload bytes (uint64 each), then
+// offset[num_blocks + 1], base[num_blocks], bits[num_blocks] and the
+// payload, each padded to 8 bytes, with 8 more bytes after the payload so
+// Get() may always load a whole word.
+
+namespace {
+
+size_t Padded(size_t bytes) { return (bytes + 7) / 8 * 8; }
+
+unsigned Width(uint32_t x) { return x == 0 ? 0 : 32 - __builtin_clz(x); }
+
+}  // namespace
+
+void PackedAdj::Build(const int* values, size_t n) {
+  size_t num_blocks = (n + BLOCK - 1) / BLOCK;
+  std::vector<int> base(num_blocks);
+  std::vector<uint8_t> bits(num_blocks);
+  std::vector<uint64_t> offset(num_blocks + 1, 0);
+#pragma omp parallel for schedule(static)
+  for (size_t b = 0; b < num_blocks; b++) {
+    const int* v = values + b * BLOCK;
+    size_t len = std::min<size_t>(BLOCK, n - b * BLOCK);
+    int lo = *std::min_element(v, v + len), hi = *std::max_element(v, v + len);
+    base[b] = lo;
+    bits[b] = Width((uint32_t)hi - (uint32_t)lo);
+  }
+  for (size_t b = 0; b < num_blocks; b++) {
+    size_t len = std::min<size_t>(BLOCK, n - b * BLOCK);
+    offset[b + 1] = offset[b] + (len * bits[b] + 7) / 8;
+  }
+  size_t payload_size = offset[num_blocks];
+
+  size_t words = 2 + (Padded(sizeof(uint64_t) * (num_blocks + 1)) +
+                      Padded(sizeof(int) * num_blocks) + Padded(num_blocks) +
+                      Padded(payload_size) + 8) / 8;
+  storage_.assign(words, 0);
+  storage_[0] = num_blocks;
+  storage_[1] = payload_size;
+  char* p = (char*)(storage_.data() + 2);
+  memcpy(p, offset.data(), sizeof(uint64_t) * (num_blocks + 1));
+  p += Padded(sizeof(uint64_t) * (num_blocks + 1));
+  memcpy(p, base.data(), sizeof(int) * num_blocks);
+  p += Padded(sizeof(int) * num_blocks);
+  memcpy(p, bits.data(), num_blocks);
+  p += Padded(num_blocks);
+  uint8_t* payload = (uint8_t*)p;
+#pragma omp parallel for schedule(static)
+  for (size_t b = 0; b < num_blocks; b++) {
+    const int* v = values + b * BLOCK;
+    size_t len = std::min<size_t>(BLOCK, n - b * BLOCK);
+    uint8_t* out = payload + offset[b];
+    // blocks start on a byte, so neighbouring blocks never share one
+    for (size_t i = 0; i < len; i++) {
+      uint64_t x = (uint32_t)v[i] - (uint32_t)base[b];
+      uint64_t bit = i * bits[b];
+      for (int left = bits[b]; left > 0;) {
+        unsigned shift = bit % 8;
+        out[bit / 8] |= (uint8_t)(x << shift);
+        x >>= 8 - shift;
+        bit += 8 - shift;
+        left -= 8 - shift;
+      }
+    }
+  }
+  Attach((const char*)storage_.data(), n);
+}
+
+void PackedAdj::Write(FILE* fp) const {
+  fwrite(offset_ - 2, sizeof(uint64_t), bytes_ / sizeof(uint64_t), fp);
+}
+
+const char* PackedAdj::Attach(const char* buffer, size_t n) {
+  const uint64_t* header = (const uint64_t*)buffer;
+  num_blocks_ = header[0];
+  if (num_blocks_ != (n + BLOCK - 1) / BLOCK) return nullptr;
+  const char* p = buffer + 2 * sizeof(uint64_t);
+  offset_ = (const uint64_t*)p;
+  p += Padded(sizeof(uint64_t) * (num_blocks_ + 1));
+  base_ = (const int*)p;
+  p += Padded(sizeof(int) * num_blocks_);
+  bits_ = (const uint8_t*)p;
+  p += Padded(num_blocks_);
+  payload_ = (const uint8_t*)p;
+  p += Padded(header[1]) + 8;
+  bytes_ = p - buffer;
+  return p;
+}
+
+bool PackedAdj::Contains(size_t begin, size_t end, int target) const {
+  // binary search down to a handful of entries, then a scan
+  while (end - begin > 8) {
+    size_t mid = begin + (end - begin) / 2;
+    if (Get(mid) <= target)
+      begin = mid;
+    else
+      end = mid;
+  }
+  for (; begin < end; begin++) {
+    int x = Get(begin);
+    if (x >= target) return x == target;
+  }
+  return false;
+}
+
+void PackedAdj::Decode(size_t begin, size_t end, int* out) const {
+  while (begin < end) {
+    size_t block = begin / BLOCK;
+    size_t stop = std::min(end, (block + 1) * BLOCK);
+    unsigned bits = bits_[block];
+    uint64_t mask = (1ull << bits) - 1;
+    const uint8_t* payload = payload_ + offset_[block];
+    int base = base_[block];
+    // one width and base per block, so the inner loop has no branches
+    for (size_t pos = begin; pos < stop; pos++) {
+      uint64_t bit = (uint64_t)(pos % BLOCK) * bits, word;
+      memcpy_word(&word, payload + bit / 8);
+      *out++ = base + (int)((word >> (bit % 8)) & mask);
+    }
+    begin = stop;
+  }
+}
@@ -0,0 +1,275 @@
+// Catalog of the label paths of a .graph binary: for every sequence of up
+// to k (edge label, direction) steps, the number of walks that follow it,
+// and with --degrees how they end:
+//
+//   gcare_catalog -d data/yago -k 3 -o yago.catalog
+//
+// The paths are expanded depth first from a shared prefix, so each prefix's
+// per-vertex walk counts are computed once and extended by every label.
+// An extension pulls the counts of each vertex's neighbours, so the threads
+// own the vertices they write and only the totals are reduced; from a few
+// vertices it pushes theirs instead. The last step needs no per-vertex
+// counts without --degrees: one pass over the list sizes of the prefix's
+// end vertices, summed per thread, counts it for every label.
+//
+// The catalog is little-endian binary: the header
+//   char magic[4] = "GCPC"; uint32 version, k, flags (1: degrees), labels;
+//   uint64 paths;
+// then per path, shortest first and in label order within a length,
+//   uint8 len; uint32 step[len] (label << 1 | out); double walks;
+// and with degrees: uint64 ends (vertices some walk ends at);
+// double max_end (the most walks ending at one vertex). Paths no walk
+// follows are left out, as are their extensions.
+#include <boost/program_options.hpp>
+#include <omp.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../include/data_graph.h"
+
+using namespace graph;
+namespace po = boost::program_options;
+
+namespace {
+
+const uint32_t CATALOG_VERSION = 1;
+const uint32_t FLAG_DEGREES = 1;
+
+struct PathStats {
+  vector<uint32_t> steps;
+  double walks;
+  uint64_t ends;
+  double max_end;
+};
+
+class PathCatalog {
+public:
+  PathCatalog(DataGraph &g, int k, bool degrees)
+      : g_(g), k_(k), degrees_(degrees) {}
+
+  // the labels with edges, and the counts of every path over them
+  void Build() {
+    int n = g_.GetNumVertices();
+    labels_.clear();
+    for (int el = 0; el < g_.GetNumELabels(); el++)
+      if (g_.GetNumEdges(el) > 0) labels_.push_back(el);
+    // each vertex's list sizes by step, slot 2 * label index + out
+    vector<int> slot_of(g_.GetNumELabels(), -1);
+    for (size_t l = 0; l < labels_.size(); l++) slot_of[labels_[l]] = 2 * l;
+    size_begin_.assign(n + 1, 0);
+    size_slot_.clear();
+    sizes_.clear();
+    for (int v = 0; v < n; v++) {
+      for (int out = 1; out >= 0; out--) {
+        range r = g_.GetELabels(v, out);
+        for (const int *el = r.begin; el != r.end; el++) {
+          int size = g_.GetAdjSize(v, *el, out);
+          if (size == 0 || slot_of[*el] < 0) continue;
+          size_slot_.push_back(slot_of[*el] + out);
+          sizes_.push_back(size);
+        }
+      }
+      size_begin_[v + 1] = sizes_.size();
+    }
+    // the vertices a step of each label and direction can end at
+    heads_.assign(labels_.size() * 2, vector<int>());
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < heads_.size(); i++) {
+      int el = labels_[i / 2];
+      bool out = i & 1;
+      for (int v = 0; v < n; v++) {
+        range r = g_.GetAdj(v, el, !out);
+        if (r.begin != r.end) heads_[i].push_back(v);
+      }
+    }
+    // level d holds the walk counts of the current prefix of d steps, zero
+    // but at the vertices of frontier d; level 0 starts a walk at every
+    // vertex
+    levels_.assign(k_ + 1, vector<double>(n, 0.0));
+    std::fill(levels_[0].begin(), levels_[0].end(), 1.0);
+    frontiers_.assign(k_ + 1, vector<int>());
+    for (int v = 0; v < n; v++) frontiers_[0].push_back(v);
+    paths_.clear();
+    vector<uint32_t> prefix;
+    Expand(prefix);
+    std::stable_sort(paths_.begin(), paths_.end(),
+                     [](const PathStats &a, const PathStats &b) {
+                       if (a.steps.size() != b.steps.size())
+                         return a.steps.size() < b.steps.size();
+                       return a.steps < b.steps;
+                     });
+  }
+
+  bool Write(const char *fn) const {
+    FILE *fp = fopen(fn, "wb");
+    if (fp == nullptr) return false;
+    uint32_t header[4] = {CATALOG_VERSION, (uint32_t)k_,
+                          degrees_ ? FLAG_DEGREES : 0,
+                          (uint32_t)labels_.size()};
+    uint64_t num_paths = paths_.size();
+    fwrite("GCPC", 1, 4, fp);
+    fwrite(header, sizeof(header), 1, fp);
+    fwrite(&num_paths, sizeof(num_paths), 1, fp);
+    for (const PathStats &p : paths_) {
+      uint8_t len = p.steps.size();
+      fwrite(&len, 1, 1, fp);
+      fwrite(p.steps.data(), sizeof(uint32_t), len, fp);
+      fwrite(&p.walks, sizeof(p.walks), 1, fp);
+      if (degrees_) {
+        fwrite(&p.ends, sizeof(p.ends), 1, fp);
+        fwrite(&p.max_end, sizeof(p.max_end), 1, fp);
+      }
+    }
+    return fclose(fp) == 0;
+  }
+
+  const vector<PathStats> &Paths() const { return paths_; }
+
+private:
+  // every extension of prefix by one step, and theirs in turn
+  void Expand(vector<uint32_t> &prefix) {
+    int d = prefix.size();
+    if (d == k_) return;
+    const vector<double> &from = levels_[d];
+    const vector<int> &frontier = frontiers_[d];
+    bool last = d + 1 == k_;
+    double *to = levels_[d + 1].data();
+    vector<int> &next = frontiers_[d + 1];
+    if (last && !degrees_) {
+      // only the totals: each walk ending at u goes on along each of u's
+      // edges, so one pass over the frontier sums up every step
+      int slots = 2 * labels_.size();
+      vector<double> totals(slots, 0.0);
+      double *sum = totals.data();
+#pragma omp parallel for schedule(dynamic, 4096) reduction(+ : sum[:slots])
+      for (size_t i = 0; i < frontier.size(); i++) {
+        int u = frontier[i];
+        for (int e = size_begin_[u]; e < size_begin_[u + 1]; e++)
+          sum[size_slot_[e]] += from[u] * sizes_[e];
+      }
+      for (size_t l = 0; l < labels_.size(); l++) {
+        for (int out = 1; out >= 0; out--) {
+          if (totals[2 * l + out] == 0) continue;
+          prefix.push_back((uint32_t)labels_[l] << 1 | out);
+          paths_.push_back(PathStats{prefix, totals[2 * l + out], 0, 0});
+          prefix.pop_back();
+        }
+      }
+      return;
+    }
+    for (size_t l = 0; l < labels_.size(); l++) {
+      int el = labels_[l];
+      for (int out = 1; out >= 0; out--) {
+        const vector<int> &heads = heads_[2 * l + out];
+        double walks = 0, max_end = 0;
+        uint64_t ends = 0;
+        next.clear();
+        if (frontier.size() * PUSH_RATIO < heads.size()) {
+          // few vertices to go on from: push their walks along their lists
+          for (int u : frontier) {
+            range r = g_.GetAdj(u, el, out);
+            for (const int *p = r.begin; p != r.end; p++) {
+              if (to[*p] == 0) next.push_back(*p);
+              to[*p] += from[u];
+            }
+          }
+          for (int v : next) {
+            walks += to[v];
+            max_end = std::max(max_end, to[v]);
+          }
+          ends = next.size();
+        } else {
+          // walks ending at v after the step: those ending at the
+          // neighbours it is reached from, i.e. its list the other way
+#pragma omp parallel for schedule(dynamic, 4096) \
+    reduction(+ : walks, ends) reduction(max : max_end)
+          for (size_t i = 0; i < heads.size(); i++) {
+            int v = heads[i];
+            range r = g_.GetAdj(v, el, !out);
+            double c = 0;
+            for (const int *p = r.begin; p != r.end; p++) c += from[*p];
+            to[v] = c;
+            walks += c;
+            ends += c > 0;
+            max_end = std::max(max_end, c);
+          }
+          for (int v : heads)
+            if (to[v] > 0) next.push_back(v);
+        }
+        if (walks > 0) {
+          prefix.push_back((uint32_t)el << 1 | out);
+          paths_.push_back(PathStats{prefix, walks, ends, max_end});
+          Expand(prefix);
+          prefix.pop_back();
+        }
+        for (int v : next) to[v] = 0;
+      }
+    }
+  }
+
+  // push a step's walks rather than pull them when the vertices they go on
+  // from are fewer than 1 / PUSH_RATIO of those they may end at
+  static const size_t PUSH_RATIO = 8;
+
+  DataGraph &g_;
+  int k_;
+  bool degrees_;
+  vector<int> labels_;
+  vector<vector<int>> heads_; // [2 * label index + out]
+  // the nonempty lists of vertex v: their slots and sizes, from
+  // size_begin_[v] to size_begin_[v + 1]
+  vector<int> size_begin_, size_slot_, sizes_;
+  vector<vector<double>> levels_;
+  vector<vector<int>> frontiers_;
+  vector<PathStats> paths_;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  po::options_description desc("gcare_catalog options");
+  desc.add_options()("help,h", "Display help message")(
+      "data,d", po::value<string>(), "binary datafile")(
+      "output,o", po::value<string>(), "catalog file")(
+      "length,k", po::value<int>()->default_value(3),
+      "longest label path, in edges")(
+      "degrees", "also record how many vertices the walks of each path end "
+                 "at, and the most walks ending at one")(
+      "threads,t", po::value<int>()->default_value(0),
+      "threads (default: OpenMP's)");
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  if (vm.count("help") || !vm.count("data") || !vm.count("output")) {
+    cout << desc;
+    return vm.count("help") ? 0 : 1;
+  }
+  int k = vm["length"].as<int>();
+  if (k < 1 || k > UINT8_MAX) {
+    fprintf(stderr, "path length must be in [1, %d]\n", UINT8_MAX);
+    return 1;
+  }
+  if (vm["threads"].as<int>() > 0) omp_set_num_threads(vm["threads"].as<int>());
+
+  DataGraph g;
+  auto start = std::chrono::steady_clock::now();
+  g.ReadBinary(vm["data"].as<string>().c_str());
+  double load_s = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start).count();
+  start = std::chrono::steady_clock::now();
+  PathCatalog catalog(g, k, vm.count("degrees") > 0);
+  catalog.Build();
+  double build_s = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start).count();
+  string out = vm["output"].as<string>();
+  if (!catalog.Write(out.c_str())) {
+    perror(out.c_str());
+    return 1;
+  }
+  printf("%zu label paths of up to %d edges (%.2f s to load, %.2f s to "
+         "count)\n",
+         catalog.Paths().size(), k, load_s, build_s);
+  return 0;
+}
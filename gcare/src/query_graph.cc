@@ -1,100 +1,54 @@
-#include <fstream>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <string>
 #include "../include/query_graph.h"
 
+namespace graph {
+
 void QueryGraph::ReadText(const char* fn) {
   fn_ = string(fn);
-    vnum_ = enum_ = 0;
-    edge_.clear();
-    adj_.clear();
-    in_adj_.clear();
-    vl_.clear();
-    bound_.clear();
-	ifstream input(fn);
-	string line;
-	int max_vl = -1, max_el = -1;
-    while (getline(input, line)) {
-        auto tok = parse(line, " ");
-        if (tok[0][0] == 'v') {
-			int vl = stoi(tok[2]);
-			max_vl = std::max(max_vl, vl);
-			vl_.push_back(vl);
-			int bound = stoi(tok[3]);
-			bound_.push_back(bound);
-			vnum_++;
-        }
-        if (tok[0][0] == 'e') {
-            if (adj_.size() == 0)
-                adj_.resize(vnum_);
-            if (in_adj_.size() == 0)
-                in_adj_.resize(vnum_);
-            int src = stoi(tok[1]);
-            int dst = stoi(tok[2]);
-            int el  = stoi(tok[3]);
-            assert(src < vnum_);
-            assert(dst < vnum_);
-            max_el = std::max(max_el, el);
-            edge_.emplace_back(src, dst, el);
-            adj_[src].push_back(make_pair(dst, el));
-            in_adj_[dst].push_back(make_pair(src, el));
-            //cout << "Q add edge (" << src << ", " << dst << ", " << el << ")" << endl;
-            enum_++;
-        }
-    }
-    if (adj_.size() == 0)
-        adj_.resize(vnum_);
-    if (in_adj_.size() == 0)
-        in_adj_.resize(vnum_);
-	vl_num_ = max_vl + 1;
-	el_num_ = max_el + 1;
+    QueryText text;
+    text.ReadFile(fn);
+    Read(text, 0);
 }
 
-void QueryGraph::ReadText(std::vector<std::string> &text) {
-    //fn_ = string(fn);
+void QueryGraph::ReadText(std::vector<std::string> &lines) {
+    QueryText text;
+    text.ReadLines(lines);
+    Read(text, 0);
+}
+
+void QueryGraph::Read(const QueryText& text, size_t q) {
     vnum_ = enum_ = 0;
     edge_.clear();
     adj_.clear();
     in_adj_.clear();
     vl_.clear();
     bound_.clear();
-	//ifstream input(fn);
-	string line;
 	int max_vl = -1, max_el = -1;
-    for (auto &line: text) {
-    //while (getline(input, line)) {
-        auto tok = parse(line, " ");
-        if (tok[0][0] == 'v') {
-			int vl = stoi(tok[2]);
-			max_vl = std::max(max_vl, vl);
-			vl_.push_back(vl);
-			int bound = stoi(tok[3]);
-			bound_.push_back(bound);
+    if (q < text.size()) {
+        const QueryText::Query& query = text.queries[q];
+        for (size_t i = query.vertex_begin; i < query.vertex_end; i++) {
+            const QueryText::Vertex& v = text.vertices[i];
+			max_vl = std::max(max_vl, v.label);
+			vl_.push_back(v.label);
+			bound_.push_back(v.bound);
 			vnum_++;
         }
-        if (tok[0][0] == 'e') {
-            if (adj_.size() == 0)
-                adj_.resize(vnum_);
-            if (in_adj_.size() == 0)
-                in_adj_.resize(vnum_);
-            int src = stoi(tok[1]);
-            int dst = stoi(tok[2]);
-            int el  = stoi(tok[3]);
-            assert(src < vnum_);
-            assert(dst < vnum_);
-            max_el = std::max(max_el, el);
-            edge_.emplace_back(src, dst, el);
-            adj_[src].push_back(make_pair(dst, el));
-            in_adj_[dst].push_back(make_pair(src, el));
-            //cout << "Q add edge (" << src << ", " << dst << ", " << el << ")" << endl;
+        adj_.resize(vnum_);
+        in_adj_.resize(vnum_);
+        for (size_t i = query.edge_begin; i < query.edge_end; i++) {
+            const QueryText::Edge& e = text.edges[i];
+            assert(e.src < vnum_);
+            assert(e.dst < vnum_);
+            max_el = std::max(max_el, e.label);
+            edge_.emplace_back(e.src, e.dst, e.label);
+            adj_[e.src].push_back(make_pair(e.dst, e.label));
+            in_adj_[e.dst].push_back(make_pair(e.src, e.label));
             enum_++;
         }
     }
-    if (adj_.size() == 0)
-        adj_.resize(vnum_);
-    if (in_adj_.size() == 0)
-        in_adj_.resize(vnum_);
 	vl_num_ = max_vl + 1;
 	el_num_ = max_el + 1;
 }
@@ -111,3 +65,150 @@ int QueryGraph::GetELabel(int u, int v) {
 	}
 	return -1;
 }
+
+//orders of the vertices within classes tried at most
+static const long CANONICAL_MAX_ORDERS = 5040;
+
+void QueryGraph::MapBounds(const vector<int>& map) {
+	for (int& b : bound_)
+		if (b >= 0 && b < (int)map.size())
+			b = map[b];
+}
+
+void QueryGraph::MapLabels(const LabelMap& vl_map, const LabelMap& el_map) {
+	if (vl_map.empty() && el_map.empty())
+		return;
+	int max_vl = -1, max_el = -1;
+	for (int& l : vl_) {
+		l = vl_map(l);
+		max_vl = std::max(max_vl, l);
+	}
+	for (Edge& e : edge_) {
+		e.el = el_map(e.el);
+		max_el = std::max(max_el, e.el);
+	}
+	for (auto* adj : {&adj_, &in_adj_})
+		for (auto& list : *adj)
+			for (auto& p : list)
+				p.second = el_map(p.second);
+	vl_num_ = max_vl + 1;
+	el_num_ = max_el + 1;
+}
+
+string QueryGraph::CanonicalForm() {
+    //vertex invariant: label, binding, sorted out and in edge labels
+    vector<vector<int>> inv(vnum_);
+    for (int u = 0; u < vnum_; u++) {
+        inv[u] = {vl_[u], bound_[u]};
+        vector<int> out, in;
+        for (auto& p : adj_[u]) out.push_back(p.second);
+        for (auto& p : in_adj_[u]) in.push_back(p.second);
+        sort(out.begin(), out.end());
+        sort(in.begin(), in.end());
+        inv[u].push_back(out.size());
+        inv[u].insert(inv[u].end(), out.begin(), out.end());
+        inv[u].insert(inv[u].end(), in.begin(), in.end());
+    }
+    vector<int> order(vnum_);
+    for (int u = 0; u < vnum_; u++) order[u] = u;
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        return inv[a] != inv[b] ? inv[a] < inv[b] : a < b;
+    });
+    vector<pair<int, int>> classes; //[begin, end) in order
+    long num_orders = 1;
+    for (int i = 0, j; i < vnum_; i = j) {
+        for (j = i + 1; j < vnum_ && inv[order[j]] == inv[order[i]]; j++)
+            if (num_orders <= CANONICAL_MAX_ORDERS) num_orders *= j - i + 1;
+        if (j - i > 1) classes.emplace_back(i, j);
+    }
+    if (num_orders > CANONICAL_MAX_ORDERS) classes.clear();
+
+    //smallest edge list over all orders, edges renumbered by position
+    vector<int> pos(vnum_);
+    vector<Edge> best, cur(enum_);
+    while (true) {
+        for (int i = 0; i < vnum_; i++) pos[order[i]] = i;
+        for (int i = 0; i < enum_; i++)
+            cur[i] = Edge(pos[edge_[i].src], pos[edge_[i].dst], edge_[i].el);
+        sort(cur.begin(), cur.end());
+        if (best.empty() || cur < best) best = cur;
+        int k = classes.size() - 1;
+        for (; k >= 0; k--) {
+            auto first = order.begin() + classes[k].first;
+            auto last = order.begin() + classes[k].second;
+            if (next_permutation(first, last)) break;
+        }
+        if (k < 0) break;
+    }
+
+    string res;
+    for (int u : order)
+        res += to_string(vl_[u]) + ',' + to_string(bound_[u]) + ';';
+    for (auto& e : best)
+        res += to_string(e.src) + ',' + to_string(e.dst) + ',' + to_string(e.el) + ';';
+    return res;
+}
+
+QueryGraph QueryGraph::Subgraph(uint64_t mask) {
+    QueryGraph sub;
+    vector<int> id(vnum_, -1);
+    for (int i = 0; i < enum_; i++) {
+        if (!(mask >> i & 1)) continue;
+        for (int u : {edge_[i].src, edge_[i].dst})
+            if (id[u] < 0) id[u] = 0;
+    }
+    for (int u = 0; u < vnum_; u++) {
+        if (id[u] < 0) continue;
+        id[u] = sub.vnum_++;
+        sub.vl_.push_back(vl_[u]);
+        sub.bound_.push_back(bound_[u]);
+    }
+    sub.adj_.resize(sub.vnum_);
+    sub.in_adj_.resize(sub.vnum_);
+    for (int i = 0; i < enum_; i++) {
+        if (!(mask >> i & 1)) continue;
+        Edge e(id[edge_[i].src], id[edge_[i].dst], edge_[i].el);
+        sub.edge_.push_back(e);
+        sub.adj_[e.src].push_back(make_pair(e.dst, e.el));
+        sub.in_adj_[e.dst].push_back(make_pair(e.src, e.el));
+        sub.enum_++;
+    }
+    sub.vl_num_ = vl_num_;
+    sub.el_num_ = el_num_;
+    return sub;
+}
+
+//grown edge by edge from the single edges: each set of one size extended
+//by every edge touching it makes the sets of the next
+vector<uint64_t> QueryGraph::ConnectedEdgeSets(size_t max) {
+    vector<uint64_t> sets;
+    if (enum_ > MAX_PATTERN_EDGES) return sets;
+    //the edges sharing a vertex with each edge
+    vector<uint64_t> touching(enum_, 0);
+    for (int i = 0; i < enum_; i++)
+        for (int j = 0; j < enum_; j++)
+            if (i != j && (edge_[i].src == edge_[j].src || edge_[i].src == edge_[j].dst ||
+                           edge_[i].dst == edge_[j].src || edge_[i].dst == edge_[j].dst))
+                touching[i] |= uint64_t(1) << j;
+    vector<uint64_t> level;
+    for (int i = 0; i < enum_; i++) level.push_back(uint64_t(1) << i);
+    while (!level.empty() && sets.size() < max) {
+        sets.insert(sets.end(), level.begin(),
+                    level.begin() + std::min(level.size(), max - sets.size()));
+        vector<uint64_t> next;
+        for (uint64_t set : level) {
+            uint64_t border = 0;
+            for (int i = 0; i < enum_; i++)
+                if (set >> i & 1) border |= touching[i];
+            border &= ~set;
+            for (int i = 0; i < enum_; i++)
+                if (border >> i & 1) next.push_back(set | uint64_t(1) << i);
+        }
+        sort(next.begin(), next.end());
+        next.erase(unique(next.begin(), next.end()), next.end());
+        level.swap(next);
+    }
+    return sets;
+}
+
+}  // namespace graph
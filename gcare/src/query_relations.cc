@@ -1,5 +1,4 @@
 #include "../include/query_relations.h"
-#include "../include/ndvector.h"
 
 #include <algorithm>
 #include <vector>
@@ -16,6 +15,8 @@ using std::string;
 using std::pair;
 using std::make_pair;
 
+namespace relational {
+
 /*
 QueryGraph::QueryGraph(void) {
 	table_.clear();
@@ -114,3 +115,4 @@ void QueryGraph::ReadText(const char* filename) {
 }
 */
 
+}  // namespace relational
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "../include/simd_search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SIMD_NEON
+#endif
+
+namespace {
+
+// the elements from k on of the MinHash kernels, one at a time
+static inline void MinHashTail(int k, int val, const int* a, const int* b, int n, int* mins) {
+	for (; k < n; k++) {
+		int h = (int) ((unsigned) val * (unsigned) a[k] + (unsigned) b[k]);
+		if (h < mins[k]) mins[k] = h;
+	}
+}
+
+static inline int CountEqualTail(int k, const int* a, const int* b, int n) {
+	int count = 0;
+	for (; k < n; k++) count += a[k] == b[k];
+	return count;
+}
+
+static inline int64_t DotProductTail(int k, const int* a, const int* b, int n) {
+	int64_t sum = 0;
+	for (; k < n; k++) sum += (int64_t) a[k] * b[k];
+	return sum;
+}
+
+static inline void UnpackBitsTail(int k, const uint32_t* words, int width, int base, int n, int* out) {
+	uint32_t mask = width == 32 ? ~0u : (1u << width) - 1;
+	for (; k < n; k++) {
+		uint64_t bit = (uint64_t) k * width;
+		uint64_t w = words[bit >> 5] | (uint64_t) words[(bit >> 5) + 1] << 32;
+		out[k] = (int) ((uint32_t) base + ((uint32_t) (w >> (bit & 31)) & mask));
+	}
+}
+
+namespace scalar {
+	static const int W = 4;
+	static inline int CountLess(const int* p, int t) {
+		return (p[0] < t) + (p[1] < t) + (p[2] < t) + (p[3] < t);
+	}
+	static inline bool HasEqual(const int* p, int t) {
+		return (p[0] == t) | (p[1] == t) | (p[2] == t) | (p[3] == t);
+	}
+	static void MinHashUpdate(int val, const int* a, const int* b, int n, int* mins) {
+		MinHashTail(0, val, a, b, n, mins);
+	}
+	static int CountEqual(const int* a, const int* b, int n) {
+		return CountEqualTail(0, a, b, n);
+	}
+	static void UnpackBits(const uint32_t* words, int width, int base, int n, int* out) {
+		UnpackBitsTail(0, words, width, base, n, out);
+	}
+	static int64_t DotProduct(const int* a, const int* b, int n) {
+		return DotProductTail(0, a, b, n);
+	}
+#include "simd_search.inc"
+}
+
+#ifdef SIMD_X86
+#pragma GCC push_options
+#pragma GCC target("avx2,popcnt")
+namespace avx2 {
+	static const int W = 8;
+	static inline int CountLess(const int* p, int t) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) p);
+		__m256i lt = _mm256_cmpgt_epi32(_mm256_set1_epi32(t), v);
+		return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+	}
+	static inline bool HasEqual(const int* p, int t) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) p);
+		return _mm256_movemask_epi8(_mm256_cmpeq_epi32(v, _mm256_set1_epi32(t))) != 0;
+	}
+	static void MinHashUpdate(int val, const int* a, const int* b, int n, int* mins) {
+		__m256i x = _mm256_set1_epi32(val);
+		int k = 0;
+		for (; k + W <= n; k += W) {
+			__m256i h = _mm256_add_epi32(
+				_mm256_mullo_epi32(x, _mm256_loadu_si256((const __m256i*) (a + k))),
+				_mm256_loadu_si256((const __m256i*) (b + k)));
+			__m256i m = _mm256_loadu_si256((const __m256i*) (mins + k));
+			_mm256_storeu_si256((__m256i*) (mins + k), _mm256_min_epi32(m, h));
+		}
+		MinHashTail(k, val, a, b, n, mins);
+	}
+	static int CountEqual(const int* a, const int* b, int n) {
+		int count = 0, k = 0;
+		for (; k + W <= n; k += W) {
+			__m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*) (a + k)),
+				_mm256_loadu_si256((const __m256i*) (b + k)));
+			count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(eq)));
+		}
+		return count + CountEqualTail(k, a, b, n);
+	}
+	static int64_t DotProduct(const int* a, const int* b, int n) {
+		// sign-extended to 64-bit lanes, whose low halves _mm256_mul_epi32 multiplies
+		__m256i sum = _mm256_setzero_si256();
+		int k = 0;
+		for (; k + W <= n; k += W) {
+			__m256i va = _mm256_loadu_si256((const __m256i*) (a + k));
+			__m256i vb = _mm256_loadu_si256((const __m256i*) (b + k));
+			sum = _mm256_add_epi64(sum, _mm256_mul_epi32(
+				_mm256_cvtepi32_epi64(_mm256_castsi256_si128(va)),
+				_mm256_cvtepi32_epi64(_mm256_castsi256_si128(vb))));
+			sum = _mm256_add_epi64(sum, _mm256_mul_epi32(
+				_mm256_cvtepi32_epi64(_mm256_extracti128_si256(va, 1)),
+				_mm256_cvtepi32_epi64(_mm256_extracti128_si256(vb, 1))));
+		}
+		int64_t lanes[4];
+		_mm256_storeu_si256((__m256i*) lanes, sum);
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3] + DotProductTail(k, a, b, n);
+	}
+	// each lane shifts the two words its bits start in, fetched by gathers
+	// relative to the first word of the group
+	static void UnpackBits(const uint32_t* words, int width, int base, int n, int* out) {
+		__m256i mask = _mm256_set1_epi32(width == 32 ? -1 : (1 << width) - 1);
+		__m256i lanes = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(width));
+		int k = 0;
+		for (; k + W <= n; k += W) {
+			uint64_t first = (uint64_t) k * width;
+			const int* p = (const int*) (words + (first >> 5));
+			__m256i bits = _mm256_add_epi32(lanes, _mm256_set1_epi32(first & 31));
+			__m256i idx = _mm256_srli_epi32(bits, 5);
+			__m256i sh = _mm256_and_si256(bits, _mm256_set1_epi32(31));
+			__m256i lo = _mm256_i32gather_epi32(p, idx, 4);
+			__m256i hi = _mm256_i32gather_epi32(p + 1, idx, 4);
+			// a shift by 32 gives 0, so hi drops out when sh is 0
+			__m256i v = _mm256_or_si256(_mm256_srlv_epi32(lo, sh),
+				_mm256_sllv_epi32(hi, _mm256_sub_epi32(_mm256_set1_epi32(32), sh)));
+			_mm256_storeu_si256((__m256i*) (out + k),
+				_mm256_add_epi32(_mm256_and_si256(v, mask), _mm256_set1_epi32(base)));
+		}
+		UnpackBitsTail(k, words, width, base, n, out);
+	}
+#include "simd_search.inc"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,popcnt")
+namespace avx512 {
+	static const int W = 16;
+	static inline int CountLess(const int* p, int t) {
+		__m512i v = _mm512_loadu_si512((const void*) p);
+		return __builtin_popcount(_mm512_cmplt_epi32_mask(v, _mm512_set1_epi32(t)));
+	}
+	static inline bool HasEqual(const int* p, int t) {
+		__m512i v = _mm512_loadu_si512((const void*) p);
+		return _mm512_cmpeq_epi32_mask(v, _mm512_set1_epi32(t)) != 0;
+	}
+	static void MinHashUpdate(int val, const int* a, const int* b, int n, int* mins) {
+		__m512i x = _mm512_set1_epi32(val);
+		int k = 0;
+		for (; k + W <= n; k += W) {
+			__m512i h = _mm512_add_epi32(
+				_mm512_mullo_epi32(x, _mm512_loadu_si512((const void*) (a + k))),
+				_mm512_loadu_si512((const void*) (b + k)));
+			__m512i m = _mm512_loadu_si512((const void*) (mins + k));
+			_mm512_storeu_si512((void*) (mins + k), _mm512_min_epi32(m, h));
+		}
+		MinHashTail(k, val, a, b, n, mins);
+	}
+	static int CountEqual(const int* a, const int* b, int n) {
+		int count = 0, k = 0;
+		for (; k + W <= n; k += W)
+			count += __builtin_popcount(_mm512_cmpeq_epi32_mask(
+				_mm512_loadu_si512((const void*) (a + k)), _mm512_loadu_si512((const void*) (b + k))));
+		return count + CountEqualTail(k, a, b, n);
+	}
+	static int64_t DotProduct(const int* a, const int* b, int n) {
+		__m512i sum = _mm512_setzero_si512();
+		int k = 0;
+		for (; k + 8 <= n; k += 8)
+			sum = _mm512_add_epi64(sum, _mm512_mul_epi32(
+				_mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*) (a + k))),
+				_mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i*) (b + k)))));
+		return _mm512_reduce_add_epi64(sum) + DotProductTail(k, a, b, n);
+	}
+	static void UnpackBits(const uint32_t* words, int width, int base, int n, int* out) {
+		__m512i mask = _mm512_set1_epi32(width == 32 ? -1 : (1 << width) - 1);
+		__m512i lanes = _mm512_mullo_epi32(
+			_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(width));
+		int k = 0;
+		for (; k + W <= n; k += W) {
+			uint64_t first = (uint64_t) k * width;
+			const int* p = (const int*) (words + (first >> 5));
+			__m512i bits = _mm512_add_epi32(lanes, _mm512_set1_epi32(first & 31));
+			__m512i idx = _mm512_srli_epi32(bits, 5);
+			__m512i sh = _mm512_and_si512(bits, _mm512_set1_epi32(31));
+			__m512i lo = _mm512_i32gather_epi32(idx, p, 4);
+			__m512i hi = _mm512_i32gather_epi32(idx, p + 1, 4);
+			__m512i v = _mm512_or_si512(_mm512_srlv_epi32(lo, sh),
+				_mm512_sllv_epi32(hi, _mm512_sub_epi32(_mm512_set1_epi32(32), sh)));
+			_mm512_storeu_si512((void*) (out + k),
+				_mm512_add_epi32(_mm512_and_si512(v, mask), _mm512_set1_epi32(base)));
+		}
+		UnpackBitsTail(k, words, width, base, n, out);
+	}
+#include "simd_search.inc"
+}
+#pragma GCC pop_options
+#endif
+
+#ifdef SIMD_NEON
+namespace neon {
+	static const int W = 4;
+	static inline int CountLess(const int* p, int t) {
+		uint32x4_t lt = vcltq_s32(vld1q_s32(p), vdupq_n_s32(t));
+		return -vaddvq_s32(vreinterpretq_s32_u32(lt));
+	}
+	static inline bool HasEqual(const int* p, int t) {
+		return vmaxvq_u32(vceqq_s32(vld1q_s32(p), vdupq_n_s32(t))) != 0;
+	}
+	static void MinHashUpdate(int val, const int* a, const int* b, int n, int* mins) {
+		int32x4_t x = vdupq_n_s32(val);
+		int k = 0;
+		for (; k + W <= n; k += W) {
+			int32x4_t h = vmlaq_s32(vld1q_s32(b + k), x, vld1q_s32(a + k));
+			vst1q_s32(mins + k, vminq_s32(vld1q_s32(mins + k), h));
+		}
+		MinHashTail(k, val, a, b, n, mins);
+	}
+	static int CountEqual(const int* a, const int* b, int n) {
+		int count = 0, k = 0;
+		for (; k + W <= n; k += W)
+			count -= vaddvq_s32(vreinterpretq_s32_u32(vceqq_s32(vld1q_s32(a + k), vld1q_s32(b + k))));
+		return count + CountEqualTail(k, a, b, n);
+	}
+	static int64_t DotProduct(const int* a, const int* b, int n) {
+		int64x2_t sum = vdupq_n_s64(0);
+		int k = 0;
+		for (; k + W <= n; k += W) {
+			int32x4_t va = vld1q_s32(a + k), vb = vld1q_s32(b + k);
+			sum = vmlal_s32(sum, vget_low_s32(va), vget_low_s32(vb));
+			sum = vmlal_high_s32(sum, va, vb);
+		}
+		return vaddvq_s64(sum) + DotProductTail(k, a, b, n);
+	}
+	// NEON has no gather, so the shifts are done one value at a time
+	static void UnpackBits(const uint32_t* words, int width, int base, int n, int* out) {
+		UnpackBitsTail(0, words, width, base, n, out);
+	}
+#include "simd_search.inc"
+}
+#endif
+
+struct Kernels {
+	const char* name;
+	const int* (*lower_bound)(const int*, const int*, int);
+	int (*contains_batch)(range, const int*, int, bool*);
+	int (*intersect)(range, range, int*);
+	void (*min_hash_update)(int, const int*, const int*, int, int*);
+	int (*count_equal)(const int*, const int*, int);
+	int64_t (*dot_product)(const int*, const int*, int);
+	void (*unpack_bits)(const uint32_t*, int, int, int, int*);
+};
+
+#define KERNELS(ns) { #ns, ns::LowerBound, ns::ContainsBatch, ns::Intersect, \
+	ns::MinHashUpdate, ns::CountEqual, ns::DotProduct, ns::UnpackBits }
+
+Kernels Select() {
+	const char* force = getenv("GCARE_SIMD");
+	Kernels candidates[] = {
+#ifdef SIMD_X86
+		KERNELS(avx512),
+		KERNELS(avx2),
+#endif
+#ifdef SIMD_NEON
+		KERNELS(neon),
+#endif
+		KERNELS(scalar),
+	};
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+#endif
+	for (const Kernels& k : candidates) {
+		if (force && strcmp(force, k.name) != 0) continue;
+#ifdef SIMD_X86
+		if (k.lower_bound == avx512::LowerBound && !__builtin_cpu_supports("avx512f")) continue;
+		if (k.lower_bound == avx2::LowerBound && !__builtin_cpu_supports("avx2")) continue;
+#endif
+		return k;
+	}
+	return KERNELS(scalar);
+}
+
+#undef KERNELS
+
+const Kernels kernels = Select();
+
+}
+
+const int* LowerBound(const int* begin, const int* end, int target) {
+	return kernels.lower_bound(begin, end, target);
+}
+
+bool Contains(range r, int target) {
+	const int* p = kernels.lower_bound(r.begin, r.end, target);
+	return p != r.end && *p == target;
+}
+
+int ContainsBatch(range r, const int* targets, int n, bool* found) {
+	return kernels.contains_batch(r, targets, n, found);
+}
+
+int Intersect(range a, range b, int* out) {
+	return kernels.intersect(a, b, out);
+}
+
+void MinHashUpdate(int val, const int* a, const int* b, int n, int* mins) {
+	kernels.min_hash_update(val, a, b, n, mins);
+}
+
+int CountEqual(const int* a, const int* b, int n) {
+	return kernels.count_equal(a, b, n);
+}
+
+int64_t DotProduct(const int* a, const int* b, int n) {
+	return kernels.dot_product(a, b, n);
+}
+
+void UnpackBits(const uint32_t* words, int width, int base, int n, int* out) {
+	kernels.unpack_bits(words, width, base, n, out);
+}
+
+const char* SimdKernelName() {
+	return kernels.name;
+}
@@ -0,0 +1,101 @@
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include "../include/start_pool.h"
+
+namespace graph {
+
+// CHUNK pairs at a time, drawn by the first reader to need them
+struct StartPool::Draws {
+	DataGraph* g;
+	bool edge;
+	int label;
+	bool empty;
+	Rng rng;
+	std::mutex lock;
+	std::deque<std::vector<int>> chunks;
+	// chunk k, drawn first if need be
+	const int* Chunk(size_t k);
+};
+
+namespace {
+
+// (graph, its updates, edge, label, stream) -> the draws
+typedef std::tuple<DataGraph*, int64_t, bool, int, uint64_t> PoolKey;
+
+std::mutex pool_lock;
+std::map<PoolKey, std::shared_ptr<StartPool::Draws>> pool;
+size_t pool_draws = 0; //of the streams in pool
+
+}  // namespace
+
+bool StartPool::Enabled() {
+	static const bool enabled = []() {
+		const char* on = getenv("GCARE_START_POOL");
+		return on != nullptr && atoi(on) == 1;
+	}();
+	return enabled;
+}
+
+StartPool::Stream StartPool::Open(DataGraph& g, bool edge, int label, uint64_t stream) {
+	PoolKey key(&g, g.NumUpdates(), edge, label, stream);
+	Stream s;
+	std::lock_guard<std::mutex> guard(pool_lock);
+	auto it = pool.find(key);
+	if (it != pool.end()) {
+		s.draws_ = it->second;
+		return s;
+	}
+	if (pool_draws >= MAX_DRAWS) {
+		pool.clear();
+		pool_draws = 0;
+	}
+	auto draws = std::make_shared<Draws>();
+	draws->g = &g;
+	draws->edge = edge;
+	draws->label = label;
+	draws->empty = edge ? g.GetNumEdges(label) == 0 : g.GetNumVertices(label) == 0;
+	draws->rng.Seed(stream ^ ((uint64_t)(uint32_t)label << 1 | edge));
+	pool[key] = draws;
+	//counted when opened, as the chunks its readers will take
+	pool_draws += CHUNK;
+	s.draws_ = draws;
+	return s;
+}
+
+const int* StartPool::Draws::Chunk(size_t k) {
+	std::lock_guard<std::mutex> guard(lock);
+	while (chunks.size() <= k) {
+		chunks.emplace_back(2 * CHUNK);
+		int* t = chunks.back().data();
+		for (size_t i = 0; i < CHUNK; i++, t += 2) {
+			if (edge) {
+				g->GetRandomEdge(label, rng, t);
+			} else {
+				g->GetRandomVertex(label, rng, t);
+				t[1] = t[0];
+			}
+		}
+		if (chunks.size() > 1) {
+			std::lock_guard<std::mutex> pool_guard(pool_lock);
+			pool_draws += CHUNK;
+		}
+	}
+	return chunks[k].data();
+}
+
+bool StartPool::Stream::Next(int* t) {
+	if (draws_->empty)
+		return false;
+	if (chunk_ == nullptr || pos_ % CHUNK == 0)
+		chunk_ = draws_->Chunk(pos_ / CHUNK);
+	const int* d = chunk_ + 2 * (pos_ % CHUNK);
+	t[0] = d[0];
+	t[1] = d[1];
+	pos_++;
+	return true;
+}
+
+}  // namespace graph
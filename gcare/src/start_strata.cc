@@ -0,0 +1,115 @@
+#include <cassert>
+#include <cmath>
+#include <unistd.h>
+#include "../include/start_strata.h"
+
+namespace graph {
+
+void StartStrata::Build(DataGraph& g) {
+	int vnum = g.GetNumVertices();
+	vector<int64_t> deg(vnum, 0);
+	for (int v = 0; v < vnum; v++)
+		for (int d = 0; d < 2; d++) {
+			range r = g.GetELabels(v, d == 0);
+			for (const int* l = r.begin; l != r.end; l++)
+				deg[v] += g.GetAdjSize(v, *l, d == 0);
+		}
+
+	int el_num = g.GetNumELabels();
+	built_.clear();
+	built_.push_back(el_num);
+	for (int el = 0; el < el_num; el++) {
+		int64_t n = g.GetNumEdges(el);
+		vector<vector<int>> strata(64);
+		for (int64_t i = 0; i < n; i++) {
+			int t[2];
+			g.GetEdge(el, i, t);
+			uint64_t w = (uint64_t)std::max<int64_t>(deg[t[0]] * deg[t[1]], 1);
+			strata[63 - __builtin_clzll(w)].push_back(i);
+		}
+		int num = 0;
+		for (auto& s : strata)
+			num += !s.empty();
+		built_.push_back(num);
+		for (int h = 0; h < 64; h++)
+			if (!strata[h].empty()) {
+				built_.push_back(h);
+				built_.push_back(strata[h].size());
+			}
+		for (auto& s : strata)
+			built_.insert(built_.end(), s.begin(), s.end());
+	}
+	attach(built_.data(), built_.data() + built_.size());
+}
+
+void StartStrata::Write(const char* fn) {
+	FILE* fp = fopen(fn, "wb");
+	int header[2] = {MAGIC, VERSION};
+	fwrite(header, sizeof(int), 2, fp);
+	fwrite(built_.data(), sizeof(int), built_.size(), fp);
+	fclose(fp);
+}
+
+bool StartStrata::Read(const char* fn) {
+	UnloadFile(summary_, summary_size_, LOAD_MMAP);
+	summary_ = nullptr;
+	summary_size_ = 0;
+	labels_.clear();
+	if (access(fn, R_OK) != 0)
+		return false;
+	summary_ = LoadFile(fn, summary_size_, SummaryLoadMode());
+	if (summary_ == nullptr)
+		return false;
+	const int* p = (const int*) summary_;
+	if (summary_size_ < 3 * sizeof(int) || p[0] != MAGIC || p[1] != VERSION) {
+		fprintf(stderr, "%s: not a start strata summary, ignored\n", fn);
+		return false;
+	}
+	attach(p + 2, p + summary_size_ / sizeof(int));
+	return true;
+}
+
+void StartStrata::attach(const int* p, const int* end) {
+	int el_num = *p++;
+	labels_.assign(el_num, Label());
+	for (auto& l : labels_) {
+		assert(p < end);
+		l.num_strata = *p++;
+		l.strata = p;
+		p += 2 * l.num_strata;
+		l.edges = p;
+		double n = 0, mass = 0;
+		for (int i = 0; i < l.num_strata; i++) {
+			n += l.strata[2 * i + 1];
+			mass += l.strata[2 * i + 1] * std::exp2(l.strata[2 * i] * 0.5);
+		}
+		l.cum.resize(l.num_strata);
+		l.begin.resize(l.num_strata);
+		double cum = 0;
+		int begin = 0;
+		for (int i = 0; i < l.num_strata; i++) {
+			int cnt = l.strata[2 * i + 1];
+			cum += 0.5 * cnt / n + 0.5 * cnt * std::exp2(l.strata[2 * i] * 0.5) / mass;
+			l.cum[i] = cum;
+			l.begin[i] = begin;
+			begin += cnt;
+		}
+		p += begin;
+	}
+}
+
+double StartStrata::Sample(DataGraph& g, int el, Rng& rng, int* t) {
+	if (el >= labels_.size() || labels_[el].num_strata == 0)
+		return 0;
+	const Label& l = labels_[el];
+	double u = (rng.Next() >> 11) * 0x1.0p-53 * l.cum.back();
+	int h = 0;
+	while (h + 1 < l.num_strata && l.cum[h] <= u)
+		h++;
+	int cnt = l.strata[2 * h + 1];
+	g.GetEdge(el, l.edges[l.begin[h] + rng.Uniform(cnt)], t);
+	double prob = (l.cum[h] - (h ? l.cum[h - 1] : 0)) / l.cum.back();
+	return cnt / prob;
+}
+
+}  // namespace graph
@@ -1,9 +1,17 @@
 #include <cassert>
 #include "../include/sumrdf.h"
+#include "../include/simd_search.h"
 #include "../include/util.h"
 
+#include <omp.h>
+#include <map>
 #include <random>
 #include <set>
+#include <tuple>
+
+namespace graph {
+
+REGISTER_ESTIMATOR("sumrdf", SumRDF);
 
 SumRDF::Type::Type() {
   classes_.clear();
@@ -11,40 +19,20 @@ SumRDF::Type::Type() {
   incoming_.clear();
 }
 
-// Convert type to string
-string SumRDF::Type::ToString() {
-  string s = "";
-  // C == classes_
-  for (int x : classes_) {
-    s = std::to_string(x) + s;
-    s = "|" + s;
-  }
-  s = "|" + s;
-  // O == outgoing_
-  for (int x : outgoing_) {
-    s = std::to_string(x) + s;
-    s = "|" + s;
-  }
-  s = "|" + s;
-  // I == incoming_
-  for (int x : incoming_) {
-    s = std::to_string(x) + s;
-    s = "|" + s;
-  }
-  s = "|" + s;
-  return s;
+void SumRDF::Type::Normalize() {
+  for (auto* s : {&classes_, &outgoing_, &incoming_}) {
+    std::sort(s->begin(), s->end());
+    s->erase(std::unique(s->begin(), s->end()), s->end());
+  }
 }
 
-// Convert type to string using only classes (C(d) == classes_)
-string SumRDF::Type::ToStringByClass() {
-  string s = "";
-  // C == classes_
-  for (int x : classes_) {
-    s = std::to_string(x) + s;
-    s = "|" + s;
+size_t SumRDF::Type::Hash() const {
+  size_t h = 0;
+  for (auto* s : {&classes_, &outgoing_, &incoming_}) {
+    boost::hash_combine(h, s->size());
+    boost::hash_range(h, s->begin(), s->end());
   }
-  s = "|" + s;
-  return s;
+  return h;
 }
 
 SumRDF::Resource::Resource() {
@@ -76,38 +64,42 @@ void SumRDF::PrepareSummaryStructure(DataGraph& g, double ratio) {
       int vl = *rv.begin;
       // C == type_.classes_
       // For fair comparisons, we assign vertex labels to C for URIs and literals
-      g_resources_[i].type_.classes_.insert(vl);
+      g_resources_[i].type_.classes_.push_back(vl);
     }
     for (auto re = g.GetELabels(i, true); re.begin != re.end; re.begin++) {
       int el = *re.begin;
       // O == type_.outgoing_
-      g_resources_[i].type_.outgoing_.insert(el);
+      g_resources_[i].type_.outgoing_.push_back(el);
     }
     for (auto re = g.GetELabels(i, false); re.begin != re.end; re.begin++) {
       int el = *re.begin;
       // I == type_.incoming_
-      g_resources_[i].type_.incoming_.insert(el);
+      g_resources_[i].type_.incoming_.push_back(el);
     }
+    g_resources_[i].type_.Normalize();
   }
+  // a byte budget below the ratio's share of the data is a smaller ratio
+  if (max_summary_bytes_ > 0 && ratio * DataGraphSize(g) > max_summary_bytes_)
+    ratio = (double) max_summary_bytes_ / DataGraphSize(g);
   double target_size = ratio * DataGraphSize(g);
   target_ = (target_size - sizeof (int) * (static_cast<size_t>(g.GetNumVertices()))) / (sizeof (int) * 3);
   target_ = std::max(target_, 10000.0);
-  unordered_map<string, int> bucket_idx; // bucket_idx maps type (string) to a summary vertex
+  unordered_map<Type, int, TypeHasher> bucket_idx; // bucket_idx maps type to a summary vertex
   vector<int> mu; // mu: maps a data vertex v to a summary vertex mu[v]
   w1_.resize(0);
   // Compute mu(v)
   // w1_ denotes w(b) in the paper
   for (size_t i = 0; i < g_resources_.size(); i++) {
     Resource& r = g_resources_[i];
-    string s = r.type_.ToString();
-    if (!bucket_idx.count(s)) { // if new type exists, create new b_{t_v}
+    auto ins = bucket_idx.emplace(r.type_, sm_.buckets_.size());
+    if (ins.second) { // if new type exists, create new b_{t_v}
       sm_.CreateBucket(r, i);
-      bucket_idx[s] = sm_.buckets_.size() - 1;
       w1_.push_back(0);
     }
-    mu.push_back(bucket_idx[s]);
-    sm_.buckets_[bucket_idx[s]].resources_.push_back(i);
-    w1_[bucket_idx[s]]++; // increase weight of the corresponding summary vertex
+    int b = ins.first->second;
+    mu.push_back(b);
+    sm_.buckets_[b].resources_.push_back(i);
+    w1_[b]++; // increase weight of the corresponding summary vertex
   }
   // Add edges to summary graph
   unordered_map<int, unordered_map<int, unordered_map<int, int>>> edge_idx; // edge_idx maps an edge (srcid, el, dstid) to an edge number
@@ -171,8 +163,8 @@ void SumRDF::PrepareSummaryStructure(DataGraph& g, double ratio) {
           if (sm_.buckets_.size() <= b1) sm_.buckets_.resize(b1 + 1, Bucket());
           if (sm_.buckets_.size() <= b2) sm_.buckets_.resize(b2 + 1, Bucket());
           AddEdgeToSummary(b1, el, b2, edge_idx);
-          sm_.buckets_[b1].type_.outgoing_.insert(el);
-          sm_.buckets_[b2].type_.incoming_.insert(el);
+          Type::Insert(sm_.buckets_[b1].type_.outgoing_, el);
+          Type::Insert(sm_.buckets_[b2].type_.incoming_, el);
         }
       }
       int b = Find(mu[srcid]);
@@ -183,7 +175,7 @@ void SumRDF::PrepareSummaryStructure(DataGraph& g, double ratio) {
       sm_.buckets_[b].resources_.push_back(srcid);
       for (auto r = g.GetVLabels(srcid); r.begin != r.end; r.begin++) {
         int vl = *r.begin;
-        sm_.buckets_[b].type_.classes_.insert(vl);
+        Type::Insert(sm_.buckets_[b].type_.classes_, vl);
       }
     }
     w1_.erase(w1_.begin() + cnt, w1_.end());
@@ -200,6 +192,12 @@ void SumRDF::PrepareSummaryStructure(DataGraph& g, double ratio) {
       w2_[i] = cp[edge_idx[src][el][dst]];
     }
   }
+  if (max_summary_bytes_ > 0 || max_build_seconds_ > 0) {
+    build_report_ += string(build_report_.empty() ? "" : ", ") + to_string(sm_.multiplicity_) +
+      " summary edges for a target of " + to_string((long long) target_);
+    if (max_summary_bytes_ > 0 && target_ * 3 * sizeof (int) + sizeof (int) * g.GetNumVertices() > max_summary_bytes_)
+      build_report_ += " (the least the resources and 10000 edges take)";
+  }
 }
 
 // Add edge <s, p, o> to summary graph
@@ -247,11 +245,9 @@ void SumRDF::MinHashScheme() {
   std::mt19937 generator(0);
   std::uniform_int_distribution<int> dis(-2147483648, 2147483647);
   for (int i = 0; i < scheme_rows_; i++) {
-    a_.push_back(vector<int>(scheme_cols_, 0));
-    b_.push_back(vector<int>(scheme_cols_, 0));
     for (int j = 0; j < scheme_cols_; j++) {
-      a_[i][j] = dis(generator);
-      b_[i][j] = dis(generator);
+      a_.push_back(dis(generator));
+      b_.push_back(dis(generator));
     }
   }
 }
@@ -264,87 +260,59 @@ void SumRDF::CreateSummary(DataGraph& g, double ratio) {
   // It merges types with the same classes
 
   int before = sm_.multiplicity_;
+  sm_.ori_multiplicity_ = sm_.multiplicity_;
 
-  CalcSignatureSize();
-  vector<bool> erased_bucket(sm_.buckets_.size(), false);
-  bool merged = true;
-  while (merged) {
+  // Merges never cross bucket lists, so the lists are merged in parallel,
+  // each thread owning the union-find entries of the lists it takes; every
+  // list sees the same merges as in a sequential pass. A list holding more
+  // than its share of the buckets would leave the other threads idle, so
+  // those are merged afterwards, one at a time, with their signatures
+  // computed by all threads
+  int num_threads = omp_get_max_threads();
+  CalcSignatureSize(num_threads);
+  vector<char> erased_bucket(sm_.buckets_.size(), 0);
+  vector<vector<pair<int, int>>> bins(num_threads); // (LSH bin, bucket), reused
+  vector<vector<int>> merged(num_threads); // roots merged away in this round
+  vector<char> large(bucket_lst_.size(), 0);
+  for (size_t t = 0; t < bucket_lst_.size(); t++)
+    large[t] = num_threads > 1 && bucket_lst_[t].size() * num_threads > sm_.buckets_.size();
+  int round = 0;
+  if (FILE* fp = ReadCheckpoint()) {
+    if (ReadMergeState(fp, erased_bucket, round, before))
+      fprintf(stderr, "sumrdf: resuming after round %d\n", round);
+    else
+      fprintf(stderr, "sumrdf: checkpoint is of another build, starting over\n");
+    fclose(fp);
+  }
+  while (true) {
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
     for (size_t t = 0; t < bucket_lst_.size(); t++) {
-      auto &bucket_lst = bucket_lst_[t];
-      CreateSignature(t);
-      auto &signatures = signatures_;
-      for (int row = 0; row < scheme_rows_; row++) {
-        vector<vector<int>> bins(32768, vector<int>());
-        // B_t == bucket_lst_[t]
-        for (size_t i = 0; i < bucket_lst.size(); i++) {
-          int bid = bucket_lst[i];
-          if (erased_bucket[bid]) continue; // Do not consider already removed types
-          int type_idx = sm_.buckets_[bid].type_idx_;
-          // Compute M^b[i], M^b[i] == val
-          int val = signatures[type_idx * n_ * m_ + row * m_ + scheme_cols_];
-          // Add b to Bins[LSH(M^b[i])]
-          bins[BinHash(val)].push_back(bid);
-        }
-        for (vector<int>& lst : bins) {
-          if (lst.size() == 0) continue;
-          int b1 = lst[0];
-          for (size_t i = 1; i < lst.size(); ++i) {
-            int b2 = lst[i];
-            if (Similarity(sm_.buckets_[b1].type_idx_, sm_.buckets_[b2].type_idx_) >= threshold_) 
-            {
-              erased_bucket[Find(b1) < Find(b2) ? b2 : b1] = true; 
-              ShallowMerge(b1, b2);
-              merged = true;
-              break;
-            }
-          }       
-        }
-      }
+      if (large[t]) continue;
+      int tid = omp_get_thread_num();
+      MergeBucketList(t, signatures_[tid], erased_bucket, bins[tid], merged[tid], 1);
     }
+    for (size_t t = 0; t < bucket_lst_.size(); t++)
+      if (large[t])
+        MergeBucketList(t, signatures_[0], erased_bucket, bins[0], merged[0], num_threads);
     // Adjust the summary graph structure after summarization
-    sm_.edges_.clear();
-    int multiplicity = 0;
-    vector<vector<pair<int,int>>> new_adj_list_(sm_.buckets_.size());
-    for (size_t t = 0; t < bucket_lst_.size(); t++) {
-      std::unordered_set<Edge,EdgeHasher> edge_idx;
-      int local_multiplicity = 0;
-      auto &bucket_lst = bucket_lst_[t];
-      for (size_t i = 0; i < bucket_lst.size(); i++) {
-        int s = bucket_lst[i];
-        auto &adj_list = sm_.adj_list_[s];
-        if (adj_list.size() == 0) continue;
-        int ns = Find(s);
-        for (size_t j = 0; j < adj_list.size(); j++) {
-          auto &pair = adj_list[j];
-          int no = Find(pair.first);
-          int p = pair.second;
-          auto result = edge_idx.emplace(ns, no, p);
-          if (result.second) {
-            new_adj_list_[ns].push_back(make_pair(no, p));
-            ++local_multiplicity;
-          }
-        }
-      }
-      multiplicity += local_multiplicity;
-    }
-    new_adj_list_.swap(sm_.adj_list_);
-    vector<vector<pair<int,int>>> new_rev_adj_list_(sm_.buckets_.size());
-    for (size_t s = 0; s < sm_.adj_list_.size(); ++s) {
-      auto &adj_list = sm_.adj_list_[s];
-      if (adj_list.size() == 0) continue;
-      int ns = Find(s);
-      for (size_t i = 0; i < adj_list.size(); ++i) {
-        auto &pair = adj_list[i];
-        int no = Find(pair.first);
-        int p = pair.second;
-        new_rev_adj_list_[no].push_back(make_pair(ns, p));
-      }
+    for (int tid = 1; tid < num_threads; tid++) {
+      merged[0].insert(merged[0].end(), merged[tid].begin(), merged[tid].end());
+      merged[tid].clear();
     }
-    new_rev_adj_list_.swap(sm_.rev_adj_list_);
-    sm_.multiplicity_ = multiplicity;
+    UpdateSummaryEdges(merged[0]);
+    merged[0].clear();
+    int multiplicity = sm_.multiplicity_;
+    round++;
     if (multiplicity <= target_) return;
     if (before - multiplicity < 1000) break;
+    // out of time, the lists are merged coarsely below instead
+    if (BuildTimeUp()) {
+      build_report_ = "merging stopped by the time budget after round " + to_string(round);
+      break;
+    }
     before = multiplicity;
+    if (CheckpointDue())
+      WriteCheckpoint([&](FILE* fp) { WriteMergeState(fp, erased_bucket, round, before); });
   }
   int n = static_cast<double>(SummaryGraphSize(g)) / DataGraphSize(g) / ratio;
   n = std::max(n, 1);
@@ -361,26 +329,142 @@ void SumRDF::CreateSummary(DataGraph& g, double ratio) {
   }
 }
 
+// The state of CreateSummary after round rounds (see CHECKPOINT_MAGIC); the
+// summary edges follow from mu_ and the typed summary
+void SumRDF::WriteMergeState(FILE* fp, const vector<char>& erased_bucket, int round, int before) {
+  int header[4] = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, (int) mu_.size(), sm_.ori_multiplicity_};
+  double params[2] = {target_, threshold_};
+  int progress[2] = {round, before};
+  fwrite(header, sizeof (int), 4, fp);
+  fwrite(params, sizeof (double), 2, fp);
+  fwrite(progress, sizeof (int), 2, fp);
+  fwrite(mu_.data(), sizeof (int), mu_.size(), fp);
+  fwrite(erased_bucket.data(), 1, erased_bucket.size(), fp);
+}
+
+// Restores the state WriteMergeState wrote, if it is of this typed summary
+// and parameters, and rebuilds the summary edges of its merges; false,
+// changing nothing, if it is not
+bool SumRDF::ReadMergeState(FILE* fp, vector<char>& erased_bucket, int& round, int& before) {
+  int header[4];
+  double params[2];
+  int progress[2];
+  if (fread(header, sizeof (int), 4, fp) != 4 || header[0] != CHECKPOINT_MAGIC ||
+      header[1] != CHECKPOINT_VERSION || header[2] != (int) mu_.size() ||
+      header[3] != sm_.ori_multiplicity_ || fread(params, sizeof (double), 2, fp) != 2 ||
+      params[0] != target_ || params[1] != threshold_ ||
+      fread(progress, sizeof (int), 2, fp) != 2)
+    return false;
+  vector<int> mu(mu_.size());
+  vector<char> erased(erased_bucket.size());
+  if (fread(mu.data(), sizeof (int), mu.size(), fp) != mu.size() ||
+      fread(erased.data(), 1, erased.size(), fp) != erased.size())
+    return false;
+  // a root is below the buckets merged into it, so a parent is never above
+  for (size_t b = 0; b < mu.size(); b++)
+    if (mu[b] < 0 || mu[b] > (int) b) return false;
+  mu_.swap(mu);
+  erased_bucket.swap(erased);
+  round = progress[0];
+  before = progress[1];
+  // every bucket merged away so far moves its edges to its root at once
+  vector<int> merged;
+  for (size_t b = 0; b < mu_.size(); b++)
+    if (Find(b) != (int) b) merged.push_back(b);
+  UpdateSummaryEdges(merged);
+  return true;
+}
+
+// One round of LSH banding over bucket list t
+void SumRDF::MergeBucketList(int t, vector<int>& signatures, vector<char>& erased_bucket,
+    vector<pair<int, int>>& bins, vector<int>& merged, int num_threads) {
+  auto &bucket_lst = bucket_lst_[t];
+  CreateSignature(t, signatures, num_threads);
+  for (int row = 0; row < scheme_rows_; row++) {
+    bins.clear();
+    // B_t == bucket_lst_[t]
+    for (size_t i = 0; i < bucket_lst.size(); i++) {
+      int bid = bucket_lst[i];
+      if (erased_bucket[bid]) continue; // Do not consider already removed types
+      int type_idx = sm_.buckets_[bid].type_idx_;
+      // Compute M^b[i], M^b[i] == val
+      int val = signatures[type_idx * n_ * m_ + n_ * scheme_cols_ + row];
+      // Add b to Bins[LSH(M^b[i])]
+      bins.push_back(make_pair(BinHash(val), bid));
+    }
+    // bucket lists are ascending, so this keeps each bin in insertion order
+    std::sort(bins.begin(), bins.end());
+    for (size_t begin = 0, end; begin < bins.size(); begin = end) {
+      for (end = begin + 1; end < bins.size() && bins[end].first == bins[begin].first; end++);
+      int b1 = bins[begin].second;
+      for (size_t i = begin + 1; i < end; ++i) {
+        int b2 = bins[i].second;
+        if (Similarity(sm_.buckets_[b1].type_idx_, sm_.buckets_[b2].type_idx_, signatures) >= threshold_)
+        {
+          erased_bucket[Find(b1) < Find(b2) ? b2 : b1] = true;
+          int root = ShallowMerge(b1, b2);
+          if (root != -1) merged.push_back(root);
+          break;
+        }
+      }
+    }
+  }
+}
+
+// Rebuild the summary edges after a round of merges. Only the lists of the
+// roots that absorbed a merged bucket, or that have an edge from or to one,
+// change; edges are mapped to roots and deduplicated there
+void SumRDF::UpdateSummaryEdges(const vector<int>& merged) {
+  vector<int> dirty;
+  vector<char> is_dirty(sm_.buckets_.size(), 0);
+  auto touch = [&](int b) {
+    b = Find(b);
+    if (!is_dirty[b]) {
+      is_dirty[b] = 1;
+      dirty.push_back(b);
+    }
+  };
+  for (int b : merged) {
+    touch(b);
+    for (auto &e : sm_.adj_list_[b]) touch(e.first);
+    for (auto &e : sm_.rev_adj_list_[b]) touch(e.first);
+  }
+  int multiplicity = sm_.multiplicity_;
+  for (int b : dirty) multiplicity -= sm_.adj_list_[b].size();
+  for (int b : merged) {
+    int root = Find(b);
+    multiplicity -= sm_.adj_list_[b].size();
+    for (auto *lists : {&sm_.adj_list_, &sm_.rev_adj_list_}) {
+      auto &from = (*lists)[b];
+      auto &to = (*lists)[root];
+      to.insert(to.end(), from.begin(), from.end());
+      vector<pair<int, int>>().swap(from);
+    }
+  }
+  for (int b : dirty) {
+    for (auto *lists : {&sm_.adj_list_, &sm_.rev_adj_list_}) {
+      auto &adj_list = (*lists)[b];
+      for (auto &e : adj_list) e.first = Find(e.first);
+      std::sort(adj_list.begin(), adj_list.end());
+      adj_list.erase(std::unique(adj_list.begin(), adj_list.end()), adj_list.end());
+    }
+    multiplicity += sm_.adj_list_[b].size();
+  }
+  sm_.multiplicity_ = multiplicity;
+}
+
 // Merge similar types (Line 20 of Algorithm 1)
 void SumRDF::MakeBucketListByType() {
-  // s_vlabel[s] maps type (string)  to the new type number
+  // s_vlabel maps a type to the new type number
   // Here, it merges types with the same classes
-  unordered_map<string, int> s_vlabel;
-  s_vlabel.clear();
-  int cnt = 0;
+  unordered_map<Type, int, ClassHasher, ClassEqual> s_vlabel;
   for (size_t i = 0; i < sm_.buckets_.size(); i++) {
     Bucket& bucket = sm_.buckets_[i];
-    Type t = bucket.type_;
-    string s = t.ToStringByClass(); // Merge types using only classes
-    if (s_vlabel.count(s)) {
-      bucket_lst_[s_vlabel[s]].push_back(i);
-      bucket.type_idx_ = bucket_lst_[s_vlabel[s]].size() - 1;
-      continue;
-    }
-    s_vlabel[s] = cnt++;
-    bucket_lst_.push_back(vector<int>());
-    bucket_lst_[cnt - 1].push_back(i);
-    bucket.type_idx_ = 0;
+    auto ins = s_vlabel.emplace(bucket.type_, bucket_lst_.size());
+    if (ins.second) bucket_lst_.push_back(vector<int>());
+    vector<int>& lst = bucket_lst_[ins.first->second];
+    lst.push_back(i);
+    bucket.type_idx_ = lst.size() - 1;
   }
 }
 
@@ -395,7 +479,13 @@ size_t SumRDF::SummaryGraphSize(DataGraph& g) {
   size_t v_cnt = 0, vl_cnt = 0;
   for (size_t i = 0; i < sm_.buckets_.size(); i++) {
     if (Find(i) != i) {
-      sm_.buckets_[Find(i)].type_.classes_.insert(sm_.buckets_[i].type_.classes_.begin(), sm_.buckets_[i].type_.classes_.end());
+      vector<int>& to = sm_.buckets_[Find(i)].type_.classes_;
+      const vector<int>& from = sm_.buckets_[i].type_.classes_;
+      if (!std::includes(to.begin(), to.end(), from.begin(), from.end())) {
+        vector<int> merged;
+        std::set_union(to.begin(), to.end(), from.begin(), from.end(), std::back_inserter(merged));
+        to.swap(merged);
+      }
     }
   }
   for (size_t i = 0; i < sm_.buckets_.size(); i++) {
@@ -423,63 +513,48 @@ void SumRDF::MakeBucketList() {
 }
 
 // Compute the size of signature
-void SumRDF::CalcSignatureSize() {
+void SumRDF::CalcSignatureSize(int num_threads) {
   int mx = 0;
   for (size_t t = 0; t < bucket_lst_.size(); t++)
     mx = std::max(mx, static_cast<int>(bucket_lst_[t].size()));
-  signatures_.resize(mx * n_ * m_);
+  signatures_.assign(num_threads, vector<int>(mx * n_ * m_));
 }
 
+// The signature of a type is its n_ x scheme_cols_ MinHash values, row by
+// row, followed by the n_ band hashes of the rows (n_ * m_ ints in all)
 // reference code: summarisation/factory/minhash/MinHash.java #204 similarity()
-void SumRDF::CreateSignature(int t) {
-  auto &signatures = signatures_;
+void SumRDF::CreateSignature(int t, vector<int>& signatures, int num_threads) {
 
-  for (size_t i = 0; i < signatures.size(); i++) {
-    signatures[i] = std::numeric_limits<int>::max();
-  }
+  // only the rows of this list's types are read
+  size_t used = bucket_lst_[t].size() * n_ * m_;
+  std::fill(signatures.begin(), signatures.begin() + used, std::numeric_limits<int>::max());
 
+  int k = n_ * scheme_cols_;
+  #pragma omp parallel for schedule(dynamic, 64) num_threads(num_threads) if(num_threads > 1)
   for (size_t i = 0; i < bucket_lst_[t].size(); i++) {
     int bid = bucket_lst_[t][i];
-    Type& type = sm_.buckets_[bid].type_;
+    int* sig = signatures.data() + sm_.buckets_[bid].type_idx_ * n_ * m_;
+    // reference code: summarisation/factory/minhash/MinHash.java #239 minHash()
+    // and #244: all n_ x scheme_cols_ hashes of a neighbour at once
     for (pair<int, int> e : sm_.adj_list_[bid]) {
       int dstid = e.first;
       int elabel = e.second;
-      UpdateSignature(bid, elabel, dstid);
+      MinHashUpdate(SchemeValue(elabel, dstid), a_.data(), b_.data(), k, sig);
     }
     for (pair<int, int> e : sm_.rev_adj_list_[bid]) {
       int srcid = e.first;
       int elabel = e.second;
-      UpdateSignature(bid, srcid, elabel);
+      MinHashUpdate(SchemeValue(srcid, elabel), a_.data(), b_.data(), k, sig);
     }
     for (int r = 0; r < scheme_rows_; r++) {
-      int index = sm_.buckets_[bid].type_idx_ * n_ * m_ + r * m_;
       int hash = 1;
-      int c = 0;
-      for (c = 0; c < scheme_cols_; c++)
-        hash = 31 * hash + signatures[index + c];
-      signatures[index + c] = hash;
+      for (int c = 0; c < scheme_cols_; c++)
+        hash = 31 * hash + sig[r * scheme_cols_ + c];
+      sig[k + r] = hash;
     }
   }
 }
 
-// reference code: summarisation/factory/minhash/MinHash.java #239 minHash()
-void SumRDF::UpdateSignature(int bid, int bid1, int bid2) {
-  auto &signatures = signatures_;
-  for (int r = 0; r < scheme_rows_; r++) {
-    int index = sm_.buckets_[bid].type_idx_ * n_ * m_ + r * m_;
-    for (int c = 0; c < scheme_cols_; c++) {
-      int hash = SchemeHash(bid1, bid2, r, c);
-      if (signatures[index + c] > hash) signatures[index + c] = hash;
-    }
-  }
-}
-
-// reference code: summarisation/factory/minhash/MinHash.java #244 in minHash()
-int SumRDF::SchemeHash(int x, int y, int row, int col) {
-  int val = (x * 127 + y) * 31;
-  return (val * a_[row][col]) + b_[row][col]; // global variable
-}
-
 // LSH function == BinHash function
 int SumRDF::BinHash(int x) {
   int res = x ^ (static_cast<uint32_t>(x) >> 16);
@@ -487,26 +562,16 @@ int SumRDF::BinHash(int x) {
 }
 
 // reference code: summarisation/factory/minhash/MinHash.java #188 similarity()
-double SumRDF::Similarity(int b1, int b2) {
-  auto &signatures = signatures_;
-  double res = 0.0;
-  for (int row = 0; row < scheme_rows_; row++) {
-    int idx1 = b1 * n_ * m_ + row * m_;
-    int idx2 = b2 * n_ * m_ + row * m_;
-    for (int col = 0; col < scheme_cols_; col++) {
-      if (signatures[idx1 + col] == signatures[idx2 + col]) res += 1.0;
-    }
-  }
-  return res / (scheme_rows_ * scheme_cols_);
+double SumRDF::Similarity(int b1, int b2, const vector<int>& signatures) {
+  int k = scheme_rows_ * scheme_cols_;
+  double res = CountEqual(signatures.data() + b1 * n_ * m_, signatures.data() + b2 * n_ * m_, k);
+  return res / k;
 }
 
 // Merge two types
-void SumRDF::ShallowMerge(int b1, int b2) {
-  if (b1 > b2) {
-    ShallowMerge(b2, b1);
-    return;
-  }
-  Union(b1, b2);
+int SumRDF::ShallowMerge(int b1, int b2) {
+  if (b1 > b2) return ShallowMerge(b2, b1);
+  return Union(b1, b2);
 }
 
 // Initialize a summary graph structure
@@ -539,45 +604,112 @@ void SumRDF::WriteSummaryFile(const char* fn) {
   fclose(fp);
 }
 
+// Binary summary: SUMRDF_MAGIC, SUMRDF_VERSION, the summary graph (embedded
+// DataGraph, vertex b = bucket b labelled with its classes), then as ints
+// |w1|, w1, |w2|, w2 (by sorted edge), #buckets, offsets[#buckets + 1] and
+// the resources of all buckets
 void SumRDF::WriteSummary(const char* fn) {
   WriteSummaryFile(fn);
-  FILE* fp = fopen(fn, "w");
-  fprintf(fp, "t # 0\n");
+  vector<vector<int>> vlabels(sm_.buckets_.size());
   for (size_t i = 0; i < sm_.buckets_.size(); i++) {
-    Bucket& bucket = sm_.buckets_[i];
-    Type t = bucket.type_;
-    string s = t.ToStringByClass();
-    fprintf(fp, "v %d", static_cast<int>(i));
-    if (bucket.type_.classes_.size() == 0) fprintf(fp, " -1");
-    for (int vl : bucket.type_.classes_) fprintf(fp, " %d", vl);
-    fprintf(fp, "\n");
+    auto &classes = sm_.buckets_[i].type_.classes_;
+    vlabels[i].assign(classes.begin(), classes.end());
   }
-  for (size_t i = 0; i < sm_.edges_.size(); i++) {
-    fprintf(fp, "e %d %d %d\n", sm_.edges_[i].src, sm_.edges_[i].dst, sm_.edges_[i].el);
+  DataGraph s;
+  s.SetRawData(vlabels, sm_.edges_);
+  s.MakeBinary();
+
+  FILE* fp = fopen(fn, "wb");
+  int header[2] = {SUMRDF_MAGIC, SUMRDF_VERSION};
+  fwrite(header, sizeof (int), 2, fp);
+  s.WriteEmbedded(fp);
+  for (auto* w : {&w1_, &w2_}) {
+    int size = w->size();
+    fwrite(&size, sizeof (int), 1, fp);
+    fwrite(w->data(), sizeof (int), w->size(), fp);
   }
+  vector<int> offsets(1, sm_.buckets_.size());
+  offsets.push_back(0);
+  for (auto &bucket : sm_.buckets_)
+    offsets.push_back(offsets.back() + bucket.resources_.size());
+  fwrite(offsets.data(), sizeof (int), offsets.size(), fp);
+  for (auto &bucket : sm_.buckets_)
+    fwrite(bucket.resources_.data(), sizeof (int), bucket.resources_.size(), fp);
   fclose(fp);
-  string fn2 = string(fn) + ".weight";
-  FILE* fp2 = fopen(fn2.c_str(), "w");
-  fprintf(fp2, "%d\n", static_cast<int>(w1_.size()));
-  fwrite(w1_.data(), sizeof (int), w1_.size(), fp2);
-  fprintf(fp2, "\n%d\n", static_cast<int>(w2_.size()));
-  fwrite(w2_.data(), sizeof (int), w2_.size(), fp2);
-  fprintf(fp2, "\n%d\n", static_cast<int>(sm_.buckets_.size()));
-  for (size_t i = 0; i < sm_.buckets_.size(); i++) {
-    Bucket& bucket = sm_.buckets_[i];
-    fprintf(fp2, "%d\n", static_cast<int>(bucket.resources_.size()));
-    for (int r : bucket.resources_) fprintf(fp2, "%d ", r);
-    fprintf(fp2, "\n");
-  }
-  fclose(fp2);
-  fn2 = string(fn) + ".bin";
-  s_.ReadText(fn);
-  s_.MakeBinary();
-  s_.WriteBinary(fn2.c_str());
-  s_.ClearRawData();
 }
 
 void SumRDF::ReadSummary(const char* fn) {
+  UnloadFile(summary_, summary_size_, LOAD_MMAP);
+  summary_ = LoadFile(fn, summary_size_, SummaryLoadMode());
+  if (summary_ == nullptr) {
+    fprintf(stderr, "cannot load %s\n", fn);
+    exit(EXIT_FAILURE);
+  }
+  const int* p = (const int*) summary_;
+  if (summary_size_ < 2 * sizeof (int) || p[0] != SUMRDF_MAGIC) {
+    // text summary of earlier versions, with .bin and .weight files
+    UnloadFile(summary_, summary_size_, LOAD_MMAP);
+    summary_ = nullptr;
+    summary_size_ = 0;
+    ReadTextSummary(fn);
+    return;
+  }
+  if (p[1] != SUMRDF_VERSION) {
+    fprintf(stderr, "%s: unsupported summary version %d\n", fn, p[1]);
+    exit(EXIT_FAILURE);
+  }
+  p = (const int*) s_.AttachEmbedded((const char*) (p + 2));
+  s_w1_ = p + 1;
+  p = s_w1_ + p[0];
+  s_w2_ = p + 1;
+  p = s_w2_ + p[0];
+  int num_buckets = p[0];
+  const int* res_offset = p + 1;
+  const int* res = res_offset + num_buckets + 1;
+  if ((const char*) (res + res_offset[num_buckets]) != summary_ + summary_size_) {
+    fprintf(stderr, "%s: corrupt summary\n", fn);
+    exit(EXIT_FAILURE);
+  }
+  s_buckets_.clear(); s_buckets_.resize(num_buckets, Bucket());
+  // the resource lists are only read here, into bucket_of_
+  bucket_of_.clear();
+  for (int b = 0; b < num_buckets; b++)
+    for (const int* r = res + res_offset[b]; r != res + res_offset[b + 1]; r++)
+      SetBucketOf(*r, b);
+  SetSummaryEdges();
+}
+
+// Set summary graph (S == smo_, H == smo_.data_edges) and the bucket types,
+// fixed per summary. Summary vertex b is labelled with the classes of bucket
+// b and has an edge of every label its resources have, so the type of the
+// bucket is read off the summary graph without the data graph.
+void SumRDF::SetSummaryEdges() {
+  for (size_t b = 0; b < s_buckets_.size() && b < (size_t) s_.GetNumVertices(); b++) {
+    Type& t = s_buckets_[b].type_;
+    auto rv = s_.GetVLabels(b);
+    t.classes_.assign(rv.begin, rv.end);
+    auto ro = s_.GetELabels(b, true);
+    t.outgoing_.assign(ro.begin, ro.end);
+    auto ri = s_.GetELabels(b, false);
+    t.incoming_.assign(ri.begin, ri.end);
+    t.Normalize();
+  }
+  smo_.data_edges.clear();
+  for (int srcid = 0; srcid < s_.GetNumVertices(); srcid++) {
+    for (auto re = s_.GetELabels(srcid, true); re.begin != re.end; re.begin++) {
+      assert(re.begin!=re.end);
+      int el = *re.begin;
+      for (auto rd = s_.GetAdj(srcid, el, true); rd.begin != rd.end; rd.begin++) {
+        int dstid = *rd.begin;
+        smo_.data_edges.push_back(Edge(srcid, dstid, el));
+      }
+    }
+  }
+  smo_.BuildLabelIndex();
+  for (Evaluation& e : evals_) e.atom_factors_.Clear();
+}
+
+void SumRDF::ReadTextSummary(const char* fn) {
   string fn2 = string(fn) + ".bin";
   s_.ReadBinary(fn2.c_str());
   fn2 = string(fn) + ".weight";
@@ -591,109 +723,387 @@ void SumRDF::ReadSummary(const char* fn) {
   if (fread(w2_.data(), sizeof (int), size, fp)) { }
   fscanf(fp, "%d", &size);
   s_buckets_.clear(); s_buckets_.resize(size, Bucket());
+  bucket_of_.clear();
   for (size_t i = 0; i < size; i++) {
-    int vl, el, rid;
+    int rid;
     fscanf(fp, "%d", &size2);
     assert(size2 >= 0);
     while (size2--) {
       fscanf(fp, "%d", &rid);
-      s_buckets_[i].resources_.push_back(rid);
+      SetBucketOf(rid, i);
     }
   }
   fclose(fp);
+  s_w1_ = w1_.data();
+  s_w2_ = w2_.data();
+  SetSummaryEdges();
 }
 
-// reference code: queryanswering/SPARQLEvaluator.java #38 SPARQLEvaluator()
-void SumRDF::Init() {
-  // Set types for each query vertex
-  for (size_t i = 0; i < s_buckets_.size(); i++) {
-    for (int srcid : s_buckets_[i].resources_) {
-      for (auto r = g->GetVLabels(srcid); r.begin != r.end; r.begin++) {
-        int vl = *r.begin;
-        s_buckets_[i].type_.classes_.insert(vl);
+// The MinHash signature of the scheme values of a resource's neighbours,
+// laid out as CreateSignature lays out a bucket's (n_ * m_ ints)
+void SumRDF::ValueSignature(const vector<int>& values, int* sig) {
+  int k = n_ * scheme_cols_;
+  std::fill(sig, sig + n_ * m_, std::numeric_limits<int>::max());
+  for (int val : values)
+    MinHashUpdate(val, a_.data(), b_.data(), k, sig);
+  for (int r = 0; r < scheme_rows_; r++) {
+    int hash = 1;
+    for (int c = 0; c < scheme_cols_; c++)
+      hash = 31 * hash + sig[r * scheme_cols_ + c];
+    sig[k + r] = hash;
+  }
+}
+
+// A resource whose type the updates change, or that was in no bucket, is
+// routed as PrepareSummaryStructure would place it: to the bucket of its
+// new type if there is one, else to the bucket of its classes whose
+// signature is the closest to its own and at least GCARE_SUMRDF_THRESHOLD
+// (1 by default) similar, found by the LSH bands of the merge rounds, else
+// to its bucket if the build merged resources of other types into it, else
+// to a new bucket of its own. The others stay where they are. w1 and the
+// summary edges then change by the updated edges and by the edges of the
+// routed resources only; a bucket left empty is dropped. Buckets keep the
+// classes they had, as merged buckets do. The signatures of the buckets
+// are those of the summary before the updates, computed only for the
+// classes some routed resource has.
+bool SumRDF::UpdateSummary(DataGraph& g, const char* fn, const char* updates) {
+  ReadSummary(fn);
+  int n = g.GetNumVertices();
+  sm_ = Summary();
+  sm_.buckets_ = s_buckets_;
+  for (int v = 0; v < (int) bucket_of_.size(); v++)
+    if (bucket_of_[v] >= 0) sm_.buckets_[bucket_of_[v]].resources_.push_back(v);
+  // smo_.data_edges lists the summary edges sorted, as w2 is
+  unordered_map<Edge, int, EdgeHasher> weight;
+  for (size_t i = 0; i < smo_.data_edges.size(); i++)
+    weight[smo_.data_edges[i]] = s_w2_[i];
+
+  //(src, dst, el) -> insertions minus deletions so far
+  std::map<std::tuple<int, int, int>, int> added;
+  //(v, out, el) -> change of v's edges of el in the direction
+  std::map<std::tuple<int, int, int>, int> degree;
+  FILE* fp = fopen(updates, "r");
+  if (fp == nullptr) {
+    fprintf(stderr, "cannot open %s\n", updates);
+    exit(EXIT_FAILURE);
+  }
+  char line[256];
+  for (int line_no = 1; fgets(line, sizeof(line), fp) != nullptr; line_no++) {
+    char op;
+    int src, dst, el;
+    int fields = sscanf(line, " %c %d %d %d", &op, &src, &dst, &el);
+    if (fields <= 0 || op == '#') continue;
+    if (fields != 4 || (op != '+' && op != '-') || src < 0 || src >= n
+        || dst < 0 || dst >= n || el < 0) {
+      fprintf(stderr, "%s:%d: expected \"+|- src dst el\"\n", updates, line_no);
+      exit(EXIT_FAILURE);
+    }
+    auto edge = std::make_tuple(src, dst, el);
+    auto it = added.find(edge);
+    range adj = g.GetAdj(src, el, true);
+    int count = std::binary_search(adj.begin, adj.end, dst) + (it == added.end() ? 0 : it->second);
+    if (op == '-' && count <= 0) {
+      fprintf(stderr, "%s:%d: no edge %d %d %d to delete, skipped\n", updates, line_no, src, dst, el);
+      continue;
+    }
+    if (op == '+' && count > 0) {
+      fprintf(stderr, "%s:%d: edge %d %d %d already there, skipped\n", updates, line_no, src, dst, el);
+      continue;
+    }
+    int d = op == '+' ? 1 : -1;
+    added[edge] += d;
+    degree[std::make_tuple(src, 1, el)] += d;
+    degree[std::make_tuple(dst, 0, el)] += d;
+  }
+  fclose(fp);
+
+  // the resources whose type changes
+  auto type_of = [&g](int v) {
+    Type t;
+    for (auto r = g.GetVLabels(v); r.begin != r.end; r.begin++) t.classes_.push_back(*r.begin);
+    for (auto r = g.GetELabels(v, true); r.begin != r.end; r.begin++) t.outgoing_.push_back(*r.begin);
+    for (auto r = g.GetELabels(v, false); r.begin != r.end; r.begin++) t.incoming_.push_back(*r.begin);
+    t.Normalize();
+    return t;
+  };
+  vector<int> routed;
+  unordered_map<int, Type> old_type, new_type;
+  for (auto it = degree.begin(); it != degree.end();) {
+    int v = std::get<0>(it->first);
+    Type before = type_of(v), after = before;
+    for (; it != degree.end() && std::get<0>(it->first) == v; ++it) {
+      bool out = std::get<1>(it->first);
+      int el = std::get<2>(it->first);
+      vector<int>& labels = out ? after.outgoing_ : after.incoming_;
+      if (g.GetAdjSize(v, el, out) + it->second > 0)
+        Type::Insert(labels, el);
+      else
+        labels.erase(std::remove(labels.begin(), labels.end(), el), labels.end());
+    }
+    if (!(after == before) || BucketOf(v) < 0) {
+      routed.push_back(v);
+      old_type.emplace(v, before);
+      new_type.emplace(v, after);
+    }
+  }
+
+  // the edges whose summary edge may change: the updated ones and those of
+  // the routed resources, with whether they are in g and in the update
+  auto delta = [&added](const Edge& e) {
+    auto it = added.find(std::make_tuple(e.src, e.dst, e.el));
+    return it == added.end() ? 0 : it->second;
+  };
+  vector<Edge> affected;
+  for (auto& a : added)
+    if (a.second != 0)
+      affected.emplace_back(std::get<0>(a.first), std::get<1>(a.first), std::get<2>(a.first));
+  for (int v : routed)
+    for (int out = 0; out < 2; out++)
+      for (auto re = g.GetELabels(v, out); re.begin != re.end; re.begin++)
+        for (auto rd = g.GetAdj(v, *re.begin, out); rd.begin != rd.end; rd.begin++)
+          affected.push_back(out ? Edge(v, *rd.begin, *re.begin) : Edge(*rd.begin, v, *re.begin));
+  std::sort(affected.begin(), affected.end());
+  affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+  auto move_edges = [&](int sign, bool after) {
+    for (const Edge& e : affected) {
+      int d = delta(e);
+      // before: in g unless inserted; after: in g with the updates
+      if (after ? d < 0 : d > 0) continue;
+      int b1 = BucketOf(e.src), b2 = BucketOf(e.dst);
+      if (b1 < 0 || b2 < 0) continue;
+      if ((weight[Edge(b1, b2, e.el)] += sign) == 0) weight.erase(Edge(b1, b2, e.el));
+    }
+  };
+  move_edges(-1, false);
+
+  // route the resources, in the order of their ids
+  scheme_rows_ = n_ = 40;
+  scheme_cols_ = 2;
+  m_ = scheme_cols_ + 1;
+  const char* threshold = getenv("GCARE_SUMRDF_THRESHOLD");
+  threshold_ = threshold != nullptr ? std::stod(threshold) : 1.0;
+  a_.clear();
+  b_.clear();
+  MinHashScheme();
+  int k = n_ * scheme_cols_;
+  unordered_map<Type, int, TypeHasher> bucket_idx;
+  unordered_map<Type, int, ClassHasher, ClassEqual> class_idx;
+  vector<vector<int>> class_buckets;
+  for (size_t b = 0; b < sm_.buckets_.size(); b++) {
+    bucket_idx.emplace(sm_.buckets_[b].type_, b);
+    auto ins = class_idx.emplace(sm_.buckets_[b].type_, class_buckets.size());
+    if (ins.second) class_buckets.push_back(vector<int>());
+    class_buckets[ins.first->second].push_back(b);
+  }
+  // per class list, once a routed resource needs it: the signatures of its
+  // buckets (bucket -> offset in sigs) and their LSH bins, keyed by
+  // (list, row, band hash)
+  vector<char> signed_list(class_buckets.size(), 0);
+  unordered_map<int, size_t> sig_of;
+  vector<int> sigs;
+  unordered_map<size_t, vector<int>> bins;
+  auto bin_key = [](int list, int row, int hash) {
+    size_t h = 0;
+    boost::hash_combine(h, list);
+    boost::hash_combine(h, row);
+    boost::hash_combine(h, hash);
+    return h;
+  };
+  vector<int> values, sig(n_ * m_);
+  vector<char> left(sm_.buckets_.size(), 0); // whether a resource left
+  for (int v : routed) {
+    Type& t = new_type[v];
+    int from = BucketOf(v), to = -1;
+    auto exact = bucket_idx.find(t);
+    auto list = class_idx.find(t);
+    if (exact != bucket_idx.end()) {
+      to = exact->second;
+    } else if (list != class_idx.end()) {
+      int l = list->second;
+      if (!signed_list[l]) {
+        signed_list[l] = 1;
+        for (int b : class_buckets[l]) {
+          values.clear();
+          for (int out = 0; out < 2; out++)
+            for (auto re = s_.GetELabels(b, out); re.begin != re.end; re.begin++)
+              for (auto rd = s_.GetAdj(b, *re.begin, out); rd.begin != rd.end; rd.begin++)
+                values.push_back(out ? SchemeValue(*re.begin, *rd.begin) : SchemeValue(*rd.begin, *re.begin));
+          sig_of[b] = sigs.size();
+          sigs.resize(sigs.size() + n_ * m_);
+          ValueSignature(values, sigs.data() + sig_of[b]);
+          for (int r = 0; r < scheme_rows_; r++)
+            bins[bin_key(l, r, sigs[sig_of[b] + k + r])].push_back(b);
+        }
       }
-      for (auto re = g->GetELabels(srcid, true); re.begin != re.end; re.begin++) {
-        int el = *re.begin;
-        s_buckets_[i].type_.outgoing_.insert(el);
+      // v's neighbours as they are now, in their buckets
+      values.clear();
+      for (int out = 0; out < 2; out++) {
+        for (auto re = g.GetELabels(v, out); re.begin != re.end; re.begin++)
+          for (auto rd = g.GetAdj(v, *re.begin, out); rd.begin != rd.end; rd.begin++) {
+            Edge e = out ? Edge(v, *rd.begin, *re.begin) : Edge(*rd.begin, v, *re.begin);
+            int w = BucketOf(*rd.begin);
+            if (delta(e) >= 0 && w >= 0)
+              values.push_back(out ? SchemeValue(e.el, w) : SchemeValue(w, e.el));
+          }
       }
-      for (auto re = g->GetELabels(srcid, false); re.begin != re.end; re.begin++) {
-        int el = *re.begin;
-        s_buckets_[i].type_.incoming_.insert(el);
+      for (auto& a : added) {
+        int src = std::get<0>(a.first), dst = std::get<1>(a.first), el = std::get<2>(a.first);
+        if (a.second <= 0 || (src != v && dst != v)) continue;
+        if (src == v && BucketOf(dst) >= 0) values.push_back(SchemeValue(el, BucketOf(dst)));
+        if (dst == v && BucketOf(src) >= 0) values.push_back(SchemeValue(BucketOf(src), el));
+      }
+      ValueSignature(values, sig.data());
+      double best = threshold_;
+      for (int r = 0; r < scheme_rows_; r++) {
+        auto bin = bins.find(bin_key(l, r, sig[k + r]));
+        if (bin == bins.end()) continue;
+        for (int b : bin->second) {
+          double similarity = (double) CountEqual(sig.data(), sigs.data() + sig_of[b], k) / k;
+          if (similarity > best || (similarity == best && (to == -1 || b < to))) {
+            best = similarity;
+            to = b;
+          }
+        }
       }
     }
+    // a bucket the build merged the resource into keeps it
+    if (to == -1 && from >= 0 && !(sm_.buckets_[from].type_ == old_type[v]))
+      to = from;
+    if (to == -1) {
+      to = sm_.buckets_.size();
+      sm_.buckets_.push_back(Bucket(t));
+      left.push_back(0);
+      bucket_idx.emplace(t, to);
+    }
+    if (to == from) continue;
+    sm_.buckets_[to].resources_.push_back(v);
+    if (from >= 0) left[from] = 1;
+    SetBucketOf(v, to);
+  }
+  move_edges(1, true);
+
+  // drop the routed resources from the buckets they left, and the buckets
+  // left empty
+  for (size_t b = 0; b < sm_.buckets_.size(); b++) {
+    auto& res = sm_.buckets_[b].resources_;
+    if (left[b])
+      res.erase(std::remove_if(res.begin(), res.end(), [&](int v) { return BucketOf(v) != (int) b; }), res.end());
+    std::sort(res.begin(), res.end());
+  }
+  vector<int> renum(sm_.buckets_.size(), -1);
+  size_t kept = 0;
+  for (size_t b = 0; b < sm_.buckets_.size(); b++) {
+    if (sm_.buckets_[b].resources_.empty()) continue;
+    renum[b] = kept;
+    if (kept != b) sm_.buckets_[kept] = std::move(sm_.buckets_[b]);
+    kept++;
   }
+  sm_.buckets_.resize(kept);
+  w1_.clear();
+  for (auto& bucket : sm_.buckets_) w1_.push_back(bucket.resources_.size());
+  vector<pair<Edge, int>> edges;
+  for (auto& e : weight)
+    if (e.second > 0 && renum[e.first.src] >= 0 && renum[e.first.dst] >= 0)
+      edges.emplace_back(Edge(renum[e.first.src], renum[e.first.dst], e.first.el), e.second);
+  std::sort(edges.begin(), edges.end(), [](const pair<Edge, int>& a, const pair<Edge, int>& b) {
+    return a.first < b.first;
+  });
+  sm_.edges_.clear();
+  w2_.clear();
+  for (auto& e : edges) {
+    sm_.edges_.push_back(e.first);
+    w2_.push_back(e.second);
+  }
+  sm_.multiplicity_ = sm_.edges_.size();
+
+  // the summary is written over the one mapped
+  UnloadFile(summary_, summary_size_, LOAD_MMAP);
+  summary_ = nullptr;
+  summary_size_ = 0;
+  s_w1_ = s_w2_ = nullptr;
+  WriteSummary(fn);
+  return true;
+}
+
+// reference code: queryanswering/SPARQLEvaluator.java #38 SPARQLEvaluator()
+void SumRDF::Init() {
+  // Set types for each query vertex (the bucket types come with the summary)
   q_resources_.clear(); q_resources_.resize(q->GetNumVertices(), Resource());
   for (int i = 0; i < q->GetNumVertices(); i++) {
-    if (q->GetVLabel(i) != -1) q_resources_[i].type_.classes_.insert(q->GetVLabel(i));
+    if (q->GetVLabel(i) != -1) Type::Insert(q_resources_[i].type_.classes_, q->GetVLabel(i));
     for (auto& r : q->GetAdj(i, true)) {
       int dst = r.first;
       int el = r.second;
       // O == type_.outgoing_
-      q_resources_[i].type_.outgoing_.insert(el);   
+      Type::Insert(q_resources_[i].type_.outgoing_, el);
       // I == type_.incoming_
-      q_resources_[dst].type_.incoming_.insert(el);
+      Type::Insert(q_resources_[dst].type_.incoming_, el);
     }
     q_resources_[i].bound_ = q->GetBound(i);
   }
-  // Set summary graph (S == smo_, H == smo_.data_edges)
-  smo_.prev.clear(); smo_.prev.resize(q->GetNumEdges(), -1);
-  smo_.data_edges.clear();
-  for (int srcid = 0; srcid < s_.GetNumVertices(); srcid++) {
-    for (auto re = s_.GetELabels(srcid, true); re.begin != re.end; re.begin++) {
-      assert(re.begin!=re.end);
-      int el = *re.begin;
-      for (auto rd = s_.GetAdj(srcid, el, true); rd.begin != rd.end; rd.begin++) {
-        int dstid = *rd.begin;
-        smo_.data_edges.push_back(Edge(srcid, dstid, el));
-      }
-    }
-  }
   result_ = 0.0;
   emb_.resize(0);
-  tau_.resize(0); tau_.resize(q->GetNumVertices(), -1);
-  smo_.candidates.clear();
+
   partitions_.resize(0);
   CreateBasePartition();
-  edges_.resize(0); edges_.resize(q->GetNumEdges());
   indexes_.resize(0);
   is_init_ = false;
+  exhausted_ = false;
   pos_ = -1;
+  // threads of iterations run in-process leave a single one here
+  num_threads_ = omp_in_parallel() ? 1 : omp_get_max_threads();
+  if (evals_.size() < (size_t) num_threads_) evals_.resize(num_threads_);
+  batch_size_ = num_threads_ == 1 ? 1 : num_threads_ * BATCH_PER_THREAD;
+  batch_tau_.resize(batch_size_);
+  batch_edges_.resize(batch_size_);
+  batch_card_.clear();
+  batch_pos_ = 0;
   // Set candidate edges for each query edge for subgraph matching
   // candidates[i]: a set of summary edges which can be matched with i-th query edge
+  // They are looked up by label, and by the bucket of a bound end, in the
+  // label indexes of smo_; the types are compared once per bucket and query
+  // vertex. smo_ then indexes each by src and by dst bucket, for matching
+  // to visit only the candidates fitting the ends it has bound.
+  smo_.candidates.resize(q->GetNumEdges());
+  fits_.resize(q->GetNumVertices());
+  for (auto& f : fits_) f.assign(s_buckets_.size(), -1);
+  auto fits = [&](int b, int v) {
+    signed char& f = fits_[v][b];
+    if (f < 0) f = Includes(s_buckets_[b].type_, q_resources_[v].type_);
+    return f == 1;
+  };
   for (size_t i = 0; i < q->GetNumEdges(); i++) {
     Edge qedge = q->GetEdge(i);
-    smo_.candidates.push_back(vector<int>());
-    for (size_t j = 0; j < smo_.data_edges.size(); j++) {
-      Edge sedge = smo_.data_edges[j];
-      bool flag = true;
-      if (q->GetBound(qedge.src) != -1) {
-        flag = false;
-        assert(sedge.src < s_buckets_.size());
-        for (int rid : s_buckets_[sedge.src].resources_) {
-          if (rid == q->GetBound(qedge.src)) {
-            flag = true;
-            break;
-          }
-        }
-      }
-      if (q->GetBound(qedge.dst) != -1) {
-        flag = false;
-        assert(sedge.dst < s_buckets_.size());
-        for (int rid : s_buckets_[sedge.dst].resources_) {
-          if (rid == q->GetBound(qedge.dst)) {
-            flag = true;
-            break;
-          }
-        }
-      }
-      if (!flag) continue;
-      if (Includes(s_buckets_[sedge.src].type_, q_resources_[qedge.src].type_) &&
-          Includes(s_buckets_[sedge.dst].type_, q_resources_[qedge.dst].type_) &&
-          sedge.el == qedge.el) { // Check conditions for subgraph matching
-        smo_.candidates[i].push_back(j);
-      }
+    vector<int>& cand = smo_.candidates[i];
+    cand.clear();
+    if (qedge.el < 0 || qedge.el >= static_cast<int>(smo_.label_edges.size())) continue;
+    int src_bucket = BucketOf(q->GetBound(qedge.src));
+    int dst_bucket = BucketOf(q->GetBound(qedge.dst));
+    if (src_bucket == -2 || dst_bucket == -2) continue; // bound outside the data
+    const vector<Edge>& edges = smo_.data_edges;
+    const vector<int>* lst = &smo_.label_edges[qedge.el];
+    auto first = lst->begin(), last = lst->end();
+    if (src_bucket >= 0) {
+      first = std::lower_bound(first, last, src_bucket,
+          [&](int j, int b) { return edges[j].src < b; });
+      last = std::upper_bound(first, last, src_bucket,
+          [&](int b, int j) { return b < edges[j].src; });
+    } else if (dst_bucket >= 0) {
+      lst = &smo_.label_in_edges[qedge.el];
+      first = std::lower_bound(lst->begin(), lst->end(), dst_bucket,
+          [&](int j, int b) { return edges[j].dst < b; });
+      last = std::upper_bound(first, lst->end(), dst_bucket,
+          [&](int b, int j) { return b < edges[j].dst; });
+    }
+    for (; first != last; ++first) {
+      const Edge& sedge = edges[*first];
+      if (dst_bucket >= 0 && sedge.dst != dst_bucket) continue;
+      // Check conditions for subgraph matching
+      if (fits(sedge.src, qedge.src) && fits(sedge.dst, qedge.dst))
+        cand.push_back(*first);
     }
   }
+  smo_.BuildCandidateIndex();
 }
 
 
@@ -710,10 +1120,17 @@ void SumRDF::CreateBasePartition() {
   // a set of partitions == partitions_ and P == partition
   for (Partition& partition : partitions_) {
     for (size_t i = 0; i < partitions_.size(); i++) {
-      Partition finer = partitions_[i];
+      Partition& finer = partitions_[i];
       if (partition.IsFiner(finer)) partition.finer_partitions_.push_back(i);
     }
   }
+  // IsFiner() only relates a partition to ones with fewer blocks, so in this
+  // order a partition comes after everything in its finer_partitions_
+  partition_order_.resize(partitions_.size());
+  for (size_t i = 0; i < partitions_.size(); i++) partition_order_[i] = i;
+  std::stable_sort(partition_order_.begin(), partition_order_.end(), [&](int a, int b) {
+    return partitions_[a].blocks_.size() < partitions_[b].blocks_.size();
+  });
 }
 
 // reference code: queryanswering/SPARQLEvaluator.java #213 computePartitions()
@@ -825,96 +1242,132 @@ bool SumRDF::Includes(Type& t1, Type& t2) {
 
 // GetSubstructure return an embedding of Q in S
 // reference code: queryanswering/SPARQLEvaluator.java #91 evaluate()
+// Embeddings are taken from smo_ a batch at a time and evaluated by all
+// threads at once, each with its own Evaluation; the estimates come back
+// one per call in enumeration order, as if evaluated one by one.
 bool SumRDF::GetSubstructure(int subquery_index) {
+  if (++batch_pos_ < batch_card_.size()) return true;
   if (!is_init_) {
     is_init_ = true;
+    smo_.Init(s_, *q);
   }
-  smo_.Init(*g, *q);
-  if (!smo_.FindMatchedSubgraph(0)) { // if we cannot find any subgraph, then stop it
-    return false;
+  size_t n = 0;
+  while (n < batch_size_ && !exhausted_) {
+    if (!smo_.Next()) { // if we cannot find any subgraph, then stop it
+      exhausted_ = true;
+      break;
+    }
+    batch_tau_[n] = smo_.embedding;
+    batch_edges_[n] = smo_.edge_idx;
+    n++;
   }
-  tau_ = smo_.embedding;
-  edges_ = smo_.edge_idx;
+  batch_card_.resize(n);
+  batch_pos_ = 0;
+  if (n == 0) return false;
+  bool expired = false;
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads_) if(n > 1)
+  for (size_t i = 0; i < n; i++) {
+    Evaluation& e = evals_[omp_get_thread_num()];
+    e.tau_.swap(batch_tau_[i]);
+    e.edges_.swap(batch_edges_[i]);
+    if (!Evaluate(e, batch_card_[i])) {
+      #pragma omp atomic write
+      expired = true;
+    }
+    e.tau_.swap(batch_tau_[i]);
+    e.edges_.swap(batch_edges_[i]);
+  }
+  if (expired) throw TIMEOUT;
   return true;
 }
 
 // 4.2 Formalisation
-// reference code: queryanswering/SPARQLEvaluator.java #109 Process()
 double SumRDF::EstCard(int subquery_index) {
-  result_ = 0.0;
-  query_image_.clear();
+  return batch_card_[batch_pos_];
+}
+
+// The estimate of the embedding in e into result; false if the deadline
+// passed first
+// reference code: queryanswering/SPARQLEvaluator.java #109 Process()
+bool SumRDF::Evaluate(Evaluation& e, double& result) {
+  result = 0.0;
+  e.query_image_.clear();
   // query_image_[i]: i-th query edge
   // Here, if query edges are mapped to the same summary edge, it considers only one query edge
   for (size_t i = 0; i < q->GetNumEdges(); i++) {
     bool flag = false;
     for (size_t j = 0; j < i; j++) {
-      if (edges_[i] == edges_[j]) {
+      if (e.edges_[i] == e.edges_[j]) {
         flag = true;
         break;
       }
     }
     if (flag) continue;
-    query_image_.push_back(edges_[i]);
+    e.query_image_.push_back(e.edges_[i]);
   }
 
-  int q_size = q->GetNumVertices();
-  int q_remaining = q_size % 8;
-  q_size = q_remaining == 0 ? q_size : 8 + q_size - q_remaining;
-  solution_chk = (bool*) malloc(q_size);
-  int pid = 0;
-  for (Partition partition : partitions_) {
-    if (!partition.IsTauUnifiable(tau_)) continue;
+  e.chk_.resize(q->GetNumVertices());
+  // minimal solutions of the whole partition lattice, bottom-up
+  e.unifiable_.resize(partitions_.size());
+  e.minimal_.resize(partitions_.size());
+  for (size_t i = 0; i < partitions_.size(); i++)
+    e.unifiable_[i] = partitions_[i].IsTauUnifiable(e.tau_);
+  for (size_t i = 0; i < partition_order_.size(); i++) {
+    if ((i & 255) == 0 && DeadlinePassed()) return false;
+    int pid = partition_order_[i];
+    e.minimal_[pid] = MinimalSolutions(e, partitions_[pid]);
+  }
+  for (size_t pid = 0; pid < partitions_.size(); pid++) {
+    Partition& partition = partitions_[pid];
+    if (DeadlinePassed()) return false;
+    if (!e.unifiable_[pid]) continue;
     // P(m) == p
-    double cnt = MinimalSolutions(partition);
-    double p = QueryFactor(partition);
+    double cnt = e.minimal_[pid];
+    double p = QueryFactor(e, partition);
     // THEOREM 4.3. E_{q,s} == results_
-    result_ += p * cnt;
+    result += p * cnt;
   }
-  free(solution_chk);
-  return result_;
+  return true;
 }
 
 // reference code: queryanswering/SPARQLEvaluator.java #144 queryFactor()
-double SumRDF::QueryFactor(Partition& partition) {
+double SumRDF::QueryFactor(Evaluation& e, Partition& partition) {
   double res = 1.0;
-  for (size_t i = 0; i < query_image_.size(); i++) {
-    res *= AtomFactor(partition, query_image_[i]);
+  for (size_t i = 0; i < e.query_image_.size(); i++) {
+    res *= AtomFactor(e, partition, e.query_image_[i]);
   }
   return res;
 }
 
 // reference code: queryanswering/SPARQLEvaluator.java #126 minimalSolutions()
-double SumRDF::MinimalSolutions(Partition& partition) {
+// minimal_ and unifiable_ must be set for the finer partitions
+double SumRDF::MinimalSolutions(Evaluation& e, Partition& partition) {
   double sum = 0.0;
   for (int idx : partition.finer_partitions_) {
-    Partition& finer = partitions_[idx];
-    double val = MinimalSolutions(finer);
-    if (finer.IsTauUnifiable(tau_)) {
+    double val = e.minimal_[idx];
+    if (e.unifiable_[idx]) {
       sum += val;
     }
   }
-  double x = Solutions(partition);
+  double x = Solutions(e, partition);
 
   return x - sum;
 }
 
 // reference code: queryanswering/SPARQLEvaluator.java #136 solutions()
-inline double SumRDF::Solutions(Partition& partition) {
+inline double SumRDF::Solutions(Evaluation& e, Partition& partition) {
   double res = 1;
-  bool* chk = solution_chk;
-  uint64_t* vec = (uint64_t*) chk;
-  for (int i = 0; i < q->GetNumVertices(); i+= 8) {
-      vec[i>>3] = 0;
-  }
+  char* chk = e.chk_.data();
+  std::fill(e.chk_.begin(), e.chk_.end(), 0);
   for (Edge &edge : partition.q_mgu_) {
     int srcid = edge.src;
     int dstid = edge.dst;
     if (!chk[srcid] && q->GetBound(srcid) == -1) {
-      res *= w1_[tau_[srcid]];  // s == w1_
+      res *= s_w1_[e.tau_[srcid]];  // s == w1_
       chk[srcid] = true;
     }
     if (!chk[dstid] && q->GetBound(dstid) == -1) {
-      res *= w1_[tau_[dstid]];
+      res *= s_w1_[e.tau_[dstid]];
       chk[dstid] = true;
     }
   }
@@ -922,29 +1375,35 @@ inline double SumRDF::Solutions(Partition& partition) {
 }
 
 // reference code: queryanswering/SPARQLEvaluator.java #152 atomFactor()
-double SumRDF::AtomFactor(Partition& partition, int idx) {
-  int cnt = GetWeight(partition, idx);
-  if (cnt > w2_[idx]) { // w == w2_
+// depends only on the summary edge and the multiplicity, so it is cached
+// per (idx, cnt) for the lifetime of the summary
+double SumRDF::AtomFactor(Evaluation& e, Partition& partition, int idx) {
+  int cnt = GetWeight(e, partition, idx);
+  if (cnt > s_w2_[idx]) { // w == w2_
     return 0.0;
   }
-  double size = static_cast<double>(w1_[smo_.data_edges[idx].src]) *
-    static_cast<double>(w1_[smo_.data_edges[idx].dst]);
-  double res = 1.0;
+  uint64_t key = MemoTable::Key(idx, cnt);
+  double res;
+  if (e.atom_factors_.Find(key, res)) return res;
+  double size = static_cast<double>(s_w1_[smo_.data_edges[idx].src]) *
+    static_cast<double>(s_w1_[smo_.data_edges[idx].dst]);
+  res = 1.0;
   for (int i = 0; i < cnt; i++) {
     assert(size - i > 0);
-    res *= static_cast<double>(w2_[idx] - i) / static_cast<double>(size - i);
+    res *= static_cast<double>(s_w2_[idx] - i) / static_cast<double>(size - i);
   }
+  e.atom_factors_.Insert(key, res);
   return res;
 }
 
 // reference code: queryanswering/SPARQLEvaluator.java #164 preimage()
-int SumRDF::GetWeight(Partition& partition, int idx) {
+int SumRDF::GetWeight(Evaluation& e, Partition& partition, int idx) {
   int size = 0;
   for (Edge atom : partition.q_mgu_) {
-    assert(atom.src < tau_.size());
-    assert(atom.dst < tau_.size());
+    assert(atom.src < e.tau_.size());
+    assert(atom.dst < e.tau_.size());
     assert(idx < smo_.data_edges.size());
-    if (tau_[atom.src] == smo_.data_edges[idx].src && tau_[atom.dst] == smo_.data_edges[idx].dst && atom.el == smo_.data_edges[idx].el) size++;
+    if (e.tau_[atom.src] == smo_.data_edges[idx].src && e.tau_[atom.dst] == smo_.data_edges[idx].dst && atom.el == smo_.data_edges[idx].el) size++;
   }
   return size;
 }
@@ -1032,3 +1491,9 @@ double SumRDF::GetSelectivity() {
   return 1.0;
 }
 
+// the only subquery is the whole query
+string SumRDF::SubqueryKey(int subquery_index) {
+  return q->CanonicalForm();
+}
+
+}  // namespace graph
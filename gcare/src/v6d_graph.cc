@@ -0,0 +1,70 @@
+#include <climits>
+#include "htap_ds_impl.h"
+#include "../include/v6d_graph.h"
+
+namespace graph {
+
+namespace {
+
+using namespace vineyard::htap_impl;
+
+template <typename FRAG_T, typename VERTEX_MAP_T>
+void collect(GraphHandleImpl* h, FRAG_T* frags, VERTEX_MAP_T* vm,
+		vector<vector<int>>& vlabels, vector<Edge>& edges) {
+	int vl_num = h->vertex_label_num;
+	int el_num = h->edge_label_num;
+	//dense id of (fid, label, offset): base[fid * vl_num + label] + offset
+	vector<int64_t> base(h->fnum * vl_num + 1, 0);
+	for (FRAG_ID_TYPE fid = 0; fid < h->fnum; fid++)
+		for (int vl = 0; vl < vl_num; vl++) {
+			int i = fid * vl_num + vl;
+			base[i + 1] = base[i] + vm->GetInnerVertexSize(fid, vl);
+		}
+	if (base.back() > INT_MAX) {
+		fprintf(stderr, "LoadV6dGraph: %ld vertices exceed the int ids of DataGraph\n", (long)base.back());
+		exit(EXIT_FAILURE);
+	}
+	vlabels.assign(base.back(), vector<int>(1));
+	for (int i = 0; i < h->fnum * vl_num; i++)
+		for (int64_t v = base[i]; v < base[i + 1]; v++)
+			vlabels[v][0] = i % vl_num;
+	auto dense = [&](VID_TYPE gid) {
+		return (int)(base[h->vid_parser.GetFid(gid) * vl_num + h->vid_parser.GetLabelId(gid)]
+			+ h->vid_parser.GetOffset(gid));
+	};
+
+	edges.clear();
+	for (FRAG_ID_TYPE i = 0; i < h->local_fnum; i++) {
+		FRAG_T& frag = frags[h->local_fragments[i]];
+		for (int vl = 0; vl < vl_num; vl++)
+			for (auto v : frag.InnerVertices(vl)) {
+				int src = dense(frag.Vertex2Gid(v));
+				for (int el = 0; el < el_num; el++) {
+					auto adj = frag.GetOutgoingAdjList(v, el);
+					for (auto* e = adj.begin_unit(); e != adj.end_unit(); e++)
+						edges.emplace_back(src, dense(frag.Vertex2Gid(typename FRAG_T::vertex_t(e->vid))), el);
+				}
+			}
+	}
+}
+
+}  // namespace
+
+void LoadV6dGraph(DataGraph& g, uint64_t object_id) {
+	GraphHandleImpl handle;
+	get_graph_handle(object_id, 1, &handle);
+	vector<vector<int>> vlabels;
+	vector<Edge> edges;
+	if (handle.use_int64_oid)
+		collect(&handle, handle.fragments, handle.vertex_map, vlabels, edges);
+	else
+		collect(&handle, handle.string_fragments, handle.string_vertex_map, vlabels, edges);
+	free_graph_handle(&handle);
+	g.SetRawData(vlabels, edges);
+	vector<vector<int>>().swap(vlabels);
+	vector<Edge>().swap(edges);
+	g.MakeBinary();
+	g.LoadRaw();
+}
+
+}  // namespace graph
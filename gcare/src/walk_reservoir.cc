@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <set>
+#include <unistd.h>
+#include "../include/query_suite.h"
+#include "../include/walk_reservoir.h"
+
+namespace graph {
+
+namespace {
+
+//keys of one query enumerated at most
+const size_t MAX_KEYS_PER_QUERY = 1 << 16;
+
+//the edges of a workload query, labels mapped to the data graph's
+struct QueryEdge {
+	int src, dst, label;
+	bool bound; //either end is
+};
+
+//adds the keys of the patterns that extend the steps of edges so far
+//(key, and the earliest step and column holding each query vertex) to keys
+void extend(const vector<QueryEdge>& edges, vector<bool>& used, vector<int>& key,
+		std::map<int, pair<int, int>>& holder, std::set<vector<int>>& keys) {
+	int steps = key.size() / 4;
+	if (steps >= WalkReservoir::MIN_STEPS)
+		keys.insert(key);
+	if (steps == WalkReservoir::MAX_STEPS || keys.size() >= MAX_KEYS_PER_QUERY)
+		return;
+	for (size_t i = 0; i < edges.size(); i++) {
+		const QueryEdge& e = edges[i];
+		if (used[i] || e.bound || e.src == e.dst)
+			continue;
+		for (int dir = 1; dir >= 0; dir--) {
+			int from = dir ? e.src : e.dst, to = dir ? e.dst : e.src;
+			auto h = holder.find(from);
+			if (h == holder.end() || holder.count(to))
+				continue;
+			used[i] = true;
+			key.insert(key.end(), {e.label, dir, h->second.first, h->second.second});
+			holder[to] = make_pair(steps, dir ? 1 : 0);
+			extend(edges, used, key, holder, keys);
+			holder.erase(to);
+			key.resize(key.size() - 4);
+			used[i] = false;
+		}
+	}
+}
+
+}  // namespace
+
+bool WalkReservoir::Build(DataGraph& g, const char* workload, int num_patterns, int walks, Rng& rng) {
+	built_.clear();
+	patterns_.clear();
+	index_.clear();
+	QuerySuite suite;
+	if (!suite.Read(workload))
+		return false;
+	//in how many queries each pattern is
+	std::map<vector<int>, int> count;
+	int el_num = g.GetNumELabels();
+	for (auto& entry : suite.entries) {
+		const QueryText& text = *suite.texts[entry.text];
+		if (entry.query >= text.size())
+			continue;
+		const QueryText::Query& query = text.queries[entry.query];
+		std::map<int, int> bound;
+		for (size_t i = query.vertex_begin; i < query.vertex_end; i++)
+			bound[text.vertices[i].id] = text.vertices[i].bound;
+		auto bound_at = [&bound](int v) {
+			auto it = bound.find(v);
+			return it != bound.end() && it->second >= 0;
+		};
+		vector<QueryEdge> edges;
+		for (size_t i = query.edge_begin; i < query.edge_end; i++) {
+			const QueryText::Edge& e = text.edges[i];
+			int label = g.GetELabelMap()(e.label);
+			edges.push_back({e.src, e.dst, label,
+					label < 0 || label >= el_num || bound_at(e.src) || bound_at(e.dst)});
+		}
+		std::set<vector<int>> keys;
+		vector<bool> used(edges.size(), false);
+		for (size_t i = 0; i < edges.size(); i++) {
+			const QueryEdge& e = edges[i];
+			if (e.bound || e.src == e.dst)
+				continue;
+			used[i] = true;
+			vector<int> key = {e.label, 0, -1, 0};
+			std::map<int, pair<int, int>> holder = {{e.src, {0, 0}}, {e.dst, {0, 1}}};
+			extend(edges, used, key, holder, keys);
+			used[i] = false;
+		}
+		for (auto& key : keys)
+			count[key]++;
+	}
+	//the most frequent first, the longer of equally frequent ones
+	vector<pair<int, const vector<int>*>> ranked;
+	for (auto& c : count)
+		ranked.emplace_back(c.second, &c.first);
+	std::stable_sort(ranked.begin(), ranked.end(), [](const pair<int, const vector<int>*>& a,
+			const pair<int, const vector<int>*>& b) {
+		return a.first != b.first ? a.first > b.first : a.second->size() > b.second->size();
+	});
+	ranked.resize(std::min<size_t>(ranked.size(), std::max(num_patterns, 0)));
+
+	built_.push_back(ranked.size());
+	for (auto& r : ranked) {
+		const vector<int>& key = *r.second;
+		int steps = key.size() / 4;
+		int width = 2 + 2 * steps;
+		built_.push_back(steps);
+		built_.insert(built_.end(), key.begin(), key.end());
+		size_t head = built_.size();
+		built_.insert(built_.end(), {walks, 0, 0});
+		vector<int> kept;
+		vector<int> walk(width);
+		int64_t successes = 0;
+		int64_t start_edges = g.GetNumEdges(key[0]);
+		for (int w = 0; w < walks && start_edges > 0; w++) {
+			int* t = walk.data() + 2;
+			g.GetRandomEdge(key[0], rng, t);
+			double inv_prob = start_edges;
+			for (int j = 1; j < steps && inv_prob != 0; j++) {
+				const int* s = key.data() + 4 * j;
+				int v = t[2 * s[2] + s[3]], other;
+				int size = g.GetRandomAdj(v, s[0], s[1], rng, &other);
+				inv_prob *= size;
+				t[2 * j] = s[1] ? v : other;
+				t[2 * j + 1] = s[1] ? other : v;
+			}
+			if (inv_prob == 0)
+				continue;
+			memcpy(walk.data(), &inv_prob, sizeof(double));
+			//reservoir sampling of the successful walks
+			successes++;
+			if (kept.size() < (size_t)SIZE * width) {
+				kept.insert(kept.end(), walk.begin(), walk.end());
+			} else {
+				uint64_t slot = rng.Uniform(successes);
+				if (slot < (uint64_t)SIZE)
+					std::copy(walk.begin(), walk.end(), kept.begin() + slot * width);
+			}
+		}
+		built_[head + 1] = successes;
+		built_[head + 2] = kept.size() / width;
+		built_.insert(built_.end(), kept.begin(), kept.end());
+	}
+	attach(built_.data(), built_.data() + built_.size());
+	return true;
+}
+
+void WalkReservoir::Write(const char* fn) {
+	if (patterns_.empty()) {
+		remove(fn);
+		return;
+	}
+	FILE* fp = fopen(fn, "wb");
+	int header[2] = {MAGIC, VERSION};
+	fwrite(header, sizeof(int), 2, fp);
+	fwrite(built_.data(), sizeof(int), built_.size(), fp);
+	fclose(fp);
+}
+
+bool WalkReservoir::Read(const char* fn) {
+	UnloadFile(summary_, summary_size_, LOAD_MMAP);
+	summary_ = nullptr;
+	summary_size_ = 0;
+	patterns_.clear();
+	index_.clear();
+	if (access(fn, R_OK) != 0)
+		return false;
+	summary_ = LoadFile(fn, summary_size_, SummaryLoadMode());
+	if (summary_ == nullptr)
+		return false;
+	const int* p = (const int*) summary_;
+	if (summary_size_ < 3 * sizeof(int) || p[0] != MAGIC || p[1] != VERSION) {
+		fprintf(stderr, "%s: not a walk reservoir, ignored\n", fn);
+		return false;
+	}
+	attach(p + 2, p + summary_size_ / sizeof(int));
+	return true;
+}
+
+void WalkReservoir::attach(const int* p, const int* end) {
+	int num = *p++;
+	patterns_.resize(num);
+	for (int i = 0; i < num; i++) {
+		Pattern& pat = patterns_[i];
+		assert(p < end);
+		pat.steps = *p++;
+		index_[vector<int>(p, p + 4 * pat.steps)] = i;
+		p += 4 * pat.steps;
+		pat.walks = p[0];
+		pat.successes = p[1];
+		pat.kept = p[2];
+		pat.walk = p + 3;
+		p += 3 + (size_t)pat.kept * (2 + 2 * pat.steps);
+	}
+}
+
+int WalkReservoir::Find(const vector<Step>& steps) const {
+	vector<int> key;
+	for (size_t j = 0; j < steps.size(); j++) {
+		const Step& s = steps[j];
+		//the start step has no direction or parent
+		if (j == 0)
+			key.insert(key.end(), {s.label, 0, -1, 0});
+		else
+			key.insert(key.end(), {s.label, s.dir, s.parent, s.col});
+	}
+	auto it = index_.find(key);
+	return it == index_.end() ? -1 : it->second;
+}
+
+double WalkReservoir::Draw(int pattern, Rng& rng, int* t) const {
+	const Pattern& pat = patterns_[pattern];
+	if (pat.kept == 0 || rng.Uniform(pat.walks) >= (uint64_t)pat.successes)
+		return 0;
+	int width = 2 + 2 * pat.steps;
+	const int* walk = pat.walk + rng.Uniform(pat.kept) * width;
+	double inv_prob;
+	memcpy(&inv_prob, walk, sizeof(double));
+	std::copy(walk + 2, walk + width, t);
+	return inv_prob;
+}
+
+}  // namespace graph
@@ -1,17 +1,39 @@
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <omp.h>
 #include <random>
 #include "../include/wander_join.h"
 
-void WanderJoin::PrepareSummaryStructure(DataGraph& g, double ratio) {
+namespace graph {
+
+REGISTER_ESTIMATOR("wj", WanderJoin);
 
+//GCARE_WJ_RESERVOIR=QUERIES also draws reservoirs of walks of the
+//patterns most frequent in the queries, GCARE_WJ_RESERVOIR_PATTERNS (default
+//16) of them, with GCARE_WJ_RESERVOIR_WALKS walks each (default SIZE: all
+//are kept)
+void WanderJoin::PrepareSummaryStructure(DataGraph& g, double ratio) {
+	strata_.Build(g);
+	const char* workload = getenv("GCARE_WJ_RESERVOIR");
+	if (workload && strcmp(workload, "0") != 0) {
+		const char* patterns = getenv("GCARE_WJ_RESERVOIR_PATTERNS");
+		const char* walks = getenv("GCARE_WJ_RESERVOIR_WALKS");
+		reservoir_.Build(g, workload, patterns ? std::atoi(patterns) : 16,
+				walks ? std::max(1, std::atoi(walks)) : WalkReservoir::SIZE, rng_);
+	}
 }
 
+//the reservoir goes to fn.reservoir
 void WanderJoin::WriteSummary(const char* fn) {
-
+	strata_.Write(fn);
+	reservoir_.Write((string(fn) + ".reservoir").c_str());
 }
 
+//summaries of earlier versions were empty: sample uniformly then
 void WanderJoin::ReadSummary(const char* fn) {
-
+	strata_.Read(fn);
+	reservoir_.Read((string(fn) + ".reservoir").c_str());
 }
 
 void WanderJoin::Init() {
@@ -21,15 +43,62 @@ void WanderJoin::Init() {
     visited_.clear();
     join_from_.clear();
     join_to_.clear();
-    node_to_v_.clear();
-    counterparts_.clear();
-    plans_.clear();
+    Fresh(node_to_v_);
+    Fresh(counterparts_);
+    Fresh(plans_);
     counterpart_.clear();
     plan_.clear();
-    success_cnt_.clear();
-    est_.clear();
-    num_idx_lookup_.clear();
-    sampled_tuples_.clear();
+    plan_stats_.clear();
+    active_plans_.clear();
+    Fresh(programs_);
+    Fresh(join_checks_);
+    batch_est_.clear();
+    batch_pos_ = 0;
+    prefix_sum_.clear();
+    prefix_walks_ = 0;
+    plan_cache_mode_ = PlanCache::ModeFromEnv();
+    const char* batch = getenv("GCARE_WJ_BATCH");
+    batch_size_ = batch ? std::atoi(batch) : 1024;
+    const char* threads = getenv("GCARE_WJ_THREADS");
+    //threads of iterations run in-process leave a single one here
+    num_threads_ = threads && !omp_in_parallel() ? std::max(1, std::atoi(threads)) : 1;
+    lanes_.resize(num_threads_);
+    const char* branch = getenv("GCARE_WJ_BRANCH");
+    branch_ = branch ? std::max(1, std::atoi(branch)) : 1;
+    const char* branch_at = getenv("GCARE_WJ_BRANCH_AT");
+    branch_at_ = branch_at ? std::max(1, std::atoi(branch_at)) : 1;
+    if (branch_ > 1)
+        batch_size_ = 0;
+    const char* exact = getenv("GCARE_EXACT_BELOW");
+    exact_below_ = exact ? std::atof(exact) : 0.0;
+    exact_ = -1;
+    pilot_done_ = false;
+    const char* filter = getenv("GCARE_CAND_FILTER");
+    filter_on_ = filter && std::atoi(filter) == 1;
+    start_tuples_.clear();
+    const char* strata = getenv("GCARE_WJ_STRATA");
+    //the strata number the edges of the binary the summary was built on
+    strata_on_ = !strata_.Empty() && !(strata && std::atoi(strata) == 0) && g->NumUpdates() == 0;
+    if (filter_on_)
+        filter_.Build(*g, *q);
+    const char* anchor = getenv("GCARE_WJ_ANCHOR");
+    anchor_on_ = !(anchor && std::atoi(anchor) == 0);
+    const char* reservoir = getenv("GCARE_WJ_RESERVOIR");
+    //the reservoir's walks are of the binary it was built on
+    reservoir_on_ = !reservoir_.Empty() && !(reservoir && strcmp(reservoir, "0") == 0) &&
+        !filter_on_ && !prefixes_on_ && g->NumUpdates() == 0;
+    reuse_.clear();
+    gpu_ = nullptr;
+    gpu_plan_.clear();
+#ifdef GCARE_GPU
+    const char* gpu = getenv("GCARE_WJ_GPU");
+    WalkGraph arrays;
+    if (gpu && std::atoi(gpu) == 1 && batch_size_ > 0 && !filter_on_ && !strata_on_ &&
+            g->GetWalkGraph(&arrays))
+        gpu_ = GpuWalker::For(arrays);
+    if (gpu_ != nullptr && !batch)
+        batch_size_ = GPU_BATCH;
+#endif
     
     //set sample size
     int sum = 0;
@@ -49,6 +118,8 @@ void WanderJoin::Init() {
     sample_size_ = sum / (offset_ + e_cnt); 
     sample_size_ *= sample_ratio;
     walk_size_ = offset_ + e_cnt;
+    pool_on_ = StartPool::Enabled();
+    start_streams_.assign(walk_size_, StartPool::Stream());
     
     //set join from and to 
     for (int i = 0; i < walk_size_; i++) {
@@ -127,15 +198,26 @@ void WanderJoin::Init() {
         }
     }
 
+    const char* bidir = getenv("GCARE_WJ_BIDIR");
+    const char* bidir_walks = getenv("GCARE_WJ_BIDIR_WALKS");
+    bidir_walks_ = bidir_walks ? std::max(1, std::atoi(bidir_walks)) : 64;
+    bidir_on_ = bidir && std::atoi(bidir) > 0 && !filter_on_ && !prefixes_on_ &&
+        decomposeBidirectional(std::atoi(bidir));
 }
 
 int WanderJoin::DecomposeQuery() {
     return 1;
 }
 
-//top function
+//top function; with anchoring, only nodes with a bound vertex start plans,
+//unless there are none
 void WanderJoin::generateWalkPlans() {
+    bool any_bound = false;
+    for (int s = 0; s < walk_size_ && anchor_on_; s++)
+        any_bound |= boundNode(s);
     for (int s = 0; s < walk_size_; s++) {
+        if (any_bound && !boundNode(s))
+            continue;
         visited_.clear();
         visited_.resize(walk_size_, false);
         visited_[s] = true;
@@ -151,8 +233,8 @@ void WanderJoin::generateWalkPlans(int cnt) {
         sample_cnt_--;
         assert(plan_.size() == walk_size_ - 1);
         assert(counterpart_.size() == walk_size_ - 1);
-        plans_.push_back(plan_);
-        counterparts_.push_back(counterpart_);
+        plans_.emplace_back(plan_.begin(), plan_.end());
+        counterparts_.emplace_back(counterpart_.begin(), counterpart_.end());
         return;
     }
     for (int i = 0; i < join_from_.size(); i++) {
@@ -168,216 +250,810 @@ void WanderJoin::generateWalkPlans(int cnt) {
     }
 }
 
-bool WanderJoin::checkBoundedVertices(int node, vector<int> t) {
-	if (node >= offset_) {
+//compiles every plan into WalkSteps; slot k of a walk holds the tuple of
+//step k (a vertex tuple repeats its vertex in both columns)
+void WanderJoin::compileWalkPlans() {
+	programs_.resize(plans_.size());
+	join_checks_.resize(plans_.size());
+	for (int p = 0; p < plans_.size(); p++) {
+		auto& plan = plans_[p];
+		auto& prog = programs_[p];
+		int start_node = 0;
+		if (counterparts_[p].size() > 0)
+			start_node = counterparts_[p][0].first;
+		prog.push_back(compileStep(start_node, -1, 0, true));
+		for (int cur_order = 0; cur_order < plan.size(); cur_order++) {
+			int parent = 0;
+			for (int k = 0; k < cur_order; k++) 
+				if (plan[k].first == counterparts_[p][cur_order].first) 
+					parent = k + 1;
+			prog.push_back(compileStep(plan[cur_order].first, parent,
+						counterparts_[p][cur_order].second, plan[cur_order].second == 0));
+		}
+		for (int i = 0; i < join_from_.size(); i++) {
+			int pos1 = 0, pos2 = 0;
+			for (int j = 0; j < plan.size(); j++) {
+				if (plan[j].first == join_from_[i].first)
+					pos1 = j + 1;
+				if (plan[j].first == join_to_[i].first)
+					pos2 = j + 1;
+			}
+			join_checks_[p].push_back({pos1, join_from_[i].second, pos2, join_to_[i].second});
+		}
+	}
+	matchReservoir();
+	if (filter_on_) {
+		vector<bool> built(walk_size_, false);
+		start_tuples_.resize(walk_size_);
+		for (auto& prog : programs_) {
+			const WalkStep& s0 = prog[0];
+			if (built[s0.node])
+				continue;
+			built[s0.node] = true;
+			filter_.Tuples(s0.label, s0.vertex[0], s0.edge ? s0.vertex[1] : -1, start_tuples_[s0.node]);
+		}
+	}
+	walk_tuples_.resize(2 * walk_size_);
+}
+
+WanderJoin::WalkStep WanderJoin::compileStep(int node, int parent, int col, bool dir) {
+	WalkStep s;
+	s.node = node;
+	s.parent = parent;
+	s.col = col;
+	s.dir = dir;
+	s.edge = node >= offset_;
+	if (s.edge) {
 		auto e = q->GetEdge(node - offset_);
-		if (q->GetBound(e.src) >= 0 && q->GetBound(e.src) != t[0])
-			return false;
-		if (q->GetBound(e.dst) >= 0 && q->GetBound(e.dst) != t[1])
-			return false;
+		s.label = e.el;
+		s.bound[0] = q->GetBound(e.src);
+		s.bound[1] = q->GetBound(e.dst);
+		s.vertex[0] = e.src;
+		s.vertex[1] = e.dst;
 	} else {
 		int u = node_to_v_[node];
-		if (q->GetBound(u) >= 0 && q->GetBound(u) != t[0])
-			return false;
+		s.label = q->GetVLabel(u);
+		s.bound[0] = s.bound[1] = q->GetBound(u);
+		s.vertex[0] = s.vertex[1] = u;
 	}
-	return true;
+	return s;
 }
 
-bool WanderJoin::checkLabelStatistics(int node) { 
+bool WanderJoin::checkBoundedVertices(const WalkStep& s, const int* t) {
+	return (s.bound[0] < 0 || s.bound[0] == t[0])
+		&& (s.bound[1] < 0 || s.bound[1] == t[1]);
+}
+
+//whether a query vertex of node is bound
+bool WanderJoin::boundNode(int node) {
 	if (node >= offset_) {
 		auto e = q->GetEdge(node - offset_);
-		if (g->GetNumEdges(e.el) == 0) {
-			return false;
-        }
-	} else {
-		int u = node_to_v_[node];
-		int vl = q->GetVLabel(u);
-		if (g->GetNumVertices(vl) == 0) {
+		return q->GetBound(e.src) >= 0 || q->GetBound(e.dst) >= 0;
+	}
+	return q->GetBound(node_to_v_[node]) >= 0;
+}
+
+bool WanderJoin::checkLabelStatistics(const WalkStep& s) { 
+	if (s.edge)
+		return g->GetNumEdges(s.label) != 0;
+	else
+		return g->GetNumVertices(s.label) != 0;
+}
+
+//slot k of the walk is at t + k * stride
+bool WanderJoin::checkNonTreeEdges(int plan, const int* t, size_t stride) {
+	for (auto& c : join_checks_[plan]) {
+		if (t[c[0] * stride + c[1]] != t[c[2] * stride + c[3]])
 			return false;
-        }
 	}
 	return true;
 }
 
-bool WanderJoin::checkNonTreeEdges(vector<pair<int, int>>& plan) {
-	for (int i = 0; i < join_from_.size(); i++) {
-		int n1 = join_from_[i].first;
-		int c1 = join_from_[i].second;
-		int n2 = join_to_[i].first;
-		int c2 = join_to_[i].second;
-		int pos1 = 0, pos2 = 0;
-		for (int j = 0; j < plan.size(); j++) {
-			if (plan[j].first == n1)
-				pos1 = j + 1;
-			if (plan[j].first == n2)
-				pos2 = j + 1;
+//a uniform tuple of s0's label into t (a vertex in both columns), from the
+//shared pool if it is on; false if the label has none
+bool WanderJoin::drawStart(const WalkStep& s0, Rng& rng, int* t) {
+	if (pool_on_) {
+		StartPool::Stream& s = start_streams_[s0.node];
+		if (!s.IsOpen())
+			s = StartPool::Open(*g, s0.edge, s0.label, StartPool::StreamOf(seed_, s0.node));
+		return s.Next(t);
+	}
+	if (s0.edge)
+		return g->GetRandomEdge(s0.label, rng, t);
+	bool ok = g->GetRandomVertex(s0.label, rng, t);
+	t[1] = t[0];
+	return ok;
+}
+
+//whether walks start at s0's bound vertex; candidate filter draws already
+//keep to the bound vertices
+bool WanderJoin::anchored(const WalkStep& s0) {
+	return anchor_on_ && !filter_on_ && (s0.bound[0] >= 0 || s0.bound[1] >= 0);
+}
+
+//a start tuple of anchored s0 into t: the bound end is fixed, so the other
+//is uniform over its s0.label list, and 1/P(t) is the length of that list
+//(1 for a vertex or an edge with both ends bound); 0 if there is none
+double WanderJoin::anchorStart(const WalkStep& s0, Rng& rng, int* t) {
+	int n = g->GetNumVertices();
+	if (s0.bound[0] >= n || s0.bound[1] >= n)
+		return 0;
+	if (!s0.edge) {
+		t[0] = t[1] = s0.bound[0];
+		return g->HasVLabel(t[0], s0.label) ? 1 : 0;
+	}
+	if (s0.bound[0] >= 0 && s0.bound[1] >= 0) {
+		t[0] = s0.bound[0];
+		t[1] = s0.bound[1];
+		return g->HasEdge(t[0], t[1], s0.label, true) ? 1 : 0;
+	}
+	bool dir = s0.bound[0] >= 0;
+	int v = dir ? s0.bound[0] : s0.bound[1];
+	int other;
+	int size = g->GetRandomAdj(v, s0.label, dir, rng, &other);
+	t[0] = dir ? v : other;
+	t[1] = dir ? other : v;
+	return size;
+}
+
+//samples the start tuple of s0 into t, returns 1/P(t) or 0 if it fails
+double WanderJoin::walkStart(const WalkStep& s0, int* t, int& lookup) {
+	//randomly sample an edge/vertex with edge/vertex label of the start node
+	double inv_prob;
+	lookup = 1;
+	if (anchored(s0)) {
+		return anchorStart(s0, rng_, t);
+	} else if (filter_on_) {
+		auto& c = start_tuples_[s0.node];
+		if (c.empty())
+			return 0;
+		int i = rng_.Uniform(c.size() / 2);
+		t[0] = c[2 * i];
+		t[1] = c[2 * i + 1];
+		inv_prob = c.size() / 2;
+	} else if (s0.edge && strata_on_) {
+		inv_prob = strata_.Sample(*g, s0.label, rng_, t);
+		if (inv_prob == 0)
+			return 0;
+	} else {
+		drawStart(s0, rng_, t);
+		inv_prob = s0.edge ? g->GetNumEdges(s0.label) : g->GetNumVertices(s0.label);
+	}
+	return checkBoundedVertices(s0, t) ? inv_prob : 0;
+}
+
+//the longest prefix of every plan that is a pattern of the reservoir: its
+//edge steps of unbound vertices as far as each reaches a new vertex
+void WanderJoin::matchReservoir() {
+	reuse_.assign(programs_.size(), make_pair(-1, 1));
+	if (!reservoir_on_)
+		return;
+	vector<WalkReservoir::Step> steps;
+	std::map<int, pair<int, int>> holder; //query vertex -> (step, column)
+	for (size_t p = 0; p < programs_.size(); p++) {
+		steps.clear();
+		holder.clear();
+		for (const WalkStep& s : programs_[p]) {
+			if (steps.size() == WalkReservoir::MAX_STEPS || !s.edge || s.bound[0] >= 0 ||
+					s.bound[1] >= 0 || s.vertex[0] == s.vertex[1])
+				break;
+			int k = steps.size();
+			if (k == 0) {
+				steps.push_back({s.label, 0, -1, 0});
+				holder[s.vertex[0]] = make_pair(0, 0);
+				holder[s.vertex[1]] = make_pair(0, 1);
+			} else {
+				int from = s.vertex[s.dir ? 0 : 1], to = s.vertex[s.dir ? 1 : 0];
+				auto h = holder.find(from);
+				if (h == holder.end() || holder.count(to))
+					break;
+				steps.push_back({s.label, s.dir, h->second.first, h->second.second});
+				holder[to] = make_pair(k, s.dir ? 1 : 0);
+			}
+			if (steps.size() >= WalkReservoir::MIN_STEPS) {
+				int pattern = reservoir_.Find(steps);
+				if (pattern >= 0)
+					reuse_[p] = make_pair(pattern, (int)steps.size());
+			}
+		}
+	}
+}
+
+//the first steps of a walk of plan p into t: from the reservoir if it has
+//them, else the start tuple; returns their 1/P or 0 if they fail, and in
+//next the first step left to walk
+double WanderJoin::walkPrefix(int p, int* t, int& lookup, int& next) {
+	if (reuse_[p].first >= 0) {
+		lookup = 1;
+		next = reuse_[p].second;
+		return reservoir_.Draw(reuse_[p].first, rng_, t);
+	}
+	next = 1;
+	return walkStart(programs_[p][0], t, lookup);
+}
+
+//runs steps [from, to) of plan p on the walk in t, returns the product of
+//their 1/P or 0 if one fails; adds its index lookups to lookup
+double WanderJoin::extend(int p, int* t, int from, int to, int& lookup) {
+	auto& prog = programs_[p];
+	double inv_prob = 1.0;
+	for (int k = from; k < to; k++) {
+		const WalkStep& s = prog[k];
+		int v = t[2 * s.parent + s.col];
+		int* cur = t + 2 * k;
+		lookup++;
+		GCARE_COUNT(walk_steps);
+		if (s.edge) {
+			int other;
+			int size = filter_on_
+				? filter_.PickAdj(v, s.label, s.dir, s.vertex[s.dir ? 1 : 0], rng_, &other)
+				: g->GetRandomAdj(v, s.label, s.dir, rng_, &other);
+			if (size == 0)
+				return 0;
+			inv_prob *= size;
+			cur[0] = s.dir ? v : other;
+			cur[1] = s.dir ? other : v;
+		} else {
+			if (!g->HasVLabel(v, s.label))
+				return 0;
+			cur[0] = cur[1] = v;
+		}
+		if (!checkBoundedVertices(s, cur))
+			return 0;
+	}
+	return inv_prob;
+}
+
+//one walk of plan p into t, returns 1/P(si) or 0 if it fails;
+//lookup is the number of index lookups made
+double WanderJoin::walk(int p, int* t, int& lookup) {
+	auto& prog = programs_[p];
+	int next;
+	double inv_prob = walkPrefix(p, t, lookup, next);
+	if (inv_prob == 0)
+		return 0;
+	inv_prob *= extend(p, t, next, prog.size(), lookup);
+	if (inv_prob == 0)
+		return 0;
+	return checkNonTreeEdges(p, t, 2) ? inv_prob : 0;
+}
+
+//branch_ walks of plan p sharing their first branch_at_ steps; returns
+//1/P(prefix) times the mean of the completions' 1/P (0 for failed ones)
+double WanderJoin::walkTree(int p, int* t, int& lookup) {
+	auto& prog = programs_[p];
+	int next;
+	double inv_prob = walkPrefix(p, t, lookup, next);
+	if (inv_prob == 0)
+		return 0;
+	int at = std::min<int>(std::max(branch_at_, next), prog.size());
+	inv_prob *= extend(p, t, next, at, lookup);
+	if (inv_prob == 0)
+		return 0;
+	double sum = 0;
+	for (int b = 0; b < branch_; b++) {
+		double rest = extend(p, t, at, prog.size(), lookup);
+		if (rest != 0 && checkNonTreeEdges(p, t, 2))
+			sum += rest;
+	}
+	return inv_prob * sum / branch_;
+}
+
+//the arms of a path or cycle query of at least min_edges edges (see
+//bidir_on_); false if the query is not one
+bool WanderJoin::decomposeBidirectional(int min_edges) {
+	int num_edges = q->GetNumEdges(), nv = q->GetNumVertices();
+	if (num_edges < std::max(min_edges, 2))
+		return false;
+	vector<vector<int>> incident(nv);
+	int cut = 0; //a cycle's edge of the rarest label
+	for (int i = 0; i < num_edges; i++) {
+		auto e = q->GetEdge(i);
+		if (e.src == e.dst)
+			return false;
+		incident[e.src].push_back(i);
+		incident[e.dst].push_back(i);
+		if (g->GetNumEdges(e.el) < g->GetNumEdges(q->GetEdge(cut).el))
+			cut = i;
+	}
+	int ends = 0, first = q->GetEdge(cut).src;
+	for (int v = 0; v < nv; v++) {
+		if (q->GetBound(v) >= 0 || incident[v].empty() || incident[v].size() > 2)
+			return false;
+		if (incident[v].size() == 1) {
+			ends++;
+			first = v;
 		}
-		if (sampled_tuples_[pos1][c1] != sampled_tuples_[pos2][c2])
+	}
+	if (ends != 0 && ends != 2)
+		return false;
+	bidir_cycle_ = ends == 0;
+	//the query vertices u[0..num_edges] in order along the edges es, a
+	//cycle's from the cut edge on and back to its start
+	vector<int> u = {first}, es;
+	vector<bool> used(num_edges, false);
+	for (int k = 0; k < num_edges; k++) {
+		int next = -1;
+		for (int i : incident[u.back()])
+			if (!used[i] && (k > 0 || !bidir_cycle_ || i == cut))
+				next = i;
+		if (next < 0)
 			return false;
+		used[next] = true;
+		es.push_back(next);
+		auto e = q->GetEdge(next);
+		u.push_back(e.src == u.back() ? e.dst : e.src);
 	}
+	if (bidir_cycle_ && u.back() != first)
+		return false;
+
+	auto start = [this](int i) {
+		auto e = q->GetEdge(i);
+		return BidirStart{e.el, {q->GetVLabel(e.src), q->GetVLabel(e.dst)}};
+	};
+	auto col = [this](int i, int v) { return q->GetEdge(i).src == v ? 0 : 1; };
+	//the step along es[k] from u[from] to u[to]
+	auto step = [&](int k, int from, int to) {
+		auto e = q->GetEdge(es[k]);
+		return ArmStep{e.el, e.src == u[from], q->GetVLabel(u[to])};
+	};
+	//arm 0 walks from u[1] up to the middle vertex u[h], arm 1 from u[last]
+	//down to it
+	int h = bidir_cycle_ ? 1 + (num_edges - 1) / 2 : num_edges / 2;
+	int last = bidir_cycle_ ? num_edges : num_edges - 1;
+	starts_.assign(1, start(es[0]));
+	arms_[0].clear();
+	arms_[1].clear();
+	arm_col_[0] = col(es[0], u[1]);
+	for (int k = 1; k < h; k++)
+		arms_[0].push_back(step(k, k, k + 1));
+	if (bidir_cycle_) {
+		arm_col_[1] = col(es[0], u[0]);
+	} else {
+		starts_.push_back(start(es[last]));
+		arm_col_[1] = col(es[last], u[last]);
+	}
+	for (int k = last; k > h; k--)
+		arms_[1].push_back(step(k - 1, k, k - 1));
 	return true;
 }
 
-//sample from the first node in the walk plan
-//returns inverse probability
-int WanderJoin::sampleTuple(int node) { 
-	int ret;
-	if (node >= offset_) {
-		auto e = q->GetEdge(node - offset_);
-		auto t = g->GetRandomEdge(e.el);
-        sampled_tuples_.push_back(t);
-        ret = g->GetNumEdges(e.el);
-    } else {
-        int u = node_to_v_[node];
-        int vl = q->GetVLabel(u);
-        auto t = g->GetRandomVertex(vl); 
-        sampled_tuples_.push_back(t);
-        ret = g->GetNumVertices(vl);
-	}
-	return ret;
-}
-
-//sample from subsequent nodes, using graph adj. list
-//returns inverse probability
-int WanderJoin::sampleTuple(int node, int v, int c) { 
-    int ret;
-    if (node >= offset_) {
-        auto e = q->GetEdge(node - offset_);
-        auto t = g->GetRandomEdge(v, e.el, c == 0);
-        if (t.size() > 0) {
-            sampled_tuples_.push_back(t);
-            ret = g->GetAdjSize(v, e.el, c == 0);
-        } else
-            ret = 0;
-    } else {
-        int u = node_to_v_[node];
-        int vl = q->GetVLabel(u);
-        if (g->HasVLabel(v, vl)) {
-            sampled_tuples_.push_back(vector<int>(1, v));
-            ret = 1;
-        } else 
-            ret = 0;
-    }
-    return ret;
+//a uniform edge of starts_[i] into t, returns its 1/P or 0 if it fails
+double WanderJoin::bidirStart(int i, int* t) {
+	const BidirStart& s = starts_[i];
+	if (g->GetNumEdges(s.label) == 0 || !g->GetRandomEdge(s.label, rng_, t))
+		return 0;
+	for (int c = 0; c < 2; c++)
+		if (s.vlabel[c] >= 0 && !g->HasVLabel(t[c], s.vlabel[c]))
+			return 0;
+	return g->GetNumEdges(s.label);
+}
+
+//walks arm from v, multiplying inv_prob by the 1/P of its steps; returns
+//the vertex it ends at, -1 if it fails
+int WanderJoin::walkArm(int arm, int v, double& inv_prob) {
+	for (const ArmStep& s : arms_[arm]) {
+		GCARE_COUNT(walk_steps);
+		int size = g->GetRandomAdj(v, s.label, s.dir, rng_, &v);
+		if (size == 0 || (s.vlabel >= 0 && !g->HasVLabel(v, s.vlabel)))
+			return -1;
+		inv_prob *= size;
+	}
+	return v;
+}
+
+//one sample of the bidirectional walks: the mean over all pairs of walks
+//of the two arms of 1/P of both where they meet, 0 where they do not
+double WanderJoin::walkBidirectional() {
+	int start[2], t[2];
+	double scale = 1;
+	if (bidir_cycle_ && (scale = bidirStart(0, start)) == 0)
+		return 0;
+	meet_.clear();
+	for (int arm = 0; arm < 2; arm++) {
+		double sum = 0;
+		for (int w = 0; w < bidir_walks_; w++) {
+			double inv_prob = 1;
+			if (!bidir_cycle_ && (inv_prob = bidirStart(arm, t)) == 0)
+				continue;
+			int v = walkArm(arm, (bidir_cycle_ ? start : t)[arm_col_[arm]], inv_prob);
+			if (v < 0)
+				continue;
+			if (arm == 0) {
+				meet_[v] += inv_prob;
+				continue;
+			}
+			auto it = meet_.find(v);
+			if (it != meet_.end())
+				sum += inv_prob * it->second;
+		}
+		if (arm == 0 && meet_.empty())
+			return 0;
+		if (arm == 1)
+			return scale * sum / ((double)bidir_walks_ * bidir_walks_);
+	}
+	return 0;
+}
+
+//the walk plans of the query, from the plan cache if an earlier run of
+//this structure generated them
+void WanderJoin::loadPlans() {
+	PlanCache::Entry* cached = nullptr;
+	if (plan_cache_mode_ != PlanCache::OFF) {
+		plan_key_ = PlanCache::Key(*q, sample_size_);
+		cached = plan_cache_.Find(plan_key_);
+	}
+	if (cached != nullptr) {
+		for (size_t p = 0; p < cached->plans.size(); p++) {
+			plans_.emplace_back(cached->plans[p].begin(), cached->plans[p].end());
+			counterparts_.emplace_back(cached->counterparts[p].begin(), cached->counterparts[p].end());
+		}
+		sample_cnt_ = sample_size_;
+		return;
+	}
+	sample_cnt_ = sample_size_;
+	//this consumes sample_cnt_, preventing generating many useless walk orders
+	//(an optimization)
+	generateWalkPlans();
+	//restore sample_cnt_
+	sample_cnt_ = sample_size_;
+	if (plan_cache_mode_ == PlanCache::OFF)
+		return;
+	PlanCache::Entry& entry = plan_cache_.Insert(plan_key_);
+	for (size_t p = 0; p < plans_.size(); p++) {
+		entry.plans.emplace_back(plans_[p].begin(), plans_[p].end());
+		entry.counterparts.emplace_back(counterparts_[p].begin(), counterparts_[p].end());
+	}
 }
 
 //generates all walk orders
 //perform random walks
 //returns si and P(si)
 bool WanderJoin::GetSubstructure(int subquery_index) {
+	if (bidir_on_) {
+		if (!plans_generated_) {
+			sample_cnt_ = sample_size_;
+			plans_generated_ = true;
+		}
+		if (exact_below_ > 0 && !pilot_done_ && card_vec_.size() >= PILOT_WALKS) {
+			pilot_done_ = true;
+			if (pilotExact())
+				return false;
+		}
+		if (sample_cnt_ <= 0)
+			return false;
+		//a sample costs the walks of both arms
+		sample_cnt_ -= 2 * bidir_walks_;
+		inv_prob_ = walkBidirectional();
+		valid_ = inv_prob_ != 0;
+		return true;
+	}
 	if (!plans_generated_) {
-		sample_cnt_ = sample_size_;
-		//this consumes sample_cnt_, preventing generating many useless walk orders
-		//(an optimization)
-		generateWalkPlans();
-        //restore sample_cnt_
-		sample_cnt_ = sample_size_;
-		success_cnt_.resize(plans_.size(), 0);
-		est_.resize(plans_.size());
-		num_idx_lookup_.resize(plans_.size());
+		loadPlans();
+		compileWalkPlans();
 		plans_generated_ = true;
 		if (plans_.size() == 0)
 			return false;
+		plan_stats_.assign(plans_.size(), PlanStats());
+		for (int p = 0; p < plans_.size(); p++)
+			active_plans_.push_back(p);
+		active_pos_ = 0;
+		round_walks_ = TRIAL_WALKS;
+		round_left_ = round_walks_ * active_plans_.size();
+		plan_chosen_ = plans_.size() == 1;
+		PlanCache::Entry* cached = plan_cache_mode_ == PlanCache::CHOICE
+			? plan_cache_.Find(plan_key_) : nullptr;
+		if (cached != nullptr && cached->chosen >= 0) {
+			pos_ = cached->chosen;
+			plan_chosen_ = true;
+		}
+	}
+	if (exact_below_ > 0 && !pilot_done_ && card_vec_.size() >= PILOT_WALKS) {
+		pilot_done_ = true;
+		if (pilotExact())
+			return false;
+	}
+	if (plan_chosen_ && batch_size_ > 0) {
+		if (batch_pos_ == batch_est_.size()) {
+			if (sample_cnt_ <= 0)
+				return false;
+			int n = std::min(batch_size_, sample_cnt_);
+			sample_cnt_ -= n;
+			if (!walkBatch(n))
+				return false;
+		}
+		inv_prob_ = batch_est_[batch_pos_++];
+		valid_ = inv_prob_ != 0;
+		return true;
 	}
 	if (sample_cnt_ <= 0)
 		return false;
-	while (sample_cnt_) {
-		sample_cnt_--;
-
-		sampled_tuples_.clear();
-		valid_ = true;
-		inv_prob_ = 1.0;
-        int lookup = 0;
+	while (sample_cnt_ > 0) {
+		sample_cnt_ -= branch_;
 
-		int start_node = 0;
-		if (counterparts_[pos_].size() > 0)
-			start_node  = counterparts_[pos_][0].first;
-		assert(start_node < walk_size_);
-		if (!checkLabelStatistics(start_node))
+		if (!checkLabelStatistics(programs_[pos_][0]))
 			return false;
-		//randomly sample an edge/vertex with edge/vertex label of start_node
-		inv_prob_ *= sampleTuple(start_node);
-        lookup++;
-		if (!checkBoundedVertices(start_node, sampled_tuples_[0])) {
-			if (!plan_chosen_) {
-                est_[pos_].push_back(0);
-                num_idx_lookup_[pos_].push_back(lookup);
-				pos_ = (pos_ + 1) % plans_.size();
-            }
-            valid_ = false;
-            return true;
+		int lookup;
+		if (branch_ > 1)
+			inv_prob_ = walkTree(pos_, walk_tuples_.data(), lookup);
+		else
+			inv_prob_ = walk(pos_, walk_tuples_.data(), lookup);
+		valid_ = inv_prob_ != 0;
+        if (!plan_chosen_)
+            recordTrial(inv_prob_, lookup);
+		return true;
+	}
+	//used all sample_cnt_ before choosing an order
+	return false;
+}
+
+//plan selection by successive halving: every active plan gets round_walks_
+//walks per round (interleaved), then the better half by variance * mean
+//index lookups goes on with twice the walks, until one plan is left
+void WanderJoin::recordTrial(double est, int lookup) {
+	plan_stats_[pos_].Add(est, lookup);
+	if (--round_left_ > 0) {
+		active_pos_ = (active_pos_ + 1) % active_plans_.size();
+		pos_ = active_plans_[active_pos_];
+		return;
+	}
+	//plans with too few successful walks have no usable variance yet
+	vector<int> ranked;
+	for (int p : active_plans_)
+		if (plan_stats_[p].success >= MIN_TRIAL_SUCCESS)
+			ranked.push_back(p);
+	if (!ranked.empty()) {
+		std::stable_sort(ranked.begin(), ranked.end(), [this](int a, int b) {
+			return plan_stats_[a].Cost() < plan_stats_[b].Cost();
+		});
+		ranked.resize((ranked.size() + 1) / 2);
+		active_plans_ = ranked;
+	}
+	active_pos_ = 0;
+	pos_ = active_plans_[0];
+	if (active_plans_.size() == 1) {
+		plan_chosen_ = true;
+		PlanCache::Entry* cached = plan_cache_mode_ == PlanCache::CHOICE
+			? plan_cache_.Find(plan_key_) : nullptr;
+		if (cached != nullptr) {
+			cached->chosen = pos_;
+			cached->cost = plan_stats_[pos_].Cost();
 		}
+		return;
+	}
+	round_walks_ *= 2;
+	round_left_ = round_walks_ * active_plans_.size();
+}
 
-		for (int cur_order = 0; cur_order < plans_[pos_].size(); cur_order++) {
-			int cur_node = plans_[pos_][cur_order].first;
-			int prev_order = 0;
-			for (int k = 0; k < cur_order; k++) 
-				if (plans_[pos_][k].first == counterparts_[pos_][cur_order].first) 
-					prev_order = k + 1;
-			int c = counterparts_[pos_][cur_order].second;
-			int v = sampled_tuples_[prev_order][c];
-			inv_prob_ *= sampleTuple(cur_node, v, plans_[pos_][cur_order].second); 
-            lookup++;
-			if (inv_prob_ == 0) {
-				valid_ = false;
-				break;
+//runs n walks of the chosen plan step by step over the whole batch, so the
+//adjacency lookups of different walks overlap instead of chaining;
+//fills batch_est_ with 1/P(si) or 0 per walk, as EstCard would report
+bool WanderJoin::walkBatch(int n) {
+	auto& prog = programs_[pos_];
+	const WalkStep& s0 = prog[0];
+	if (!checkLabelStatistics(s0))
+		return false;
+
+	batch_pos_ = 0;
+	batch_est_.resize(n);
+#ifdef GCARE_GPU
+	//the device draws start tuples uniformly over the label
+	if (gpu_ != nullptr && !prefixes_on_ && prog.size() <= GPU_MAX_STEPS && !anchored(s0) &&
+			reuse_[pos_].first < 0) {
+		gpu_plan_.clear();
+		for (const WalkStep& s : prog)
+			gpu_plan_.push_back({s.edge, s.label, s.dir, s.parent, s.col, {s.bound[0], s.bound[1]}});
+		auto& checks = join_checks_[pos_];
+		if (gpu_->Walk(gpu_plan_.data(), gpu_plan_.size(), checks.empty() ? nullptr : checks[0].data(),
+				checks.size(), n, rng_.Next(), batch_est_.data()))
+			return true;
+		//the device failed: the host walks from now on
+		gpu_ = nullptr;
+	}
+#endif
+	int lanes = pool_on_ ? 1 : std::min(num_threads_, std::max(1, n / MIN_LANE_WALKS));
+	if (prefixes_on_)
+		for (int i = 0; i < lanes; i++)
+			lanes_[i].prefix_sum.assign(prog.size(), 0.0);
+	if (lanes == 1) {
+		walkLane(lanes_[0], rng_, batch_est_.data(), n);
+	} else {
+		for (int i = 0; i < lanes; i++)
+			lanes_[i].rng.Seed(rng_.Next());
+#pragma omp parallel for schedule(static, 1) num_threads(lanes)
+		for (int i = 0; i < lanes; i++) {
+			int from = (long)n * i / lanes, to = (long)n * (i + 1) / lanes;
+			walkLane(lanes_[i], lanes_[i].rng, batch_est_.data() + from, to - from);
+		}
+	}
+	if (prefixes_on_) {
+		prefix_sum_.resize(prog.size(), 0.0);
+		for (int i = 0; i < lanes; i++)
+			for (size_t k = 0; k < prog.size(); k++)
+				prefix_sum_[k] += lanes_[i].prefix_sum[k];
+		prefix_walks_ += n;
+	}
+	return true;
+}
+
+//the join checks of the chosen plan within its first k + 1 steps that the
+//first k do not cover yet, applied to the walks alive in lane after step k
+//(they fail the whole walk anyway), and the prefix's 1/P summed up
+void WanderJoin::recordPrefix(Lane& lane, double* est, int k, int n) {
+	const int* tuples = lane.tuples.data();
+	int alive = 0;
+	for (int w : lane.alive) {
+		bool ok = true;
+		for (auto& c : join_checks_[pos_])
+			if (std::max(c[0], c[2]) == k &&
+					tuples[(size_t)c[0] * n * 2 + 2 * w + c[1]] != tuples[(size_t)c[2] * n * 2 + 2 * w + c[3]])
+				ok = false;
+		if (!ok) {
+			est[w] = 0;
+			continue;
+		}
+		lane.prefix_sum[k] += est[w];
+		lane.alive[alive++] = w;
+	}
+	lane.alive.resize(alive);
+}
+
+//the sub-pattern of each prefix of the chosen plan whose nodes are its
+//edges and the vertex labels of just their vertices
+void WanderJoin::PrefixEstimates(unordered_map<uint64_t, double>& est) {
+	if (prefix_walks_ == 0)
+		return;
+	auto& prog = programs_[pos_];
+	int nv = q->GetNumVertices();
+	vector<char> touched(nv, 0), labelled(nv, 0);
+	uint64_t mask = 0;
+	int labels = 0; //label nodes in the prefix
+	for (size_t k = 0; k < prog.size(); k++) {
+		const WalkStep& s = prog[k];
+		if (s.edge) {
+			mask |= uint64_t(1) << (s.node - offset_);
+			touched[s.vertex[0]] = touched[s.vertex[1]] = 1;
+		} else {
+			labelled[s.vertex[0]] = 1;
+			labels++;
+		}
+		bool whole = mask != 0;
+		int covered = 0;
+		for (int u = 0; u < nv && whole; u++) {
+			if (q->GetVLabel(u) != -1 && touched[u] && !labelled[u])
+				whole = false;
+			covered += touched[u] && labelled[u];
+		}
+		if (whole && covered == labels)
+			est[mask] = prefix_sum_[k] / prefix_walks_;
+	}
+}
+
+//n walks of the chosen plan in lock-step on lane, drawing from rng; est
+//gets their 1/P(si) or 0
+void WanderJoin::walkLane(Lane& lane, Rng& rng, double* est, int n) {
+	auto& prog = programs_[pos_];
+	const WalkStep& s0 = prog[0];
+	lane.tuples.resize(prog.size() * n * 2);
+	lane.pick.resize(n);
+	lane.drawn.resize(n);
+	lane.alive.clear();
+
+	int* tuples = lane.tuples.data();
+	//the first steps of all walks from the reservoir, or their start tuples
+	int first = reuse_[pos_].second;
+	if (reuse_[pos_].first >= 0) {
+		int buf[2 * WalkReservoir::MAX_STEPS];
+		for (int w = 0; w < n; w++) {
+			est[w] = reservoir_.Draw(reuse_[pos_].first, rng, buf);
+			if (est[w] == 0)
+				continue;
+			for (int k = 0; k < first; k++) {
+				tuples[(size_t)k * n * 2 + 2 * w] = buf[2 * k];
+				tuples[(size_t)k * n * 2 + 2 * w + 1] = buf[2 * k + 1];
 			}
-			if (!checkBoundedVertices(cur_node, sampled_tuples_.back())) {
-				valid_ = false;
-				break;
+			lane.alive.push_back(w);
+		}
+	}
+	double start_inv_prob = s0.edge ? g->GetNumEdges(s0.label) : g->GetNumVertices(s0.label);
+	if (filter_on_)
+		start_inv_prob = start_tuples_[s0.node].size() / 2;
+	for (int w = 0; w < n && reuse_[pos_].first < 0; w++) {
+		int* t = tuples + 2 * w;
+		if (anchored(s0)) {
+			start_inv_prob = anchorStart(s0, rng, t);
+		} else if (filter_on_) {
+			auto& c = start_tuples_[s0.node];
+			if (c.empty()) {
+				est[w] = 0;
+				continue;
 			}
+			int i = rng.Uniform(c.size() / 2);
+			t[0] = c[2 * i];
+			t[1] = c[2 * i + 1];
+		} else if (s0.edge && strata_on_) {
+			start_inv_prob = strata_.Sample(*g, s0.label, rng, t);
+		} else {
+			drawStart(s0, rng, t);
 		}
-		if (!valid_ || !checkNonTreeEdges(plans_[pos_])) {
-			if (!plan_chosen_) {
-                est_[pos_].push_back(0);
-                num_idx_lookup_[pos_].push_back(lookup);
-				pos_ = (pos_ + 1) % plans_.size();
-            }
-            valid_ = false;
-            return true;
-        }
-        success_cnt_[pos_]++;
-        if (!plan_chosen_) {
-            est_[pos_].push_back(inv_prob_);
-            num_idx_lookup_[pos_].push_back(lookup);
-            if (success_cnt_[pos_] >= 100) {
-                int min_pos = -1;
-                double min_val = std::numeric_limits<double>::max();
-                for (int i = 0; i < plans_.size(); i++) {
-                    if (success_cnt_[i] >= 50) {
-                        double sum = 0;
-                        for (double e : est_[i])
-                            sum += e;
-                        double mean = sum / est_[i].size();
-                        double var = 0;
-                        for (double e : est_[i])
-                            var += (e - mean) * (e - mean);
-                        //variance of estimates 
-                        var = var / (est_[i].size() - 1); 
-
-                        sum = 0;
-                        for (double l : num_idx_lookup_[i])
-                            sum += l;
-                        //mean of index lookups
-                        mean = sum / num_idx_lookup_[i].size();
-                        if (var * mean < min_val) {
-                            min_pos = i;
-                            min_val = var * mean;
-                        }
-                    }
-                }
-                assert(min_pos != -1);
-                pos_ = min_pos;
-                plan_chosen_ = true;
-            }
-            else 
-                pos_ = (pos_ + 1) % plans_.size();
-        }
-		return true;
+		est[w] = start_inv_prob;
+		if (start_inv_prob != 0 && checkBoundedVertices(s0, t))
+			lane.alive.push_back(w);
+		else
+			est[w] = 0;
 	}
-	//used all sample_cnt_ before choosing an order
-	if (sample_cnt_ == 0)
-		return false;
+	if (prefixes_on_)
+		recordPrefix(lane, est, 0, n);
+
+	for (int k = first; k < prog.size() && !lane.alive.empty(); k++) {
+		const WalkStep& s = prog[k];
+		const int* prev = tuples + (size_t)s.parent * n * 2;
+		int* cur = tuples + (size_t)k * n * 2;
+		int alive = 0;
+		GCARE_COUNT_N(walk_steps, lane.alive.size());
+		if (s.edge) {
+			for (int w : lane.alive)
+				g->PrefetchAdj(prev[2 * w + s.col], s.label, s.dir);
+			//out of core: the reads of all the lists are under way before
+			//the first walk waits for its own
+			if (g->IsOutOfCore())
+				for (int w : lane.alive)
+					g->PrefetchAdjList(prev[2 * w + s.col], s.label, s.dir);
+			//draw a neighbour per walk and prefetch it; read them afterwards
+			for (int w : lane.alive) {
+				int size;
+				if (filter_on_) {
+					size = filter_.PickAdj(prev[2 * w + s.col], s.label, s.dir,
+							s.vertex[s.dir ? 1 : 0], rng, &lane.drawn[w]);
+					lane.pick[w] = &lane.drawn[w];
+				} else if (g->IsPackedAdj() || g->IsOutOfCore()) {
+					//decoded (read) lists don't outlive the call: draw by value
+					size = g->GetRandomAdj(prev[2 * w + s.col], s.label, s.dir, rng, &lane.drawn[w]);
+					lane.pick[w] = &lane.drawn[w];
+				} else {
+					range r = g->GetAdj(prev[2 * w + s.col], s.label, s.dir);
+					size = r.end - r.begin;
+					if (size > 0)
+						lane.pick[w] = r.begin + rng.Uniform(size);
+				}
+				if (size == 0) {
+					est[w] = 0;
+					continue;
+				}
+				est[w] *= size;
+				__builtin_prefetch(lane.pick[w]);
+				lane.alive[alive++] = w;
+			}
+			lane.alive.resize(alive);
+			alive = 0;
+			for (int w : lane.alive) {
+				int v = prev[2 * w + s.col];
+				int other = *lane.pick[w];
+				cur[2 * w] = s.dir ? v : other;
+				cur[2 * w + 1] = s.dir ? other : v;
+				if (checkBoundedVertices(s, cur + 2 * w))
+					lane.alive[alive++] = w;
+				else
+					est[w] = 0;
+			}
+		} else {
+			for (int w : lane.alive) {
+				int v = prev[2 * w + s.col];
+				cur[2 * w] = cur[2 * w + 1] = v;
+				if (g->HasVLabel(v, s.label) && checkBoundedVertices(s, cur + 2 * w))
+					lane.alive[alive++] = w;
+				else
+					est[w] = 0;
+			}
+		}
+		lane.alive.resize(alive);
+		if (prefixes_on_)
+			recordPrefix(lane, est, k, n);
+	}
+
+	for (int w : lane.alive)
+		if (!checkNonTreeEdges(pos_, tuples + 2 * w, 2 * n))
+			est[w] = 0;
 }
 
 //HT estimator,
@@ -390,7 +1066,27 @@ double WanderJoin::EstCard(int subquery_index) {
         return 0.0;
 }
 
+//counts the query exactly if the walks so far predict a small result;
+//false if they do not, or the count exceeds the limit or the deadline
+bool WanderJoin::pilotExact() {
+	double mean = 0;
+	for (double card : card_vec_) mean += card;
+	mean /= card_vec_.size();
+	if (mean > exact_below_)
+		return false;
+	ExactCounter counter(*g, *q);
+	counter.SetLimit(EXACT_LIMIT_FACTOR * exact_below_);
+	counter.SetStop([this]() { return DeadlinePassed(); });
+	double count;
+	if (!counter.Count(count))
+		return false;
+	exact_ = count;
+	return true;
+}
+
 double WanderJoin::AggCard() {
+    if (exact_ >= 0)
+        return exact_;
     double res = 0.0;
     if (card_vec_.size() == 0)
         return res;
@@ -398,6 +1094,15 @@ double WanderJoin::AggCard() {
     return res / card_vec_.size();
 }
 
+//a count of the exact counter is certain
+double WanderJoin::AggVariance() {
+    if (exact_ >= 0)
+        return 0.0;
+    return Estimator::AggVariance();
+}
+
 double WanderJoin::GetSelectivity() {
     return 1;
 }
+
+}  // namespace graph
@@ -0,0 +1,244 @@
+/**
+ * Copyright 2020 Alibaba Group Holding Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ANALYTICAL_ENGINE_HTAP_COMPACT_VERTEX_MAP_H_
+#define ANALYTICAL_ENGINE_HTAP_COMPACT_VERTEX_MAP_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace vineyard {
+namespace htap_impl {
+
+inline uint64_t compact_mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+inline uint64_t compact_hash(int64_t oid, uint64_t seed) {
+  return compact_mix(static_cast<uint64_t>(oid) ^ seed);
+}
+
+// string oids: anything with data() and size()
+template <typename STRING_T>
+uint64_t compact_hash(const STRING_T& oid, uint64_t seed) {
+  uint64_t h = seed ^ 0xcbf29ce484222325ULL;
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(oid.data());
+  for (size_t i = 0; i < oid.size(); ++i) {
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  }
+  return compact_mix(h ^ oid.size());
+}
+
+// n unsigned integers of a fixed number of bits each.
+class PackedArray {
+ public:
+  void Init(uint64_t n, int bits) {
+    bits_ = bits;
+    mask_ = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+    // a word of slack, so that Get can always read two words
+    words_.assign((n * bits + 63) / 64 + 1, 0);
+  }
+
+  uint64_t Get(uint64_t i) const {
+    uint64_t bit = i * bits_;
+    uint64_t word = bit >> 6;
+    int shift = bit & 63;
+    uint64_t value = words_[word] >> shift;
+    if (shift + bits_ > 64) {
+      value |= words_[word + 1] << (64 - shift);
+    }
+    return value & mask_;
+  }
+
+  void Set(uint64_t i, uint64_t value) {
+    uint64_t bit = i * bits_;
+    uint64_t word = bit >> 6;
+    int shift = bit & 63;
+    words_[word] = (words_[word] & ~(mask_ << shift)) | (value << shift);
+    if (shift + bits_ > 64) {
+      int high = 64 - shift;
+      words_[word + 1] =
+          (words_[word + 1] & ~(mask_ >> high)) | (value >> high);
+    }
+  }
+
+  size_t MemoryBytes() const { return words_.size() * sizeof(uint64_t); }
+
+ private:
+  int bits_ = 1;
+  uint64_t mask_ = 1;
+  std::vector<uint64_t> words_;
+};
+
+// An immutable map of the n distinct oids of a vertex label to their
+// indices [0, n), built once with a perfect hash in the manner of PTHash:
+// the oids are hashed into buckets, skewed so that 60% of them fall into
+// 30% of the buckets, and, the largest buckets first, each bucket gets the
+// first pilot value that sends all its oids to free slots of a table of
+// n / 0.98 slots. A lookup is then a pilot and a packed index read, about
+// 4 bytes per oid in all. Oids that aren't in the map land on an arbitrary
+// index, so the caller checks the oid at the index it is given.
+template <typename OID_T>
+class CompactVertexMap {
+ public:
+  // over key(0), ..., key(n - 1); false if no seed separated them, which
+  // takes oids that hash alike on every seed
+  template <typename KEY_T>
+  bool Build(uint64_t n, KEY_T key) {
+    n_ = n;
+    slots_ = std::max<uint64_t>(1, static_cast<uint64_t>(n / 0.98) + 1);
+    buckets_ = std::max<uint64_t>(2, n / 5 + 1);
+    dense_buckets_ = std::max<uint64_t>(1, buckets_ * 3 / 10);
+    int bits = 1;
+    while (bits < 64 && (1ULL << bits) <= n) {
+      ++bits;
+    }
+    std::vector<uint64_t> hashes(n);
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; ++attempt) {
+      seed_ = compact_mix(0x9e3779b97f4a7c15ULL * (attempt + 1));
+      for (uint64_t i = 0; i < n; ++i) {
+        hashes[i] = compact_hash(key(i), seed_);
+      }
+      if (Place(hashes, bits)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // the index of oid, if it is in the map; -1 or any other index if not
+  int64_t Find(const OID_T& oid) const {
+    if (n_ == 0) {
+      return -1;
+    }
+    uint64_t h = compact_hash(oid, seed_);
+    uint64_t index = indices_.Get(Slot(h, pilots_[Bucket(h)]));
+    return index < n_ ? static_cast<int64_t>(index) : -1;
+  }
+
+  size_t MemoryBytes() const {
+    return pilots_.size() * sizeof(uint32_t) + indices_.MemoryBytes();
+  }
+
+ private:
+  static const int MAX_ATTEMPTS = 8;
+  static const uint32_t MAX_PILOT = 1u << 24;
+
+  static uint64_t Range(uint64_t x, uint64_t n) {
+    return static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(x) * n) >> 64);
+  }
+
+  uint64_t Bucket(uint64_t h) const {
+    // the bucket is drawn from the low bits, the skew from the high ones
+    uint64_t low = (h << 32) | (h >> 32);
+    if (h < 0x9999999999999999ULL) {
+      return Range(low, dense_buckets_);
+    }
+    return dense_buckets_ + Range(low, buckets_ - dense_buckets_);
+  }
+
+  uint64_t Slot(uint64_t h, uint32_t pilot) const {
+    // mixed again, so that oids that share bits of h still part on most
+    // pilots
+    return Range(compact_mix(h ^ (seed_ + pilot)), slots_);
+  }
+
+  bool Place(const std::vector<uint64_t>& hashes, int bits) {
+    uint64_t n = hashes.size();
+    // the oids bucket by bucket
+    std::vector<uint64_t> starts(buckets_ + 1, 0);
+    for (uint64_t i = 0; i < n; ++i) {
+      ++starts[Bucket(hashes[i]) + 1];
+    }
+    for (uint64_t b = 0; b < buckets_; ++b) {
+      starts[b + 1] += starts[b];
+    }
+    std::vector<uint64_t> members(n);
+    {
+      std::vector<uint64_t> next(starts.begin(), starts.end() - 1);
+      for (uint64_t i = 0; i < n; ++i) {
+        members[next[Bucket(hashes[i])]++] = i;
+      }
+    }
+    std::vector<uint64_t> order(buckets_);
+    for (uint64_t b = 0; b < buckets_; ++b) {
+      order[b] = b;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+      return starts[a + 1] - starts[a] > starts[b + 1] - starts[b];
+    });
+
+    pilots_.assign(buckets_, 0);
+    indices_.Init(slots_, bits);
+    std::vector<bool> taken(slots_, false);
+    std::vector<uint64_t> slots;
+    for (uint64_t b : order) {
+      uint64_t begin = starts[b], end = starts[b + 1];
+      if (begin == end) {
+        break;
+      }
+      uint32_t pilot = 0;
+      for (;; ++pilot) {
+        if (pilot == MAX_PILOT) {
+          return false;
+        }
+        slots.clear();
+        bool free = true;
+        for (uint64_t k = begin; k < end && free; ++k) {
+          uint64_t slot = Slot(hashes[members[k]], pilot);
+          free = !taken[slot] &&
+                 std::find(slots.begin(), slots.end(), slot) == slots.end();
+          slots.push_back(slot);
+        }
+        if (free) {
+          break;
+        }
+      }
+      pilots_[b] = pilot;
+      for (uint64_t k = begin; k < end; ++k) {
+        taken[slots[k - begin]] = true;
+        indices_.Set(slots[k - begin], members[k]);
+      }
+    }
+    // the free slots hold n, which Find turns away
+    for (uint64_t slot = 0; slot < slots_; ++slot) {
+      if (!taken[slot]) {
+        indices_.Set(slot, n);
+      }
+    }
+    return true;
+  }
+
+  uint64_t n_ = 0;
+  uint64_t seed_ = 0;
+  uint64_t slots_ = 1;
+  uint64_t buckets_ = 2;
+  uint64_t dense_buckets_ = 1;
+  std::vector<uint32_t> pilots_;
+  PackedArray indices_;
+};
+
+}  // namespace htap_impl
+}  // namespace vineyard
+
+#endif  // ANALYTICAL_ENGINE_HTAP_COMPACT_VERTEX_MAP_H_
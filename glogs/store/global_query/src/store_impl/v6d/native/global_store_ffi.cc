@@ -15,27 +15,428 @@
  */
 #include "global_store_ffi.h"
 #include "htap_ds_impl.h"
+#include "htap_trace.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 using namespace vineyard;
 
+namespace {
+
+// The labels of an FFI call as edge labels of the fragments. The buffer is
+// per thread, so resetting an iterator per source vertex does not allocate.
+LabelId* transform_edge_labels(htap_impl::GraphHandleImpl* casted_graph,
+                               LabelId* labels, int labels_count) {
+  thread_local std::vector<LabelId> transformed_labels;
+  transformed_labels.resize(labels_count);
+  for (int i = 0; i < labels_count; ++i) {
+    transformed_labels[i] = labels[i] - casted_graph->vertex_label_num;
+  }
+  return transformed_labels.data();
+}
+
+void fill_out_edge_iterator(GraphHandle graph, PartitionId partition_id,
+                            VertexId src_id, LabelId* labels,
+                            int labels_count, int64_t limit,
+                            htap_impl::EdgeIteratorImpl* iter) {
+  htap_impl::GraphHandleImpl* casted_graph =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  LabelId* transformed_labels =
+      transform_edge_labels(casted_graph, labels, labels_count);
+  if (casted_graph->use_int64_oid) {
+    htap_impl::get_out_edges(
+      htap_impl::get_fragment(casted_graph, partition_id / casted_graph->channel_num),
+      &(casted_graph->eid_parser), src_id, transformed_labels,
+      labels_count, limit, iter);
+  } else {
+    htap_impl::get_out_edges(
+      htap_impl::get_string_fragment(casted_graph, partition_id / casted_graph->channel_num),
+      &(casted_graph->eid_parser), src_id, transformed_labels,
+      labels_count, limit, iter);
+  }
+}
+
+void fill_in_edge_iterator(GraphHandle graph, PartitionId partition_id,
+                           VertexId dst_id, LabelId* labels, int labels_count,
+                           int64_t limit, htap_impl::EdgeIteratorImpl* iter) {
+  htap_impl::GraphHandleImpl* casted_graph =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  PartitionId dst_partition_id = v6d_get_partition_id(graph, dst_id);
+  if (dst_partition_id != partition_id) {
+    htap_impl::empty_edge_iterator(iter);
+    return;
+  }
+  LabelId* transformed_labels =
+      transform_edge_labels(casted_graph, labels, labels_count);
+  if (casted_graph->use_int64_oid) {
+    htap_impl::get_in_edges(
+      htap_impl::get_fragment(casted_graph, partition_id / casted_graph->channel_num),
+      &(casted_graph->eid_parser), dst_id, transformed_labels,
+      labels_count, limit, iter);
+  } else {
+    htap_impl::get_in_edges(
+      htap_impl::get_string_fragment(casted_graph, partition_id / casted_graph->channel_num),
+      &(casted_graph->eid_parser), dst_id, transformed_labels,
+      labels_count, limit, iter);
+  }
+}
+
+// the view of rows [begin, end) of the property id (as in the schema) of
+// the vertices of label in partition partition_id
+int get_vertex_column(htap_impl::GraphHandleImpl* handle, int partition_id,
+                      LabelId label_id, PropertyId id, int64_t begin,
+                      int64_t end, PropertyColumn* out) {
+  if (partition_id < 0 || partition_id >= static_cast<int>(handle->fnum) ||
+      label_id < 0 || label_id >= handle->vertex_label_num) {
+    return -1;
+  }
+  PropertyId transformed_id =
+      handle->schema->VertexEntries()[label_id].reverse_mapping[id];
+  if (transformed_id == -1) {
+    return -1;
+  }
+  if (handle->use_int64_oid) {
+    return htap_impl::get_vertex_property_column(
+        htap_impl::get_fragment(handle, partition_id), label_id, transformed_id, begin,
+        end, out);
+  }
+  return htap_impl::get_vertex_property_column(
+      htap_impl::get_string_fragment(handle, partition_id), label_id, transformed_id,
+      begin, end, out);
+}
+
+// the view of rows [begin, end) of the property id (as in the schema) of
+// the edges of label in partition partition_id
+int get_edge_column(htap_impl::GraphHandleImpl* handle, int partition_id,
+                    LabelId label_id, PropertyId id, int64_t begin,
+                    int64_t end, PropertyColumn* out) {
+  if (partition_id < 0 || partition_id >= static_cast<int>(handle->fnum) ||
+      label_id < 0 || label_id >= handle->edge_label_num) {
+    return -1;
+  }
+  PropertyId transformed_id =
+      handle->schema->EdgeEntries()[label_id].reverse_mapping[id];
+  if (transformed_id == -1) {
+    return -1;
+  }
+  if (handle->use_int64_oid) {
+    return htap_impl::get_edge_property_column(
+        htap_impl::get_fragment(handle, partition_id), label_id, transformed_id,
+        begin, end, out);
+  }
+  return htap_impl::get_edge_property_column(
+      htap_impl::get_string_fragment(handle, partition_id), label_id,
+      transformed_id, begin, end, out);
+}
+
+int numeric_property_width(PropertyType type) {
+  switch (type) {
+  case BOOL:
+  case CHAR:
+    return 1;
+  case SHORT:
+    return 2;
+  case INT:
+  case FLOAT:
+    return 4;
+  case LONG:
+  case DOUBLE:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+inline bool bit_at(const uint8_t* bits, int64_t i) {
+  return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+// Resolves vertex or edge ids to rows of one property column for the
+// gathers, the column being looked up once per run of ids of the same
+// partition and label.
+template <typename ID_TYPE, bool EDGE>
+class ColumnCursor {
+ public:
+  ColumnCursor(htap_impl::GraphHandleImpl* handle, PropertyId id)
+      : handle_(handle), id_(id) {}
+
+  // the row of v in *column, or -1 if v has no value; *column is null if
+  // the label of v has no such property
+  int64_t Row(ID_TYPE v, const PropertyColumn** column) {
+    const vineyard::IdParser<ID_TYPE>& parser = Parser();
+    int partition_id = parser.GetFid(v);
+    LabelId label_id = parser.GetLabelId(v);
+    if (partition_id != partition_id_ || label_id != label_id_) {
+      partition_id_ = partition_id;
+      label_id_ = label_id;
+      found_ = (EDGE ? get_edge_column : get_vertex_column)(
+                   handle_, partition_id, label_id, id_, 0, INT64_MAX,
+                   &column_) == 0;
+    }
+    if (!found_) {
+      *column = nullptr;
+      return -1;
+    }
+    *column = &column_;
+    int64_t row = parser.GetOffset(v);
+    if (row < 0 || row >= column_.length ||
+        (column_.validity != nullptr &&
+         !bit_at(column_.validity, column_.bit_offset + row))) {
+      return -1;
+    }
+    return row;
+  }
+
+ private:
+  const vineyard::IdParser<ID_TYPE>& Parser() const;
+
+  htap_impl::GraphHandleImpl* handle_;
+  PropertyId id_;
+  int partition_id_ = -1;
+  LabelId label_id_ = -1;
+  bool found_ = false;
+  PropertyColumn column_;
+};
+
+template <>
+const vineyard::IdParser<htap_impl::VID_TYPE>&
+ColumnCursor<htap_impl::VID_TYPE, false>::Parser() const {
+  return handle_->vid_parser;
+}
+
+template <>
+const vineyard::IdParser<htap_impl::EID_TYPE>&
+ColumnCursor<htap_impl::EID_TYPE, true>::Parser() const {
+  return handle_->eid_parser;
+}
+
+using VertexColumnCursor = ColumnCursor<htap_impl::VID_TYPE, false>;
+using EdgeColumnCursor = ColumnCursor<htap_impl::EID_TYPE, true>;
+
+// writes the value at row of a numeric column of type, or zeros for -1
+void copy_numeric_value(const PropertyColumn* column, int64_t row,
+                        PropertyType type, int width, char* value) {
+  if (row < 0) {
+    memset(value, 0, width);
+  } else if (type == BOOL) {
+    *value = bit_at(static_cast<const uint8_t*>(column->values),
+                    column->bit_offset + row);
+  } else {
+    memcpy(value, static_cast<const char*>(column->values) + row * width,
+           width);
+  }
+}
+
+// the characters at row of a string column, or nullptr and 0 for -1
+void string_value(const PropertyColumn* column, int64_t row,
+                  const char** data, int64_t* len) {
+  if (row < 0) {
+    *data = nullptr;
+    *len = 0;
+    return;
+  }
+  int64_t first, last;
+  if (column->offset_width == 4) {
+    const int32_t* offsets = static_cast<const int32_t*>(column->offsets);
+    first = offsets[row];
+    last = offsets[row + 1];
+  } else {
+    const int64_t* offsets = static_cast<const int64_t*>(column->offsets);
+    first = offsets[row];
+    last = offsets[row + 1];
+  }
+  *data = static_cast<const char*>(column->values) + first;
+  *len = last - first;
+}
+
+// the positions of edges ordered by edge id, i.e. by fragment, label and
+// row, so that the gathers read each column once and in order
+const std::vector<int>& edge_id_order(const Edge* edges, int count) {
+  thread_local std::vector<int> order;
+  order.resize(count);
+  for (int i = 0; i < count; ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [edges](int a, int b) {
+    return static_cast<uint64_t>(edges[a].offset) <
+           static_cast<uint64_t>(edges[b].offset);
+  });
+  return order;
+}
+
+void write_resolved(const std::vector<htap_impl::VID_TYPE>& gids,
+                    const std::vector<char>& found, int count, Vertex* v_out,
+                    uint8_t* found_out) {
+  for (int i = 0; i < count; ++i) {
+    v_out[i] = found[i] ? static_cast<Vertex>(gids[i]) : -1;
+    if (found_out != nullptr) {
+      found_out[i] = found[i];
+    }
+  }
+}
+
+// get_gids, or a probe of the compact vertex maps per oid if there are
+template <typename VERTEX_MAP_T>
+int resolve_gids(
+    htap_impl::GraphHandleImpl* handle, VERTEX_MAP_T* vertex_map,
+    const htap_impl::CompactVertexMap<typename VERTEX_MAP_T::oid_t>* maps,
+    const LabelId* label_ids, const typename VERTEX_MAP_T::oid_t* oids,
+    int count, htap_impl::VID_TYPE* gids, char* found) {
+  if (maps == nullptr) {
+    return htap_impl::get_gids(vertex_map, handle->fnum, label_ids, oids,
+                               count, gids, found);
+  }
+  int num_found = 0;
+  for (int i = 0; i < count; ++i) {
+    found[i] = htap_impl::get_compact_gid(handle, vertex_map, maps,
+                                          label_ids[i], oids[i], &gids[i]);
+    num_found += found[i];
+  }
+  return num_found;
+}
+
+// the statistics of the fragment of partition_id, or nullptr if it isn't local
+const htap_impl::GraphStatistics* get_statistics(GraphHandle graph,
+                                                PartitionId partition_id) {
+  auto handle = (htap_impl::GraphHandleImpl*)graph;
+  if (partition_id < 0) {
+    return nullptr;
+  }
+  return htap_impl::get_statistics(handle, partition_id / handle->channel_num);
+}
+
+// How the pools below make and unmake an iterator of each type: the lists
+// and labels an iterator grew stay with it while it is pooled.
+void init_pooled(htap_impl::EdgeIteratorImpl* iter) {
+  htap_impl::init_edge_iterator(iter);
+}
+void finish_pooled(htap_impl::EdgeIteratorImpl* iter) {
+  htap_impl::free_edge_iterator(iter);
+}
+void init_pooled(htap_impl::GetAllEdgesIteratorImpl* iter) {
+  htap_impl::init_get_all_edges_iterator(iter);
+}
+void finish_pooled(htap_impl::GetAllEdgesIteratorImpl* iter) {
+  htap_impl::free_get_all_edges_iterator(iter);
+}
+void init_pooled(htap_impl::PropertiesIteratorImpl* iter) {}
+void finish_pooled(htap_impl::PropertiesIteratorImpl* iter) {
+  htap_impl::free_properties_iterator(iter);
+}
+
+// Per-thread free lists of the iterators the FFI calls hand out, so that
+// the engine threads sharing a handle neither malloc per call nor contend
+// on the allocator: a freed iterator goes to the list of the thread freeing
+// it, keeping its buffers, and the next call on that thread takes it back.
+// At most kPooledIterators are kept per type and thread, and a thread's
+// are released when it exits.
+template <typename T>
+class IteratorPool {
+ public:
+  static constexpr size_t kPooledIterators = 64;
+
+  static T* Acquire() {
+    std::vector<T*>& list = List().items;
+    if (!list.empty()) {
+      T* iter = list.back();
+      list.pop_back();
+      return iter;
+    }
+    T* iter = static_cast<T*>(malloc(sizeof(T)));
+    if (iter != nullptr) {
+      init_pooled(iter);
+    }
+    return iter;
+  }
+
+  static void Release(T* iter) {
+    std::vector<T*>& list = List().items;
+    if (list.size() < kPooledIterators) {
+      list.push_back(iter);
+      return;
+    }
+    finish_pooled(iter);
+    free(iter);
+  }
+
+ private:
+  struct FreeList {
+    std::vector<T*> items;
+    ~FreeList() {
+      for (T* iter : items) {
+        finish_pooled(iter);
+        free(iter);
+      }
+    }
+  };
+  static FreeList& List() {
+    thread_local FreeList list;
+    return list;
+  }
+};
+
+using EdgeIteratorPool = IteratorPool<htap_impl::EdgeIteratorImpl>;
+using AllEdgesIteratorPool = IteratorPool<htap_impl::GetAllEdgesIteratorImpl>;
+using PropertiesIteratorPool = IteratorPool<htap_impl::PropertiesIteratorImpl>;
+
+// The open handles, shared by the callers asking for the same graph and
+// channel number, and how many times each was given out.
+struct SharedHandle {
+  GraphHandle handle;
+  int refs;
+};
+std::mutex handles_lock;
+std::map<std::pair<ObjectId, PartitionId>, SharedHandle> handles;
+
+bool is_local_fragment(const htap_impl::GraphHandleImpl* handle,
+                       htap_impl::FRAG_ID_TYPE fid) {
+  return std::find(handle->local_fragments,
+                   handle->local_fragments + handle->local_fnum,
+                   fid) != handle->local_fragments + handle->local_fnum;
+}
+
+}  // namespace
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 GraphHandle v6d_get_graph_handle(ObjectId object_id, PartitionId channel_num) {
+  std::lock_guard<std::mutex> guard(handles_lock);
+  auto it = handles.find(std::make_pair(object_id, channel_num));
+  if (it != handles.end()) {
+    ++it->second.refs;
+    return it->second.handle;
+  }
   // FIXME: handle exception here
   GraphHandle handle = malloc(sizeof(htap_impl::GraphHandleImpl));
   if (handle) {
     std::memset(handle, 0, sizeof(htap_impl::GraphHandleImpl));
     htap_impl::get_graph_handle(object_id, channel_num, (htap_impl::GraphHandleImpl*)handle);
+    handles[std::make_pair(object_id, channel_num)] = SharedHandle{handle, 1};
   }
   return handle;
 }
 
 void v6d_free_graph_handle(GraphHandle handle) {
-  htap_impl::free_graph_handle((htap_impl::GraphHandleImpl*)handle);
+  auto impl = (htap_impl::GraphHandleImpl*)handle;
+  std::lock_guard<std::mutex> guard(handles_lock);
+  auto it = handles.find(std::make_pair(impl->object_id, impl->channel_num));
+  if (it != handles.end() && it->second.handle == handle) {
+    if (--it->second.refs > 0) {
+      return;
+    }
+    handles.erase(it);
+  }
+  htap_impl::free_graph_handle(impl);
   free(handle);
 }
 
@@ -47,11 +448,11 @@ GetVertexIterator v6d_get_vertices(GraphHandle graph, PartitionId partition_id,
 
   if (casted_graph->use_int64_oid) {
     htap_impl::get_vertices(
-      &(casted_graph->fragments[partition_id / casted_graph->channel_num]),
+      htap_impl::get_fragment(casted_graph, partition_id / casted_graph->channel_num),
       labels, ids, count, (htap_impl::GetVertexIteratorImpl*)ret);
   } else {
     htap_impl::get_vertices(
-      &(casted_graph->string_fragments[partition_id / casted_graph->channel_num]),
+      htap_impl::get_string_fragment(casted_graph, partition_id / casted_graph->channel_num),
       labels, ids, count, (htap_impl::GetVertexIteratorImpl*)ret);
   }
   return ret;
@@ -71,13 +472,7 @@ GetAllVerticesIterator v6d_get_all_vertices(GraphHandle graph,
                                         PartitionId partition_id,
                                         LabelId* labels, int labels_count,
                                         int64_t limit) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__ << ": partition_id = " << partition_id
-            << ", labels_count = " << labels_count;
-  for (int i = 0; i < labels_count; ++i) {
-    LOG(INFO) << "label[" << i << "] = " << labels[i];
-  }
-#endif
+  HTAP_TRACE_SCOPE(TRACE_VERTEX, labels_count);
   GetAllVerticesIterator ret =
       malloc(sizeof(htap_impl::GetAllVerticesIteratorImpl));
   htap_impl::GraphHandleImpl* casted_graph =
@@ -87,12 +482,12 @@ GetAllVerticesIterator v6d_get_all_vertices(GraphHandle graph,
 
   if (casted_graph->use_int64_oid) {
     htap_impl::get_all_vertices(
-      &(casted_graph->fragments[fid]), partition_id % casted_graph->channel_num,
+      htap_impl::get_fragment(casted_graph, fid), partition_id % casted_graph->channel_num,
       casted_graph->vertex_chunk_sizes[fid], labels, labels_count, limit,
       (htap_impl::GetAllVerticesIteratorImpl*)ret);
   } else {
     htap_impl::get_all_vertices(
-      &(casted_graph->string_fragments[fid]), partition_id % casted_graph->channel_num,
+      htap_impl::get_string_fragment(casted_graph, fid), partition_id % casted_graph->channel_num,
       casted_graph->vertex_chunk_sizes[fid], labels, labels_count, limit,
       (htap_impl::GetAllVerticesIteratorImpl*)ret);
   }
@@ -110,6 +505,38 @@ int v6d_get_all_vertices_next(GetAllVerticesIterator iter, Vertex* v_out) {
       (htap_impl::GetAllVerticesIteratorImpl*)iter, v_out);
 }
 
+GetAllVerticesIterator v6d_get_all_vertices_where(GraphHandle graph,
+                                                  PartitionId partition_id,
+                                                  LabelId* labels,
+                                                  int labels_count,
+                                                  int64_t limit,
+                                                  const char* predicate,
+                                                  int64_t predicate_len) {
+  HTAP_TRACE_SCOPE(TRACE_VERTEX, labels_count);
+  auto handle = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  std::unique_ptr<htap_impl::VertexFilterImpl> filter(
+      new htap_impl::VertexFilterImpl());
+  if (predicate == nullptr ||
+      !filter->predicate.Parse(predicate, predicate_len)) {
+    return nullptr;
+  }
+  filter->handle = handle;
+  filter->fid = partition_id / handle->channel_num;
+  filter->remaining = limit < 0 ? INT64_MAX : limit;
+  // the limit counts qualifying vertices, so every vertex is scanned
+  GetAllVerticesIterator ret = v6d_get_all_vertices(
+      graph, partition_id, labels, labels_count, limit == 0 ? 0 : INT64_MAX);
+  static_cast<htap_impl::GetAllVerticesIteratorImpl*>(ret)->filter =
+      filter.release();
+  return ret;
+}
+
+int v6d_get_all_vertices_next_batch(GetAllVerticesIterator iter, Vertex* v_out,
+                                    int capacity) {
+  return htap_impl::get_all_vertices_next_batch(
+      (htap_impl::GetAllVerticesIteratorImpl*)iter, v_out, capacity);
+}
+
 VertexId v6d_get_vertex_id(GraphHandle graph, Vertex v) { return (VertexId)v; }
 
 OuterId v6d_get_outer_id(GraphHandle graph, Vertex v) {
@@ -122,10 +549,34 @@ OuterId v6d_get_outer_id(GraphHandle graph, Vertex v) {
       LOG(INFO) << "Unable to find the gid for vertex " << v;
       return -1; // NOT FOUND
     }
+  }
+  return htap_impl::get_dense_outer_id(casted_graph, (htap_impl::VID_TYPE)v);
+}
+
+int v6d_get_outer_id_string(GraphHandle graph, Vertex v, char* buf,
+                            int capacity) {
+  auto casted_graph = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  std::string oid;
+  if (casted_graph->use_int64_oid) {
+    htap_impl::OID_TYPE int_oid;
+    if (!casted_graph->vertex_map->GetOid((htap_impl::VID_TYPE)v, int_oid)) {
+      return -1;
+    }
+    oid = std::to_string(int_oid);
   } else {
-    LOG(FATAL) << "get_outer_id is not supported on string fragment";
+    htap_impl::STRING_VERTEX_MAP_TYPE::oid_t string_oid;
+    if (!casted_graph->string_vertex_map->GetOid((htap_impl::VID_TYPE)v,
+                                                 string_oid)) {
+      return -1;
+    }
+    oid.assign(string_oid.data(), string_oid.size());
   }
-  return OuterId();
+  if (buf != nullptr && capacity > 0) {
+    size_t n = std::min(oid.size(), static_cast<size_t>(capacity - 1));
+    std::memcpy(buf, oid.data(), n);
+    buf[n] = '\0';
+  }
+  return static_cast<int>(oid.size());
 }
 
 int v6d_get_vertex_by_outer_id(GraphHandle graph, LabelId label_id,
@@ -136,16 +587,94 @@ int v6d_get_vertex_by_outer_id(GraphHandle graph, LabelId label_id,
   auto casted_graph = static_cast<htap_impl::GraphHandleImpl*>(graph);
   if (casted_graph->use_int64_oid) {
     htap_impl::VID_TYPE gid;
+    if (casted_graph->compact_vertex_maps != nullptr) {
+      if (!htap_impl::get_compact_gid(casted_graph, casted_graph->vertex_map,
+                                      casted_graph->compact_vertex_maps,
+                                      label_id, outer_id, &gid)) {
+        return -1;
+      }
+      *v = gid;
+      return 0;
+    }
+    if (casted_graph->gid_cache->Get(label_id, outer_id, gid)) {
+      *v = gid;
+      return 0;
+    }
     if (casted_graph->vertex_map->GetGid(label_id, outer_id, gid)) {
+      casted_graph->gid_cache->Put(label_id, outer_id, gid);
       *v = gid;
       return 0;
     }
   } else {
-    LOG(FATAL) << "get_vertex_by_outer_id is not supported on string fragment";
+    htap_impl::VID_TYPE gid;
+    if (htap_impl::get_dense_outer_id_gid(casted_graph, label_id, outer_id,
+                                          &gid)) {
+      *v = gid;
+      return 0;
+    }
   }
   return -1;
 }
 
+int v6d_get_vertices_by_outer_ids(GraphHandle graph, const LabelId* label_ids,
+                                  const OuterId* outer_ids, int count,
+                                  Vertex* v_out, uint8_t* found_out) {
+  HTAP_TRACE_SCOPE(TRACE_VERTEX, count);
+  auto casted_graph = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  if (!casted_graph->use_int64_oid) {
+    int num_found = 0;
+    for (int i = 0; i < count; ++i) {
+      htap_impl::VID_TYPE gid;
+      bool found = htap_impl::get_dense_outer_id_gid(
+          casted_graph, label_ids[i], outer_ids[i], &gid);
+      v_out[i] = found ? static_cast<Vertex>(gid) : -1;
+      if (found_out != nullptr) {
+        found_out[i] = found;
+      }
+      num_found += found;
+    }
+    return num_found;
+  }
+  thread_local std::vector<htap_impl::VID_TYPE> gids;
+  thread_local std::vector<char> found;
+  gids.resize(count);
+  found.resize(count);
+  int num_found = resolve_gids(casted_graph, casted_graph->vertex_map,
+                               casted_graph->compact_vertex_maps, label_ids,
+                               outer_ids, count, gids.data(), found.data());
+  write_resolved(gids, found, count, v_out, found_out);
+  return num_found;
+}
+
+int v6d_get_vertices_by_primary_keys(GraphHandle graph,
+                                     const LabelId* label_ids,
+                                     const char* const* keys, int count,
+                                     Vertex* v_out, uint8_t* found_out) {
+  auto casted_graph = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  thread_local std::vector<htap_impl::VID_TYPE> gids;
+  thread_local std::vector<char> found;
+  gids.resize(count);
+  found.resize(count);
+  int num_found;
+  if (casted_graph->use_int64_oid) {
+    std::vector<htap_impl::OID_TYPE> oids(count);
+    for (int i = 0; i < count; ++i) {
+      oids[i] = std::stoll(keys[i]);
+    }
+    num_found = resolve_gids(casted_graph, casted_graph->vertex_map,
+                             casted_graph->compact_vertex_maps, label_ids,
+                             oids.data(), count, gids.data(), found.data());
+  } else {
+    std::vector<htap_impl::STRING_VERTEX_MAP_TYPE::oid_t> oids(keys, keys + count);
+    num_found = resolve_gids(casted_graph, casted_graph->string_vertex_map,
+                             casted_graph->string_compact_vertex_maps,
+                             label_ids, oids.data(), count, gids.data(),
+                             found.data());
+  }
+  write_resolved(gids, found, count, v_out, found_out);
+  return num_found;
+}
+
 OuterId v6d_get_outer_id_by_vertex_id(GraphHandle graph, VertexId v) {
   return v6d_get_outer_id(graph, (Vertex)v);
 }
@@ -168,13 +697,13 @@ int v6d_get_vertex_property(GraphHandle graph, Vertex v, PropertyId id,
   int r = -1;
   if (handle->use_int64_oid) {
     r = htap_impl::get_vertex_property(
-      &(static_cast<htap_impl::GraphHandleImpl*>(graph)
-            ->fragments[partition_id]),
+      htap_impl::get_fragment(
+          static_cast<htap_impl::GraphHandleImpl*>(graph), partition_id),
       v, transformed_id, p_out);
   } else {
     r = htap_impl::get_vertex_property(
-      &(static_cast<htap_impl::GraphHandleImpl*>(graph)
-            ->string_fragments[partition_id]),
+      htap_impl::get_string_fragment(
+          static_cast<htap_impl::GraphHandleImpl*>(graph), partition_id),
       v, transformed_id, p_out);
   }
 
@@ -184,18 +713,127 @@ int v6d_get_vertex_property(GraphHandle graph, Vertex v, PropertyId id,
   return r;
 }
 
+int v6d_get_vertex_property_column(GraphHandle graph, Vertex begin,
+                                   int64_t count, PropertyId id,
+                                   struct PropertyColumn* out) {
+  htap_impl::GraphHandleImpl* handle =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  int partition_id = handle->vid_parser.GetFid((htap_impl::VID_TYPE)begin);
+  LabelId label_id = handle->vid_parser.GetLabelId((htap_impl::VID_TYPE)begin);
+  int64_t offset = handle->vid_parser.GetOffset((htap_impl::VID_TYPE)begin);
+  if (get_vertex_column(handle, partition_id, label_id, id, offset,
+                        offset + count, out) != 0 ||
+      out->length != count) {
+    return -1;
+  }
+  return 0;
+}
+
+int v6d_gather_vertex_property(GraphHandle graph, PropertyId id,
+                               const Vertex* ids, int count,
+                               enum PropertyType type, void* values_out,
+                               uint8_t* valid_out) {
+  HTAP_TRACE_SCOPE(TRACE_PROPERTY, count);
+  int width = numeric_property_width(type);
+  if (width == 0) {
+    return -1;
+  }
+  htap_impl::GraphHandleImpl* handle =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  char* values = static_cast<char*>(values_out);
+  VertexColumnCursor cursor(handle, id);
+  for (int i = 0; i < count; ++i) {
+    const PropertyColumn* column = nullptr;
+    int64_t row = cursor.Row(ids[i], &column);
+    if (column != nullptr && column->type != type) {
+      return -1;
+    }
+    copy_numeric_value(column, row, type, width,
+                       values + static_cast<int64_t>(i) * width);
+    bool valid = row >= 0;
+    if (valid_out != nullptr) {
+      valid_out[i] = valid;
+    }
+  }
+  return 0;
+}
+
+int v6d_gather_vertex_string_property(GraphHandle graph, PropertyId id,
+                                      const Vertex* ids, int count,
+                                      const char** data_out,
+                                      int64_t* len_out) {
+  htap_impl::GraphHandleImpl* handle =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  VertexColumnCursor cursor(handle, id);
+  for (int i = 0; i < count; ++i) {
+    const PropertyColumn* column = nullptr;
+    int64_t row = cursor.Row(ids[i], &column);
+    if (column != nullptr && column->type != STRING) {
+      return -1;
+    }
+    string_value(column, row, &data_out[i], &len_out[i]);
+  }
+  return 0;
+}
+
+int v6d_gather_edge_property(GraphHandle graph, PropertyId id,
+                             const struct Edge* edges, int count,
+                             enum PropertyType type, void* values_out,
+                             uint8_t* valid_out) {
+  HTAP_TRACE_SCOPE(TRACE_PROPERTY, count);
+  int width = numeric_property_width(type);
+  if (width == 0) {
+    return -1;
+  }
+  htap_impl::GraphHandleImpl* handle =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  char* values = static_cast<char*>(values_out);
+  EdgeColumnCursor cursor(handle, id);
+  for (int i : edge_id_order(edges, count)) {
+    const PropertyColumn* column = nullptr;
+    int64_t row = cursor.Row(edges[i].offset, &column);
+    if (column != nullptr && column->type != type) {
+      return -1;
+    }
+    copy_numeric_value(column, row, type, width,
+                       values + static_cast<int64_t>(i) * width);
+    if (valid_out != nullptr) {
+      valid_out[i] = row >= 0;
+    }
+  }
+  return 0;
+}
+
+int v6d_gather_edge_string_property(GraphHandle graph, PropertyId id,
+                                    const struct Edge* edges, int count,
+                                    const char** data_out, int64_t* len_out) {
+  HTAP_TRACE_SCOPE(TRACE_PROPERTY, count);
+  htap_impl::GraphHandleImpl* handle =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  EdgeColumnCursor cursor(handle, id);
+  for (int i : edge_id_order(edges, count)) {
+    const PropertyColumn* column = nullptr;
+    int64_t row = cursor.Row(edges[i].offset, &column);
+    if (column != nullptr && column->type != STRING) {
+      return -1;
+    }
+    string_value(column, row, &data_out[i], &len_out[i]);
+  }
+  return 0;
+}
+
 PropertiesIterator v6d_get_vertex_properties(GraphHandle graph, Vertex v) {
-  PropertiesIterator ret = malloc(sizeof(htap_impl::PropertiesIteratorImpl));
+  htap_impl::PropertiesIteratorImpl* ret = PropertiesIteratorPool::Acquire();
   htap_impl::GraphHandleImpl* handle =
       static_cast<htap_impl::GraphHandleImpl*>(graph);
-  ((htap_impl::PropertiesIteratorImpl*)ret)->handle = handle;
+  ret->handle = handle;
   int partition_id = handle->vid_parser.GetFid((htap_impl::VID_TYPE)v);
   if (handle->use_int64_oid) {
-    htap_impl::get_vertex_properties(&(handle->fragments[partition_id]), v,
-                                   (htap_impl::PropertiesIteratorImpl*)ret);
+    htap_impl::get_vertex_properties(htap_impl::get_fragment(handle, partition_id), v,
+                                   ret);
   } else {
-    htap_impl::get_vertex_properties(&(handle->string_fragments[partition_id]), v,
-                                   (htap_impl::PropertiesIteratorImpl*)ret);
+    htap_impl::get_vertex_properties(htap_impl::get_string_fragment(handle, partition_id), v,
+                                   ret);
   }
   return ret;
 }
@@ -203,162 +841,249 @@ PropertiesIterator v6d_get_vertex_properties(GraphHandle graph, Vertex v) {
 OutEdgeIterator v6d_get_out_edges(GraphHandle graph, PartitionId partition_id,
                               VertexId src_id, LabelId* labels,
                               int labels_count, int64_t limit) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-  LOG(INFO) << "label count " << labels_count;
-  for (int i = 0; i < labels_count; i++) {
-    LOG(INFO) << "label index " << i << " label value " << labels[i];
+  HTAP_TRACE_SCOPE(TRACE_EDGE, labels_count);
+  htap_impl::EdgeIteratorImpl* ret = EdgeIteratorPool::Acquire();
+  fill_out_edge_iterator(graph, partition_id, src_id, labels, labels_count,
+                         limit, ret);
+  return ret;
+}
+
+void v6d_reset_out_edge_iterator(OutEdgeIterator iter, GraphHandle graph,
+                                 PartitionId partition_id, VertexId src_id,
+                                 LabelId* labels, int labels_count,
+                                 int64_t limit) {
+  fill_out_edge_iterator(graph, partition_id, src_id, labels, labels_count,
+                         limit, (htap_impl::EdgeIteratorImpl*)iter);
+}
+
+void v6d_free_out_edge_iterator(OutEdgeIterator iter) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
+  EdgeIteratorPool::Release((htap_impl::EdgeIteratorImpl*)iter);
+}
+
+int v6d_out_edge_next(OutEdgeIterator iter, struct Edge* e_out) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
+  return htap_impl::out_edge_next((htap_impl::EdgeIteratorImpl*)iter, e_out);
+}
+
+int v6d_out_edge_next_batch(OutEdgeIterator iter, struct Edge* e_out,
+                            int capacity) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, capacity);
+  return htap_impl::out_edge_next_batch((htap_impl::EdgeIteratorImpl*)iter,
+                                        e_out, capacity);
+}
+
+int v6d_out_edge_next_columns(OutEdgeIterator iter, VertexId* srcs,
+                              VertexId* dsts, EdgeId* eids, int capacity) {
+  return htap_impl::out_edge_next_columns((htap_impl::EdgeIteratorImpl*)iter,
+                                          srcs, dsts, eids, capacity);
+}
+
+InEdgeIterator v6d_get_in_edges(GraphHandle graph, PartitionId partition_id,
+                            VertexId dst_id, LabelId* labels, int labels_count,
+                            int64_t limit) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, labels_count);
+  htap_impl::EdgeIteratorImpl* ret = EdgeIteratorPool::Acquire();
+  fill_in_edge_iterator(graph, partition_id, dst_id, labels, labels_count,
+                        limit, ret);
+  return ret;
+}
+
+void v6d_reset_in_edge_iterator(InEdgeIterator iter, GraphHandle graph,
+                                PartitionId partition_id, VertexId dst_id,
+                                LabelId* labels, int labels_count,
+                                int64_t limit) {
+  fill_in_edge_iterator(graph, partition_id, dst_id, labels, labels_count,
+                        limit, (htap_impl::EdgeIteratorImpl*)iter);
+}
+
+void v6d_free_in_edge_iterator(InEdgeIterator iter) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
+  EdgeIteratorPool::Release((htap_impl::EdgeIteratorImpl*)iter);
+}
+
+int v6d_in_edge_next(InEdgeIterator iter, struct Edge* e_out) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
+  return htap_impl::in_edge_next((htap_impl::EdgeIteratorImpl*)iter, e_out);
+}
+
+int v6d_in_edge_next_batch(InEdgeIterator iter, struct Edge* e_out,
+                           int capacity) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, capacity);
+  return htap_impl::in_edge_next_batch((htap_impl::EdgeIteratorImpl*)iter,
+                                       e_out, capacity);
+}
+
+int v6d_in_edge_next_columns(InEdgeIterator iter, VertexId* srcs,
+                             VertexId* dsts, EdgeId* eids, int capacity) {
+  return htap_impl::in_edge_next_columns((htap_impl::EdgeIteratorImpl*)iter,
+                                         srcs, dsts, eids, capacity);
+}
+
+EdgeBatch v6d_create_edge_batch() {
+  return new htap_impl::EdgeBatchImpl();
+}
+
+void v6d_free_edge_batch(EdgeBatch batch) {
+  delete static_cast<htap_impl::EdgeBatchImpl*>(batch);
+}
+
+void v6d_get_out_edges_batch(GraphHandle graph, PartitionId partition_id,
+                             const VertexId* src_ids, int src_count,
+                             LabelId* labels, int labels_count, int64_t limit,
+                             EdgeBatch batch) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
+  htap_impl::GraphHandleImpl* casted_graph =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  LabelId* transformed_labels =
+      transform_edge_labels(casted_graph, labels, labels_count);
+  htap_impl::EdgeBatchImpl* out = static_cast<htap_impl::EdgeBatchImpl*>(batch);
+  if (casted_graph->use_int64_oid) {
+    htap_impl::get_out_edges_batch(
+      htap_impl::get_fragment(casted_graph, partition_id / casted_graph->channel_num),
+      &(casted_graph->eid_parser), src_ids, src_count, nullptr,
+      transformed_labels, labels_count, limit, out);
+  } else {
+    htap_impl::get_out_edges_batch(
+      htap_impl::get_string_fragment(casted_graph, partition_id / casted_graph->channel_num),
+      &(casted_graph->eid_parser), src_ids, src_count, nullptr,
+      transformed_labels, labels_count, limit, out);
   }
-#endif
+}
 
+void v6d_get_in_edges_batch(GraphHandle graph, PartitionId partition_id,
+                            const VertexId* dst_ids, int dst_count,
+                            LabelId* labels, int labels_count, int64_t limit,
+                            EdgeBatch batch) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
   htap_impl::GraphHandleImpl* casted_graph =
       static_cast<htap_impl::GraphHandleImpl*>(graph);
-  OutEdgeIterator ret = malloc(sizeof(htap_impl::EdgeIteratorImpl));
-  std::vector<LabelId> transformed_labels(labels_count);
-  for (int i = 0; i < labels_count; ++i) {
-    transformed_labels[i] = labels[i] - casted_graph->vertex_label_num;
+  // as v6d_get_in_edges, only the vertices of the partition itself
+  thread_local std::vector<char> active;
+  active.resize(dst_count);
+  for (int i = 0; i < dst_count; ++i) {
+    active[i] = v6d_get_partition_id(graph, dst_ids[i]) == partition_id;
   }
+  LabelId* transformed_labels =
+      transform_edge_labels(casted_graph, labels, labels_count);
+  htap_impl::EdgeBatchImpl* out = static_cast<htap_impl::EdgeBatchImpl*>(batch);
   if (casted_graph->use_int64_oid) {
-    htap_impl::get_out_edges(
-      &(casted_graph->fragments[partition_id / casted_graph->channel_num]),
-      &(casted_graph->eid_parser), src_id, transformed_labels.data(),
-      labels_count, limit, (htap_impl::EdgeIteratorImpl*)ret);
+    htap_impl::get_in_edges_batch(
+      htap_impl::get_fragment(casted_graph, partition_id / casted_graph->channel_num),
+      &(casted_graph->eid_parser), dst_ids, dst_count, active.data(),
+      transformed_labels, labels_count, limit, out);
   } else {
-    htap_impl::get_out_edges(
-      &(casted_graph->string_fragments[partition_id / casted_graph->channel_num]),
-      &(casted_graph->eid_parser), src_id, transformed_labels.data(),
-      labels_count, limit, (htap_impl::EdgeIteratorImpl*)ret);
+    htap_impl::get_in_edges_batch(
+      htap_impl::get_string_fragment(casted_graph, partition_id / casted_graph->channel_num),
+      &(casted_graph->eid_parser), dst_ids, dst_count, active.data(),
+      transformed_labels, labels_count, limit, out);
   }
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
-  return ret;
 }
 
-void v6d_free_out_edge_iterator(OutEdgeIterator iter) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
-  htap_impl::free_edge_iterator((htap_impl::EdgeIteratorImpl*)iter);
-  free(iter);
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
+int64_t v6d_edge_batch_edge_count(EdgeBatch batch) {
+  return static_cast<htap_impl::EdgeBatchImpl*>(batch)->nbrs.size();
 }
 
-int v6d_out_edge_next(OutEdgeIterator iter, struct Edge* e_out) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
-  return htap_impl::out_edge_next((htap_impl::EdgeIteratorImpl*)iter, e_out);
+const int64_t* v6d_edge_batch_offsets(EdgeBatch batch) {
+  return static_cast<htap_impl::EdgeBatchImpl*>(batch)->offsets.data();
 }
 
-InEdgeIterator v6d_get_in_edges(GraphHandle graph, PartitionId partition_id,
-                            VertexId dst_id, LabelId* labels, int labels_count,
-                            int64_t limit) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
+const VertexId* v6d_edge_batch_nbrs(EdgeBatch batch) {
+  return static_cast<htap_impl::EdgeBatchImpl*>(batch)->nbrs.data();
+}
+
+const EdgeId* v6d_edge_batch_eids(EdgeBatch batch) {
+  return static_cast<htap_impl::EdgeBatchImpl*>(batch)->eids.data();
+}
+
+EdgeScan v6d_create_edge_scan(GraphHandle graph, PartitionId partition_id,
+                              LabelId* labels, int labels_count,
+                              int64_t morsel_size) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
   htap_impl::GraphHandleImpl* casted_graph =
       static_cast<htap_impl::GraphHandleImpl*>(graph);
-  InEdgeIterator ret = malloc(sizeof(htap_impl::EdgeIteratorImpl));
-  PartitionId dst_partition_id = v6d_get_partition_id(graph, dst_id);
-  if (dst_partition_id != partition_id) {
-    htap_impl::empty_edge_iterator((htap_impl::EdgeIteratorImpl*)ret);
+  htap_impl::EdgeScanImpl* scan = new htap_impl::EdgeScanImpl();
+  LabelId* transformed_labels =
+      transform_edge_labels(casted_graph, labels, labels_count);
+  PartitionId fid = partition_id / casted_graph->channel_num;
+  if (casted_graph->use_int64_oid) {
+    htap_impl::init_edge_scan(htap_impl::get_fragment(casted_graph, fid),
+                              &(casted_graph->eid_parser), transformed_labels,
+                              labels_count, morsel_size, scan);
   } else {
-    std::vector<LabelId> transformed_labels(labels_count);
-    for (int i = 0; i < labels_count; ++i) {
-      transformed_labels[i] = labels[i] - casted_graph->vertex_label_num;
-    }
-    if (casted_graph->use_int64_oid) {
-      htap_impl::get_in_edges(
-        &(casted_graph->fragments[partition_id / casted_graph->channel_num]),
-        &(casted_graph->eid_parser), dst_id, transformed_labels.data(),
-        labels_count, limit, (htap_impl::EdgeIteratorImpl*)ret);
-    } else {
-      htap_impl::get_in_edges(
-        &(casted_graph->string_fragments[partition_id / casted_graph->channel_num]),
-        &(casted_graph->eid_parser), dst_id, transformed_labels.data(),
-        labels_count, limit, (htap_impl::EdgeIteratorImpl*)ret);
-    }
+    htap_impl::init_edge_scan(htap_impl::get_string_fragment(casted_graph, fid),
+                              &(casted_graph->eid_parser), transformed_labels,
+                              labels_count, morsel_size, scan);
   }
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
-  return ret;
+  return scan;
 }
 
-void v6d_free_in_edge_iterator(InEdgeIterator iter) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
-  htap_impl::free_edge_iterator((htap_impl::EdgeIteratorImpl*)iter);
-  free(iter);
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
+void v6d_free_edge_scan(EdgeScan scan) {
+  delete static_cast<htap_impl::EdgeScanImpl*>(scan);
 }
 
-int v6d_in_edge_next(InEdgeIterator iter, struct Edge* e_out) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
-  return htap_impl::in_edge_next((htap_impl::EdgeIteratorImpl*)iter, e_out);
+int v6d_edge_scan_next(GraphHandle graph, EdgeScan scan, EdgeBatch batch,
+                       VertexId* first_src, LabelId* edge_label) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
+  htap_impl::GraphHandleImpl* casted_graph =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  if (!htap_impl::edge_scan_next(static_cast<htap_impl::EdgeScanImpl*>(scan),
+                                 static_cast<htap_impl::EdgeBatchImpl*>(batch),
+                                 first_src, edge_label)) {
+    return -1;
+  }
+  *edge_label += casted_graph->vertex_label_num;
+  return 0;
 }
 
 GetAllEdgesIterator v6d_get_all_edges(GraphHandle graph, PartitionId partition_id,
                                   LabelId* labels, int labels_count,
                                   int64_t limit) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter get all edges";
-#endif
+  HTAP_TRACE_SCOPE(TRACE_EDGE, labels_count);
   htap_impl::GraphHandleImpl* casted_graph =
       static_cast<htap_impl::GraphHandleImpl*>(graph);
-  GetAllEdgesIterator ret = malloc(sizeof(htap_impl::GetAllEdgesIteratorImpl));
-  std::vector<LabelId> transformed_labels(labels_count);
-  for (int i = 0; i < labels_count; ++i) {
-    transformed_labels[i] = labels[i] - casted_graph->vertex_label_num;
-  }
+  htap_impl::GetAllEdgesIteratorImpl* ret = AllEdgesIteratorPool::Acquire();
+  LabelId* transformed_labels =
+      transform_edge_labels(casted_graph, labels, labels_count);
   PartitionId fid = partition_id / casted_graph->channel_num;
   if (casted_graph->use_int64_oid) {
     htap_impl::get_all_edges(
-      &(casted_graph->fragments[fid]), partition_id % casted_graph->channel_num,
+      htap_impl::get_fragment(casted_graph, fid), partition_id % casted_graph->channel_num,
       casted_graph->vertex_chunk_sizes[fid], &(casted_graph->eid_parser),
-      transformed_labels.data(), labels_count, limit,
-      (htap_impl::GetAllEdgesIteratorImpl*)ret);
+      transformed_labels, labels_count, limit, ret);
   } else {
     htap_impl::get_all_edges(
-      &(casted_graph->string_fragments[fid]), partition_id % casted_graph->channel_num,
+      htap_impl::get_string_fragment(casted_graph, fid), partition_id % casted_graph->channel_num,
       casted_graph->vertex_chunk_sizes[fid], &(casted_graph->eid_parser),
-      transformed_labels.data(), labels_count, limit,
-      (htap_impl::GetAllEdgesIteratorImpl*)ret);
+      transformed_labels, labels_count, limit, ret);
   }
-#ifndef NDEBUG
-  LOG(INFO) << "finish get all edges";
-#endif
   return ret;
 }
 
 void v6d_free_get_all_edges_iterator(GetAllEdgesIterator iter) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
-  htap_impl::free_get_all_edges_iterator(
-      (htap_impl::GetAllEdgesIteratorImpl*)iter);
-  free(iter);
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
+  AllEdgesIteratorPool::Release((htap_impl::GetAllEdgesIteratorImpl*)iter);
 }
 
 int v6d_get_all_edges_next(GetAllEdgesIterator iter, struct Edge* e_out) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
   return htap_impl::get_all_edges_next(
       (htap_impl::GetAllEdgesIteratorImpl*)iter, e_out);
 }
 
+int v6d_get_all_edges_next_batch(GetAllEdgesIterator iter, struct Edge* e_out,
+                                 int capacity) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, capacity);
+  return htap_impl::get_all_edges_next_batch(
+      (htap_impl::GetAllEdgesIteratorImpl*)iter, e_out, capacity);
+}
+
+int v6d_get_all_edges_next_columns(GetAllEdgesIterator iter, VertexId* srcs,
+                                   VertexId* dsts, EdgeId* eids, int capacity) {
+  return htap_impl::get_all_edges_next_columns(
+      (htap_impl::GetAllEdgesIteratorImpl*)iter, srcs, dsts, eids, capacity);
+}
+
 VertexId v6d_get_edge_src_id(GraphHandle graph, struct Edge* e) { return e->src; }
 
 VertexId v6d_get_edge_dst_id(GraphHandle graph, struct Edge* e) { return e->dst; }
@@ -366,61 +1091,44 @@ VertexId v6d_get_edge_dst_id(GraphHandle graph, struct Edge* e) { return e->dst;
 static void v6d_parse_edge_id(GraphHandle graph, htap_impl::EID_TYPE eid,
                           htap_impl::FRAG_ID_TYPE* fid, LabelId* label,
                           int64_t* offset) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
   vineyard::IdParser<htap_impl::EID_TYPE>* parser =
       &(static_cast<htap_impl::GraphHandleImpl*>(graph)->eid_parser);
   *fid = parser->GetFid(eid);
   *label = parser->GetLabelId(eid);
   *offset = parser->GetOffset(eid);
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
 }
 
 EdgeId v6d_get_edge_id(GraphHandle graph, struct Edge* e) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
   htap_impl::FRAG_ID_TYPE partition_id;
   LabelId label;
   int64_t offset;
   v6d_parse_edge_id(graph, (htap_impl::EID_TYPE)e->offset, &partition_id, &label,
                 &offset);
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
   auto handle = static_cast<htap_impl::GraphHandleImpl*>(graph);
   if (handle->use_int64_oid) {
     return htap_impl::get_edge_id(
-      &(handle->fragments[partition_id]),
+      htap_impl::get_fragment(handle, partition_id),
       label, offset);
   } else {
     return htap_impl::get_edge_id(
-      &(handle->string_fragments[partition_id]),
+      htap_impl::get_string_fragment(handle, partition_id),
       label, offset);
   }
 }
 
 LabelId v6d_get_edge_src_label(GraphHandle graph, struct Edge* e) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
   return ((htap_impl::GraphHandleImpl*)graph)->vid_parser.GetLabelId(e->src);
 }
 
 LabelId v6d_get_edge_dst_label(GraphHandle graph, struct Edge* e) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
   return ((htap_impl::GraphHandleImpl*)graph)->vid_parser.GetLabelId(e->dst);
 }
 
 LabelId v6d_get_edge_label(GraphHandle graph, struct Edge* e) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_EDGE, 0);
   htap_impl::GraphHandleImpl* handle =
       static_cast<htap_impl::GraphHandleImpl*>(graph);
   return handle->eid_parser.GetLabelId(e->offset) + handle->vertex_label_num;
@@ -428,9 +1136,7 @@ LabelId v6d_get_edge_label(GraphHandle graph, struct Edge* e) {
 
 int v6d_get_edge_property(GraphHandle graph, struct Edge* e, PropertyId id,
                       Property* p_out) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_PROPERTY, 0);
   htap_impl::FRAG_ID_TYPE partition_id;
   LabelId label;
   int64_t offset;
@@ -443,15 +1149,12 @@ int v6d_get_edge_property(GraphHandle graph, struct Edge* e, PropertyId id,
   if (transformed_id == -1) {
     return -1;
   }
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
   int r = -1;
   if (handle->use_int64_oid) {
-    r = htap_impl::get_edge_property(&(handle->fragments[partition_id]),
+    r = htap_impl::get_edge_property(htap_impl::get_fragment(handle, partition_id),
                                        label, offset, transformed_id, p_out);
   } else {
-    r = htap_impl::get_edge_property(&(handle->string_fragments[partition_id]),
+    r = htap_impl::get_edge_property(htap_impl::get_string_fragment(handle, partition_id),
                                        label, offset, transformed_id, p_out);
   }
   if (r == 0) {
@@ -461,37 +1164,30 @@ int v6d_get_edge_property(GraphHandle graph, struct Edge* e, PropertyId id,
 }
 
 PropertiesIterator v6d_get_edge_properties(GraphHandle graph, struct Edge* e) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_PROPERTY, 0);
   htap_impl::FRAG_ID_TYPE partition_id;
   LabelId label;
   int64_t offset;
   v6d_parse_edge_id(graph, (htap_impl::EID_TYPE)e->offset, &partition_id, &label,
                 &offset);
-  PropertiesIterator ret = malloc(sizeof(htap_impl::PropertiesIteratorImpl));
+  htap_impl::PropertiesIteratorImpl* ret = PropertiesIteratorPool::Acquire();
   htap_impl::GraphHandleImpl* handle =
       static_cast<htap_impl::GraphHandleImpl*>(graph);
-  ((htap_impl::PropertiesIteratorImpl*)ret)->handle = handle;
+  ret->handle = handle;
   if (handle->use_int64_oid) {
-    htap_impl::get_edge_properties(&(handle->fragments[partition_id]), label,
+    htap_impl::get_edge_properties(htap_impl::get_fragment(handle, partition_id), label,
                                  offset,
-                                 (htap_impl::PropertiesIteratorImpl*)ret);
+                                 ret);
   } else {
-    htap_impl::get_edge_properties(&(handle->string_fragments[partition_id]), label,
+    htap_impl::get_edge_properties(htap_impl::get_string_fragment(handle, partition_id), label,
                                  offset,
-                                 (htap_impl::PropertiesIteratorImpl*)ret);
+                                 ret);
   }
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
   return ret;
 }
 
 int v6d_properties_next(PropertiesIterator iter, Property* p_out) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_PROPERTY, 0);
   int r = htap_impl::properties_next((htap_impl::PropertiesIteratorImpl*)iter,
                                      p_out);
   if (r == 0) {
@@ -510,14 +1206,8 @@ int v6d_properties_next(PropertiesIterator iter, Property* p_out) {
 }
 
 void v6d_free_properties_iterator(PropertiesIterator iter) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
-#endif
-  htap_impl::free_properties_iterator((htap_impl::PropertiesIteratorImpl*)iter);
-  free(iter);
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
+  HTAP_TRACE_SCOPE(TRACE_PROPERTY, 0);
+  PropertiesIteratorPool::Release((htap_impl::PropertiesIteratorImpl*)iter);
 }
 
 int v6d_get_property_as_bool(Property* property, bool* out) {
@@ -573,50 +1263,225 @@ int v6d_get_property_as_string_list(Property* property, const char*** out,
 
 void v6d_free_property(Property* property) {}
 
-Schema v6d_get_schema(GraphHandle graph) {
-#ifndef NDEBUG
-  LOG(INFO) << "rust ffi call: " << __FUNCTION__;
-#endif
-  return ((htap_impl::GraphHandleImpl*)graph)->schema;
+int v6d_get_label_counts(GraphHandle graph, PartitionId partition_id,
+                         int64_t* vertex_counts, int64_t* edge_counts) {
+  HTAP_TRACE_SCOPE(TRACE_GRAPH, 0);
+  auto stats = get_statistics(graph, partition_id);
+  if (stats == nullptr) {
+    return -1;
+  }
+  if (vertex_counts != nullptr) {
+    std::copy(stats->vertex_counts.begin(), stats->vertex_counts.end(),
+              vertex_counts);
+  }
+  if (edge_counts != nullptr) {
+    std::copy(stats->edge_counts.begin(), stats->edge_counts.end(),
+              edge_counts);
+  }
+  return 0;
 }
 
-// *out_num为string的个数
-// (*out_len)[i]为第i个string的长度
-// (*out)[i]为第i个string的其实地址
-
-PartitionId v6d_get_partition_id(GraphHandle graph, VertexId v) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter get_partition_id " << v;
-#endif
-  htap_impl::GraphHandleImpl* casted_graph =
-      static_cast<htap_impl::GraphHandleImpl*>(graph);
-
-  auto fid = casted_graph->vid_parser.GetFid((htap_impl::VID_TYPE)v);
-  LabelId label_id =
-      casted_graph->vid_parser.GetLabelId((htap_impl::VID_TYPE)v);
-  htap_impl::VID_TYPE offset =
-      casted_graph->vid_parser.GetOffset((htap_impl::VID_TYPE)v);
+int64_t v6d_get_triple_count(GraphHandle graph, PartitionId partition_id,
+                             LabelId src_label, LabelId edge_label,
+                             LabelId dst_label) {
+  HTAP_TRACE_SCOPE(TRACE_GRAPH, 0);
+  auto stats = get_statistics(graph, partition_id);
+  int vertex_label_num = ((htap_impl::GraphHandleImpl*)graph)->vertex_label_num;
+  edge_label -= vertex_label_num;
+  if (stats == nullptr || src_label < 0 || src_label >= vertex_label_num ||
+      dst_label < 0 || dst_label >= vertex_label_num || edge_label < 0 ||
+      edge_label >= stats->edge_label_num) {
+    return -1;
+  }
+  return stats->triple_counts[(static_cast<size_t>(src_label) *
+                                   stats->edge_label_num + edge_label) *
+                                  vertex_label_num + dst_label];
+}
 
-  if (fid >= casted_graph->fnum || fid < 0 ||
-      label_id >= casted_graph->vertex_label_num || label_id < 0) {
+int v6d_get_degree_histogram(GraphHandle graph, PartitionId partition_id,
+                             LabelId vertex_label, LabelId edge_label,
+                             bool out, int64_t* buckets, int bucket_num) {
+  HTAP_TRACE_SCOPE(TRACE_GRAPH, 0);
+  auto stats = get_statistics(graph, partition_id);
+  edge_label -= ((htap_impl::GraphHandleImpl*)graph)->vertex_label_num;
+  if (stats == nullptr || vertex_label < 0 ||
+      vertex_label >= stats->vertex_label_num || edge_label < 0 ||
+      edge_label >= stats->edge_label_num) {
     return -1;
   }
+  const std::vector<int64_t>& histograms =
+      out ? stats->out_degrees : stats->in_degrees;
+  auto begin = histograms.begin() +
+               (static_cast<size_t>(vertex_label) * stats->edge_label_num +
+                edge_label) * htap_impl::DEGREE_HISTOGRAM_BUCKETS;
+  int n = std::min(std::max(bucket_num, 0), htap_impl::DEGREE_HISTOGRAM_BUCKETS);
+  std::copy(begin, begin + n, buckets);
+  return n;
+}
 
-  if (casted_graph->use_int64_oid) {
-    if (offset >= casted_graph->vertex_map->GetInnerVertexSize(fid, label_id) ||
-        offset < 0) {
+int v6d_has_edge(GraphHandle graph, VertexId src_id, VertexId dst_id,
+                 LabelId label) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, src_id);
+  auto handle = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  LabelId e_label = label - handle->vertex_label_num;
+  if (e_label < 0 || e_label >= handle->edge_label_num) {
+    return 0;
+  }
+  // the fragment of src holds the edge as an out edge, that of dst as an in
+  // edge
+  for (VertexId v : {src_id, dst_id}) {
+    auto fid = handle->vid_parser.GetFid((htap_impl::VID_TYPE)v);
+    if (fid >= handle->fnum || !is_local_fragment(handle, fid)) {
+      continue;
+    }
+    return handle->use_int64_oid
+               ? htap_impl::has_edge(htap_impl::get_fragment(handle, fid),
+                                     (htap_impl::VID_TYPE)src_id,
+                                     (htap_impl::VID_TYPE)dst_id, e_label)
+               : htap_impl::has_edge(htap_impl::get_string_fragment(handle, fid),
+                                     (htap_impl::VID_TYPE)src_id,
+                                     (htap_impl::VID_TYPE)dst_id, e_label);
+  }
+  return -1;
+}
+
+int64_t v6d_intersect_neighbors(GraphHandle graph, VertexId v1, bool out1,
+                                VertexId v2, bool out2, LabelId* labels,
+                                int labels_count, VertexId* out_buffer,
+                                int64_t capacity) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, v1);
+  auto handle = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  if (labels == nullptr) {
+    labels_count = 0;
+  }
+  LabelId* e_labels = transform_edge_labels(handle, labels, labels_count);
+  thread_local std::vector<htap_impl::VID_TYPE> lists[2];
+  VertexId vs[2] = {v1, v2};
+  bool outs[2] = {out1, out2};
+  for (int k = 0; k < 2; ++k) {
+    lists[k].clear();
+    auto fid = handle->vid_parser.GetFid((htap_impl::VID_TYPE)vs[k]);
+    if (fid >= handle->fnum || !is_local_fragment(handle, fid)) {
       return -1;
     }
-  } else {
-    if (offset >= casted_graph->string_vertex_map->GetInnerVertexSize(fid, label_id) ||
-        offset < 0) {
+    bool found =
+        handle->use_int64_oid
+            ? htap_impl::get_neighbor_gids(
+                  htap_impl::get_fragment(handle, fid), (htap_impl::VID_TYPE)vs[k], outs[k],
+                  e_labels, labels_count, lists[k])
+            : htap_impl::get_neighbor_gids(
+                  htap_impl::get_string_fragment(handle, fid), (htap_impl::VID_TYPE)vs[k],
+                  outs[k], e_labels, labels_count, lists[k]);
+    if (!found) {
       return -1;
     }
   }
+  htap_impl::intersect_sorted(lists[0], lists[1]);
+  int64_t n = std::min<int64_t>(capacity, lists[0].size());
+  std::copy(lists[0].begin(), lists[0].begin() + n, out_buffer);
+  return lists[0].size();
+}
+
+int64_t v6d_sample_out_neighbor(GraphHandle graph, VertexId src_id,
+                                LabelId label, uint64_t* rng_state,
+                                struct Edge* e_out) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, src_id);
+  auto handle = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  auto fid = handle->vid_parser.GetFid((htap_impl::VID_TYPE)src_id);
+  LabelId e_label = label - handle->vertex_label_num;
+  if (fid >= handle->fnum || !is_local_fragment(handle, fid) || e_label < 0 ||
+      e_label >= handle->edge_label_num) {
+    return -1;
+  }
+  if (handle->use_int64_oid) {
+    return htap_impl::sample_out_neighbor(
+        htap_impl::get_fragment(handle, fid), &handle->eid_parser,
+        (htap_impl::VID_TYPE)src_id, e_label, rng_state, e_out);
+  } else {
+    return htap_impl::sample_out_neighbor(
+        htap_impl::get_string_fragment(handle, fid), &handle->eid_parser,
+        (htap_impl::VID_TYPE)src_id, e_label, rng_state, e_out);
+  }
+}
+
+void v6d_sample_out_neighbors(GraphHandle graph, const VertexId* src_ids,
+                              int count, LabelId label, uint64_t* rng_state,
+                              struct Edge* e_out, int64_t* degrees_out) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, count);
+  for (int i = 0; i < count; ++i) {
+    degrees_out[i] =
+        v6d_sample_out_neighbor(graph, src_ids[i], label, rng_state, &e_out[i]);
+  }
+}
+
+int64_t v6d_sample_edges(GraphHandle graph, LabelId label, int count,
+                         uint64_t* rng_state, struct Edge* e_out) {
+  HTAP_TRACE_SCOPE(TRACE_EDGE, count);
+  auto handle = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  LabelId e_label = label - handle->vertex_label_num;
+  if (e_label < 0 || e_label >= handle->edge_label_num) {
+    return 0;
+  }
+  // a sample is first placed in a fragment by the fragments' edge counts
+  std::vector<int64_t> cumulative(handle->local_fnum + 1, 0);
+  for (htap_impl::FRAG_ID_TYPE i = 0; i < handle->local_fnum; ++i) {
+    auto fid = handle->local_fragments[i];
+    cumulative[i + 1] =
+        cumulative[i] +
+        (handle->use_int64_oid
+             ? htap_impl::count_out_edges(htap_impl::get_fragment(handle, fid), e_label)
+             : htap_impl::count_out_edges(htap_impl::get_string_fragment(handle, fid),
+                                          e_label));
+  }
+  int64_t total = cumulative.back();
+  if (total == 0) {
+    return 0;
+  }
+  for (int k = 0; k < count; ++k) {
+    int64_t index = htap_impl::random_below(rng_state, total);
+    size_t i = std::upper_bound(cumulative.begin(), cumulative.end(), index) -
+               cumulative.begin() - 1;
+    auto fid = handle->local_fragments[i];
+    index -= cumulative[i];
+    if (handle->use_int64_oid) {
+      htap_impl::get_out_edge_at(htap_impl::get_fragment(handle, fid), &handle->eid_parser,
+                                 e_label, index, &e_out[k]);
+    } else {
+      htap_impl::get_out_edge_at(htap_impl::get_string_fragment(handle, fid),
+                                 &handle->eid_parser, e_label, index,
+                                 &e_out[k]);
+    }
+  }
+  return total;
+}
+
+void v6d_trace_enable(const char* subsystems) {
+  if (!htap_impl::set_trace_subsystems(subsystems == nullptr ? "" : subsystems)) {
+    LOG(ERROR) << "Unknown trace subsystem in '" << subsystems << "'";
+  }
+}
+
+void v6d_trace_set_sampling(int sample_every) {
+  htap_impl::set_trace_sampling(sample_every);
+}
+
+int v6d_trace_dump(const char* path) { return htap_impl::dump_trace(path); }
+
+Schema v6d_get_schema(GraphHandle graph) {
+  HTAP_TRACE_SCOPE(TRACE_GRAPH, 0);
+  return ((htap_impl::GraphHandleImpl*)graph)->schema;
+}
 
-  int channel_id = offset / casted_graph->vertex_chunk_sizes[fid][label_id];
+// *out_num为string的个数
+// (*out_len)[i]为第i个string的长度
+// (*out)[i]为第i个string的其实地址
 
-  int partition_id = fid * casted_graph->channel_num + channel_id;
+PartitionId v6d_get_partition_id(GraphHandle graph, VertexId v) {
+  HTAP_TRACE_SCOPE(TRACE_GRAPH, v);
+  htap_impl::GraphHandleImpl* casted_graph =
+      static_cast<htap_impl::GraphHandleImpl*>(graph);
+  PartitionId partition_id =
+      htap_impl::get_partition_id(casted_graph, (htap_impl::VID_TYPE)v);
 
 #ifndef NDEBUG
   LOG(INFO) << "get partition id: " << v << " -> " << partition_id;
@@ -624,6 +1489,52 @@ PartitionId v6d_get_partition_id(GraphHandle graph, VertexId v) {
   return partition_id;
 }
 
+PartitionId v6d_get_partition_num(GraphHandle graph) {
+  auto impl = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  return impl->fnum * impl->channel_num;
+}
+
+void v6d_get_partition_ids(GraphHandle graph, const VertexId* ids, size_t n,
+                           PartitionId* out) {
+  HTAP_TRACE_SCOPE(TRACE_GRAPH, n);
+  auto impl = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = htap_impl::get_partition_id(impl, (htap_impl::VID_TYPE)ids[i]);
+  }
+}
+
+size_t v6d_group_by_partition(GraphHandle graph, const VertexId* ids, size_t n,
+                              PartitionId* out, size_t* order, size_t* offsets) {
+  HTAP_TRACE_SCOPE(TRACE_GRAPH, n);
+  auto impl = static_cast<htap_impl::GraphHandleImpl*>(graph);
+  size_t partition_num = impl->fnum * impl->channel_num;
+  v6d_get_partition_ids(graph, ids, n, out);
+  // a counting sort: offsets[p + 1] counts partition p, then is prefix summed
+  std::fill(offsets, offsets + partition_num + 1, 0);
+  size_t missing = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (out[i] < 0) {
+      ++missing;
+    } else {
+      ++offsets[out[i] + 1];
+    }
+  }
+  for (size_t p = 0; p < partition_num; ++p) {
+    offsets[p + 1] += offsets[p];
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (out[i] >= 0) {
+      order[offsets[out[i]]++] = i;
+    }
+  }
+  // each offsets[p] now is where p + 1 starts
+  for (size_t p = partition_num; p > 0; --p) {
+    offsets[p] = offsets[p - 1];
+  }
+  offsets[0] = 0;
+  return missing;
+}
+
 // 如果 key 不存在，返回 -1
 // 否则返回0，结果存在 internal_id 和 partition_id 中
 int v6d_get_vertex_id_from_primary_key(GraphHandle graph, LabelId label_id,
@@ -641,12 +1552,32 @@ int v6d_get_vertex_id_from_primary_key(GraphHandle graph, LabelId label_id,
   bool get_gid_ret;
   htap_impl::VID_TYPE gid;
 
-  if (handle->use_int64_oid) {
+  if (handle->compact_vertex_maps != nullptr) {
+    get_gid_ret = htap_impl::get_compact_gid(
+        handle, handle->vertex_map, handle->compact_vertex_maps, label_id,
+        std::stoll(key), &gid);
+  } else if (handle->string_compact_vertex_maps != nullptr) {
+    get_gid_ret = htap_impl::get_compact_gid(
+        handle, handle->string_vertex_map, handle->string_compact_vertex_maps,
+        label_id, htap_impl::STRING_VERTEX_MAP_TYPE::oid_t(key), &gid);
+  } else if (handle->use_int64_oid) {
     htap_impl::OID_TYPE oid = std::stoll(key);
-    get_gid_ret = handle->vertex_map->GetGid(label_id, oid, gid);
+    get_gid_ret = handle->gid_cache->Get(label_id, oid, gid);
+    if (!get_gid_ret) {
+      get_gid_ret = handle->vertex_map->GetGid(label_id, oid, gid);
+      if (get_gid_ret) {
+        handle->gid_cache->Put(label_id, oid, gid);
+      }
+    }
   } else {
     htap_impl::STRING_OID_TYPE oid = key;
-    get_gid_ret = handle->string_vertex_map->GetGid(label_id, oid, gid);
+    get_gid_ret = handle->string_gid_cache->Get(label_id, oid, gid);
+    if (!get_gid_ret) {
+      get_gid_ret = handle->string_vertex_map->GetGid(label_id, oid, gid);
+      if (get_gid_ret) {
+        handle->string_gid_cache->Put(label_id, oid, gid);
+      }
+    }
   }
   if (get_gid_ret) {
     *internal_id = gid;
@@ -666,9 +1597,7 @@ int v6d_get_vertex_id_from_primary_key(GraphHandle graph, LabelId label_id,
 
 void v6d_get_process_partition_list(GraphHandle graph, PartitionId** partition_ids,
                                 int* partition_id_size) {
-#ifndef NDEBUG
-  LOG(INFO) << "enter get_process_partition_list";
-#endif
+  HTAP_TRACE_SCOPE(TRACE_GRAPH, 0);
   auto impl = (htap_impl::GraphHandleImpl*)graph;
   *partition_id_size = impl->local_fnum * impl->channel_num;
 #ifndef NDEBUG
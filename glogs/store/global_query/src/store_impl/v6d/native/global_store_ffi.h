@@ -36,6 +36,8 @@ typedef void* GetAllVerticesIterator;
 typedef void* GetAllEdgesIterator;
 typedef void* PropertiesIterator;
 typedef void* Schema;
+typedef void* EdgeBatch;
+typedef void* EdgeScan;
 
 typedef int64_t Vertex;
 struct Edge {
@@ -72,12 +74,47 @@ struct Property {
   int64_t len;
 };
 
+// 一段属性列的只读视图，直接指向底层Arrow列的内存，在graph释放前有效
+// values：数值类型为length个定长元素；BOOL为位图，第i个值在第(bit_offset + i)位；
+//         STRING为字符数据，第i个值是[offsets[i], offsets[i + 1])
+// offsets：仅STRING有效，length + 1个偏移，每个offset_width（4或8）字节
+// validity：null位图，与BOOL的values一样从bit_offset位开始，为空表示没有null
+struct PropertyColumn {
+  enum PropertyType type;
+  int64_t length;
+  const void* values;
+  const void* offsets;
+  int offset_width;
+  const uint8_t* validity;
+  int64_t bit_offset;
+};
+
+// 点属性谓词的比较操作，见v6d_get_all_vertices_where
+enum PredicateOp {
+  PRED_EQ = 0,
+  PRED_NE = 1,
+  PRED_LT = 2,
+  PRED_LE = 3,
+  PRED_GT = 4,
+  PRED_GE = 5,
+  PRED_IN = 6,
+};
+
 // ----------------- graph api -------------------- //
 
-// 获取图存储的句柄
+// 线程安全：同一个句柄可以被任意多个线程同时调用下面所有的读接口，分片和统计信息的
+// 延迟构造只发生一次；迭代器和EdgeBatch同一时刻只能由一个线程使用，但可以在另一个
+// 线程上释放。释放的边和属性迭代器放回释放线程的缓存池，连同已分配的缓冲区一起被该
+// 线程之后的调用复用，而不是每次调用都分配内存。v6d_free_graph_handle不能与同一句柄
+// 上的其它调用并发
+
+// 获取图存储的句柄。同一 (object_id, channel_num) 在进程内共享一个句柄（引用计数），
+// 分片在首次访问时才构造，统计信息在首次读取时才加载
+// 设置环境变量V6D_COMPACT_VERTEX_MAP=1时，加载时用完美哈希为每个点label建立紧凑的
+// oid到点的映射（每个oid约4字节），按外部id和主键查找点时代替vertex map，一次探查
 GraphHandle v6d_get_graph_handle(ObjectId object_id, PartitionId channel_num);
 
-// 释放图存储的句柄，清理内存空间等
+// 释放图存储的句柄：引用计数减一，最后一次释放时清理内存空间等
 void v6d_free_graph_handle(GraphHandle handle);
 
 // ----------------- vertex api -------------------- //
@@ -114,14 +151,51 @@ void v6d_free_get_all_vertices_iterator(GetAllVerticesIterator iter);
 // 从迭代器取出下一个元素，返回值是一个Vertex
 int v6d_get_all_vertices_next(GetAllVerticesIterator iter, Vertex* v_out);
 
+// 同v6d_get_all_vertices，但只返回属性满足predicate的点，limit限制的是满足的点数。
+// 谓词在存储内按Arrow列成块求值，不再逐点调用v6d_get_vertex_property。
+// predicate为predicate_len字节的序列化谓词（小端）：int32条件个数，然后是各条件，
+// 点须满足全部条件。每个条件为int32属性id、int32 op（PredicateOp）、
+// int32常量类型（PropertyType，BOOL到DOUBLE或STRING）、int32常量个数n，
+// 然后n个常量：数值类型各占该类型的宽度（BOOL占1字节），STRING为int32长度加字符数据。
+// 除PRED_IN外n为1。整数与浮点数按数值比较，STRING只与STRING列比较；
+// 值为null或label没有该属性的点不满足条件。predicate格式错误时返回nullptr。
+// 返回的迭代器同样用v6d_get_all_vertices_next或v6d_get_all_vertices_next_batch读取，
+// 用v6d_free_get_all_vertices_iterator释放
+GetAllVerticesIterator v6d_get_all_vertices_where(GraphHandle graph,
+                                                  PartitionId partition_id,
+                                                  LabelId* labels,
+                                                  int labels_count,
+                                                  int64_t limit,
+                                                  const char* predicate,
+                                                  int64_t predicate_len);
+
+// 从v6d_get_all_vertices或v6d_get_all_vertices_where的迭代器批量取出至多capacity个点
+// 写入v_out，返回写入的个数，0表示迭代结束
+int v6d_get_all_vertices_next_batch(GetAllVerticesIterator iter, Vertex* v_out,
+                                    int capacity);
+
 // 获取点id
 VertexId v6d_get_vertex_id(GraphHandle graph, Vertex v);
 
+// 获取点的外部id。string oid的图上返回加载时按label、分片编排的稠密int64 id，
+// 与v6d_get_vertex_by_outer_id等互逆，原始的字符串由v6d_get_outer_id_string取得
 OuterId v6d_get_outer_id(GraphHandle graph, Vertex v);
 
+// 将点的原始外部id（int64 oid的图上为其十进制表示）写入buf，至多capacity-1个字符并以'\0'结尾，
+// 返回其完整长度，找不到该点时返回-1
+int v6d_get_outer_id_string(GraphHandle graph, Vertex v, char* buf,
+                            int capacity);
+
 int v6d_get_vertex_by_outer_id(GraphHandle graph, LabelId label_id,
                            OuterId outer_id, Vertex* v);
 
+// 批量将外部id转换为点，label_ids[i]和outer_ids[i]对应，结果写入v_out，找不到的点写入-1，
+// found_out可为空，否则对找到的点写1、找不到的写0。不经过单个查询的缓存。
+// 返回找到的个数，string oid的图上外部id为v6d_get_outer_id给出的稠密id
+int v6d_get_vertices_by_outer_ids(GraphHandle graph, const LabelId* label_ids,
+                                  const OuterId* outer_ids, int count,
+                                  Vertex* v_out, uint8_t* found_out);
+
 OuterId v6d_get_outer_id_by_vertex_id(GraphHandle graph, VertexId v);
 
 // 获取点的label
@@ -134,6 +208,27 @@ int v6d_get_vertex_property(GraphHandle graph, Vertex v, PropertyId id,
 // 获取点的属性列表，返回一个迭代器
 PropertiesIterator v6d_get_vertex_properties(GraphHandle graph, Vertex v);
 
+// 获取从begin开始的count个点的某个属性列，不拷贝数据
+// 这些点需要属于同一个partition和label，即id连续，否则或该label没有此属性时返回-1
+int v6d_get_vertex_property_column(GraphHandle graph, Vertex begin,
+                                   int64_t count, PropertyId id,
+                                   struct PropertyColumn* out);
+
+// 按点id列表批量读取数值属性（BOOL到DOUBLE），写入values_out，
+// 每个值占type的宽度，BOOL占1字节。valid_out可为空，否则对没有该属性或值为null的点写0。
+// 某个点的属性类型不是type时返回-1
+int v6d_gather_vertex_property(GraphHandle graph, PropertyId id,
+                               const Vertex* ids, int count,
+                               enum PropertyType type, void* values_out,
+                               uint8_t* valid_out);
+
+// 按点id列表批量读取STRING属性，data_out和len_out指向列内的字符数据，不拷贝，
+// 没有该属性或值为null的点写入nullptr和0。某个点的属性类型不是STRING时返回-1
+int v6d_gather_vertex_string_property(GraphHandle graph, PropertyId id,
+                                      const Vertex* ids, int count,
+                                      const char** data_out,
+                                      int64_t* len_out);
+
 // ----------------- edge api -------------------- //
 
 // 查询某个partition内的点的出边
@@ -151,6 +246,22 @@ void v6d_free_out_edge_iterator(OutEdgeIterator iter);
 // 从迭代器取出下一个元素，返回值是一个Edge
 int v6d_out_edge_next(OutEdgeIterator iter, struct Edge* e_out);
 
+// 从迭代器批量取出至多capacity条边写入e_out，返回写入的条数，0表示迭代结束
+int v6d_out_edge_next_batch(OutEdgeIterator iter, struct Edge* e_out,
+                            int capacity);
+
+// 同v6d_out_edge_next_batch，但按列写入起点、终点和边id（即Edge::offset），
+// 每个数组的长度至少为capacity
+int v6d_out_edge_next_columns(OutEdgeIterator iter, VertexId* srcs,
+                              VertexId* dsts, EdgeId* eids, int capacity);
+
+// 复用迭代器查询另一个点的出边，参数同v6d_get_out_edges，
+// 避免每个点重新分配迭代器和邻接表数组
+void v6d_reset_out_edge_iterator(OutEdgeIterator iter, GraphHandle graph,
+                                 PartitionId partition_id, VertexId src_id,
+                                 LabelId* labels, int labels_count,
+                                 int64_t limit);
+
 // 查询某个partition内的点的入边
 // src_ids是待查询的点id列表
 // labels是label列表，表示查询这些点的这些label的出边
@@ -167,6 +278,61 @@ void v6d_free_in_edge_iterator(InEdgeIterator iter);
 // 从迭代器取出下一个元素，返回值是一个Edge
 int v6d_in_edge_next(InEdgeIterator iter, struct Edge* e_out);
 
+// 批量取出入边，语义同v6d_out_edge_next_batch
+int v6d_in_edge_next_batch(InEdgeIterator iter, struct Edge* e_out,
+                           int capacity);
+
+// 按列批量取出入边，语义同v6d_out_edge_next_columns
+int v6d_in_edge_next_columns(InEdgeIterator iter, VertexId* srcs,
+                             VertexId* dsts, EdgeId* eids, int capacity);
+
+// 复用迭代器查询另一个点的入边，参数同v6d_get_in_edges
+void v6d_reset_in_edge_iterator(InEdgeIterator iter, GraphHandle graph,
+                                PartitionId partition_id, VertexId dst_id,
+                                LabelId* labels, int labels_count,
+                                int64_t limit);
+
+// 创建批量查询边的结果，可在多次v6d_get_{out,in}_edges_batch之间复用
+EdgeBatch v6d_create_edge_batch();
+
+// 释放批量查询的结果
+void v6d_free_edge_batch(EdgeBatch batch);
+
+// 一次查询某个partition内src_count个点的出边，结果覆盖写入batch，格式为CSR：
+// 第i个点的出边的终点和边id是nbrs和eids的[offsets[i], offsets[i+1])，
+// 顺序与v6d_get_out_edges相同，limit对每个点分别生效
+void v6d_get_out_edges_batch(GraphHandle graph, PartitionId partition_id,
+                             const VertexId* src_ids, int src_count,
+                             LabelId* labels, int labels_count, int64_t limit,
+                             EdgeBatch batch);
+
+// 同v6d_get_out_edges_batch，查询dst_count个点的入边，nbrs是入边的起点
+void v6d_get_in_edges_batch(GraphHandle graph, PartitionId partition_id,
+                            const VertexId* dst_ids, int dst_count,
+                            LabelId* labels, int labels_count, int64_t limit,
+                            EdgeBatch batch);
+
+// 批量结果的总边数，以及长度为点数+1的offsets和长度为总边数的nbrs、eids，
+// 指针在batch下一次查询或释放之前有效
+int64_t v6d_edge_batch_edge_count(EdgeBatch batch);
+const int64_t* v6d_edge_batch_offsets(EdgeBatch batch);
+const VertexId* v6d_edge_batch_nbrs(EdgeBatch batch);
+const EdgeId* v6d_edge_batch_eids(EdgeBatch batch);
+
+// 创建对partition所在fragment全部内点出边的并行扫描，labels的含义同v6d_get_out_edges。
+// 扫描按(点label, 边label)划分为每块至多morsel_size个连续起点的morsel，由多个线程领取
+EdgeScan v6d_create_edge_scan(GraphHandle graph, PartitionId partition_id,
+                              LabelId* labels, int labels_count,
+                              int64_t morsel_size);
+
+// 释放扫描
+void v6d_free_edge_scan(EdgeScan scan);
+
+// 领取下一个morsel，将其出边以CSR格式写入batch（每个线程使用自己的batch），
+// 第i个起点是*first_src + i，边的label写入*edge_label。线程安全，返回0，没有未领取的morsel时返回-1
+int v6d_edge_scan_next(GraphHandle graph, EdgeScan scan, EdgeBatch batch,
+                       VertexId* first_src, LabelId* edge_label);
+
 // 查询某个partition内某些label的边数据
 // labels是待查询的label列表
 // labels_count表示label列表的长度
@@ -183,6 +349,28 @@ void v6d_free_get_all_edges_iterator(GetAllEdgesIterator iter);
 // 从迭代器取出下一个元素，返回值是一个Edge
 int v6d_get_all_edges_next(GetAllEdgesIterator iter, struct Edge* e_out);
 
+// 批量取出边，语义同v6d_out_edge_next_batch，写入的条数同样受limit限制
+int v6d_get_all_edges_next_batch(GetAllEdgesIterator iter, struct Edge* e_out,
+                                 int capacity);
+
+// 按列批量取出边，语义同v6d_out_edge_next_columns
+int v6d_get_all_edges_next_columns(GetAllEdgesIterator iter, VertexId* srcs,
+                                   VertexId* dsts, EdgeId* eids, int capacity);
+
+// src_id到dst_id是否有label的边，有返回1，没有返回0。两个点都不是本地fragment
+// 的内部点时返回-1
+int v6d_has_edge(GraphHandle graph, VertexId src_id, VertexId dst_id,
+                 LabelId label);
+
+// v1和v2的邻居的交集（去重、升序），用于闭合三角形、四边形等环。out1/out2为true
+// 时取出边的终点，否则取入边的起点；labels的含义同v6d_get_out_edges。至多写入
+// capacity个点到out_buffer，返回交集的大小（可能大于capacity），v1或v2不是
+// 本地fragment的内部点时返回-1
+int64_t v6d_intersect_neighbors(GraphHandle graph, VertexId v1, bool out1,
+                                VertexId v2, bool out2, LabelId* labels,
+                                int labels_count, VertexId* out_buffer,
+                                int64_t capacity);
+
 // 从edge对象获取起点id
 VertexId v6d_get_edge_src_id(GraphHandle graph, struct Edge* e);
 
@@ -205,6 +393,18 @@ LabelId v6d_get_edge_label(GraphHandle graph, struct Edge* e);
 int v6d_get_edge_property(GraphHandle graph, struct Edge*, PropertyId id,
                       struct Property* p_out);
 
+// 按边列表批量读取数值属性，语义同v6d_gather_vertex_property。边id一次解析，
+// 按分片、label和行号排序后读取属性列，每个属性列只查找一次
+int v6d_gather_edge_property(GraphHandle graph, PropertyId id,
+                             const struct Edge* edges, int count,
+                             enum PropertyType type, void* values_out,
+                             uint8_t* valid_out);
+
+// 按边列表批量读取STRING属性，语义同v6d_gather_vertex_string_property
+int v6d_gather_edge_string_property(GraphHandle graph, PropertyId id,
+                                    const struct Edge* edges, int count,
+                                    const char** data_out, int64_t* len_out);
+
 // 获取边的属性列表，返回一个迭代器
 PropertiesIterator v6d_get_edge_properties(GraphHandle graph, struct Edge*);
 
@@ -253,11 +453,88 @@ void v6d_free_property(struct Property* property);
 // 获取schema对象
 Schema v6d_get_schema(GraphHandle graph);
 
+// ------------------ statistics api ------------- //
+
+// 统计信息在graph handle加载时按fragment并行计算，并缓存在vineyard的metadata中，
+// 之后再加载同一个图时直接读取，无需扫描全图。统计的是partition_id所在fragment的
+// 内部点以及从这些点出发的边，fragment不在本地时返回-1。边label与其他接口一致。
+
+// vertex_counts接收每个点label的点数（vertex_label_num个），edge_counts接收每个边
+// label的边数（edge_label_num个），二者均可为空
+int v6d_get_label_counts(GraphHandle graph, PartitionId partition_id,
+                         int64_t* vertex_counts, int64_t* edge_counts);
+
+// (src_label, edge_label, dst_label)的边数
+int64_t v6d_get_triple_count(GraphHandle graph, PartitionId partition_id,
+                             LabelId src_label, LabelId edge_label,
+                             LabelId dst_label);
+
+// label为vertex_label的点在edge_label上的出度（out为true）或入度直方图，写入buckets
+// 的前bucket_num个桶：第0个桶是度为0的点数，第b个桶是度在[2^(b-1), 2^b)之间的点数。
+// 返回写入的桶数
+int v6d_get_degree_histogram(GraphHandle graph, PartitionId partition_id,
+                             LabelId vertex_label, LabelId edge_label,
+                             bool out, int64_t* buckets, int bucket_num);
+
+// ------------------ sampling api ------------- //
+
+// 在线基数估计（WanderJoin、JSUB等）使用的均匀采样，都是O(1)访问邻接表。
+// rng_state是调用者持有的随机数状态，每个线程一个，初值任意，每次采样后更新。
+// label与其他边接口一致。
+
+// 从src_id的label出边中均匀采样一条写入e_out，返回src_id在label上的出度，即该
+// 样本概率的倒数（Horvitz-Thompson权重）。出度为0时返回0且不写入e_out，
+// src_id不是本地fragment的内部点时返回-1
+int64_t v6d_sample_out_neighbor(GraphHandle graph, VertexId src_id,
+                                LabelId label, uint64_t* rng_state,
+                                struct Edge* e_out);
+
+// 对count个点各采样一次，第i个点的样本写入e_out[i]，返回值写入degrees_out[i]
+void v6d_sample_out_neighbors(GraphHandle graph, const VertexId* src_ids,
+                              int count, LabelId label, uint64_t* rng_state,
+                              struct Edge* e_out, int64_t* degrees_out);
+
+// 从本进程全部本地fragment的label边中有放回地均匀采样count条写入e_out，每条边
+// 每次被采中的概率都是1/total，total是这些边的总数，作为返回值。每条边只属于
+// 其起点所在的fragment，因此各进程的total之和是全图的边数，按total的比例给各
+// 进程分配样本数即得到全图上均匀的样本。total为0时不写入e_out
+int64_t v6d_sample_edges(GraphHandle graph, LabelId label, int count,
+                         uint64_t* rng_state, struct Edge* e_out);
+
+// ------------------ tracing api ------------- //
+
+// FFI调用的追踪，release版本中同样可用，子系统关闭时每次调用只多一次原子读。
+// subsystems为逗号分隔的子系统名（graph, vertex, edge, property, builder，all表示
+// 全部），空串表示全部关闭，有未知的名字时不做修改。也可以在启动时通过环境变量
+// V6D_TRACE设置
+void v6d_trace_enable(const char* subsystems);
+
+// 每个线程每sample_every次调用记录一次，默认为1，也可以通过环境变量V6D_TRACE_SAMPLE设置
+void v6d_trace_set_sampling(int sample_every);
+
+// 将ring buffer中最近的事件按时间顺序以csv写入path，返回写入的事件数，无法打开path时返回-1
+int v6d_trace_dump(const char* path);
+
 // ------------------ partition list api ------------- //
 
 // 如果 v 不存在，返回 -1
 PartitionId v6d_get_partition_id(GraphHandle graph, VertexId v);
 
+// 图的partition总数，即fragment数乘以channel_num，partition id都小于它
+PartitionId v6d_get_partition_num(GraphHandle graph);
+
+// 一次查询n个点的partition，结果写入out[0, n)，不存在的点为-1。
+// chunk大小的除法使用预先计算的倒数，不访问vertex map。
+void v6d_get_partition_ids(GraphHandle graph, const VertexId* ids, size_t n,
+                           PartitionId* out);
+
+// 同v6d_get_partition_ids，并将点按partition分组（shuffle使用）：offsets有
+// v6d_get_partition_num() + 1个元素，order[offsets[p], offsets[p + 1])是属于
+// partition p的点在ids中的下标，保持ids中的顺序。不存在的点不出现在order中，
+// 返回它们的个数。
+size_t v6d_group_by_partition(GraphHandle graph, const VertexId* ids, size_t n,
+                              PartitionId* out, size_t* order, size_t* offsets);
+
 // primary key所对应的property会提前通过schema里的对应字段返回。
 // key是\0结束的字符串，如果 key 不存在，返回 -1
 // 否则返回0，结果存在 internal_id 和 partition_id 中
@@ -265,6 +542,13 @@ int v6d_get_vertex_id_from_primary_key(GraphHandle graph, LabelId label_id,
                                    const char* key, VertexId* internal_id,
                                    PartitionId* partition_id);
 
+// 同v6d_get_vertices_by_outer_ids，外部id为\0结束的字符串，解析方式同
+// v6d_get_vertex_id_from_primary_key，支持int64和string oid的图
+int v6d_get_vertices_by_primary_keys(GraphHandle graph,
+                                     const LabelId* label_ids,
+                                     const char* const* keys, int count,
+                                     Vertex* v_out, uint8_t* found_out);
+
 // 返回本地的partition列表。
 //
 // 因为maxgraph已经有GraphHandler，因此不需要传worker_global_index。
@@ -21,11 +21,14 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
+#include "arrow/c/bridge.h"
 #include "boost/algorithm/string.hpp"
 #include "vineyard/basic/stream/dataframe_stream.h"
 #include "vineyard/basic/stream/parallel_stream.h"
 
+#include "htap_trace.h"
 #include "property_graph_stream.h"
 
 using namespace vineyard;
@@ -182,6 +185,7 @@ int v6d_initialize_graph_builder(GraphBuilder builder, Schema schema) {
 
 int v6d_add_vertex(GraphBuilder builder, VertexId id, LabelId labelid,
                 size_t property_size, Property *properties) {
+  HTAP_TRACE_SCOPE(TRACE_BUILDER, 1);
   auto stream =
       static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
   return (*stream)->AddVertex(id, labelid, property_size, properties);
@@ -190,6 +194,7 @@ int v6d_add_vertex(GraphBuilder builder, VertexId id, LabelId labelid,
 int v6d_add_edge(GraphBuilder builder, VertexId src_id,
               VertexId dst_id, LabelId label, LabelId src_label,
               LabelId dst_label, size_t property_size, Property *properties) {
+  HTAP_TRACE_SCOPE(TRACE_BUILDER, 1);
   auto stream =
       static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
   return (*stream)->AddEdge(src_id, dst_id, label, src_label, dst_label,
@@ -199,6 +204,7 @@ int v6d_add_edge(GraphBuilder builder, VertexId src_id,
 int v6d_add_vertices(GraphBuilder builder, size_t vertex_size, VertexId *ids,
                   LabelId *labelids, size_t *property_sizes,
                   Property *properties) {
+  HTAP_TRACE_SCOPE(TRACE_BUILDER, vertex_size);
   auto stream =
       static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
   return (*stream)->AddVertices(vertex_size, ids, labelids, property_sizes,
@@ -209,6 +215,7 @@ int v6d_add_edges(GraphBuilder builder, size_t edge_size,
                VertexId *src_ids, VertexId *dst_ids, LabelId *labels,
                LabelId *src_labels, LabelId *dst_labels, size_t *property_sizes,
                Property *properties) {
+  HTAP_TRACE_SCOPE(TRACE_BUILDER, edge_size);
   auto stream =
       static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
   return (*stream)->AddEdges(edge_size, src_ids, dst_ids, labels,
@@ -216,6 +223,106 @@ int v6d_add_edges(GraphBuilder builder, size_t edge_size,
                              properties);
 }
 
+int v6d_add_vertex_batch(GraphBuilder builder, LabelId label,
+                         struct ArrowArray *array, struct ArrowSchema *schema) {
+  HTAP_TRACE_SCOPE(TRACE_BUILDER, 0);
+  auto stream =
+      static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
+  auto batch = arrow::ImportRecordBatch(array, schema);
+  if (!batch.ok()) {
+    LOG(ERROR) << "Failed to import the vertex batch: " << batch.status().ToString();
+    return -1;
+  }
+  return (*stream)->AddVertexBatch(label, batch.ValueOrDie());
+}
+
+int v6d_add_edge_batch(GraphBuilder builder, LabelId label, LabelId src_label,
+                       LabelId dst_label, struct ArrowArray *array,
+                       struct ArrowSchema *schema) {
+  HTAP_TRACE_SCOPE(TRACE_BUILDER, 0);
+  auto stream =
+      static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
+  auto batch = arrow::ImportRecordBatch(array, schema);
+  if (!batch.ok()) {
+    LOG(ERROR) << "Failed to import the edge batch: " << batch.status().ToString();
+    return -1;
+  }
+  return (*stream)->AddEdgeBatch(label, src_label, dst_label, batch.ValueOrDie());
+}
+
+// imports all n batches, releasing the ones left over on a failure
+static bool import_batches(
+    size_t n, struct ArrowArray *arrays, struct ArrowSchema *schemas,
+    std::vector<std::shared_ptr<arrow::RecordBatch>> &batches) {
+  for (size_t i = 0; i < n; ++i) {
+    auto batch = arrow::ImportRecordBatch(&arrays[i], &schemas[i]);
+    if (!batch.ok()) {
+      LOG(ERROR) << "Failed to import batch " << i << ": "
+                 << batch.status().ToString();
+      for (size_t k = i + 1; k < n; ++k) {
+        if (arrays[k].release != nullptr) {
+          arrays[k].release(&arrays[k]);
+        }
+        if (schemas[k].release != nullptr) {
+          schemas[k].release(&schemas[k]);
+        }
+      }
+      return false;
+    }
+    batches.push_back(batch.ValueOrDie());
+  }
+  return true;
+}
+
+int v6d_add_vertex_batches(GraphBuilder builder, size_t n, LabelId *labels,
+                           struct ArrowArray *arrays,
+                           struct ArrowSchema *schemas) {
+  HTAP_TRACE_SCOPE(TRACE_BUILDER, 0);
+  auto stream =
+      static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  if (!import_batches(n, arrays, schemas, batches)) {
+    return -1;
+  }
+  return (*stream)->AddVertexBatches(std::vector<LabelId>(labels, labels + n),
+                                     batches);
+}
+
+int v6d_add_edge_batches(GraphBuilder builder, size_t n, LabelId *labels,
+                         LabelId *src_labels, LabelId *dst_labels,
+                         struct ArrowArray *arrays,
+                         struct ArrowSchema *schemas) {
+  HTAP_TRACE_SCOPE(TRACE_BUILDER, 0);
+  auto stream =
+      static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  if (!import_batches(n, arrays, schemas, batches)) {
+    return -1;
+  }
+  return (*stream)->AddEdgeBatches(
+      std::vector<LabelId>(labels, labels + n),
+      std::vector<LabelId>(src_labels, src_labels + n),
+      std::vector<LabelId>(dst_labels, dst_labels + n), batches);
+}
+
+int v6d_set_chunk_size(GraphBuilder builder, int64_t rows) {
+  auto stream =
+      static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
+  return (*stream)->SetChunkSize(rows);
+}
+
+void v6d_set_backpressure_timeout(GraphBuilder builder, double seconds) {
+  auto stream =
+      static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
+  (*stream)->SetBackpressureTimeout(seconds);
+}
+
+int v6d_set_compression(GraphBuilder builder, const char* codec) {
+  auto stream =
+      static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
+  return (*stream)->SetCompression(codec);
+}
+
 int v6d_build(GraphBuilder builder) {
   auto stream =
       static_cast<std::shared_ptr<vineyard::htap::PropertyGraphOutStream> *>(builder);
@@ -123,6 +123,62 @@ int v6d_add_edges(GraphBuilder builder, size_t edge_size,
                LabelId* src_labels, LabelId* dst_labels, size_t* property_sizes,
                Property* properties);
 
+struct ArrowArray;
+struct ArrowSchema;
+
+/**
+ * 按列批量写入某个label的点，array和schema是Arrow C data interface导出的一个
+ * struct数组（即一个RecordBatch），列依次为点id和该label的全部属性（包括主键），
+ * 顺序和类型与schema一致，不一致时返回-1。调用之后array和schema被release。
+ */
+int v6d_add_vertex_batch(GraphBuilder builder, LabelId label,
+                         struct ArrowArray* array, struct ArrowSchema* schema);
+
+/**
+ * 参数含义与add_vertex_batch一致，列依次为src id、dst id和该label的全部属性。
+ */
+int v6d_add_edge_batch(GraphBuilder builder, LabelId label, LabelId src_label,
+                       LabelId dst_label, struct ArrowArray* array,
+                       struct ArrowSchema* schema);
+
+/**
+ * 一次写入多个batch（通常每个label一个），labels、arrays和schemas各有n个，
+ * 每个batch的含义与add_vertex_batch一致。所有batch都先和各自label的schema
+ * 比较，有任何一个不一致则返回-1且什么都不写入；各label的batch在各自的线程
+ * 上切分成chunk，再按label依次写入stream。调用之后全部array和schema被release。
+ */
+int v6d_add_vertex_batches(GraphBuilder builder, size_t n, LabelId* labels,
+                           struct ArrowArray* arrays,
+                           struct ArrowSchema* schemas);
+
+/**
+ * 参数含义与add_vertex_batches一致，每个batch的含义与add_edge_batch一致。
+ */
+int v6d_add_edge_batches(GraphBuilder builder, size_t n, LabelId* labels,
+                         LabelId* src_labels, LabelId* dst_labels,
+                         struct ArrowArray* arrays,
+                         struct ArrowSchema* schemas);
+
+/**
+ * 每个写入stream的chunk的行数，需要在写入任何点、边之前调用，否则返回-1。
+ */
+int v6d_set_chunk_size(GraphBuilder builder, int64_t rows);
+
+/**
+ * vineyard内存不足（即读端尚未读走之前的chunk）时，写入一个chunk最多等待
+ * 的秒数，超时后写入失败。
+ */
+void v6d_set_backpressure_timeout(GraphBuilder builder, double seconds);
+
+/**
+ * 之后写入stream的chunk的压缩方式："lz4"、"zstd"或"none"，默认取环境变量
+ * V6D_STREAM_COMPRESSION。每个chunk自带其压缩方式，读端据此解压，无需设置；
+ * 读端可用环境变量V6D_STREAM_DECOMPRESSION_THREADS指定并行解压的线程数，
+ * 用V6D_STREAM_READ_AHEAD指定后台预读的chunk数。
+ * 不支持的压缩方式（或Arrow版本低于4.0）返回-1。
+ */
+int v6d_set_compression(GraphBuilder builder, const char* codec);
+
 /**
  * 结束local GraphBuilder的build，点、边写完之后分别调用
  */
@@ -15,9 +15,14 @@
  */
 #include "htap_ds_impl.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "vineyard/client/client.h"
 #include "vineyard/graph/fragment/arrow_fragment.h"
@@ -26,6 +31,268 @@
 namespace vineyard {
 namespace htap_impl {
 
+void GraphStatistics::Init(int vertex_label_num, int edge_label_num) {
+  this->vertex_label_num = vertex_label_num;
+  this->edge_label_num = edge_label_num;
+  vertex_counts.assign(vertex_label_num, 0);
+  edge_counts.assign(edge_label_num, 0);
+  triple_counts.assign(
+      static_cast<size_t>(vertex_label_num) * edge_label_num * vertex_label_num,
+      0);
+  out_degrees.assign(static_cast<size_t>(vertex_label_num) * edge_label_num *
+                         DEGREE_HISTOGRAM_BUCKETS, 0);
+  in_degrees.assign(out_degrees.size(), 0);
+}
+
+void GraphStatistics::Add(const GraphStatistics& other) {
+  auto add = [](std::vector<int64_t>& to, const std::vector<int64_t>& from) {
+    for (size_t i = 0; i < to.size(); ++i) {
+      to[i] += from[i];
+    }
+  };
+  add(vertex_counts, other.vertex_counts);
+  add(edge_counts, other.edge_counts);
+  add(triple_counts, other.triple_counts);
+  add(out_degrees, other.out_degrees);
+  add(in_degrees, other.in_degrees);
+}
+
+void GraphStatistics::AddDegree(std::vector<int64_t>& histogram,
+                                LabelId v_label, LabelId e_label,
+                                int64_t degree) {
+  int bucket = 0;
+  while (degree > 0 && bucket < DEGREE_HISTOGRAM_BUCKETS - 1) {
+    degree >>= 1;
+    ++bucket;
+  }
+  ++histogram[(static_cast<size_t>(v_label) * edge_label_num + e_label) *
+                  DEGREE_HISTOGRAM_BUCKETS + bucket];
+}
+
+void GraphStatistics::ToJSON(vineyard::json& tree) const {
+  tree["vertex_label_num"] = vertex_label_num;
+  tree["edge_label_num"] = edge_label_num;
+  tree["vertex_counts"] = vertex_counts;
+  tree["edge_counts"] = edge_counts;
+  tree["triple_counts"] = triple_counts;
+  tree["out_degrees"] = out_degrees;
+  tree["in_degrees"] = in_degrees;
+}
+
+bool GraphStatistics::FromJSON(const vineyard::json& tree,
+                               int vertex_label_num, int edge_label_num) {
+  if (!tree.contains("vertex_label_num") ||
+      tree["vertex_label_num"].get<int>() != vertex_label_num ||
+      tree["edge_label_num"].get<int>() != edge_label_num) {
+    return false;
+  }
+  Init(vertex_label_num, edge_label_num);
+  vertex_counts = tree["vertex_counts"].get<std::vector<int64_t>>();
+  edge_counts = tree["edge_counts"].get<std::vector<int64_t>>();
+  triple_counts = tree["triple_counts"].get<std::vector<int64_t>>();
+  out_degrees = tree["out_degrees"].get<std::vector<int64_t>>();
+  in_degrees = tree["in_degrees"].get<std::vector<int64_t>>();
+  return true;
+}
+
+// Each thread takes the same share of every vertex label, so that labels of
+// very different sizes still spread evenly.
+template <typename FRAGMENT_TYPE_T>
+static void compute_statistics(FRAGMENT_TYPE_T* frag, int vertex_label_num,
+                               int edge_label_num, GraphStatistics* out) {
+  out->Init(vertex_label_num, edge_label_num);
+  int thread_num = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<GraphStatistics> partial(thread_num);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_num; ++t) {
+    threads.emplace_back([&, t]() {
+      GraphStatistics& stats = partial[t];
+      stats.Init(vertex_label_num, edge_label_num);
+      for (LabelId v_label = 0; v_label < vertex_label_num; ++v_label) {
+        auto range = frag->InnerVertices(v_label);
+        VID_TYPE size = range.end_value() - range.begin_value();
+        VID_TYPE begin = range.begin_value() + size * t / thread_num;
+        VID_TYPE end = range.begin_value() + size * (t + 1) / thread_num;
+        stats.vertex_counts[v_label] += end - begin;
+        for (LabelId e_label = 0; e_label < edge_label_num; ++e_label) {
+          for (VID_TYPE v = begin; v < end; ++v) {
+            auto out_list = frag->GetOutgoingAdjList(VERTEX_TYPE(v), e_label);
+            int64_t degree = out_list.end_unit() - out_list.begin_unit();
+            stats.edge_counts[e_label] += degree;
+            stats.AddDegree(stats.out_degrees, v_label, e_label, degree);
+            for (const NBR_TYPE* e = out_list.begin_unit();
+                 e != out_list.end_unit(); ++e) {
+              LabelId dst_label = frag->vertex_label(VERTEX_TYPE(e->vid));
+              ++stats.triple_counts[(static_cast<size_t>(v_label) *
+                                         edge_label_num + e_label) *
+                                        vertex_label_num + dst_label];
+            }
+            auto in_list = frag->GetIncomingAdjList(VERTEX_TYPE(v), e_label);
+            stats.AddDegree(stats.in_degrees, v_label, e_label,
+                            in_list.end_unit() - in_list.begin_unit());
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& stats : partial) {
+    out->Add(stats);
+  }
+}
+
+static std::string statistics_name(vineyard::ObjectID fragment_id) {
+  return "__htap_statistics_" + vineyard::ObjectIDToString(fragment_id);
+}
+
+static bool load_statistics(vineyard::Client* client,
+                            vineyard::ObjectID fragment_id,
+                            int vertex_label_num, int edge_label_num,
+                            GraphStatistics* out) {
+  vineyard::ObjectID stats_id = vineyard::InvalidObjectID();
+  vineyard::ObjectMeta meta;
+  if (!client->GetName(statistics_name(fragment_id), stats_id).ok() ||
+      !client->GetMetaData(stats_id, meta).ok()) {
+    return false;
+  }
+  auto tree = vineyard::json::parse(meta.GetKeyValue("statistics"), nullptr,
+                                    false);
+  return !tree.is_discarded() &&
+         out->FromJSON(tree, vertex_label_num, edge_label_num);
+}
+
+// a cache only: failing to store the statistics costs the next load a scan
+static void store_statistics(vineyard::Client* client,
+                             vineyard::ObjectID fragment_id,
+                             const GraphStatistics& stats) {
+  vineyard::json tree;
+  stats.ToJSON(tree);
+  vineyard::ObjectMeta meta;
+  meta.SetTypeName("vineyard::htap::GraphStatistics");
+  meta.AddKeyValue("fragment_id", vineyard::ObjectIDToString(fragment_id));
+  meta.AddKeyValue("statistics", tree.dump());
+  vineyard::ObjectID stats_id = vineyard::InvalidObjectID();
+  auto status = client->CreateMetaData(meta, stats_id);
+  if (status.ok()) {
+    status = client->Persist(stats_id);
+  }
+  if (status.ok()) {
+    status = client->PutName(stats_id, statistics_name(fragment_id));
+  }
+  if (!status.ok()) {
+    LOG(WARNING) << "Failed to cache the statistics of fragment "
+                 << vineyard::ObjectIDToString(fragment_id) << ": "
+                 << status.ToString();
+  }
+}
+
+// The statistics of the local fragment fid: those cached in vineyard, or
+// computed over the fragment, which get_frag constructs, and cached.
+template <typename GET_FRAGMENT_T>
+static void init_statistics(GraphHandleImpl* handle, FRAG_ID_TYPE fid,
+                            GET_FRAGMENT_T get_frag, GraphStatistics* out) {
+  vineyard::ObjectID fragment_id = handle->fragment_ids[fid];
+  if (load_statistics(handle->client, fragment_id, handle->vertex_label_num,
+                      handle->edge_label_num, out)) {
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  compute_statistics(get_frag(handle, fid), handle->vertex_label_num,
+                     handle->edge_label_num, out);
+  LOG(INFO) << "computed the statistics of fragment " << fid << " in "
+            << std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start).count()
+            << "s";
+  store_statistics(handle->client, fragment_id, *out);
+}
+
+// fragments[fid], constructed from its metadata by the first caller; a
+// fragment that isn't local stays unconstructed, as before
+template <typename FRAGMENT_TYPE_T>
+static FRAGMENT_TYPE_T* construct_fragment(GraphHandleImpl* handle,
+                                           FRAGMENT_TYPE_T* fragments,
+                                           FRAG_ID_TYPE fid) {
+  std::call_once(handle->fragment_once[fid], [&]() {
+    if (handle->fragment_ids[fid] == vineyard::InvalidObjectID()) {
+      return;
+    }
+    vineyard::ObjectMeta meta;
+    VINEYARD_CHECK_OK(
+        handle->client->GetMetaData(handle->fragment_ids[fid], meta));
+#ifndef NDEBUG
+    LOG(INFO) << "construct fragment " << fid << ": "
+              << handle->fragment_ids[fid] << ", " << meta.GetTypeName();
+#endif
+    fragments[fid].Construct(meta);
+  });
+  return &fragments[fid];
+}
+
+FRAGMENT_TYPE* get_fragment(GraphHandleImpl* handle, FRAG_ID_TYPE fid) {
+  return construct_fragment(handle, handle->fragments, fid);
+}
+
+STRING_FRAGMENT_TYPE* get_string_fragment(GraphHandleImpl* handle,
+                                          FRAG_ID_TYPE fid) {
+  return construct_fragment(handle, handle->string_fragments, fid);
+}
+
+const GraphStatistics* get_statistics(GraphHandleImpl* handle,
+                                      FRAG_ID_TYPE fid) {
+  if (fid >= handle->fnum) {
+    return nullptr;
+  }
+  std::call_once(handle->statistics_once[fid], [&]() {
+    if (handle->fragment_ids[fid] == vineyard::InvalidObjectID()) {
+      return;
+    }
+    if (handle->use_int64_oid) {
+      init_statistics(handle, fid, get_fragment, &handle->statistics[fid]);
+    } else {
+      init_statistics(handle, fid, get_string_fragment,
+                      &handle->statistics[fid]);
+    }
+  });
+  return handle->statistics[fid].Empty() ? nullptr : &handle->statistics[fid];
+}
+
+// The compact vertex maps of every label, over the oids read from
+// vertex_map; nullptr, the vertex map being used instead, if one can't be
+// built.
+template <typename VERTEX_MAP_T>
+static CompactVertexMap<typename VERTEX_MAP_T::oid_t>*
+build_compact_vertex_maps(GraphHandleImpl* handle, VERTEX_MAP_T* vertex_map) {
+  auto start = std::chrono::steady_clock::now();
+  auto maps =
+      new CompactVertexMap<typename VERTEX_MAP_T::oid_t>[handle->vertex_label_num];
+  size_t bytes = 0;
+  for (LabelId label = 0; label < handle->vertex_label_num; ++label) {
+    const int64_t* range =
+        handle->dense_oid_offsets + static_cast<size_t>(label) * handle->fnum;
+    auto key = [&](uint64_t i) {
+      VID_TYPE gid = 0;
+      typename VERTEX_MAP_T::oid_t oid;
+      CHECK(get_dense_outer_id_gid(handle, label, range[0] + i, &gid));
+      CHECK(vertex_map->GetOid(gid, oid));
+      return oid;
+    };
+    if (!maps[label].Build(range[handle->fnum] - range[0], key)) {
+      LOG(WARNING) << "no compact vertex map of label " << label
+                   << ", the vertex map is used";
+      delete[] maps;
+      return nullptr;
+    }
+    bytes += maps[label].MemoryBytes();
+  }
+  LOG(INFO) << "built the compact vertex maps in "
+            << std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start).count()
+            << "s, " << bytes << " bytes";
+  return maps;
+}
+
 void get_graph_handle(ObjectId id, PartitionId channel_num,
                       GraphHandleImpl* handle) {
 #ifndef NDEBUG
@@ -45,6 +312,7 @@ void get_graph_handle(ObjectId id, PartitionId channel_num,
             << ", vertex label num = " << vertex_label_num
             << ", edge label num = " << edge_label_num;
 
+  handle->object_id = id;
   handle->fnum = total_frag_num;
   handle->vid_parser.Init(total_frag_num, vertex_label_num);
   handle->eid_parser.Init(total_frag_num, edge_label_num);
@@ -77,83 +345,78 @@ void get_graph_handle(ObjectId id, PartitionId channel_num,
   handle->schema = NULL;
   handle->vertex_map = NULL;
   handle->string_vertex_map = NULL;
+  handle->client = client.release();
 
+  // the fragments are constructed on first use (get_fragment); the first
+  // local one here, for the oid type, the vertex map and the schema
+  handle->fragment_ids = new vineyard::ObjectID[total_frag_num];
+  std::fill(handle->fragment_ids, handle->fragment_ids + total_frag_num,
+            vineyard::InvalidObjectID());
+  handle->fragment_once = new std::once_flag[total_frag_num];
+  handle->statistics_once = new std::once_flag[total_frag_num];
+  FRAG_ID_TYPE first = total_frag_num;
   for (const auto& pair : fg->Fragments()) {
     FRAG_ID_TYPE fid = pair.first;
     LOG(INFO) << "fid = " << fid
-              << ", instance_id = " << client->instance_id()
+              << ", instance_id = " << handle->client->instance_id()
               << ", location = " << fg->FragmentLocations().at(fid);
-    if (fg->FragmentLocations().at(fid) == client->instance_id()) {
-      vineyard::ObjectMeta meta;
-      VINEYARD_CHECK_OK(client->GetMetaData(pair.second, meta));
-#ifndef NDEBUG
-      LOG(INFO) << "begin construct fragment: " << pair.second << ", "
-                << meta.GetTypeName();
-#endif
-      if (meta.GetKeyValue("oid_type") == vineyard::type_name<OID_TYPE>()) {
-        if (handle->fragments == nullptr) {
-          handle->use_int64_oid = true;
-          handle->use_string_oid = false;
-          handle->fragments = new FRAGMENT_TYPE[total_frag_num];
-        }
-        handle->fragments[fid].Construct(meta);
-      } else if (meta.GetKeyValue("oid_type") == vineyard::type_name<STRING_OID_TYPE>()) {
-        if (handle->string_fragments == nullptr) {
-          handle->use_int64_oid = false;
-          handle->use_string_oid = true;
-          handle->string_fragments = new STRING_FRAGMENT_TYPE[total_frag_num];
-        }
-        handle->string_fragments[fid].Construct(meta);
-      } else {
-        LOG(FATAL) << "Unsupported fragment type: " << meta.GetTypeName()
-                   << ", with OID type " << meta.GetKeyValue("oid_type")
-                   << ", with VID type " << meta.GetKeyValue("vid_type");
-      }
-
-      if (handle->vertex_map == nullptr && handle->string_vertex_map == nullptr ) {
-        vineyard::ObjectID vertex_map_id = vineyard::InvalidObjectID();
-        if (handle->fragments != nullptr) {
-          vertex_map_id = handle->fragments[fid].vertex_map_id();
-        } else {
-          vertex_map_id = handle->string_fragments[fid].vertex_map_id();
-        }
+    if (fg->FragmentLocations().at(fid) == handle->client->instance_id()) {
+      handle->fragment_ids[fid] = pair.second;
+      first = std::min(first, fid);
+    }
+  }
+  if (first != total_frag_num) {
+    vineyard::ObjectMeta meta;
+    VINEYARD_CHECK_OK(
+        handle->client->GetMetaData(handle->fragment_ids[first], meta));
+    vineyard::ObjectID vertex_map_id = vineyard::InvalidObjectID();
+    vineyard::json schema_json;
+    if (meta.GetKeyValue("oid_type") == vineyard::type_name<OID_TYPE>()) {
+      handle->use_int64_oid = true;
+      handle->use_string_oid = false;
+      handle->fragments = new FRAGMENT_TYPE[total_frag_num];
+      FRAGMENT_TYPE* frag = get_fragment(handle, first);
+      vertex_map_id = frag->vertex_map_id();
+      frag->schema().ToJSON(schema_json);
+    } else if (meta.GetKeyValue("oid_type") == vineyard::type_name<STRING_OID_TYPE>()) {
+      handle->use_int64_oid = false;
+      handle->use_string_oid = true;
+      handle->string_fragments = new STRING_FRAGMENT_TYPE[total_frag_num];
+      STRING_FRAGMENT_TYPE* frag = get_string_fragment(handle, first);
+      vertex_map_id = frag->vertex_map_id();
+      frag->schema().ToJSON(schema_json);
+    } else {
+      LOG(FATAL) << "Unsupported fragment type: " << meta.GetTypeName()
+                 << ", with OID type " << meta.GetKeyValue("oid_type")
+                 << ", with VID type " << meta.GetKeyValue("vid_type");
+    }
 
-        vineyard::ObjectMeta vm_meta;
-        LOG(INFO) << "begin get vertex map: " << vertex_map_id;
-        VINEYARD_CHECK_OK(client->GetMetaData(vertex_map_id, vm_meta));
+    vineyard::ObjectMeta vm_meta;
+    LOG(INFO) << "begin get vertex map: " << vertex_map_id;
+    VINEYARD_CHECK_OK(handle->client->GetMetaData(vertex_map_id, vm_meta));
 #ifndef NDEBUG
-        LOG(INFO) << "begin construct vertex map: " << vertex_map_id;
+    LOG(INFO) << "begin construct vertex map: " << vertex_map_id;
 #endif
-
-        if (handle->fragments != nullptr) {
-          handle->vertex_map = new VERTEX_MAP_TYPE();
-          handle->vertex_map->Construct(vm_meta);
-        } else {
-          handle->string_vertex_map = new STRING_VERTEX_MAP_TYPE();
-          handle->string_vertex_map->Construct(vm_meta);
-        }
-
+    if (handle->fragments != nullptr) {
+      handle->vertex_map = new VERTEX_MAP_TYPE();
+      handle->vertex_map->Construct(vm_meta);
+    } else {
+      handle->string_vertex_map = new STRING_VERTEX_MAP_TYPE();
+      handle->string_vertex_map->Construct(vm_meta);
+    }
 #ifndef NDEBUG
-        LOG(INFO) << "finish construct vertex map: " << pair.second
-                  << ", vertex map is: " << vertex_map_id;
+    LOG(INFO) << "finish construct vertex map: " << vertex_map_id;
 #endif
-      }
-      if (handle->schema == NULL) {
-        vineyard::json schema_json;
-        if (handle->fragments != nullptr) {
-          handle->fragments[fid].schema().ToJSON(schema_json);
-        } else {
-          handle->string_fragments[fid].schema().ToJSON(schema_json);
-        }
-        vineyard::htap::MGPropertyGraphSchema mgschema;
-        mgschema.FromJSON(schema_json);
-        handle->schema =
-            new vineyard::htap::MGPropertyGraphSchema(mgschema.TransformToMaxGraph());
-      }
-    }
+
+    vineyard::htap::MGPropertyGraphSchema mgschema;
+    mgschema.FromJSON(schema_json);
+    handle->schema =
+        new vineyard::htap::MGPropertyGraphSchema(mgschema.TransformToMaxGraph());
   }
   handle->vertex_chunk_sizes =
       static_cast<VID_TYPE**>(malloc(sizeof(VID_TYPE*) * total_frag_num));
+  handle->partition_divisors =
+      new PartitionDivisor[static_cast<size_t>(total_frag_num) * vertex_label_num];
   for (vineyard::fid_t i = 0; i < total_frag_num; ++i) {
     handle->vertex_chunk_sizes[i] =
         static_cast<VID_TYPE*>(malloc(sizeof(VID_TYPE) * vertex_label_num));
@@ -166,9 +429,39 @@ void get_graph_handle(ObjectId id, PartitionId channel_num,
       }
       handle->vertex_chunk_sizes[i][j] =
           (ivnum + channel_num - 1) / channel_num;
+      handle->partition_divisors[static_cast<size_t>(i) * vertex_label_num + j]
+          .Init(ivnum, handle->vertex_chunk_sizes[i][j]);
     }
   }
-  handle->client = client.release();
+  size_t ranges = static_cast<size_t>(vertex_label_num) * total_frag_num;
+  handle->dense_oid_offsets = new int64_t[ranges + 1];
+  handle->dense_oid_offsets[0] = 0;
+  for (LabelId j = 0; j < vertex_label_num; ++j) {
+    for (vineyard::fid_t i = 0; i < total_frag_num; ++i) {
+      size_t r = static_cast<size_t>(j) * total_frag_num + i;
+      handle->dense_oid_offsets[r + 1] =
+          handle->dense_oid_offsets[r] +
+          handle->partition_divisors[static_cast<size_t>(i) *
+                                         vertex_label_num + j].inner_size;
+    }
+  }
+  const char* compact = getenv("V6D_COMPACT_VERTEX_MAP");
+  if (compact != nullptr && strcmp(compact, "1") == 0) {
+    if (handle->use_int64_oid) {
+      handle->compact_vertex_maps =
+          build_compact_vertex_maps(handle, handle->vertex_map);
+    } else {
+      handle->string_compact_vertex_maps =
+          build_compact_vertex_maps(handle, handle->string_vertex_map);
+    }
+  }
+  if (handle->use_int64_oid) {
+    handle->gid_cache = new GidCache<OID_TYPE>(GID_CACHE_CAPACITY);
+  } else {
+    handle->string_gid_cache = new GidCache<STRING_OID_TYPE>(GID_CACHE_CAPACITY);
+  }
+  // filled on first use, see get_statistics
+  handle->statistics = new GraphStatistics[total_frag_num];
   LOG(INFO) << "finish get graph handle: " << id << ", handle = " << handle;
 }
 
@@ -183,6 +476,7 @@ void free_graph_handle(GraphHandleImpl* handle) {
     free(handle->vertex_chunk_sizes[i]);
   }
   free(handle->vertex_chunk_sizes);
+  delete[] handle->partition_divisors;
 
   if (handle->fragments != nullptr) {
     delete[] handle->fragments;
@@ -204,6 +498,24 @@ void free_graph_handle(GraphHandleImpl* handle) {
     delete[] handle->local_fragments;
     handle->local_fragments = NULL;
   }
+  delete handle->gid_cache;
+  handle->gid_cache = nullptr;
+  delete handle->string_gid_cache;
+  handle->string_gid_cache = nullptr;
+  delete[] handle->statistics;
+  handle->statistics = nullptr;
+  delete[] handle->compact_vertex_maps;
+  handle->compact_vertex_maps = nullptr;
+  delete[] handle->string_compact_vertex_maps;
+  handle->string_compact_vertex_maps = nullptr;
+  delete[] handle->dense_oid_offsets;
+  handle->dense_oid_offsets = nullptr;
+  delete[] handle->fragment_ids;
+  handle->fragment_ids = nullptr;
+  delete[] handle->fragment_once;
+  handle->fragment_once = nullptr;
+  delete[] handle->statistics_once;
+  handle->statistics_once = nullptr;
   delete handle->client;
   handle->client = NULL;
 #ifndef NDEBUG
@@ -211,6 +523,72 @@ void free_graph_handle(GraphHandleImpl* handle) {
 #endif
 }
 
+template <typename VERTEX_MAP_T>
+int get_gids(VERTEX_MAP_T* vertex_map, FRAG_ID_TYPE fnum,
+             const LabelId* labels,
+             const typename VERTEX_MAP_T::oid_t* oids, int count,
+             VID_TYPE* gids, char* found) {
+  std::vector<int> order(count);
+  for (int i = 0; i < count; ++i) {
+    order[i] = i;
+    found[i] = 0;
+  }
+  std::sort(order.begin(), order.end(), [labels, oids](int a, int b) {
+    return labels[a] != labels[b] ? labels[a] < labels[b] : oids[a] < oids[b];
+  });
+  // the distinct pairs, each with its first position in order
+  std::vector<int> unique;
+  for (int k = 0; k < count; ++k) {
+    int i = order[k];
+    if (labels[i] < 0) {
+      continue;
+    }
+    if (unique.empty() || labels[order[unique.back()]] != labels[i] ||
+        oids[order[unique.back()]] != oids[i]) {
+      unique.push_back(k);
+    }
+  }
+  int num_found = 0;
+  size_t run_begin = 0;
+  while (run_begin < unique.size()) {
+    LabelId label = labels[order[unique[run_begin]]];
+    size_t run_end = run_begin;
+    while (run_end < unique.size() && labels[order[unique[run_end]]] == label) {
+      ++run_end;
+    }
+    for (FRAG_ID_TYPE fid = 0; fid < fnum; ++fid) {
+      for (size_t u = run_begin; u < run_end; ++u) {
+        int i = order[unique[u]];
+        if (!found[i] && vertex_map->GetGid(fid, label, oids[i], gids[i])) {
+          found[i] = 1;
+        }
+      }
+    }
+    run_begin = run_end;
+  }
+  // copy to the duplicates
+  for (size_t u = 0; u < unique.size(); ++u) {
+    int k_end = u + 1 < unique.size() ? unique[u + 1] : count;
+    int first = order[unique[u]];
+    for (int k = unique[u]; k < k_end; ++k) {
+      int i = order[k];
+      found[i] = found[first];
+      gids[i] = gids[first];
+      num_found += found[i];
+    }
+  }
+  return num_found;
+}
+
+template
+int get_gids(VERTEX_MAP_TYPE* vertex_map, FRAG_ID_TYPE fnum,
+             const LabelId* labels, const VERTEX_MAP_TYPE::oid_t* oids,
+             int count, VID_TYPE* gids, char* found);
+template
+int get_gids(STRING_VERTEX_MAP_TYPE* vertex_map, FRAG_ID_TYPE fnum,
+             const LabelId* labels, const STRING_VERTEX_MAP_TYPE::oid_t* oids,
+             int count, VID_TYPE* gids, char* found);
+
 static int get_property_from_table(arrow::Table* table, int64_t row_id,
                                    PropertyId col_id, Property* p_out) {
 #ifndef NDEBUG
@@ -273,6 +651,82 @@ static int get_property_from_table(arrow::Table* table, int64_t row_id,
   return 0;
 }
 
+static PropertyType get_property_type(const std::shared_ptr<arrow::DataType>& dt) {
+  if (dt == arrow::boolean()) {
+    return BOOL;
+  } else if (dt == arrow::int8()) {
+    return CHAR;
+  } else if (dt == arrow::int16()) {
+    return SHORT;
+  } else if (dt == arrow::int32()) {
+    return INT;
+  } else if (dt == arrow::int64()) {
+    return LONG;
+  } else if (dt == arrow::float32()) {
+    return FLOAT;
+  } else if (dt == arrow::float64()) {
+    return DOUBLE;
+  } else if (dt == arrow::utf8() || dt == arrow::large_utf8()) {
+    return STRING;
+  }
+  return INVALID;
+}
+
+static int get_column_from_table(arrow::Table* table, PropertyId col_id,
+                                 int64_t begin, int64_t end,
+                                 PropertyColumn* out) {
+  if (col_id < 0 || col_id >= table->num_columns()) {
+    return -1;
+  }
+  std::shared_ptr<arrow::DataType> dt = table->field(col_id)->type();
+  std::shared_ptr<arrow::ArrayData> data =
+      table->column(col_id)->chunk(0)->data();
+  end = std::min(end, data->length);
+  begin = std::min(std::max<int64_t>(begin, 0), end);
+  out->type = get_property_type(dt);
+  out->length = end - begin;
+  out->offsets = nullptr;
+  out->offset_width = 0;
+  out->bit_offset = data->offset + begin;
+  out->validity = data->buffers[0] == nullptr ? nullptr : data->buffers[0]->data();
+  switch (out->type) {
+  case BOOL:
+    out->values = data->buffers[1]->data();
+    break;
+  case STRING:
+    out->offset_width = dt == arrow::utf8() ? 4 : 8;
+    out->offsets = data->buffers[1]->data() + out->bit_offset * out->offset_width;
+    out->values = data->buffers[2]->data();
+    break;
+  case INVALID:
+    LOG(ERROR) << "invalid dt is = " << dt->ToString();
+    return -1;
+  default:
+    out->values = data->buffers[1]->data() +
+                  out->bit_offset *
+                      std::static_pointer_cast<arrow::FixedWidthType>(dt)->bit_width() / 8;
+    break;
+  }
+  return 0;
+}
+
+template <typename FRAGMENT_TYPE>
+int get_vertex_property_column(FRAGMENT_TYPE* frag, LabelId label,
+                               PropertyId id, int64_t begin, int64_t end,
+                               PropertyColumn* out) {
+  std::shared_ptr<arrow::Table> table = frag->vertex_data_table(label);
+  return get_column_from_table(table.get(), id, begin, end, out);
+}
+
+template
+int get_vertex_property_column(FRAGMENT_TYPE* frag, LabelId label,
+                               PropertyId id, int64_t begin, int64_t end,
+                               PropertyColumn* out);
+template
+int get_vertex_property_column(STRING_FRAGMENT_TYPE* frag, LabelId label,
+                               PropertyId id, int64_t begin, int64_t end,
+                               PropertyColumn* out);
+
 static void get_properties_from_table(std::shared_ptr<arrow::Table> table,
                                       int row_id,
                                       PropertiesIteratorImpl* iter) {
@@ -451,6 +905,7 @@ void get_all_vertices(FRAGMENT_TYPE* frag, PartitionId channel_id,
 #ifndef NDEBUG
   LOG(INFO) << "enter " << __FUNCTION__ << ", limit = " << limit;
 #endif
+  out->filter = NULL;
   if (limit == 0) {
     out->ranges = NULL;
     out->range_id = 0;
@@ -541,9 +996,319 @@ void free_get_all_vertices_iterator(GetAllVerticesIteratorImpl* iter) {
   if (iter->ranges != NULL) {
     free(iter->ranges);
   }
+  delete iter->filter;
+}
+
+namespace {
+
+// reads the little-endian constants of a predicate, failing past its end
+class PredicateReader {
+ public:
+  PredicateReader(const char* data, int64_t len) : p_(data), end_(data + len) {}
+
+  bool Read(void* out, int64_t bytes) {
+    if (bytes < 0 || end_ - p_ < bytes) {
+      return false;
+    }
+    memcpy(out, p_, bytes);
+    p_ += bytes;
+    return true;
+  }
+  bool AtEnd() const { return p_ == end_; }
+
+ private:
+  const char* p_;
+  const char* end_;
+};
+
+template <typename T>
+bool read_number(PredicateReader& in, VertexPredicate::Term& term) {
+  T x;
+  if (!in.Read(&x, sizeof(T))) {
+    return false;
+  }
+  term.ints.push_back(static_cast<int64_t>(x));
+  term.doubles.push_back(static_cast<double>(x));
+  return true;
+}
+
+// sel[i] &= (values[i] op the constants), for the column type T and the
+// constant type C; the loops over one constant vectorise
+template <typename T, typename C>
+void filter_values(const T* values, int64_t n, PredicateOp op,
+                   const std::vector<C>& consts, uint8_t* sel) {
+  const C c = consts.empty() ? C() : consts[0];
+  switch (op) {
+  case PRED_EQ:
+    for (int64_t i = 0; i < n; ++i) sel[i] &= static_cast<C>(values[i]) == c;
+    break;
+  case PRED_NE:
+    for (int64_t i = 0; i < n; ++i) sel[i] &= static_cast<C>(values[i]) != c;
+    break;
+  case PRED_LT:
+    for (int64_t i = 0; i < n; ++i) sel[i] &= static_cast<C>(values[i]) < c;
+    break;
+  case PRED_LE:
+    for (int64_t i = 0; i < n; ++i) sel[i] &= static_cast<C>(values[i]) <= c;
+    break;
+  case PRED_GT:
+    for (int64_t i = 0; i < n; ++i) sel[i] &= static_cast<C>(values[i]) > c;
+    break;
+  case PRED_GE:
+    for (int64_t i = 0; i < n; ++i) sel[i] &= static_cast<C>(values[i]) >= c;
+    break;
+  case PRED_IN:
+    if (consts.size() <= 8) {
+      for (int64_t i = 0; i < n; ++i) {
+        bool hit = false;
+        for (C x : consts) hit |= static_cast<C>(values[i]) == x;
+        sel[i] &= hit;
+      }
+    } else {
+      for (int64_t i = 0; i < n; ++i) {
+        sel[i] &= sel[i] && std::binary_search(consts.begin(), consts.end(),
+                                               static_cast<C>(values[i]));
+      }
+    }
+    break;
+  }
+}
+
+template <typename T>
+void filter_numbers(const T* values, int64_t n, const VertexPredicate::Term& term,
+                    bool floating, uint8_t* sel) {
+  if (floating || term.floating) {
+    filter_values(values, n, term.op, term.doubles, sel);
+  } else {
+    filter_values(values, n, term.op, term.ints, sel);
+  }
+}
+
+// the column of the schema property id of label in the filter's fragment
+bool get_filter_column(const VertexFilterImpl* filter, LabelId label,
+                       PropertyId id, PropertyColumn* out) {
+  GraphHandleImpl* handle = filter->handle;
+  const auto& mapping = handle->schema->VertexEntries()[label].reverse_mapping;
+  if (id < 0 || id >= static_cast<PropertyId>(mapping.size()) ||
+      mapping[id] == -1) {
+    return false;
+  }
+  return (handle->use_int64_oid
+              ? get_vertex_property_column(get_fragment(handle, filter->fid),
+                                           label, mapping[id], 0, INT64_MAX, out)
+              : get_vertex_property_column(
+                    get_string_fragment(handle, filter->fid), label,
+                    mapping[id], 0, INT64_MAX, out)) == 0;
+}
+
+// Evaluates the filter over blocks of the iterator's ranges until one has
+// a qualifying vertex; false once the ranges or the limit are exhausted.
+bool fill_filtered(GetAllVerticesIteratorImpl* iter) {
+  VertexFilterImpl* filter = iter->filter;
+  GraphHandleImpl* handle = filter->handle;
+  filter->pending.clear();
+  filter->next = 0;
+  while (filter->pending.empty() && filter->remaining > 0) {
+    while (iter->range_id != iter->range_num &&
+           iter->cur_vertex_id == iter->ranges[iter->range_id].second) {
+      if (++iter->range_id != iter->range_num) {
+        iter->cur_vertex_id = iter->ranges[iter->range_id].first;
+      }
+    }
+    if (iter->range_id == iter->range_num) {
+      return false;
+    }
+    VID_TYPE begin = iter->cur_vertex_id;
+    VID_TYPE end = std::min(iter->ranges[iter->range_id].second,
+                            begin + VertexFilterImpl::BLOCK);
+    iter->cur_vertex_id = end;
+    int64_t n = end - begin;
+    LabelId label = handle->vid_parser.GetLabelId(begin);
+    int64_t row = handle->vid_parser.GetOffset(begin);
+    filter->sel.assign(n, 1);
+    for (const auto& term : filter->predicate.terms) {
+      PropertyColumn column;
+      bool found = get_filter_column(filter, label, term.id, &column);
+      VertexPredicate::Filter(term, found ? &column : nullptr, row, n,
+                              filter->sel.data());
+    }
+    for (int64_t i = 0; i < n && filter->remaining > 0; ++i) {
+      if (filter->sel[i]) {
+        filter->pending.push_back(begin + i);
+        --filter->remaining;
+      }
+    }
+  }
+  return !filter->pending.empty();
+}
+
+}  // namespace
+
+bool VertexPredicate::Parse(const char* data, int64_t len) {
+  terms.clear();
+  PredicateReader in(data, len);
+  int32_t num_terms;
+  if (!in.Read(&num_terms, sizeof(num_terms)) || num_terms < 0) {
+    return false;
+  }
+  for (int32_t k = 0; k < num_terms; ++k) {
+    int32_t header[4];  // id, op, type, count
+    if (!in.Read(header, sizeof(header)) || header[1] < PRED_EQ ||
+        header[1] > PRED_IN || header[3] < 0 ||
+        (header[1] != PRED_IN && header[3] != 1)) {
+      return false;
+    }
+    Term term;
+    term.id = header[0];
+    term.op = static_cast<PredicateOp>(header[1]);
+    PropertyType type = static_cast<PropertyType>(header[2]);
+    term.floating = type == FLOAT || type == DOUBLE;
+    for (int32_t i = 0; i < header[3]; ++i) {
+      bool ok = false;
+      switch (type) {
+      case BOOL:
+      case CHAR:
+        ok = read_number<int8_t>(in, term);
+        break;
+      case SHORT:
+        ok = read_number<int16_t>(in, term);
+        break;
+      case INT:
+        ok = read_number<int32_t>(in, term);
+        break;
+      case LONG:
+        ok = read_number<int64_t>(in, term);
+        break;
+      case FLOAT:
+        ok = read_number<float>(in, term);
+        break;
+      case DOUBLE:
+        ok = read_number<double>(in, term);
+        break;
+      case STRING: {
+        int32_t size;
+        std::string str;
+        if (in.Read(&size, sizeof(size)) && size >= 0) {
+          str.resize(size);
+          ok = in.Read(&str[0], size);
+        }
+        term.strings.push_back(std::move(str));
+        break;
+      }
+      default:
+        break;
+      }
+      if (!ok) {
+        return false;
+      }
+    }
+    if (term.op == PRED_IN) {
+      std::sort(term.ints.begin(), term.ints.end());
+      std::sort(term.doubles.begin(), term.doubles.end());
+      std::sort(term.strings.begin(), term.strings.end());
+    }
+    terms.push_back(std::move(term));
+  }
+  return in.AtEnd();
+}
+
+void VertexPredicate::Filter(const Term& term, const PropertyColumn* column,
+                             int64_t begin, int64_t n, uint8_t* sel) {
+  if (column == nullptr || begin + n > column->length ||
+      (column->type == STRING) != !term.strings.empty() ||
+      (term.strings.empty() && term.doubles.empty())) {
+    memset(sel, 0, n);
+    return;
+  }
+  switch (column->type) {
+  case BOOL: {
+    thread_local std::vector<uint8_t> bits;
+    bits.resize(n);
+    const uint8_t* values = static_cast<const uint8_t*>(column->values);
+    for (int64_t i = 0; i < n; ++i) {
+      int64_t bit = column->bit_offset + begin + i;
+      bits[i] = (values[bit >> 3] >> (bit & 7)) & 1;
+    }
+    filter_numbers(bits.data(), n, term, false, sel);
+    break;
+  }
+  case CHAR:
+    filter_numbers(static_cast<const int8_t*>(column->values) + begin, n, term,
+                   false, sel);
+    break;
+  case SHORT:
+    filter_numbers(static_cast<const int16_t*>(column->values) + begin, n,
+                   term, false, sel);
+    break;
+  case INT:
+    filter_numbers(static_cast<const int32_t*>(column->values) + begin, n,
+                   term, false, sel);
+    break;
+  case LONG:
+    filter_numbers(static_cast<const int64_t*>(column->values) + begin, n,
+                   term, false, sel);
+    break;
+  case FLOAT:
+    filter_numbers(static_cast<const float*>(column->values) + begin, n, term,
+                   true, sel);
+    break;
+  case DOUBLE:
+    filter_numbers(static_cast<const double*>(column->values) + begin, n,
+                   term, true, sel);
+    break;
+  case STRING: {
+    const char* chars = static_cast<const char*>(column->values);
+    const std::string& c = term.strings[0];
+    for (int64_t i = 0; i < n; ++i) {
+      if (!sel[i]) {
+        continue;
+      }
+      int64_t from, to;
+      if (column->offset_width == 4) {
+        from = static_cast<const int32_t*>(column->offsets)[begin + i];
+        to = static_cast<const int32_t*>(column->offsets)[begin + i + 1];
+      } else {
+        from = static_cast<const int64_t*>(column->offsets)[begin + i];
+        to = static_cast<const int64_t*>(column->offsets)[begin + i + 1];
+      }
+      int cmp = c.compare(0, std::string::npos, chars + from, to - from);
+      // cmp compares the constant with the value, so it is reversed
+      switch (term.op) {
+      case PRED_EQ: sel[i] = cmp == 0; break;
+      case PRED_NE: sel[i] = cmp != 0; break;
+      case PRED_LT: sel[i] = cmp > 0; break;
+      case PRED_LE: sel[i] = cmp >= 0; break;
+      case PRED_GT: sel[i] = cmp < 0; break;
+      case PRED_GE: sel[i] = cmp <= 0; break;
+      case PRED_IN:
+        sel[i] = std::binary_search(term.strings.begin(), term.strings.end(),
+                                    std::string(chars + from, to - from));
+        break;
+      }
+    }
+    break;
+  }
+  default:
+    memset(sel, 0, n);
+    return;
+  }
+  if (column->validity != nullptr) {
+    for (int64_t i = 0; i < n; ++i) {
+      int64_t bit = column->bit_offset + begin + i;
+      sel[i] &= (column->validity[bit >> 3] >> (bit & 7)) & 1;
+    }
+  }
 }
 
 int get_all_vertices_next(GetAllVerticesIteratorImpl* iter, Vertex* v_out) {
+  if (iter->filter != NULL) {
+    VertexFilterImpl* filter = iter->filter;
+    if (filter->next == filter->pending.size() && !fill_filtered(iter)) {
+      return -1;
+    }
+    *v_out = (Vertex)filter->pending[filter->next++];
+    return 0;
+  }
   while (iter->range_id != iter->range_num &&
          iter->cur_vertex_id == iter->ranges[iter->range_id].second) {
     ++iter->range_id;
@@ -560,6 +1325,40 @@ int get_all_vertices_next(GetAllVerticesIteratorImpl* iter, Vertex* v_out) {
   return 0;
 }
 
+int get_all_vertices_next_batch(GetAllVerticesIteratorImpl* iter, Vertex* v_out,
+                                int capacity) {
+  int n = 0;
+  if (iter->filter != NULL) {
+    VertexFilterImpl* filter = iter->filter;
+    while (n < capacity) {
+      if (filter->next == filter->pending.size() && !fill_filtered(iter)) {
+        break;
+      }
+      size_t k = std::min<size_t>(capacity - n,
+                                  filter->pending.size() - filter->next);
+      for (size_t i = 0; i < k; ++i) {
+        v_out[n++] = (Vertex)filter->pending[filter->next++];
+      }
+    }
+    return n;
+  }
+  while (n < capacity && iter->range_id != iter->range_num) {
+    VID_TYPE end = iter->ranges[iter->range_id].second;
+    if (iter->cur_vertex_id == end) {
+      if (++iter->range_id != iter->range_num) {
+        iter->cur_vertex_id = iter->ranges[iter->range_id].first;
+      }
+      continue;
+    }
+    VID_TYPE k = std::min<VID_TYPE>(capacity - n, end - iter->cur_vertex_id);
+    for (VID_TYPE i = 0; i < k; ++i) {
+      v_out[n++] = (Vertex)(iter->cur_vertex_id + i);
+    }
+    iter->cur_vertex_id += k;
+  }
+  return n;
+}
+
 template
 void get_all_vertices(FRAGMENT_TYPE* frag, PartitionId channel_id,
                       const VID_TYPE* chunk_sizes, LabelId* labels,
@@ -607,6 +1406,23 @@ template
 int get_edge_property(STRING_FRAGMENT_TYPE* frag, LabelId label, int64_t offset,
                       PropertyId id, Property* p_out);
 
+template <typename FRAGMENT_TYPE>
+int get_edge_property_column(FRAGMENT_TYPE* frag, LabelId label,
+                             PropertyId id, int64_t begin, int64_t end,
+                             PropertyColumn* out) {
+  std::shared_ptr<arrow::Table> table = frag->edge_data_table(label);
+  return get_column_from_table(table.get(), id, begin, end, out);
+}
+
+template
+int get_edge_property_column(FRAGMENT_TYPE* frag, LabelId label,
+                             PropertyId id, int64_t begin, int64_t end,
+                             PropertyColumn* out);
+template
+int get_edge_property_column(STRING_FRAGMENT_TYPE* frag, LabelId label,
+                             PropertyId id, int64_t begin, int64_t end,
+                             PropertyColumn* out);
+
 template <typename FRAGMENT_TYPE>
 void get_edge_properties(FRAGMENT_TYPE* frag, LabelId label, int64_t offset,
                          PropertiesIteratorImpl* iter) {
@@ -645,11 +1461,29 @@ int properties_next(PropertiesIteratorImpl* iter, Property* p_out) {
 
 void free_properties_iterator(PropertiesIteratorImpl* iter) {}
 
+void init_edge_iterator(EdgeIteratorImpl* iter) {
+  iter->fragment = nullptr;
+  iter->string_fragment = nullptr;
+  iter->lists = NULL;
+  iter->list_capacity = 0;
+  empty_edge_iterator(iter);
+}
+
+// keeps the lists of the iterator, so that reusing it does not reallocate
 void empty_edge_iterator(EdgeIteratorImpl* iter) {
   iter->list_num = 0;
   iter->list_id = 0;
   iter->cur_edge = NULL;
-  iter->lists = NULL;
+}
+
+// grows the lists of iter to at least n entries, reusing them if large enough
+static void reserve_adj_lists(EdgeIteratorImpl* iter, int n) {
+  if (iter->list_capacity >= n && iter->lists != NULL) {
+    return;
+  }
+  free(iter->lists);
+  iter->lists = static_cast<AdjListUnit*>(malloc(sizeof(AdjListUnit) * n));
+  iter->list_capacity = n;
 }
 
 template <typename FRAGMENT_TYPE_T>
@@ -676,8 +1510,7 @@ void get_out_edges(FRAGMENT_TYPE_T* frag,
     size_t limit_remaining = limit;
     if (labels == NULL || labels_count == 0) {
       labels_count = frag->edge_label_num();
-      iter->lists =
-          static_cast<AdjListUnit*>(malloc(sizeof(AdjListUnit) * labels_count));
+      reserve_adj_lists(iter, labels_count);
       for (int i = 0; i < labels_count; ++i) {
         auto adj_list = frag->GetOutgoingAdjList(
             vert, (typename FRAGMENT_TYPE_T::label_id_t)i);
@@ -701,8 +1534,7 @@ void get_out_edges(FRAGMENT_TYPE_T* frag,
         }
       }
     } else {
-      iter->lists =
-          static_cast<AdjListUnit*>(malloc(sizeof(AdjListUnit) * labels_count));
+      reserve_adj_lists(iter, labels_count);
       for (int i = 0; i < labels_count; ++i) {
         if (labels[i] < 0) {
           continue;
@@ -730,8 +1562,6 @@ void get_out_edges(FRAGMENT_TYPE_T* frag,
       }
     }
     if (list_index == 0) {
-      free(iter->lists);
-      iter->lists = NULL;
       iter->list_num = 0;
       iter->cur_edge = NULL;
     } else {
@@ -739,7 +1569,6 @@ void get_out_edges(FRAGMENT_TYPE_T* frag,
       iter->cur_edge = iter->lists[0].begin;
     }
   } else {
-    iter->lists = NULL;
     iter->list_num = 0;
     iter->cur_edge = NULL;
   }
@@ -766,7 +1595,9 @@ int out_edge_next(EdgeIteratorImpl* iter, Edge* e_out) {
   while (iter->list_id != iter->list_num &&
          iter->cur_edge == iter->lists[iter->list_id].end) {
     ++iter->list_id;
-    iter->cur_edge = iter->lists[iter->list_id].begin;
+    if (iter->list_id != iter->list_num) {
+      iter->cur_edge = iter->lists[iter->list_id].begin;
+    }
   }
   if (iter->list_id == iter->list_num) {
     return -1;
@@ -813,8 +1644,7 @@ void get_in_edges(FRAGMENT_TYPE_T* frag, vineyard::IdParser<EID_TYPE>* eid_parse
     size_t limit_remaining = limit;
     if (labels == NULL || labels_count == 0) {
       labels_count = frag->edge_label_num();
-      iter->lists =
-          static_cast<AdjListUnit*>(malloc(sizeof(AdjListUnit) * labels_count));
+      reserve_adj_lists(iter, labels_count);
       for (int i = 0; i < labels_count; ++i) {
         auto adj_list = frag->GetIncomingAdjList(
             vert, (typename FRAGMENT_TYPE_T::label_id_t)i);
@@ -838,8 +1668,7 @@ void get_in_edges(FRAGMENT_TYPE_T* frag, vineyard::IdParser<EID_TYPE>* eid_parse
         }
       }
     } else {
-      iter->lists =
-          static_cast<AdjListUnit*>(malloc(sizeof(AdjListUnit) * labels_count));
+      reserve_adj_lists(iter, labels_count);
       for (int i = 0; i < labels_count; ++i) {
         if (labels[i] < 0) {
           continue;
@@ -867,8 +1696,6 @@ void get_in_edges(FRAGMENT_TYPE_T* frag, vineyard::IdParser<EID_TYPE>* eid_parse
       }
     }
     if (list_index == 0) {
-      free(iter->lists);
-      iter->lists = NULL;
       iter->list_num = 0;
       iter->cur_edge = NULL;
     } else {
@@ -876,7 +1703,6 @@ void get_in_edges(FRAGMENT_TYPE_T* frag, vineyard::IdParser<EID_TYPE>* eid_parse
       iter->cur_edge = iter->lists[0].begin;
     }
   } else {
-    iter->lists = NULL;
     iter->list_num = 0;
     iter->cur_edge = NULL;
   }
@@ -901,7 +1727,9 @@ int in_edge_next(EdgeIteratorImpl* iter, Edge* e_out) {
   while (iter->list_id != iter->list_num &&
          iter->cur_edge == iter->lists[iter->list_id].end) {
     ++iter->list_id;
-    iter->cur_edge = iter->lists[iter->list_id].begin;
+    if (iter->list_id != iter->list_num) {
+      iter->cur_edge = iter->lists[iter->list_id].begin;
+    }
   }
   if (iter->list_id == iter->list_num) {
     return -1;
@@ -925,6 +1753,520 @@ int in_edge_next(EdgeIteratorImpl* iter, Edge* e_out) {
   return 0;
 }
 
+namespace {
+
+struct EdgeSink {
+  Edge* e_out;
+
+  void operator()(int i, VID_TYPE src, VID_TYPE dst, EID_TYPE eid) {
+    e_out[i].src = src;
+    e_out[i].dst = dst;
+    e_out[i].offset = eid;
+  }
+};
+
+struct ColumnSink {
+  VertexId* srcs;
+  VertexId* dsts;
+  EdgeId* eids;
+
+  void operator()(int i, VID_TYPE src, VID_TYPE dst, EID_TYPE eid) {
+    srcs[i] = src;
+    dsts[i] = dst;
+    eids[i] = eid;
+  }
+};
+
+// Emits the edges of iter into positions [begin, end) of sink and returns the
+// position after the last one. The fragment is resolved once per call rather
+// than per edge as in out_edge_next.
+template <bool OUT, typename FRAGMENT_TYPE_T, typename SINK>
+int fill_adj_edges(EdgeIteratorImpl* iter, FRAGMENT_TYPE_T* frag, int begin,
+                   int end, SINK& sink) {
+  FRAG_ID_TYPE frag_id = frag->fid();
+  int n = begin;
+  while (n < end && iter->list_id != iter->list_num) {
+    const AdjListUnit& list = iter->lists[iter->list_id];
+    const NBR_TYPE* edge = iter->cur_edge;
+    for (; edge != list.end && n < end; ++edge, ++n) {
+      VID_TYPE nbr = frag->Vertex2Gid(VERTEX_TYPE(edge->vid));
+      EID_TYPE eid = iter->eid_parser->GenerateId(frag_id, list.label, edge->eid);
+      if (OUT) {
+        sink(n, iter->src, nbr, eid);
+      } else {
+        sink(n, nbr, iter->src, eid);
+      }
+    }
+    iter->cur_edge = edge;
+    if (edge != list.end) {
+      break;
+    }
+    ++iter->list_id;
+    if (iter->list_id != iter->list_num) {
+      iter->cur_edge = iter->lists[iter->list_id].begin;
+    }
+  }
+  return n;
+}
+
+template <bool OUT, typename SINK>
+int fill_edges(EdgeIteratorImpl* iter, int begin, int end, SINK& sink) {
+  if (iter->list_id == iter->list_num) {
+    return begin;
+  }
+  if (iter->fragment != nullptr) {
+    return fill_adj_edges<OUT>(iter, iter->fragment, begin, end, sink);
+  }
+  return fill_adj_edges<OUT>(iter, iter->string_fragment, begin, end, sink);
+}
+
+}  // namespace
+
+int out_edge_next_batch(EdgeIteratorImpl* iter, Edge* e_out, int capacity) {
+  EdgeSink sink{e_out};
+  return fill_edges<true>(iter, 0, capacity, sink);
+}
+
+int in_edge_next_batch(EdgeIteratorImpl* iter, Edge* e_out, int capacity) {
+  EdgeSink sink{e_out};
+  return fill_edges<false>(iter, 0, capacity, sink);
+}
+
+int out_edge_next_columns(EdgeIteratorImpl* iter, VertexId* srcs,
+                          VertexId* dsts, EdgeId* eids, int capacity) {
+  ColumnSink sink{srcs, dsts, eids};
+  return fill_edges<true>(iter, 0, capacity, sink);
+}
+
+int in_edge_next_columns(EdgeIteratorImpl* iter, VertexId* srcs,
+                         VertexId* dsts, EdgeId* eids, int capacity) {
+  ColumnSink sink{srcs, dsts, eids};
+  return fill_edges<false>(iter, 0, capacity, sink);
+}
+
+template <bool OUT, typename FRAGMENT_TYPE_T>
+static void get_edges_batch(FRAGMENT_TYPE_T* frag,
+                            vineyard::IdParser<EID_TYPE>* eid_parser,
+                            const VertexId* ids, int count,
+                            const char* active, LabelId* labels,
+                            int labels_count, int64_t limit,
+                            EdgeBatchImpl* out) {
+  out->vertices.resize(count);
+  out->inner.assign(count, 0);
+  if (limit != 0) {
+    for (int i = 0; i < count; ++i) {
+      if ((active == nullptr || active[i]) &&
+          frag->InnerVertexGid2Vertex((VID_TYPE)ids[i], out->vertices[i])) {
+        out->inner[i] = 1;
+      }
+    }
+  }
+  out->labels.clear();
+  if (labels == NULL || labels_count == 0) {
+    for (int i = 0; i < static_cast<int>(frag->edge_label_num()); ++i) {
+      out->labels.push_back(i);
+    }
+  } else {
+    for (int i = 0; i < labels_count; ++i) {
+      if (labels[i] >= 0) {
+        out->labels.push_back(labels[i]);
+      }
+    }
+  }
+  auto adj_list = [frag](const VERTEX_TYPE& v, LabelId label) {
+    auto l = (typename FRAGMENT_TYPE_T::label_id_t)label;
+    return OUT ? frag->GetOutgoingAdjList(v, l) : frag->GetIncomingAdjList(v, l);
+  };
+
+  // the degrees, truncated to limit in label order as get_out_edges does
+  size_t limit_per_vertex = limit;
+  std::vector<int64_t>& offsets = out->offsets;
+  offsets.assign(count + 1, 0);
+  for (LabelId label : out->labels) {
+    for (int i = 0; i < count; ++i) {
+      if (!out->inner[i]) {
+        continue;
+      }
+      auto adj = adj_list(out->vertices[i], label);
+      size_t degree = offsets[i + 1] + (adj.end_unit() - adj.begin_unit());
+      offsets[i + 1] = std::min(degree, limit_per_vertex);
+    }
+  }
+  for (int i = 0; i < count; ++i) {
+    offsets[i + 1] += offsets[i];
+  }
+  out->nbrs.resize(offsets[count]);
+  out->eids.resize(offsets[count]);
+
+  FRAG_ID_TYPE frag_id = frag->fid();
+  out->cursors.assign(offsets.begin(), offsets.end() - 1);
+  for (LabelId label : out->labels) {
+    for (int i = 0; i < count; ++i) {
+      int64_t& cursor = out->cursors[i];
+      if (!out->inner[i] || cursor == offsets[i + 1]) {
+        continue;
+      }
+      auto adj = adj_list(out->vertices[i], label);
+      for (auto e = adj.begin_unit(); e != adj.end_unit() && cursor != offsets[i + 1];
+           ++e, ++cursor) {
+        out->nbrs[cursor] = frag->Vertex2Gid(VERTEX_TYPE(e->vid));
+        out->eids[cursor] = eid_parser->GenerateId(frag_id, label, e->eid);
+      }
+    }
+  }
+}
+
+template <typename FRAGMENT_TYPE_T>
+void get_out_edges_batch(FRAGMENT_TYPE_T* frag,
+                         vineyard::IdParser<EID_TYPE>* eid_parser,
+                         const VertexId* src_ids, int count,
+                         const char* active, LabelId* labels,
+                         int labels_count, int64_t limit, EdgeBatchImpl* out) {
+  get_edges_batch<true>(frag, eid_parser, src_ids, count, active, labels,
+                        labels_count, limit, out);
+}
+
+template
+void get_out_edges_batch(FRAGMENT_TYPE* frag,
+                         vineyard::IdParser<EID_TYPE>* eid_parser,
+                         const VertexId* src_ids, int count,
+                         const char* active, LabelId* labels,
+                         int labels_count, int64_t limit, EdgeBatchImpl* out);
+template
+void get_out_edges_batch(STRING_FRAGMENT_TYPE* frag,
+                         vineyard::IdParser<EID_TYPE>* eid_parser,
+                         const VertexId* src_ids, int count,
+                         const char* active, LabelId* labels,
+                         int labels_count, int64_t limit, EdgeBatchImpl* out);
+
+template <typename FRAGMENT_TYPE_T>
+void get_in_edges_batch(FRAGMENT_TYPE_T* frag,
+                        vineyard::IdParser<EID_TYPE>* eid_parser,
+                        const VertexId* dst_ids, int count,
+                        const char* active, LabelId* labels,
+                        int labels_count, int64_t limit, EdgeBatchImpl* out) {
+  get_edges_batch<false>(frag, eid_parser, dst_ids, count, active, labels,
+                         labels_count, limit, out);
+}
+
+template
+void get_in_edges_batch(FRAGMENT_TYPE* frag,
+                        vineyard::IdParser<EID_TYPE>* eid_parser,
+                        const VertexId* dst_ids, int count,
+                        const char* active, LabelId* labels,
+                        int labels_count, int64_t limit, EdgeBatchImpl* out);
+template
+void get_in_edges_batch(STRING_FRAGMENT_TYPE* frag,
+                        vineyard::IdParser<EID_TYPE>* eid_parser,
+                        const VertexId* dst_ids, int count,
+                        const char* active, LabelId* labels,
+                        int labels_count, int64_t limit, EdgeBatchImpl* out);
+
+template <typename FRAGMENT_TYPE_T>
+void init_edge_scan(FRAGMENT_TYPE_T* frag,
+                    vineyard::IdParser<EID_TYPE>* eid_parser, LabelId* labels,
+                    int labels_count, int64_t morsel_size,
+                    EdgeScanImpl* scan) {
+  if (frag->oid_typename() == vineyard::type_name<OID_TYPE>()) {
+    scan->fragment = reinterpret_cast<FRAGMENT_TYPE *>(frag);
+    scan->string_fragment = nullptr;
+  } else {
+    scan->fragment = nullptr;
+    scan->string_fragment = reinterpret_cast<STRING_FRAGMENT_TYPE *>(frag);
+  }
+  scan->eid_parser = eid_parser;
+  scan->next = 0;
+  scan->morsels.clear();
+  std::vector<LabelId> e_labels;
+  if (labels == NULL || labels_count == 0) {
+    for (int i = 0; i < static_cast<int>(frag->edge_label_num()); ++i) {
+      e_labels.push_back(i);
+    }
+  } else {
+    for (int i = 0; i < labels_count; ++i) {
+      if (labels[i] >= 0) {
+        e_labels.push_back(labels[i]);
+      }
+    }
+  }
+  VID_TYPE step = std::max<int64_t>(morsel_size, 1);
+  for (int v_label = 0; v_label < static_cast<int>(frag->vertex_label_num());
+       ++v_label) {
+    auto range = frag->InnerVertices(v_label);
+    for (LabelId e_label : e_labels) {
+      for (VID_TYPE begin = range.begin_value(); begin < range.end_value();
+           begin += step) {
+        scan->morsels.push_back(
+            {v_label, e_label, begin, std::min(begin + step, range.end_value())});
+      }
+    }
+  }
+}
+
+template
+void init_edge_scan(FRAGMENT_TYPE* frag,
+                    vineyard::IdParser<EID_TYPE>* eid_parser, LabelId* labels,
+                    int labels_count, int64_t morsel_size,
+                    EdgeScanImpl* scan);
+template
+void init_edge_scan(STRING_FRAGMENT_TYPE* frag,
+                    vineyard::IdParser<EID_TYPE>* eid_parser, LabelId* labels,
+                    int labels_count, int64_t morsel_size,
+                    EdgeScanImpl* scan);
+
+template <typename FRAGMENT_TYPE_T>
+static void expand_morsel(FRAGMENT_TYPE_T* frag,
+                          vineyard::IdParser<EID_TYPE>* eid_parser,
+                          const EdgeMorsel& morsel, EdgeBatchImpl* out) {
+  auto label = (typename FRAGMENT_TYPE_T::label_id_t)morsel.e_label;
+  int count = morsel.end - morsel.begin;
+  std::vector<int64_t>& offsets = out->offsets;
+  offsets.resize(count + 1);
+  offsets[0] = 0;
+  for (int i = 0; i < count; ++i) {
+    auto adj = frag->GetOutgoingAdjList(VERTEX_TYPE(morsel.begin + i), label);
+    offsets[i + 1] = offsets[i] + (adj.end_unit() - adj.begin_unit());
+  }
+  out->nbrs.resize(offsets[count]);
+  out->eids.resize(offsets[count]);
+  if (count == 0) {
+    return;
+  }
+  // the lists of consecutive vertices follow each other, so this is one
+  // sequential pass over the neighbours of the morsel
+  auto first = frag->GetOutgoingAdjList(VERTEX_TYPE(morsel.begin), label);
+  FRAG_ID_TYPE frag_id = frag->fid();
+  const NBR_TYPE* e = first.begin_unit();
+  for (int64_t i = 0; i < offsets[count]; ++i, ++e) {
+    out->nbrs[i] = frag->Vertex2Gid(VERTEX_TYPE(e->vid));
+    out->eids[i] = eid_parser->GenerateId(frag_id, morsel.e_label, e->eid);
+  }
+}
+
+bool edge_scan_next(EdgeScanImpl* scan, EdgeBatchImpl* out,
+                    VertexId* first_src, LabelId* e_label) {
+  size_t id = scan->next.fetch_add(1, std::memory_order_relaxed);
+  if (id >= scan->morsels.size()) {
+    return false;
+  }
+  const EdgeMorsel& morsel = scan->morsels[id];
+  if (scan->fragment != nullptr) {
+    expand_morsel(scan->fragment, scan->eid_parser, morsel, out);
+    *first_src = scan->fragment->Vertex2Gid(VERTEX_TYPE(morsel.begin));
+  } else {
+    expand_morsel(scan->string_fragment, scan->eid_parser, morsel, out);
+    *first_src = scan->string_fragment->Vertex2Gid(VERTEX_TYPE(morsel.begin));
+  }
+  *e_label = morsel.e_label;
+  return true;
+}
+
+template <typename FRAGMENT_TYPE_T>
+int64_t sample_out_neighbor(FRAGMENT_TYPE_T* frag,
+                            vineyard::IdParser<EID_TYPE>* eid_parser,
+                            VID_TYPE src, LabelId e_label, uint64_t* state,
+                            Edge* e_out) {
+  VERTEX_TYPE v;
+  if (!frag->InnerVertexGid2Vertex(src, v)) {
+    return -1;
+  }
+  auto adj = frag->GetOutgoingAdjList(
+      v, (typename FRAGMENT_TYPE_T::label_id_t)e_label);
+  int64_t degree = adj.end_unit() - adj.begin_unit();
+  if (degree == 0) {
+    return 0;
+  }
+  auto e = adj.begin_unit() + random_below(state, degree);
+  e_out->src = src;
+  e_out->dst = frag->Vertex2Gid(VERTEX_TYPE(e->vid));
+  e_out->offset = eid_parser->GenerateId(frag->fid(), e_label, e->eid);
+  return degree;
+}
+
+template
+int64_t sample_out_neighbor(FRAGMENT_TYPE* frag,
+                            vineyard::IdParser<EID_TYPE>* eid_parser,
+                            VID_TYPE src, LabelId e_label, uint64_t* state,
+                            Edge* e_out);
+template
+int64_t sample_out_neighbor(STRING_FRAGMENT_TYPE* frag,
+                            vineyard::IdParser<EID_TYPE>* eid_parser,
+                            VID_TYPE src, LabelId e_label, uint64_t* state,
+                            Edge* e_out);
+
+template <typename FRAGMENT_TYPE_T>
+static int64_t count_label_out_edges(FRAGMENT_TYPE_T* frag, int v_label,
+                                     LabelId e_label) {
+  auto range = frag->InnerVertices(v_label);
+  if (range.begin_value() == range.end_value()) {
+    return 0;
+  }
+  auto l = (typename FRAGMENT_TYPE_T::label_id_t)e_label;
+  return frag->GetOutgoingAdjList(VERTEX_TYPE(range.end_value() - 1), l)
+             .end_unit() -
+         frag->GetOutgoingAdjList(VERTEX_TYPE(range.begin_value()), l)
+             .begin_unit();
+}
+
+template <typename FRAGMENT_TYPE_T>
+int64_t count_out_edges(FRAGMENT_TYPE_T* frag, LabelId e_label) {
+  int64_t count = 0;
+  for (int v_label = 0; v_label < static_cast<int>(frag->vertex_label_num());
+       ++v_label) {
+    count += count_label_out_edges(frag, v_label, e_label);
+  }
+  return count;
+}
+
+template
+int64_t count_out_edges(FRAGMENT_TYPE* frag, LabelId e_label);
+template
+int64_t count_out_edges(STRING_FRAGMENT_TYPE* frag, LabelId e_label);
+
+template <typename FRAGMENT_TYPE_T>
+void get_out_edge_at(FRAGMENT_TYPE_T* frag,
+                     vineyard::IdParser<EID_TYPE>* eid_parser,
+                     LabelId e_label, int64_t index, Edge* e_out) {
+  auto l = (typename FRAGMENT_TYPE_T::label_id_t)e_label;
+  for (int v_label = 0; v_label < static_cast<int>(frag->vertex_label_num());
+       ++v_label) {
+    int64_t count = count_label_out_edges(frag, v_label, e_label);
+    if (index >= count) {
+      index -= count;
+      continue;
+    }
+    auto range = frag->InnerVertices(v_label);
+    auto target =
+        frag->GetOutgoingAdjList(VERTEX_TYPE(range.begin_value()), l)
+            .begin_unit() + index;
+    // the first source whose list ends past the target
+    VID_TYPE lo = range.begin_value(), hi = range.end_value() - 1;
+    while (lo < hi) {
+      VID_TYPE mid = lo + (hi - lo) / 2;
+      if (frag->GetOutgoingAdjList(VERTEX_TYPE(mid), l).end_unit() <= target) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    e_out->src = frag->Vertex2Gid(VERTEX_TYPE(lo));
+    e_out->dst = frag->Vertex2Gid(VERTEX_TYPE(target->vid));
+    e_out->offset = eid_parser->GenerateId(frag->fid(), e_label, target->eid);
+    return;
+  }
+}
+
+template
+void get_out_edge_at(FRAGMENT_TYPE* frag,
+                     vineyard::IdParser<EID_TYPE>* eid_parser,
+                     LabelId e_label, int64_t index, Edge* e_out);
+template
+void get_out_edge_at(STRING_FRAGMENT_TYPE* frag,
+                     vineyard::IdParser<EID_TYPE>* eid_parser,
+                     LabelId e_label, int64_t index, Edge* e_out);
+
+template <typename FRAGMENT_TYPE_T>
+int has_edge(FRAGMENT_TYPE_T* frag, VID_TYPE src, VID_TYPE dst,
+             LabelId e_label) {
+  auto l = (typename FRAGMENT_TYPE_T::label_id_t)e_label;
+  VERTEX_TYPE v, other;
+  if (frag->InnerVertexGid2Vertex(src, v)) {
+    if (!frag->Gid2Vertex(dst, other)) {
+      return 0;
+    }
+    auto adj = frag->GetOutgoingAdjList(v, l);
+    for (auto e = adj.begin_unit(); e != adj.end_unit(); ++e) {
+      if (e->vid == other.GetValue()) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+  if (frag->InnerVertexGid2Vertex(dst, v)) {
+    if (!frag->Gid2Vertex(src, other)) {
+      return 0;
+    }
+    auto adj = frag->GetIncomingAdjList(v, l);
+    for (auto e = adj.begin_unit(); e != adj.end_unit(); ++e) {
+      if (e->vid == other.GetValue()) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+  return -1;
+}
+
+template
+int has_edge(FRAGMENT_TYPE* frag, VID_TYPE src, VID_TYPE dst, LabelId e_label);
+template
+int has_edge(STRING_FRAGMENT_TYPE* frag, VID_TYPE src, VID_TYPE dst,
+             LabelId e_label);
+
+template <typename FRAGMENT_TYPE_T>
+bool get_neighbor_gids(FRAGMENT_TYPE_T* frag, VID_TYPE gid, bool out,
+                       const LabelId* e_labels, int e_labels_count,
+                       std::vector<VID_TYPE>& gids) {
+  VERTEX_TYPE v;
+  if (!frag->InnerVertexGid2Vertex(gid, v)) {
+    return false;
+  }
+  int label_num = e_labels_count == 0 || e_labels == nullptr
+                      ? static_cast<int>(frag->edge_label_num())
+                      : e_labels_count;
+  for (int i = 0; i < label_num; ++i) {
+    LabelId e_label = e_labels_count == 0 || e_labels == nullptr ? i : e_labels[i];
+    if (e_label < 0) {
+      continue;
+    }
+    auto l = (typename FRAGMENT_TYPE_T::label_id_t)e_label;
+    auto adj = out ? frag->GetOutgoingAdjList(v, l) : frag->GetIncomingAdjList(v, l);
+    for (auto e = adj.begin_unit(); e != adj.end_unit(); ++e) {
+      gids.push_back(frag->Vertex2Gid(VERTEX_TYPE(e->vid)));
+    }
+  }
+  return true;
+}
+
+template
+bool get_neighbor_gids(FRAGMENT_TYPE* frag, VID_TYPE gid, bool out,
+                       const LabelId* e_labels, int e_labels_count,
+                       std::vector<VID_TYPE>& gids);
+template
+bool get_neighbor_gids(STRING_FRAGMENT_TYPE* frag, VID_TYPE gid, bool out,
+                       const LabelId* e_labels, int e_labels_count,
+                       std::vector<VID_TYPE>& gids);
+
+void intersect_sorted(std::vector<VID_TYPE>& a, std::vector<VID_TYPE>& b) {
+  for (auto* list : {&a, &b}) {
+    std::sort(list->begin(), list->end());
+    list->erase(std::unique(list->begin(), list->end()), list->end());
+  }
+  if (a.size() > b.size()) {
+    a.swap(b);
+  }
+  size_t n = 0;
+  auto from = b.begin();
+  for (VID_TYPE gid : a) {
+    // gallop to a bound past gid, then search within it
+    size_t step = 1;
+    auto hi = from;
+    while (hi != b.end() && *hi < gid) {
+      from = hi;
+      hi = static_cast<size_t>(b.end() - hi) > step ? hi + step : b.end();
+      step *= 2;
+    }
+    from = std::lower_bound(from, hi, gid);
+    if (from == b.end()) {
+      break;
+    }
+    if (*from == gid) {
+      a[n++] = gid;
+    }
+  }
+  a.resize(n);
+}
+
 template <typename FRAGMENT_TYPE_T>
 void get_all_edges(FRAGMENT_TYPE_T* frag, PartitionId channel_id,
                    const VID_TYPE* chunk_sizes,
@@ -946,13 +2288,20 @@ void get_all_edges(FRAGMENT_TYPE_T* frag, PartitionId channel_id,
     out->fragment = nullptr;
     out->string_fragment = reinterpret_cast<STRING_FRAGMENT_TYPE *>(frag);
   }
-  out->e_labels = static_cast<LabelId*>(malloc(sizeof(LabelId) * labels_count));
+  if (out->e_labels_capacity < labels_count || out->e_labels == NULL) {
+    int capacity = std::max(labels_count, 1);
+    free(out->e_labels);
+    out->e_labels = static_cast<LabelId*>(malloc(sizeof(LabelId) * capacity));
+    out->e_labels_capacity = capacity;
+  }
   out->eid_parser = eid_parser;
   memcpy(out->e_labels, labels, sizeof(LabelId) * labels_count);
   out->e_labels_count = labels_count;
 
   out->chunk_sizes = chunk_sizes;
   out->channel_id = channel_id;
+  out->index = 0;
+  out->limit = limit;
 
   out->cur_v_label = 0;
   auto super_range = frag->InnerVertices(out->cur_v_label);
@@ -974,9 +2323,6 @@ void get_all_edges(FRAGMENT_TYPE_T* frag, PartitionId channel_id,
 
   get_out_edges(frag, eid_parser, out->cur_range.first, out->e_labels,
                 out->e_labels_count, limit, &out->ei);
-
-  out->index = 0;
-  out->limit = limit;
 #ifndef NDEBUG
   LOG(INFO) << "finish " << __FUNCTION__;
 #endif
@@ -995,17 +2341,69 @@ void get_all_edges(STRING_FRAGMENT_TYPE* frag, PartitionId channel_id,
                    int labels_count, int64_t limit,
                    GetAllEdgesIteratorImpl* out);
 
-int get_all_edges_next(GetAllEdgesIteratorImpl* iter, Edge* e_out) {
+static int get_vertex_label_num(GetAllEdgesIteratorImpl* iter) {
+  if (iter->fragment != nullptr) {
+    return iter->fragment->vertex_label_num();
+  }
+  return iter->string_fragment->vertex_label_num();
+}
+
+// Points iter->ei at the next source vertex of the channel, reusing its
+// lists. Returns false once the vertices of all labels are done.
+static bool next_all_edges_source(GetAllEdgesIteratorImpl* iter) {
+  int vertex_label_num = get_vertex_label_num(iter);
+  if (iter->cur_v_label >= vertex_label_num) {
+    return false;
+  }
+  VID_TYPE cur_vid = iter->ei.src + 1;
+  if (cur_vid == iter->cur_range.second) {
+    ++iter->cur_v_label;
+    typename FRAGMENT_TYPE::vertex_range_t super_range, range;
+    while (iter->cur_v_label < vertex_label_num) {
+      if (iter->fragment != nullptr) {
+        super_range = iter->fragment->InnerVertices(iter->cur_v_label);
+      } else {
+        super_range = iter->string_fragment->InnerVertices(iter->cur_v_label);
+      }
+      range = get_sub_range<FRAGMENT_TYPE>(
+        super_range, iter->chunk_sizes[iter->cur_v_label], iter->channel_id);
+      if (range.size() == 0) {
+        ++iter->cur_v_label;
+      } else {
+        break;
+      }
+    }
+    if (iter->cur_v_label == vertex_label_num) {
 #ifndef NDEBUG
-  LOG(INFO) << "enter " << __FUNCTION__;
+      LOG(INFO) << "finish " << __FUNCTION__ << " no extra v label";
 #endif
-  FRAGMENT_TYPE::label_id_t vertex_label_num;
+      return false;
+    }
+    if (iter->fragment != nullptr) {
+      iter->cur_range.first = iter->fragment->Vertex2Gid(*range.begin());
+    } else {
+      iter->cur_range.first = iter->string_fragment->Vertex2Gid(*range.begin());
+    }
+    iter->cur_range.second = iter->cur_range.first + range.size();
+    cur_vid = iter->cur_range.first;
+  }
+
   if (iter->fragment != nullptr) {
-    vertex_label_num = iter->fragment->vertex_label_num();
+    get_out_edges<FRAGMENT_TYPE>(iter->fragment, iter->eid_parser, cur_vid, iter->e_labels,
+                  iter->e_labels_count, iter->limit, &iter->ei);
   } else {
-    vertex_label_num = iter->string_fragment->vertex_label_num();
+    get_out_edges<STRING_FRAGMENT_TYPE>(iter->string_fragment, iter->eid_parser, cur_vid,
+                  iter->e_labels, iter->e_labels_count, iter->limit,
+                  &iter->ei);
   }
-  if (iter->cur_v_label >= static_cast<int>(vertex_label_num)) {
+  return true;
+}
+
+int get_all_edges_next(GetAllEdgesIteratorImpl* iter, Edge* e_out) {
+#ifndef NDEBUG
+  LOG(INFO) << "enter " << __FUNCTION__;
+#endif
+  if (iter->cur_v_label >= get_vertex_label_num(iter)) {
     return -1;
   }
   if (iter->index == iter->limit) {
@@ -1023,54 +2421,44 @@ int get_all_edges_next(GetAllEdgesIteratorImpl* iter, Edge* e_out) {
       ++iter->index;
       return 0;
     }
-
-    VID_TYPE cur_vid = iter->ei.src + 1;
-    if (cur_vid == iter->cur_range.second) {
-      ++iter->cur_v_label;
-      typename FRAGMENT_TYPE::vertex_range_t super_range, range;
-      while (iter->cur_v_label < vertex_label_num) {
-        if (iter->fragment != nullptr) {
-          super_range = iter->fragment->InnerVertices(iter->cur_v_label);
-        } else {
-          super_range = iter->string_fragment->InnerVertices(iter->cur_v_label);
-        }
-        range = get_sub_range<FRAGMENT_TYPE>(
-          super_range, iter->chunk_sizes[iter->cur_v_label], iter->channel_id);
-        if (range.size() == 0) {
-          ++iter->cur_v_label;
-        } else {
-          break;
-        }
-      }
-      if (iter->cur_v_label == vertex_label_num) {
-#ifndef NDEBUG
-        LOG(INFO) << "finish " << __FUNCTION__ << " no extra v label";
-#endif
-        return -1;
-      }
-      if (iter->fragment != nullptr) {
-        iter->cur_range.first = iter->fragment->Vertex2Gid(*range.begin());
-      } else {
-        iter->cur_range.first = iter->string_fragment->Vertex2Gid(*range.begin());
-      }
-      iter->cur_range.first = iter->fragment->Vertex2Gid(*range.begin());
-      iter->cur_range.second = iter->cur_range.first + range.size();
-      cur_vid = iter->cur_range.first;
+    if (!next_all_edges_source(iter)) {
+      return -1;
     }
+  }
+}
 
-    free_edge_iterator(&iter->ei);
-    if (iter->fragment != nullptr) {
-      get_out_edges<FRAGMENT_TYPE>(iter->fragment, iter->eid_parser, cur_vid, iter->e_labels,
-                    iter->e_labels_count, iter->limit, &iter->ei);
-    } else {
-      get_out_edges<STRING_FRAGMENT_TYPE>(iter->string_fragment, iter->eid_parser, cur_vid,
-                    iter->e_labels, iter->e_labels_count, iter->limit,
-                    &iter->ei);
+template <typename SINK>
+static int fill_all_edges(GetAllEdgesIteratorImpl* iter, int capacity,
+                          SINK& sink) {
+  if (iter->cur_v_label >= get_vertex_label_num(iter)) {
+    return 0;
+  }
+  int end = capacity;
+  if (iter->limit >= 0) {
+    end = static_cast<int>(
+        std::min<int64_t>(end, iter->limit - iter->index));
+  }
+  int n = 0;
+  while (n < end) {
+    n = fill_edges<true>(&iter->ei, n, end, sink);
+    if (n == end || !next_all_edges_source(iter)) {
+      break;
     }
   }
-#ifndef NDEBUG
-  LOG(INFO) << "finish " << __FUNCTION__;
-#endif
+  iter->index += n;
+  return n;
+}
+
+int get_all_edges_next_batch(GetAllEdgesIteratorImpl* iter, Edge* e_out,
+                             int capacity) {
+  EdgeSink sink{e_out};
+  return fill_all_edges(iter, capacity, sink);
+}
+
+int get_all_edges_next_columns(GetAllEdgesIteratorImpl* iter, VertexId* srcs,
+                               VertexId* dsts, EdgeId* eids, int capacity) {
+  ColumnSink sink{srcs, dsts, eids};
+  return fill_all_edges(iter, capacity, sink);
 }
 
 void free_edge_iterator(EdgeIteratorImpl* iter) {
@@ -1078,6 +2466,14 @@ void free_edge_iterator(EdgeIteratorImpl* iter) {
     free(iter->lists);
     iter->lists = NULL;
   }
+  iter->list_capacity = 0;
+}
+
+void init_get_all_edges_iterator(GetAllEdgesIteratorImpl* iter) {
+  iter->e_labels = NULL;
+  iter->e_labels_count = 0;
+  iter->e_labels_capacity = 0;
+  init_edge_iterator(&iter->ei);
 }
 
 void free_get_all_edges_iterator(GetAllEdgesIteratorImpl* iter) {
@@ -1085,6 +2481,7 @@ void free_get_all_edges_iterator(GetAllEdgesIteratorImpl* iter) {
     free(iter->e_labels);
     iter->e_labels = NULL;
   }
+  iter->e_labels_capacity = 0;
   free_edge_iterator(&iter->ei);
 }
 
@@ -16,11 +16,19 @@
 #ifndef ANALYTICAL_ENGINE_HTAP_HTAP_DS_IMPL_H_
 #define ANALYTICAL_ENGINE_HTAP_HTAP_DS_IMPL_H_
 
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "vineyard/client/client.h"
 #include "vineyard/graph/fragment/arrow_fragment.h"
 
+#include "compact_vertex_map.h"
 #include "global_store_ffi.h"
 #include "graph_schema.h"
 
@@ -43,14 +51,129 @@ using EID_TYPE = typename FRAGMENT_TYPE::eid_t;
 using VERTEX_RANGE_TYPE = std::pair<VID_TYPE, VID_TYPE>;
 using VERTEX_TYPE = typename FRAGMENT_TYPE::vertex_t;
 
+// A small LRU of (label, outer id) -> gid for hot ids, shared by the threads
+// using a handle. The vertex map looks an outer id up in the hash map of
+// every fragment in turn, which this saves for repeated lookups.
+template <typename OID_T>
+class GidCache {
+ public:
+  explicit GidCache(size_t capacity) : capacity_(capacity) {}
+
+  bool Get(LabelId label, const OID_T& oid, VID_TYPE& gid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(Key(label, oid));
+    if (it == index_.end()) {
+      return false;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    gid = it->second->second;
+    return true;
+  }
+
+  void Put(LabelId label, const OID_T& oid, VID_TYPE gid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Key key(label, oid);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      it->second->second = gid;
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return;
+    }
+    entries_.emplace_front(key, gid);
+    index_.emplace(key, entries_.begin());
+    if (entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+ private:
+  using Key = std::pair<LabelId, OID_T>;
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<OID_T>()(key.second) * 31 + key.first;
+    }
+  };
+
+  size_t capacity_;
+  std::mutex mutex_;
+  std::list<std::pair<Key, VID_TYPE>> entries_;
+  std::unordered_map<Key, typename std::list<std::pair<Key, VID_TYPE>>::iterator,
+                     KeyHash>
+      index_;
+};
+
+const size_t GID_CACHE_CAPACITY = 1 << 16;
+
+// log2 buckets of the degree histograms: bucket 0 holds the vertices of
+// degree 0 and bucket b > 0 those of degree in [2^(b-1), 2^b)
+const int DEGREE_HISTOGRAM_BUCKETS = 40;
+
+// Counts over the inner vertices of one fragment and the edges leaving
+// them, computed when the handle is loaded and cached in vineyard metadata,
+// so that later loads of the graph skip the scan.
+struct GraphStatistics {
+  int vertex_label_num = 0;
+  int edge_label_num = 0;
+  std::vector<int64_t> vertex_counts;  // vertex label ->
+  std::vector<int64_t> edge_counts;    // edge label ->
+  // (src label * edge_label_num + edge label) * vertex_label_num + dst label
+  std::vector<int64_t> triple_counts;
+  // (vertex label * edge_label_num + edge label) * DEGREE_HISTOGRAM_BUCKETS
+  // + bucket
+  std::vector<int64_t> out_degrees;
+  std::vector<int64_t> in_degrees;
+
+  void Init(int vertex_label_num, int edge_label_num);
+  void Add(const GraphStatistics& other);
+  void AddDegree(std::vector<int64_t>& histogram, LabelId v_label,
+                 LabelId e_label, int64_t degree);
+  bool Empty() const { return vertex_counts.empty(); }
+
+  void ToJSON(vineyard::json& tree) const;
+  // false if the tree doesn't hold statistics of the label numbers
+  bool FromJSON(const vineyard::json& tree, int vertex_label_num,
+                int edge_label_num);
+};
+
+// The channel of a vertex is its offset divided by the chunk size of its
+// fragment and label. The division is a multiplication by a precomputed
+// reciprocal, which is exact for the offsets below 2^32 (Lemire's fastdiv);
+// larger offsets fall back to the division.
+struct PartitionDivisor {
+  VID_TYPE inner_size = 0;
+  VID_TYPE chunk_size = 0;
+  uint64_t reciprocal = 0;  // floor(2^64 / chunk_size) + 1, 0 if it wraps
+
+  void Init(VID_TYPE ivnum, VID_TYPE chunk) {
+    inner_size = ivnum;
+    chunk_size = chunk;
+    reciprocal = chunk == 0 ? 0 : UINT64_MAX / chunk + 1;
+  }
+
+  VID_TYPE Divide(VID_TYPE offset) const {
+    if ((offset >> 32) != 0 || reciprocal == 0) {
+      return offset / chunk_size;
+    }
+    return static_cast<VID_TYPE>(
+        (static_cast<unsigned __int128>(reciprocal) * offset) >> 64);
+  }
+};
+
 struct GraphHandleImpl {
   vineyard::Client* client = nullptr;
+  ObjectId object_id;
 
   bool use_int64_oid = true;
   bool use_string_oid = false;
 
+  // [fnum], each constructed on first use: get_fragment and
+  // get_string_fragment, not these, are read
   FRAGMENT_TYPE* fragments = nullptr;
   STRING_FRAGMENT_TYPE* string_fragments = nullptr;
+  // [fnum], InvalidObjectID for the fragments that aren't local
+  vineyard::ObjectID* fragment_ids = nullptr;
+  std::once_flag* fragment_once = nullptr;
   VERTEX_MAP_TYPE* vertex_map = nullptr;
   STRING_VERTEX_MAP_TYPE* string_vertex_map = nullptr;
 
@@ -65,17 +188,145 @@ struct GraphHandleImpl {
 
   PartitionId channel_num;
   VID_TYPE** vertex_chunk_sizes = nullptr;
+  // [fnum * vertex_label_num], for resolving partitions without the vertex map
+  PartitionDivisor* partition_divisors = nullptr;
+  // the inner vertices numbered densely, label by label, fragment by
+  // fragment, those of fragment f of label l from [l * fnum + f]: the outer
+  // ids handed out for string oids and the indices of the compact vertex
+  // maps; [vertex_label_num * fnum + 1]
+  int64_t* dense_oid_offsets = nullptr;
+  // [vertex_label_num], with V6D_COMPACT_VERTEX_MAP=1: the oids of each label
+  // to their dense numbers less that of the label's first vertex, looked up
+  // in place of the vertex map
+  CompactVertexMap<VERTEX_MAP_TYPE::oid_t>* compact_vertex_maps = nullptr;
+  CompactVertexMap<STRING_VERTEX_MAP_TYPE::oid_t>* string_compact_vertex_maps =
+      nullptr;
+
+  GidCache<OID_TYPE>* gid_cache = nullptr;
+  GidCache<STRING_OID_TYPE>* string_gid_cache = nullptr;
+
+  // [fnum], only the local fragments filled, on first use: get_statistics
+  GraphStatistics* statistics = nullptr;
+  std::once_flag* statistics_once = nullptr;
 };
 
 inline int get_edge_partition_id(EID_TYPE id, GraphHandleImpl* handle) {
   return handle->eid_parser.GetFid(id);
 }
 
+// The partition of gid, or -1 if it is no vertex of the graph.
+inline PartitionId get_partition_id(const GraphHandleImpl* handle,
+                                    VID_TYPE gid) {
+  auto fid = handle->vid_parser.GetFid(gid);
+  LabelId label_id = handle->vid_parser.GetLabelId(gid);
+  VID_TYPE offset = handle->vid_parser.GetOffset(gid);
+  if (fid >= handle->fnum || label_id < 0 ||
+      label_id >= handle->vertex_label_num) {
+    return -1;
+  }
+  const PartitionDivisor& divisor =
+      handle->partition_divisors[static_cast<size_t>(fid) *
+                                     handle->vertex_label_num + label_id];
+  if (offset >= divisor.inner_size) {
+    return -1;
+  }
+  return fid * handle->channel_num +
+         static_cast<PartitionId>(divisor.Divide(offset));
+}
+
+// The dense outer id of gid on a graph of string oids, or -1 if it is no
+// inner vertex of the graph.
+inline OuterId get_dense_outer_id(const GraphHandleImpl* handle,
+                                  VID_TYPE gid) {
+  auto fid = handle->vid_parser.GetFid(gid);
+  LabelId label_id = handle->vid_parser.GetLabelId(gid);
+  VID_TYPE offset = handle->vid_parser.GetOffset(gid);
+  if (fid >= handle->fnum || label_id < 0 ||
+      label_id >= handle->vertex_label_num) {
+    return -1;
+  }
+  const int64_t* range =
+      handle->dense_oid_offsets + static_cast<size_t>(label_id) * handle->fnum
+      + fid;
+  if (static_cast<int64_t>(offset) >= range[1] - range[0]) {
+    return -1;
+  }
+  return range[0] + offset;
+}
+
+// The vertex of label_id with the dense outer id outer_id on a graph of
+// string oids; false if there is none.
+inline bool get_dense_outer_id_gid(const GraphHandleImpl* handle,
+                                   LabelId label_id, OuterId outer_id,
+                                   VID_TYPE* gid) {
+  if (label_id < 0 || label_id >= handle->vertex_label_num) {
+    return false;
+  }
+  const int64_t* begin =
+      handle->dense_oid_offsets + static_cast<size_t>(label_id) * handle->fnum;
+  const int64_t* end = begin + handle->fnum;
+  if (outer_id < begin[0] || outer_id >= end[0]) {
+    return false;
+  }
+  // the last fragment starting at or before outer_id
+  const int64_t* range = std::upper_bound(begin, end, outer_id) - 1;
+  *gid = handle->vid_parser.GenerateId(static_cast<FRAG_ID_TYPE>(range - begin),
+                                       label_id, outer_id - range[0]);
+  return true;
+}
+
+// The gid of oid of label through the compact vertex maps, the probe
+// checked against the oid read back from the vertex map.
+template <typename VERTEX_MAP_T>
+bool get_compact_gid(
+    const GraphHandleImpl* handle, VERTEX_MAP_T* vertex_map,
+    const CompactVertexMap<typename VERTEX_MAP_T::oid_t>* maps,
+    LabelId label_id, const typename VERTEX_MAP_T::oid_t& oid, VID_TYPE* gid) {
+  if (label_id < 0 || label_id >= handle->vertex_label_num) {
+    return false;
+  }
+  int64_t index = maps[label_id].Find(oid);
+  VID_TYPE candidate;
+  typename VERTEX_MAP_T::oid_t found;
+  if (index < 0 ||
+      !get_dense_outer_id_gid(
+          handle, label_id,
+          handle->dense_oid_offsets[static_cast<size_t>(label_id) *
+                                    handle->fnum] + index,
+          &candidate) ||
+      !vertex_map->GetOid(candidate, found) || !(found == oid)) {
+    return false;
+  }
+  *gid = candidate;
+  return true;
+}
+
 void get_graph_handle(ObjectId id, PartitionId channel_num,
                       GraphHandleImpl* handle);
 
 void free_graph_handle(GraphHandleImpl* handle);
 
+// Fragment fid of the graph, constructed by the first call.
+FRAGMENT_TYPE* get_fragment(GraphHandleImpl* handle, FRAG_ID_TYPE fid);
+
+STRING_FRAGMENT_TYPE* get_string_fragment(GraphHandleImpl* handle,
+                                          FRAG_ID_TYPE fid);
+
+// The statistics of fragment fid, loaded or computed by the first call;
+// nullptr if the fragment isn't local.
+const GraphStatistics* get_statistics(GraphHandleImpl* handle,
+                                      FRAG_ID_TYPE fid);
+
+// Resolves count (label, outer id) pairs to gids, found[i] telling whether
+// gids[i] is set. The pairs are sorted so that duplicates are looked up once,
+// and each label's ids are looked up one fragment at a time, so that one
+// hash map of the vertex map stays hot. Returns the number found.
+template <typename VERTEX_MAP_T>
+int get_gids(VERTEX_MAP_T* vertex_map, FRAG_ID_TYPE fnum,
+             const LabelId* labels,
+             const typename VERTEX_MAP_T::oid_t* oids, int count,
+             VID_TYPE* gids, char* found);
+
 struct GetVertexIteratorImpl {
   VID_TYPE* ids;
   int count;
@@ -90,12 +341,54 @@ void free_get_vertex_iterator(GetVertexIteratorImpl* iter);
 
 int get_vertices_next(GetVertexIteratorImpl* iter, Vertex* v_out);
 
+// A conjunction of comparisons of vertex properties with constants, in the
+// serialised form of v6d_get_all_vertices_where, evaluated a block of rows
+// of one label at a time over the Arrow columns.
+struct VertexPredicate {
+  struct Term {
+    PropertyId id;  // as in the schema
+    PredicateOp op;
+    bool floating;  // whether the constants are FLOAT or DOUBLE
+    // the constants: ints of the integral and BOOL ones, doubles of every
+    // numeric one and strings of STRING ones, each sorted for PRED_IN
+    std::vector<int64_t> ints;
+    std::vector<double> doubles;
+    std::vector<std::string> strings;
+  };
+  std::vector<Term> terms;
+
+  // false if data is not a well-formed predicate
+  bool Parse(const char* data, int64_t len);
+
+  // Clears sel[i], i < n, for the rows begin + i of column that fail term;
+  // column is the view of the term's property of the label over all its
+  // rows, null if the label has no such property.
+  static void Filter(const Term& term, const PropertyColumn* column,
+                     int64_t begin, int64_t n, uint8_t* sel);
+};
+
+// The filter of a v6d_get_all_vertices_where iterator: the qualifying gids
+// of the block last evaluated, handed out before the next one is.
+struct VertexFilterImpl {
+  static const VID_TYPE BLOCK = 4096;
+
+  GraphHandleImpl* handle = nullptr;
+  FRAG_ID_TYPE fid = 0;
+  VertexPredicate predicate;
+  int64_t remaining = 0;  // of the limit
+  std::vector<VID_TYPE> pending;
+  size_t next = 0;
+  std::vector<uint8_t> sel;
+};
+
 struct GetAllVerticesIteratorImpl {
   VERTEX_RANGE_TYPE* ranges;
   int range_num;
   int range_id;
 
   VID_TYPE cur_vertex_id;
+  // set by v6d_get_all_vertices_where, null otherwise
+  VertexFilterImpl* filter;
 };
 
 template <typename FRAGMENT_TYPE>
@@ -108,6 +401,10 @@ void free_get_all_vertices_iterator(GetAllVerticesIteratorImpl* iter);
 
 int get_all_vertices_next(GetAllVerticesIteratorImpl* iter, Vertex* v_out);
 
+// Up to capacity vertices of the iterator into v_out, the number written.
+int get_all_vertices_next_batch(GetAllVerticesIteratorImpl* iter, Vertex* v_out,
+                                int capacity);
+
 struct PropertiesIteratorImpl {
   GraphHandleImpl* handle;
   arrow::Table* table;
@@ -121,6 +418,14 @@ struct PropertiesIteratorImpl {
 template <typename FRAGMENT_TYPE>
 typename FRAGMENT_TYPE::oid_t get_outer_id(FRAGMENT_TYPE* frag, Vertex v);
 
+// A view of rows [begin, end) of a column of the vertex table of label,
+// clamped to the rows of the table; -1 for columns of other types than
+// those of Property.
+template <typename FRAGMENT_TYPE>
+int get_vertex_property_column(FRAGMENT_TYPE* frag, LabelId label,
+                               PropertyId id, int64_t begin, int64_t end,
+                               PropertyColumn* out);
+
 template <typename FRAGMENT_TYPE>
 int get_vertex_property(FRAGMENT_TYPE* frag, Vertex v, PropertyId id,
                         Property* p_out);
@@ -146,11 +451,15 @@ struct EdgeIteratorImpl {
   int64_t src;
   AdjListUnit* lists;
   int list_num;
+  int list_capacity;  // entries allocated in lists, kept when reused
 
   int list_id;
   const NBR_TYPE* cur_edge;
 };
 
+// a freshly allocated iterator, without lists yet
+void init_edge_iterator(EdgeIteratorImpl* iter);
+
 void empty_edge_iterator(EdgeIteratorImpl* iter);
 
 template <typename FRAGMENT_TYPE>
@@ -168,12 +477,145 @@ void get_in_edges(FRAGMENT_TYPE* frag, vineyard::IdParser<EID_TYPE>* eid_parser,
 
 int in_edge_next(EdgeIteratorImpl* iter, Edge* e_out);
 
+// Write up to capacity edges per call and return how many, 0 once the
+// iterator is exhausted. The columns forms write sources, destinations and
+// edge ids (as in Edge::offset) into separate arrays instead.
+int out_edge_next_batch(EdgeIteratorImpl* iter, Edge* e_out, int capacity);
+int in_edge_next_batch(EdgeIteratorImpl* iter, Edge* e_out, int capacity);
+int out_edge_next_columns(EdgeIteratorImpl* iter, VertexId* srcs,
+                          VertexId* dsts, EdgeId* eids, int capacity);
+int in_edge_next_columns(EdgeIteratorImpl* iter, VertexId* srcs,
+                         VertexId* dsts, EdgeId* eids, int capacity);
+
+// The edges of many vertices at once, as a CSR: those of ids[i] are
+// [offsets[i], offsets[i + 1]) of nbrs and eids, in the order get_out_edges
+// and get_in_edges return them and with limit applying per vertex. The
+// buffers are kept across calls.
+struct EdgeBatchImpl {
+  std::vector<int64_t> offsets;
+  std::vector<VertexId> nbrs;
+  std::vector<EdgeId> eids;
+
+  // scratch
+  std::vector<VERTEX_TYPE> vertices;
+  std::vector<char> inner;
+  std::vector<LabelId> labels;
+  std::vector<int64_t> cursors;
+};
+
+// Resolves the gids in bulk and walks the adjacency lists of the fragment
+// one label at a time over all vertices, instead of all labels per vertex.
+// Vertices not inner to frag, or with active[i] false if active is given,
+// have no edges.
+template <typename FRAGMENT_TYPE>
+void get_out_edges_batch(FRAGMENT_TYPE* frag,
+                         vineyard::IdParser<EID_TYPE>* eid_parser,
+                         const VertexId* src_ids, int count,
+                         const char* active, LabelId* labels,
+                         int labels_count, int64_t limit, EdgeBatchImpl* out);
+
+template <typename FRAGMENT_TYPE>
+void get_in_edges_batch(FRAGMENT_TYPE* frag,
+                        vineyard::IdParser<EID_TYPE>* eid_parser,
+                        const VertexId* dst_ids, int count,
+                        const char* active, LabelId* labels,
+                        int labels_count, int64_t limit, EdgeBatchImpl* out);
+
+// A full scan of the out edges of a fragment, split into morsels of up to
+// morsel_size consecutive inner vertices of one (vertex label, edge label)
+// pair. Workers claim morsels through an atomic cursor, each expanding its
+// morsel into an EdgeBatchImpl of its own; the adjacency lists of a morsel
+// are contiguous in the fragment.
+struct EdgeMorsel {
+  int v_label;
+  LabelId e_label;
+  VID_TYPE begin;  // local vertex ids
+  VID_TYPE end;
+};
+
+struct EdgeScanImpl {
+  FRAGMENT_TYPE* fragment = nullptr;
+  STRING_FRAGMENT_TYPE* string_fragment = nullptr;
+  vineyard::IdParser<EID_TYPE>* eid_parser;
+
+  std::vector<EdgeMorsel> morsels;
+  std::atomic<size_t> next{0};
+};
+
+// labels as in get_out_edges, all of them if none are given
+template <typename FRAGMENT_TYPE>
+void init_edge_scan(FRAGMENT_TYPE* frag,
+                    vineyard::IdParser<EID_TYPE>* eid_parser, LabelId* labels,
+                    int labels_count, int64_t morsel_size,
+                    EdgeScanImpl* scan);
+
+// Claims the next morsel and writes its edges to out, whose sources are the
+// consecutive vertex ids from *first_src. Thread-safe; false once all
+// morsels are claimed.
+bool edge_scan_next(EdgeScanImpl* scan, EdgeBatchImpl* out,
+                    VertexId* first_src, LabelId* e_label);
+
+// Uniform samplers for online estimation (WanderJoin, JSUB): the random
+// state is the caller's, one per thread, advanced by splitmix64.
+inline uint64_t next_random(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// uniform in [0, n) by a multiply-shift, biased by at most n / 2^64
+inline uint64_t random_below(uint64_t* state, uint64_t n) {
+  return static_cast<uint64_t>(
+      (static_cast<unsigned __int128>(next_random(state)) * n) >> 64);
+}
+
+// Samples one of the e_label out edges of the gid src uniformly into *e_out
+// and returns the out degree on e_label, i.e. the inverse of the sample's
+// probability. 0 if there are none, leaving *e_out untouched, and -1 if src
+// is no inner vertex of frag.
+template <typename FRAGMENT_TYPE>
+int64_t sample_out_neighbor(FRAGMENT_TYPE* frag,
+                            vineyard::IdParser<EID_TYPE>* eid_parser,
+                            VID_TYPE src, LabelId e_label, uint64_t* state,
+                            Edge* e_out);
+
+// The number of e_label out edges of the inner vertices of frag, from the
+// bounds of its adjacency arrays, which are contiguous per vertex label.
+template <typename FRAGMENT_TYPE>
+int64_t count_out_edges(FRAGMENT_TYPE* frag, LabelId e_label);
+
+// The index-th of those edges in the order of the edge scan (vertex label,
+// then source), found by a binary search over the sources' list bounds.
+template <typename FRAGMENT_TYPE>
+void get_out_edge_at(FRAGMENT_TYPE* frag,
+                     vineyard::IdParser<EID_TYPE>* eid_parser,
+                     LabelId e_label, int64_t index, Edge* e_out);
+
+// Whether the fragment has an e_label edge from the gid src to the gid dst:
+// 1 or 0, scanning the out list of src if it is an inner vertex, else the in
+// list of dst, for the local id of the other end; -1 if neither is inner.
+template <typename FRAGMENT_TYPE>
+int has_edge(FRAGMENT_TYPE* frag, VID_TYPE src, VID_TYPE dst, LabelId e_label);
+
+// Appends the gids of the out (or in) neighbours of the inner vertex gid over
+// the e_labels (all if none) to gids; false if it is no inner vertex of frag.
+template <typename FRAGMENT_TYPE>
+bool get_neighbor_gids(FRAGMENT_TYPE* frag, VID_TYPE gid, bool out,
+                       const LabelId* e_labels, int e_labels_count,
+                       std::vector<VID_TYPE>& gids);
+
+// Sorts and dedups a and b and intersects them into a by galloping from the
+// shorter one, so a skewed pair costs about the shorter times log the longer.
+void intersect_sorted(std::vector<VID_TYPE>& a, std::vector<VID_TYPE>& b);
+
 struct GetAllEdgesIteratorImpl {
   FRAGMENT_TYPE* fragment = nullptr;
   STRING_FRAGMENT_TYPE* string_fragment = nullptr;
   LabelId* e_labels;
   vineyard::IdParser<EID_TYPE>* eid_parser;
   int e_labels_count;
+  int e_labels_capacity;  // entries allocated in e_labels, kept when reused
 
   int cur_v_label;
   VERTEX_RANGE_TYPE cur_range;
@@ -187,6 +629,11 @@ struct GetAllEdgesIteratorImpl {
   int64_t limit;
 };
 
+// a freshly allocated iterator, without labels or lists yet
+void init_get_all_edges_iterator(GetAllEdgesIteratorImpl* iter);
+
+// Points iter, initialised or used before, at the edges of the channel,
+// reusing its labels and lists.
 template <typename FRAGMENT_TYPE>
 void get_all_edges(FRAGMENT_TYPE* frag, PartitionId channel_id,
                    const VID_TYPE* chunk_sizes,
@@ -196,6 +643,11 @@ void get_all_edges(FRAGMENT_TYPE* frag, PartitionId channel_id,
 
 int get_all_edges_next(GetAllEdgesIteratorImpl* iter, Edge* e_out);
 
+int get_all_edges_next_batch(GetAllEdgesIteratorImpl* iter, Edge* e_out,
+                             int capacity);
+int get_all_edges_next_columns(GetAllEdgesIteratorImpl* iter, VertexId* srcs,
+                               VertexId* dsts, EdgeId* eids, int capacity);
+
 void free_edge_iterator(EdgeIteratorImpl* iter);
 
 void free_get_all_edges_iterator(GetAllEdgesIteratorImpl* iter);
@@ -207,6 +659,12 @@ template <typename FRAGMENT_TYPE>
 int get_edge_property(FRAGMENT_TYPE* frag, LabelId label, int64_t offset,
                       PropertyId id, Property* p_out);
 
+// As get_vertex_property_column, over the edge table of label.
+template <typename FRAGMENT_TYPE>
+int get_edge_property_column(FRAGMENT_TYPE* frag, LabelId label,
+                             PropertyId id, int64_t begin, int64_t end,
+                             PropertyColumn* out);
+
 template <typename FRAGMENT_TYPE>
 void get_edge_properties(FRAGMENT_TYPE* frag, LabelId label, int64_t offset,
                          PropertiesIteratorImpl* iter);
@@ -14,9 +14,12 @@
  * limitations under the License.
  */
 #include <stdio.h>
+#include <sys/stat.h>
 
+#include <algorithm>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "glog/logging.h"
 
@@ -37,6 +40,8 @@ struct htap_loader_options {
   std::vector<std::string> vfiles;
   int directed;
   int generate_eid;
+  // > 0: load the edges in stages of about this many MB, see load_in_stages
+  int64_t memory_budget_mb = 0;
 };
 
 namespace detail {
@@ -57,6 +62,9 @@ bool parse_options_from_args(struct htap_loader_options &options, int current_in
   if (argc > current_index) {
     options.generate_eid = atoi(argv[current_index++]);
   }
+  if (argc > current_index) {
+    options.memory_budget_mb = atoll(argv[current_index++]);
+  }
   return true;
 }
 
@@ -106,14 +114,126 @@ bool parse_options_from_config_json(struct htap_loader_options &options, std::st
       options.generate_eid = config["generate_eid"].get<std::string>() == "true";
     }
   }
+  if (config.contains("memory_budget_mb")) {
+    options.memory_budget_mb = config["memory_budget_mb"].get<int64_t>();
+  }
   return true;
 }
 
+// arrow tables and CSR take a few times the size of their text input
+const int64_t LOADED_BYTES_PER_FILE_BYTE = 3;
+
+// the memory a file is estimated to take once loaded, from its size on disk;
+// files of unknown size (not local, or directories) count as the whole budget
+int64_t estimated_load_bytes(std::string const &file, int64_t budget) {
+  std::string path = file.substr(0, file.find('#'));
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return budget;
+  }
+  return st.st_size * LOADED_BYTES_PER_FILE_BYTE;
+}
+
+// The edge files in consecutive stages, each estimated to fit the budget
+// and with at least one file, in their order so that the edge labels keep
+// their ids. All workers must agree on the stages, so the estimates are
+// the maxima over the workers.
+std::vector<std::vector<std::string>> stages_by_budget(
+    grape::CommSpec const &comm_spec, std::vector<std::string> const &efiles,
+    int64_t budget) {
+  std::vector<int64_t> sizes(efiles.size());
+  for (size_t i = 0; i < efiles.size(); ++i) {
+    sizes[i] = estimated_load_bytes(efiles[i], budget);
+  }
+  MPI_Allreduce(MPI_IN_PLACE, sizes.data(), sizes.size(), MPI_INT64_T, MPI_MAX,
+                comm_spec.comm());
+  std::vector<std::vector<std::string>> stages;
+  int64_t stage_bytes = 0;
+  for (size_t i = 0; i < efiles.size(); ++i) {
+    if (stages.empty() || stage_bytes + sizes[i] > budget) {
+      stages.emplace_back();
+      stage_bytes = 0;
+    }
+    stages.back().push_back(efiles[i]);
+    stage_bytes += sizes[i];
+  }
+  return stages;
+}
+
+using loader_t = vineyard::ArrowFragmentLoader<
+    vineyard::property_graph_types::OID_TYPE,
+    vineyard::property_graph_types::VID_TYPE>;
+
+vineyard::ObjectID load_at_once(vineyard::Client &client,
+                                grape::CommSpec const &comm_spec,
+                                struct htap_loader_options const &options,
+                                std::vector<std::string> const &efiles) {
+  auto loader = std::make_unique<loader_t>(
+      client, comm_spec, efiles, options.vfiles, options.directed != 0,
+      options.generate_eid != 0);
+  return boost::leaf::try_handle_all(
+      [&]() { return loader->LoadFragmentAsFragmentGroup(); },
+      [](const boost::leaf::error_info &unmatched) {
+        LOG(FATAL) << "Unmatched error " << unmatched;
+        return 0;
+      });
+}
+
+// Loads the vertices with the first stage of edge files, then adds the edge
+// labels of each further stage to the fragment. Only one stage of input
+// tables is held at a time, so the peak is about the graph plus one stage,
+// rather than the graph plus all of its input tables.
+vineyard::ObjectID load_in_stages(vineyard::Client &client,
+                                  grape::CommSpec const &comm_spec,
+                                  struct htap_loader_options const &options) {
+  int64_t budget = options.memory_budget_mb << 20;
+  auto stages = stages_by_budget(comm_spec, options.efiles, budget);
+  if (comm_spec.worker_id() == 0) {
+    LOG(INFO) << "loading " << options.efiles.size() << " edge files in "
+              << stages.size() << " stages of at most "
+              << options.memory_budget_mb << " MB";
+  }
+  if (stages.size() <= 1) {
+    return load_at_once(client, comm_spec, options, options.efiles);
+  }
+  vineyard::ObjectID frag_id;
+  {
+    auto loader = std::make_unique<loader_t>(
+        client, comm_spec, stages[0], options.vfiles, options.directed != 0,
+        options.generate_eid != 0);
+    frag_id = boost::leaf::try_handle_all(
+        [&]() { return loader->LoadFragment(); },
+        [](const boost::leaf::error_info &unmatched) {
+          LOG(FATAL) << "Unmatched error " << unmatched;
+          return 0;
+        });
+  }
+  const std::vector<std::string> no_vfiles;
+  for (size_t i = 1; i < stages.size(); ++i) {
+    auto loader = std::make_unique<loader_t>(
+        client, comm_spec, stages[i], no_vfiles, options.directed != 0,
+        options.generate_eid != 0);
+    bool last = i + 1 == stages.size();
+    frag_id = boost::leaf::try_handle_all(
+        [&]() {
+          return last ? loader->AddLabelsToFragmentAsFragmentGroup(frag_id)
+                      : loader->AddLabelsToFragment(frag_id);
+        },
+        [](const boost::leaf::error_info &unmatched) {
+          LOG(FATAL) << "Unmatched error " << unmatched;
+          return 0;
+        });
+    LOG(INFO) << "[worker-" << comm_spec.worker_id() << "] loaded stage " << i
+              << " of " << stages.size();
+  }
+  return frag_id;
+}
+
 }
 
 int main(int argc, char **argv) {
   if (argc < 3) {
-    printf("usage: ./vineyard_htap_loader <e_label_num> <efiles...> <v_label_num> <vfiles...> [directed] [generate_eid]\n"
+    printf("usage: ./vineyard_htap_loader <e_label_num> <efiles...> <v_label_num> <vfiles...> [directed] [generate_eid] [memory_budget_mb]\n"
            "\n"
            "   or: ./vineyard_htap_loader --config <config.json>"
            "\n\n");
@@ -140,19 +260,11 @@ int main(int argc, char **argv) {
 
     MPI_Barrier(comm_spec.comm());
     vineyard::ObjectID fragment_group_id;
-    {
-      auto loader = std::make_unique<vineyard::ArrowFragmentLoader<
-          vineyard::property_graph_types::OID_TYPE,
-          vineyard::property_graph_types::VID_TYPE>>(
-            client, comm_spec, options.efiles, options.vfiles,
-            options.directed != 0, options.generate_eid != 0);
-
-      fragment_group_id = boost::leaf::try_handle_all(
-          [&]() { return loader->LoadFragmentAsFragmentGroup(); },
-          [](const boost::leaf::error_info &unmatched) {
-            LOG(FATAL) << "Unmatched error " << unmatched;
-            return 0;
-          });
+    if (options.memory_budget_mb > 0) {
+      fragment_group_id = detail::load_in_stages(client, comm_spec, options);
+    } else {
+      fragment_group_id =
+          detail::load_at_once(client, comm_spec, options, options.efiles);
     }
 
     LOG(INFO) << "[fragment group id]: " << fragment_group_id;
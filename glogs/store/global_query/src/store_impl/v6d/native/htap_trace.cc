@@ -0,0 +1,134 @@
+/**
+ * Copyright 2020 Alibaba Group Holding Limited.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "htap_trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+namespace vineyard {
+namespace htap_impl {
+
+std::atomic<uint32_t> trace_mask(0);
+
+namespace {
+
+const char* const subsystem_names[TRACE_SUBSYSTEM_NUM] = {
+    "graph", "vertex", "edge", "property", "builder"};
+
+std::atomic<int> sample_every(1);
+TraceEvent ring[TRACE_RING_SIZE];
+std::atomic<uint64_t> ring_next(0);
+std::atomic<uint32_t> thread_num(0);
+
+uint32_t trace_thread() {
+  static thread_local uint32_t thread = thread_num.fetch_add(1);
+  return thread;
+}
+
+// V6D_TRACE and V6D_TRACE_SAMPLE
+const bool trace_env_read = []() {
+  if (const char* sample = getenv("V6D_TRACE_SAMPLE")) {
+    set_trace_sampling(atoi(sample));
+  }
+  if (const char* subsystems = getenv("V6D_TRACE")) {
+    if (!set_trace_subsystems(subsystems)) {
+      fprintf(stderr, "V6D_TRACE: unknown subsystem in '%s'\n", subsystems);
+    }
+  }
+  return true;
+}();
+
+}  // namespace
+
+bool set_trace_subsystems(const std::string& subsystems) {
+  uint32_t mask = 0;
+  std::stringstream ss(subsystems);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    if (name.empty()) {
+      continue;
+    }
+    if (name == "all") {
+      mask = (1u << TRACE_SUBSYSTEM_NUM) - 1;
+      continue;
+    }
+    auto it = std::find(subsystem_names, subsystem_names + TRACE_SUBSYSTEM_NUM,
+                        name);
+    if (it == subsystem_names + TRACE_SUBSYSTEM_NUM) {
+      return false;
+    }
+    mask |= 1u << (it - subsystem_names);
+  }
+  trace_mask.store(mask, std::memory_order_relaxed);
+  return true;
+}
+
+void set_trace_sampling(int every) {
+  sample_every.store(std::max(every, 1), std::memory_order_relaxed);
+}
+
+bool trace_sampled() {
+  static thread_local int calls = 0;
+  if (++calls < sample_every.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  calls = 0;
+  return true;
+}
+
+void record_trace(const TraceEvent& event) {
+  uint64_t slot = ring_next.fetch_add(1, std::memory_order_relaxed);
+  TraceEvent& entry = ring[slot % TRACE_RING_SIZE];
+  entry = event;
+  entry.thread = trace_thread();
+}
+
+int dump_trace(const char* path) {
+  FILE* fp = fopen(path, "w");
+  if (fp == nullptr) {
+    return -1;
+  }
+  uint64_t end = ring_next.load(std::memory_order_relaxed);
+  uint64_t begin = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+  std::vector<TraceEvent> events;
+  events.reserve(end - begin);
+  for (uint64_t i = begin; i < end; ++i) {
+    const TraceEvent& event = ring[i % TRACE_RING_SIZE];
+    if (event.name != nullptr && event.subsystem < TRACE_SUBSYSTEM_NUM) {
+      events.push_back(event);
+    }
+  }
+  std::sort(events.begin(), events.end(),
+            [](const TraceEvent& a, const TraceEvent& b) {
+              return a.start_ns < b.start_ns;
+            });
+  fprintf(fp, "start_ns,duration_ns,subsystem,name,arg,thread\n");
+  for (const TraceEvent& event : events) {
+    fprintf(fp, "%lld,%lld,%s,%s,%lld,%u\n",
+            static_cast<long long>(event.start_ns),
+            static_cast<long long>(event.duration_ns),
+            subsystem_names[event.subsystem], event.name,
+            static_cast<long long>(event.arg), event.thread);
+  }
+  fclose(fp);
+  return static_cast<int>(events.size());
+}
+
+}  // namespace htap_impl
+}  // namespace vineyard
@@ -0,0 +1,110 @@
+/**
+ * Copyright 2020 Alibaba Group Holding Limited.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ANALYTICAL_ENGINE_HTAP_HTAP_TRACE_H_
+#define ANALYTICAL_ENGINE_HTAP_HTAP_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Tracing of the FFI calls, cheap enough to stay in release builds: while a
+// subsystem is disabled its HTAP_TRACE_SCOPE costs one relaxed atomic load.
+// Enabled, every sample_every-th call of a thread records its start,
+// duration and an argument into a fixed ring buffer, which dump_trace
+// writes out. Subsystems are enabled at runtime (v6d_trace_enable) or at
+// startup through the environment, e.g. V6D_TRACE=edge,vertex and
+// V6D_TRACE_SAMPLE=100.
+
+namespace vineyard {
+namespace htap_impl {
+
+enum TraceSubsystem : uint32_t {
+  TRACE_GRAPH = 0,  // handles, partitions, schema and statistics
+  TRACE_VERTEX,
+  TRACE_EDGE,
+  TRACE_PROPERTY,
+  TRACE_BUILDER,
+  TRACE_SUBSYSTEM_NUM,
+};
+
+struct TraceEvent {
+  int64_t start_ns;
+  int64_t duration_ns;
+  const char* name;  // a string literal, e.g. __FUNCTION__
+  int64_t arg;
+  uint32_t subsystem;
+  uint32_t thread;
+};
+
+const size_t TRACE_RING_SIZE = 1 << 16;
+
+// a bit per enabled subsystem
+extern std::atomic<uint32_t> trace_mask;
+
+// comma separated subsystem names ("graph", "vertex", "edge", "property",
+// "builder", or "all"), an empty list disabling all; false on an unknown name,
+// leaving the mask as it was
+bool set_trace_subsystems(const std::string& subsystems);
+
+void set_trace_sampling(int sample_every);
+
+// whether this call of the thread is one to record
+bool trace_sampled();
+
+void record_trace(const TraceEvent& event);
+
+// writes the events in the ring, oldest first, as csv; the number written,
+// or -1 if path can't be opened. Events recorded meanwhile may be torn.
+int dump_trace(const char* path);
+
+inline int64_t trace_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+class TraceScope {
+ public:
+  TraceScope(TraceSubsystem subsystem, const char* name, int64_t arg) {
+    if ((trace_mask.load(std::memory_order_relaxed) & (1u << subsystem)) &&
+        trace_sampled()) {
+      event_.start_ns = trace_now_ns();
+      event_.name = name;
+      event_.arg = arg;
+      event_.subsystem = subsystem;
+    }
+  }
+
+  ~TraceScope() {
+    if (event_.name != nullptr) {
+      event_.duration_ns = trace_now_ns() - event_.start_ns;
+      record_trace(event_);
+    }
+  }
+
+ private:
+  TraceEvent event_{0, 0, nullptr, 0, 0, 0};
+};
+
+}  // namespace htap_impl
+}  // namespace vineyard
+
+#define HTAP_TRACE_SCOPE(subsystem, arg)                  \
+  ::vineyard::htap_impl::TraceScope htap_trace_scope_(    \
+      ::vineyard::htap_impl::subsystem, __FUNCTION__, (arg))
+
+#endif  // ANALYTICAL_ENGINE_HTAP_HTAP_TRACE_H_
@@ -15,7 +15,22 @@
  */
 #include "property_graph_stream.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "arrow/io/memory.h"
+#include "arrow/ipc/reader.h"
+#include "arrow/ipc/writer.h"
 #include "arrow/type.h"
+#include "arrow/util/compression.h"
 
 #include "vineyard/basic/stream/recordbatch_stream.h"
 
@@ -23,8 +38,6 @@ namespace vineyard {
 
 namespace htap {
 
-constexpr int64_t kDefaultBufferSize = 1024 * 128;
-
 namespace detail {
 
 std::shared_ptr<arrow::DataType> PropertyTypeToDataType(
@@ -99,8 +112,156 @@ static std::shared_ptr<arrow::Schema> ToArrowSchema(
   return std::make_shared<arrow::Schema>(fields, kv);
 }
 
+namespace {
+
+template <typename T>
+struct TypedColumn;
+
+#define TYPED_COLUMN(T, BUILDER, TYPE, FIELD)                     \
+  template <>                                                     \
+  struct TypedColumn<T> {                                         \
+    using BuilderType = BUILDER;                                  \
+    static std::shared_ptr<arrow::DataType> type() { return TYPE; } \
+    static T value(Property const* prop) {                        \
+      vineyard::htap::htap_types::PodProperties pp;               \
+      pp.long_value = prop->len;                                  \
+      return pp.FIELD;                                            \
+    }                                                             \
+  };
+
+TYPED_COLUMN(int32_t, arrow::Int32Builder, arrow::int32(), int_value)
+TYPED_COLUMN(int64_t, arrow::Int64Builder, arrow::int64(), long_value)
+TYPED_COLUMN(float, arrow::FloatBuilder, arrow::float32(), float_value)
+TYPED_COLUMN(double, arrow::DoubleBuilder, arrow::float64(), double_value)
+
+#undef TYPED_COLUMN
+
+template <>
+struct TypedColumn<std::string> {
+  static std::shared_ptr<arrow::DataType> type() { return arrow::large_utf8(); }
+};
+
+// the n properties from prop on, stride apart
+template <typename T>
+void append_column(arrow::ArrayBuilder* builder, Property const* prop,
+                   size_t stride, size_t n) {
+  static thread_local std::vector<T> values;
+  values.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    values[i] = TypedColumn<T>::value(prop + i * stride);
+  }
+  CHECK_ARROW_ERROR(
+      static_cast<typename TypedColumn<T>::BuilderType*>(builder)->AppendValues(
+          values.data(), n));
+}
+
+template <>
+void append_column<std::string>(arrow::ArrayBuilder* builder,
+                                Property const* prop, size_t stride, size_t n) {
+  auto string_builder = static_cast<arrow::LargeStringBuilder*>(builder);
+  int64_t bytes = 0;
+  for (size_t i = 0; i < n; ++i) {
+    bytes += prop[i * stride].len;
+  }
+  CHECK_ARROW_ERROR(string_builder->Reserve(n));
+  CHECK_ARROW_ERROR(string_builder->ReserveData(bytes));
+  for (size_t i = 0; i < n; ++i) {
+    Property const* p = prop + i * stride;
+    string_builder->UnsafeAppend(static_cast<const uint8_t*>(p->data), p->len);
+  }
+}
+
+template <size_t KEYS, typename... Ts>
+class TypedTableAppenderImpl : public TypedTableAppender {
+ public:
+  static bool Matches(std::shared_ptr<arrow::Schema> const& schema) {
+    if (schema->num_fields() != static_cast<int>(KEYS + sizeof...(Ts))) {
+      return false;
+    }
+    for (size_t k = 0; k < KEYS; ++k) {
+      if (!schema->field(k)->type()->Equals(arrow::int64())) {
+        return false;
+      }
+    }
+    std::shared_ptr<arrow::DataType> types[] = {nullptr,
+                                                TypedColumn<Ts>::type()...};
+    for (size_t i = 0; i < sizeof...(Ts); ++i) {
+      if (!schema->field(KEYS + i)->type()->Equals(types[i + 1])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void AppendRows(arrow::RecordBatchBuilder* builder,
+                  VertexId const* const* keys, size_t n,
+                  Property const* properties) override {
+    for (size_t k = 0; k < KEYS; ++k) {
+      CHECK_ARROW_ERROR(static_cast<arrow::Int64Builder*>(builder->GetField(k))
+                            ->AppendValues(keys[k], n));
+    }
+    appendProperties(builder, n, properties, std::index_sequence_for<Ts...>());
+  }
+
+ private:
+  template <size_t... Is>
+  void appendProperties(arrow::RecordBatchBuilder* builder, size_t n,
+                        Property const* properties, std::index_sequence<Is...>) {
+    int expand[] = {0, (append_column<Ts>(builder->GetField(KEYS + Is),
+                                          properties + Is, sizeof...(Ts), n),
+                        0)...};
+    (void) expand;
+  }
+};
+
+template <size_t KEYS, typename... Ts>
+bool try_typed_appender(std::shared_ptr<arrow::Schema> const& schema,
+                        std::unique_ptr<TypedTableAppender>& out) {
+  if (TypedTableAppenderImpl<KEYS, Ts...>::Matches(schema)) {
+    out.reset(new TypedTableAppenderImpl<KEYS, Ts...>());
+  }
+  return out != nullptr;
+}
+
+// the property columns of the common schemas, each specialised for vertex
+// and for edge tables
+template <size_t KEYS>
+std::unique_ptr<TypedTableAppender> make_typed_appender(
+    std::shared_ptr<arrow::Schema> const& schema) {
+  std::unique_ptr<TypedTableAppender> out;
+  (void) (try_typed_appender<KEYS>(schema, out) ||
+      try_typed_appender<KEYS, int64_t>(schema, out) ||
+      try_typed_appender<KEYS, int64_t, int64_t>(schema, out) ||
+      try_typed_appender<KEYS, int64_t, int64_t, int64_t>(schema, out) ||
+      try_typed_appender<KEYS, int32_t>(schema, out) ||
+      try_typed_appender<KEYS, float>(schema, out) ||
+      try_typed_appender<KEYS, double>(schema, out) ||
+      try_typed_appender<KEYS, std::string>(schema, out) ||
+      try_typed_appender<KEYS, std::string, int64_t>(schema, out) ||
+      try_typed_appender<KEYS, std::string, float>(schema, out) ||
+      try_typed_appender<KEYS, std::string, double>(schema, out) ||
+      try_typed_appender<KEYS, std::string, std::string>(schema, out) ||
+      try_typed_appender<KEYS, int64_t, std::string>(schema, out) ||
+      try_typed_appender<KEYS, std::string, int64_t, float>(schema, out));
+  return out;
+}
+
+}  // namespace
+
+std::unique_ptr<TypedTableAppender> MakeTypedTableAppender(
+    std::shared_ptr<arrow::Schema> const& schema, size_t key_columns) {
+  if (key_columns == 1) {
+    return make_typed_appender<1>(schema);
+  } else if (key_columns == 2) {
+    return make_typed_appender<2>(schema);
+  }
+  return nullptr;
+}
+
 PropertyTableAppender::PropertyTableAppender(
-    std::shared_ptr<arrow::Schema> schema) {
+    std::shared_ptr<arrow::Schema> schema, size_t key_columns)
+    : key_columns_(key_columns),
+      typed_(MakeTypedTableAppender(schema, key_columns)) {
   for (const auto& field : schema->fields()) {
     std::shared_ptr<arrow::DataType> type = field->type();
     if (type == arrow::boolean()) {
@@ -219,6 +380,77 @@ void PropertyTableAppender::Apply(
   }
 }
 
+void PropertyTableAppender::ApplyBatch(
+    std::unique_ptr<arrow::RecordBatchBuilder>& builder, size_t n,
+    VertexId const* src_ids, VertexId const* dst_ids,
+    size_t const* property_sizes, Property* properties,
+    std::map<int, int> const& property_id_mapping,
+    std::vector<std::shared_ptr<arrow::RecordBatch>>& batches_out) {
+  // the property id of each property column
+  size_t property_num = col_num_ - key_columns_;
+  std::vector<int> column_ids(property_num, -1);
+  if (typed_ != nullptr) {
+    for (auto const& kv : property_id_mapping) {
+      size_t column = kv.second;
+      if (column >= key_columns_ && column < col_num_) {
+        column_ids[column - key_columns_] = kv.first;
+      }
+    }
+  }
+  auto in_order = [&](size_t property_size, Property const* props) {
+    if (property_size != property_num) {
+      return false;
+    }
+    for (size_t i = 0; i < property_num; ++i) {
+      if (props[i].id != column_ids[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  size_t row = 0, offset = 0;
+  while (row < n) {
+    size_t end = row, end_offset = offset;
+    if (typed_ != nullptr) {
+      size_t room =
+          builder->initial_capacity() - builder->GetField(0)->length();
+      while (end < n && end - row < room &&
+             in_order(property_sizes[end], properties + end_offset)) {
+        end_offset += property_sizes[end];
+        ++end;
+      }
+    }
+    if (end > row) {
+      VertexId const* keys[2] = {src_ids + row,
+                                 dst_ids == nullptr ? nullptr : dst_ids + row};
+      typed_->AppendRows(builder.get(), keys, end - row, properties + offset);
+      if (builder->GetField(0)->length() == builder->initial_capacity()) {
+        std::shared_ptr<arrow::RecordBatch> batch = nullptr;
+        CHECK_ARROW_ERROR(builder->Flush(&batch));
+        batches_out.push_back(batch);
+      }
+      row = end;
+      offset = end_offset;
+      continue;
+    }
+    std::shared_ptr<arrow::RecordBatch> batch = nullptr;
+    if (dst_ids == nullptr) {
+      Apply(builder, src_ids[row], property_sizes[row], properties + offset,
+            property_id_mapping, batch);
+    } else {
+      // the labels are in the builder's metadata already
+      Apply(builder, src_ids[row], dst_ids[row], 0, 0, property_sizes[row],
+            properties + offset, property_id_mapping, batch);
+    }
+    if (batch != nullptr) {
+      batches_out.push_back(batch);
+    }
+    offset += property_sizes[row];
+    ++row;
+  }
+}
+
 void PropertyTableAppender::Flush(
     std::unique_ptr<arrow::RecordBatchBuilder>& builder,
     std::shared_ptr<arrow::RecordBatch>& batches_out, bool allow_empty) {
@@ -229,6 +461,297 @@ void PropertyTableAppender::Flush(
   }
 }
 
+namespace {
+
+const char kCompressionKey[] = "htap.compression";
+
+#if defined(ARROW_VERSION) && ARROW_VERSION >= 4000000
+bool chunk_codec(std::string const& codec, arrow::Compression::type& type) {
+  if (codec == "lz4") {
+    type = arrow::Compression::LZ4_FRAME;
+  } else if (codec == "zstd") {
+    type = arrow::Compression::ZSTD;
+  } else {
+    return false;
+  }
+  return arrow::util::Codec::IsAvailable(type);
+}
+#endif
+
+}  // namespace
+
+bool CanCompressChunks(std::string const& codec) {
+#if defined(ARROW_VERSION) && ARROW_VERSION >= 4000000
+  arrow::Compression::type type;
+  return chunk_codec(codec, type);
+#else
+  return false;
+#endif
+}
+
+Status CompressChunk(std::shared_ptr<arrow::RecordBatch> const& batch,
+                     std::string const& codec,
+                     std::shared_ptr<arrow::RecordBatch>& out) {
+#if defined(ARROW_VERSION) && ARROW_VERSION >= 4000000
+  arrow::Compression::type type;
+  if (!chunk_codec(codec, type)) {
+    return Status::NotImplemented("no chunk compression " + codec);
+  }
+  auto options = arrow::ipc::IpcWriteOptions::Defaults();
+  RETURN_ON_ARROW_ERROR_AND_ASSIGN(options.codec,
+                                   arrow::util::Codec::Create(type));
+  std::shared_ptr<arrow::io::BufferOutputStream> sink;
+  RETURN_ON_ARROW_ERROR_AND_ASSIGN(sink, arrow::io::BufferOutputStream::Create());
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+  RETURN_ON_ARROW_ERROR_AND_ASSIGN(
+      writer, arrow::ipc::MakeStreamWriter(sink, batch->schema(), options));
+  RETURN_ON_ARROW_ERROR(writer->WriteRecordBatch(*batch));
+  RETURN_ON_ARROW_ERROR(writer->Close());
+  std::shared_ptr<arrow::Buffer> stream;
+  RETURN_ON_ARROW_ERROR_AND_ASSIGN(stream, sink->Finish());
+
+  // the stream as the one value of a large binary column
+  std::shared_ptr<arrow::Buffer> offsets;
+  RETURN_ON_ARROW_ERROR_AND_ASSIGN(offsets,
+                                   arrow::AllocateBuffer(2 * sizeof(int64_t)));
+  int64_t* offset_data = reinterpret_cast<int64_t*>(offsets->mutable_data());
+  offset_data[0] = 0;
+  offset_data[1] = stream->size();
+  auto array = std::make_shared<arrow::LargeBinaryArray>(1, offsets, stream);
+  // the chunk's own metadata too, for its label
+  auto metadata = batch->schema()->metadata() != nullptr
+                      ? batch->schema()->metadata()->Copy()
+                      : std::make_shared<arrow::KeyValueMetadata>();
+  metadata->Append(kCompressionKey, codec);
+  auto schema = arrow::schema({arrow::field("chunk", arrow::large_binary())},
+                              metadata);
+  out = arrow::RecordBatch::Make(schema, 1, {array});
+  return Status::OK();
+#else
+  return Status::NotImplemented("chunk compression needs Arrow 4.0");
+#endif
+}
+
+bool IsCompressedChunk(std::shared_ptr<arrow::RecordBatch> const& batch) {
+  auto metadata = batch->schema()->metadata();
+  return metadata != nullptr && metadata->FindKey(kCompressionKey) != -1;
+}
+
+Status DecompressChunk(std::shared_ptr<arrow::RecordBatch> const& batch,
+                       std::shared_ptr<arrow::RecordBatch>& out) {
+  if (batch->num_columns() != 1 || batch->num_rows() != 1 ||
+      batch->column(0)->type_id() != arrow::Type::LARGE_BINARY) {
+    return Status::Invalid("not a compressed chunk");
+  }
+  auto array =
+      std::static_pointer_cast<arrow::LargeBinaryArray>(batch->column(0));
+  auto stream = arrow::SliceBuffer(array->value_data(), array->value_offset(0),
+                                   array->value_length(0));
+  auto input = std::make_shared<arrow::io::BufferReader>(stream);
+  std::shared_ptr<arrow::ipc::RecordBatchReader> reader;
+  RETURN_ON_ARROW_ERROR_AND_ASSIGN(
+      reader, arrow::ipc::RecordBatchStreamReader::Open(input));
+  RETURN_ON_ARROW_ERROR(reader->ReadNext(&out));
+  if (out == nullptr) {
+    return Status::Invalid("empty compressed chunk");
+  }
+  return Status::OK();
+}
+
+std::string DefaultStreamCompression() {
+  const char* codec = getenv("V6D_STREAM_COMPRESSION");
+  if (codec == nullptr || codec[0] == '\0' || strcmp(codec, "none") == 0) {
+    return "none";
+  }
+  if (!CanCompressChunks(codec)) {
+    LOG(WARNING) << "V6D_STREAM_COMPRESSION: can't compress with " << codec;
+    return "none";
+  }
+  return codec;
+}
+
+int64_t ChunkLabel(std::shared_ptr<arrow::RecordBatch> const& batch) {
+  auto metadata = batch->schema()->metadata();
+  int index = metadata == nullptr ? -1 : metadata->FindKey("label_id");
+  return index == -1 ? -1 : std::stoll(metadata->value(index));
+}
+
+// Reads the chunks of a stream on a thread of its own, up to a window of
+// chunks ahead of the consumers, and decompresses those that are
+// compressed on a pool of threads (or on the reading thread without one).
+// Next hands the chunks out in stream order; NextOfLabel hands out, to
+// consumers on several threads, only chunks whose label no consumer holds
+// until Done, so that each label's chunks are taken in stream order one at
+// a time. The threads hold the pipeline, and leave once it is stopped and
+// they are done with the read or the chunk at hand.
+class ChunkPipeline : public std::enable_shared_from_this<ChunkPipeline> {
+ public:
+  ChunkPipeline(std::shared_ptr<vineyard::RecordBatchStream> stream,
+                size_t window)
+      : stream_(std::move(stream)), window_(std::max<size_t>(1, window)) {}
+
+  void Start(int threads) {
+    auto self = shared_from_this();
+    pool_ = threads > 0;
+    std::thread([self]() { self->fetch(); }).detach();
+    for (int i = 0; i < threads; ++i) {
+      std::thread([self]() { self->decompress(); }).detach();
+    }
+  }
+
+  void Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    changed_.notify_all();
+  }
+
+  // the next chunk; the status of the read that ended the stream once all
+  // chunks are out
+  Status Next(std::shared_ptr<arrow::RecordBatch>& batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock,
+                  [this]() { return !slots_.empty() && slots_.front()->ready; });
+    return take(slots_.begin(), batch);
+  }
+
+  // the first chunk whose label is free and all of whose label's earlier
+  // chunks are out, the label then being held until Done
+  Status NextOfLabel(std::shared_ptr<arrow::RecordBatch>& batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = slots_.end();
+    changed_.wait(lock, [this, &it]() {
+      it = firstOfFreeLabel();
+      return it != slots_.end();
+    });
+    if ((*it)->status.ok()) {
+      held_.push_back((*it)->label);
+    }
+    return take(it, batch);
+  }
+
+  void Done(int64_t label) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find(held_.begin(), held_.end(), label);
+    if (it != held_.end()) {
+      held_.erase(it);
+      changed_.notify_all();
+    }
+  }
+
+ private:
+  struct Slot {
+    std::shared_ptr<arrow::RecordBatch> batch;
+    Status status;
+    int64_t label = -1;
+    bool ready = false;
+  };
+  using Slots = std::deque<std::shared_ptr<Slot>>;
+
+  // hands out the slot at it, leaving the end of the stream for the others
+  Status take(Slots::iterator it, std::shared_ptr<arrow::RecordBatch>& batch) {
+    auto slot = *it;
+    if (slot->status.ok()) {
+      slots_.erase(it);
+      changed_.notify_all();
+    }
+    batch = slot->batch;
+    return slot->status;
+  }
+
+  Slots::iterator firstOfFreeLabel() {
+    std::vector<int64_t> passed;  // labels with an earlier chunk waiting
+    for (auto it = slots_.begin(); it != slots_.end(); ++it) {
+      const Slot& slot = **it;
+      if (!slot.status.ok()) {
+        // the end, once nothing is left before it
+        return it == slots_.begin() ? it : slots_.end();
+      }
+      if (std::find(passed.begin(), passed.end(), slot.label) != passed.end()) {
+        continue;
+      }
+      if (slot.ready &&
+          std::find(held_.begin(), held_.end(), slot.label) == held_.end()) {
+        return it;
+      }
+      passed.push_back(slot.label);
+    }
+    return slots_.end();
+  }
+
+  void fetch() {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock,
+                      [this]() { return stopped_ || slots_.size() < window_; });
+        if (stopped_) {
+          return;
+        }
+      }
+      auto slot = std::make_shared<Slot>();
+      slot->status = stream_->ReadBatch(slot->batch, true);
+      bool compressed = slot->status.ok() && IsCompressedChunk(slot->batch);
+      if (slot->status.ok()) {
+        slot->label = ChunkLabel(slot->batch);
+      }
+      if (compressed && !pool_) {
+        std::shared_ptr<arrow::RecordBatch> chunk = slot->batch;
+        slot->status = DecompressChunk(chunk, slot->batch);
+        compressed = false;
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      slots_.push_back(slot);
+      if (compressed) {
+        pending_.push_back(slot);
+      } else {
+        slot->ready = true;
+      }
+      if (!slot->status.ok()) {
+        ended_ = true;
+      }
+      changed_.notify_all();
+      if (ended_) {
+        return;
+      }
+    }
+  }
+
+  void decompress() {
+    while (true) {
+      std::shared_ptr<Slot> slot;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]() {
+          return stopped_ || ended_ || !pending_.empty();
+        });
+        if (pending_.empty()) {
+          return;
+        }
+        slot = pending_.front();
+        pending_.pop_front();
+      }
+      std::shared_ptr<arrow::RecordBatch> batch;
+      Status status = DecompressChunk(slot->batch, batch);
+      std::lock_guard<std::mutex> lock(mutex_);
+      slot->batch = batch;
+      slot->status = status;
+      slot->ready = true;
+      changed_.notify_all();
+    }
+  }
+
+  std::shared_ptr<vineyard::RecordBatchStream> stream_;
+  size_t window_;
+  bool pool_ = false;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  Slots slots_;                  // read and not handed out, in stream order
+  Slots pending_;                // read, to decompress
+  std::vector<int64_t> held_;    // labels taken by NextOfLabel, until Done
+  bool stopped_ = false;
+  bool ended_ = false;
+};
+
 }  // namespace detail
 
 int PropertyGraphOutStream::Initialize(Schema schema) {
@@ -283,17 +806,7 @@ int PropertyGraphOutStream::AddVertex(VertexId id, LabelId labelid,
   std::shared_ptr<arrow::RecordBatch> batch_chunk = nullptr;
   appender->Apply(builder, id, property_size, properties,
                   vertex_property_id_mapping_[labelid], batch_chunk);
-  if (batch_chunk != nullptr && vertex_primary_key_column_[labelid] != kNoPrimaryKeyColumn) {
-#if defined(ARROW_VERSION) && ARROW_VERSION < 17000
-    ARROW_OK_OR_RAISE(
-      batch_chunk->RemoveColumn(vertex_primary_key_column_[labelid], &batch_chunk));
-#else
-    CHECK_ARROW_ERROR_AND_ASSIGN(batch_chunk,
-      batch_chunk->RemoveColumn(vertex_primary_key_column_[labelid]));
-#endif
-  }
-  this->buildTableChunk(batch_chunk, vertex_stream_, 1,
-                        vertex_property_id_mapping_[labelid]);
+  this->buildVertexChunk(labelid, batch_chunk);
 
   return 0;
 }
@@ -307,26 +820,7 @@ int PropertyGraphOutStream::AddEdge(VertexId src_id,
   LOG(INFO) << "add edge: labelid = " << label
             << ", property_size = " << property_size;
 #endif
-  auto src_dst_key = std::make_pair(src_label, dst_label);
-  if (edge_builders_[label][src_dst_key] == nullptr) {
-    std::shared_ptr<arrow::KeyValueMetadata> metadata;
-    if (edge_schemas_[label]->metadata() != nullptr) {
-      metadata = edge_schemas_[label]->metadata()->Copy();
-    } else {
-      metadata.reset(new arrow::KeyValueMetadata());
-    }
-    metadata->Append("src_label_id", std::to_string(src_label));
-    metadata->Append("src_label", graph_schema_->GetLabelName(src_label));
-    metadata->Append("dst_label_id", std::to_string(dst_label));
-    metadata->Append("dst_label", graph_schema_->GetLabelName(dst_label));
-    auto schema = edge_schemas_[label]->WithMetadata(metadata);
-
-    std::unique_ptr<arrow::RecordBatchBuilder> builder = nullptr;
-    CHECK_ARROW_ERROR(arrow::RecordBatchBuilder::Make(
-        schema, arrow::default_memory_pool(), kDefaultBufferSize, &builder));
-    edge_builders_[label][src_dst_key].reset(builder.release());
-  }
-  auto &builder = edge_builders_[label][src_dst_key];
+  auto &builder = edgeBuilder(label, src_label, dst_label);
   auto &appender = edge_appenders_[label];
   VINEYARD_ASSERT(appender != nullptr, "edge label = " + std::to_string(label));
   std::shared_ptr<arrow::RecordBatch> batch_chunk = nullptr;
@@ -343,11 +837,17 @@ int PropertyGraphOutStream::AddVertices(size_t vertex_size, VertexId* ids,
                                          LabelId* labelids,
                                          size_t* property_sizes,
                                          Property* properties) {
-  size_t cumsum = 0;
-  for (size_t idx = 0; idx < vertex_size; ++idx) {
-    AddVertex(ids[idx], labelids[idx], property_sizes[idx],
-              properties + cumsum);
-    cumsum += property_sizes[idx];
+  size_t cumsum = 0, idx = 0;
+  while (idx < vertex_size) {
+    size_t end = idx, run_properties = 0;
+    while (end < vertex_size && labelids[end] == labelids[idx]) {
+      run_properties += property_sizes[end];
+      ++end;
+    }
+    addVertexRun(labelids[idx], end - idx, ids + idx, property_sizes + idx,
+                 properties + cumsum);
+    cumsum += run_properties;
+    idx = end;
   }
   return 0;
 }
@@ -358,16 +858,278 @@ int PropertyGraphOutStream::AddEdges(size_t edge_size,
                                       LabelId* dst_labels,
                                       size_t* property_sizes,
                                       Property* properties) {
-  size_t cumsum = 0;
-  for (size_t idx = 0; idx < edge_size; ++idx) {
-    AddEdge(src_ids[idx], dst_ids[idx], labels[idx],
-            src_labels[idx], dst_labels[idx], property_sizes[idx],
-            properties + cumsum);
-    cumsum += property_sizes[idx];
+  size_t cumsum = 0, idx = 0;
+  while (idx < edge_size) {
+    size_t end = idx, run_properties = 0;
+    while (end < edge_size && labels[end] == labels[idx] &&
+           src_labels[end] == src_labels[idx] &&
+           dst_labels[end] == dst_labels[idx]) {
+      run_properties += property_sizes[end];
+      ++end;
+    }
+    addEdgeRun(labels[idx], src_labels[idx], dst_labels[idx], end - idx,
+               src_ids + idx, dst_ids + idx, property_sizes + idx,
+               properties + cumsum);
+    cumsum += run_properties;
+    idx = end;
+  }
+  return 0;
+}
+
+int PropertyGraphOutStream::addVertexRun(LabelId label, size_t n,
+                                         VertexId* ids, size_t* property_sizes,
+                                         Property* properties) {
+  auto& builder = vertex_builders_[label];
+  auto& appender = vertex_appenders_[label];
+  VINEYARD_ASSERT(builder != nullptr && appender != nullptr);
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  appender->ApplyBatch(builder, n, ids, nullptr, property_sizes, properties,
+                       vertex_property_id_mapping_[label], batches);
+  for (auto const& batch : batches) {
+    this->buildVertexChunk(label, batch);
   }
   return 0;
 }
 
+int PropertyGraphOutStream::addEdgeRun(LabelId label, LabelId src_label,
+                                       LabelId dst_label, size_t n,
+                                       VertexId* src_ids, VertexId* dst_ids,
+                                       size_t* property_sizes,
+                                       Property* properties) {
+  auto &builder = edgeBuilder(label, src_label, dst_label);
+  auto &appender = edge_appenders_[label];
+  VINEYARD_ASSERT(appender != nullptr, "edge label = " + std::to_string(label));
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  appender->ApplyBatch(builder, n, src_ids, dst_ids, property_sizes, properties,
+                       edge_property_id_mapping_[label], batches);
+  for (auto const& batch : batches) {
+    this->buildTableChunk(batch, edge_stream_, 2,
+                          edge_property_id_mapping_[label]);
+  }
+  return 0;
+}
+
+bool PropertyGraphOutStream::checkVertexBatch(
+    LabelId label, std::shared_ptr<arrow::RecordBatch> const& batch) const {
+  auto iter = vertex_schemas_.find(label);
+  if (iter == vertex_schemas_.end()) {
+    LOG(ERROR) << "unknown vertex label: " << label;
+    return false;
+  }
+  if (batch == nullptr || !batch->schema()->Equals(*iter->second, false)) {
+    LOG(ERROR) << "vertex batch of label " << label << " doesn't match the schema: "
+               << (batch == nullptr ? "null" : batch->schema()->ToString())
+               << " vs. " << iter->second->ToString();
+    return false;
+  }
+  return true;
+}
+
+bool PropertyGraphOutStream::checkEdgeBatch(
+    LabelId label, std::shared_ptr<arrow::RecordBatch> const& batch) const {
+  auto iter = edge_schemas_.find(label);
+  if (iter == edge_schemas_.end()) {
+    LOG(ERROR) << "unknown edge label: " << label;
+    return false;
+  }
+  if (batch == nullptr || !batch->schema()->Equals(*iter->second, false)) {
+    LOG(ERROR) << "edge batch of label " << label << " doesn't match the schema: "
+               << (batch == nullptr ? "null" : batch->schema()->ToString())
+               << " vs. " << iter->second->ToString();
+    return false;
+  }
+  return true;
+}
+
+void PropertyGraphOutStream::cutChunks(
+    std::unique_ptr<arrow::RecordBatchBuilder>& builder,
+    std::shared_ptr<detail::PropertyTableAppender> const& appender,
+    std::vector<std::shared_ptr<arrow::RecordBatch>> const& batches,
+    std::vector<std::shared_ptr<arrow::RecordBatch>>& chunks) const {
+  // for edges, with the src and dst labels in its metadata
+  auto schema = builder->schema();
+  std::shared_ptr<arrow::RecordBatch> pending = nullptr;
+  appender->Flush(builder, pending);
+  if (pending != nullptr) {
+    chunks.push_back(pending);
+  }
+  for (auto const& batch : batches) {
+    for (int64_t offset = 0; offset < batch->num_rows(); offset += chunk_size_) {
+      auto slice = batch->Slice(offset, chunk_size_);
+      chunks.push_back(
+          arrow::RecordBatch::Make(schema, slice->num_rows(), slice->columns()));
+    }
+  }
+}
+
+// Runs task(0) .. task(n - 1), spread over the hardware threads.
+static void parallel_for_labels(size_t n,
+                                std::function<void(size_t)> const& task) {
+  size_t thread_num = std::min<size_t>(
+      n, std::max(1u, std::thread::hardware_concurrency()));
+  if (thread_num <= 1) {
+    for (size_t i = 0; i < n; ++i) {
+      task(i);
+    }
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_num; ++t) {
+    threads.emplace_back([&]() {
+      for (size_t i; (i = next.fetch_add(1)) < n;) {
+        task(i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+int PropertyGraphOutStream::AddVertexBatch(
+    LabelId label, std::shared_ptr<arrow::RecordBatch> const& batch) {
+  return AddVertexBatches({label}, {batch});
+}
+
+int PropertyGraphOutStream::AddEdgeBatch(
+    LabelId label, LabelId src_label, LabelId dst_label,
+    std::shared_ptr<arrow::RecordBatch> const& batch) {
+  return AddEdgeBatches({label}, {src_label}, {dst_label}, {batch});
+}
+
+int PropertyGraphOutStream::AddVertexBatches(
+    std::vector<LabelId> const& labels,
+    std::vector<std::shared_ptr<arrow::RecordBatch>> const& batches) {
+  if (labels.size() != batches.size()) {
+    return -1;
+  }
+  std::map<LabelId, std::vector<std::shared_ptr<arrow::RecordBatch>>> groups;
+  for (size_t i = 0; i < labels.size(); ++i) {
+    if (!checkVertexBatch(labels[i], batches[i])) {
+      return -1;
+    }
+    groups[labels[i]].push_back(batches[i]);
+  }
+  // the maps are only looked up from now on
+  std::vector<LabelId> group_labels;
+  std::vector<std::vector<std::shared_ptr<arrow::RecordBatch>>*> group_batches;
+  for (auto& group : groups) {
+    group_labels.push_back(group.first);
+    group_batches.push_back(&group.second);
+  }
+  std::vector<std::vector<std::shared_ptr<arrow::RecordBatch>>> chunks(
+      groups.size());
+  parallel_for_labels(groups.size(), [&](size_t i) {
+    LabelId label = group_labels[i];
+    cutChunks(vertex_builders_.at(label), vertex_appenders_.at(label),
+              *group_batches[i], chunks[i]);
+    for (auto& chunk : chunks[i]) {
+      chunk = vertexChunk(label, chunk);
+    }
+  });
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    for (auto const& chunk : chunks[i]) {
+      this->buildTableChunk(chunk, vertex_stream_, 1,
+                            vertex_property_id_mapping_[group_labels[i]]);
+    }
+  }
+  return 0;
+}
+
+int PropertyGraphOutStream::AddEdgeBatches(
+    std::vector<LabelId> const& labels, std::vector<LabelId> const& src_labels,
+    std::vector<LabelId> const& dst_labels,
+    std::vector<std::shared_ptr<arrow::RecordBatch>> const& batches) {
+  if (labels.size() != batches.size() || src_labels.size() != batches.size() ||
+      dst_labels.size() != batches.size()) {
+    return -1;
+  }
+  for (size_t i = 0; i < labels.size(); ++i) {
+    if (!checkEdgeBatch(labels[i], batches[i])) {
+      return -1;
+    }
+  }
+  // a label's (src, dst) builders share its appender, so they are cut by
+  // the same thread; the builders are created before the threads start
+  struct Group {
+    LabelId label;
+    std::vector<std::unique_ptr<arrow::RecordBatchBuilder>*> builders;
+    std::vector<std::vector<std::shared_ptr<arrow::RecordBatch>>> batches;
+  };
+  std::map<LabelId, Group> groups;
+  std::map<std::unique_ptr<arrow::RecordBatchBuilder>*, size_t> slots;
+  for (size_t i = 0; i < labels.size(); ++i) {
+    auto& group = groups[labels[i]];
+    group.label = labels[i];
+    auto* builder = &edgeBuilder(labels[i], src_labels[i], dst_labels[i]);
+    auto slot = slots.find(builder);
+    if (slot == slots.end()) {
+      slot = slots.emplace(builder, group.builders.size()).first;
+      group.builders.push_back(builder);
+      group.batches.emplace_back();
+    }
+    group.batches[slot->second].push_back(batches[i]);
+  }
+  std::vector<Group*> group_list;
+  for (auto& group : groups) {
+    group_list.push_back(&group.second);
+  }
+  std::vector<std::vector<std::shared_ptr<arrow::RecordBatch>>> chunks(
+      groups.size());
+  parallel_for_labels(group_list.size(), [&](size_t i) {
+    Group& group = *group_list[i];
+    auto const& appender = edge_appenders_.at(group.label);
+    for (size_t k = 0; k < group.builders.size(); ++k) {
+      cutChunks(*group.builders[k], appender, group.batches[k], chunks[i]);
+    }
+  });
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    for (auto const& chunk : chunks[i]) {
+      this->buildTableChunk(chunk, edge_stream_, 2,
+                            edge_property_id_mapping_[group_list[i]->label]);
+    }
+  }
+  return 0;
+}
+
+int PropertyGraphOutStream::SetChunkSize(int64_t rows) {
+  if (rows <= 0) {
+    return -1;
+  }
+  for (auto const& vertices : vertex_builders_) {
+    if (vertices.second->GetField(0)->length() != 0) {
+      return -1;
+    }
+  }
+  for (auto const& edges : edge_builders_) {
+    for (auto const& subedges : edges.second) {
+      if (subedges.second->GetField(0)->length() != 0) {
+        return -1;
+      }
+    }
+  }
+  chunk_size_ = rows;
+  // the appenders flush when a builder reaches its initial capacity
+  for (auto& vertices : vertex_builders_) {
+    vertices.second = makeBuilder(vertices.second->schema());
+  }
+  for (auto& edges : edge_builders_) {
+    for (auto& subedges : edges.second) {
+      subedges.second = makeBuilder(subedges.second->schema());
+    }
+  }
+  return 0;
+}
+
+int PropertyGraphOutStream::SetCompression(std::string const& codec) {
+  if (codec != "none" && !detail::CanCompressChunks(codec)) {
+    return -1;
+  }
+  compression_ = codec;
+  return 0;
+}
+
 Status PropertyGraphOutStream::Abort() {
   VINEYARD_CHECK_OK(vertex_stream_->Abort());
   VINEYARD_CHECK_OK(edge_stream_->Abort());
@@ -423,13 +1185,10 @@ void PropertyGraphOutStream::initialTables() {
         schema->AddField(0, arrow::field(field_name, vertex_id_type)));
 #endif
 
-    std::unique_ptr<arrow::RecordBatchBuilder> builder = nullptr;
-    CHECK_ARROW_ERROR(arrow::RecordBatchBuilder::Make(
-        schema, arrow::default_memory_pool(), kDefaultBufferSize, &builder));
-    vertex_builders_.emplace(entry.id, std::move(builder));
+    vertex_builders_.emplace(entry.id, makeBuilder(schema));
     vertex_schemas_.emplace(entry.id, schema);
     vertex_appenders_.emplace(
-        entry.id, std::make_shared<detail::PropertyTableAppender>(schema));
+        entry.id, std::make_shared<detail::PropertyTableAppender>(schema, 1));
   }
   for (auto const& entry : graph_schema_->EdgeEntries()) {
     auto schema = detail::ToArrowSchema(entry);
@@ -476,15 +1235,12 @@ void PropertyGraphOutStream::initialTables() {
         metadata->Append("dst_label", rel.second);
         auto subschema = schema->WithMetadata(metadata);
 
-        std::unique_ptr<arrow::RecordBatchBuilder> builder = nullptr;
-        CHECK_ARROW_ERROR(arrow::RecordBatchBuilder::Make(
-            subschema, arrow::default_memory_pool(), kDefaultBufferSize, &builder));
-        edge_builders_[entry.id][src_dst_key].reset(builder.release());
+        edge_builders_[entry.id][src_dst_key] = makeBuilder(subschema);
       }
     }
     edge_schemas_.emplace(entry.id, schema);
     edge_appenders_.emplace(
-        entry.id, std::make_shared<detail::PropertyTableAppender>(schema));
+        entry.id, std::make_shared<detail::PropertyTableAppender>(schema, 2));
   }
 }
 
@@ -508,37 +1264,110 @@ void PropertyGraphOutStream::buildTableChunk(
   LOG(INFO) << "chunk schema: batch is (" << batch->num_rows() << ", " << batch->num_columns() << ")";
   LOG(INFO) << "chunk schema: batch is " << batch->schema()->ToString();
 #endif
-  auto status = output_stream->WriteBatch(batch);
+  auto status = this->writeBatch(batch, output_stream);
   if (!status.ok()) {
     LOG(ERROR) << "Failed to write recordbatch to stream: " << status.ToString();
   }
 }
 
+Status PropertyGraphOutStream::writeBatch(
+    std::shared_ptr<arrow::RecordBatch> const& batch,
+    std::shared_ptr<vineyard::RecordBatchStream> &output_stream) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::duration<double>(backpressure_timeout_seconds_);
+  auto backoff = std::chrono::milliseconds(1);
+  std::shared_ptr<arrow::RecordBatch> chunk = batch;
+  if (compression_ != "none") {
+    auto status = detail::CompressChunk(batch, compression_, chunk);
+    if (!status.ok()) {
+      LOG(ERROR) << "Failed to compress chunk, writing it as is: "
+                 << status.ToString();
+      chunk = batch;
+    }
+  }
+  while (true) {
+    auto status = output_stream->WriteBatch(chunk);
+    if (!status.IsNotEnoughMemory() ||
+        std::chrono::steady_clock::now() >= deadline) {
+      return status;
+    }
+    // the consumers free the chunks they've read
+    std::this_thread::sleep_for(backoff);
+    backoff = std::min(backoff * 2, std::chrono::milliseconds(100));
+  }
+}
+
+void PropertyGraphOutStream::buildVertexChunk(
+    LabelId label, std::shared_ptr<arrow::RecordBatch> batch) {
+  this->buildTableChunk(vertexChunk(label, batch), vertex_stream_, 1,
+                        vertex_property_id_mapping_[label]);
+}
+
+std::shared_ptr<arrow::RecordBatch> PropertyGraphOutStream::vertexChunk(
+    LabelId label, std::shared_ptr<arrow::RecordBatch> batch) const {
+  size_t primary_key_column = vertex_primary_key_column_.at(label);
+  if (batch != nullptr && primary_key_column != kNoPrimaryKeyColumn) {
+#if defined(ARROW_VERSION) && ARROW_VERSION < 17000
+    CHECK_ARROW_ERROR(batch->RemoveColumn(primary_key_column, &batch));
+#else
+    CHECK_ARROW_ERROR_AND_ASSIGN(batch, batch->RemoveColumn(primary_key_column));
+#endif
+  }
+  return batch;
+}
+
+std::unique_ptr<arrow::RecordBatchBuilder>& PropertyGraphOutStream::edgeBuilder(
+    LabelId label, LabelId src_label, LabelId dst_label) {
+  auto src_dst_key = std::make_pair(src_label, dst_label);
+  auto &builder = edge_builders_[label][src_dst_key];
+  if (builder == nullptr) {
+    std::shared_ptr<arrow::KeyValueMetadata> metadata;
+    if (edge_schemas_[label]->metadata() != nullptr) {
+      metadata = edge_schemas_[label]->metadata()->Copy();
+    } else {
+      metadata.reset(new arrow::KeyValueMetadata());
+    }
+    metadata->Append("src_label_id", std::to_string(src_label));
+    metadata->Append("src_label", graph_schema_->GetLabelName(src_label));
+    metadata->Append("dst_label_id", std::to_string(dst_label));
+    metadata->Append("dst_label", graph_schema_->GetLabelName(dst_label));
+    builder = makeBuilder(edge_schemas_[label]->WithMetadata(metadata));
+  }
+  return builder;
+}
+
+std::unique_ptr<arrow::RecordBatchBuilder> PropertyGraphOutStream::makeBuilder(
+    std::shared_ptr<arrow::Schema> const& schema) const {
+  std::unique_ptr<arrow::RecordBatchBuilder> builder = nullptr;
+  CHECK_ARROW_ERROR(arrow::RecordBatchBuilder::Make(
+      schema, arrow::default_memory_pool(), chunk_size_, &builder));
+  return builder;
+}
+
 int PropertyGraphOutStream::FinishAllVertices() {
   LOG(INFO) << "vertex_finished_ = " << vertex_finished_ << ", " << this;
   if (vertex_finished_) {
     return 0;
   }
-  for (auto& vertices : vertex_builders_) {
-    auto &builder = vertices.second;
-    auto appender = vertex_appenders_[vertices.first];
-    VINEYARD_ASSERT(builder != nullptr && appender != nullptr);
-    std::shared_ptr<arrow::RecordBatch> batch = nullptr;
-    appender->Flush(builder, batch, true);
+  // the labels are sealed concurrently, and written in order
+  std::vector<LabelId> labels;
+  for (auto const& vertices : vertex_builders_) {
+    VINEYARD_ASSERT(vertices.second != nullptr &&
+                    vertex_appenders_[vertices.first] != nullptr);
+    labels.push_back(vertices.first);
+  }
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches(labels.size());
+  parallel_for_labels(labels.size(), [&](size_t i) {
+    vertex_appenders_.at(labels[i])->Flush(vertex_builders_.at(labels[i]),
+                                           batches[i], true);
+    batches[i] = vertexChunk(labels[i], batches[i]);
+  });
+  for (size_t i = 0; i < labels.size(); ++i) {
 #ifndef NDEBUG
-    LOG(INFO) << "finish vertices: " << batch;
-#endif
-    if (batch != nullptr && vertex_primary_key_column_[vertices.first] != kNoPrimaryKeyColumn) {
-#if defined(ARROW_VERSION) && ARROW_VERSION < 17000
-      ARROW_OK_OR_RAISE(
-        batch->RemoveColumn(vertex_primary_key_column_[vertices.first], &batch));
-#else
-      CHECK_ARROW_ERROR_AND_ASSIGN(batch,
-        batch->RemoveColumn(vertex_primary_key_column_[vertices.first]));
+    LOG(INFO) << "finish vertices: " << batches[i];
 #endif
-    }
-    buildTableChunk(batch, vertex_stream_, 1,
-                    vertex_property_id_mapping_[vertices.first]);
+    buildTableChunk(batches[i], vertex_stream_, 1,
+                    vertex_property_id_mapping_[labels[i]]);
   }
   if (!vertex_stream_->IsOpen()) {
     VINEYARD_CHECK_OK(this->Open(vertex_stream_));
@@ -555,18 +1384,32 @@ int PropertyGraphOutStream::FinishAllEdges() {
   if (edge_finished_) {
     return 0;
   }
-  for (auto& edges : edge_builders_) {
-    for (auto &subedges: edges.second) {
-      auto &builder = subedges.second;
-      auto appender = edge_appenders_[edges.first];
-      VINEYARD_ASSERT(builder != nullptr && appender != nullptr);
+  // a label's builders share its appender, so one thread seals them all
+  std::vector<LabelId> labels;
+  for (auto const& edges : edge_builders_) {
+    VINEYARD_ASSERT(edge_appenders_[edges.first] != nullptr);
+    for (auto const& subedges : edges.second) {
+      VINEYARD_ASSERT(subedges.second != nullptr);
+    }
+    labels.push_back(edges.first);
+  }
+  std::vector<std::vector<std::shared_ptr<arrow::RecordBatch>>> batches(
+      labels.size());
+  parallel_for_labels(labels.size(), [&](size_t i) {
+    auto const& appender = edge_appenders_.at(labels[i]);
+    for (auto& subedges : edge_builders_.at(labels[i])) {
       std::shared_ptr<arrow::RecordBatch> batch = nullptr;
-      appender->Flush(builder, batch, true);
+      appender->Flush(subedges.second, batch, true);
+      batches[i].push_back(batch);
+    }
+  });
+  for (size_t i = 0; i < labels.size(); ++i) {
+    for (auto const& batch : batches[i]) {
 #ifndef NDEBUG
-    LOG(INFO) << "finish edges: " << batch;
+      LOG(INFO) << "finish edges: " << batch;
 #endif
       buildTableChunk(batch, edge_stream_, 2,
-                      edge_property_id_mapping_[edges.first]);
+                      edge_property_id_mapping_[labels[i]]);
     }
   }
   if (!edge_stream_->IsOpen()) {
@@ -579,6 +1422,76 @@ int PropertyGraphOutStream::FinishAllEdges() {
   return 0;
 }
 
+PropertyGraphInStream::PropertyGraphInStream(vineyard::Client& client,
+                                             PropertyGraphOutStream& stream,
+                                             bool vertex)
+    : vertex_stream_(stream.vertex_stream_),
+      edge_stream_(stream.edge_stream_),
+      graph_schema_(stream.graph_schema_),
+      vertex_(vertex) {
+  if (vertex) {
+    VINEYARD_CHECK_OK(vertex_stream_->OpenReader(&client));
+  } else {
+    VINEYARD_CHECK_OK(edge_stream_->OpenReader(&client));
+  }
+  const char* threads = getenv("V6D_STREAM_DECOMPRESSION_THREADS");
+  decompression_threads_ = threads == nullptr ? 0 : std::max(0, atoi(threads));
+  const char* read_ahead = getenv("V6D_STREAM_READ_AHEAD");
+  read_ahead_ = read_ahead == nullptr ? 0 : std::max(0, atoi(read_ahead));
+}
+
+PropertyGraphInStream::~PropertyGraphInStream() {
+  if (pipeline_ != nullptr) {
+    pipeline_->Stop();
+  }
+}
+
+void PropertyGraphInStream::SetDecompressionThreads(int threads) {
+  decompression_threads_ = std::max(0, threads);
+}
+
+void PropertyGraphInStream::SetReadAhead(int chunks) {
+  read_ahead_ = std::max(0, chunks);
+}
+
+Status PropertyGraphInStream::GetNextLabelChunk(
+    Client& client, std::shared_ptr<arrow::RecordBatch>& batch) {
+  return pipeline()->NextOfLabel(batch);
+}
+
+void PropertyGraphInStream::LabelChunkDone(
+    std::shared_ptr<arrow::RecordBatch> const& batch) {
+  pipeline()->Done(detail::ChunkLabel(batch));
+}
+
+std::shared_ptr<detail::ChunkPipeline> const& PropertyGraphInStream::pipeline() {
+  std::call_once(pipeline_once_, [this]() {
+    // by default as many chunks ahead as there are threads to decompress
+    // them, twice
+    size_t window = read_ahead_ > 0
+                        ? static_cast<size_t>(read_ahead_)
+                        : 2 * static_cast<size_t>(decompression_threads_);
+    pipeline_ = std::make_shared<detail::ChunkPipeline>(
+        vertex_ ? vertex_stream_ : edge_stream_, window);
+    pipeline_->Start(decompression_threads_);
+  });
+  return pipeline_;
+}
+
+Status PropertyGraphInStream::next(
+    std::shared_ptr<vineyard::RecordBatchStream> const& stream,
+    std::shared_ptr<arrow::RecordBatch>& batch) {
+  if (decompression_threads_ == 0 && read_ahead_ == 0) {
+    auto status = stream->ReadBatch(batch, true);
+    if (status.ok() && detail::IsCompressedChunk(batch)) {
+      std::shared_ptr<arrow::RecordBatch> chunk = batch;
+      status = detail::DecompressChunk(chunk, batch);
+    }
+    return status;
+  }
+  return pipeline()->Next(batch);
+}
+
 void GlobalPGStream::Construct(const ObjectMeta& meta) {
   std::string __type_name = type_name<GlobalPGStream>();
   CHECK(meta.GetTypeName() == __type_name);
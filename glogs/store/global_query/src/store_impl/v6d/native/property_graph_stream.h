@@ -20,6 +20,7 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <unordered_map>
@@ -69,7 +70,7 @@ struct AppendProperty<bool> {
     vineyard::htap::htap_types::PodProperties pp;
     pp.long_value = prop->len;
     CHECK_ARROW_ERROR(
-        dynamic_cast<arrow::BooleanBuilder*>(builder)->Append(pp.bool_value));
+        static_cast<arrow::BooleanBuilder*>(builder)->Append(pp.bool_value));
   }
 };
 
@@ -79,7 +80,7 @@ struct AppendProperty<char> {
     vineyard::htap::htap_types::PodProperties pp;
     pp.long_value = prop->len;
     CHECK_ARROW_ERROR(
-        dynamic_cast<arrow::Int8Builder*>(builder)->Append(pp.char_value));
+        static_cast<arrow::Int8Builder*>(builder)->Append(pp.char_value));
   }
 };
 
@@ -89,7 +90,7 @@ struct AppendProperty<int16_t> {
     vineyard::htap::htap_types::PodProperties pp;
     pp.long_value = prop->len;
     CHECK_ARROW_ERROR(
-        dynamic_cast<arrow::Int16Builder*>(builder)->Append(pp.int16_value));
+        static_cast<arrow::Int16Builder*>(builder)->Append(pp.int16_value));
   }
 };
 
@@ -99,7 +100,7 @@ struct AppendProperty<int32_t> {
     vineyard::htap::htap_types::PodProperties pp;
     pp.long_value = prop->len;
     CHECK_ARROW_ERROR(
-        dynamic_cast<arrow::Int32Builder*>(builder)->Append(pp.int_value));
+        static_cast<arrow::Int32Builder*>(builder)->Append(pp.int_value));
   }
 };
 
@@ -107,7 +108,7 @@ template <>
 struct AppendProperty<int64_t> {
   static void append(arrow::ArrayBuilder* builder, Property const* prop) {
     CHECK_ARROW_ERROR(
-        dynamic_cast<arrow::Int64Builder*>(builder)->Append(prop->len));
+        static_cast<arrow::Int64Builder*>(builder)->Append(prop->len));
   }
 };
 
@@ -117,7 +118,7 @@ struct AppendProperty<float> {
     vineyard::htap::htap_types::PodProperties pp;
     pp.long_value = prop->len;
     CHECK_ARROW_ERROR(
-        dynamic_cast<arrow::FloatBuilder*>(builder)->Append(pp.float_value));
+        static_cast<arrow::FloatBuilder*>(builder)->Append(pp.float_value));
   }
 };
 
@@ -127,14 +128,14 @@ struct AppendProperty<double> {
     vineyard::htap::htap_types::PodProperties pp;
     pp.long_value = prop->len;
     CHECK_ARROW_ERROR(
-        dynamic_cast<arrow::DoubleBuilder*>(builder)->Append(pp.double_value));
+        static_cast<arrow::DoubleBuilder*>(builder)->Append(pp.double_value));
   }
 };
 
 template <>
 struct AppendProperty<std::string> {
   static void append(arrow::ArrayBuilder* builder, Property const* prop) {
-    CHECK_ARROW_ERROR(dynamic_cast<arrow::LargeStringBuilder*>(builder)->Append(
+    CHECK_ARROW_ERROR(static_cast<arrow::LargeStringBuilder*>(builder)->Append(
         static_cast<uint8_t*>(prop->data), prop->len));
   }
 };
@@ -143,23 +144,44 @@ template <>
 struct AppendProperty<void> {
   static void append(arrow::ArrayBuilder* builder, Property const* prop) {
     CHECK_ARROW_ERROR(
-        dynamic_cast<arrow::NullBuilder*>(builder)->Append(nullptr));
+        static_cast<arrow::NullBuilder*>(builder)->Append(nullptr));
   }
 };
 
 template <typename T>
 void generic_appender(arrow::ArrayBuilder* builder, T const& value) {
   CHECK_ARROW_ERROR(
-      dynamic_cast<typename ConvertToArrowType<T>::BuilderType*>(builder)
+      static_cast<typename ConvertToArrowType<T>::BuilderType*>(builder)
           ->Append(value));
 }
 
 using property_appender_func = void (*)(arrow::ArrayBuilder*,
                                         Property const* prop);
 
+// Appends whole runs of rows to a table of one of the common schemas (see
+// MakeTypedTableAppender), with one typed AppendValues per column instead of
+// a call through property_appender_func per cell.
+class TypedTableAppender {
+ public:
+  virtual ~TypedTableAppender() = default;
+
+  // keys[k] gives the n values of the k-th id column; the properties come
+  // row by row, each row with every property column in order
+  virtual void AppendRows(arrow::RecordBatchBuilder* builder,
+                          VertexId const* const* keys, size_t n,
+                          Property const* properties) = 0;
+};
+
+// nullptr if the schema isn't one of the specialised ones
+std::unique_ptr<TypedTableAppender> MakeTypedTableAppender(
+    std::shared_ptr<arrow::Schema> const& schema, size_t key_columns);
+
 class PropertyTableAppender {
  public:
-  explicit PropertyTableAppender(std::shared_ptr<arrow::Schema> schema);
+  // key_columns: the id columns in front of the properties, 1 for vertices
+  // and 2 (src and dst) for edges
+  PropertyTableAppender(std::shared_ptr<arrow::Schema> schema,
+                        size_t key_columns);
 
   // apply for vertex values and properties.
   void Apply(std::unique_ptr<arrow::RecordBatchBuilder>& builder, VertexId id,
@@ -175,6 +197,16 @@ class PropertyTableAppender {
              std::map<int, int> const& property_id_mapping,
              std::shared_ptr<arrow::RecordBatch>& batch_out);
 
+  // Applies n rows at once, vertices if dst_ids is nullptr and edges
+  // otherwise, and flushes a batch into batches_out whenever the builder is
+  // full. Runs of rows giving every property in column order take the typed
+  // path, the others go through Apply one by one.
+  void ApplyBatch(std::unique_ptr<arrow::RecordBatchBuilder>& builder,
+                  size_t n, VertexId const* src_ids, VertexId const* dst_ids,
+                  size_t const* property_sizes, Property* properties,
+                  std::map<int, int> const& property_id_mapping,
+                  std::vector<std::shared_ptr<arrow::RecordBatch>>& batches_out);
+
   void Flush(std::unique_ptr<arrow::RecordBatchBuilder>& builder,
              std::shared_ptr<arrow::RecordBatch>& batches_out,
              const bool allow_empty = false);
@@ -182,8 +214,33 @@ class PropertyTableAppender {
  private:
   std::vector<property_appender_func> funcs_;
   size_t col_num_;
+  size_t key_columns_;
+  std::unique_ptr<TypedTableAppender> typed_;
 };
 
+// Chunks compressed for the transfer: a batch of one row holding the chunk
+// as an Arrow IPC stream with compressed bodies, its schema's metadata
+// naming the codec, so that readers decompress whatever they are given.
+// The codec is "lz4" or "zstd"; NotImplemented for others and on Arrow
+// releases before 4.0, which can't compress IPC bodies.
+Status CompressChunk(std::shared_ptr<arrow::RecordBatch> const& batch,
+                     std::string const& codec,
+                     std::shared_ptr<arrow::RecordBatch>& out);
+// whether CompressChunk takes codec here
+bool CanCompressChunks(std::string const& codec);
+bool IsCompressedChunk(std::shared_ptr<arrow::RecordBatch> const& batch);
+Status DecompressChunk(std::shared_ptr<arrow::RecordBatch> const& batch,
+                       std::shared_ptr<arrow::RecordBatch>& out);
+
+// V6D_STREAM_COMPRESSION, "none" if unset
+std::string DefaultStreamCompression();
+
+// the label_id in the chunk's schema metadata, -1 if there is none
+int64_t ChunkLabel(std::shared_ptr<arrow::RecordBatch> const& batch);
+
+// reads chunks ahead and decompresses them, see property_graph_stream.cc
+class ChunkPipeline;
+
 }  // namespace detail
 
 class PropertyGraphInStream;
@@ -288,6 +345,47 @@ class PropertyGraphOutStream : public Registered<PropertyGraphOutStream> {
                 LabelId* dst_labels, size_t* property_sizes,
                 Property* properties);
 
+  // Columnar appends of whole batches, whose columns are those of the label's
+  // table (the id, or source and destination ids, then every property). Rows
+  // added one at a time before are flushed first, then the batch is written
+  // in chunks of the chunk size without copying. -1 if the schema differs.
+  int AddVertexBatch(LabelId label,
+                     std::shared_ptr<arrow::RecordBatch> const& batch);
+
+  int AddEdgeBatch(LabelId label, LabelId src_label, LabelId dst_label,
+                   std::shared_ptr<arrow::RecordBatch> const& batch);
+
+  // Columnar appends of many batches at once, e.g. one per label: all are
+  // checked against their schemas before any is written (-1 and nothing
+  // written otherwise), then each label's pending rows and batches are cut
+  // into chunks on a thread of its own, and the chunks are written label by
+  // label, in the order given within a label.
+  int AddVertexBatches(
+      std::vector<LabelId> const& labels,
+      std::vector<std::shared_ptr<arrow::RecordBatch>> const& batches);
+
+  int AddEdgeBatches(
+      std::vector<LabelId> const& labels, std::vector<LabelId> const& src_labels,
+      std::vector<LabelId> const& dst_labels,
+      std::vector<std::shared_ptr<arrow::RecordBatch>> const& batches);
+
+  // rows per chunk written to the streams, before any row is added; -1 once
+  // rows are pending
+  int SetChunkSize(int64_t rows);
+
+  // Backpressure: when vineyard has no memory for another chunk, i.e. the
+  // consumers lag behind, the writer waits until they have read enough, for
+  // up to this long before failing.
+  void SetBackpressureTimeout(double seconds) {
+    backpressure_timeout_seconds_ = seconds;
+  }
+
+  // Compresses the chunks written from now on with codec, "lz4" or "zstd",
+  // or not with "none"; V6D_STREAM_COMPRESSION sets the default. Each chunk
+  // names its codec, so the readers need no setting. -1 for other codecs
+  // and where Arrow can't compress IPC bodies.
+  int SetCompression(std::string const& codec);
+
   Status Abort();
 
   Status Finish();
@@ -302,6 +400,39 @@ class PropertyGraphOutStream : public Registered<PropertyGraphOutStream> {
                        std::shared_ptr<vineyard::RecordBatchStream> &output_stream,
                        int const property_offset,
                        std::map<int, int> const& property_id_mapping);
+  // a run of vertices, or edges, sharing the label (and src and dst labels)
+  int addVertexRun(LabelId label, size_t n, VertexId* ids,
+                   size_t* property_sizes, Property* properties);
+  int addEdgeRun(LabelId label, LabelId src_label, LabelId dst_label, size_t n,
+                 VertexId* src_ids, VertexId* dst_ids, size_t* property_sizes,
+                 Property* properties);
+  // drops the primary key column, which the fragment gets from the id
+  void buildVertexChunk(LabelId label, std::shared_ptr<arrow::RecordBatch> batch);
+  std::shared_ptr<arrow::RecordBatch> vertexChunk(
+      LabelId label, std::shared_ptr<arrow::RecordBatch> batch) const;
+  bool checkVertexBatch(LabelId label,
+                        std::shared_ptr<arrow::RecordBatch> const& batch) const;
+  bool checkEdgeBatch(LabelId label,
+                      std::shared_ptr<arrow::RecordBatch> const& batch) const;
+  // the pending rows of the builder, then the batches, in chunks of the
+  // chunk size with the builder's schema; touches nothing but the builder,
+  // so builders of different labels may be cut concurrently
+  void cutChunks(std::unique_ptr<arrow::RecordBatchBuilder>& builder,
+                 std::shared_ptr<detail::PropertyTableAppender> const& appender,
+                 std::vector<std::shared_ptr<arrow::RecordBatch>> const& batches,
+                 std::vector<std::shared_ptr<arrow::RecordBatch>>& chunks) const;
+  std::unique_ptr<arrow::RecordBatchBuilder>& edgeBuilder(LabelId label,
+                                                          LabelId src_label,
+                                                          LabelId dst_label);
+  std::unique_ptr<arrow::RecordBatchBuilder> makeBuilder(
+      std::shared_ptr<arrow::Schema> const& schema) const;
+  Status writeBatch(std::shared_ptr<arrow::RecordBatch> const& batch,
+                    std::shared_ptr<vineyard::RecordBatchStream> &output_stream);
+
+  static constexpr int64_t kDefaultChunkSize = 1024 * 128;
+  int64_t chunk_size_ = kDefaultChunkSize;
+  double backpressure_timeout_seconds_ = 600;
+  std::string compression_ = detail::DefaultStreamCompression();
 
   std::shared_ptr<htap::MGPropertyGraphSchema> graph_schema_;
 
@@ -337,25 +468,37 @@ class PropertyGraphOutStream : public Registered<PropertyGraphOutStream> {
 
 class PropertyGraphInStream {
  public:
-  explicit PropertyGraphInStream(vineyard::Client &client, PropertyGraphOutStream& stream, bool vertex)
-      : vertex_stream_(stream.vertex_stream_),
-        edge_stream_(stream.edge_stream_),
-        graph_schema_(stream.graph_schema_) {
-    if (vertex) {
-      VINEYARD_CHECK_OK(vertex_stream_->OpenReader(&client));
-    } else {
-      VINEYARD_CHECK_OK(edge_stream_->OpenReader(&client));
-    }
-  }
+  explicit PropertyGraphInStream(vineyard::Client &client, PropertyGraphOutStream& stream, bool vertex);
+  ~PropertyGraphInStream();
+
+  // Reads chunks ahead and decompresses them on this many threads, handing
+  // them out in stream order; 0 decompresses on the reading thread. The
+  // default is V6D_STREAM_DECOMPRESSION_THREADS. Set before the first read.
+  void SetDecompressionThreads(int threads);
+
+  // Reads up to this many chunks ahead on a background thread, overlapping
+  // the transfer with the consumer's work; 0, by default twice the
+  // decompression threads. The default is V6D_STREAM_READ_AHEAD. Set before
+  // the first read.
+  void SetReadAhead(int chunks);
+
+  // For consumers on several threads that need each label's chunks in
+  // stream order: the next chunk of the stream opened whose label no other
+  // consumer holds, once the earlier chunks of its label are done. The
+  // label is held until LabelChunkDone is called with the chunk. Reads
+  // ahead as SetReadAhead sets, one chunk at the least.
+  Status GetNextLabelChunk(Client& client,
+                           std::shared_ptr<arrow::RecordBatch>& batch);
+  void LabelChunkDone(std::shared_ptr<arrow::RecordBatch> const& batch);
 
   Status GetNextVertices(Client& client,
                          std::shared_ptr<arrow::RecordBatch>& vertices) {
-    return vertex_stream_->ReadBatch(vertices, true);
+    return next(vertex_stream_, vertices);
   }
 
   Status GetNextEdges(Client& client,
                       std::shared_ptr<arrow::RecordBatch>& edges) {
-    return edge_stream_->ReadBatch(edges, true);
+    return next(edge_stream_, edges);
   }
 
   std::shared_ptr<MGPropertyGraphSchema> graph_schema() const {
@@ -363,9 +506,19 @@ class PropertyGraphInStream {
   }
 
  private:
+  Status next(std::shared_ptr<vineyard::RecordBatchStream> const& stream,
+              std::shared_ptr<arrow::RecordBatch>& batch);
+  // started by the first read that needs it
+  std::shared_ptr<detail::ChunkPipeline> const& pipeline();
+
   std::shared_ptr<vineyard::RecordBatchStream> vertex_stream_;
   std::shared_ptr<vineyard::RecordBatchStream> edge_stream_;
   std::shared_ptr<MGPropertyGraphSchema> graph_schema_;
+  bool vertex_;  // which stream was opened
+  int decompression_threads_;
+  int read_ahead_;
+  std::once_flag pipeline_once_;
+  std::shared_ptr<detail::ChunkPipeline> pipeline_;
 };
 
 class GlobalPGStreamBuilder;